@@ -0,0 +1,45 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2019 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+
+#pragma once
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <libmogwai-schedule-client/schedule-entry.h>
+
+G_BEGIN_DECLS
+
+void mwsc_schedule_entry_handle_signal (MwscScheduleEntry *self,
+                                        const gchar       *sender_name,
+                                        const gchar       *interface_name,
+                                        const gchar       *signal_name,
+                                        GVariant          *parameters);
+void mwsc_schedule_entry_disconnected  (MwscScheduleEntry *self);
+void mwsc_schedule_entry_reconnected   (MwscScheduleEntry *self,
+                                        GDBusProxy        *proxy);
+
+MwscScheduleEntry *mwsc_schedule_entry_new_shared (GDBusProxy   *proxy,
+                                                   const gchar  *service_name,
+                                                   GError      **error);
+
+G_END_DECLS
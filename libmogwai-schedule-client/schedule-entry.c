@@ -28,6 +28,7 @@
 #include <gio/gio.h>
 #include <libmogwai-schedule/schedule-entry-interface.h>
 #include <libmogwai-schedule-client/schedule-entry.h>
+#include <libmogwai-schedule-client/schedule-entry-private.h>
 #include <string.h>
 
 
@@ -74,6 +75,9 @@ static void proxy_notify_name_owner_cb (GObject     *obj,
                                         GParamSpec  *pspec,
                                         gpointer     user_data);
 
+static void connect_proxy_signals      (MwscScheduleEntry *self);
+static void disconnect_proxy_signals   (MwscScheduleEntry *self);
+
 /**
  * MwscScheduleEntry:
  *
@@ -115,6 +119,12 @@ static void proxy_notify_name_owner_cb (GObject     *obj,
  * emitted, and all future method calls on the object will return a
  * %MWSC_SCHEDULE_ENTRY_ERROR_INVALIDATED error.
  *
+ * The exception is entries returned by mwsc_scheduler_schedule_entries_async()
+ * or mwsc_scheduler_list_entries_async() on a #MwscScheduler for an activatable
+ * well-known name: they survive the service exiting, and are reconnected to the
+ * next instance of the service if it still knows about them. Method calls on
+ * them start the service again if needed.
+ *
  * Since: 0.1.0
  */
 struct _MwscScheduleEntry
@@ -126,6 +136,12 @@ struct _MwscScheduleEntry
   gchar *name;  /* (owned); NULL if not running on a message bus */
   gchar *object_path;  /* (owned) */
 
+  /* Well-known name to send method calls to, allowing them to start the
+   * service, for entries shared by a #MwscScheduler which survives the service
+   * restarting. Otherwise, calls go to the name of @proxy, without
+   * auto-starting. See mwsc_schedule_entry_new_shared(). */
+  gchar *service_name;  /* (owned) (nullable) */
+
   /* Exactly one of these will be set after initialisation completes (or
    * fails). */
   GError *init_error;  /* nullable; owned */
@@ -134,6 +150,10 @@ struct _MwscScheduleEntry
 
   gboolean resumable;
   guint32 priority;
+  guint64 expected_size;
+  guint64 deadline;
+  gboolean bind_to_connection;
+  guint64 downloaded_size;
 };
 
 typedef enum
@@ -146,6 +166,13 @@ typedef enum
   PROP_DOWNLOAD_NOW,
   PROP_RESUMABLE,
   PROP_PRIORITY,
+  PROP_EXPECTED_SIZE,
+  PROP_DEADLINE,
+  PROP_BIND_TO_CONNECTION,
+  PROP_CONNECTION_ID,
+  PROP_MAX_RATE,
+  PROP_DOWNLOAD_STARTS_AT,
+  PROP_DOWNLOADED_SIZE,
 } MwscScheduleEntryProperty;
 
 G_DEFINE_TYPE_WITH_CODE (MwscScheduleEntry, mwsc_schedule_entry, G_TYPE_OBJECT,
@@ -158,7 +185,7 @@ static void
 mwsc_schedule_entry_class_init (MwscScheduleEntryClass *klass)
 {
   GObjectClass *object_class = (GObjectClass *) klass;
-  GParamSpec *props[PROP_PRIORITY + 1] = { NULL, };
+  GParamSpec *props[PROP_DOWNLOADED_SIZE + 1] = { NULL, };
 
   object_class->constructed = mwsc_schedule_entry_constructed;
   object_class->dispose = mwsc_schedule_entry_dispose;
@@ -291,6 +318,131 @@ mwsc_schedule_entry_class_init (MwscScheduleEntryClass *klass)
                          0, G_MAXUINT32, 0,
                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
 
+  /**
+   * MwscScheduleEntry:expected-size:
+   *
+   * The number of bytes this application expects the download to transfer, or
+   * zero if that isn’t known. The scheduler may use this to let small downloads
+   * complete before large ones of the same priority.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_EXPECTED_SIZE] =
+      g_param_spec_uint64 ("expected-size", "Expected Size",
+                           "Number of bytes this download is expected to "
+                           "transfer, or zero if unknown.",
+                           0, G_MAXUINT64, 0,
+                           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwscScheduleEntry:deadline:
+   *
+   * The time by which this application would like the download to have
+   * started, in seconds since the Unix epoch, or zero if it has no deadline.
+   * Setting a deadline allows the scheduler to defer the download to a cheaper
+   * tariff period which starts before the deadline.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_DEADLINE] =
+      g_param_spec_uint64 ("deadline", "Deadline",
+                           "Time by which this download should have started, "
+                           "or zero for no deadline.",
+                           0, G_MAXUINT64, 0,
+                           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwscScheduleEntry:bind-to-connection:
+   *
+   * Whether this application can bind the download to a specific network
+   * connection, given by #MwscScheduleEntry:connection-id. If %TRUE, the
+   * scheduler may allow the download when only some of the network connections
+   * are safe to download on; the application must then only use the given
+   * connection for it.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_BIND_TO_CONNECTION] =
+      g_param_spec_boolean ("bind-to-connection", "Bind to Connection",
+                            "Whether this download can be bound to a specific "
+                            "network connection.",
+                            FALSE,
+                            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwscScheduleEntry:connection-id:
+   *
+   * ID of the network connection which the scheduler has chosen for this
+   * download, or %NULL if none has been chosen. This is only set while
+   * #MwscScheduleEntry:download-now is %TRUE, and only if
+   * #MwscScheduleEntry:bind-to-connection is %TRUE. When the service uses
+   * NetworkManager, the ID is the ID of the NetworkManager connection.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_CONNECTION_ID] =
+      g_param_spec_string ("connection-id", "Connection ID",
+                           "ID of the network connection chosen for this "
+                           "download, if any.",
+                           NULL,
+                           G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwscScheduleEntry:max-rate:
+   *
+   * Hint from the scheduler for the maximum rate this download should proceed
+   * at, in bytes per second, or zero if it doesn’t need to be throttled. This
+   * is only set while #MwscScheduleEntry:download-now is %TRUE. It is
+   * calculated from the tariff of the network connection, so that the
+   * connection’s capacity limit isn’t reached early. The scheduler doesn’t
+   * enforce it; the download code should.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_MAX_RATE] =
+      g_param_spec_uint64 ("max-rate", "Max. Rate",
+                           "Maximum rate to download at, in bytes per second, "
+                           "or zero for no limit.",
+                           0, G_MAXUINT64, 0,
+                           G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwscScheduleEntry:download-starts-at:
+   *
+   * Prediction from the scheduler of when #MwscScheduleEntry:download-now will
+   * next become %TRUE, in seconds since the Unix epoch, or zero if the download
+   * is already active or the scheduler can’t predict when it will start. This
+   * is a hint, so that the download code can prepare (for example, by
+   * resolving mirrors and opening connections) shortly beforehand; it should
+   * still wait for #MwscScheduleEntry:download-now before downloading, as the
+   * prediction changes if the network connections or the other entries do.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_DOWNLOAD_STARTS_AT] =
+      g_param_spec_uint64 ("download-starts-at", "Download Starts At",
+                           "Predicted time the download will start, in "
+                           "seconds since the Unix epoch, or zero if unknown.",
+                           0, G_MAXUINT64, 0,
+                           G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwscScheduleEntry:downloaded-size:
+   *
+   * The number of bytes of the download which this application has transferred
+   * so far. Updating this periodically (and sending it with
+   * mwsc_schedule_entry_send_properties_async()) lets the scheduler avoid
+   * pausing non-resumable downloads which are nearly complete.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_DOWNLOADED_SIZE] =
+      g_param_spec_uint64 ("downloaded-size", "Downloaded Size",
+                           "Number of bytes of this download transferred so "
+                           "far.",
+                           0, G_MAXUINT64, 0,
+                           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (object_class, G_N_ELEMENTS (props), props);
 
   /**
@@ -305,6 +457,10 @@ mwsc_schedule_entry_class_init (MwscScheduleEntryClass *klass)
    * emitted are if the underlying D-Bus object disappears, or if the schedule
    * entry is removed by calling mwsc_schedule_entry_remove_async().
    *
+   * Entries which are shared with a #MwscScheduler that survives the service
+   * restarting are only invalidated on restart if the new instance of the
+   * service no longer has them (see #MwscScheduleEntry).
+   *
    * After this signal is emitted, all method calls to #MwscScheduleEntry
    * methods will return %MWSC_SCHEDULE_ENTRY_ERROR_INVALIDATED.
    *
@@ -362,18 +518,12 @@ mwsc_schedule_entry_dispose (GObject *object)
   MwscScheduleEntry *self = MWSC_SCHEDULE_ENTRY (object);
 
   if (self->proxy != NULL)
-    {
-      /* Disconnect from signals. */
-      g_signal_handlers_disconnect_by_func (self->proxy, properties_changed_cb,
-                                            self);
-      g_signal_handlers_disconnect_by_func (self->proxy, signal_cb, self);
-      g_signal_handlers_disconnect_by_func (self->proxy,
-                                            proxy_notify_name_owner_cb, self);
-    }
+    disconnect_proxy_signals (self);
 
   g_clear_object (&self->proxy);
   g_clear_object (&self->connection);
   g_clear_pointer (&self->name, g_free);
+  g_clear_pointer (&self->service_name, g_free);
   g_clear_pointer (&self->object_path, g_free);
   g_clear_error (&self->init_error);
 
@@ -418,6 +568,27 @@ mwsc_schedule_entry_get_property (GObject    *object,
     case PROP_PRIORITY:
       g_value_set_uint (value, self->priority);
       break;
+    case PROP_EXPECTED_SIZE:
+      g_value_set_uint64 (value, self->expected_size);
+      break;
+    case PROP_DEADLINE:
+      g_value_set_uint64 (value, self->deadline);
+      break;
+    case PROP_BIND_TO_CONNECTION:
+      g_value_set_boolean (value, self->bind_to_connection);
+      break;
+    case PROP_CONNECTION_ID:
+      g_value_set_string (value, mwsc_schedule_entry_get_connection_id (self));
+      break;
+    case PROP_MAX_RATE:
+      g_value_set_uint64 (value, mwsc_schedule_entry_get_max_rate (self));
+      break;
+    case PROP_DOWNLOAD_STARTS_AT:
+      g_value_set_uint64 (value, mwsc_schedule_entry_get_download_starts_at (self));
+      break;
+    case PROP_DOWNLOADED_SIZE:
+      g_value_set_uint64 (value, self->downloaded_size);
+      break;
     default:
       g_assert_not_reached ();
     }
@@ -470,6 +641,24 @@ mwsc_schedule_entry_set_property (GObject      *object,
     case PROP_PRIORITY:
       mwsc_schedule_entry_set_priority (self, g_value_get_uint (value));
       break;
+    case PROP_EXPECTED_SIZE:
+      mwsc_schedule_entry_set_expected_size (self, g_value_get_uint64 (value));
+      break;
+    case PROP_DEADLINE:
+      mwsc_schedule_entry_set_deadline (self, g_value_get_uint64 (value));
+      break;
+    case PROP_BIND_TO_CONNECTION:
+      mwsc_schedule_entry_set_bind_to_connection (self, g_value_get_boolean (value));
+      break;
+    case PROP_DOWNLOADED_SIZE:
+      mwsc_schedule_entry_set_downloaded_size (self, g_value_get_uint64 (value));
+      break;
+    case PROP_CONNECTION_ID:
+    case PROP_MAX_RATE:
+    case PROP_DOWNLOAD_STARTS_AT:
+      /* Read only. */
+      g_assert_not_reached ();
+      break;
     default:
       g_assert_not_reached ();
     }
@@ -483,12 +672,7 @@ schedule_entry_invalidate (MwscScheduleEntry *self,
 {
   g_assert (self->proxy != NULL);
 
-  /* Disconnect from signals. */
-  g_signal_handlers_disconnect_by_func (self->proxy, properties_changed_cb,
-                                        self);
-  g_signal_handlers_disconnect_by_func (self->proxy, signal_cb, self);
-  g_signal_handlers_disconnect_by_func (self->proxy,
-                                        proxy_notify_name_owner_cb, self);
+  disconnect_proxy_signals (self);
 
   /* Clear the proxy, which marks this #MwscScheduleEntry as invalidated. */
   g_debug ("Marking schedule entry ‘%s’ as invalidated due to error: %s",
@@ -559,6 +743,31 @@ properties_changed_cb (GDBusProxy *proxy,
   if (g_variant_dict_lookup (&dict, "Priority", "u", &priority))
     mwsc_schedule_entry_set_priority (self, priority);
 
+  guint64 expected_size;
+  if (g_variant_dict_lookup (&dict, "ExpectedSize", "t", &expected_size))
+    mwsc_schedule_entry_set_expected_size (self, expected_size);
+
+  guint64 deadline;
+  if (g_variant_dict_lookup (&dict, "Deadline", "t", &deadline))
+    mwsc_schedule_entry_set_deadline (self, deadline);
+
+  gboolean bind_to_connection;
+  if (g_variant_dict_lookup (&dict, "BindToConnection", "b", &bind_to_connection))
+    mwsc_schedule_entry_set_bind_to_connection (self, bind_to_connection);
+
+  guint64 downloaded_size;
+  if (g_variant_dict_lookup (&dict, "DownloadedSize", "t", &downloaded_size))
+    mwsc_schedule_entry_set_downloaded_size (self, downloaded_size);
+
+  if (g_variant_dict_contains (&dict, "Connection"))
+    g_object_notify (G_OBJECT (self), "connection-id");
+
+  if (g_variant_dict_contains (&dict, "MaxRate"))
+    g_object_notify (G_OBJECT (self), "max-rate");
+
+  if (g_variant_dict_contains (&dict, "DownloadStartsAt"))
+    g_object_notify (G_OBJECT (self), "download-starts-at");
+
   g_object_thaw_notify (G_OBJECT (self));
 }
 
@@ -604,6 +813,167 @@ proxy_notify_name_owner_cb (GObject    *obj,
     }
 }
 
+/* Handle a signal from the schedule entry object on the bus, which has been
+ * received by a #MwscScheduler on our behalf. This is used for entries whose
+ * proxy was created without its own signal subscriptions, so that the
+ * #MwscScheduler can use one subscription for all the entries it creates,
+ * rather than two per entry. See mwsc_scheduler_schedule_entries_async().
+ *
+ * PropertiesChanged signals are applied to the proxy’s property cache (which
+ * the proxy won’t do itself) before being handled as normal. */
+void
+mwsc_schedule_entry_handle_signal (MwscScheduleEntry *self,
+                                   const gchar       *sender_name,
+                                   const gchar       *interface_name,
+                                   const gchar       *signal_name,
+                                   GVariant          *parameters)
+{
+  g_return_if_fail (MWSC_IS_SCHEDULE_ENTRY (self));
+
+  /* Invalidated? */
+  if (self->proxy == NULL)
+    return;
+
+  if (g_str_equal (interface_name, "org.freedesktop.DBus.Properties") &&
+      g_str_equal (signal_name, "PropertiesChanged") &&
+      g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(sa{sv}as)")))
+    {
+      const gchar *changed_interface_name;
+      g_autoptr(GVariant) changed_properties = NULL;
+      g_autofree const gchar **invalidated_properties = NULL;
+
+      g_variant_get (parameters, "(&s@a{sv}^a&s)", &changed_interface_name,
+                     &changed_properties, &invalidated_properties);
+
+      if (!g_str_equal (changed_interface_name,
+                        g_dbus_proxy_get_interface_name (self->proxy)))
+        return;
+
+      GVariantIter iter;
+      const gchar *property_name;
+      GVariant *value;
+
+      g_variant_iter_init (&iter, changed_properties);
+      while (g_variant_iter_next (&iter, "{&sv}", &property_name, &value))
+        {
+          g_dbus_proxy_set_cached_property (self->proxy, property_name, value);
+          g_variant_unref (value);
+        }
+
+      for (gsize i = 0; invalidated_properties[i] != NULL; i++)
+        g_dbus_proxy_set_cached_property (self->proxy, invalidated_properties[i], NULL);
+
+      properties_changed_cb (self->proxy, changed_properties,
+                             (GStrv) invalidated_properties, self);
+    }
+  else if (g_str_equal (interface_name, g_dbus_proxy_get_interface_name (self->proxy)))
+    {
+      signal_cb (self->proxy, sender_name, signal_name, parameters, self);
+    }
+}
+
+/* Mark this entry as invalidated because the service has disconnected. This is
+ * used by #MwscScheduler for entries whose proxy doesn’t track its name owner;
+ * see mwsc_schedule_entry_handle_signal(). */
+void
+mwsc_schedule_entry_disconnected (MwscScheduleEntry *self)
+{
+  g_return_if_fail (MWSC_IS_SCHEDULE_ENTRY (self));
+
+  /* Invalidated? */
+  if (self->proxy == NULL)
+    return;
+
+  g_autoptr(GError) error = NULL;
+  g_set_error_literal (&error, G_DBUS_ERROR, G_DBUS_ERROR_DISCONNECTED,
+                       _("Schedule entry owner has disconnected."));
+  schedule_entry_invalidate (self, error);
+}
+
+/* Switch this entry over to @proxy, for the same object on a new instance of
+ * the service, with its properties already cached. This is used by
+ * #MwscScheduler for entries whose proxy doesn’t track its name owner, once the
+ * service has been restarted. Any properties which differ from those on the
+ * old instance are notified as if the service had signalled the change. */
+void
+mwsc_schedule_entry_reconnected (MwscScheduleEntry *self,
+                                 GDBusProxy        *proxy)
+{
+  g_return_if_fail (MWSC_IS_SCHEDULE_ENTRY (self));
+  g_return_if_fail (G_IS_DBUS_PROXY (proxy));
+
+  /* Invalidated? */
+  if (self->proxy == NULL)
+    return;
+
+  g_auto(GVariantDict) dict = G_VARIANT_DICT_INIT (NULL);
+  g_auto(GStrv) property_names = g_dbus_proxy_get_cached_property_names (proxy);
+
+  for (gsize i = 0; property_names != NULL && property_names[i] != NULL; i++)
+    {
+      g_autoptr(GVariant) old_value = NULL;
+      g_autoptr(GVariant) new_value = NULL;
+
+      old_value = g_dbus_proxy_get_cached_property (self->proxy, property_names[i]);
+      new_value = g_dbus_proxy_get_cached_property (proxy, property_names[i]);
+
+      if (old_value == NULL || !g_variant_equal (old_value, new_value))
+        g_variant_dict_insert_value (&dict, property_names[i], new_value);
+    }
+
+  g_debug ("Reconnecting schedule entry ‘%s’ to ‘%s’",
+           mwsc_schedule_entry_get_id (self), g_dbus_proxy_get_name (proxy));
+
+  disconnect_proxy_signals (self);
+  g_set_object (&self->proxy, proxy);
+  connect_proxy_signals (self);
+  g_object_notify (G_OBJECT (self), "proxy");
+
+  g_autoptr(GVariant) changed_properties = g_variant_ref_sink (g_variant_dict_end (&dict));
+  if (g_variant_n_children (changed_properties) > 0)
+    properties_changed_cb (self->proxy, changed_properties, NULL, self);
+}
+
+static void
+connect_proxy_signals (MwscScheduleEntry *self)
+{
+  g_signal_connect (self->proxy, "g-properties-changed",
+                    (GCallback) properties_changed_cb, self);
+  g_signal_connect (self->proxy, "g-signal", (GCallback) signal_cb, self);
+
+  /* Proxies without their own signal subscriptions are shared with a
+   * #MwscScheduler, which tracks the name owner for them and calls
+   * mwsc_schedule_entry_disconnected() or mwsc_schedule_entry_reconnected(). */
+  if (!(g_dbus_proxy_get_flags (self->proxy) & G_DBUS_PROXY_FLAGS_DO_NOT_CONNECT_SIGNALS))
+    g_signal_connect (self->proxy, "notify::g-name-owner",
+                      (GCallback) proxy_notify_name_owner_cb, self);
+}
+
+static void
+disconnect_proxy_signals (MwscScheduleEntry *self)
+{
+  g_signal_handlers_disconnect_by_func (self->proxy, properties_changed_cb,
+                                        self);
+  g_signal_handlers_disconnect_by_func (self->proxy, signal_cb, self);
+  g_signal_handlers_disconnect_by_func (self->proxy,
+                                        proxy_notify_name_owner_cb, self);
+}
+
+/* Get the destination and flags for a method call on this entry. */
+static const gchar *
+get_call_destination (MwscScheduleEntry *self,
+                      GDBusCallFlags    *flags_out)
+{
+  if (self->service_name != NULL)
+    {
+      *flags_out = G_DBUS_CALL_FLAGS_NONE;
+      return self->service_name;
+    }
+
+  *flags_out = G_DBUS_CALL_FLAGS_NO_AUTO_START;
+  return g_dbus_proxy_get_name (self->proxy);
+}
+
 static gboolean
 set_up_proxy (MwscScheduleEntry  *self,
               GError            **error)
@@ -616,12 +986,7 @@ set_up_proxy (MwscScheduleEntry  *self,
     g_dbus_proxy_set_interface_info (self->proxy,
                                      (GDBusInterfaceInfo *) &schedule_entry_interface);
 
-  /* Subscribe to signals. */
-  g_signal_connect (self->proxy, "g-properties-changed",
-                    (GCallback) properties_changed_cb, self);
-  g_signal_connect (self->proxy, "g-signal", (GCallback) signal_cb, self);
-  g_signal_connect (self->proxy, "notify::g-name-owner",
-                    (GCallback) proxy_notify_name_owner_cb, self);
+  connect_proxy_signals (self);
 
   /* Validate that the entry actually exists. */
   g_autoptr(GError) local_error = NULL;
@@ -803,6 +1168,29 @@ mwsc_schedule_entry_new_from_proxy (GDBusProxy  *proxy,
                          NULL);
 }
 
+/* Create a #MwscScheduleEntry wrapping @proxy, as with
+ * mwsc_schedule_entry_new_from_proxy(), for a #MwscScheduler to share its
+ * signal subscription with. If @service_name is non-%NULL, method calls are
+ * sent to it and may start the service, rather than going to the name of
+ * @proxy; this is for entries which survive the service restarting. */
+MwscScheduleEntry *
+mwsc_schedule_entry_new_shared (GDBusProxy   *proxy,
+                                const gchar  *service_name,
+                                GError      **error)
+{
+  g_return_val_if_fail (G_IS_DBUS_PROXY (proxy), NULL);
+  g_return_val_if_fail (service_name == NULL || g_dbus_is_name (service_name), NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  g_autoptr(MwscScheduleEntry) entry = mwsc_schedule_entry_new_from_proxy (proxy, error);
+  if (entry == NULL)
+    return NULL;
+
+  entry->service_name = g_strdup (service_name);
+
+  return g_steal_pointer (&entry);
+}
+
 /**
  * mwsc_schedule_entry_new_full:
  * @connection: D-Bus connection to use
@@ -1037,10 +1425,56 @@ mwsc_schedule_entry_set_resumable (MwscScheduleEntry *self,
   g_object_notify (G_OBJECT (self), "resumable");
 }
 
-static gboolean queue_send_properties_sync (GDBusProxy   *proxy,
-                                            const gchar  *property_name,
-                                            GVariant     *property_value,
-                                            GCancellable *cancellable);
+/* Add @property_value to @dict if it differs from the value of @property_name
+ * cached from the service. If @property_value is floating, it will be
+ * consumed. Returns %TRUE if it was added. */
+static gboolean
+add_changed_property (GDBusProxy   *proxy,
+                      GVariantDict *dict,
+                      const gchar  *property_name,
+                      GVariant     *property_value)
+{
+  g_autoptr(GVariant) sunk_property_value = g_variant_ref_sink (property_value);
+
+  g_autoptr(GVariant) cached_property_value = NULL;
+  cached_property_value = g_dbus_proxy_get_cached_property (proxy, property_name);
+
+  /* Older versions of the service don’t support all the properties; there’s
+   * nothing to send to them for those. */
+  if (cached_property_value == NULL)
+    return FALSE;
+
+  if (g_variant_equal (cached_property_value, sunk_property_value))
+    return FALSE;
+
+  g_variant_dict_insert_value (dict, property_name, sunk_property_value);
+  return TRUE;
+}
+
+/* Build an `a{sv}` of all the properties on @self which have been changed
+ * locally, for passing to the SetProperties() method on the service. Returns
+ * %NULL if nothing has changed. The returned variant is floating. */
+static GVariant *
+changed_properties_to_variant (MwscScheduleEntry *self)
+{
+  g_autoptr(GVariantDict) dict = g_variant_dict_new (NULL);
+  gboolean changed = FALSE;
+
+  changed |= add_changed_property (self->proxy, dict,
+                                   "Priority", g_variant_new_uint32 (self->priority));
+  changed |= add_changed_property (self->proxy, dict,
+                                   "Resumable", g_variant_new_boolean (self->resumable));
+  changed |= add_changed_property (self->proxy, dict,
+                                   "ExpectedSize", g_variant_new_uint64 (self->expected_size));
+  changed |= add_changed_property (self->proxy, dict,
+                                   "Deadline", g_variant_new_uint64 (self->deadline));
+  changed |= add_changed_property (self->proxy, dict,
+                                   "BindToConnection", g_variant_new_boolean (self->bind_to_connection));
+  changed |= add_changed_property (self->proxy, dict,
+                                   "DownloadedSize", g_variant_new_uint64 (self->downloaded_size));
+
+  return changed ? g_variant_dict_end (dict) : NULL;
+}
 
 /**
  * mwsc_schedule_entry_send_properties:
@@ -1058,8 +1492,6 @@ mwsc_schedule_entry_send_properties (MwscScheduleEntry  *self,
                                      GCancellable       *cancellable,
                                      GError            **error)
 {
-  gboolean success;
-
   g_return_val_if_fail (MWSC_IS_SCHEDULE_ENTRY (self), FALSE);
   g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
@@ -1067,77 +1499,36 @@ mwsc_schedule_entry_send_properties (MwscScheduleEntry  *self,
   if (!check_invalidated_with_error (self, error))
     return FALSE;
 
-  success = (queue_send_properties_sync (self->proxy,
-                                         "Priority", g_variant_new_uint32 (self->priority),
-                                         cancellable) &&
-             queue_send_properties_sync (self->proxy,
-                                         "Resumable", g_variant_new_boolean (self->resumable),
-                                         cancellable));
-
-  if (!success)
-    {
-      g_set_error_literal (error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
-                           _("Error sending updated properties to service."));
-      return FALSE;
-    }
-
-  return TRUE;
-}
-
-/* If @property_value is floating, it will be consumed. */
-static gboolean
-queue_send_properties_sync (GDBusProxy    *proxy,
-                            const gchar   *property_name,
-                            GVariant      *property_value,
-                            GCancellable  *cancellable)
-{
-  g_autoptr(GVariant) sunk_property_value = g_variant_ref_sink (property_value);
-
-  g_autoptr(GVariant) cached_property_value = NULL;
-  cached_property_value = g_dbus_proxy_get_cached_property (proxy, property_name);
-  g_assert (cached_property_value != NULL);
-
-  if (g_variant_equal (cached_property_value, sunk_property_value))
+  GVariant *properties = changed_properties_to_variant (self);
+  if (properties == NULL)
     return TRUE;
 
+  GDBusCallFlags flags;
+  const gchar *destination = get_call_destination (self, &flags);
+
   g_autoptr(GVariant) return_value =
-      g_dbus_connection_call_sync (g_dbus_proxy_get_connection (proxy),
-                                   g_dbus_proxy_get_name (proxy),
-                                   g_dbus_proxy_get_object_path (proxy),
-                                   "org.freedesktop.DBus.Properties",
-                                   "Set",
-                                   g_variant_new ("(ssv)",
-                                                  "com.endlessm.DownloadManager1.ScheduleEntry",
-                                                  property_name,
-                                                  sunk_property_value),
+      g_dbus_connection_call_sync (g_dbus_proxy_get_connection (self->proxy),
+                                   destination,
+                                   g_dbus_proxy_get_object_path (self->proxy),
+                                   "com.endlessm.DownloadManager1.ScheduleEntry",
+                                   "SetProperties",
+                                   g_variant_new ("(@a{sv})", properties),
                                    NULL,  /* no reply type */
-                                   G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                   flags,
                                    -1,  /* default timeout */
                                    cancellable,
                                    NULL);
-  return (return_value != NULL);
-}
 
-typedef struct
-{
-  guint n_properties;
-  gboolean error;
-} SendPropertiesData;
+  if (return_value == NULL)
+    {
+      g_set_error_literal (error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
+                           _("Error sending updated properties to service."));
+      return FALSE;
+    }
 
-static void
-send_properties_data_free (SendPropertiesData *data)
-{
-  g_free (data);
+  return TRUE;
 }
 
-G_DEFINE_AUTOPTR_CLEANUP_FUNC (SendPropertiesData, send_properties_data_free)
-
-static void queue_send_properties (GDBusProxy         *proxy,
-                                   const gchar        *property_name,
-                                   GVariant           *property_value,
-                                   GCancellable       *cancellable,
-                                   GTask              *task,
-                                   SendPropertiesData *data);
 static void send_properties_cb (GObject      *obj,
                                 GAsyncResult *result,
                                 gpointer      user_data);
@@ -1153,7 +1544,8 @@ static void send_properties_cb (GObject      *obj,
  * the mwsc_schedule_entry_set_*() functions are not sent to the server until
  * this method is called, in order to allow updates to be batched.
  *
- * (Note, currently the D-Bus API does not allow this batching to be atomic.)
+ * All the changed properties are sent in a single D-Bus call, and are applied
+ * atomically by the service, which reschedules once for the whole update.
  *
  * If no properties have been changed compared to their values on the server,
  * this is a no-op and will schedule @callback immediately.
@@ -1175,57 +1567,28 @@ mwsc_schedule_entry_send_properties_async (MwscScheduleEntry   *self,
   if (!check_invalidated_with_task (self, task))
     return;
 
-  g_autoptr(SendPropertiesData) data = g_new0 (SendPropertiesData, 1);
-  data->n_properties = 1;  /* keep it at 1 for this function to avoid an early return */
-  data->error = FALSE;
-  g_task_set_task_data (task, data  /* steal */, (GDestroyNotify) send_properties_data_free);
-
-  queue_send_properties (self->proxy,
-                         "Priority", g_variant_new_uint32 (self->priority),
-                         cancellable, task, data);
-  queue_send_properties (self->proxy,
-                         "Resumable", g_variant_new_boolean (self->resumable),
-                         cancellable, task, data);
-
-  /* Handle a possible early return. */
-  send_properties_cb (NULL, NULL, g_steal_pointer (&task));
-  data = NULL;  /* stolen above */
-}
-
-/* If @property_value is floating, it will be consumed. */
-static void
-queue_send_properties (GDBusProxy         *proxy,
-                       const gchar        *property_name,
-                       GVariant           *property_value,
-                       GCancellable       *cancellable,
-                       GTask              *task,
-                       SendPropertiesData *data)
-{
-  g_autoptr(GVariant) sunk_property_value = g_variant_ref_sink (property_value);
-
-  g_autoptr(GVariant) cached_property_value = NULL;
-  cached_property_value = g_dbus_proxy_get_cached_property (proxy, property_name);
-  g_assert (cached_property_value != NULL);
+  GVariant *properties = changed_properties_to_variant (self);
+  if (properties == NULL)
+    {
+      g_task_return_boolean (task, TRUE);
+      return;
+    }
 
-  if (g_variant_equal (cached_property_value, sunk_property_value))
-    return;
+  GDBusCallFlags flags;
+  const gchar *destination = get_call_destination (self, &flags);
 
-  data->n_properties++;
-  g_dbus_connection_call (g_dbus_proxy_get_connection (proxy),
-                          g_dbus_proxy_get_name (proxy),
-                          g_dbus_proxy_get_object_path (proxy),
-                          "org.freedesktop.DBus.Properties",
-                          "Set",
-                          g_variant_new ("(ssv)",
-                                         "com.endlessm.DownloadManager1.ScheduleEntry",
-                                         property_name,
-                                         sunk_property_value),
+  g_dbus_connection_call (g_dbus_proxy_get_connection (self->proxy),
+                          destination,
+                          g_dbus_proxy_get_object_path (self->proxy),
+                          "com.endlessm.DownloadManager1.ScheduleEntry",
+                          "SetProperties",
+                          g_variant_new ("(@a{sv})", properties),
                           NULL,  /* no reply type */
-                          G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                          flags,
                           -1,  /* default timeout */
                           cancellable,
                           send_properties_cb,
-                          g_object_ref (task));
+                          g_steal_pointer (&task));
 }
 
 static void
@@ -1234,28 +1597,17 @@ send_properties_cb (GObject      *obj,
                     gpointer      user_data)
 {
   g_autoptr(GTask) task = G_TASK (user_data);
-  SendPropertiesData *data = g_task_get_task_data (task);
   g_autoptr(GError) error = NULL;
 
-  if (result != NULL)
-    {
-      g_autoptr(GVariant) return_value = NULL;
-      return_value = g_dbus_connection_call_finish (G_DBUS_CONNECTION (obj),
-                                                    result, &error);
-    }
-
-  data->n_properties--;
-  if (error != NULL)
-    data->error = TRUE;
+  g_autoptr(GVariant) return_value = NULL;
+  return_value = g_dbus_connection_call_finish (G_DBUS_CONNECTION (obj),
+                                                result, &error);
 
-  if (data->n_properties == 0)
-    {
-      if (data->error)
-        g_task_return_new_error (task, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
-                                 _("Error sending updated properties to service."));
-      else
-        g_task_return_boolean (task, TRUE);
-    }
+  if (return_value == NULL)
+    g_task_return_new_error (task, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
+                             _("Error sending updated properties to service."));
+  else
+    g_task_return_boolean (task, TRUE);
 }
 
 /**
@@ -1308,14 +1660,21 @@ mwsc_schedule_entry_remove (MwscScheduleEntry  *self,
   if (!check_invalidated_with_error (self, error))
     return FALSE;
 
+  GDBusCallFlags flags;
+  const gchar *destination = get_call_destination (self, &flags);
+
   g_autoptr(GVariant) return_value = NULL;
-  return_value = g_dbus_proxy_call_sync (self->proxy,
-                                         "Remove",
-                                         NULL,  /* no parameters */
-                                         G_DBUS_CALL_FLAGS_NO_AUTO_START,
-                                         -1,  /* default timeout */
-                                         cancellable,
-                                         error);
+  return_value = g_dbus_connection_call_sync (g_dbus_proxy_get_connection (self->proxy),
+                                              destination,
+                                              g_dbus_proxy_get_object_path (self->proxy),
+                                              "com.endlessm.DownloadManager1.ScheduleEntry",
+                                              "Remove",
+                                              NULL,  /* no parameters */
+                                              NULL,  /* no reply type */
+                                              flags,
+                                              -1,  /* default timeout */
+                                              cancellable,
+                                              error);
 
   return (return_value != NULL);
 }
@@ -1357,14 +1716,21 @@ mwsc_schedule_entry_remove_async (MwscScheduleEntry   *self,
   if (!check_invalidated_with_task (self, task))
     return;
 
-  g_dbus_proxy_call (self->proxy,
-                     "Remove",
-                     NULL,  /* no parameters */
-                     G_DBUS_CALL_FLAGS_NO_AUTO_START,
-                     -1,  /* default timeout */
-                     cancellable,
-                     remove_cb,
-                     g_steal_pointer (&task));
+  GDBusCallFlags flags;
+  const gchar *destination = get_call_destination (self, &flags);
+
+  g_dbus_connection_call (g_dbus_proxy_get_connection (self->proxy),
+                          destination,
+                          g_dbus_proxy_get_object_path (self->proxy),
+                          "com.endlessm.DownloadManager1.ScheduleEntry",
+                          "Remove",
+                          NULL,  /* no parameters */
+                          NULL,  /* no reply type */
+                          flags,
+                          -1,  /* default timeout */
+                          cancellable,
+                          remove_cb,
+                          g_steal_pointer (&task));
 }
 
 static void
@@ -1372,12 +1738,12 @@ remove_cb (GObject      *obj,
            GAsyncResult *result,
            gpointer      user_data)
 {
-  GDBusProxy *proxy = G_DBUS_PROXY (obj);
+  GDBusConnection *connection = G_DBUS_CONNECTION (obj);
   g_autoptr(GTask) task = G_TASK (user_data);
   g_autoptr(GError) error = NULL;
 
   g_autoptr(GVariant) return_value = NULL;
-  return_value = g_dbus_proxy_call_finish (proxy, result, &error);
+  return_value = g_dbus_connection_call_finish (connection, result, &error);
 
   if (error != NULL)
     g_task_return_error (task, g_steal_pointer (&error));
@@ -1409,3 +1775,259 @@ mwsc_schedule_entry_remove_finish (MwscScheduleEntry  *self,
 
   return g_task_propagate_boolean (G_TASK (result), error);
 }
+
+/**
+ * mwsc_schedule_entry_get_expected_size:
+ * @self: a #MwscScheduleEntry
+ *
+ * Get the value of #MwscScheduleEntry:expected-size.
+ *
+ * Returns: the expected size of the download, in bytes, or zero if unknown
+ * Since: 0.3.0
+ */
+guint64
+mwsc_schedule_entry_get_expected_size (MwscScheduleEntry *self)
+{
+  g_return_val_if_fail (MWSC_IS_SCHEDULE_ENTRY (self), 0);
+
+  return self->expected_size;
+}
+
+/**
+ * mwsc_schedule_entry_set_expected_size:
+ * @self: a #MwscScheduleEntry
+ * @expected_size: the expected size of the download, in bytes, or zero if
+ *    unknown
+ *
+ * Set the value of #MwscScheduleEntry:expected-size.
+ *
+ * Since: 0.3.0
+ */
+void
+mwsc_schedule_entry_set_expected_size (MwscScheduleEntry *self,
+                                       guint64            expected_size)
+{
+  g_return_if_fail (MWSC_IS_SCHEDULE_ENTRY (self));
+
+  if (self->expected_size == expected_size)
+    return;
+
+  self->expected_size = expected_size;
+  g_object_notify (G_OBJECT (self), "expected-size");
+}
+
+/**
+ * mwsc_schedule_entry_get_deadline:
+ * @self: a #MwscScheduleEntry
+ *
+ * Get the value of #MwscScheduleEntry:deadline.
+ *
+ * Returns: the entry’s deadline, in seconds since the Unix epoch, or zero if
+ *    it has none
+ * Since: 0.3.0
+ */
+guint64
+mwsc_schedule_entry_get_deadline (MwscScheduleEntry *self)
+{
+  g_return_val_if_fail (MWSC_IS_SCHEDULE_ENTRY (self), 0);
+
+  return self->deadline;
+}
+
+/**
+ * mwsc_schedule_entry_set_deadline:
+ * @self: a #MwscScheduleEntry
+ * @deadline: the entry’s deadline, in seconds since the Unix epoch, or zero
+ *    for no deadline
+ *
+ * Set the value of #MwscScheduleEntry:deadline.
+ *
+ * Since: 0.3.0
+ */
+void
+mwsc_schedule_entry_set_deadline (MwscScheduleEntry *self,
+                                  guint64            deadline)
+{
+  g_return_if_fail (MWSC_IS_SCHEDULE_ENTRY (self));
+
+  if (self->deadline == deadline)
+    return;
+
+  self->deadline = deadline;
+  g_object_notify (G_OBJECT (self), "deadline");
+}
+
+/**
+ * mwsc_schedule_entry_get_bind_to_connection:
+ * @self: a #MwscScheduleEntry
+ *
+ * Get the value of #MwscScheduleEntry:bind-to-connection.
+ *
+ * Returns: %TRUE if the download can be bound to a specific network
+ *    connection, %FALSE otherwise
+ * Since: 0.3.0
+ */
+gboolean
+mwsc_schedule_entry_get_bind_to_connection (MwscScheduleEntry *self)
+{
+  g_return_val_if_fail (MWSC_IS_SCHEDULE_ENTRY (self), FALSE);
+
+  return self->bind_to_connection;
+}
+
+/**
+ * mwsc_schedule_entry_set_bind_to_connection:
+ * @self: a #MwscScheduleEntry
+ * @bind_to_connection: %TRUE if the download can be bound to a specific
+ *    network connection, %FALSE otherwise
+ *
+ * Set the value of #MwscScheduleEntry:bind-to-connection.
+ *
+ * Since: 0.3.0
+ */
+void
+mwsc_schedule_entry_set_bind_to_connection (MwscScheduleEntry *self,
+                                            gboolean           bind_to_connection)
+{
+  g_return_if_fail (MWSC_IS_SCHEDULE_ENTRY (self));
+
+  bind_to_connection = !!bind_to_connection;
+
+  if (self->bind_to_connection == bind_to_connection)
+    return;
+
+  self->bind_to_connection = bind_to_connection;
+  g_object_notify (G_OBJECT (self), "bind-to-connection");
+}
+
+/**
+ * mwsc_schedule_entry_get_connection_id:
+ * @self: a #MwscScheduleEntry
+ *
+ * Get the value of #MwscScheduleEntry:connection-id.
+ *
+ * Returns: (nullable): ID of the network connection chosen for the download,
+ *    or %NULL if none has been chosen (or if the service is too old to support
+ *    choosing one)
+ * Since: 0.3.0
+ */
+const gchar *
+mwsc_schedule_entry_get_connection_id (MwscScheduleEntry *self)
+{
+  g_return_val_if_fail (MWSC_IS_SCHEDULE_ENTRY (self), NULL);
+
+  if (self->proxy == NULL)
+    return NULL;
+
+  /* The proxy holds a reference to the cached value, so the string remains
+   * valid until the property next changes. */
+  g_autoptr(GVariant) connection_variant = NULL;
+  connection_variant = g_dbus_proxy_get_cached_property (self->proxy, "Connection");
+
+  if (connection_variant == NULL ||
+      !g_variant_is_of_type (connection_variant, G_VARIANT_TYPE_STRING))
+    return NULL;
+
+  const gchar *connection_id = g_variant_get_string (connection_variant, NULL);
+  return (*connection_id != '\0') ? connection_id : NULL;
+}
+
+/**
+ * mwsc_schedule_entry_get_max_rate:
+ * @self: a #MwscScheduleEntry
+ *
+ * Get the value of #MwscScheduleEntry:max-rate.
+ *
+ * Returns: maximum rate to download at, in bytes per second, or zero if the
+ *    download doesn’t need to be throttled (or if the service is too old to
+ *    calculate a rate)
+ * Since: 0.3.0
+ */
+guint64
+mwsc_schedule_entry_get_max_rate (MwscScheduleEntry *self)
+{
+  g_return_val_if_fail (MWSC_IS_SCHEDULE_ENTRY (self), 0);
+
+  if (self->proxy == NULL)
+    return 0;
+
+  g_autoptr(GVariant) max_rate_variant = NULL;
+  max_rate_variant = g_dbus_proxy_get_cached_property (self->proxy, "MaxRate");
+
+  if (max_rate_variant == NULL ||
+      !g_variant_is_of_type (max_rate_variant, G_VARIANT_TYPE_UINT64))
+    return 0;
+
+  return g_variant_get_uint64 (max_rate_variant);
+}
+
+/**
+ * mwsc_schedule_entry_get_download_starts_at:
+ * @self: a #MwscScheduleEntry
+ *
+ * Get the value of #MwscScheduleEntry:download-starts-at.
+ *
+ * Returns: predicted time the download will start, in seconds since the Unix
+ *    epoch, or zero if it’s active or no prediction is available (or if the
+ *    service is too old to make predictions)
+ * Since: 0.3.0
+ */
+guint64
+mwsc_schedule_entry_get_download_starts_at (MwscScheduleEntry *self)
+{
+  g_return_val_if_fail (MWSC_IS_SCHEDULE_ENTRY (self), 0);
+
+  if (self->proxy == NULL)
+    return 0;
+
+  g_autoptr(GVariant) download_starts_at_variant = NULL;
+  download_starts_at_variant = g_dbus_proxy_get_cached_property (self->proxy,
+                                                                 "DownloadStartsAt");
+
+  if (download_starts_at_variant == NULL ||
+      !g_variant_is_of_type (download_starts_at_variant, G_VARIANT_TYPE_UINT64))
+    return 0;
+
+  return g_variant_get_uint64 (download_starts_at_variant);
+}
+
+/**
+ * mwsc_schedule_entry_get_downloaded_size:
+ * @self: a #MwscScheduleEntry
+ *
+ * Get the value of #MwscScheduleEntry:downloaded-size.
+ *
+ * Returns: number of bytes of the download transferred so far
+ * Since: 0.3.0
+ */
+guint64
+mwsc_schedule_entry_get_downloaded_size (MwscScheduleEntry *self)
+{
+  g_return_val_if_fail (MWSC_IS_SCHEDULE_ENTRY (self), 0);
+
+  return self->downloaded_size;
+}
+
+/**
+ * mwsc_schedule_entry_set_downloaded_size:
+ * @self: a #MwscScheduleEntry
+ * @downloaded_size: number of bytes of the download transferred so far
+ *
+ * Set the value of #MwscScheduleEntry:downloaded-size. As with the other
+ * properties, this is only sent to the service by
+ * mwsc_schedule_entry_send_properties_async().
+ *
+ * Since: 0.3.0
+ */
+void
+mwsc_schedule_entry_set_downloaded_size (MwscScheduleEntry *self,
+                                         guint64            downloaded_size)
+{
+  g_return_if_fail (MWSC_IS_SCHEDULE_ENTRY (self));
+
+  if (self->downloaded_size == downloaded_size)
+    return;
+
+  self->downloaded_size = downloaded_size;
+  g_object_notify (G_OBJECT (self), "downloaded-size");
+}
@@ -80,6 +80,21 @@ void                mwsc_schedule_entry_set_priority     (MwscScheduleEntry    *
 gboolean            mwsc_schedule_entry_get_resumable    (MwscScheduleEntry    *self);
 void                mwsc_schedule_entry_set_resumable    (MwscScheduleEntry    *self,
                                                           gboolean              resumable);
+guint64             mwsc_schedule_entry_get_expected_size (MwscScheduleEntry *self);
+void                mwsc_schedule_entry_set_expected_size (MwscScheduleEntry *self,
+                                                           guint64            expected_size);
+guint64             mwsc_schedule_entry_get_deadline     (MwscScheduleEntry    *self);
+void                mwsc_schedule_entry_set_deadline     (MwscScheduleEntry    *self,
+                                                          guint64               deadline);
+gboolean            mwsc_schedule_entry_get_bind_to_connection (MwscScheduleEntry *self);
+void                mwsc_schedule_entry_set_bind_to_connection (MwscScheduleEntry *self,
+                                                                gboolean           bind_to_connection);
+const gchar        *mwsc_schedule_entry_get_connection_id (MwscScheduleEntry   *self);
+guint64             mwsc_schedule_entry_get_max_rate     (MwscScheduleEntry    *self);
+guint64             mwsc_schedule_entry_get_download_starts_at (MwscScheduleEntry *self);
+guint64             mwsc_schedule_entry_get_downloaded_size (MwscScheduleEntry *self);
+void                mwsc_schedule_entry_set_downloaded_size (MwscScheduleEntry *self,
+                                                             guint64            downloaded_size);
 
 gboolean mwsc_schedule_entry_send_properties        (MwscScheduleEntry    *self,
                                                      GCancellable         *cancellable,
@@ -26,8 +26,10 @@
 #include <glib.h>
 #include <glib-object.h>
 #include <gio/gio.h>
+#include <libmogwai-schedule/schedule-entry-interface.h>
 #include <libmogwai-schedule/scheduler-interface.h>
 #include <libmogwai-schedule-client/schedule-entry.h>
+#include <libmogwai-schedule-client/schedule-entry-private.h>
 #include <libmogwai-schedule-client/scheduler.h>
 
 
@@ -68,6 +70,20 @@ static void proxy_properties_changed_cb (GDBusProxy *proxy,
                                          GVariant   *changed_properties,
                                          GStrv       invalidated_properties,
                                          gpointer    user_data);
+static void shared_entry_weak_notify_cb (gpointer    user_data,
+                                         GObject    *where_the_object_was);
+static gboolean ensure_entries_subscription (MwscScheduler *self);
+static void drop_entries_subscription   (MwscScheduler *self);
+static void unsubscribe_shared_entries  (MwscScheduler *self);
+static void forget_shared_entry         (MwscScheduler *self,
+                                         const gchar   *object_path);
+static void reconnect_shared_entries    (MwscScheduler *self,
+                                         const gchar   *name_owner);
+static GDBusProxy *entry_proxy_new      (MwscScheduler  *self,
+                                         const gchar    *object_path,
+                                         GVariant       *properties,
+                                         gboolean        shared,
+                                         GError        **error);
 
 static const GDBusErrorEntry scheduler_error_map[] =
   {
@@ -90,6 +106,14 @@ G_STATIC_ASSERT (G_N_ELEMENTS (scheduler_error_map) == G_N_ELEMENTS (scheduler_e
  * all future method calls on the object will return a
  * %MWSC_SCHEDULER_ERROR_INVALIDATED error.
  *
+ * The exception is if the #MwscScheduler is for a well-known name which the
+ * message bus can activate (as with mwsc_scheduler_new_async()), in which case
+ * the service exiting (for example, when it has been idle for a while) does
+ * not invalidate it. The next method call starts the service again. The
+ * entries created by mwsc_scheduler_schedule_entries_async() and
+ * mwsc_scheduler_list_entries_async() are reconnected to the new instance of
+ * the service, and any which it no longer has are invalidated.
+ *
  * Since: 0.1.0
  */
 struct _MwscScheduler
@@ -108,8 +132,35 @@ struct _MwscScheduler
   gboolean initialising;
 
   guint hold_count;
+
+  /* A single subscription to all the signals from the service, shared by all
+   * the #MwscScheduleEntrys created by mwsc_scheduler_schedule_entries_async(),
+   * and a map from their object paths to them to demultiplex the signals. The
+   * entries are weakly referenced, and each holds a strong reference to the
+   * scheduler so the subscription outlives them. The subscription is created
+   * on first use by ensure_entries_subscription(). It matches on the unique
+   * name of the service, so it is redone whenever the name owner changes, and
+   * the entries are moved over to the new owner (see
+   * proxy_notify_name_owner_cb()). */
+  guint entries_subscription_id;
+  GHashTable *shared_entries;  /* (owned) (element-type utf8 SharedEntry) */
 };
 
+/* An entry in #MwscScheduler.shared_entries. */
+typedef struct
+{
+  MwscScheduler *scheduler;  /* (unowned) */
+  MwscScheduleEntry *entry;  /* (unowned) (weak ref) */
+  gchar *object_path;  /* (owned) */
+} SharedEntry;
+
+static void
+shared_entry_free (SharedEntry *shared)
+{
+  g_free (shared->object_path);
+  g_free (shared);
+}
+
 typedef enum
 {
   PROP_CONNECTION = 1,
@@ -241,6 +292,10 @@ mwsc_scheduler_class_init (MwscSchedulerClass *klass)
    * data). The most common reason for this signal to be emitted is if the
    * underlying D-Bus object disappears.
    *
+   * If the scheduler is for an activatable well-known name, it is not
+   * invalidated when the service exits, as the service can be started again
+   * (see #MwscScheduler).
+   *
    * After this signal is emitted, all method calls to #MwscScheduler methods
    * will return %MWSC_SCHEDULER_ERROR_INVALIDATED.
    *
@@ -277,7 +332,9 @@ mwsc_scheduler_async_initable_init (GAsyncInitableIface *iface)
 static void
 mwsc_scheduler_init (MwscScheduler *self)
 {
-  /* Nothing to do here. */
+  /* The keys are owned by the values. */
+  self->shared_entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                                (GDestroyNotify) shared_entry_free);
 }
 
 static void
@@ -314,6 +371,10 @@ mwsc_scheduler_dispose (GObject *object)
                                             proxy_notify_name_owner_cb, self);
     }
 
+  if (self->shared_entries != NULL)
+    unsubscribe_shared_entries (self);
+  g_clear_pointer (&self->shared_entries, g_hash_table_unref);
+
   g_clear_object (&self->proxy);
   g_clear_object (&self->connection);
   g_clear_pointer (&self->name, g_free);
@@ -413,6 +474,9 @@ scheduler_invalidate (MwscScheduler *self,
   g_signal_handlers_disconnect_by_func (self->proxy,
                                         proxy_notify_name_owner_cb, self);
 
+  /* The shared entries will have been invalidated already, if needed. */
+  unsubscribe_shared_entries (self);
+
   /* Clear the proxy, which marks this #MwscScheduler as invalidated. */
   g_debug ("Marking scheduler (%p) as invalidated due to error: %s",
            self, error->message);
@@ -455,6 +519,81 @@ check_invalidated_with_error (MwscScheduler  *self,
   return TRUE;
 }
 
+/* Whether the service can be started again by method calls after it exits,
+ * going by how the scheduler was constructed. This doesn’t check that the bus
+ * can actually activate the name; see proxy_notify_name_owner_cb(). */
+static gboolean
+can_reactivate (MwscScheduler *self)
+{
+  const gchar *name = g_dbus_proxy_get_name (self->proxy);
+
+  return (name != NULL && !g_dbus_is_unique_name (name) &&
+          !(g_dbus_proxy_get_flags (self->proxy) & G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START));
+}
+
+/* The service has gone away for good: invalidate the scheduler and its shared
+ * entries. */
+static void
+scheduler_disconnected (MwscScheduler *self)
+{
+  /* The proxies for the shared entries don’t track their name owner, so they
+   * have to be told. Take a copy of the list, since invalidating them could
+   * cause them to be finalised. */
+  g_autoptr(GPtrArray) entries = g_ptr_array_new_with_free_func (g_object_unref);
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, self->shared_entries);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      SharedEntry *shared = value;
+      g_ptr_array_add (entries, g_object_ref (shared->entry));
+    }
+
+  for (gsize i = 0; i < entries->len; i++)
+    mwsc_schedule_entry_disconnected (entries->pdata[i]);
+
+  g_autoptr(GError) error = NULL;
+  g_set_error_literal (&error, G_DBUS_ERROR, G_DBUS_ERROR_DISCONNECTED,
+                       _("Scheduler owner has disconnected."));
+  scheduler_invalidate (self, error);
+}
+
+static void
+list_activatable_names_cb (GObject      *obj,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+  GDBusConnection *connection = G_DBUS_CONNECTION (obj);
+  g_autoptr(MwscScheduler) self = MWSC_SCHEDULER (user_data);
+  g_autoptr(GError) local_error = NULL;
+
+  g_autoptr(GVariant) return_value = NULL;
+  return_value = g_dbus_connection_call_finish (connection, result, &local_error);
+
+  /* Has the scheduler been invalidated, or the service come back, meanwhile? */
+  if (self->proxy == NULL)
+    return;
+
+  g_autofree gchar *name_owner = g_dbus_proxy_get_name_owner (self->proxy);
+  if (name_owner != NULL)
+    return;
+
+  const gchar *name = g_dbus_proxy_get_name (self->proxy);
+  g_autofree const gchar **activatable_names = NULL;
+
+  if (return_value != NULL)
+    g_variant_get (return_value, "(^a&s)", &activatable_names);
+  else
+    g_debug ("Error listing activatable names: %s", local_error->message);
+
+  if (activatable_names != NULL &&
+      g_strv_contains ((const gchar * const *) activatable_names, name))
+    g_debug ("Service ‘%s’ has exited, and will be re-activated when needed.", name);
+  else
+    scheduler_disconnected (self);
+}
+
 static void
 proxy_notify_name_owner_cb (GObject    *obj,
                             GParamSpec *pspec,
@@ -464,13 +603,363 @@ proxy_notify_name_owner_cb (GObject    *obj,
 
   g_debug ("Name owner for proxy ‘%s’ has changed.", self->object_path);
 
-  if (g_dbus_proxy_get_name_owner (G_DBUS_PROXY (obj)) == NULL)
+  g_autofree gchar *name_owner = g_dbus_proxy_get_name_owner (G_DBUS_PROXY (obj));
+
+  /* The subscription for the shared entries matches on the old name owner, so
+   * it won’t see any signals from the new one. */
+  drop_entries_subscription (self);
+
+  if (name_owner == NULL && can_reactivate (self))
+    {
+      /* Keep going if the service has only exited (for example, when idle)
+       * and can be started again, as long as the bus can actually do so. */
+      g_dbus_connection_call (g_dbus_proxy_get_connection (self->proxy),
+                              "org.freedesktop.DBus",
+                              "/org/freedesktop/DBus",
+                              "org.freedesktop.DBus",
+                              "ListActivatableNames",
+                              NULL,  /* no arguments */
+                              G_VARIANT_TYPE ("(as)"),
+                              G_DBUS_CALL_FLAGS_NONE,
+                              -1,  /* default timeout */
+                              NULL,  /* cancellable */
+                              list_activatable_names_cb,
+                              g_object_ref (self));
+    }
+  else if (name_owner == NULL)
+    {
+      scheduler_disconnected (self);
+    }
+  else if (g_hash_table_size (self->shared_entries) > 0)
+    {
+      /* The service has been started again, or the name has been taken over by
+       * another instance of it (for example, one started with `--replace`). */
+      g_debug ("Re-subscribing to signals for %u shared entries from ‘%s’",
+               g_hash_table_size (self->shared_entries), name_owner);
+      ensure_entries_subscription (self);
+      reconnect_shared_entries (self, name_owner);
+    }
+}
+
+typedef struct
+{
+  MwscScheduler *scheduler;  /* (owned) */
+  gchar *name_owner;  /* (owned) */
+} ReconnectData;
+
+static void
+reconnect_data_free (ReconnectData *data)
+{
+  g_clear_object (&data->scheduler);
+  g_free (data->name_owner);
+  g_free (data);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ReconnectData, reconnect_data_free)
+
+static void reconnect_shared_entries_cb (GObject      *obj,
+                                         GAsyncResult *result,
+                                         gpointer      user_data);
+
+/* Move the shared entries over to @name_owner, the new owner of the service’s
+ * name. They are looked up with the ObjectManager interface, which is on the
+ * same object as the Scheduler interface. The new instance of the service will
+ * have restored the entries it had saved when the old one exited. */
+static void
+reconnect_shared_entries (MwscScheduler *self,
+                          const gchar   *name_owner)
+{
+  ReconnectData *data = g_new0 (ReconnectData, 1);
+  data->scheduler = g_object_ref (self);
+  data->name_owner = g_strdup (name_owner);
+
+  g_dbus_connection_call (g_dbus_proxy_get_connection (self->proxy),
+                          name_owner,
+                          g_dbus_proxy_get_object_path (self->proxy),
+                          "org.freedesktop.DBus.ObjectManager",
+                          "GetManagedObjects",
+                          NULL,  /* no arguments */
+                          G_VARIANT_TYPE ("(a{oa{sa{sv}}})"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,  /* default timeout */
+                          NULL,  /* cancellable */
+                          reconnect_shared_entries_cb,
+                          data);
+}
+
+static void
+reconnect_shared_entries_cb (GObject      *obj,
+                             GAsyncResult *result,
+                             gpointer      user_data)
+{
+  GDBusConnection *connection = G_DBUS_CONNECTION (obj);
+  g_autoptr(ReconnectData) data = user_data;
+  MwscScheduler *self = data->scheduler;
+  g_autoptr(GError) local_error = NULL;
+
+  g_autoptr(GVariant) return_value = NULL;
+  return_value = g_dbus_connection_call_finish (connection, result, &local_error);
+
+  /* Ignore the reply if the scheduler has been invalidated, or the name owner
+   * has changed again; in the latter case another call is in flight. */
+  g_autofree gchar *name_owner = NULL;
+  if (self->proxy != NULL)
+    name_owner = g_dbus_proxy_get_name_owner (self->proxy);
+  if (g_strcmp0 (name_owner, data->name_owner) != 0)
+    return;
+
+  g_autoptr(GVariant) objects = NULL;
+  if (return_value != NULL)
+    objects = g_variant_get_child_value (return_value, 0);
+  else
+    g_debug ("Error listing schedule entries from ‘%s’: %s",
+             data->name_owner, local_error->message);
+  g_clear_error (&local_error);
+
+  /* Take a copy of the list, since reconnecting or invalidating the entries
+   * could cause them to be finalised. */
+  g_autoptr(GPtrArray) entries = g_ptr_array_new_with_free_func (g_object_unref);
+  g_autoptr(GPtrArray) object_paths = g_ptr_array_new_with_free_func (g_free);
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, self->shared_entries);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      SharedEntry *shared = value;
+      g_ptr_array_add (entries, g_object_ref (shared->entry));
+      g_ptr_array_add (object_paths, g_strdup (shared->object_path));
+    }
+
+  for (gsize i = 0; i < entries->len; i++)
+    {
+      MwscScheduleEntry *entry = entries->pdata[i];
+      const gchar *object_path = object_paths->pdata[i];
+      g_autoptr(GDBusProxy) old_proxy = NULL;
+      g_autoptr(GVariant) interfaces = NULL;
+      g_autoptr(GVariant) properties = NULL;
+      g_autoptr(GDBusProxy) proxy = NULL;
+
+      /* Skip entries which have been created on the new owner since the
+       * GetManagedObjects call was made, as they might not be listed. */
+      g_object_get (entry, "proxy", &old_proxy, NULL);
+      if (old_proxy == NULL ||
+          g_strcmp0 (g_dbus_proxy_get_name (old_proxy), data->name_owner) == 0)
+        continue;
+
+      if (objects != NULL)
+        interfaces = g_variant_lookup_value (objects, object_path,
+                                             G_VARIANT_TYPE ("a{sa{sv}}"));
+      if (interfaces != NULL)
+        properties = g_variant_lookup_value (interfaces,
+                                             "com.endlessm.DownloadManager1.ScheduleEntry",
+                                             G_VARIANT_TYPE_VARDICT);
+      if (properties != NULL)
+        proxy = entry_proxy_new (self, object_path, properties, TRUE, &local_error);
+
+      if (proxy != NULL)
+        {
+          mwsc_schedule_entry_reconnected (entry, proxy);
+        }
+      else
+        {
+          if (local_error != NULL)
+            g_debug ("Error reconnecting schedule entry ‘%s’: %s",
+                     object_path, local_error->message);
+          g_clear_error (&local_error);
+
+          forget_shared_entry (self, object_path);
+          mwsc_schedule_entry_disconnected (entry);
+        }
+    }
+}
+
+static void
+entries_signal_cb (GDBusConnection *connection,
+                   const gchar     *sender_name,
+                   const gchar     *object_path,
+                   const gchar     *interface_name,
+                   const gchar     *signal_name,
+                   GVariant        *parameters,
+                   gpointer         user_data)
+{
+  MwscScheduler *self = MWSC_SCHEDULER (user_data);
+  SharedEntry *shared = g_hash_table_lookup (self->shared_entries, object_path);
+
+  /* This will receive all the service’s signals, including those for the
+   * scheduler (which its proxy handles) and for entries which aren’t shared
+   * (which their own proxies handle), so ignore those. */
+  if (shared == NULL)
+    return;
+
+  g_autoptr(MwscScheduleEntry) entry = g_object_ref (shared->entry);
+  mwsc_schedule_entry_handle_signal (entry, sender_name, interface_name,
+                                     signal_name, parameters);
+}
+
+/* Subscribe to all the signals from the scheduler’s name owner, if that hasn’t
+ * been done already. This must be done before any entries are created, so
+ * that no signals for them are missed. One subscription (and hence one match
+ * rule on the bus) is used for all the shared entries. Returns %FALSE if the
+ * scheduler isn’t on a message bus (or its owner has disappeared), in which
+ * case entries can’t be shared and must use their own proxies. */
+static gboolean
+ensure_entries_subscription (MwscScheduler *self)
+{
+  if (self->entries_subscription_id != 0)
+    return TRUE;
+
+  g_autofree gchar *name_owner = g_dbus_proxy_get_name_owner (self->proxy);
+  if (name_owner == NULL)
+    return FALSE;
+
+  self->entries_subscription_id =
+      g_dbus_connection_signal_subscribe (g_dbus_proxy_get_connection (self->proxy),
+                                          name_owner,
+                                          NULL,  /* any interface */
+                                          NULL,  /* any member */
+                                          NULL,  /* any object path */
+                                          NULL,  /* any arg0 */
+                                          G_DBUS_SIGNAL_FLAGS_NONE,
+                                          entries_signal_cb, self, NULL);
+
+  return TRUE;
+}
+
+static void
+shared_entry_weak_notify_cb (gpointer  user_data,
+                             GObject  *where_the_object_was)
+{
+  SharedEntry *shared = user_data;
+
+  /* This frees @shared. */
+  g_hash_table_remove (shared->scheduler->shared_entries, shared->object_path);
+}
+
+/* Drop the subscription, if there is one, but carry on tracking the shared
+ * entries so it can be created again by ensure_entries_subscription(). */
+static void
+drop_entries_subscription (MwscScheduler *self)
+{
+  if (self->entries_subscription_id != 0)
+    {
+      g_dbus_connection_signal_unsubscribe (g_dbus_proxy_get_connection (self->proxy),
+                                            self->entries_subscription_id);
+      self->entries_subscription_id = 0;
+    }
+}
+
+/* Stop tracking the shared entry at @object_path, if there is one. */
+static void
+forget_shared_entry (MwscScheduler *self,
+                     const gchar   *object_path)
+{
+  SharedEntry *shared = g_hash_table_lookup (self->shared_entries, object_path);
+  if (shared == NULL)
+    return;
+
+  g_object_weak_unref (G_OBJECT (shared->entry), shared_entry_weak_notify_cb, shared);
+  g_hash_table_remove (self->shared_entries, object_path);
+}
+
+/* Drop the subscription, and stop tracking all the shared entries. */
+static void
+unsubscribe_shared_entries (MwscScheduler *self)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, self->shared_entries);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      SharedEntry *shared = value;
+      g_object_weak_unref (G_OBJECT (shared->entry), shared_entry_weak_notify_cb, shared);
+      g_hash_table_iter_remove (&iter);
+    }
+
+  drop_entries_subscription (self);
+}
+
+/* Create a proxy for the schedule entry at @object_path, seeding its property
+ * cache from @properties (of type `a{sv}`) so that it doesn’t have to make any
+ * D-Bus calls. If @shared is %TRUE, the proxy doesn’t subscribe to signals
+ * itself, and relies on the scheduler’s signal subscription instead. */
+static GDBusProxy *
+entry_proxy_new (MwscScheduler  *self,
+                 const gchar    *object_path,
+                 GVariant       *properties,
+                 gboolean        shared,
+                 GError        **error)
+{
+  GDBusProxyFlags flags = G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES |
+                          G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START;
+  if (shared)
+    flags |= G_DBUS_PROXY_FLAGS_DO_NOT_CONNECT_SIGNALS;
+
+  /* Using the unique name, where known, means the #GDBusProxy doesn’t have to
+   * look up the name owner. */
+  g_autofree gchar *name_owner = g_dbus_proxy_get_name_owner (self->proxy);
+  const gchar *name = (name_owner != NULL) ? name_owner : g_dbus_proxy_get_name (self->proxy);
+
+  g_autoptr(GDBusProxy) proxy = NULL;
+  proxy = g_initable_new (G_TYPE_DBUS_PROXY, NULL, error,
+                          "g-flags", flags,
+                          "g-interface-info", &schedule_entry_interface,
+                          "g-name", name,
+                          "g-connection", g_dbus_proxy_get_connection (self->proxy),
+                          "g-object-path", object_path,
+                          "g-interface-name", "com.endlessm.DownloadManager1.ScheduleEntry",
+                          NULL);
+  if (proxy == NULL)
+    return NULL;
+
+  GVariantIter iter;
+  const gchar *property_name;
+  GVariant *value;
+
+  g_variant_iter_init (&iter, properties);
+
+  while (g_variant_iter_next (&iter, "{&sv}", &property_name, &value))
     {
-      g_autoptr(GError) error = NULL;
-      g_set_error_literal (&error, G_DBUS_ERROR, G_DBUS_ERROR_DISCONNECTED,
-                           _("Scheduler owner has disconnected."));
-      scheduler_invalidate (self, error);
+      g_dbus_proxy_set_cached_property (proxy, property_name, value);
+      g_variant_unref (value);
     }
+
+  return g_steal_pointer (&proxy);
+}
+
+/* Wrap @proxy (from entry_proxy_new(), with its properties loaded) in a new
+ * #MwscScheduleEntry, and start demultiplexing signals to it. */
+static MwscScheduleEntry *
+shared_entry_new (MwscScheduler  *self,
+                  GDBusProxy     *proxy,
+                  GError        **error)
+{
+  /* If the service can be restarted, the entry sends its method calls to the
+   * well-known name, so that they start the service again if it has exited. */
+  const gchar *service_name = can_reactivate (self) ? g_dbus_proxy_get_name (self->proxy) : NULL;
+
+  g_autoptr(MwscScheduleEntry) entry = mwsc_schedule_entry_new_shared (proxy, service_name, error);
+  if (entry == NULL)
+    return NULL;
+
+  SharedEntry *shared = g_new0 (SharedEntry, 1);
+  shared->scheduler = self;
+  shared->entry = entry;
+  shared->object_path = g_strdup (g_dbus_proxy_get_object_path (proxy));
+
+  /* If the same object path was somehow returned twice, the old entry stops
+   * receiving signals. */
+  forget_shared_entry (self, shared->object_path);
+
+  g_hash_table_insert (self->shared_entries, shared->object_path, shared);
+  g_object_weak_ref (G_OBJECT (entry), shared_entry_weak_notify_cb, shared);
+
+  /* The subscription lives in the scheduler, so it has to outlive the entry. */
+  g_object_set_data_full (G_OBJECT (entry), "mwsc-scheduler",
+                          g_object_ref (self), g_object_unref);
+
+  return g_steal_pointer (&entry);
 }
 
 static void
@@ -973,6 +1462,11 @@ static void schedule_cb (GObject      *obj,
  *
  *  * `resumable` (`b`): sets #MwscScheduleEntry:resumable
  *  * `priority` (`u`): sets #MwscScheduleEntry:priority
+ *  * `expected-size` (`t`): sets #MwscScheduleEntry:expected-size (since
+ *    0.3.0)
+ *  * `deadline` (`t`): sets #MwscScheduleEntry:deadline (since 0.3.0)
+ *  * `bind-to-connection` (`b`): sets #MwscScheduleEntry:bind-to-connection
+ *    (since 0.3.0)
  *
  * Since: 0.1.0
  */
@@ -1048,6 +1542,49 @@ mwsc_scheduler_schedule_finish (MwscScheduler  *self,
 }
 
 /* Returns a floating reference. */
+/* Build #MwscScheduleEntrys from the return value of a ScheduleEntriesFull
+ * call, which is of type `(a(oa{sv}))`. As the initial properties of each entry
+ * are included, this doesn’t need to make any D-Bus calls. */
+static GPtrArray *
+entries_from_variant (MwscScheduler  *self,
+                      GVariant       *return_value,
+                      GError        **error)
+{
+  gboolean shared = (self->entries_subscription_id != 0);
+  g_autoptr(GVariant) entries_variant = g_variant_get_child_value (return_value, 0);
+  gsize n_entries = g_variant_n_children (entries_variant);
+
+  g_autoptr(GPtrArray) entries = NULL;
+  entries = g_ptr_array_new_full (n_entries, g_object_unref);
+
+  for (gsize i = 0; i < n_entries; i++)
+    {
+      const gchar *schedule_entry_path;
+      g_autoptr(GVariant) properties = NULL;
+      g_autoptr(GDBusProxy) proxy = NULL;
+      g_autoptr(MwscScheduleEntry) entry = NULL;
+
+      g_variant_get_child (entries_variant, i, "(&o@a{sv})",
+                           &schedule_entry_path, &properties);
+
+      proxy = entry_proxy_new (self, schedule_entry_path, properties, shared, error);
+      if (proxy == NULL)
+        return NULL;
+
+      if (shared)
+        entry = shared_entry_new (self, proxy, error);
+      else
+        entry = mwsc_schedule_entry_new_from_proxy (proxy, error);
+
+      if (entry == NULL)
+        return NULL;
+
+      g_ptr_array_add (entries, g_steal_pointer (&entry));
+    }
+
+  return g_steal_pointer (&entries);
+}
+
 static GVariant *
 parameters_to_variant (GPtrArray *parameters)
 {
@@ -1101,10 +1638,13 @@ mwsc_scheduler_schedule_entries (MwscScheduler  *self,
   if (!check_invalidated_with_error (self, error))
     return NULL;
 
+  /* Subscribe to signals for the new entries before creating them. */
+  ensure_entries_subscription (self);
+
   /* Grab the schedule entries. */
   g_autoptr(GVariant) return_value = NULL;
   return_value = g_dbus_proxy_call_sync (self->proxy,
-                                         "ScheduleEntries",
+                                         "ScheduleEntriesFull",
                                          parameters_to_variant (parameters),
                                          G_DBUS_CALL_FLAGS_NONE,
                                          -1,  /* default timeout */
@@ -1114,54 +1654,12 @@ mwsc_scheduler_schedule_entries (MwscScheduler  *self,
   if (return_value == NULL)
     return NULL;
 
-  /* Start constructing the entries in parallel. */
-  g_autoptr(GVariantIter) iter = NULL;
-  const gchar *schedule_entry_path;
-  g_variant_get (return_value, "(ao)", &iter);
-
-  g_autoptr(GPtrArray) entries = NULL;
-  entries = g_ptr_array_new_with_free_func (g_object_unref);
-
-  while (g_variant_iter_loop (iter, "&o", &schedule_entry_path))
-    {
-      g_autoptr(MwscScheduleEntry) entry = NULL;
-
-      entry = mwsc_schedule_entry_new_full (g_dbus_proxy_get_connection (self->proxy),
-                                            g_dbus_proxy_get_name (self->proxy),
-                                            schedule_entry_path,
-                                            cancellable,
-                                            error);
-
-      if (entry == NULL)
-        return NULL;
-
-      g_ptr_array_add (entries, g_steal_pointer (&entry));
-    }
-
-  return g_steal_pointer (&entries);
-}
-
-typedef struct
-{
-  gsize n_entries;
-  GPtrArray *entries;  /* (element-type MwscScheduleEntry) (owned) */
-} ScheduleEntriesData;
-
-static void
-schedule_entries_data_free (ScheduleEntriesData *data)
-{
-  g_clear_pointer (&data->entries, g_ptr_array_unref);
-  g_free (data);
+  return entries_from_variant (self, return_value, error);
 }
 
-G_DEFINE_AUTOPTR_CLEANUP_FUNC (ScheduleEntriesData, schedule_entries_data_free)
-
 static void schedule_entries_cb (GObject      *obj,
                                  GAsyncResult *result,
                                  gpointer      user_data);
-static void proxy_entries_cb    (GObject      *obj,
-                                 GAsyncResult *result,
-                                 gpointer      user_data);
 
 /**
  * mwsc_scheduler_schedule_entries_async:
@@ -1184,6 +1682,18 @@ static void proxy_entries_cb    (GObject      *obj,
  *
  *  * `resumable` (`b`): sets #MwscScheduleEntry:resumable
  *  * `priority` (`u`): sets #MwscScheduleEntry:priority
+ *  * `expected-size` (`t`): sets #MwscScheduleEntry:expected-size (since
+ *    0.3.0)
+ *  * `deadline` (`t`): sets #MwscScheduleEntry:deadline (since 0.3.0)
+ *  * `bind-to-connection` (`b`): sets #MwscScheduleEntry:bind-to-connection
+ *    (since 0.3.0)
+ *
+ * When connected to the service over a message bus, the returned entries share
+ * a single signal subscription owned by the #MwscScheduler, rather than each
+ * adding its own match rules. The initial properties of the entries are
+ * returned along with them, so no further D-Bus calls are needed to load them.
+ * Each entry keeps a reference to the #MwscScheduler so that it continues to
+ * receive signals after the caller drops theirs.
  *
  * Since: 0.1.0
  */
@@ -1204,8 +1714,11 @@ mwsc_scheduler_schedule_entries_async (MwscScheduler       *self,
   if (!check_invalidated_with_task (self, task))
     return;
 
+  /* Subscribe to signals for the new entries before creating them. */
+  ensure_entries_subscription (self);
+
   g_dbus_proxy_call (self->proxy,
-                     "ScheduleEntries",
+                     "ScheduleEntriesFull",
                      parameters_to_variant (parameters),
                      G_DBUS_CALL_FLAGS_NONE,
                      -1,  /* default timeout */
@@ -1222,7 +1735,6 @@ schedule_entries_cb (GObject      *obj,
   GDBusProxy *proxy = G_DBUS_PROXY (obj);
   g_autoptr(GTask) task = G_TASK (user_data);
   MwscScheduler *self = g_task_get_source_object (task);
-  GCancellable *cancellable = g_task_get_cancellable (task);
   g_autoptr(GError) error = NULL;
 
   /* Grab the schedule entries. */
@@ -1235,50 +1747,12 @@ schedule_entries_cb (GObject      *obj,
       return;
     }
 
-  /* Start constructing the entries in parallel. */
-  g_autoptr(GVariantIter) iter = NULL;
-  const gchar *schedule_entry_path;
-  g_variant_get (return_value, "(ao)", &iter);
-
-  /* Set up the return closure. */
-  g_autoptr(ScheduleEntriesData) data = g_new0 (ScheduleEntriesData, 1);
-  data->n_entries = g_variant_iter_n_children (iter);
-  data->entries = g_ptr_array_new_with_free_func (g_object_unref);
-  g_task_set_task_data (task, g_steal_pointer (&data),
-                        (GDestroyNotify) schedule_entries_data_free);
-
-  while (g_variant_iter_loop (iter, "&o", &schedule_entry_path))
-    {
-      mwsc_schedule_entry_new_full_async (g_dbus_proxy_get_connection (self->proxy),
-                                          g_dbus_proxy_get_name (self->proxy),
-                                          schedule_entry_path,
-                                          cancellable,
-                                          proxy_entries_cb,
-                                          g_steal_pointer (&task));
-    }
-}
-
-static void
-proxy_entries_cb (GObject      *obj,
-                  GAsyncResult *result,
-                  gpointer      user_data)
-{
-  g_autoptr(GTask) task = G_TASK (user_data);
-  g_autoptr(GError) local_error = NULL;
-  ScheduleEntriesData *data = g_task_get_task_data (task);
-
-  g_autoptr(MwscScheduleEntry) entry = mwsc_schedule_entry_new_full_finish (result, &local_error);
-
-  if (entry == NULL)
-    {
-      g_task_return_error (task, g_steal_pointer (&local_error));
-      return;
-    }
-
-  g_ptr_array_add (data->entries, g_steal_pointer (&entry));
+  g_autoptr(GPtrArray) entries = entries_from_variant (self, return_value, &error);
 
-  if (data->entries->len == data->n_entries && !g_task_had_error (task))
-    g_task_return_pointer (task, g_steal_pointer (&data->entries),
+  if (entries == NULL)
+    g_task_return_error (task, g_steal_pointer (&error));
+  else
+    g_task_return_pointer (task, g_steal_pointer (&entries),
                            (GDestroyNotify) g_ptr_array_unref);
 }
 
@@ -1648,6 +2122,732 @@ mwsc_scheduler_release_finish (MwscScheduler  *self,
   return g_task_propagate_boolean (G_TASK (result), error);
 }
 
+/* Returns a floating reference, or %NULL if any of the arguments are invalid. */
+static GVariant *
+updates_to_variant (GPtrArray *entries,
+                    GPtrArray *properties)
+{
+  g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("(a(oa{sv}))"));
+  g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(oa{sv})"));
+
+  for (gsize i = 0; i < entries->len; i++)
+    {
+      MwscScheduleEntry *entry = g_ptr_array_index (entries, i);
+      GVariant *variant = g_ptr_array_index (properties, i);
+      g_autofree gchar *object_path = NULL;
+
+      g_return_val_if_fail (MWSC_IS_SCHEDULE_ENTRY (entry), NULL);
+      g_return_val_if_fail (variant != NULL &&
+                            g_variant_is_normal_form (variant) &&
+                            g_variant_is_of_type (variant, G_VARIANT_TYPE_VARDICT),
+                            NULL);
+
+      g_object_get (entry, "object-path", &object_path, NULL);
+      g_variant_builder_add (&builder, "(o@a{sv})", object_path, variant);
+    }
+
+  g_variant_builder_close (&builder);
+
+  return g_variant_builder_end (&builder);
+}
+
+/**
+ * mwsc_scheduler_update_entries:
+ * @self: a #MwscScheduler
+ * @entries: (element-type MwscScheduleEntry): non-empty array of schedule
+ *    entries to update
+ * @properties: (element-type GVariant): array of #GVariants of type `a{sv}`
+ *    giving the new property values for each of @entries
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @error: return location for a #GError, or %NULL
+ *
+ * Synchronous version of mwsc_scheduler_update_entries_async().
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 0.3.0
+ */
+gboolean
+mwsc_scheduler_update_entries (MwscScheduler  *self,
+                               GPtrArray      *entries,
+                               GPtrArray      *properties,
+                               GCancellable   *cancellable,
+                               GError        **error)
+{
+  g_return_val_if_fail (MWSC_IS_SCHEDULER (self), FALSE);
+  g_return_val_if_fail (entries != NULL && entries->len > 0, FALSE);
+  g_return_val_if_fail (properties != NULL && properties->len == entries->len, FALSE);
+  g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  if (!check_invalidated_with_error (self, error))
+    return FALSE;
+
+  GVariant *updates = updates_to_variant (entries, properties);
+  g_return_val_if_fail (updates != NULL, FALSE);
+
+  g_debug ("Updating %u schedule entries over D-Bus", entries->len);
+
+  g_autoptr(GVariant) return_value = NULL;
+  return_value = g_dbus_proxy_call_sync (self->proxy,
+                                         "UpdateEntries",
+                                         updates,
+                                         G_DBUS_CALL_FLAGS_NONE,
+                                         -1,  /* default timeout */
+                                         cancellable,
+                                         error);
+
+  return (return_value != NULL);
+}
+
+static void update_entries_cb (GObject      *obj,
+                               GAsyncResult *result,
+                               gpointer      user_data);
+
+/**
+ * mwsc_scheduler_update_entries_async:
+ * @self: a #MwscScheduler
+ * @entries: (element-type MwscScheduleEntry): non-empty array of schedule
+ *    entries to update
+ * @properties: (element-type GVariant): array of #GVariants of type `a{sv}`
+ *    giving the new property values for each of @entries
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: callback to invoke on completion
+ * @user_data: user data to pass to @callback
+ *
+ * Update the properties of several schedule entries at once. The element of
+ * @properties at each index gives the new property values for the element of
+ * @entries at the same index. All of the changes are applied atomically by the
+ * scheduler, which reschedules once after applying them. This is more
+ * efficient than setting the properties on each #MwscScheduleEntry
+ * individually.
+ *
+ * If any of the changes are invalid, none of them are applied and an error is
+ * returned. All of @entries must have been created by this process.
+ *
+ * If any of the #GVariants in @properties are floating, they are consumed.
+ *
+ * The keys in @properties are the D-Bus property names. The following are
+ * currently supported:
+ *
+ *  * `Resumable` (`b`): sets #MwscScheduleEntry:resumable
+ *  * `Priority` (`u`): sets #MwscScheduleEntry:priority
+ *  * `ExpectedSize` (`t`): sets #MwscScheduleEntry:expected-size
+ *  * `Deadline` (`t`): sets #MwscScheduleEntry:deadline
+ *  * `BindToConnection` (`b`): sets #MwscScheduleEntry:bind-to-connection
+ *
+ * Since: 0.3.0
+ */
+void
+mwsc_scheduler_update_entries_async (MwscScheduler       *self,
+                                     GPtrArray           *entries,
+                                     GPtrArray           *properties,
+                                     GCancellable        *cancellable,
+                                     GAsyncReadyCallback  callback,
+                                     gpointer             user_data)
+{
+  g_return_if_fail (MWSC_IS_SCHEDULER (self));
+  g_return_if_fail (entries != NULL && entries->len > 0);
+  g_return_if_fail (properties != NULL && properties->len == entries->len);
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+  g_autoptr(GTask) task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, mwsc_scheduler_update_entries_async);
+
+  if (!check_invalidated_with_task (self, task))
+    return;
+
+  GVariant *updates = updates_to_variant (entries, properties);
+  g_return_if_fail (updates != NULL);
+
+  g_debug ("Updating %u schedule entries over D-Bus", entries->len);
+
+  g_dbus_proxy_call (self->proxy,
+                     "UpdateEntries",
+                     updates,
+                     G_DBUS_CALL_FLAGS_NONE,
+                     -1,  /* default timeout */
+                     cancellable,
+                     update_entries_cb,
+                     g_steal_pointer (&task));
+}
+
+static void
+update_entries_cb (GObject      *obj,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+  GDBusProxy *proxy = G_DBUS_PROXY (obj);
+  g_autoptr(GTask) task = G_TASK (user_data);
+  g_autoptr(GError) local_error = NULL;
+
+  /* Check for errors. */
+  g_autoptr(GVariant) return_value = NULL;
+  return_value = g_dbus_proxy_call_finish (proxy, result, &local_error);
+
+  if (local_error != NULL)
+    g_task_return_error (task, g_steal_pointer (&local_error));
+  else
+    g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * mwsc_scheduler_update_entries_finish:
+ * @self: a #MwscScheduler
+ * @result: asynchronous operation result
+ * @error: return location for a #GError
+ *
+ * Finish updating schedule entries. See mwsc_scheduler_update_entries_async().
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 0.3.0
+ */
+gboolean
+mwsc_scheduler_update_entries_finish (MwscScheduler  *self,
+                                      GAsyncResult   *result,
+                                      GError        **error)
+{
+  g_return_val_if_fail (MWSC_IS_SCHEDULER (self), FALSE);
+  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+  g_return_val_if_fail (g_async_result_is_tagged (result, mwsc_scheduler_update_entries_async), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/* Returns a floating reference, or %NULL if any of the @entries are invalid. */
+static GVariant *
+entries_to_variant (GPtrArray *entries)
+{
+  g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("(ao)"));
+  g_variant_builder_open (&builder, G_VARIANT_TYPE ("ao"));
+
+  for (gsize i = 0; i < entries->len; i++)
+    {
+      MwscScheduleEntry *entry = g_ptr_array_index (entries, i);
+      g_autofree gchar *object_path = NULL;
+
+      g_return_val_if_fail (MWSC_IS_SCHEDULE_ENTRY (entry), NULL);
+
+      g_object_get (entry, "object-path", &object_path, NULL);
+      g_variant_builder_add (&builder, "o", object_path);
+    }
+
+  g_variant_builder_close (&builder);
+
+  return g_variant_builder_end (&builder);
+}
+
+/**
+ * mwsc_scheduler_remove_entries:
+ * @self: a #MwscScheduler
+ * @entries: (element-type MwscScheduleEntry): non-empty array of schedule
+ *    entries to remove
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @error: return location for a #GError, or %NULL
+ *
+ * Synchronous version of mwsc_scheduler_remove_entries_async().
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 0.3.0
+ */
+gboolean
+mwsc_scheduler_remove_entries (MwscScheduler  *self,
+                               GPtrArray      *entries,
+                               GCancellable   *cancellable,
+                               GError        **error)
+{
+  g_return_val_if_fail (MWSC_IS_SCHEDULER (self), FALSE);
+  g_return_val_if_fail (entries != NULL && entries->len > 0, FALSE);
+  g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  if (!check_invalidated_with_error (self, error))
+    return FALSE;
+
+  GVariant *entries_variant = entries_to_variant (entries);
+  g_return_val_if_fail (entries_variant != NULL, FALSE);
+
+  g_debug ("Removing %u schedule entries over D-Bus", entries->len);
+
+  g_autoptr(GVariant) return_value = NULL;
+  return_value = g_dbus_proxy_call_sync (self->proxy,
+                                         "RemoveEntries",
+                                         entries_variant,
+                                         G_DBUS_CALL_FLAGS_NONE,
+                                         -1,  /* default timeout */
+                                         cancellable,
+                                         error);
+
+  return (return_value != NULL);
+}
+
+static void remove_entries_cb (GObject      *obj,
+                               GAsyncResult *result,
+                               gpointer      user_data);
+
+/**
+ * mwsc_scheduler_remove_entries_async:
+ * @self: a #MwscScheduler
+ * @entries: (element-type MwscScheduleEntry): non-empty array of schedule
+ *    entries to remove
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: callback to invoke on completion
+ * @user_data: user data to pass to @callback
+ *
+ * Remove several schedule entries from the scheduler at once. This is
+ * equivalent to calling mwsc_schedule_entry_remove_async() on each of them,
+ * but the scheduler removes them all together and reschedules once, and only
+ * one D-Bus call is made.
+ *
+ * If any of @entries are unknown to the scheduler, none of them are removed
+ * and an error is returned. All of @entries must have been created by this
+ * process.
+ *
+ * Each of the removed @entries will be invalidated, as with
+ * mwsc_schedule_entry_remove_async().
+ *
+ * Since: 0.3.0
+ */
+void
+mwsc_scheduler_remove_entries_async (MwscScheduler       *self,
+                                     GPtrArray           *entries,
+                                     GCancellable        *cancellable,
+                                     GAsyncReadyCallback  callback,
+                                     gpointer             user_data)
+{
+  g_return_if_fail (MWSC_IS_SCHEDULER (self));
+  g_return_if_fail (entries != NULL && entries->len > 0);
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+  g_autoptr(GTask) task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, mwsc_scheduler_remove_entries_async);
+
+  if (!check_invalidated_with_task (self, task))
+    return;
+
+  GVariant *entries_variant = entries_to_variant (entries);
+  g_return_if_fail (entries_variant != NULL);
+
+  g_debug ("Removing %u schedule entries over D-Bus", entries->len);
+
+  g_dbus_proxy_call (self->proxy,
+                     "RemoveEntries",
+                     entries_variant,
+                     G_DBUS_CALL_FLAGS_NONE,
+                     -1,  /* default timeout */
+                     cancellable,
+                     remove_entries_cb,
+                     g_steal_pointer (&task));
+}
+
+static void
+remove_entries_cb (GObject      *obj,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+  GDBusProxy *proxy = G_DBUS_PROXY (obj);
+  g_autoptr(GTask) task = G_TASK (user_data);
+  g_autoptr(GError) local_error = NULL;
+
+  /* Check for errors. */
+  g_autoptr(GVariant) return_value = NULL;
+  return_value = g_dbus_proxy_call_finish (proxy, result, &local_error);
+
+  if (local_error != NULL)
+    g_task_return_error (task, g_steal_pointer (&local_error));
+  else
+    g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * mwsc_scheduler_remove_entries_finish:
+ * @self: a #MwscScheduler
+ * @result: asynchronous operation result
+ * @error: return location for a #GError
+ *
+ * Finish removing schedule entries. See mwsc_scheduler_remove_entries_async().
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 0.3.0
+ */
+gboolean
+mwsc_scheduler_remove_entries_finish (MwscScheduler  *self,
+                                      GAsyncResult   *result,
+                                      GError        **error)
+{
+  g_return_val_if_fail (MWSC_IS_SCHEDULER (self), FALSE);
+  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+  g_return_val_if_fail (g_async_result_is_tagged (result, mwsc_scheduler_remove_entries_async), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/**
+ * mwsc_scheduler_get_metrics:
+ * @self: a #MwscScheduler
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @error: return location for a #GError, or %NULL
+ *
+ * Synchronous version of mwsc_scheduler_get_metrics_async().
+ *
+ * Returns: (transfer full): the scheduler’s metrics as an `a{sv}`, or %NULL on
+ *    error
+ * Since: 0.3.0
+ */
+GVariant *
+mwsc_scheduler_get_metrics (MwscScheduler  *self,
+                            GCancellable   *cancellable,
+                            GError        **error)
+{
+  g_return_val_if_fail (MWSC_IS_SCHEDULER (self), NULL);
+  g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  if (!check_invalidated_with_error (self, error))
+    return NULL;
+
+  g_debug ("Getting scheduler metrics over D-Bus");
+
+  /* The Metrics interface is on the same object as the Scheduler interface
+   * which @proxy is for. */
+  g_autoptr(GVariant) return_value = NULL;
+  return_value = g_dbus_connection_call_sync (g_dbus_proxy_get_connection (self->proxy),
+                                              g_dbus_proxy_get_name (self->proxy),
+                                              g_dbus_proxy_get_object_path (self->proxy),
+                                              "com.endlessm.DownloadManager1.Metrics",
+                                              "GetMetrics",
+                                              NULL,  /* no arguments */
+                                              G_VARIANT_TYPE ("(a{sv})"),
+                                              G_DBUS_CALL_FLAGS_NONE,
+                                              -1,  /* default timeout */
+                                              cancellable,
+                                              error);
+
+  if (return_value == NULL)
+    return NULL;
+
+  return g_variant_get_child_value (return_value, 0);
+}
+
+static void get_metrics_cb (GObject      *obj,
+                            GAsyncResult *result,
+                            gpointer      user_data);
+
+/**
+ * mwsc_scheduler_get_metrics_async:
+ * @self: a #MwscScheduler
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: callback to invoke on completion
+ * @user_data: user data to pass to @callback
+ *
+ * Get a snapshot of the scheduler daemon’s performance counters, from its
+ * `com.endlessm.DownloadManager1.Metrics` interface. This is intended for
+ * debugging and monitoring tools.
+ *
+ * The metrics are returned as an `a{sv}`. The set of keys is not fixed, and
+ * new ones may be added in future.
+ *
+ * Since: 0.3.0
+ */
+void
+mwsc_scheduler_get_metrics_async (MwscScheduler       *self,
+                                  GCancellable        *cancellable,
+                                  GAsyncReadyCallback  callback,
+                                  gpointer             user_data)
+{
+  g_return_if_fail (MWSC_IS_SCHEDULER (self));
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+  g_autoptr(GTask) task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, mwsc_scheduler_get_metrics_async);
+
+  if (!check_invalidated_with_task (self, task))
+    return;
+
+  g_debug ("Getting scheduler metrics over D-Bus");
+
+  /* The Metrics interface is on the same object as the Scheduler interface
+   * which @proxy is for. */
+  g_dbus_connection_call (g_dbus_proxy_get_connection (self->proxy),
+                          g_dbus_proxy_get_name (self->proxy),
+                          g_dbus_proxy_get_object_path (self->proxy),
+                          "com.endlessm.DownloadManager1.Metrics",
+                          "GetMetrics",
+                          NULL,  /* no arguments */
+                          G_VARIANT_TYPE ("(a{sv})"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,  /* default timeout */
+                          cancellable,
+                          get_metrics_cb,
+                          g_steal_pointer (&task));
+}
+
+static void
+get_metrics_cb (GObject      *obj,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+  GDBusConnection *connection = G_DBUS_CONNECTION (obj);
+  g_autoptr(GTask) task = G_TASK (user_data);
+  g_autoptr(GError) local_error = NULL;
+
+  /* Check for errors. */
+  g_autoptr(GVariant) return_value = NULL;
+  return_value = g_dbus_connection_call_finish (connection, result, &local_error);
+
+  if (local_error != NULL)
+    g_task_return_error (task, g_steal_pointer (&local_error));
+  else
+    g_task_return_pointer (task, g_variant_get_child_value (return_value, 0),
+                           (GDestroyNotify) g_variant_unref);
+}
+
+/**
+ * mwsc_scheduler_get_metrics_finish:
+ * @self: a #MwscScheduler
+ * @result: asynchronous operation result
+ * @error: return location for a #GError
+ *
+ * Finish getting the scheduler’s metrics. See
+ * mwsc_scheduler_get_metrics_async().
+ *
+ * Returns: (transfer full): the scheduler’s metrics as an `a{sv}`, or %NULL on
+ *    error
+ * Since: 0.3.0
+ */
+GVariant *
+mwsc_scheduler_get_metrics_finish (MwscScheduler  *self,
+                                   GAsyncResult   *result,
+                                   GError        **error)
+{
+  g_return_val_if_fail (MWSC_IS_SCHEDULER (self), NULL);
+  g_return_val_if_fail (g_task_is_valid (result, self), NULL);
+  g_return_val_if_fail (g_async_result_is_tagged (result, mwsc_scheduler_get_metrics_async), NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/* Build #MwscScheduleEntrys from the return value of a GetManagedObjects call,
+ * which is of type `(a{oa{sa{sv}}})`. Objects which don’t implement the
+ * com.endlessm.DownloadManager1.ScheduleEntry interface are ignored. As with
+ * entries_from_variant(), this doesn’t need to make any D-Bus calls. */
+static GPtrArray *
+entries_from_managed_objects (MwscScheduler  *self,
+                              GVariant       *return_value,
+                              GError        **error)
+{
+  gboolean shared = (self->entries_subscription_id != 0);
+  g_autoptr(GVariant) objects_variant = g_variant_get_child_value (return_value, 0);
+  gsize n_objects = g_variant_n_children (objects_variant);
+
+  g_autoptr(GPtrArray) entries = NULL;
+  entries = g_ptr_array_new_full (n_objects, g_object_unref);
+
+  for (gsize i = 0; i < n_objects; i++)
+    {
+      const gchar *schedule_entry_path;
+      g_autoptr(GVariant) interfaces = NULL;
+      g_autoptr(GVariant) properties = NULL;
+      g_autoptr(GDBusProxy) proxy = NULL;
+      g_autoptr(MwscScheduleEntry) entry = NULL;
+
+      g_variant_get_child (objects_variant, i, "{&o@a{sa{sv}}}",
+                           &schedule_entry_path, &interfaces);
+
+      properties = g_variant_lookup_value (interfaces,
+                                           "com.endlessm.DownloadManager1.ScheduleEntry",
+                                           G_VARIANT_TYPE_VARDICT);
+      if (properties == NULL)
+        continue;
+
+      proxy = entry_proxy_new (self, schedule_entry_path, properties, shared, error);
+      if (proxy == NULL)
+        return NULL;
+
+      if (shared)
+        entry = shared_entry_new (self, proxy, error);
+      else
+        entry = mwsc_schedule_entry_new_from_proxy (proxy, error);
+
+      if (entry == NULL)
+        return NULL;
+
+      g_ptr_array_add (entries, g_steal_pointer (&entry));
+    }
+
+  return g_steal_pointer (&entries);
+}
+
+/**
+ * mwsc_scheduler_list_entries:
+ * @self: a #MwscScheduler
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @error: return location for a #GError, or %NULL
+ *
+ * Synchronous version of mwsc_scheduler_list_entries_async().
+ *
+ * Returns: (transfer full) (element-type MwscScheduleEntry): a potentially
+ *    empty array of the #MwscScheduleEntrys visible to this client
+ * Since: 0.3.0
+ */
+GPtrArray *
+mwsc_scheduler_list_entries (MwscScheduler  *self,
+                             GCancellable   *cancellable,
+                             GError        **error)
+{
+  g_return_val_if_fail (MWSC_IS_SCHEDULER (self), NULL);
+  g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  if (!check_invalidated_with_error (self, error))
+    return NULL;
+
+  /* Subscribe to signals for the entries before listing them. */
+  ensure_entries_subscription (self);
+
+  g_debug ("Listing schedule entries over D-Bus");
+
+  /* The ObjectManager interface is on the same object as the Scheduler
+   * interface which @proxy is for. */
+  g_autoptr(GVariant) return_value = NULL;
+  return_value = g_dbus_connection_call_sync (g_dbus_proxy_get_connection (self->proxy),
+                                              g_dbus_proxy_get_name (self->proxy),
+                                              g_dbus_proxy_get_object_path (self->proxy),
+                                              "org.freedesktop.DBus.ObjectManager",
+                                              "GetManagedObjects",
+                                              NULL,  /* no arguments */
+                                              G_VARIANT_TYPE ("(a{oa{sa{sv}}})"),
+                                              G_DBUS_CALL_FLAGS_NONE,
+                                              -1,  /* default timeout */
+                                              cancellable,
+                                              error);
+
+  if (return_value == NULL)
+    return NULL;
+
+  return entries_from_managed_objects (self, return_value, error);
+}
+
+static void list_entries_cb (GObject      *obj,
+                             GAsyncResult *result,
+                             gpointer      user_data);
+
+/**
+ * mwsc_scheduler_list_entries_async:
+ * @self: a #MwscScheduler
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: callback to invoke on completion
+ * @user_data: user data to pass to @callback
+ *
+ * List all the schedule entries which this client owns, along with their
+ * current properties, in a single D-Bus call, using the scheduler’s
+ * `org.freedesktop.DBus.ObjectManager` interface. This avoids making one call
+ * per entry to load its properties, which is slow for clients (such as
+ * dashboards) with thousands of entries.
+ *
+ * If this client has called `Monitor()` on the scheduler, entries owned by all
+ * clients are returned. Entries owned by other clients can be inspected, but
+ * any attempt to modify or remove them will fail.
+ *
+ * As with mwsc_scheduler_schedule_entries_async(), the returned entries share
+ * a single signal subscription owned by the #MwscScheduler when connected over
+ * a message bus.
+ *
+ * Since: 0.3.0
+ */
+void
+mwsc_scheduler_list_entries_async (MwscScheduler       *self,
+                                   GCancellable        *cancellable,
+                                   GAsyncReadyCallback  callback,
+                                   gpointer             user_data)
+{
+  g_return_if_fail (MWSC_IS_SCHEDULER (self));
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+  g_autoptr(GTask) task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, mwsc_scheduler_list_entries_async);
+
+  if (!check_invalidated_with_task (self, task))
+    return;
+
+  /* Subscribe to signals for the entries before listing them. */
+  ensure_entries_subscription (self);
+
+  g_debug ("Listing schedule entries over D-Bus");
+
+  /* The ObjectManager interface is on the same object as the Scheduler
+   * interface which @proxy is for. */
+  g_dbus_connection_call (g_dbus_proxy_get_connection (self->proxy),
+                          g_dbus_proxy_get_name (self->proxy),
+                          g_dbus_proxy_get_object_path (self->proxy),
+                          "org.freedesktop.DBus.ObjectManager",
+                          "GetManagedObjects",
+                          NULL,  /* no arguments */
+                          G_VARIANT_TYPE ("(a{oa{sa{sv}}})"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,  /* default timeout */
+                          cancellable,
+                          list_entries_cb,
+                          g_steal_pointer (&task));
+}
+
+static void
+list_entries_cb (GObject      *obj,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  GDBusConnection *connection = G_DBUS_CONNECTION (obj);
+  g_autoptr(GTask) task = G_TASK (user_data);
+  MwscScheduler *self = g_task_get_source_object (task);
+  g_autoptr(GError) local_error = NULL;
+
+  /* Grab the schedule entries. */
+  g_autoptr(GVariant) return_value = NULL;
+  return_value = g_dbus_connection_call_finish (connection, result, &local_error);
+
+  if (local_error != NULL)
+    {
+      g_task_return_error (task, g_steal_pointer (&local_error));
+      return;
+    }
+
+  g_autoptr(GPtrArray) entries = entries_from_managed_objects (self, return_value, &local_error);
+
+  if (entries == NULL)
+    g_task_return_error (task, g_steal_pointer (&local_error));
+  else
+    g_task_return_pointer (task, g_steal_pointer (&entries),
+                           (GDestroyNotify) g_ptr_array_unref);
+}
+
+/**
+ * mwsc_scheduler_list_entries_finish:
+ * @self: a #MwscScheduler
+ * @result: asynchronous operation result
+ * @error: return location for a #GError
+ *
+ * Finish listing the schedule entries. See
+ * mwsc_scheduler_list_entries_async().
+ *
+ * Returns: (transfer full) (element-type MwscScheduleEntry): a potentially
+ *    empty array of the #MwscScheduleEntrys visible to this client
+ * Since: 0.3.0
+ */
+GPtrArray *
+mwsc_scheduler_list_entries_finish (MwscScheduler  *self,
+                                    GAsyncResult   *result,
+                                    GError        **error)
+{
+  g_return_val_if_fail (MWSC_IS_SCHEDULER (self), NULL);
+  g_return_val_if_fail (g_task_is_valid (result, self), NULL);
+  g_return_val_if_fail (g_async_result_is_tagged (result, mwsc_scheduler_list_entries_async), NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
 /**
  * mwsc_scheduler_get_allow_downloads:
  * @self: a #MwscScheduler
@@ -133,6 +133,56 @@ gboolean           mwsc_scheduler_release_finish (MwscScheduler        *self,
                                                   GAsyncResult         *result,
                                                   GError              **error);
 
+gboolean           mwsc_scheduler_update_entries        (MwscScheduler        *self,
+                                                         GPtrArray            *entries,
+                                                         GPtrArray            *properties,
+                                                         GCancellable         *cancellable,
+                                                         GError              **error);
+void               mwsc_scheduler_update_entries_async  (MwscScheduler        *self,
+                                                         GPtrArray            *entries,
+                                                         GPtrArray            *properties,
+                                                         GCancellable         *cancellable,
+                                                         GAsyncReadyCallback   callback,
+                                                         gpointer              user_data);
+gboolean           mwsc_scheduler_update_entries_finish (MwscScheduler        *self,
+                                                         GAsyncResult         *result,
+                                                         GError              **error);
+
+gboolean           mwsc_scheduler_remove_entries        (MwscScheduler        *self,
+                                                         GPtrArray            *entries,
+                                                         GCancellable         *cancellable,
+                                                         GError              **error);
+void               mwsc_scheduler_remove_entries_async  (MwscScheduler        *self,
+                                                         GPtrArray            *entries,
+                                                         GCancellable         *cancellable,
+                                                         GAsyncReadyCallback   callback,
+                                                         gpointer              user_data);
+gboolean           mwsc_scheduler_remove_entries_finish (MwscScheduler        *self,
+                                                         GAsyncResult         *result,
+                                                         GError              **error);
+
+GVariant          *mwsc_scheduler_get_metrics        (MwscScheduler        *self,
+                                                       GCancellable         *cancellable,
+                                                       GError              **error);
+void               mwsc_scheduler_get_metrics_async  (MwscScheduler        *self,
+                                                       GCancellable         *cancellable,
+                                                       GAsyncReadyCallback   callback,
+                                                       gpointer              user_data);
+GVariant          *mwsc_scheduler_get_metrics_finish (MwscScheduler        *self,
+                                                       GAsyncResult         *result,
+                                                       GError              **error);
+
+GPtrArray         *mwsc_scheduler_list_entries        (MwscScheduler        *self,
+                                                       GCancellable         *cancellable,
+                                                       GError              **error);
+void               mwsc_scheduler_list_entries_async  (MwscScheduler        *self,
+                                                       GCancellable         *cancellable,
+                                                       GAsyncReadyCallback   callback,
+                                                       gpointer              user_data);
+GPtrArray         *mwsc_scheduler_list_entries_finish (MwscScheduler        *self,
+                                                       GAsyncResult         *result,
+                                                       GError              **error);
+
 gboolean           mwsc_scheduler_get_allow_downloads (MwscScheduler *self);
 
 G_END_DECLS
@@ -24,14 +24,24 @@
 
 #include <glib.h>
 #include <gio/gio.h>
+#include <libmogwai-schedule/object-manager-interface.h>
+#include <libmogwai-schedule/schedule-entry-interface.h>
+#include <libmogwai-schedule/scheduler-interface.h>
+#include <libmogwai-schedule-client/schedule-entry.h>
 #include <libmogwai-schedule-client/scheduler.h>
+#include <glib/gstdio.h>
 #include <locale.h>
 
 
+#define MOCK_SERVICE_NAME "com.endlessm.MogwaiSchedule1.Test"
+#define MOCK_OBJECT_PATH "/com/endlessm/DownloadManager1"
+#define MOCK_ENTRY_PATH_PREFIX MOCK_OBJECT_PATH "/ScheduleEntry/"
+
 typedef struct
 {
   GTestDBus *bus;  /* (owned) */
   GDBusConnection *connection;  /* (owned) */
+  gchar *service_dir;  /* (owned) (nullable) */
 } Fixture;
 
 static void
@@ -52,6 +62,41 @@ setup (Fixture       *fixture,
   g_assert_no_error (error);
 }
 
+/* As setup(), but make the bus able to activate the service name used by the
+ * mock service (see %MOCK_SERVICE_NAME), as it would for the real service.
+ * Actually trying to activate it will fail. */
+static void
+setup_activatable (Fixture       *fixture,
+                   gconstpointer  test_data)
+{
+  g_autoptr(GError) error = NULL;
+
+  fixture->service_dir = g_dir_make_tmp ("mogwai-schedule-client-tests-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  g_autofree gchar *service_file = g_build_filename (fixture->service_dir,
+                                                     MOCK_SERVICE_NAME ".service",
+                                                     NULL);
+  g_file_set_contents (service_file,
+                       "[D-BUS Service]\n"
+                       "Name=" MOCK_SERVICE_NAME "\n"
+                       "Exec=/bin/false\n",
+                       -1, &error);
+  g_assert_no_error (error);
+
+  fixture->bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+  g_test_dbus_add_service_dir (fixture->bus, fixture->service_dir);
+  g_test_dbus_up (fixture->bus);
+
+  fixture->connection = g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (fixture->bus),
+                                                                G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                                                G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                                                NULL,
+                                                                NULL,
+                                                                &error);
+  g_assert_no_error (error);
+}
+
 static void
 teardown (Fixture       *fixture,
           gconstpointer  test_data)
@@ -62,6 +107,16 @@ teardown (Fixture       *fixture,
 
   g_test_dbus_down (fixture->bus);
   g_clear_object (&fixture->bus);
+
+  if (fixture->service_dir != NULL)
+    {
+      g_autofree gchar *service_file = g_build_filename (fixture->service_dir,
+                                                         MOCK_SERVICE_NAME ".service",
+                                                         NULL);
+      g_assert_cmpint (g_unlink (service_file), ==, 0);
+      g_assert_cmpint (g_rmdir (fixture->service_dir), ==, 0);
+    }
+  g_clear_pointer (&fixture->service_dir, g_free);
 }
 
 static void
@@ -73,6 +128,634 @@ async_result_cb (GObject      *obj,
   *result_out = g_object_ref (result);
 }
 
+/* A minimal in-process mock of the scheduler service, on its own connection to
+ * the test bus. It exports the scheduler (and its object manager) at
+ * %MOCK_OBJECT_PATH, and an object for each schedule entry created with ScheduleEntriesFull() or
+ * mock_service_add_entry(). Only the parts of the D-Bus API which the
+ * #MwscScheduler tests need are implemented. Signals are broadcast.
+ *
+ * As the mock runs in the same main context as the client, the tests must only
+ * use the asynchronous client APIs. */
+typedef struct _MockService MockService;
+
+typedef struct
+{
+  MockService *service;  /* (unowned) */
+  gchar *object_path;  /* (owned) */
+  GVariant *properties;  /* (owned); a{sv} */
+  GVariant *set_properties;  /* (owned) (nullable); a{sv} from SetProperties() */
+  guint registration_id;
+} MockEntry;
+
+struct _MockService
+{
+  GDBusConnection *connection;  /* (owned) */
+  guint scheduler_registration_id;
+  guint object_manager_registration_id;
+  GHashTable *entries;  /* (owned) (element-type utf8 MockEntry) */
+  guint next_entry_id;
+};
+
+static void
+mock_entry_free (MockEntry *entry)
+{
+  g_dbus_connection_unregister_object (entry->service->connection,
+                                       entry->registration_id);
+  g_free (entry->object_path);
+  g_variant_unref (entry->properties);
+  g_clear_pointer (&entry->set_properties, g_variant_unref);
+  g_free (entry);
+}
+
+static void
+mock_entry_method_call (GDBusConnection       *connection,
+                        const gchar           *sender,
+                        const gchar           *object_path,
+                        const gchar           *interface_name,
+                        const gchar           *method_name,
+                        GVariant              *parameters,
+                        GDBusMethodInvocation *invocation,
+                        gpointer               user_data)
+{
+  MockEntry *entry = user_data;
+
+  if (g_str_equal (method_name, "SetProperties"))
+    {
+      g_clear_pointer (&entry->set_properties, g_variant_unref);
+      entry->set_properties = g_variant_get_child_value (parameters, 0);
+      g_dbus_method_invocation_return_value (invocation, NULL);
+    }
+  else
+    {
+      g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+                                             G_DBUS_ERROR_NOT_SUPPORTED,
+                                             "Not implemented by the mock");
+    }
+}
+
+static GVariant *
+mock_entry_get_property (GDBusConnection  *connection,
+                         const gchar      *sender,
+                         const gchar      *object_path,
+                         const gchar      *interface_name,
+                         const gchar      *property_name,
+                         GError          **error,
+                         gpointer          user_data)
+{
+  MockEntry *entry = user_data;
+
+  return g_variant_lookup_value (entry->properties, property_name, NULL);
+}
+
+static const GDBusInterfaceVTable mock_entry_vtable =
+{
+  mock_entry_method_call,
+  mock_entry_get_property,
+  NULL,  /* set_property */
+};
+
+/* Add a schedule entry to @service at @object_path, with default properties
+ * apart from those given. Returns the new entry, which is owned by @service. */
+static MockEntry *
+mock_service_add_entry (MockService *service,
+                        const gchar *object_path,
+                        gboolean     download_now,
+                        guint32      priority)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_auto(GVariantDict) dict = G_VARIANT_DICT_INIT (NULL);
+
+  g_variant_dict_insert (&dict, "DownloadNow", "b", download_now);
+  g_variant_dict_insert (&dict, "Priority", "u", priority);
+  g_variant_dict_insert (&dict, "Resumable", "b", FALSE);
+  g_variant_dict_insert (&dict, "ExpectedSize", "t", (guint64) 0);
+  g_variant_dict_insert (&dict, "Deadline", "t", (guint64) 0);
+  g_variant_dict_insert (&dict, "BindToConnection", "b", FALSE);
+  g_variant_dict_insert (&dict, "Connection", "s", "");
+  g_variant_dict_insert (&dict, "MaxRate", "t", (guint64) 0);
+  g_variant_dict_insert (&dict, "DownloadStartsAt", "t", (guint64) 0);
+  g_variant_dict_insert (&dict, "DownloadedSize", "t", (guint64) 0);
+
+  MockEntry *entry = g_new0 (MockEntry, 1);
+  entry->service = service;
+  entry->object_path = g_strdup (object_path);
+  entry->properties = g_variant_ref_sink (g_variant_dict_end (&dict));
+  entry->registration_id =
+      g_dbus_connection_register_object (service->connection, object_path,
+                                         (GDBusInterfaceInfo *) &schedule_entry_interface,
+                                         &mock_entry_vtable, entry, NULL,
+                                         &local_error);
+  g_assert_no_error (local_error);
+
+  g_hash_table_replace (service->entries, entry->object_path, entry);
+
+  return entry;
+}
+
+/* Look up the mock entry for @entry’s object path. */
+static MockEntry *
+mock_service_get_entry (MockService       *service,
+                        MwscScheduleEntry *entry)
+{
+  g_autofree gchar *object_path = g_strconcat (MOCK_ENTRY_PATH_PREFIX,
+                                               mwsc_schedule_entry_get_id (entry),
+                                               NULL);
+  MockEntry *mock_entry = g_hash_table_lookup (service->entries, object_path);
+  g_assert_nonnull (mock_entry);
+
+  return mock_entry;
+}
+
+/* Change a property of @entry, and emit PropertiesChanged for it. If @value is
+ * floating, it is consumed. */
+static void
+mock_entry_update_property (MockEntry   *entry,
+                            const gchar *property_name,
+                            GVariant    *value)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GVariant) value_sunk = g_variant_ref_sink (value);
+  g_auto(GVariantDict) dict = G_VARIANT_DICT_INIT (entry->properties);
+
+  g_variant_dict_insert_value (&dict, property_name, value_sunk);
+  g_variant_unref (entry->properties);
+  entry->properties = g_variant_ref_sink (g_variant_dict_end (&dict));
+
+  g_auto(GVariantBuilder) changed_builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&changed_builder, "{sv}", property_name, value_sunk);
+
+  g_dbus_connection_emit_signal (entry->service->connection,
+                                 NULL,  /* broadcast */
+                                 entry->object_path,
+                                 "org.freedesktop.DBus.Properties",
+                                 "PropertiesChanged",
+                                 g_variant_new ("(sa{sv}as)",
+                                                "com.endlessm.DownloadManager1.ScheduleEntry",
+                                                &changed_builder, NULL),
+                                 &local_error);
+  g_assert_no_error (local_error);
+}
+
+static void
+mock_scheduler_method_call (GDBusConnection       *connection,
+                            const gchar           *sender,
+                            const gchar           *object_path,
+                            const gchar           *interface_name,
+                            const gchar           *method_name,
+                            GVariant              *parameters,
+                            GDBusMethodInvocation *invocation,
+                            gpointer               user_data)
+{
+  MockService *service = user_data;
+
+  if (g_str_equal (method_name, "ScheduleEntriesFull"))
+    {
+      g_autoptr(GVariantIter) iter = NULL;
+      GVariant *entry_parameters;
+      g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("a(oa{sv})"));
+
+      g_variant_get (parameters, "(aa{sv})", &iter);
+
+      while (g_variant_iter_loop (iter, "@a{sv}", &entry_parameters))
+        {
+          guint32 priority = 0;
+          g_variant_lookup (entry_parameters, "priority", "u", &priority);
+
+          g_autofree gchar *entry_path = g_strdup_printf (MOCK_ENTRY_PATH_PREFIX "%u",
+                                                          service->next_entry_id++);
+          MockEntry *entry = mock_service_add_entry (service, entry_path, FALSE, priority);
+          g_variant_builder_add (&builder, "(o@a{sv})",
+                                 entry->object_path, entry->properties);
+        }
+
+      g_dbus_method_invocation_return_value (invocation,
+                                             g_variant_new ("(a(oa{sv}))", &builder));
+    }
+  else if (g_str_equal (method_name, "GetManagedObjects"))
+    {
+      g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("a{oa{sa{sv}}}"));
+      GHashTableIter iter;
+      gpointer value;
+
+      g_hash_table_iter_init (&iter, service->entries);
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+        {
+          MockEntry *entry = value;
+
+          g_variant_builder_open (&builder, G_VARIANT_TYPE ("{oa{sa{sv}}}"));
+          g_variant_builder_add (&builder, "o", entry->object_path);
+          g_variant_builder_open (&builder, G_VARIANT_TYPE ("a{sa{sv}}"));
+          g_variant_builder_add (&builder, "{s@a{sv}}",
+                                 "com.endlessm.DownloadManager1.ScheduleEntry",
+                                 entry->properties);
+          g_variant_builder_close (&builder);
+          g_variant_builder_close (&builder);
+        }
+
+      g_dbus_method_invocation_return_value (invocation,
+                                             g_variant_new ("(a{oa{sa{sv}}})", &builder));
+    }
+  else
+    {
+      g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+                                             G_DBUS_ERROR_NOT_SUPPORTED,
+                                             "Not implemented by the mock");
+    }
+}
+
+static GVariant *
+mock_scheduler_get_property (GDBusConnection  *connection,
+                             const gchar      *sender,
+                             const gchar      *object_path,
+                             const gchar      *interface_name,
+                             const gchar      *property_name,
+                             GError          **error,
+                             gpointer          user_data)
+{
+  MockService *service = user_data;
+
+  if (g_str_equal (property_name, "EntryCount"))
+    return g_variant_new_uint32 (g_hash_table_size (service->entries));
+  else if (g_str_equal (property_name, "ActiveEntryCount"))
+    return g_variant_new_uint32 (0);
+  else if (g_str_equal (property_name, "DownloadsAllowed"))
+    return g_variant_new_boolean (TRUE);
+  else
+    g_assert_not_reached ();
+}
+
+static const GDBusInterfaceVTable mock_scheduler_vtable =
+{
+  mock_scheduler_method_call,
+  mock_scheduler_get_property,
+  NULL,  /* set_property */
+};
+
+static MockService *
+mock_service_new (GTestDBus *bus)
+{
+  g_autoptr(GError) local_error = NULL;
+  MockService *service = g_new0 (MockService, 1);
+
+  service->connection = g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (bus),
+                                                                G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                                                G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                                                NULL,
+                                                                NULL,
+                                                                &local_error);
+  g_assert_no_error (local_error);
+
+  /* The keys are owned by the values. */
+  service->entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                            (GDestroyNotify) mock_entry_free);
+  service->next_entry_id = 1;
+
+  service->scheduler_registration_id =
+      g_dbus_connection_register_object (service->connection, MOCK_OBJECT_PATH,
+                                         (GDBusInterfaceInfo *) &scheduler_interface,
+                                         &mock_scheduler_vtable, service, NULL,
+                                         &local_error);
+  g_assert_no_error (local_error);
+
+  service->object_manager_registration_id =
+      g_dbus_connection_register_object (service->connection, MOCK_OBJECT_PATH,
+                                         (GDBusInterfaceInfo *) &object_manager_interface,
+                                         &mock_scheduler_vtable, service, NULL,
+                                         &local_error);
+  g_assert_no_error (local_error);
+
+  return service;
+}
+
+/* Disconnect @service from the bus, which releases its name, and free it. */
+static void
+mock_service_free (MockService *service)
+{
+  g_clear_pointer (&service->entries, g_hash_table_unref);
+  g_dbus_connection_unregister_object (service->connection,
+                                       service->scheduler_registration_id);
+  g_dbus_connection_unregister_object (service->connection,
+                                       service->object_manager_registration_id);
+  g_dbus_connection_close_sync (service->connection, NULL, NULL);
+  g_clear_object (&service->connection);
+  g_free (service);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (MockService, mock_service_free)
+
+/* Request %MOCK_SERVICE_NAME for @service, with the given
+ * `DBUS_NAME_FLAG_*` @flags, and assert that it becomes the primary owner. */
+static void
+mock_service_own_name (MockService *service,
+                       guint32      flags)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GVariant) reply = NULL;
+
+  reply = g_dbus_connection_call_sync (service->connection,
+                                       "org.freedesktop.DBus",
+                                       "/org/freedesktop/DBus",
+                                       "org.freedesktop.DBus",
+                                       "RequestName",
+                                       g_variant_new ("(su)", MOCK_SERVICE_NAME, flags),
+                                       G_VARIANT_TYPE ("(u)"),
+                                       G_DBUS_CALL_FLAGS_NONE,
+                                       -1, NULL, &local_error);
+  g_assert_no_error (local_error);
+
+  guint32 result;
+  g_variant_get (reply, "(u)", &result);
+  g_assert_cmpuint (result, ==, 1  /* DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER */);
+}
+
+/* Make a round trip to the bus daemon from @connection, so that any match rules
+ * it has added are in place before the test carries on. */
+static void
+sync_with_bus (GDBusConnection *connection)
+{
+  g_autoptr(GAsyncResult) result = NULL;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  g_dbus_connection_call (connection,
+                          "org.freedesktop.DBus",
+                          "/org/freedesktop/DBus",
+                          "org.freedesktop.DBus",
+                          "GetId",
+                          NULL, G_VARIANT_TYPE ("(s)"),
+                          G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                          async_result_cb, &result);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  reply = g_dbus_connection_call_finish (connection, result, &local_error);
+  g_assert_no_error (local_error);
+}
+
+/* Create an #MwscScheduler for %MOCK_SERVICE_NAME (or @name, if it’s
+ * non-%NULL) asynchronously, and assert that it succeeds. */
+static MwscScheduler *
+scheduler_new (Fixture     *fixture,
+               const gchar *name)
+{
+  g_autoptr(GAsyncResult) result = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  mwsc_scheduler_new_full_async (fixture->connection,
+                                 (name != NULL) ? name : MOCK_SERVICE_NAME,
+                                 MOCK_OBJECT_PATH,
+                                 NULL,  /* cancellable */
+                                 async_result_cb,
+                                 &result);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_autoptr(MwscScheduler) scheduler = NULL;
+  scheduler = mwsc_scheduler_new_full_finish (result, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (scheduler);
+
+  return g_steal_pointer (&scheduler);
+}
+
+/* Schedule @n_entries entries with default parameters on @scheduler
+ * asynchronously, and assert that it succeeds. */
+static GPtrArray *
+scheduler_schedule_entries (MwscScheduler *scheduler,
+                            guint          n_entries)
+{
+  g_autoptr(GAsyncResult) result = NULL;
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GPtrArray) parameters = g_ptr_array_new ();
+
+  for (guint i = 0; i < n_entries; i++)
+    g_ptr_array_add (parameters, NULL);
+
+  mwsc_scheduler_schedule_entries_async (scheduler, parameters, NULL,
+                                         async_result_cb, &result);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_autoptr(GPtrArray) entries = NULL;
+  entries = mwsc_scheduler_schedule_entries_finish (scheduler, result, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (entries);
+  g_assert_cmpuint (entries->len, ==, n_entries);
+
+  return g_steal_pointer (&entries);
+}
+
+/* Iterate the main context until the scheduler’s proxy reports @name_owner as
+ * its name owner (which may be %NULL). */
+static void
+wait_for_name_owner (MwscScheduler *scheduler,
+                     const gchar   *name_owner)
+{
+  g_autoptr(GDBusProxy) proxy = NULL;
+  g_object_get (scheduler, "proxy", &proxy, NULL);
+  g_assert_nonnull (proxy);
+
+  while (TRUE)
+    {
+      g_autofree gchar *current_name_owner = g_dbus_proxy_get_name_owner (proxy);
+
+      if (g_strcmp0 (current_name_owner, name_owner) == 0)
+        break;
+
+      g_main_context_iteration (NULL, TRUE);
+    }
+}
+
+/* Test that signals for entries created with
+ * mwsc_scheduler_schedule_entries_async(), which share the scheduler’s signal
+ * subscription, are delivered to the right entry, and only to it. */
+static void
+test_scheduler_shared_entries_signals (Fixture       *fixture,
+                                       gconstpointer  test_data)
+{
+  g_autoptr(MockService) service = mock_service_new (fixture->bus);
+  mock_service_own_name (service, 0);
+
+  g_autoptr(MwscScheduler) scheduler = scheduler_new (fixture, NULL);
+  g_autoptr(GPtrArray) entries = scheduler_schedule_entries (scheduler, 2);
+  MwscScheduleEntry *entry0 = entries->pdata[0];
+  MwscScheduleEntry *entry1 = entries->pdata[1];
+
+  g_assert_false (mwsc_schedule_entry_get_download_now (entry0));
+  g_assert_false (mwsc_schedule_entry_get_download_now (entry1));
+
+  mock_entry_update_property (mock_service_get_entry (service, entry0),
+                              "DownloadNow", g_variant_new_boolean (TRUE));
+
+  while (!mwsc_schedule_entry_get_download_now (entry0))
+    g_main_context_iteration (NULL, TRUE);
+
+  mock_entry_update_property (mock_service_get_entry (service, entry1),
+                              "Priority", g_variant_new_uint32 (7));
+
+  while (mwsc_schedule_entry_get_priority (entry1) != 7)
+    g_main_context_iteration (NULL, TRUE);
+
+  /* Signals are delivered in order, so if @entry1 had received the first
+   * signal, it would have done so by now. */
+  g_assert_false (mwsc_schedule_entry_get_download_now (entry1));
+  g_assert_cmpuint (mwsc_schedule_entry_get_priority (entry0), ==, 0);
+}
+
+/* Test that if the service’s name is taken over by another instance, the
+ * shared entries receive signals from the new instance. */
+static void
+test_scheduler_shared_entries_owner_changed (Fixture       *fixture,
+                                             gconstpointer  test_data)
+{
+  g_autoptr(MockService) service1 = mock_service_new (fixture->bus);
+  mock_service_own_name (service1, 1  /* DBUS_NAME_FLAG_ALLOW_REPLACEMENT */);
+
+  g_autoptr(MwscScheduler) scheduler = scheduler_new (fixture, NULL);
+  g_autoptr(GPtrArray) entries = scheduler_schedule_entries (scheduler, 1);
+  MwscScheduleEntry *entry = entries->pdata[0];
+
+  /* Start a second instance, which knows about the same entry, and have it
+   * replace the first. */
+  g_autoptr(MockService) service2 = mock_service_new (fixture->bus);
+  g_autofree gchar *entry_path = g_strconcat (MOCK_ENTRY_PATH_PREFIX,
+                                              mwsc_schedule_entry_get_id (entry),
+                                              NULL);
+  MockEntry *mock_entry2 = mock_service_add_entry (service2, entry_path, FALSE, 0);
+  mock_service_own_name (service2, 2  /* DBUS_NAME_FLAG_REPLACE_EXISTING */);
+
+  wait_for_name_owner (scheduler, g_dbus_connection_get_unique_name (service2->connection));
+  sync_with_bus (fixture->connection);
+
+  /* The entry should now receive signals from the second instance. */
+  mock_entry_update_property (mock_entry2, "DownloadNow", g_variant_new_boolean (TRUE));
+
+  while (!mwsc_schedule_entry_get_download_now (entry))
+    g_main_context_iteration (NULL, TRUE);
+}
+
+static void
+invalidated_cb (GObject      *obj,
+                const GError *error,
+                gpointer      user_data)
+{
+  gboolean *invalidated_out = user_data;
+  *invalidated_out = TRUE;
+}
+
+/* Test that if the service exits while its name is activatable, the scheduler
+ * and its shared entries are not invalidated; and that once the service is
+ * started again, the entries it has restored are reconnected to it, and any
+ * others are invalidated. */
+static void
+test_scheduler_shared_entries_restart (Fixture       *fixture,
+                                       gconstpointer  test_data)
+{
+  g_autoptr(MockService) service1 = mock_service_new (fixture->bus);
+  mock_service_own_name (service1, 0);
+
+  g_autoptr(MwscScheduler) scheduler = scheduler_new (fixture, NULL);
+  g_autoptr(GPtrArray) entries = scheduler_schedule_entries (scheduler, 2);
+  MwscScheduleEntry *entry0 = entries->pdata[0];
+  MwscScheduleEntry *entry1 = entries->pdata[1];
+
+  gboolean scheduler_invalidated = FALSE;
+  gboolean entry0_invalidated = FALSE;
+  gboolean entry1_invalidated = FALSE;
+  g_signal_connect (scheduler, "invalidated", (GCallback) invalidated_cb,
+                    &scheduler_invalidated);
+  g_signal_connect (entry0, "invalidated", (GCallback) invalidated_cb,
+                    &entry0_invalidated);
+  g_signal_connect (entry1, "invalidated", (GCallback) invalidated_cb,
+                    &entry1_invalidated);
+
+  g_autofree gchar *entry0_path = g_strconcat (MOCK_ENTRY_PATH_PREFIX,
+                                               mwsc_schedule_entry_get_id (entry0),
+                                               NULL);
+
+  /* Stop the service, as if it had exited when idle. The scheduler then checks
+   * whether the name is activatable; replies arrive in order, so syncing with
+   * the bus waits for that check to finish. */
+  g_clear_pointer (&service1, mock_service_free);
+  wait_for_name_owner (scheduler, NULL);
+  sync_with_bus (fixture->connection);
+
+  g_assert_false (scheduler_invalidated);
+  g_assert_false (entry0_invalidated);
+  g_assert_false (entry1_invalidated);
+
+  /* Start the service again. It has restored @entry0 (which has since been
+   * made active) but not @entry1. */
+  g_autoptr(MockService) service2 = mock_service_new (fixture->bus);
+  MockEntry *mock_entry0 = mock_service_add_entry (service2, entry0_path, TRUE, 0);
+  mock_service_own_name (service2, 0);
+
+  while (!entry1_invalidated)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_false (scheduler_invalidated);
+  g_assert_false (entry0_invalidated);
+  g_assert_true (mwsc_schedule_entry_get_download_now (entry0));
+
+  /* Method calls from @entry0 should go to the new instance. */
+  g_autoptr(GAsyncResult) result = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  mwsc_schedule_entry_set_priority (entry0, 5);
+  mwsc_schedule_entry_send_properties_async (entry0, NULL, async_result_cb, &result);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_true (mwsc_schedule_entry_send_properties_finish (entry0, result, &local_error));
+  g_assert_no_error (local_error);
+
+  guint32 priority;
+  g_assert_nonnull (mock_entry0->set_properties);
+  g_assert_true (g_variant_lookup (mock_entry0->set_properties, "Priority", "u", &priority));
+  g_assert_cmpuint (priority, ==, 5);
+
+  /* And so should signals. */
+  mock_entry_update_property (mock_entry0, "DownloadNow", g_variant_new_boolean (FALSE));
+
+  while (mwsc_schedule_entry_get_download_now (entry0))
+    g_main_context_iteration (NULL, TRUE);
+}
+
+/* Test that the scheduler and its shared entries are invalidated if the service
+ * exits and can’t be started again, either because its name isn’t activatable
+ * or because the scheduler is for its unique name. The #gconstpointer is
+ * %TRUE to use the unique name. */
+static void
+test_scheduler_shared_entries_vanished (Fixture       *fixture,
+                                        gconstpointer  test_data)
+{
+  gboolean use_unique_name = GPOINTER_TO_INT (test_data);
+
+  g_autoptr(MockService) service = mock_service_new (fixture->bus);
+  mock_service_own_name (service, 0);
+
+  const gchar *name = use_unique_name ? g_dbus_connection_get_unique_name (service->connection) : NULL;
+  g_autoptr(MwscScheduler) scheduler = scheduler_new (fixture, name);
+  g_autoptr(GPtrArray) entries = scheduler_schedule_entries (scheduler, 1);
+  MwscScheduleEntry *entry = entries->pdata[0];
+
+  gboolean scheduler_invalidated = FALSE;
+  gboolean entry_invalidated = FALSE;
+  g_signal_connect (scheduler, "invalidated", (GCallback) invalidated_cb,
+                    &scheduler_invalidated);
+  g_signal_connect (entry, "invalidated", (GCallback) invalidated_cb,
+                    &entry_invalidated);
+
+  g_clear_pointer (&service, mock_service_free);
+
+  while (!scheduler_invalidated || !entry_invalidated)
+    g_main_context_iteration (NULL, TRUE);
+}
+
 /* Test asynchronously constructing an #MwscScheduler object with invalid
  * arguments. */
 static void
@@ -127,6 +810,19 @@ main (int    argc,
               test_service_construction_async_error, teardown);
   g_test_add ("/scheduler/construction/sync/error", Fixture, NULL, setup,
               test_service_construction_sync_error, teardown);
+  g_test_add ("/scheduler/shared-entries/signals", Fixture, NULL, setup,
+              test_scheduler_shared_entries_signals, teardown);
+  g_test_add ("/scheduler/shared-entries/owner-changed", Fixture, NULL, setup,
+              test_scheduler_shared_entries_owner_changed, teardown);
+  g_test_add ("/scheduler/shared-entries/restart", Fixture, NULL,
+              setup_activatable, test_scheduler_shared_entries_restart,
+              teardown);
+  g_test_add ("/scheduler/shared-entries/vanished/well-known-name", Fixture,
+              GINT_TO_POINTER (FALSE), setup,
+              test_scheduler_shared_entries_vanished, teardown);
+  g_test_add ("/scheduler/shared-entries/vanished/unique-name", Fixture,
+              GINT_TO_POINTER (TRUE), setup,
+              test_scheduler_shared_entries_vanished, teardown);
 
   return g_test_run ();
 }
@@ -22,12 +22,18 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <glib.h>
 #include <glib-object.h>
+#include <glib-unix.h>
 #include <glib/gi18n-lib.h>
 #include <gio/gio.h>
 #include <libmogwai-schedule/clock.h>
 #include <libmogwai-schedule/clock-system.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
 
 
 /**
@@ -38,15 +44,29 @@
  *
  * #MwsClockSystem is the standard implementation of #MwsClock, which uses the
  * system wall clock to provide time and alarms. Internally, it uses
- * g_date_time_new_now_local() to provide time, and
- * g_timeout_source_new_seconds() to provide alarms. It adds #GSources to the
- * thread-default main context from when the #MwsClockSystem was constructed.
- * That main context must be running in order for alarm callbacks to be invoked.
+ * g_date_time_new_now() with its own copy of the local time zone to provide
+ * time.
  *
- * FIXME: Currently, this does not support detecting when the system timezone
- * or underlying RTC clock changes, and hence it never emits the
- * #MwsClock::offset-changed signal. See
- * https://phabricator.endlessm.com/T21845.
+ * All alarms are multiplexed onto a single #GSource: pending alarms are kept
+ * in a min-heap ordered by alarm time, and a single timerfd on
+ * %CLOCK_REALTIME is armed for the earliest of them. Alarms are therefore
+ * triggered at exactly the requested wall clock time, even if the computer was
+ * suspended or the wall clock was changed in the meantime, and adding or
+ * removing an alarm takes O(log n) time. If timerfds are not available, a
+ * single g_timeout_source_new() is used instead, which does not handle suspend
+ * or changes to the wall clock. The #GSource is added to the thread-default
+ * main context from when the #MwsClockSystem was constructed. That main
+ * context must be running in order for alarm callbacks to be invoked.
+ *
+ * Changes to the underlying RTC clock (for example, by NTP or by the user) are
+ * detected using %TFD_TIMER_CANCEL_ON_SET on the same timerfd, and result in
+ * #MwsClock::offset-changed being emitted.
+ *
+ * Changes to the system time zone are detected by monitoring
+ * `/etc/localtime`, and the `Timezone` property of
+ * `org.freedesktop.timedate1` on the system bus. Notifications from both are
+ * coalesced, and the time zone is reloaded. #MwsClock::offset-changed is
+ * emitted once if the new time zone’s offsets differ from the old ones.
  *
  * Since: 0.1.0
  */
@@ -64,6 +84,28 @@ static guint      mws_clock_system_add_alarm     (MwsClock       *clock,
 static void       mws_clock_system_remove_alarm  (MwsClock       *clock,
                                                   guint           id);
 
+/* A pending alarm. */
+typedef struct
+{
+  guint id;
+  gint64 alarm_usec;  /* microseconds since the Unix epoch */
+  guint heap_index;  /* index in #MwsClockSystem.alarm_heap */
+
+  GSourceFunc alarm_func;  /* (nullable) */
+  gpointer user_data;  /* (nullable) */
+  GDestroyNotify destroy_func;  /* (nullable) */
+} Alarm;
+
+static void
+alarm_free (Alarm *alarm)
+{
+  if (alarm->destroy_func != NULL && alarm->user_data != NULL)
+    alarm->destroy_func (alarm->user_data);
+  g_free (alarm);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (Alarm, alarm_free)
+
 /**
  * MwsClockSystem:
  *
@@ -76,7 +118,33 @@ struct _MwsClockSystem
   GObject parent;
 
   GMainContext *context;  /* (owned) */
-  GPtrArray *alarms;  /* (owned) (element-type GSource) */
+
+  /* Pending alarms, as a binary min-heap ordered by alarm_compare(), so the
+   * next alarm to trigger is always first. Each #Alarm stores its own index in
+   * the heap so it can be removed without searching. */
+  GPtrArray *alarm_heap;  /* (owned) (element-type Alarm) */
+  GHashTable *alarms;  /* (owned) (element-type guint Alarm) */
+  guint next_alarm_id;
+
+  /* The single source which triggers all alarms. If timerfds are supported,
+   * @alarm_fd is armed for the first alarm in @alarm_heap (or far in the future
+   * if there are none) with %TFD_TIMER_CANCEL_ON_SET, and @alarm_source watches
+   * it. Otherwise, @alarm_fd is -1 and @alarm_source is a timeout which is
+   * recreated whenever the first alarm changes. */
+  gint alarm_fd;  /* (owned); -1 if unsupported */
+  GSource *alarm_source;  /* (owned) (nullable) */
+
+  /* Local time zone used by mws_clock_system_get_now_local(). This is reloaded
+   * when @localtime_monitor or the timedate1 subscription indicate it might
+   * have changed. The reload is done in an idle callback,
+   * @time_zone_check_id, so that several notifications for the same change
+   * result in a single check. */
+  GTimeZone *time_zone;  /* (owned) */
+  GFileMonitor *localtime_monitor;  /* (owned) (nullable) */
+  GDBusConnection *system_bus;  /* (owned) (nullable) */
+  guint timedate1_subscription_id;  /* 0 when not subscribed */
+  guint time_zone_check_id;  /* 0 when no check is queued */
+  GCancellable *cancellable;  /* (owned) */
 };
 
 G_DEFINE_TYPE_WITH_CODE (MwsClockSystem, mws_clock_system, G_TYPE_OBJECT,
@@ -98,18 +166,475 @@ mws_clock_system_clock_init (MwsClockInterface *iface)
   iface->remove_alarm = mws_clock_system_remove_alarm;
 }
 
+/* How far in the future to arm @alarm_fd when there are no alarms. It’s
+ * re-armed if it ever expires, so this only needs to be long enough to avoid
+ * frequent wakeups. */
+static const gint64 IDLE_TIMEOUT_SECONDS = 365 * 24 * 60 * 60;
+
+/* Order alarms by time, and then by the order they were added in. */
+static gint
+alarm_compare (const Alarm *a,
+               const Alarm *b)
+{
+  if (a->alarm_usec != b->alarm_usec)
+    return (a->alarm_usec < b->alarm_usec) ? -1 : 1;
+  if (a->id != b->id)
+    return (a->id < b->id) ? -1 : 1;
+  return 0;
+}
+
+static Alarm *
+alarm_heap_get (MwsClockSystem *self,
+                guint           index)
+{
+  return g_ptr_array_index (self->alarm_heap, index);
+}
+
+static void
+alarm_heap_set (MwsClockSystem *self,
+                guint           index,
+                Alarm          *alarm)
+{
+  self->alarm_heap->pdata[index] = alarm;
+  alarm->heap_index = index;
+}
+
+/* Move the alarm at @index towards the root of the heap until it’s in order. */
+static void
+alarm_heap_sift_up (MwsClockSystem *self,
+                    guint           index)
+{
+  Alarm *alarm = alarm_heap_get (self, index);
+
+  while (index > 0)
+    {
+      guint parent_index = (index - 1) / 2;
+      Alarm *parent = alarm_heap_get (self, parent_index);
+
+      if (alarm_compare (parent, alarm) <= 0)
+        break;
+
+      alarm_heap_set (self, index, parent);
+      index = parent_index;
+    }
+
+  alarm_heap_set (self, index, alarm);
+}
+
+/* Move the alarm at @index towards the leaves of the heap until it’s in
+ * order. */
+static void
+alarm_heap_sift_down (MwsClockSystem *self,
+                      guint           index)
+{
+  Alarm *alarm = alarm_heap_get (self, index);
+  guint len = self->alarm_heap->len;
+
+  while (TRUE)
+    {
+      guint child_index = 2 * index + 1;
+
+      if (child_index >= len)
+        break;
+      if (child_index + 1 < len &&
+          alarm_compare (alarm_heap_get (self, child_index + 1),
+                         alarm_heap_get (self, child_index)) < 0)
+        child_index++;
+
+      Alarm *child = alarm_heap_get (self, child_index);
+
+      if (alarm_compare (alarm, child) <= 0)
+        break;
+
+      alarm_heap_set (self, index, child);
+      index = child_index;
+    }
+
+  alarm_heap_set (self, index, alarm);
+}
+
+static void
+alarm_heap_push (MwsClockSystem *self,
+                 Alarm          *alarm)
+{
+  g_ptr_array_add (self->alarm_heap, alarm);
+  alarm->heap_index = self->alarm_heap->len - 1;
+  alarm_heap_sift_up (self, alarm->heap_index);
+}
+
+/* Remove @alarm from the heap. It is not freed. */
+static void
+alarm_heap_remove (MwsClockSystem *self,
+                   Alarm          *alarm)
+{
+  guint index = alarm->heap_index;
+  guint last_index = self->alarm_heap->len - 1;
+
+  g_assert (alarm_heap_get (self, index) == alarm);
+
+  if (index != last_index)
+    {
+      Alarm *last = alarm_heap_get (self, last_index);
+      alarm_heap_set (self, index, last);
+      g_ptr_array_set_size (self->alarm_heap, last_index);
+
+      if (index > 0 &&
+          alarm_compare (last, alarm_heap_get (self, (index - 1) / 2)) < 0)
+        alarm_heap_sift_up (self, index);
+      else
+        alarm_heap_sift_down (self, index);
+    }
+  else
+    {
+      g_ptr_array_set_size (self->alarm_heap, last_index);
+    }
+}
+
+/* Arm @fd to expire at @alarm_usec (in microseconds since the Unix epoch) on
+ * %CLOCK_REALTIME, and to be cancelled if the clock is set. */
+static gboolean
+timerfd_arm (gint   fd,
+             gint64 alarm_usec)
+{
+  struct itimerspec spec;
+
+  /* A zero #struct itimerspec disarms a timerfd rather than expiring it
+   * immediately, so clamp the time. */
+  if (alarm_usec <= 0)
+    alarm_usec = 1;
+
+  memset (&spec, 0, sizeof (spec));
+  spec.it_value.tv_sec = alarm_usec / G_USEC_PER_SEC;
+  spec.it_value.tv_nsec = (alarm_usec % G_USEC_PER_SEC) * 1000;
+
+  return (timerfd_settime (fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+                           &spec, NULL) == 0);
+}
+
+static gboolean alarm_source_cb   (gpointer      user_data);
+static gboolean alarm_fd_cb       (gint          fd,
+                                   GIOCondition  condition,
+                                   gpointer      user_data);
+
+/* Update the alarm source so it’s next triggered for the first alarm in the
+ * heap. This must be called whenever the first alarm changes. */
+static void
+update_alarm_source (MwsClockSystem *self)
+{
+  const Alarm *first = (self->alarm_heap->len > 0) ? alarm_heap_get (self, 0) : NULL;
+
+  if (self->alarm_fd >= 0)
+    {
+      gint64 alarm_usec;
+
+      if (first != NULL)
+        alarm_usec = first->alarm_usec;
+      else
+        alarm_usec = g_get_real_time () + IDLE_TIMEOUT_SECONDS * G_USEC_PER_SEC;
+
+      if (!timerfd_arm (self->alarm_fd, alarm_usec))
+        g_warning ("Error arming alarm timerfd: %s", g_strerror (errno));
+
+      return;
+    }
+
+  /* Fallback without timerfd support: use a timeout on the monotonic clock,
+   * rounding up so it’s never triggered early. */
+  if (self->alarm_source != NULL)
+    {
+      g_source_destroy (self->alarm_source);
+      g_clear_pointer (&self->alarm_source, g_source_unref);
+    }
+
+  if (first != NULL)
+    {
+      gint64 interval = first->alarm_usec - g_get_real_time ();
+      if (interval < 0)
+        interval = 0;
+
+      self->alarm_source = g_timeout_source_new (MIN ((interval + 999) / 1000, G_MAXUINT));
+      g_source_set_callback (self->alarm_source, alarm_source_cb, self, NULL);
+      g_source_set_name (self->alarm_source, "MwsClockSystem alarms");
+      g_source_attach (self->alarm_source, self->context);
+    }
+}
+
+/* Invoke all the alarms which are due, and then update the alarm source for the
+ * next one. Alarms are removed before being invoked, so they may add or remove
+ * other alarms. */
+static void
+dispatch_alarms (MwsClockSystem *self)
+{
+  gint64 now_usec = g_get_real_time ();
+
+  while (self->alarm_heap->len > 0 &&
+         alarm_heap_get (self, 0)->alarm_usec <= now_usec)
+    {
+      Alarm *first = alarm_heap_get (self, 0);
+      gpointer key = GUINT_TO_POINTER (first->id);
+
+      alarm_heap_remove (self, first);
+      g_hash_table_steal (self->alarms, key);
+
+      g_autoptr(Alarm) alarm = first;
+
+      g_debug ("%s: Alarm %u triggered", G_STRFUNC, alarm->id);
+
+      /* Alarms are one-shot, so the return value is ignored. */
+      if (alarm->alarm_func != NULL)
+        alarm->alarm_func (alarm->user_data);
+    }
+
+  update_alarm_source (self);
+}
+
+/* Callback for the fallback timeout source. */
+static gboolean
+alarm_source_cb (gpointer user_data)
+{
+  MwsClockSystem *self = MWS_CLOCK_SYSTEM (user_data);
+
+  /* This destroys the current source, and creates a new one if needed. */
+  dispatch_alarms (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Callback for @alarm_fd becoming readable, which could be because the first
+ * alarm is due, or because the wall clock was changed. */
+static gboolean
+alarm_fd_cb (gint         fd,
+             GIOCondition condition,
+             gpointer     user_data)
+{
+  MwsClockSystem *self = MWS_CLOCK_SYSTEM (user_data);
+  guint64 n_expirations;
+  gboolean clock_changed;
+
+  /* A read() on a %TFD_TIMER_CANCEL_ON_SET timerfd fails with %ECANCELED if
+   * the clock was changed. */
+  clock_changed = (read (fd, &n_expirations, sizeof (n_expirations)) < 0 &&
+                   errno == ECANCELED);
+
+  dispatch_alarms (self);
+
+  if (clock_changed)
+    {
+      g_debug ("%s: Wall clock changed", G_STRFUNC);
+      g_signal_emit_by_name (self, "offset-changed");
+    }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* Load the current local time zone. Don’t use g_time_zone_new_local(), since it
+ * caches the time zone. Passing %NULL reloads it from `TZ` or
+ * `/etc/localtime`. */
+static GTimeZone *
+load_local_time_zone (void)
+{
+#if GLIB_CHECK_VERSION(2, 68, 0)
+  GTimeZone *time_zone = g_time_zone_new_identifier (NULL);
+  return (time_zone != NULL) ? time_zone : g_time_zone_new_utc ();
+#else
+  return g_time_zone_new (NULL);
+#endif
+}
+
+/* Check whether the offsets of @a and @b from UTC differ at any of a few
+ * points in the coming year. This is what matters for scheduling: a change of
+ * time zone which doesn’t change the offset doesn’t affect any alarms. Points
+ * six months apart make sure daylight saving time is covered. */
+static gboolean
+time_zones_differ (GTimeZone *a,
+                   GTimeZone *b)
+{
+  gint64 now_secs = g_get_real_time () / G_USEC_PER_SEC;
+
+  for (gsize i = 0; i < 3; i++)
+    {
+      gint64 secs = now_secs + i * 183 * 24 * 60 * 60;
+      gint interval_a = g_time_zone_find_interval (a, G_TIME_TYPE_UNIVERSAL, secs);
+      gint interval_b = g_time_zone_find_interval (b, G_TIME_TYPE_UNIVERSAL, secs);
+
+      if (g_time_zone_get_offset (a, interval_a) != g_time_zone_get_offset (b, interval_b))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+time_zone_check_cb (gpointer user_data)
+{
+  MwsClockSystem *self = MWS_CLOCK_SYSTEM (user_data);
+
+  self->time_zone_check_id = 0;
+
+  g_autoptr(GTimeZone) new_time_zone = load_local_time_zone ();
+  gboolean changed = time_zones_differ (self->time_zone, new_time_zone);
+
+  g_time_zone_unref (self->time_zone);
+  self->time_zone = g_steal_pointer (&new_time_zone);
+
+  if (changed)
+    {
+      g_debug ("%s: Time zone offset changed", G_STRFUNC);
+      g_signal_emit_by_name (self, "offset-changed");
+    }
+  else
+    {
+      g_debug ("%s: Time zone offsets unchanged", G_STRFUNC);
+    }
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Queue a check of whether the time zone has changed, if one isn’t already
+ * queued. */
 static void
-destroy_and_unref_source (GSource *source)
+queue_time_zone_check (MwsClockSystem *self)
 {
-  g_source_destroy (source);
-  g_source_unref (source);
+  if (self->time_zone_check_id != 0)
+    return;
+
+  g_autoptr(GSource) source = g_idle_source_new ();
+  g_source_set_callback (source, time_zone_check_cb, self, NULL);
+  g_source_set_name (source, "MwsClockSystem time zone check");
+  self->time_zone_check_id = g_source_attach (source, self->context);
+}
+
+static void
+localtime_changed_cb (GFileMonitor      *monitor,
+                      GFile             *file,
+                      GFile             *other_file,
+                      GFileMonitorEvent  event_type,
+                      gpointer           user_data)
+{
+  MwsClockSystem *self = MWS_CLOCK_SYSTEM (user_data);
+
+  if (event_type == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT ||
+      event_type == G_FILE_MONITOR_EVENT_CREATED ||
+      event_type == G_FILE_MONITOR_EVENT_DELETED ||
+      event_type == G_FILE_MONITOR_EVENT_RENAMED ||
+      event_type == G_FILE_MONITOR_EVENT_MOVED_IN)
+    {
+      g_debug ("%s: /etc/localtime changed", G_STRFUNC);
+      queue_time_zone_check (self);
+    }
+}
+
+static void
+timedate1_properties_changed_cb (GDBusConnection *connection,
+                                 const gchar     *sender_name,
+                                 const gchar     *object_path,
+                                 const gchar     *interface_name,
+                                 const gchar     *signal_name,
+                                 GVariant        *parameters,
+                                 gpointer         user_data)
+{
+  MwsClockSystem *self = MWS_CLOCK_SYSTEM (user_data);
+
+  if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(sa{sv}as)")))
+    return;
+
+  g_autoptr(GVariant) changed_properties = g_variant_get_child_value (parameters, 1);
+  g_autofree const gchar **invalidated_properties = NULL;
+  g_variant_get_child (parameters, 2, "^a&s", &invalidated_properties);
+
+  g_autoptr(GVariant) time_zone_variant = NULL;
+  time_zone_variant = g_variant_lookup_value (changed_properties, "Timezone", NULL);
+
+  if (time_zone_variant != NULL ||
+      g_strv_contains (invalidated_properties, "Timezone"))
+    {
+      g_debug ("%s: timedate1 Timezone changed", G_STRFUNC);
+      queue_time_zone_check (self);
+    }
+}
+
+static void
+system_bus_get_cb (GObject      *obj,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GDBusConnection) connection = g_bus_get_finish (result, &local_error);
+
+  /* @user_data is only valid if we weren’t cancelled. */
+  if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    return;
+
+  MwsClockSystem *self = MWS_CLOCK_SYSTEM (user_data);
+
+  if (local_error != NULL)
+    {
+      g_debug ("%s: Error getting system bus; timedate1 changes will not be "
+               "detected: %s", G_STRFUNC, local_error->message);
+      return;
+    }
+
+  self->system_bus = g_steal_pointer (&connection);
+  self->timedate1_subscription_id =
+      g_dbus_connection_signal_subscribe (self->system_bus,
+                                          "org.freedesktop.timedate1",
+                                          "org.freedesktop.DBus.Properties",
+                                          "PropertiesChanged",
+                                          "/org/freedesktop/timedate1",
+                                          "org.freedesktop.timedate1",
+                                          G_DBUS_SIGNAL_FLAGS_NONE,
+                                          timedate1_properties_changed_cb,
+                                          self, NULL);
 }
 
 static void
 mws_clock_system_init (MwsClockSystem *self)
 {
   self->context = g_main_context_ref_thread_default ();
-  self->alarms = g_ptr_array_new_with_free_func ((GDestroyNotify) destroy_and_unref_source);
+  self->alarm_heap = g_ptr_array_new_with_free_func (NULL);
+  self->alarms = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                        NULL, (GDestroyNotify) alarm_free);
+  self->next_alarm_id = 1;
+
+  self->alarm_fd = timerfd_create (CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+
+  if (self->alarm_fd >= 0 &&
+      timerfd_arm (self->alarm_fd,
+                   g_get_real_time () + IDLE_TIMEOUT_SECONDS * G_USEC_PER_SEC))
+    {
+      self->alarm_source = g_unix_fd_source_new (self->alarm_fd, G_IO_IN);
+      g_source_set_callback (self->alarm_source,
+                             (GSourceFunc) alarm_fd_cb, self, NULL);
+      g_source_set_name (self->alarm_source, "MwsClockSystem alarms");
+      g_source_attach (self->alarm_source, self->context);
+    }
+  else
+    {
+      g_debug ("%s: Error creating alarm timerfd; falling back to timeouts, "
+               "and wall clock changes will not be detected: %s",
+               G_STRFUNC, g_strerror (errno));
+      if (self->alarm_fd >= 0)
+        close (self->alarm_fd);
+      self->alarm_fd = -1;
+    }
+
+  /* Watch for changes to the time zone. */
+  self->time_zone = load_local_time_zone ();
+  self->cancellable = g_cancellable_new ();
+
+  g_autoptr(GFile) localtime_file = g_file_new_for_path ("/etc/localtime");
+  g_autoptr(GError) local_error = NULL;
+  self->localtime_monitor = g_file_monitor_file (localtime_file,
+                                                 G_FILE_MONITOR_WATCH_MOVES,
+                                                 NULL, &local_error);
+  if (self->localtime_monitor != NULL)
+    g_signal_connect (self->localtime_monitor, "changed",
+                      (GCallback) localtime_changed_cb, self);
+  else
+    g_debug ("%s: Error monitoring /etc/localtime: %s",
+             G_STRFUNC, local_error->message);
+
+  g_bus_get (G_BUS_TYPE_SYSTEM, self->cancellable, system_bus_get_cb, self);
 }
 
 static void
@@ -117,7 +642,47 @@ mws_clock_system_finalize (GObject *obj)
 {
   MwsClockSystem *self = MWS_CLOCK_SYSTEM (obj);
 
-  g_clear_pointer (&self->alarms, g_ptr_array_unref);
+  g_cancellable_cancel (self->cancellable);
+  g_clear_object (&self->cancellable);
+
+  if (self->timedate1_subscription_id != 0)
+    {
+      g_dbus_connection_signal_unsubscribe (self->system_bus,
+                                            self->timedate1_subscription_id);
+      self->timedate1_subscription_id = 0;
+    }
+  g_clear_object (&self->system_bus);
+
+  if (self->localtime_monitor != NULL)
+    {
+      g_signal_handlers_disconnect_by_func (self->localtime_monitor,
+                                            localtime_changed_cb, self);
+      g_file_monitor_cancel (self->localtime_monitor);
+      g_clear_object (&self->localtime_monitor);
+    }
+
+  if (self->time_zone_check_id != 0)
+    {
+      GSource *source = g_main_context_find_source_by_id (self->context,
+                                                          self->time_zone_check_id);
+      g_source_destroy (source);
+      self->time_zone_check_id = 0;
+    }
+
+  g_clear_pointer (&self->time_zone, g_time_zone_unref);
+
+  if (self->alarm_source != NULL)
+    {
+      g_source_destroy (self->alarm_source);
+      g_clear_pointer (&self->alarm_source, g_source_unref);
+    }
+
+  if (self->alarm_fd >= 0)
+    close (self->alarm_fd);
+  self->alarm_fd = -1;
+
+  g_clear_pointer (&self->alarm_heap, g_ptr_array_unref);
+  g_clear_pointer (&self->alarms, g_hash_table_unref);
   g_clear_pointer (&self->context, g_main_context_unref);
 
   G_OBJECT_CLASS (mws_clock_system_parent_class)->finalize (obj);
@@ -126,7 +691,9 @@ mws_clock_system_finalize (GObject *obj)
 static GDateTime *
 mws_clock_system_get_now_local (MwsClock *clock)
 {
-  return g_date_time_new_now_local ();
+  MwsClockSystem *self = MWS_CLOCK_SYSTEM (clock);
+
+  return g_date_time_new_now (self->time_zone);
 }
 
 static guint
@@ -138,25 +705,36 @@ mws_clock_system_add_alarm (MwsClock       *clock,
 {
   MwsClockSystem *self = MWS_CLOCK_SYSTEM (clock);
 
-  g_autoptr(GDateTime) now = mws_clock_system_get_now_local (clock);
+  /* Allocate an ID, skipping 0 and any still in use after wrapping around. */
+  while (self->next_alarm_id == 0 ||
+         g_hash_table_contains (self->alarms, GUINT_TO_POINTER (self->next_alarm_id)))
+    self->next_alarm_id++;
 
-  /* If the @alarm_time is in the past, invoke the callback on the next main
-   * context iteration. */
-  GTimeSpan interval = g_date_time_difference (alarm_time, now);
-  if (interval < 0)
-    interval = 0;
+  g_autoptr(Alarm) alarm = g_new0 (Alarm, 1);
+  alarm->id = self->next_alarm_id++;
+  alarm->alarm_usec = (g_date_time_to_unix (alarm_time) * G_USEC_PER_SEC +
+                       g_date_time_get_microsecond (alarm_time));
+  alarm->alarm_func = alarm_func;
+  alarm->user_data = user_data;
+  alarm->destroy_func = destroy_func;
 
-  g_autoptr(GSource) source = g_timeout_source_new_seconds (interval / G_USEC_PER_SEC);
-  g_source_set_callback (source, alarm_func, user_data, destroy_func);
-  g_source_attach (source, self->context);
+  guint id = alarm->id;
+  gint64 interval = alarm->alarm_usec - g_get_real_time ();
 
-  guint id = g_source_get_id (source);
-  g_ptr_array_add (self->alarms, g_steal_pointer (&source));
+  /* If the @alarm_time is in the past, the callback is invoked on the next main
+   * context iteration, since the timerfd (or timeout) is armed for a time in
+   * the past and expires immediately. */
+  Alarm *owned_alarm = g_steal_pointer (&alarm);
+  g_hash_table_insert (self->alarms, GUINT_TO_POINTER (id), owned_alarm);
+  alarm_heap_push (self, owned_alarm);
+
+  if (owned_alarm->heap_index == 0)
+    update_alarm_source (self);
 
   g_autofree gchar *alarm_time_str = NULL;
   alarm_time_str = g_date_time_format (alarm_time, "%FT%T%:::z");
-  g_debug ("%s: Setting alarm %u for %s (in %" G_GUINT64_FORMAT " seconds)",
-           G_STRFUNC, id, alarm_time_str, (guint64) interval / G_USEC_PER_SEC);
+  g_debug ("%s: Setting alarm %u for %s (in %" G_GINT64_FORMAT " µs)",
+           G_STRFUNC, id, alarm_time_str, MAX (interval, 0));
 
   return id;
 }
@@ -166,12 +744,19 @@ mws_clock_system_remove_alarm (MwsClock *clock,
                                guint     id)
 {
   MwsClockSystem *self = MWS_CLOCK_SYSTEM (clock);
-  GSource *source = g_main_context_find_source_by_id (self->context, id);
+  Alarm *alarm = g_hash_table_lookup (self->alarms, GUINT_TO_POINTER (id));
 
   g_debug ("%s: Removing alarm %u", G_STRFUNC, id);
 
-  /* The source will be destroyed by the free function set up on the array. */
-  g_return_if_fail (g_ptr_array_remove_fast (self->alarms, source));
+  g_return_if_fail (alarm != NULL);
+
+  gboolean was_first = (alarm->heap_index == 0);
+
+  alarm_heap_remove (self, alarm);
+  g_hash_table_remove (self->alarms, GUINT_TO_POINTER (id));
+
+  if (was_first)
+    update_alarm_source (self);
 }
 
 /**
@@ -0,0 +1,446 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+
+#include "config.h"
+
+#include <glib.h>
+#include <glib-object.h>
+#include <glib/gi18n-lib.h>
+#include <gio/gio.h>
+#include <libmogwai-schedule/concurrency-controller.h>
+#include <string.h>
+
+
+/* Length of the window over which throughput is measured. Long enough to
+ * smooth out the statistics refresh rate of the connection monitor, and TCP
+ * slow start on newly active downloads. */
+#define SAMPLE_INTERVAL_USEC (30 * G_USEC_PER_SEC)
+
+/* Increasing the limit by one must increase the measured throughput by at
+ * least this fraction for the increase to be kept. */
+#define SCALING_THRESHOLD 0.1
+
+/* If the `some avg10` value for CPU or I/O pressure is at least this
+ * percentage, the limit is reduced regardless of throughput. */
+#define PRESSURE_BACK_OFF_PERCENT 25.0
+
+/* Number of sample windows to wait after backing off before probing for a
+ * higher limit again. */
+#define HOLD_WINDOWS 10
+
+static void mws_concurrency_controller_finalize     (GObject      *object);
+static void mws_concurrency_controller_get_property (GObject      *object,
+                                                     guint         property_id,
+                                                     GValue       *value,
+                                                     GParamSpec   *pspec);
+static void mws_concurrency_controller_set_property (GObject      *object,
+                                                     guint         property_id,
+                                                     const GValue *value,
+                                                     GParamSpec   *pspec);
+
+/**
+ * MwsConcurrencyController:
+ *
+ * A controller which adapts the maximum number of schedule entries which can
+ * be active at once (see #MwsScheduler:concurrency-controller) to the
+ * available bandwidth and system load.
+ *
+ * It is fed the running total of bytes received over all connections, from
+ * #MwsConnectionMonitor::connection-statistics-changed, and measures the
+ * aggregate throughput over fixed windows. It starts with a limit of 1. While
+ * the scheduler is using the whole limit, the limit is increased by one after
+ * each window, for as long as that increases throughput by a useful amount.
+ * When an increase doesn’t help (for example, because the link is saturated),
+ * the limit is reduced again and held for a while before probing upwards
+ * again.
+ *
+ * If #MwsConcurrencyController:pressure-directory is set, CPU and I/O pressure
+ * stall information (PSI) is read from the `cpu` and `io` files in it at the
+ * end of each window. If either shows that tasks have been stalled for a
+ * significant proportion of recent time, the limit is reduced, since
+ * additional parallel downloads (particularly OSTree ones) would only add to
+ * the contention.
+ *
+ * The limit is always between 1 and #MwsConcurrencyController:max-limit.
+ *
+ * Since: 0.3.0
+ */
+struct _MwsConcurrencyController
+{
+  GObject parent;
+
+  guint max_limit;
+  gchar *pressure_directory;  /* (owned) (nullable) */
+
+  guint limit;
+
+  /* Start of the current sample window; 0 if it hasn’t started. */
+  gint64 window_start_usec;
+  guint64 window_start_rx_bytes;
+
+  /* Throughput (in bytes per second) measured at (@limit - 1), before the
+   * limit was last increased. Only valid if @have_baseline is %TRUE, which it
+   * is while an increase is being evaluated. */
+  gdouble baseline_throughput;
+  gboolean have_baseline;
+
+  guint hold_windows;
+};
+
+typedef enum
+{
+  PROP_MAX_LIMIT = 1,
+  PROP_PRESSURE_DIRECTORY,
+  PROP_LIMIT,
+} MwsConcurrencyControllerProperty;
+
+G_DEFINE_TYPE (MwsConcurrencyController, mws_concurrency_controller, G_TYPE_OBJECT)
+
+static void
+mws_concurrency_controller_class_init (MwsConcurrencyControllerClass *klass)
+{
+  GObjectClass *object_class = (GObjectClass *) klass;
+  GParamSpec *props[PROP_LIMIT + 1] = { NULL, };
+
+  object_class->finalize = mws_concurrency_controller_finalize;
+  object_class->get_property = mws_concurrency_controller_get_property;
+  object_class->set_property = mws_concurrency_controller_set_property;
+
+  /**
+   * MwsConcurrencyController:max-limit:
+   *
+   * The highest value #MwsConcurrencyController:limit can be increased to.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_MAX_LIMIT] =
+      g_param_spec_uint ("max-limit", "Max. Limit",
+                         "The highest value the limit can be increased to.",
+                         1, G_MAXUINT, 1,
+                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwsConcurrencyController:pressure-directory:
+   *
+   * Directory to read `cpu` and `io` pressure stall information files from;
+   * typically `/proc/pressure`. If this is %NULL, or the files can’t be read,
+   * pressure is not taken into account.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_PRESSURE_DIRECTORY] =
+      g_param_spec_string ("pressure-directory", "Pressure Directory",
+                           "Directory to read pressure stall information from.",
+                           NULL,
+                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwsConcurrencyController:limit:
+   *
+   * The current limit on the number of active schedule entries.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_LIMIT] =
+      g_param_spec_uint ("limit", "Limit",
+                         "The current limit on the number of active schedule entries.",
+                         1, G_MAXUINT, 1,
+                         G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (object_class, G_N_ELEMENTS (props), props);
+}
+
+static void
+mws_concurrency_controller_init (MwsConcurrencyController *self)
+{
+  self->max_limit = 1;
+  self->limit = 1;
+}
+
+static void
+mws_concurrency_controller_finalize (GObject *object)
+{
+  MwsConcurrencyController *self = MWS_CONCURRENCY_CONTROLLER (object);
+
+  g_clear_pointer (&self->pressure_directory, g_free);
+
+  /* Chain up to the parent class */
+  G_OBJECT_CLASS (mws_concurrency_controller_parent_class)->finalize (object);
+}
+
+static void
+mws_concurrency_controller_get_property (GObject    *object,
+                                         guint       property_id,
+                                         GValue     *value,
+                                         GParamSpec *pspec)
+{
+  MwsConcurrencyController *self = MWS_CONCURRENCY_CONTROLLER (object);
+
+  switch ((MwsConcurrencyControllerProperty) property_id)
+    {
+    case PROP_MAX_LIMIT:
+      g_value_set_uint (value, self->max_limit);
+      break;
+    case PROP_PRESSURE_DIRECTORY:
+      g_value_set_string (value, self->pressure_directory);
+      break;
+    case PROP_LIMIT:
+      g_value_set_uint (value, self->limit);
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+static void
+mws_concurrency_controller_set_property (GObject      *object,
+                                         guint         property_id,
+                                         const GValue *value,
+                                         GParamSpec   *pspec)
+{
+  MwsConcurrencyController *self = MWS_CONCURRENCY_CONTROLLER (object);
+
+  switch ((MwsConcurrencyControllerProperty) property_id)
+    {
+    case PROP_MAX_LIMIT:
+      /* Construct only. */
+      self->max_limit = g_value_get_uint (value);
+      break;
+    case PROP_PRESSURE_DIRECTORY:
+      /* Construct only. */
+      g_assert (self->pressure_directory == NULL);
+      self->pressure_directory = g_value_dup_string (value);
+      break;
+    case PROP_LIMIT:
+      /* Read only. */
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+/**
+ * mws_concurrency_controller_new:
+ * @max_limit: the highest the limit can be increased to; must be at least 1
+ * @pressure_directory: (nullable): directory to read pressure stall information
+ *    from, or %NULL to ignore pressure
+ *
+ * Create a #MwsConcurrencyController with an initial limit of 1.
+ *
+ * Returns: (transfer full): a new #MwsConcurrencyController
+ * Since: 0.3.0
+ */
+MwsConcurrencyController *
+mws_concurrency_controller_new (guint        max_limit,
+                                const gchar *pressure_directory)
+{
+  g_return_val_if_fail (max_limit >= 1, NULL);
+
+  return g_object_new (MWS_TYPE_CONCURRENCY_CONTROLLER,
+                       "max-limit", max_limit,
+                       "pressure-directory", pressure_directory,
+                       NULL);
+}
+
+/**
+ * mws_concurrency_controller_get_limit:
+ * @self: a #MwsConcurrencyController
+ *
+ * Get the value of #MwsConcurrencyController:limit.
+ *
+ * Returns: current limit on the number of active schedule entries
+ * Since: 0.3.0
+ */
+guint
+mws_concurrency_controller_get_limit (MwsConcurrencyController *self)
+{
+  g_return_val_if_fail (MWS_IS_CONCURRENCY_CONTROLLER (self), 1);
+
+  return self->limit;
+}
+
+/**
+ * mws_concurrency_controller_get_max_limit:
+ * @self: a #MwsConcurrencyController
+ *
+ * Get the value of #MwsConcurrencyController:max-limit.
+ *
+ * Returns: highest value the limit can be increased to
+ * Since: 0.3.0
+ */
+guint
+mws_concurrency_controller_get_max_limit (MwsConcurrencyController *self)
+{
+  g_return_val_if_fail (MWS_IS_CONCURRENCY_CONTROLLER (self), 1);
+
+  return self->max_limit;
+}
+
+/* Read the `some avg10` value from the PSI file called @name in
+ * @self->pressure_directory, returning 0 if it can’t be read. */
+static gdouble
+read_pressure (MwsConcurrencyController *self,
+               const gchar              *name)
+{
+  g_autofree gchar *path = g_build_filename (self->pressure_directory, name, NULL);
+  g_autofree gchar *contents = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  if (!g_file_get_contents (path, &contents, NULL, &local_error))
+    {
+      g_debug ("%s: Error reading ‘%s’: %s", G_STRFUNC, path, local_error->message);
+      return 0.0;
+    }
+
+  /* The file looks like:
+   *    some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+   *    full avg10=0.00 avg60=0.00 avg300=0.00 total=0 */
+  g_auto(GStrv) lines = g_strsplit (contents, "\n", -1);
+
+  for (gsize i = 0; lines[i] != NULL; i++)
+    {
+      const gchar *avg10;
+
+      if (!g_str_has_prefix (lines[i], "some ") ||
+          (avg10 = strstr (lines[i], "avg10=")) == NULL)
+        continue;
+
+      return g_ascii_strtod (avg10 + strlen ("avg10="), NULL);
+    }
+
+  g_debug ("%s: No ‘some avg10’ value in ‘%s’", G_STRFUNC, path);
+  return 0.0;
+}
+
+static void
+set_limit (MwsConcurrencyController *self,
+           guint                     limit)
+{
+  g_debug ("%s: Changing limit from %u to %u", G_STRFUNC, self->limit, limit);
+  self->limit = limit;
+  g_object_notify (G_OBJECT (self), "limit");
+}
+
+/**
+ * mws_concurrency_controller_update:
+ * @self: a #MwsConcurrencyController
+ * @now_usec: the current time, in microseconds since the Unix epoch
+ * @total_rx_bytes: running total of bytes received over all connections
+ * @n_active: number of schedule entries currently active
+ *
+ * Feed a new throughput sample into the controller. This is cheap, and should
+ * be called whenever connection statistics are updated. At the end of each
+ * sample window it may change #MwsConcurrencyController:limit, in which case
+ * %TRUE is returned and the caller should reschedule.
+ *
+ * The limit is only increased if @n_active shows that the current limit is
+ * being used in full, since otherwise the throughput says nothing about
+ * whether more parallelism would help.
+ *
+ * Returns: %TRUE if the limit has changed, %FALSE otherwise
+ * Since: 0.3.0
+ */
+gboolean
+mws_concurrency_controller_update (MwsConcurrencyController *self,
+                                   gint64                    now_usec,
+                                   guint64                   total_rx_bytes,
+                                   guint                     n_active)
+{
+  g_return_val_if_fail (MWS_IS_CONCURRENCY_CONTROLLER (self), FALSE);
+
+  /* Start a new window if this is the first sample, or if the clock or the
+   * counter has gone backwards. */
+  if (self->window_start_usec == 0 ||
+      now_usec < self->window_start_usec ||
+      total_rx_bytes < self->window_start_rx_bytes)
+    {
+      self->window_start_usec = now_usec;
+      self->window_start_rx_bytes = total_rx_bytes;
+      return FALSE;
+    }
+
+  gint64 elapsed_usec = now_usec - self->window_start_usec;
+
+  if (elapsed_usec < SAMPLE_INTERVAL_USEC)
+    return FALSE;
+
+  gdouble throughput = ((gdouble) (total_rx_bytes - self->window_start_rx_bytes) *
+                        G_USEC_PER_SEC / elapsed_usec);
+  self->window_start_usec = now_usec;
+  self->window_start_rx_bytes = total_rx_bytes;
+
+  gdouble pressure = 0.0;
+  if (self->pressure_directory != NULL)
+    pressure = MAX (read_pressure (self, "cpu"), read_pressure (self, "io"));
+
+  g_debug ("%s: Throughput %.0f bytes/s with limit %u (%u active, previously "
+           "%.0f bytes/s); pressure %.2f%%",
+           G_STRFUNC, throughput, self->limit, n_active,
+           self->baseline_throughput, pressure);
+
+  guint old_limit = self->limit;
+
+  if (pressure >= PRESSURE_BACK_OFF_PERCENT)
+    {
+      /* The system is struggling: back off, and don’t probe again for a
+       * while. */
+      self->have_baseline = FALSE;
+      self->hold_windows = HOLD_WINDOWS;
+
+      if (self->limit > 1)
+        set_limit (self, self->limit - 1);
+    }
+  else if (self->hold_windows > 0)
+    {
+      self->hold_windows--;
+    }
+  else if (n_active < self->limit || throughput <= 0.0)
+    {
+      /* Not enough entries to use the limit, or they aren’t downloading, so
+       * this window says nothing about scaling. Discard any comparison in
+       * progress. */
+      self->have_baseline = FALSE;
+    }
+  else if (!self->have_baseline ||
+           throughput >= self->baseline_throughput * (1.0 + SCALING_THRESHOLD))
+    {
+      /* Throughput scaled with the last increase (or there wasn’t one), so
+       * try increasing the limit again. */
+      if (self->limit < self->max_limit)
+        {
+          self->baseline_throughput = throughput;
+          self->have_baseline = TRUE;
+          set_limit (self, self->limit + 1);
+        }
+    }
+  else
+    {
+      /* The last increase didn’t help, so undo it and hold. */
+      self->have_baseline = FALSE;
+      self->hold_windows = HOLD_WINDOWS;
+
+      if (self->limit > 1)
+        set_limit (self, self->limit - 1);
+    }
+
+  return (self->limit != old_limit);
+}
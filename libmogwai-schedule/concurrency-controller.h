@@ -0,0 +1,45 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+
+#pragma once
+
+#include <glib.h>
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define MWS_TYPE_CONCURRENCY_CONTROLLER mws_concurrency_controller_get_type ()
+G_DECLARE_FINAL_TYPE (MwsConcurrencyController, mws_concurrency_controller, MWS, CONCURRENCY_CONTROLLER, GObject)
+
+MwsConcurrencyController *mws_concurrency_controller_new (guint        max_limit,
+                                                          const gchar *pressure_directory);
+
+guint    mws_concurrency_controller_get_limit     (MwsConcurrencyController *self);
+guint    mws_concurrency_controller_get_max_limit (MwsConcurrencyController *self);
+
+gboolean mws_concurrency_controller_update        (MwsConcurrencyController *self,
+                                                   gint64                    now_usec,
+                                                   guint64                   total_rx_bytes,
+                                                   guint                     n_active);
+
+G_END_DECLS
@@ -0,0 +1,249 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <glib-object.h>
+#include <libmogwai-schedule/connection-monitor.h>
+#include <libmogwai-schedule/connection-monitor-deferred.h>
+
+
+static void mws_connection_monitor_deferred_connection_monitor_init (MwsConnectionMonitorInterface *iface);
+
+static void mws_connection_monitor_deferred_dispose (GObject *object);
+
+static const gchar * const *mws_connection_monitor_deferred_get_connection_ids     (MwsConnectionMonitor *monitor);
+static gboolean             mws_connection_monitor_deferred_get_connection_details (MwsConnectionMonitor *monitor,
+                                                                                    const gchar          *id,
+                                                                                    MwsConnectionDetails *out_details);
+
+static void target_connections_changed_cb           (MwsConnectionMonitor *target,
+                                                     GPtrArray            *added,
+                                                     GPtrArray            *removed,
+                                                     gpointer              user_data);
+static void target_connection_details_changed_cb    (MwsConnectionMonitor *target,
+                                                     const gchar          *connection_id,
+                                                     gpointer              user_data);
+static void target_connection_statistics_changed_cb (MwsConnectionMonitor *target,
+                                                     const gchar          *connection_id,
+                                                     guint64               rx_bytes,
+                                                     gpointer              user_data);
+
+/**
+ * MwsConnectionMonitorDeferred:
+ *
+ * An implementation of the #MwsConnectionMonitor interface which stands in for
+ * another connection monitor (its target) while that is being initialised.
+ *
+ * Until mws_connection_monitor_deferred_set_target() is called, it reports
+ * that there are no active connections, so a #MwsScheduler using it will
+ * accept entries but not allow any of them to download. Once the target is
+ * set, #MwsConnectionMonitor::connections-changed is emitted for all of the
+ * target’s connections, and from then on all calls and signals are forwarded
+ * to and from the target.
+ *
+ * This allows the daemon to start serving D-Bus requests straight away, rather
+ * than waiting for a slow connection monitor to start up first.
+ *
+ * Since: 0.3.0
+ */
+struct _MwsConnectionMonitorDeferred
+{
+  GObject parent;
+
+  MwsConnectionMonitor *target;  /* (owned) (nullable) */
+};
+
+G_DEFINE_TYPE_WITH_CODE (MwsConnectionMonitorDeferred, mws_connection_monitor_deferred, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (MWS_TYPE_CONNECTION_MONITOR,
+                                                mws_connection_monitor_deferred_connection_monitor_init))
+static void
+mws_connection_monitor_deferred_class_init (MwsConnectionMonitorDeferredClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = mws_connection_monitor_deferred_dispose;
+}
+
+static void
+mws_connection_monitor_deferred_connection_monitor_init (MwsConnectionMonitorInterface *iface)
+{
+  iface->get_connection_ids = mws_connection_monitor_deferred_get_connection_ids;
+  iface->get_connection_details = mws_connection_monitor_deferred_get_connection_details;
+}
+
+static void
+mws_connection_monitor_deferred_init (MwsConnectionMonitorDeferred *self)
+{
+  /* Nothing to do here. */
+}
+
+static void
+mws_connection_monitor_deferred_dispose (GObject *object)
+{
+  MwsConnectionMonitorDeferred *self = MWS_CONNECTION_MONITOR_DEFERRED (object);
+
+  if (self->target != NULL)
+    {
+      g_signal_handlers_disconnect_by_func (self->target, target_connections_changed_cb, self);
+      g_signal_handlers_disconnect_by_func (self->target, target_connection_details_changed_cb, self);
+      g_signal_handlers_disconnect_by_func (self->target, target_connection_statistics_changed_cb, self);
+    }
+
+  g_clear_object (&self->target);
+
+  G_OBJECT_CLASS (mws_connection_monitor_deferred_parent_class)->dispose (object);
+}
+
+static const gchar * const *
+mws_connection_monitor_deferred_get_connection_ids (MwsConnectionMonitor *monitor)
+{
+  MwsConnectionMonitorDeferred *self = MWS_CONNECTION_MONITOR_DEFERRED (monitor);
+  static const gchar * const no_connection_ids[] = { NULL, };
+
+  if (self->target == NULL)
+    return no_connection_ids;
+
+  return mws_connection_monitor_get_connection_ids (self->target);
+}
+
+static gboolean
+mws_connection_monitor_deferred_get_connection_details (MwsConnectionMonitor *monitor,
+                                                        const gchar          *id,
+                                                        MwsConnectionDetails *out_details)
+{
+  MwsConnectionMonitorDeferred *self = MWS_CONNECTION_MONITOR_DEFERRED (monitor);
+
+  if (self->target == NULL)
+    return FALSE;
+
+  return mws_connection_monitor_get_connection_details (self->target, id, out_details);
+}
+
+static void
+target_connections_changed_cb (MwsConnectionMonitor *target,
+                               GPtrArray            *added,
+                               GPtrArray            *removed,
+                               gpointer              user_data)
+{
+  MwsConnectionMonitorDeferred *self = MWS_CONNECTION_MONITOR_DEFERRED (user_data);
+
+  g_signal_emit_by_name (self, "connections-changed", added, removed);
+}
+
+static void
+target_connection_details_changed_cb (MwsConnectionMonitor *target,
+                                      const gchar          *connection_id,
+                                      gpointer              user_data)
+{
+  MwsConnectionMonitorDeferred *self = MWS_CONNECTION_MONITOR_DEFERRED (user_data);
+
+  g_signal_emit_by_name (self, "connection-details-changed", connection_id);
+}
+
+static void
+target_connection_statistics_changed_cb (MwsConnectionMonitor *target,
+                                         const gchar          *connection_id,
+                                         guint64               rx_bytes,
+                                         gpointer              user_data)
+{
+  MwsConnectionMonitorDeferred *self = MWS_CONNECTION_MONITOR_DEFERRED (user_data);
+
+  g_signal_emit_by_name (self, "connection-statistics-changed",
+                         connection_id, rx_bytes);
+}
+
+/**
+ * mws_connection_monitor_deferred_new:
+ *
+ * Create a #MwsConnectionMonitorDeferred object with no target.
+ *
+ * Returns: (transfer full): a new #MwsConnectionMonitorDeferred
+ * Since: 0.3.0
+ */
+MwsConnectionMonitorDeferred *
+mws_connection_monitor_deferred_new (void)
+{
+  return g_object_new (MWS_TYPE_CONNECTION_MONITOR_DEFERRED, NULL);
+}
+
+/**
+ * mws_connection_monitor_deferred_get_target:
+ * @self: a #MwsConnectionMonitorDeferred
+ *
+ * Get the connection monitor which @self forwards to, if it has been set yet.
+ *
+ * Returns: (transfer none) (nullable): the target connection monitor, or %NULL
+ * Since: 0.3.0
+ */
+MwsConnectionMonitor *
+mws_connection_monitor_deferred_get_target (MwsConnectionMonitorDeferred *self)
+{
+  g_return_val_if_fail (MWS_IS_CONNECTION_MONITOR_DEFERRED (self), NULL);
+
+  return self->target;
+}
+
+/**
+ * mws_connection_monitor_deferred_set_target:
+ * @self: a #MwsConnectionMonitorDeferred
+ * @target: (transfer none): the initialised connection monitor to forward to
+ *
+ * Set the connection monitor which @self forwards to. This may only be called
+ * once.
+ *
+ * If @target has any connections, #MwsConnectionMonitor::connections-changed
+ * is emitted to add them all.
+ *
+ * Since: 0.3.0
+ */
+void
+mws_connection_monitor_deferred_set_target (MwsConnectionMonitorDeferred *self,
+                                            MwsConnectionMonitor         *target)
+{
+  g_return_if_fail (MWS_IS_CONNECTION_MONITOR_DEFERRED (self));
+  g_return_if_fail (MWS_IS_CONNECTION_MONITOR (target));
+  g_return_if_fail (self->target == NULL);
+  g_return_if_fail ((gpointer) target != (gpointer) self);
+
+  self->target = g_object_ref (target);
+
+  g_signal_connect (self->target, "connections-changed",
+                    (GCallback) target_connections_changed_cb, self);
+  g_signal_connect (self->target, "connection-details-changed",
+                    (GCallback) target_connection_details_changed_cb, self);
+  g_signal_connect (self->target, "connection-statistics-changed",
+                    (GCallback) target_connection_statistics_changed_cb, self);
+
+  const gchar * const *connection_ids = mws_connection_monitor_get_connection_ids (target);
+
+  if (connection_ids[0] == NULL)
+    return;
+
+  g_autoptr(GPtrArray) added = g_ptr_array_new_with_free_func (NULL);
+  for (gsize i = 0; connection_ids[i] != NULL; i++)
+    g_ptr_array_add (added, (gpointer) connection_ids[i]);
+
+  g_debug ("%s: Adding %u connections from target.", G_STRFUNC, added->len);
+  g_signal_emit_by_name (self, "connections-changed", added, NULL);
+}
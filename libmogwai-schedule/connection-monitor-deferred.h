@@ -0,0 +1,40 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <glib-object.h>
+#include <libmogwai-schedule/connection-monitor.h>
+
+G_BEGIN_DECLS
+
+#define MWS_TYPE_CONNECTION_MONITOR_DEFERRED mws_connection_monitor_deferred_get_type ()
+G_DECLARE_FINAL_TYPE (MwsConnectionMonitorDeferred, mws_connection_monitor_deferred, MWS, CONNECTION_MONITOR_DEFERRED, GObject)
+
+MwsConnectionMonitorDeferred *mws_connection_monitor_deferred_new (void);
+
+MwsConnectionMonitor *mws_connection_monitor_deferred_get_target (MwsConnectionMonitorDeferred *self);
+void                  mws_connection_monitor_deferred_set_target (MwsConnectionMonitorDeferred *self,
+                                                                  MwsConnectionMonitor         *target);
+
+G_END_DECLS
@@ -0,0 +1,1530 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib-object.h>
+#include <libmogwai-schedule/connection-monitor.h>
+#include <libmogwai-schedule/connection-monitor-nm-dbus.h>
+#include <libmogwai-schedule/latency-histogram.h>
+#include <libmogwai-schedule/tariff-setting.h>
+#include <libmogwai-tariff/tariff.h>
+
+
+static void mws_connection_monitor_nm_dbus_connection_monitor_init (MwsConnectionMonitorInterface *iface);
+static void mws_connection_monitor_nm_dbus_async_initable_init     (GAsyncInitableIface           *iface);
+static void mws_connection_monitor_nm_dbus_dispose                 (GObject                       *object);
+
+static void mws_connection_monitor_nm_dbus_get_property (GObject      *object,
+                                                         guint         property_id,
+                                                         GValue        *value,
+                                                         GParamSpec   *pspec);
+static void mws_connection_monitor_nm_dbus_set_property (GObject      *object,
+                                                         guint         property_id,
+                                                         const GValue *value,
+                                                         GParamSpec   *pspec);
+
+static void     mws_connection_monitor_nm_dbus_init_async  (GAsyncInitable       *initable,
+                                                            int                   io_priority,
+                                                            GCancellable         *cancellable,
+                                                            GAsyncReadyCallback   callback,
+                                                            gpointer              user_data);
+static gboolean mws_connection_monitor_nm_dbus_init_finish (GAsyncInitable       *initable,
+                                                            GAsyncResult         *result,
+                                                            GError              **error);
+
+static const gchar * const *mws_connection_monitor_nm_dbus_get_connection_ids     (MwsConnectionMonitor *monitor);
+static gboolean             mws_connection_monitor_nm_dbus_get_connection_details (MwsConnectionMonitor *monitor,
+                                                                                   const gchar          *id,
+                                                                                   MwsConnectionDetails *out_details);
+
+/**
+ * MwsConnectionMonitorNmDbus:
+ *
+ * An implementation of the #MwsConnectionMonitor interface which talks to
+ * NetworkManager’s D-Bus interface directly, rather than through #NMClient.
+ * #NMClient mirrors NetworkManager’s entire object graph (every device, access
+ * point, IP configuration and saved connection), which is a significant part
+ * of the daemon’s memory use and start up time on low-end devices. This
+ * implementation only tracks the active connections, and for each of them:
+ *
+ *  * the `Id`, `Connection` and `Devices` properties of the active connection;
+ *  * the `connection.metered` setting and the `user.data` settings of its
+ *    settings connection, re-fetched when the settings connection emits
+ *    `Updated`;
+ *  * the `Metered` property of each of its devices; and
+ *  * the `RxBytes` counter of each of its devices, from the
+ *    `org.freedesktop.NetworkManager.Device.Statistics` interface.
+ *
+ * Each of those objects has its own `PropertiesChanged` subscription, filtered
+ * to the interface in question, so property changes on other objects (or
+ * other interfaces of the same objects) are never delivered to the daemon.
+ *
+ * The connection details are calculated in the same way as by
+ * #MwsConnectionMonitorNm, and the same #NMSettingUser keys are used. An active
+ * connection is only reported (and #MwsConnectionMonitor::connections-changed
+ * only emitted for it) once all of its details have been fetched.
+ * Initialisation completes once the details of all the connections which were
+ * active at the time have been fetched, or immediately if NetworkManager isn’t
+ * running. If NetworkManager is restarted, all active connections are removed
+ * and then re-added.
+ *
+ * Tariffs are parsed synchronously, and cached until their setting changes.
+ * Unlike #MwsConnectionMonitorNm, large tariffs aren’t parsed in a worker
+ * thread.
+ *
+ * Since: 0.3.0
+ */
+struct _MwsConnectionMonitorNmDbus
+{
+  GObject parent;
+
+  GDBusConnection *connection;  /* (owned) (not nullable) */
+
+  /* Exactly one of these will be set after initialisation completes (or fails).
+   * While initialising, @init_task is set, and is returned once the details of
+   * all the initial @active_connections have been fetched. */
+  GError *init_error;  /* (nullable) (owned) */
+  gboolean init_success;
+  GTask *init_task;  /* (nullable) (owned) */
+
+  /* Whether the initial set of active connections is known: either
+   * NetworkManager isn’t running, or `ActiveConnections` has been fetched. */
+  gboolean have_active_connections;
+
+  /* Allow cancelling any pending operations during dispose. */
+  GCancellable *cancellable;  /* (owned) */
+
+  guint name_watch_id;  /* 0 if not watching */
+  guint manager_properties_changed_id;  /* 0 if not subscribed */
+
+  /* Active connections, keyed by their object path. Entries are added as
+   * soon as they appear in `ActiveConnections`, but aren’t reported until
+   * they’re loaded. */
+  GHashTable *active_connections;  /* (owned) (element-type utf8 ActiveConnection) */
+
+  /* This cache should be invalidated whenever the set of loaded
+   * @active_connections is changed. */
+  gchar **cached_connection_ids;  /* (owned) (array zero-terminated=1) (nullable) */
+
+  /* Parsed `connection.tariff-bin` or `connection.tariff` for each active
+   * connection which has one, keyed by connection ID. This is checked against
+   * the current setting string on every lookup, and entries are removed when
+   * their active connection is removed. */
+  GHashTable *cached_tariffs;  /* (owned) (element-type utf8 CachedTariff) */
+
+  /* How long each tariff parse has taken, including failed ones. */
+  MwsLatencyHistogram tariff_parse_time;
+};
+
+/* A parsed `connection.tariff-bin` or `connection.tariff` string, as
+ * indicated by @tariff_is_binary. @tariff is %NULL if the string was invalid,
+ * so that the warning about it is only emitted once. */
+typedef struct
+{
+  guint tariff_str_hash;
+  gboolean tariff_is_binary;
+  gchar *tariff_str;  /* (owned) (not nullable) */
+  MwtTariff *tariff;  /* (owned) (nullable) */
+} CachedTariff;
+
+static void
+cached_tariff_free (CachedTariff *cached)
+{
+  g_free (cached->tariff_str);
+  g_clear_object (&cached->tariff);
+  g_free (cached);
+}
+
+/* Maximum refresh rate for device statistics to request from NetworkManager,
+ * in milliseconds. See #MwsConnectionMonitorNm. */
+#define STATISTICS_REFRESH_RATE_MS 5000
+
+#define NM_DBUS_NAME "org.freedesktop.NetworkManager"
+#define NM_DBUS_PATH "/org/freedesktop/NetworkManager"
+#define NM_DBUS_INTERFACE "org.freedesktop.NetworkManager"
+#define NM_DBUS_INTERFACE_ACTIVE_CONNECTION "org.freedesktop.NetworkManager.Connection.Active"
+#define NM_DBUS_INTERFACE_DEVICE "org.freedesktop.NetworkManager.Device"
+#define NM_DBUS_INTERFACE_STATISTICS "org.freedesktop.NetworkManager.Device.Statistics"
+#define NM_DBUS_INTERFACE_SETTINGS_CONNECTION "org.freedesktop.NetworkManager.Settings.Connection"
+#define DBUS_INTERFACE_PROPERTIES "org.freedesktop.DBus.Properties"
+
+/* Timeout for each call to NetworkManager, in milliseconds. */
+#define NM_CALL_TIMEOUT_MS 10000
+
+typedef struct _ActiveConnection ActiveConnection;
+
+/* A device belonging to an active connection, with the values of the
+ * properties we’re interested in. This is reference counted so that it can
+ * outlive removal from the active connection while calls are pending;
+ * @cancellable is cancelled and @active_connection cleared when it’s removed.
+ * @n_pending_calls counts the calls included in the active connection’s
+ * #ActiveConnection.n_pending_calls. */
+typedef struct
+{
+  gint ref_count;
+  ActiveConnection *active_connection;  /* (unowned) (nullable) */
+  GDBusConnection *connection;  /* (owned) (not nullable) */
+  gchar *path;  /* (owned) (not nullable) */
+  GCancellable *cancellable;  /* (owned) (not nullable) */
+  guint properties_changed_id;  /* 0 if not subscribed */
+  guint statistics_changed_id;  /* 0 if not subscribed */
+  guint n_pending_calls;
+  MwsMetered metered;
+  guint64 rx_bytes;
+} Device;
+
+/* An active connection, and the settings of its settings connection. This is
+ * reference counted in the same way as #Device. It is @loaded once
+ * @n_pending_calls first drops to zero; after that, each time it drops to zero
+ * again, #MwsConnectionMonitor::connection-details-changed is emitted. */
+struct _ActiveConnection
+{
+  gint ref_count;
+  MwsConnectionMonitorNmDbus *connection_monitor;  /* (unowned) (nullable) */
+  gchar *path;  /* (owned) (not nullable) */
+  GCancellable *cancellable;  /* (owned) (not nullable) */
+  guint properties_changed_id;  /* 0 if not subscribed */
+  guint n_pending_calls;
+  gboolean loaded;
+
+  gchar *id;  /* (owned) (nullable); NULL until the properties are fetched */
+  GPtrArray *devices;  /* (owned) (element-type Device) */
+
+  gchar *settings_path;  /* (owned) (nullable) */
+  guint settings_updated_id;  /* 0 if not subscribed */
+  MwsMetered connection_metered;
+  GVariant *user_data;  /* (owned) (nullable) (type a{ss}) */
+};
+
+static void device_release (Device *device);
+
+static Device *
+device_ref (Device *device)
+{
+  g_atomic_int_inc (&device->ref_count);
+  return device;
+}
+
+static void
+device_unref (Device *device)
+{
+  if (!g_atomic_int_dec_and_test (&device->ref_count))
+    return;
+
+  g_clear_object (&device->cancellable);
+  g_clear_object (&device->connection);
+  g_free (device->path);
+  g_free (device);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (Device, device_unref)
+
+static ActiveConnection *
+active_connection_ref (ActiveConnection *active_connection)
+{
+  g_atomic_int_inc (&active_connection->ref_count);
+  return active_connection;
+}
+
+static void
+active_connection_unref (ActiveConnection *active_connection)
+{
+  if (!g_atomic_int_dec_and_test (&active_connection->ref_count))
+    return;
+
+  g_clear_pointer (&active_connection->devices, g_ptr_array_unref);
+  g_clear_pointer (&active_connection->user_data, g_variant_unref);
+  g_clear_object (&active_connection->cancellable);
+  g_free (active_connection->settings_path);
+  g_free (active_connection->id);
+  g_free (active_connection->path);
+  g_free (active_connection);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ActiveConnection, active_connection_unref)
+
+static void
+unsubscribe (GDBusConnection *connection,
+             guint           *subscription_id)
+{
+  if (*subscription_id != 0)
+    g_dbus_connection_signal_unsubscribe (connection, *subscription_id);
+  *subscription_id = 0;
+}
+
+/* Called when @active_connection is removed from
+ * #MwsConnectionMonitorNmDbus.active_connections, to stop any further use of
+ * its connection monitor pointer. */
+static void
+active_connection_release (ActiveConnection *active_connection)
+{
+  GDBusConnection *connection = active_connection->connection_monitor->connection;
+
+  g_cancellable_cancel (active_connection->cancellable);
+  unsubscribe (connection, &active_connection->properties_changed_id);
+  unsubscribe (connection, &active_connection->settings_updated_id);
+
+  /* This releases the devices. */
+  g_ptr_array_set_size (active_connection->devices, 0);
+
+  active_connection->connection_monitor = NULL;
+  active_connection_unref (active_connection);
+}
+
+typedef enum
+{
+  PROP_CONNECTION = 1,
+} MwsConnectionMonitorNmDbusProperty;
+
+G_DEFINE_TYPE_WITH_CODE (MwsConnectionMonitorNmDbus, mws_connection_monitor_nm_dbus, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (MWS_TYPE_CONNECTION_MONITOR,
+                                                mws_connection_monitor_nm_dbus_connection_monitor_init)
+                         G_IMPLEMENT_INTERFACE (G_TYPE_ASYNC_INITABLE,
+                                                mws_connection_monitor_nm_dbus_async_initable_init))
+static void
+mws_connection_monitor_nm_dbus_class_init (MwsConnectionMonitorNmDbusClass *klass)
+{
+  GObjectClass *object_class = (GObjectClass *) klass;
+  GParamSpec *props[PROP_CONNECTION + 1] = { NULL, };
+
+  object_class->dispose = mws_connection_monitor_nm_dbus_dispose;
+  object_class->get_property = mws_connection_monitor_nm_dbus_get_property;
+  object_class->set_property = mws_connection_monitor_nm_dbus_set_property;
+
+  /**
+   * MwsConnectionMonitorNmDbus:connection:
+   *
+   * D-Bus connection to the system bus, which NetworkManager is on.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_CONNECTION] =
+      g_param_spec_object ("connection", "Connection",
+                           "D-Bus connection to the system bus, which "
+                           "NetworkManager is on.",
+                           G_TYPE_DBUS_CONNECTION,
+                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (object_class, G_N_ELEMENTS (props), props);
+}
+
+static void
+mws_connection_monitor_nm_dbus_connection_monitor_init (MwsConnectionMonitorInterface *iface)
+{
+  iface->get_connection_ids = mws_connection_monitor_nm_dbus_get_connection_ids;
+  iface->get_connection_details = mws_connection_monitor_nm_dbus_get_connection_details;
+}
+
+static void
+mws_connection_monitor_nm_dbus_async_initable_init (GAsyncInitableIface *iface)
+{
+  iface->init_async = mws_connection_monitor_nm_dbus_init_async;
+  iface->init_finish = mws_connection_monitor_nm_dbus_init_finish;
+}
+
+static void
+mws_connection_monitor_nm_dbus_init (MwsConnectionMonitorNmDbus *self)
+{
+  self->cancellable = g_cancellable_new ();
+  self->active_connections = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                    NULL,
+                                                    (GDestroyNotify) active_connection_release);
+  self->cached_tariffs = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                g_free,
+                                                (GDestroyNotify) cached_tariff_free);
+}
+
+static void
+mws_connection_monitor_nm_dbus_dispose (GObject *object)
+{
+  MwsConnectionMonitorNmDbus *self = MWS_CONNECTION_MONITOR_NM_DBUS (object);
+
+  if (self->cancellable != NULL)
+    g_cancellable_cancel (self->cancellable);
+  g_clear_object (&self->cancellable);
+
+  if (self->name_watch_id != 0)
+    g_bus_unwatch_name (self->name_watch_id);
+  self->name_watch_id = 0;
+
+  if (self->connection != NULL)
+    unsubscribe (self->connection, &self->manager_properties_changed_id);
+
+  /* This releases all the active connections, so must happen before
+   * @connection is cleared. */
+  g_clear_pointer (&self->active_connections, g_hash_table_unref);
+
+  g_clear_object (&self->connection);
+  g_clear_object (&self->init_task);
+  g_clear_error (&self->init_error);
+
+  g_clear_pointer (&self->cached_connection_ids, g_strfreev);
+  g_clear_pointer (&self->cached_tariffs, g_hash_table_unref);
+
+  /* Chain up to the parent class */
+  G_OBJECT_CLASS (mws_connection_monitor_nm_dbus_parent_class)->dispose (object);
+}
+
+static void
+mws_connection_monitor_nm_dbus_get_property (GObject    *object,
+                                             guint       property_id,
+                                             GValue     *value,
+                                             GParamSpec *pspec)
+{
+  MwsConnectionMonitorNmDbus *self = MWS_CONNECTION_MONITOR_NM_DBUS (object);
+
+  switch ((MwsConnectionMonitorNmDbusProperty) property_id)
+    {
+    case PROP_CONNECTION:
+      g_value_set_object (value, self->connection);
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+static void
+mws_connection_monitor_nm_dbus_set_property (GObject      *object,
+                                             guint         property_id,
+                                             const GValue *value,
+                                             GParamSpec   *pspec)
+{
+  MwsConnectionMonitorNmDbus *self = MWS_CONNECTION_MONITOR_NM_DBUS (object);
+
+  switch ((MwsConnectionMonitorNmDbusProperty) property_id)
+    {
+    case PROP_CONNECTION:
+      /* Construct only. */
+      g_assert (self->connection == NULL);
+      self->connection = g_value_dup_object (value);
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+/* Convert an `NMMetered` value from D-Bus to a #MwsMetered. Invalid values are
+ * treated as unknown. */
+static MwsMetered
+mws_metered_from_nm_metered (guint32 m)
+{
+  switch (m)
+    {
+    case 0:  /* NM_METERED_UNKNOWN */
+      return MWS_METERED_UNKNOWN;
+    case 1:  /* NM_METERED_YES */
+      return MWS_METERED_YES;
+    case 2:  /* NM_METERED_NO */
+      return MWS_METERED_NO;
+    case 3:  /* NM_METERED_GUESS_YES */
+      return MWS_METERED_GUESS_YES;
+    case 4:  /* NM_METERED_GUESS_NO */
+      return MWS_METERED_GUESS_NO;
+    default:
+      return MWS_METERED_UNKNOWN;
+    }
+}
+
+static void check_init_complete (MwsConnectionMonitorNmDbus *self);
+
+/* Emit #MwsConnectionMonitor::connection-statistics-changed for
+ * @active_connection, summing the counters of all its devices. */
+static void
+active_connection_emit_statistics (ActiveConnection *active_connection)
+{
+  guint64 rx_bytes = 0;
+
+  if (!active_connection->loaded)
+    return;
+
+  for (gsize i = 0; i < active_connection->devices->len; i++)
+    {
+      const Device *device = g_ptr_array_index (active_connection->devices, i);
+      rx_bytes += device->rx_bytes;
+    }
+
+  g_signal_emit_by_name (active_connection->connection_monitor,
+                         "connection-statistics-changed",
+                         active_connection->id, rx_bytes);
+}
+
+static void
+active_connection_begin_call (ActiveConnection *active_connection)
+{
+  active_connection->n_pending_calls++;
+}
+
+/* Called when a call on behalf of @active_connection has finished (or been
+ * abandoned), and its result has been stored. If it was the last pending call,
+ * the active connection is reported as added or changed. */
+static void
+active_connection_end_call (ActiveConnection *active_connection)
+{
+  MwsConnectionMonitorNmDbus *self = active_connection->connection_monitor;
+
+  g_assert (active_connection->n_pending_calls > 0);
+  active_connection->n_pending_calls--;
+
+  if (active_connection->n_pending_calls > 0)
+    return;
+
+  if (active_connection->loaded)
+    {
+      g_signal_emit_by_name (self, "connection-details-changed",
+                             active_connection->id);
+      return;
+    }
+
+  /* active_connection_get_all_cb() only ends its call once the ID is known. */
+  g_assert (active_connection->id != NULL);
+
+  g_debug ("%s: Adding active connection ‘%s’ (%s).",
+           G_STRFUNC, active_connection->id, active_connection->path);
+
+  active_connection->loaded = TRUE;
+  g_clear_pointer (&self->cached_connection_ids, g_strfreev);
+
+  if (self->init_task != NULL)
+    {
+      check_init_complete (self);
+    }
+  else
+    {
+      g_autoptr(GPtrArray) added = g_ptr_array_new_with_free_func (NULL);
+      g_ptr_array_add (added, active_connection->id);
+      g_signal_emit_by_name (self, "connections-changed", added, NULL);
+    }
+
+  active_connection_emit_statistics (active_connection);
+}
+
+static void
+device_begin_call (Device *device)
+{
+  device->n_pending_calls++;
+  active_connection_begin_call (device->active_connection);
+}
+
+static void
+device_end_call (Device *device)
+{
+  g_assert (device->n_pending_calls > 0);
+  device->n_pending_calls--;
+  active_connection_end_call (device->active_connection);
+}
+
+static void
+device_get_metered_cb (GObject      *obj,
+                       GAsyncResult *result,
+                       gpointer      user_data)
+{
+  g_autoptr(Device) device = user_data;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (obj), result, &local_error);
+
+  if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    return;
+
+  if (local_error != NULL)
+    {
+      g_debug ("Failed to get metered status of device ‘%s’: %s",
+               device->path, local_error->message);
+    }
+  else
+    {
+      g_autoptr(GVariant) value = NULL;
+      g_variant_get (reply, "(v)", &value);
+
+      if (g_variant_is_of_type (value, G_VARIANT_TYPE_UINT32))
+        device->metered = mws_metered_from_nm_metered (g_variant_get_uint32 (value));
+    }
+
+  device_end_call (device);
+}
+
+static void
+device_set_refresh_rate_cb (GObject      *obj,
+                            GAsyncResult *result,
+                            gpointer      user_data)
+{
+  g_autoptr(Device) device = user_data;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (obj), result, &local_error);
+
+  /* This will typically fail if polkit doesn’t allow us to enable statistics,
+   * which isn’t fatal: capacity limits just won’t be enforced. */
+  if (local_error != NULL &&
+      !g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    g_debug ("Failed to enable statistics for device ‘%s’: %s",
+             device->path, local_error->message);
+}
+
+static void
+device_get_statistics_cb (GObject      *obj,
+                          GAsyncResult *result,
+                          gpointer      user_data)
+{
+  g_autoptr(Device) device = user_data;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (obj), result, &local_error);
+
+  if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    return;
+
+  if (local_error != NULL)
+    {
+      g_debug ("Failed to get statistics for device ‘%s’: %s",
+               device->path, local_error->message);
+    }
+  else
+    {
+      g_autoptr(GVariant) properties = NULL;
+      guint32 refresh_rate_ms = 0;
+
+      g_variant_get (reply, "(@a{sv})", &properties);
+      g_variant_lookup (properties, "RxBytes", "t", &device->rx_bytes);
+      g_variant_lookup (properties, "RefreshRateMs", "u", &refresh_rate_ms);
+
+      /* Make sure NetworkManager updates the counters often enough. A refresh
+       * rate of 0 means statistics are disabled. */
+      if (refresh_rate_ms == 0 || refresh_rate_ms > STATISTICS_REFRESH_RATE_MS)
+        g_dbus_connection_call (device->connection, NM_DBUS_NAME, device->path,
+                                DBUS_INTERFACE_PROPERTIES, "Set",
+                                g_variant_new ("(ssv)", NM_DBUS_INTERFACE_STATISTICS,
+                                               "RefreshRateMs",
+                                               g_variant_new_uint32 (STATISTICS_REFRESH_RATE_MS)),
+                                NULL, G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                NM_CALL_TIMEOUT_MS, device->cancellable,
+                                device_set_refresh_rate_cb, device_ref (device));
+    }
+
+  device_end_call (device);
+}
+
+static void
+device_properties_changed_cb (GDBusConnection *connection,
+                              const gchar     *sender_name,
+                              const gchar     *object_path,
+                              const gchar     *interface_name,
+                              const gchar     *signal_name,
+                              GVariant        *parameters,
+                              gpointer         user_data)
+{
+  Device *device = user_data;
+  const gchar *changed_interface_name;
+  g_autoptr(GVariant) changed_properties = NULL;
+  guint32 metered;
+  guint64 rx_bytes;
+
+  if (device->active_connection == NULL ||
+      !g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(sa{sv}as)")))
+    return;
+
+  g_variant_get (parameters, "(&s@a{sv}@as)",
+                 &changed_interface_name, &changed_properties, NULL);
+
+  if (g_str_equal (changed_interface_name, NM_DBUS_INTERFACE_DEVICE) &&
+      g_variant_lookup (changed_properties, "Metered", "u", &metered))
+    {
+      device->metered = mws_metered_from_nm_metered (metered);
+
+      /* Emit connection-details-changed (once loaded). */
+      active_connection_begin_call (device->active_connection);
+      active_connection_end_call (device->active_connection);
+    }
+  else if (g_str_equal (changed_interface_name, NM_DBUS_INTERFACE_STATISTICS) &&
+           g_variant_lookup (changed_properties, "RxBytes", "t", &rx_bytes))
+    {
+      device->rx_bytes = rx_bytes;
+      active_connection_emit_statistics (device->active_connection);
+    }
+}
+
+/* Start tracking the device at @path as part of @active_connection. */
+static Device *
+device_new (ActiveConnection *active_connection,
+            const gchar      *path)
+{
+  GDBusConnection *connection = active_connection->connection_monitor->connection;
+  g_autoptr(Device) device = g_new0 (Device, 1);
+
+  device->ref_count = 1;
+  device->active_connection = active_connection;
+  device->connection = g_object_ref (connection);
+  device->path = g_strdup (path);
+  device->cancellable = g_cancellable_new ();
+  device->metered = MWS_METERED_UNKNOWN;
+
+  /* Subscribe before fetching the properties, so no changes are missed. */
+  device->properties_changed_id =
+      g_dbus_connection_signal_subscribe (connection, NM_DBUS_NAME,
+                                          DBUS_INTERFACE_PROPERTIES,
+                                          "PropertiesChanged", path,
+                                          NM_DBUS_INTERFACE_DEVICE,
+                                          G_DBUS_SIGNAL_FLAGS_NONE,
+                                          device_properties_changed_cb,
+                                          device_ref (device),
+                                          (GDestroyNotify) device_unref);
+  device->statistics_changed_id =
+      g_dbus_connection_signal_subscribe (connection, NM_DBUS_NAME,
+                                          DBUS_INTERFACE_PROPERTIES,
+                                          "PropertiesChanged", path,
+                                          NM_DBUS_INTERFACE_STATISTICS,
+                                          G_DBUS_SIGNAL_FLAGS_NONE,
+                                          device_properties_changed_cb,
+                                          device_ref (device),
+                                          (GDestroyNotify) device_unref);
+
+  device_begin_call (device);
+  g_dbus_connection_call (connection, NM_DBUS_NAME, path,
+                          DBUS_INTERFACE_PROPERTIES, "Get",
+                          g_variant_new ("(ss)", NM_DBUS_INTERFACE_DEVICE,
+                                         "Metered"),
+                          G_VARIANT_TYPE ("(v)"),
+                          G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                          NM_CALL_TIMEOUT_MS, device->cancellable,
+                          device_get_metered_cb, device_ref (device));
+
+  device_begin_call (device);
+  g_dbus_connection_call (connection, NM_DBUS_NAME, path,
+                          DBUS_INTERFACE_PROPERTIES, "GetAll",
+                          g_variant_new ("(s)", NM_DBUS_INTERFACE_STATISTICS),
+                          G_VARIANT_TYPE ("(a{sv})"),
+                          G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                          NM_CALL_TIMEOUT_MS, device->cancellable,
+                          device_get_statistics_cb, device_ref (device));
+
+  return g_steal_pointer (&device);
+}
+
+/* Called when @device is removed from #ActiveConnection.devices. Any calls
+ * still pending for it are abandoned. */
+static void
+device_release (Device *device)
+{
+  g_cancellable_cancel (device->cancellable);
+  unsubscribe (device->connection, &device->properties_changed_id);
+  unsubscribe (device->connection, &device->statistics_changed_id);
+
+  if (device->active_connection != NULL)
+    {
+      g_assert (device->active_connection->n_pending_calls >= device->n_pending_calls);
+      device->active_connection->n_pending_calls -= device->n_pending_calls;
+    }
+
+  device->n_pending_calls = 0;
+  device->active_connection = NULL;
+  device_unref (device);
+}
+
+/* Update the devices of @active_connection to match @device_paths. The caller
+ * must have a call pending on @active_connection, so that it isn’t reported as
+ * changed until it has finished updating. */
+static void
+active_connection_set_devices (ActiveConnection   *active_connection,
+                               const gchar * const *device_paths)
+{
+  g_assert (active_connection->n_pending_calls > 0);
+
+  for (guint i = active_connection->devices->len; i > 0; i--)
+    {
+      const Device *device = g_ptr_array_index (active_connection->devices, i - 1);
+
+      if (!g_strv_contains (device_paths, device->path))
+        g_ptr_array_remove_index (active_connection->devices, i - 1);
+    }
+
+  for (gsize i = 0; device_paths[i] != NULL; i++)
+    {
+      gboolean found = FALSE;
+
+      for (gsize j = 0; j < active_connection->devices->len && !found; j++)
+        {
+          const Device *device = g_ptr_array_index (active_connection->devices, j);
+          found = g_str_equal (device->path, device_paths[i]);
+        }
+
+      if (!found)
+        g_ptr_array_add (active_connection->devices,
+                         device_new (active_connection, device_paths[i]));
+    }
+}
+
+static void
+active_connection_get_settings_cb (GObject      *obj,
+                                   GAsyncResult *result,
+                                   gpointer      user_data)
+{
+  g_autoptr(ActiveConnection) active_connection = user_data;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (obj), result, &local_error);
+
+  if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    return;
+
+  /* If the settings path has changed since this call was made, a newer call
+   * is pending. NetworkManager replies in order, so that call’s reply will
+   * overwrite these settings. */
+  g_clear_pointer (&active_connection->user_data, g_variant_unref);
+  active_connection->connection_metered = MWS_METERED_GUESS_NO;
+
+  if (local_error != NULL)
+    {
+      g_debug ("Failed to get settings ‘%s’ for active connection ‘%s’: %s",
+               active_connection->settings_path, active_connection->path,
+               local_error->message);
+    }
+  else
+    {
+      g_autoptr(GVariant) settings = NULL;
+      g_autoptr(GVariant) setting_connection = NULL;
+      g_autoptr(GVariant) setting_user = NULL;
+
+      g_variant_get (reply, "(@a{sa{sv}})", &settings);
+
+      /* These mirror nm_setting_connection_get_metered(), which defaults to
+       * unknown, and #MwsConnectionMonitorNm’s default if there’s no
+       * connection setting at all. */
+      setting_connection = g_variant_lookup_value (settings, "connection",
+                                                   G_VARIANT_TYPE_VARDICT);
+      if (setting_connection != NULL)
+        {
+          gint32 metered = 0;
+          g_variant_lookup (setting_connection, "metered", "i", &metered);
+          active_connection->connection_metered = mws_metered_from_nm_metered (metered);
+        }
+
+      setting_user = g_variant_lookup_value (settings, "user",
+                                             G_VARIANT_TYPE_VARDICT);
+      if (setting_user != NULL)
+        active_connection->user_data = g_variant_lookup_value (setting_user, "data",
+                                                               G_VARIANT_TYPE ("a{ss}"));
+    }
+
+  active_connection_end_call (active_connection);
+}
+
+static void
+active_connection_fetch_settings (ActiveConnection *active_connection)
+{
+  GDBusConnection *connection = active_connection->connection_monitor->connection;
+
+  active_connection_begin_call (active_connection);
+  g_dbus_connection_call (connection, NM_DBUS_NAME,
+                          active_connection->settings_path,
+                          NM_DBUS_INTERFACE_SETTINGS_CONNECTION, "GetSettings",
+                          NULL, G_VARIANT_TYPE ("(a{sa{sv}})"),
+                          G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                          NM_CALL_TIMEOUT_MS, active_connection->cancellable,
+                          active_connection_get_settings_cb,
+                          active_connection_ref (active_connection));
+}
+
+static void
+settings_updated_cb (GDBusConnection *connection,
+                     const gchar     *sender_name,
+                     const gchar     *object_path,
+                     const gchar     *interface_name,
+                     const gchar     *signal_name,
+                     GVariant        *parameters,
+                     gpointer         user_data)
+{
+  ActiveConnection *active_connection = user_data;
+
+  if (active_connection->connection_monitor == NULL ||
+      g_strcmp0 (active_connection->settings_path, object_path) != 0)
+    return;
+
+  active_connection_fetch_settings (active_connection);
+}
+
+/* Update the settings connection of @active_connection to @settings_path, and
+ * fetch its settings if it has changed. The caller must have a call pending on
+ * @active_connection. */
+static void
+active_connection_set_settings_path (ActiveConnection *active_connection,
+                                     const gchar      *settings_path)
+{
+  GDBusConnection *connection = active_connection->connection_monitor->connection;
+
+  g_assert (active_connection->n_pending_calls > 0);
+
+  /* NetworkManager uses `/` for ‘none’. */
+  if (g_strcmp0 (settings_path, "/") == 0)
+    settings_path = NULL;
+
+  if (g_strcmp0 (active_connection->settings_path, settings_path) == 0)
+    return;
+
+  unsubscribe (connection, &active_connection->settings_updated_id);
+  g_free (active_connection->settings_path);
+  active_connection->settings_path = g_strdup (settings_path);
+
+  /* The default if there’s no settings connection. */
+  g_clear_pointer (&active_connection->user_data, g_variant_unref);
+  active_connection->connection_metered = MWS_METERED_GUESS_NO;
+
+  if (settings_path == NULL)
+    return;
+
+  active_connection->settings_updated_id =
+      g_dbus_connection_signal_subscribe (connection, NM_DBUS_NAME,
+                                          NM_DBUS_INTERFACE_SETTINGS_CONNECTION,
+                                          "Updated", settings_path, NULL,
+                                          G_DBUS_SIGNAL_FLAGS_NONE,
+                                          settings_updated_cb,
+                                          active_connection_ref (active_connection),
+                                          (GDestroyNotify) active_connection_unref);
+  active_connection_fetch_settings (active_connection);
+}
+
+/* Update @active_connection from @properties, a (partial) set of the
+ * properties of its `org.freedesktop.NetworkManager.Connection.Active`
+ * interface. The caller must have a call pending on @active_connection. */
+static void
+active_connection_update (ActiveConnection *active_connection,
+                          GVariant         *properties)
+{
+  const gchar *id, *settings_path;
+  g_autofree const gchar **device_paths = NULL;
+
+  /* The ID can’t change while the connection is active, so only take the
+   * first value. */
+  if (active_connection->id == NULL &&
+      g_variant_lookup (properties, "Id", "&s", &id))
+    active_connection->id = g_strdup (id);
+
+  if (g_variant_lookup (properties, "Connection", "&o", &settings_path))
+    active_connection_set_settings_path (active_connection, settings_path);
+
+  if (g_variant_lookup (properties, "Devices", "^a&o", &device_paths))
+    active_connection_set_devices (active_connection, device_paths);
+}
+
+static void
+active_connection_get_all_cb (GObject      *obj,
+                              GAsyncResult *result,
+                              gpointer      user_data)
+{
+  g_autoptr(ActiveConnection) active_connection = user_data;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (obj), result, &local_error);
+
+  if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    return;
+
+  if (local_error == NULL)
+    {
+      g_autoptr(GVariant) properties = NULL;
+      g_variant_get (reply, "(@a{sv})", &properties);
+      active_connection_update (active_connection, properties);
+
+      if (active_connection->id == NULL)
+        g_set_error_literal (&local_error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                             "No Id property");
+    }
+
+  if (local_error != NULL)
+    {
+      MwsConnectionMonitorNmDbus *self = active_connection->connection_monitor;
+
+      /* The active connection has probably just disappeared. Forget about it;
+       * if it hasn’t, it will be retried next time `ActiveConnections`
+       * changes. This cancels any other calls started for it. */
+      g_debug ("Failed to get properties of active connection ‘%s’: %s",
+               active_connection->path, local_error->message);
+
+      g_hash_table_remove (self->active_connections, active_connection->path);
+      check_init_complete (self);
+      return;
+    }
+
+  active_connection_end_call (active_connection);
+}
+
+static void
+active_connection_properties_changed_cb (GDBusConnection *connection,
+                                         const gchar     *sender_name,
+                                         const gchar     *object_path,
+                                         const gchar     *interface_name,
+                                         const gchar     *signal_name,
+                                         GVariant        *parameters,
+                                         gpointer         user_data)
+{
+  ActiveConnection *active_connection = user_data;
+  g_autoptr(GVariant) changed_properties = NULL;
+
+  if (active_connection->connection_monitor == NULL ||
+      !g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(sa{sv}as)")))
+    return;
+
+  g_variant_get (parameters, "(&s@a{sv}@as)", NULL, &changed_properties, NULL);
+
+  /* Most changes are to the state and IP configuration, which we don’t care
+   * about. */
+  if (!g_variant_lookup (changed_properties, "Connection", "&o", NULL) &&
+      !g_variant_lookup (changed_properties, "Devices", "^a&o", NULL))
+    return;
+
+  active_connection_begin_call (active_connection);
+  active_connection_update (active_connection, changed_properties);
+  active_connection_end_call (active_connection);
+}
+
+/* Start tracking the active connection at @path. */
+static ActiveConnection *
+active_connection_new (MwsConnectionMonitorNmDbus *self,
+                       const gchar                *path)
+{
+  g_autoptr(ActiveConnection) active_connection = g_new0 (ActiveConnection, 1);
+
+  active_connection->ref_count = 1;
+  active_connection->connection_monitor = self;
+  active_connection->path = g_strdup (path);
+  active_connection->cancellable = g_cancellable_new ();
+  active_connection->devices = g_ptr_array_new_with_free_func ((GDestroyNotify) device_release);
+  active_connection->connection_metered = MWS_METERED_GUESS_NO;
+
+  /* Subscribe before fetching the properties, so no changes are missed. */
+  active_connection->properties_changed_id =
+      g_dbus_connection_signal_subscribe (self->connection, NM_DBUS_NAME,
+                                          DBUS_INTERFACE_PROPERTIES,
+                                          "PropertiesChanged", path,
+                                          NM_DBUS_INTERFACE_ACTIVE_CONNECTION,
+                                          G_DBUS_SIGNAL_FLAGS_NONE,
+                                          active_connection_properties_changed_cb,
+                                          active_connection_ref (active_connection),
+                                          (GDestroyNotify) active_connection_unref);
+
+  active_connection_begin_call (active_connection);
+  g_dbus_connection_call (self->connection, NM_DBUS_NAME, path,
+                          DBUS_INTERFACE_PROPERTIES, "GetAll",
+                          g_variant_new ("(s)", NM_DBUS_INTERFACE_ACTIVE_CONNECTION),
+                          G_VARIANT_TYPE ("(a{sv})"),
+                          G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                          NM_CALL_TIMEOUT_MS, active_connection->cancellable,
+                          active_connection_get_all_cb,
+                          active_connection_ref (active_connection));
+
+  return g_steal_pointer (&active_connection);
+}
+
+/* Complete initialisation if the initial set of active connections is known,
+ * and they have all been loaded. */
+static void
+check_init_complete (MwsConnectionMonitorNmDbus *self)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  if (self->init_task == NULL || !self->have_active_connections)
+    return;
+
+  g_hash_table_iter_init (&iter, self->active_connections);
+
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      const ActiveConnection *active_connection = value;
+
+      if (!active_connection->loaded)
+        return;
+    }
+
+  g_debug ("%s: Loaded %u initial active connections.",
+           G_STRFUNC, g_hash_table_size (self->active_connections));
+
+  g_autoptr(GTask) task = g_steal_pointer (&self->init_task);
+  self->init_success = TRUE;
+  g_task_return_boolean (task, TRUE);
+}
+
+/* Update the set of active connections to match @paths, which is %NULL if
+ * NetworkManager has gone away. Connections which have been removed are
+ * reported immediately; connections which have been added are reported once
+ * they’ve loaded. */
+static void
+update_active_connections (MwsConnectionMonitorNmDbus *self,
+                           const gchar * const        *paths)
+{
+  g_autoptr(GPtrArray) removed = g_ptr_array_new_with_free_func (g_free);
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, self->active_connections);
+
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      ActiveConnection *active_connection = value;
+
+      if (paths != NULL && g_strv_contains (paths, active_connection->path))
+        continue;
+
+      if (active_connection->loaded)
+        {
+          g_debug ("%s: Removing active connection ‘%s’ (%s).",
+                   G_STRFUNC, active_connection->id, active_connection->path);
+
+          g_hash_table_remove (self->cached_tariffs, active_connection->id);
+          g_ptr_array_add (removed, g_strdup (active_connection->id));
+        }
+
+      g_hash_table_iter_remove (&iter);
+    }
+
+  for (gsize i = 0; paths != NULL && paths[i] != NULL; i++)
+    {
+      if (g_hash_table_contains (self->active_connections, paths[i]))
+        continue;
+
+      ActiveConnection *active_connection = active_connection_new (self, paths[i]);
+      g_hash_table_insert (self->active_connections,
+                           active_connection->path, active_connection);
+    }
+
+  if (removed->len > 0)
+    {
+      g_clear_pointer (&self->cached_connection_ids, g_strfreev);
+      g_signal_emit_by_name (self, "connections-changed", NULL, removed);
+    }
+
+  check_init_complete (self);
+}
+
+static void
+manager_get_active_connections_cb (GObject      *obj,
+                                   GAsyncResult *result,
+                                   gpointer      user_data)
+{
+  MwsConnectionMonitorNmDbus *self = MWS_CONNECTION_MONITOR_NM_DBUS (user_data);
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GVariant) value = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (obj), result, &local_error);
+
+  /* @self may have been disposed. */
+  if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    return;
+
+  self->have_active_connections = TRUE;
+
+  if (local_error != NULL)
+    {
+      g_warning ("Failed to get active connections from NetworkManager: %s",
+                 local_error->message);
+      check_init_complete (self);
+      return;
+    }
+
+  g_variant_get (reply, "(v)", &value);
+
+  if (g_variant_is_of_type (value, G_VARIANT_TYPE_OBJECT_PATH_ARRAY))
+    {
+      g_autofree const gchar **paths = g_variant_get_objv (value, NULL);
+      update_active_connections (self, paths);
+    }
+  else
+    {
+      check_init_complete (self);
+    }
+}
+
+static void
+manager_properties_changed_cb (GDBusConnection *connection,
+                               const gchar     *sender_name,
+                               const gchar     *object_path,
+                               const gchar     *interface_name,
+                               const gchar     *signal_name,
+                               GVariant        *parameters,
+                               gpointer         user_data)
+{
+  MwsConnectionMonitorNmDbus *self = MWS_CONNECTION_MONITOR_NM_DBUS (user_data);
+  g_autoptr(GVariant) changed_properties = NULL;
+  g_autofree const gchar **paths = NULL;
+
+  if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(sa{sv}as)")))
+    return;
+
+  g_variant_get (parameters, "(&s@a{sv}@as)", NULL, &changed_properties, NULL);
+
+  if (g_variant_lookup (changed_properties, "ActiveConnections", "^a&o", &paths))
+    update_active_connections (self, paths);
+}
+
+static void
+name_appeared_cb (GDBusConnection *connection,
+                  const gchar     *name,
+                  const gchar     *name_owner,
+                  gpointer         user_data)
+{
+  MwsConnectionMonitorNmDbus *self = MWS_CONNECTION_MONITOR_NM_DBUS (user_data);
+
+  g_debug ("%s: NetworkManager appeared as ‘%s’.", G_STRFUNC, name_owner);
+
+  g_dbus_connection_call (connection, NM_DBUS_NAME, NM_DBUS_PATH,
+                          DBUS_INTERFACE_PROPERTIES, "Get",
+                          g_variant_new ("(ss)", NM_DBUS_INTERFACE,
+                                         "ActiveConnections"),
+                          G_VARIANT_TYPE ("(v)"),
+                          G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                          NM_CALL_TIMEOUT_MS, self->cancellable,
+                          manager_get_active_connections_cb, self);
+}
+
+static void
+name_vanished_cb (GDBusConnection *connection,
+                  const gchar     *name,
+                  gpointer         user_data)
+{
+  MwsConnectionMonitorNmDbus *self = MWS_CONNECTION_MONITOR_NM_DBUS (user_data);
+
+  g_debug ("%s: NetworkManager is not running.", G_STRFUNC);
+
+  self->have_active_connections = TRUE;
+  update_active_connections (self, NULL);
+}
+
+static void
+mws_connection_monitor_nm_dbus_init_async (GAsyncInitable      *initable,
+                                           int                  io_priority,
+                                           GCancellable        *cancellable,
+                                           GAsyncReadyCallback  callback,
+                                           gpointer             user_data)
+{
+  MwsConnectionMonitorNmDbus *self = MWS_CONNECTION_MONITOR_NM_DBUS (initable);
+
+  /* We don’t support parallel initialisation. */
+  g_assert (self->init_task == NULL);
+
+  g_autoptr(GTask) task = g_task_new (initable, cancellable, callback, user_data);
+  g_task_set_source_tag (task, mws_connection_monitor_nm_dbus_init_async);
+
+  if (self->init_error != NULL)
+    {
+      g_task_return_error (task, g_error_copy (self->init_error));
+      return;
+    }
+  else if (self->init_success)
+    {
+      g_task_return_boolean (task, TRUE);
+      return;
+    }
+
+  g_assert (self->connection != NULL);
+
+  self->init_task = g_steal_pointer (&task);
+
+  /* Subscribe to changes to the set of active connections first, so none are
+   * missed. Both this and the name watch call back in the current thread
+   * default main context. */
+  self->manager_properties_changed_id =
+      g_dbus_connection_signal_subscribe (self->connection, NM_DBUS_NAME,
+                                          DBUS_INTERFACE_PROPERTIES,
+                                          "PropertiesChanged", NM_DBUS_PATH,
+                                          NM_DBUS_INTERFACE,
+                                          G_DBUS_SIGNAL_FLAGS_NONE,
+                                          manager_properties_changed_cb,
+                                          self, NULL);
+  self->name_watch_id =
+      g_bus_watch_name_on_connection (self->connection, NM_DBUS_NAME,
+                                      G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                      name_appeared_cb, name_vanished_cb,
+                                      self, NULL);
+}
+
+static gboolean
+mws_connection_monitor_nm_dbus_init_finish (GAsyncInitable  *initable,
+                                            GAsyncResult    *result,
+                                            GError         **error)
+{
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/* Look up the loaded active connection with @id. */
+static ActiveConnection *
+lookup_active_connection (MwsConnectionMonitorNmDbus *self,
+                          const gchar                *id)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, self->active_connections);
+
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      ActiveConnection *active_connection = value;
+
+      if (active_connection->loaded && g_str_equal (active_connection->id, id))
+        return active_connection;
+    }
+
+  return NULL;
+}
+
+static const gchar * const *
+mws_connection_monitor_nm_dbus_get_connection_ids (MwsConnectionMonitor *monitor)
+{
+  MwsConnectionMonitorNmDbus *self = MWS_CONNECTION_MONITOR_NM_DBUS (monitor);
+
+  if (self->cached_connection_ids == NULL)
+    {
+      g_autoptr(GPtrArray) connection_ids = g_ptr_array_new_with_free_func (g_free);
+      GHashTableIter iter;
+      gpointer value;
+
+      g_hash_table_iter_init (&iter, self->active_connections);
+
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+        {
+          const ActiveConnection *active_connection = value;
+
+          if (active_connection->loaded)
+            g_ptr_array_add (connection_ids, g_strdup (active_connection->id));
+        }
+
+      g_ptr_array_add (connection_ids, NULL);  /* NULL terminator */
+      self->cached_connection_ids = (gchar **) g_ptr_array_free (g_steal_pointer (&connection_ids), FALSE);
+    }
+
+  return (const gchar * const *) self->cached_connection_ids;
+}
+
+/* Get a boolean configuration value from @user_data, the `user.data` settings
+ * of a connection. Valid values are `0` or `1`; if @key is unset, the
+ * @default_value is returned. */
+static gboolean
+user_data_get_boolean (GVariant    *user_data,
+                       const gchar *key,
+                       gboolean     default_value)
+{
+  const gchar *str;
+
+  if (!g_variant_lookup (user_data, key, "&s", &str))
+    return default_value;
+  else if (g_str_equal (str, "0"))
+    return FALSE;
+  else if (g_str_equal (str, "1"))
+    return TRUE;
+  else
+    g_warning ("Invalid value ‘%s’ for user setting ‘%s’; expecting ‘0’ or ‘1’",
+               str, key);
+
+  return default_value;
+}
+
+/* Get the parsed form of @tariff_str, the `connection.tariff-bin` (if
+ * @tariff_is_binary is %TRUE) or `connection.tariff` setting for the
+ * connection with @id. The result is cached, and @tariff_str is only parsed
+ * if it has changed since the last call for @id. Returns %NULL (and warns
+ * once) if @tariff_str is invalid. */
+static MwtTariff *
+get_cached_tariff (MwsConnectionMonitorNmDbus *self,
+                   const gchar                *id,
+                   const gchar                *tariff_str,
+                   gboolean                    tariff_is_binary)
+{
+  const gchar *key = tariff_is_binary ? "connection.tariff-bin" : "connection.tariff";
+  guint tariff_str_hash = g_str_hash (tariff_str);
+  CachedTariff *cached = g_hash_table_lookup (self->cached_tariffs, id);
+
+  if (cached == NULL ||
+      cached->tariff_str_hash != tariff_str_hash ||
+      cached->tariff_is_binary != tariff_is_binary ||
+      !g_str_equal (cached->tariff_str, tariff_str))
+    {
+      g_autoptr(GError) local_error = NULL;
+
+      g_debug ("%s: Parsing tariff from %s for connection ‘%s’.",
+               G_STRFUNC, key, id);
+
+      gint64 parse_start_usec = g_get_monotonic_time ();
+      cached = g_new0 (CachedTariff, 1);
+      cached->tariff_str_hash = tariff_str_hash;
+      cached->tariff_is_binary = tariff_is_binary;
+      cached->tariff_str = g_strdup (tariff_str);
+      cached->tariff = mws_tariff_setting_parse (tariff_str, tariff_is_binary,
+                                                 &local_error);
+      mws_latency_histogram_record (&self->tariff_parse_time,
+                                    g_get_monotonic_time () - parse_start_usec);
+
+      if (local_error != NULL)
+        g_warning ("%s contained an invalid tariff ‘%s’: %s",
+                   key, tariff_str, local_error->message);
+
+      g_hash_table_replace (self->cached_tariffs, g_strdup (id), cached);
+    }
+
+  return (cached->tariff != NULL) ? g_object_ref (cached->tariff) : NULL;
+}
+
+static gboolean
+mws_connection_monitor_nm_dbus_get_connection_details (MwsConnectionMonitor *monitor,
+                                                       const gchar          *id,
+                                                       MwsConnectionDetails *out_details)
+{
+  MwsConnectionMonitorNmDbus *self = MWS_CONNECTION_MONITOR_NM_DBUS (monitor);
+  ActiveConnection *active_connection = lookup_active_connection (self, id);
+
+  if (active_connection == NULL)
+    return FALSE;
+
+  /* Early return if the connection was found, but the caller doesn’t want the details. */
+  if (out_details == NULL)
+    return TRUE;
+
+  /* Combine the metered status of the devices and the settings connection
+   * pessimistically, as in #MwsConnectionMonitorNm. */
+  MwsMetered devices_metered = MWS_METERED_UNKNOWN;
+
+  for (gsize i = 0; i < active_connection->devices->len; i++)
+    {
+      const Device *device = g_ptr_array_index (active_connection->devices, i);
+      devices_metered = mws_metered_combine_pessimistic (device->metered,
+                                                         devices_metered);
+    }
+
+  const gboolean allow_downloads_when_metered_default = FALSE;
+  const gboolean allow_downloads_default = TRUE;
+
+  gboolean allow_downloads_when_metered = allow_downloads_when_metered_default;
+  gboolean allow_downloads = allow_downloads_default;
+  g_autoptr(MwtTariff) tariff = NULL;
+  GVariant *user_data = active_connection->user_data;
+
+  if (user_data != NULL)
+    {
+      allow_downloads_when_metered = user_data_get_boolean (user_data,
+                                                            "connection.allow-downloads-when-metered",
+                                                            allow_downloads_when_metered_default);
+      allow_downloads = user_data_get_boolean (user_data,
+                                               "connection.allow-downloads",
+                                               allow_downloads_default);
+
+      gboolean tariff_enabled = user_data_get_boolean (user_data,
+                                                       "connection.tariff-enabled",
+                                                       FALSE);
+      const gchar *tariff_bin_str = NULL, *tariff_variant_str = NULL;
+      g_variant_lookup (user_data, "connection.tariff-bin", "&s", &tariff_bin_str);
+      g_variant_lookup (user_data, "connection.tariff", "&s", &tariff_variant_str);
+
+      /* Prefer the binary form, since it’s much cheaper to load. */
+      if (tariff_enabled && tariff_bin_str != NULL)
+        tariff = get_cached_tariff (self, id, tariff_bin_str, TRUE);
+      else if (tariff_enabled && tariff_variant_str != NULL)
+        tariff = get_cached_tariff (self, id, tariff_variant_str, FALSE);
+      else if (tariff_enabled)
+        g_warning ("Neither connection.tariff-bin nor connection.tariff is "
+                   "set even though connection.tariff-enabled is 1");
+    }
+
+  out_details->metered = mws_metered_combine_pessimistic (devices_metered,
+                                                          active_connection->connection_metered);
+  out_details->allow_downloads_when_metered = allow_downloads_when_metered;
+  out_details->allow_downloads = allow_downloads;
+  out_details->tariff = g_steal_pointer (&tariff);
+
+  return TRUE;
+}
+
+/**
+ * mws_connection_monitor_nm_dbus_new_async:
+ * @connection: a #GDBusConnection to the system bus
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: callback to invoke on completion
+ * @user_data: user data to pass to @callback
+ *
+ * Create a new #MwsConnectionMonitorNmDbus and load the initial set of active
+ * connections from NetworkManager. Object instantiation must be finished by
+ * calling mws_connection_monitor_nm_dbus_new_finish().
+ *
+ * Since: 0.3.0
+ */
+void
+mws_connection_monitor_nm_dbus_new_async (GDBusConnection     *connection,
+                                          GCancellable        *cancellable,
+                                          GAsyncReadyCallback  callback,
+                                          gpointer             user_data)
+{
+  g_return_if_fail (G_IS_DBUS_CONNECTION (connection));
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+  g_async_initable_new_async (MWS_TYPE_CONNECTION_MONITOR_NM_DBUS, G_PRIORITY_DEFAULT,
+                              cancellable, callback, user_data,
+                              "connection", connection,
+                              NULL);
+}
+
+/**
+ * mws_connection_monitor_nm_dbus_new_finish:
+ * @result: asynchronous operation result
+ * @error: return location for a #GError
+ *
+ * Finish initialising a #MwsConnectionMonitorNmDbus. See
+ * mws_connection_monitor_nm_dbus_new_async().
+ *
+ * Returns: (transfer full): initialised #MwsConnectionMonitorNmDbus, or %NULL
+ *    on error
+ * Since: 0.3.0
+ */
+MwsConnectionMonitorNmDbus *
+mws_connection_monitor_nm_dbus_new_finish (GAsyncResult  *result,
+                                           GError       **error)
+{
+  g_return_val_if_fail (G_IS_ASYNC_RESULT (result), NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  g_autoptr(GObject) source_object = g_async_result_get_source_object (result);
+  return MWS_CONNECTION_MONITOR_NM_DBUS (g_async_initable_new_finish (G_ASYNC_INITABLE (source_object),
+                                                                      result, error));
+}
+
+/**
+ * mws_connection_monitor_nm_dbus_get_tariff_parse_time:
+ * @self: a #MwsConnectionMonitorNmDbus
+ *
+ * Get a histogram of how long each parse of a `connection.tariff-bin` or
+ * `connection.tariff` setting has taken. See
+ * mws_connection_monitor_nm_get_tariff_parse_time().
+ *
+ * Returns: (transfer none): histogram of tariff parse durations
+ * Since: 0.3.0
+ */
+const MwsLatencyHistogram *
+mws_connection_monitor_nm_dbus_get_tariff_parse_time (MwsConnectionMonitorNmDbus *self)
+{
+  g_return_val_if_fail (MWS_IS_CONNECTION_MONITOR_NM_DBUS (self), NULL);
+
+  return &self->tariff_parse_time;
+}
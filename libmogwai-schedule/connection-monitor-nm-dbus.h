@@ -0,0 +1,45 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib-object.h>
+#include <libmogwai-schedule/connection-monitor.h>
+#include <libmogwai-schedule/latency-histogram.h>
+
+G_BEGIN_DECLS
+
+#define MWS_TYPE_CONNECTION_MONITOR_NM_DBUS mws_connection_monitor_nm_dbus_get_type ()
+G_DECLARE_FINAL_TYPE (MwsConnectionMonitorNmDbus, mws_connection_monitor_nm_dbus, MWS, CONNECTION_MONITOR_NM_DBUS, GObject)
+
+void                        mws_connection_monitor_nm_dbus_new_async  (GDBusConnection      *connection,
+                                                                       GCancellable         *cancellable,
+                                                                       GAsyncReadyCallback   callback,
+                                                                       gpointer              user_data);
+MwsConnectionMonitorNmDbus *mws_connection_monitor_nm_dbus_new_finish (GAsyncResult         *result,
+                                                                       GError              **error);
+
+const MwsLatencyHistogram *mws_connection_monitor_nm_dbus_get_tariff_parse_time (MwsConnectionMonitorNmDbus *self);
+
+G_END_DECLS
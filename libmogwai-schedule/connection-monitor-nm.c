@@ -28,9 +28,11 @@
 #include <gio/gio.h>
 #include <libmogwai-schedule/connection-monitor.h>
 #include <libmogwai-schedule/connection-monitor-nm.h>
-#include <libmogwai-tariff/tariff-loader.h>
+#include <libmogwai-schedule/tariff-setting.h>
+#include <libmogwai-schedule/worker-pool.h>
 #include <libmogwai-tariff/tariff.h>
 #include <NetworkManager.h>
+#include <string.h>
 
 
 static void mws_connection_monitor_nm_connection_monitor_init (MwsConnectionMonitorInterface *iface);
@@ -115,14 +117,37 @@ static gboolean             mws_connection_monitor_nm_get_connection_details (Mw
  *    may be scheduled on this connection, iff it is not metered. If the
  *    connection is metered, or if this setting is `0`, Mogwai will not schedule
  *    downloads on this connection. (Default: `0`.)
- *  * `connection.tariff-enabled` (boolean): If `1`, the tariff string in
- *    `connection.tariff` is parsed and used (and must be present). If `0`, it
- *    is not. (Default: `0`.)
- *  * `connection.tariff` (string): A serialised tariff (see
- *    mwt_tariff_builder_get_tariff_as_variant()) which specifies how the
+ *  * `connection.tariff-enabled` (boolean): If `1`, the tariff in
+ *    `connection.tariff-bin` or `connection.tariff` is parsed and used (and
+ *    one of them must be present). If `0`, it is not. (Default: `0`.)
+ *  * `connection.tariff-bin` (string): A base64-encoded binary serialised
+ *    tariff (see mwt_tariff_builder_get_tariff_as_bytes(), and
+ *    `mogwai-tariff build --base64`). This is much cheaper to load than
+ *    `connection.tariff`, and takes precedence over it if both are set.
+ *    (Default: unset.)
+ *  * `connection.tariff` (string): A serialised tariff in GVariant text format
+ *    (see mwt_tariff_builder_get_tariff_as_variant()) which specifies how the
  *    connection’s properties change over time (for example, bandwidth limits
  *    at certain times of day, or capacity limits). (Default: unset.)
  *
+ * The parsed tariff for each active connection is cached, keyed by a hash of
+ * the `connection.tariff-bin` or `connection.tariff` string, so it is only
+ * re-parsed when that string changes. Strings longer than
+ * %TARIFF_PARSE_THREAD_THRESHOLD bytes are parsed in a worker thread, so that
+ * a huge tariff doesn’t hold up the main context. Until that finishes, the
+ * connection’s previous tariff is used; or, if it didn’t have one, downloads
+ * are not allowed on the connection, as its limits aren’t known yet.
+ * #MwsConnectionMonitor::connection-details-changed is emitted once the
+ * tariff has been parsed.
+ *
+ * #MwsConnectionMonitor::connection-statistics-changed is emitted using the
+ * `org.freedesktop.NetworkManager.Device.Statistics` interface of each device
+ * belonging to an active connection, summing the `RxBytes` counters of the
+ * devices. NetworkManager only updates those counters if statistics are
+ * enabled on the device, so the monitor asks for a refresh rate of at most
+ * %STATISTICS_REFRESH_RATE_MS. If it isn’t permitted to do so, statistics are
+ * only reported if something else has enabled them.
+ *
  * Since: 0.1.0
  */
 struct _MwsConnectionMonitorNm
@@ -142,8 +167,112 @@ struct _MwsConnectionMonitorNm
   /* This cache should be invalidated whenever
    * nm_client_get_active_connections() is changed. */
   gchar **cached_connection_ids;  /* (owned) (array zero-terminated=1) */
+
+  /* Parsed `connection.tariff-bin` or `connection.tariff` for each active
+   * connection which has one. This
+   * is checked against the current setting string on every lookup, and
+   * entries are removed when their active connection is removed. */
+  GHashTable *cached_tariffs;  /* (owned) (element-type utf8 CachedTariff) */
+
+  /* Statistics for each device which has been added, keyed by the device. The
+   * entry for a device is removed when the device is removed. */
+  GHashTable *device_statistics;  /* (owned) (element-type NMDevice DeviceStatistics) */
+
+  /* How long each tariff parse started by get_cached_tariff() has taken,
+   * including failed ones and ones in worker threads. */
+  MwsLatencyHistogram tariff_parse_time;
 };
 
+/* A parsed `connection.tariff-bin` or `connection.tariff` string, as
+ * indicated by @tariff_is_binary. @tariff is %NULL if the string was invalid,
+ * so that the warning about it is only emitted once. While @parsing is %TRUE,
+ * the string is being parsed in a worker thread, and @tariff is the
+ * connection’s previous tariff (if it had one). */
+typedef struct
+{
+  guint tariff_str_hash;
+  gboolean tariff_is_binary;
+  gboolean parsing;
+  gchar *tariff_str;  /* (owned) (not nullable) */
+  MwtTariff *tariff;  /* (owned) (nullable) */
+} CachedTariff;
+
+static void
+cached_tariff_free (CachedTariff *cached)
+{
+  g_free (cached->tariff_str);
+  g_clear_object (&cached->tariff);
+  g_free (cached);
+}
+
+/* Maximum refresh rate for device statistics to request from NetworkManager,
+ * in milliseconds. This bounds how long it takes to notice that a capacity
+ * limit has been reached. */
+#define STATISTICS_REFRESH_RATE_MS 5000
+
+/* Tariff strings longer than this many bytes are parsed in a worker thread.
+ * Typical tariffs are much shorter than this, and are quicker to parse
+ * synchronously than to pass to another thread. */
+#define TARIFF_PARSE_THREAD_THRESHOLD 4096
+
+#define NM_DBUS_NAME "org.freedesktop.NetworkManager"
+#define NM_DBUS_INTERFACE_STATISTICS "org.freedesktop.NetworkManager.Device.Statistics"
+
+/* Proxy for the statistics interface of a device, and the last `RxBytes` value
+ * seen from it. This is reference counted so that it can outlive removal of
+ * the device while the proxy is still being created; @cancellable is
+ * cancelled when the device is removed. */
+typedef struct
+{
+  gint ref_count;
+  MwsConnectionMonitorNm *connection_monitor;  /* (unowned) (not nullable) */
+  NMDevice *device;  /* (owned) (not nullable) */
+  GDBusProxy *proxy;  /* (owned) (nullable); NULL until created */
+  GCancellable *cancellable;  /* (owned) (not nullable) */
+  guint64 rx_bytes;
+} DeviceStatistics;
+
+static void device_statistics_properties_changed_cb (GDBusProxy *proxy,
+                                                     GVariant   *changed_properties,
+                                                     GStrv       invalidated_properties,
+                                                     gpointer    user_data);
+
+static DeviceStatistics *
+device_statistics_ref (DeviceStatistics *stats)
+{
+  g_atomic_int_inc (&stats->ref_count);
+  return stats;
+}
+
+static void
+device_statistics_unref (DeviceStatistics *stats)
+{
+  if (!g_atomic_int_dec_and_test (&stats->ref_count))
+    return;
+
+  g_clear_object (&stats->proxy);
+  g_clear_object (&stats->cancellable);
+  g_clear_object (&stats->device);
+  g_free (stats);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (DeviceStatistics, device_statistics_unref)
+
+/* Called when @stats is removed from #MwsConnectionMonitorNm.device_statistics,
+ * to stop any further use of its connection monitor pointer. */
+static void
+device_statistics_release (DeviceStatistics *stats)
+{
+  g_cancellable_cancel (stats->cancellable);
+
+  if (stats->proxy != NULL)
+    g_signal_handlers_disconnect_by_func (stats->proxy,
+                                          device_statistics_properties_changed_cb,
+                                          stats);
+
+  device_statistics_unref (stats);
+}
+
 typedef enum
 {
   PROP_CLIENT = 1,
@@ -210,6 +339,12 @@ mws_connection_monitor_nm_init (MwsConnectionMonitorNm *self)
 {
   self->cancellable = g_cancellable_new ();
   self->cached_connection_ids = NULL;
+  self->cached_tariffs = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                g_free,
+                                                (GDestroyNotify) cached_tariff_free);
+  self->device_statistics = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                                   NULL,
+                                                   (GDestroyNotify) device_statistics_release);
 }
 
 /* Utilities for connection and disconnecting signals on various objects. */
@@ -247,6 +382,123 @@ active_connection_disconnect (MwsConnectionMonitorNm *self,
   g_signal_handlers_disconnect_by_func (active_connection, active_connection_notify_cb, self);
 }
 
+/* Emit #MwsConnectionMonitor::connection-statistics-changed for the active
+ * connection which @device belongs to (if any), summing the counters of all
+ * the devices in that connection. */
+static void
+emit_connection_statistics (MwsConnectionMonitorNm *self,
+                            NMDevice               *device)
+{
+  NMActiveConnection *active_connection = nm_device_get_active_connection (device);
+
+  if (active_connection == NULL)
+    return;
+
+  const GPtrArray *devices = nm_active_connection_get_devices (active_connection);
+  guint64 rx_bytes = 0;
+
+  for (gsize i = 0; i < devices->len; i++)
+    {
+      const DeviceStatistics *stats = g_hash_table_lookup (self->device_statistics,
+                                                           g_ptr_array_index (devices, i));
+
+      if (stats != NULL)
+        rx_bytes += stats->rx_bytes;
+    }
+
+  g_signal_emit_by_name (self, "connection-statistics-changed",
+                         nm_active_connection_get_id (active_connection), rx_bytes);
+}
+
+static void
+device_statistics_properties_changed_cb (GDBusProxy *proxy,
+                                         GVariant   *changed_properties,
+                                         GStrv       invalidated_properties,
+                                         gpointer    user_data)
+{
+  DeviceStatistics *stats = user_data;
+  guint64 rx_bytes;
+
+  if (!g_variant_lookup (changed_properties, "RxBytes", "t", &rx_bytes))
+    return;
+
+  stats->rx_bytes = rx_bytes;
+  emit_connection_statistics (stats->connection_monitor, stats->device);
+}
+
+static void
+device_statistics_set_refresh_rate_cb (GObject      *obj,
+                                       GAsyncResult *result,
+                                       gpointer      user_data)
+{
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  reply = g_dbus_proxy_call_finish (G_DBUS_PROXY (obj), result, &local_error);
+
+  /* This will typically fail if polkit doesn’t allow us to enable statistics,
+   * which isn’t fatal: capacity limits just won’t be enforced. */
+  if (local_error != NULL &&
+      !g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    g_debug ("Failed to enable statistics for device ‘%s’: %s",
+             g_dbus_proxy_get_object_path (G_DBUS_PROXY (obj)),
+             local_error->message);
+}
+
+static void
+device_statistics_proxy_new_cb (GObject      *obj,
+                                GAsyncResult *result,
+                                gpointer      user_data)
+{
+  g_autoptr(DeviceStatistics) stats = user_data;
+  g_autoptr(GDBusProxy) proxy = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  proxy = g_dbus_proxy_new_for_bus_finish (result, &local_error);
+
+  if (g_cancellable_is_cancelled (stats->cancellable))
+    return;
+
+  if (local_error != NULL)
+    {
+      g_debug ("Failed to get statistics for device ‘%s’: %s",
+               nm_device_get_iface (stats->device), local_error->message);
+      return;
+    }
+
+  stats->proxy = g_steal_pointer (&proxy);
+  g_signal_connect (stats->proxy, "g-properties-changed",
+                    (GCallback) device_statistics_properties_changed_cb, stats);
+
+  /* Make sure NetworkManager updates the counters often enough. A refresh
+   * rate of 0 means statistics are disabled. */
+  g_autoptr(GVariant) refresh_rate_variant = NULL;
+  refresh_rate_variant = g_dbus_proxy_get_cached_property (stats->proxy, "RefreshRateMs");
+  guint32 refresh_rate_ms = 0;
+
+  if (refresh_rate_variant != NULL &&
+      g_variant_is_of_type (refresh_rate_variant, G_VARIANT_TYPE_UINT32))
+    refresh_rate_ms = g_variant_get_uint32 (refresh_rate_variant);
+
+  if (refresh_rate_ms == 0 || refresh_rate_ms > STATISTICS_REFRESH_RATE_MS)
+    g_dbus_proxy_call (stats->proxy, "org.freedesktop.DBus.Properties.Set",
+                       g_variant_new ("(ssv)", NM_DBUS_INTERFACE_STATISTICS,
+                                      "RefreshRateMs",
+                                      g_variant_new_uint32 (STATISTICS_REFRESH_RATE_MS)),
+                       G_DBUS_CALL_FLAGS_NONE, -1, stats->cancellable,
+                       device_statistics_set_refresh_rate_cb, NULL);
+
+  g_autoptr(GVariant) rx_bytes_variant = NULL;
+  rx_bytes_variant = g_dbus_proxy_get_cached_property (stats->proxy, "RxBytes");
+
+  if (rx_bytes_variant != NULL &&
+      g_variant_is_of_type (rx_bytes_variant, G_VARIANT_TYPE_UINT64))
+    {
+      stats->rx_bytes = g_variant_get_uint64 (rx_bytes_variant);
+      emit_connection_statistics (stats->connection_monitor, stats->device);
+    }
+}
+
 static void
 device_connect (MwsConnectionMonitorNm *self,
                 NMDevice               *device)
@@ -254,6 +506,27 @@ device_connect (MwsConnectionMonitorNm *self,
   g_signal_connect (device, "state-changed",
                     (GCallback) device_state_changed_cb, self);
   g_signal_connect (device, "notify", (GCallback) device_notify_cb, self);
+
+  /* Start watching the device’s statistics. libnm doesn’t expose them, so
+   * this uses its own proxy. */
+  g_autoptr(DeviceStatistics) stats = g_new0 (DeviceStatistics, 1);
+  stats->ref_count = 1;
+  stats->connection_monitor = self;
+  stats->device = g_object_ref (device);
+  stats->cancellable = g_cancellable_new ();
+
+  g_dbus_proxy_new_for_bus (G_BUS_TYPE_SYSTEM,
+                            G_DBUS_PROXY_FLAGS_DO_NOT_CONNECT_SIGNALS |
+                            G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
+                            NULL  /* interface info */,
+                            NM_DBUS_NAME,
+                            nm_object_get_path (NM_OBJECT (device)),
+                            NM_DBUS_INTERFACE_STATISTICS,
+                            stats->cancellable,
+                            device_statistics_proxy_new_cb,
+                            device_statistics_ref (stats));
+
+  g_hash_table_replace (self->device_statistics, device, g_steal_pointer (&stats));
 }
 
 static void
@@ -262,6 +535,8 @@ device_disconnect (MwsConnectionMonitorNm *self,
 {
   g_signal_handlers_disconnect_by_func (device, device_state_changed_cb, self);
   g_signal_handlers_disconnect_by_func (device, device_notify_cb, self);
+
+  g_hash_table_remove (self->device_statistics, device);
 }
 
 /* Closure for the #NMSettingConnection::notify signal callback. */
@@ -357,6 +632,8 @@ mws_connection_monitor_nm_dispose (GObject *object)
   g_clear_error (&self->init_error);
 
   g_clear_pointer (&self->cached_connection_ids, g_strfreev);
+  g_clear_pointer (&self->cached_tariffs, g_hash_table_unref);
+  g_clear_pointer (&self->device_statistics, g_hash_table_unref);
 
   /* Chain up to the parent class */
   G_OBJECT_CLASS (mws_connection_monitor_nm_parent_class)->dispose (object);
@@ -596,6 +873,180 @@ setting_user_get_boolean (NMSettingUser *setting_user,
   return default_value;
 }
 
+/* Store the result of parsing the string in @cached, which is @tariff, or
+ * %NULL if @error is set. */
+static void
+cached_tariff_set_result (CachedTariff *cached,
+                          MwtTariff    *tariff,
+                          const GError *error)
+{
+  if (error != NULL)
+    {
+      g_assert (tariff == NULL);
+      g_warning ("%s contained an invalid tariff ‘%s’: %s",
+                 cached->tariff_is_binary ? "connection.tariff-bin" : "connection.tariff",
+                 cached->tariff_str, error->message);
+    }
+
+  g_set_object (&cached->tariff, tariff);
+  cached->parsing = FALSE;
+}
+
+/* Task data for parse_tariff_thread_cb(). */
+typedef struct
+{
+  gchar *id;  /* (owned) */
+  gchar *tariff_str;  /* (owned) */
+  gboolean tariff_is_binary;
+  GTimeSpan parse_time;  /* set by parse_tariff_thread_cb() */
+} ParseTariffData;
+
+static void
+parse_tariff_data_free (ParseTariffData *data)
+{
+  g_free (data->id);
+  g_free (data->tariff_str);
+  g_free (data);
+}
+
+static void
+parse_tariff_thread_cb (GTask        *task,
+                        gpointer      source_object,
+                        gpointer      task_data,
+                        GCancellable *cancellable)
+{
+  ParseTariffData *data = task_data;
+  g_autoptr(GError) local_error = NULL;
+  gint64 parse_start_usec = g_get_monotonic_time ();
+
+  g_autoptr(MwtTariff) tariff = mws_tariff_setting_parse (data->tariff_str,
+                                                          data->tariff_is_binary,
+                                                          &local_error);
+  data->parse_time = g_get_monotonic_time () - parse_start_usec;
+
+  if (tariff != NULL)
+    g_task_return_pointer (task, g_steal_pointer (&tariff), g_object_unref);
+  else
+    g_task_return_error (task, g_steal_pointer (&local_error));
+}
+
+static void
+parse_tariff_cb (GObject      *obj,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  MwsConnectionMonitorNm *self = MWS_CONNECTION_MONITOR_NM (obj);
+  ParseTariffData *data = g_task_get_task_data (G_TASK (result));
+  g_autoptr(GError) local_error = NULL;
+
+  g_autoptr(MwtTariff) tariff = g_task_propagate_pointer (G_TASK (result),
+                                                          &local_error);
+
+  /* The monitor may have been disposed in the meantime. */
+  if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    return;
+
+  mws_latency_histogram_record (&self->tariff_parse_time, data->parse_time);
+
+  /* The setting may have changed again, or the connection may have been
+   * removed, while the tariff was being parsed. */
+  CachedTariff *cached = g_hash_table_lookup (self->cached_tariffs, data->id);
+
+  if (cached == NULL || !cached->parsing ||
+      cached->tariff_is_binary != data->tariff_is_binary ||
+      !g_str_equal (cached->tariff_str, data->tariff_str))
+    {
+      g_debug ("%s: Discarding outdated tariff for connection ‘%s’.",
+               G_STRFUNC, data->id);
+      return;
+    }
+
+  g_debug ("%s: Finished parsing tariff for connection ‘%s’.",
+           G_STRFUNC, data->id);
+  cached_tariff_set_result (cached, tariff, local_error);
+
+  g_signal_emit_by_name (self, "connection-details-changed", data->id);
+}
+
+/* Get the parsed form of @tariff_str, the `connection.tariff-bin` (if
+ * @tariff_is_binary is %TRUE) or `connection.tariff` setting for the
+ * connection with @id. The result is cached, and @tariff_str is only parsed
+ * if it has changed since the last call for @id. Returns %NULL (and warns
+ * once) if @tariff_str is invalid.
+ *
+ * If @tariff_str is longer than %TARIFF_PARSE_THREAD_THRESHOLD, it is parsed
+ * in a worker thread, and the connection’s previous tariff is returned until
+ * that finishes. If there is no previous tariff, %NULL is returned and
+ * @out_pending is set to %TRUE. */
+static MwtTariff *
+get_cached_tariff (MwsConnectionMonitorNm *self,
+                   const gchar            *id,
+                   const gchar            *tariff_str,
+                   gboolean                tariff_is_binary,
+                   gboolean               *out_pending)
+{
+  const gchar *key = tariff_is_binary ? "connection.tariff-bin" : "connection.tariff";
+  guint tariff_str_hash = g_str_hash (tariff_str);
+  CachedTariff *cached = g_hash_table_lookup (self->cached_tariffs, id);
+
+  if (cached != NULL &&
+      cached->tariff_str_hash == tariff_str_hash &&
+      cached->tariff_is_binary == tariff_is_binary &&
+      g_str_equal (cached->tariff_str, tariff_str))
+    {
+      *out_pending = (cached->parsing && cached->tariff == NULL);
+      return (cached->tariff != NULL) ? g_object_ref (cached->tariff) : NULL;
+    }
+
+  CachedTariff *new_cached = g_new0 (CachedTariff, 1);
+  new_cached->tariff_str_hash = tariff_str_hash;
+  new_cached->tariff_is_binary = tariff_is_binary;
+  new_cached->tariff_str = g_strdup (tariff_str);
+
+  if (strlen (tariff_str) > TARIFF_PARSE_THREAD_THRESHOLD)
+    {
+      g_debug ("%s: Parsing tariff from %s for connection ‘%s’ in a worker thread.",
+               G_STRFUNC, key, id);
+
+      /* Keep using the previous tariff until this one is ready. */
+      new_cached->parsing = TRUE;
+      if (cached != NULL && cached->tariff != NULL)
+        new_cached->tariff = g_object_ref (cached->tariff);
+
+      ParseTariffData *data = g_new0 (ParseTariffData, 1);
+      data->id = g_strdup (id);
+      data->tariff_str = g_strdup (tariff_str);
+      data->tariff_is_binary = tariff_is_binary;
+
+      g_autoptr(GTask) task = g_task_new (self, self->cancellable,
+                                          parse_tariff_cb, NULL);
+      g_task_set_source_tag (task, get_cached_tariff);
+      g_task_set_task_data (task, data, (GDestroyNotify) parse_tariff_data_free);
+      mws_worker_pool_run_task (task, parse_tariff_thread_cb);
+    }
+  else
+    {
+      g_debug ("%s: Parsing tariff from %s for connection ‘%s’.",
+               G_STRFUNC, key, id);
+
+      g_autoptr(GError) local_error = NULL;
+      gint64 parse_start_usec = g_get_monotonic_time ();
+      g_autoptr(MwtTariff) tariff = mws_tariff_setting_parse (tariff_str,
+                                                              tariff_is_binary,
+                                                              &local_error);
+
+      mws_latency_histogram_record (&self->tariff_parse_time,
+                                    g_get_monotonic_time () - parse_start_usec);
+      cached_tariff_set_result (new_cached, tariff, local_error);
+    }
+
+  /* This may free @cached. */
+  g_hash_table_replace (self->cached_tariffs, g_strdup (id), new_cached);
+
+  *out_pending = (new_cached->parsing && new_cached->tariff == NULL);
+  return (new_cached->tariff != NULL) ? g_object_ref (new_cached->tariff) : NULL;
+}
+
 static gboolean
 mws_connection_monitor_nm_get_connection_details (MwsConnectionMonitor *monitor,
                                                   const gchar          *id,
@@ -679,7 +1130,9 @@ mws_connection_monitor_nm_get_connection_details (MwsConnectionMonitor *monitor,
       gboolean tariff_enabled = setting_user_get_boolean (setting_user,
                                                           "connection.tariff-enabled",
                                                           FALSE);
-      const gchar *tariff_variant_str;
+      const gchar *tariff_bin_str, *tariff_variant_str;
+      tariff_bin_str = nm_setting_user_get_data (setting_user,
+                                                 "connection.tariff-bin");
       tariff_variant_str = nm_setting_user_get_data (setting_user,
                                                      "connection.tariff");
 
@@ -687,36 +1140,37 @@ mws_connection_monitor_nm_get_connection_details (MwsConnectionMonitor *monitor,
                " • connection.allow-downloads-when-metered: %s\n"
                " • connection.allow-downloads: %s\n"
                " • connection.tariff-enabled: %s\n"
+               " • connection.tariff-bin: %s\n"
                " • connection.tariff: %s",
                G_STRFUNC, id, allow_downloads_when_metered ? "yes" : "no",
                allow_downloads ? "yes" : "no", tariff_enabled ? "yes" : "no",
-               tariff_variant_str);
+               tariff_bin_str, tariff_variant_str);
+
+      /* Prefer the binary form, since it’s much cheaper to load. */
+      gboolean tariff_pending = FALSE;
 
-      if (tariff_enabled && tariff_variant_str != NULL)
+      if (tariff_enabled && tariff_bin_str != NULL)
+        {
+          tariff = get_cached_tariff (self, id, tariff_bin_str, TRUE,
+                                      &tariff_pending);
+        }
+      else if (tariff_enabled && tariff_variant_str != NULL)
+        {
+          tariff = get_cached_tariff (self, id, tariff_variant_str, FALSE,
+                                      &tariff_pending);
+        }
+      else if (tariff_enabled)
         {
-          g_autoptr(GError) local_error = NULL;
-          g_autoptr(GVariant) tariff_variant = NULL;
-          tariff_variant = g_variant_parse (NULL, tariff_variant_str,
-                                            NULL, NULL, &local_error);
-          g_autoptr(MwtTariffLoader) loader = mwt_tariff_loader_new ();
-
-          if (tariff_variant != NULL &&
-              mwt_tariff_loader_load_from_variant (loader, tariff_variant,
-                                                   &local_error))
-            tariff = g_object_ref (mwt_tariff_loader_get_tariff (loader));
-
-          if (local_error != NULL)
-            {
-              g_assert (tariff == NULL);
-              g_warning ("connection.tariff contained an invalid tariff ‘%s’: %s",
-                         tariff_variant_str, local_error->message);
-              g_clear_error (&local_error);
-            }
+          g_warning ("Neither connection.tariff-bin nor connection.tariff is "
+                     "set even though connection.tariff-enabled is 1");
         }
-      else if (tariff_enabled && tariff_variant_str == NULL)
+
+      /* Don’t download on the connection until its limits are known. */
+      if (tariff_pending)
         {
-          g_warning ("connection.tariff is not set even though "
-                     "connection.tariff-enabled is 1");
+          g_debug ("%s: Tariff for connection ‘%s’ is still being parsed; "
+                   "not allowing downloads until it’s ready.", G_STRFUNC, id);
+          allow_downloads = FALSE;
         }
     }
 
@@ -766,6 +1220,7 @@ active_connection_removed_cb (NMClient           *client,
   g_debug ("%s: Removing active connection ‘%s’.", G_STRFUNC, id);
 
   g_clear_pointer (&self->cached_connection_ids, g_strfreev);
+  g_hash_table_remove (self->cached_tariffs, id);
   active_connection_disconnect (self, active_connection);
 
   g_autoptr(GPtrArray) removed = g_ptr_array_new_with_free_func (NULL);
@@ -977,3 +1432,22 @@ mws_connection_monitor_nm_new_finish (GAsyncResult  *result,
   return MWS_CONNECTION_MONITOR_NM (g_async_initable_new_finish (G_ASYNC_INITABLE (source_object),
                                                                  result, error));
 }
+
+/**
+ * mws_connection_monitor_nm_get_tariff_parse_time:
+ * @self: a #MwsConnectionMonitorNm
+ *
+ * Get a histogram of how long each parse of a `connection.tariff-bin` or
+ * `connection.tariff` setting has taken. Settings are only parsed when they
+ * change, so this doesn’t include cache hits.
+ *
+ * Returns: (transfer none): histogram of tariff parse durations
+ * Since: 0.3.0
+ */
+const MwsLatencyHistogram *
+mws_connection_monitor_nm_get_tariff_parse_time (MwsConnectionMonitorNm *self)
+{
+  g_return_val_if_fail (MWS_IS_CONNECTION_MONITOR_NM (self), NULL);
+
+  return &self->tariff_parse_time;
+}
@@ -25,6 +25,7 @@
 #include <glib.h>
 #include <glib-object.h>
 #include <libmogwai-schedule/connection-monitor.h>
+#include <libmogwai-schedule/latency-histogram.h>
 #include <NetworkManager.h>
 
 G_BEGIN_DECLS
@@ -40,4 +41,6 @@ void                    mws_connection_monitor_nm_new_async       (GCancellable
 MwsConnectionMonitorNm *mws_connection_monitor_nm_new_finish      (GAsyncResult         *result,
                                                                    GError              **error);
 
+const MwsLatencyHistogram *mws_connection_monitor_nm_get_tariff_parse_time (MwsConnectionMonitorNm *self);
+
 G_END_DECLS
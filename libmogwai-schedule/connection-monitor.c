@@ -184,6 +184,31 @@ mws_connection_monitor_default_init (MwsConnectionMonitorInterface *iface)
                 0, NULL, NULL, NULL,
                 G_TYPE_NONE, 1,
                 G_TYPE_STRING);
+
+  /**
+   * MwsConnectionMonitor::connection-statistics-changed:
+   * @self: a #MwsConnectionMonitor
+   * @connection_id: ID of the connection whose statistics have changed
+   * @rx_bytes: total number of bytes received over the connection so far
+   *
+   * Emitted periodically while a connection is active, to report how much data
+   * has been received over it. @rx_bytes is a running counter, so subscribers
+   * must work out how much has been received since the previous emission
+   * themselves. The counter normally only increases, but may go backwards if
+   * the underlying network devices are reset or change; subscribers should
+   * treat that as a new starting point for the counter.
+   *
+   * Implementations which cannot provide statistics never emit this signal.
+   * The rate at which it is emitted is implementation defined.
+   *
+   * Since: 0.3.0
+   */
+  g_signal_new ("connection-statistics-changed", G_TYPE_FROM_INTERFACE (iface),
+                G_SIGNAL_RUN_LAST,
+                0, NULL, NULL, NULL,
+                G_TYPE_NONE, 2,
+                G_TYPE_STRING,
+                G_TYPE_UINT64);
 }
 
 /**
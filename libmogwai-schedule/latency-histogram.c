@@ -0,0 +1,85 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <libmogwai-schedule/latency-histogram.h>
+
+
+/**
+ * mws_latency_histogram_record:
+ * @self: a #MwsLatencyHistogram
+ * @duration_usec: duration to record, in microseconds; negative durations are
+ *    treated as zero
+ *
+ * Add @duration_usec to the histogram.
+ *
+ * Since: 0.3.0
+ */
+void
+mws_latency_histogram_record (MwsLatencyHistogram *self,
+                              GTimeSpan            duration_usec)
+{
+  g_return_if_fail (self != NULL);
+
+  guint64 duration = (duration_usec > 0) ? (guint64) duration_usec : 0;
+
+  /* Clamp before calling g_bit_storage(), as #gulong may be 32 bits. */
+  guint64 clamped = MIN (duration, G_GUINT64_CONSTANT (1) << (MWS_LATENCY_HISTOGRAM_N_BUCKETS - 1));
+  guint bucket = (clamped > 0) ? g_bit_storage ((gulong) clamped) : 0;
+
+  self->n_samples++;
+  self->total_usec += duration;
+  self->max_usec = MAX (self->max_usec, duration);
+  self->buckets[MIN (bucket, MWS_LATENCY_HISTOGRAM_N_BUCKETS - 1)]++;
+}
+
+/**
+ * mws_latency_histogram_to_variant:
+ * @self: a #MwsLatencyHistogram
+ *
+ * Serialise the histogram as an `a{sv}` for exposing over D-Bus. It contains
+ * `Count`, `TotalMicroseconds` and `MaxMicroseconds` (all `t`), and `Buckets`
+ * (`at`) with one element per bucket, as described in #MwsLatencyHistogram.
+ *
+ * Returns: (transfer floating): the histogram as an `a{sv}`
+ * Since: 0.3.0
+ */
+GVariant *
+mws_latency_histogram_to_variant (const MwsLatencyHistogram *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_auto(GVariantDict) dict = G_VARIANT_DICT_INIT (NULL);
+
+  g_variant_dict_insert (&dict, "Count", "t", self->n_samples);
+  g_variant_dict_insert (&dict, "TotalMicroseconds", "t", self->total_usec);
+  g_variant_dict_insert (&dict, "MaxMicroseconds", "t", self->max_usec);
+  g_variant_dict_insert_value (&dict, "Buckets",
+                               g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64,
+                                                          self->buckets,
+                                                          G_N_ELEMENTS (self->buckets),
+                                                          sizeof (self->buckets[0])));
+
+  return g_variant_dict_end (&dict);
+}
@@ -0,0 +1,65 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * MWS_LATENCY_HISTOGRAM_N_BUCKETS:
+ *
+ * Number of buckets in a #MwsLatencyHistogram.
+ *
+ * Since: 0.3.0
+ */
+#define MWS_LATENCY_HISTOGRAM_N_BUCKETS 24
+
+/**
+ * MwsLatencyHistogram:
+ * @n_samples: number of durations recorded
+ * @total_usec: sum of all the durations recorded, in microseconds
+ * @max_usec: longest duration recorded, in microseconds
+ * @buckets: number of durations recorded in each bucket: bucket 0 counts
+ *    durations under 1µs, bucket `i` counts durations in the range
+ *    [2^(i-1), 2^i)µs, and the last bucket also counts all longer durations
+ *
+ * A fixed-size summary of a series of durations, with logarithmically sized
+ * buckets so recording a duration is cheap enough to do on every call of a hot
+ * path. A zero-initialised #MwsLatencyHistogram is empty.
+ *
+ * Since: 0.3.0
+ */
+typedef struct
+{
+  guint64 n_samples;
+  guint64 total_usec;
+  guint64 max_usec;
+  guint64 buckets[MWS_LATENCY_HISTOGRAM_N_BUCKETS];
+} MwsLatencyHistogram;
+
+void      mws_latency_histogram_record     (MwsLatencyHistogram       *self,
+                                            GTimeSpan                  duration_usec);
+GVariant *mws_latency_histogram_to_variant (const MwsLatencyHistogram *self);
+
+G_END_DECLS
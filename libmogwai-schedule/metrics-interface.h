@@ -0,0 +1,81 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Declaration of the com.endlessm.DownloadManager1.Metrics D-Bus interface.
+ *
+ * This is implemented on the same object as
+ * com.endlessm.DownloadManager1.Scheduler, and exposes performance counters for
+ * the daemon. The counters are only returned on request, rather than as
+ * properties, so that updating them never causes any D-Bus traffic.
+ *
+ * FIXME: Ideally, there would be a gdbus-codegen mode to generate just this
+ * interface info, because writing it out in C is horrific.
+ * See: https://bugzilla.gnome.org/show_bug.cgi?id=795304
+ */
+
+static const GDBusArgInfo metrics_interface_get_metrics_arg_metrics =
+{
+  -1,  /* ref count */
+  (gchar *) "metrics",
+  (gchar *) "a{sv}",
+  NULL
+};
+
+static const GDBusArgInfo *metrics_interface_get_metrics_out_args[] =
+{
+  &metrics_interface_get_metrics_arg_metrics,
+  NULL,
+};
+static const GDBusMethodInfo metrics_interface_get_metrics =
+{
+  -1,  /* ref count */
+  (gchar *) "GetMetrics",
+  NULL,  /* in args */
+  (GDBusArgInfo **) metrics_interface_get_metrics_out_args,
+  NULL,  /* annotations */
+};
+
+static const GDBusMethodInfo *metrics_interface_methods[] =
+{
+  &metrics_interface_get_metrics,
+  NULL,
+};
+
+static const GDBusInterfaceInfo metrics_interface =
+{
+  -1,  /* ref count */
+  (gchar *) "com.endlessm.DownloadManager1.Metrics",
+  (GDBusMethodInfo **) metrics_interface_methods,
+  NULL,  /* no signals */
+  NULL,  /* no properties */
+  NULL,  /* no annotations */
+};
+
+G_END_DECLS
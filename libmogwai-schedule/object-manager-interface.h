@@ -0,0 +1,157 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Declaration of the org.freedesktop.DBus.ObjectManager D-Bus interface.
+ *
+ * This is implemented on the same object as
+ * com.endlessm.DownloadManager1.Scheduler, so that all the schedule entries
+ * visible to a peer, and their properties, can be listed in a single call.
+ * Peers only see the entries they own, unless they have called Monitor() and
+ * been authorised for it by polkit, in which case they see all entries.
+ *
+ * Unlike on most object managers, the InterfacesAdded and InterfacesRemoved
+ * signals are not broadcast: they are unicast to the owner of the entry, and
+ * to authorised monitors. A peer which wants to track other peers’ entries
+ * must call Monitor() before GetManagedObjects().
+ *
+ * See:
+ * https://dbus.freedesktop.org/doc/dbus-specification.html#standard-interfaces-objectmanager
+ *
+ * FIXME: Ideally, there would be a gdbus-codegen mode to generate just this
+ * interface info, because writing it out in C is horrific.
+ * See: https://bugzilla.gnome.org/show_bug.cgi?id=795304
+ */
+
+static const GDBusArgInfo object_manager_interface_get_managed_objects_arg_objects =
+{
+  -1,  /* ref count */
+  (gchar *) "objects",
+  (gchar *) "a{oa{sa{sv}}}",
+  NULL
+};
+
+static const GDBusArgInfo *object_manager_interface_get_managed_objects_out_args[] =
+{
+  &object_manager_interface_get_managed_objects_arg_objects,
+  NULL,
+};
+static const GDBusMethodInfo object_manager_interface_get_managed_objects =
+{
+  -1,  /* ref count */
+  (gchar *) "GetManagedObjects",
+  NULL,  /* in args */
+  (GDBusArgInfo **) object_manager_interface_get_managed_objects_out_args,
+  NULL,  /* annotations */
+};
+
+static const GDBusMethodInfo *object_manager_interface_methods[] =
+{
+  &object_manager_interface_get_managed_objects,
+  NULL,
+};
+
+static const GDBusArgInfo object_manager_interface_interfaces_added_arg_object =
+{
+  -1,  /* ref count */
+  (gchar *) "object",
+  (gchar *) "o",
+  NULL
+};
+
+static const GDBusArgInfo object_manager_interface_interfaces_added_arg_interfaces =
+{
+  -1,  /* ref count */
+  (gchar *) "interfaces",
+  (gchar *) "a{sa{sv}}",
+  NULL
+};
+
+static const GDBusArgInfo *object_manager_interface_interfaces_added_args[] =
+{
+  &object_manager_interface_interfaces_added_arg_object,
+  &object_manager_interface_interfaces_added_arg_interfaces,
+  NULL,
+};
+static const GDBusSignalInfo object_manager_interface_interfaces_added =
+{
+  -1,  /* ref count */
+  (gchar *) "InterfacesAdded",
+  (GDBusArgInfo **) object_manager_interface_interfaces_added_args,
+  NULL,  /* annotations */
+};
+
+static const GDBusArgInfo object_manager_interface_interfaces_removed_arg_object =
+{
+  -1,  /* ref count */
+  (gchar *) "object",
+  (gchar *) "o",
+  NULL
+};
+
+static const GDBusArgInfo object_manager_interface_interfaces_removed_arg_interfaces =
+{
+  -1,  /* ref count */
+  (gchar *) "interfaces",
+  (gchar *) "as",
+  NULL
+};
+
+static const GDBusArgInfo *object_manager_interface_interfaces_removed_args[] =
+{
+  &object_manager_interface_interfaces_removed_arg_object,
+  &object_manager_interface_interfaces_removed_arg_interfaces,
+  NULL,
+};
+static const GDBusSignalInfo object_manager_interface_interfaces_removed =
+{
+  -1,  /* ref count */
+  (gchar *) "InterfacesRemoved",
+  (GDBusArgInfo **) object_manager_interface_interfaces_removed_args,
+  NULL,  /* annotations */
+};
+
+static const GDBusSignalInfo *object_manager_interface_signals[] =
+{
+  &object_manager_interface_interfaces_added,
+  &object_manager_interface_interfaces_removed,
+  NULL,
+};
+
+static const GDBusInterfaceInfo object_manager_interface =
+{
+  -1,  /* ref count */
+  (gchar *) "org.freedesktop.DBus.ObjectManager",
+  (GDBusMethodInfo **) object_manager_interface_methods,
+  (GDBusSignalInfo **) object_manager_interface_signals,
+  NULL,  /* no properties */
+  NULL,  /* no annotations */
+};
+
+G_END_DECLS
@@ -26,14 +26,20 @@
 #include <glib-object.h>
 #include <glib/gi18n-lib.h>
 #include <gio/gio.h>
+#include <gio/gunixfdlist.h>
 #include <libmogwai-schedule/peer-manager.h>
 #include <libmogwai-schedule/peer-manager-dbus.h>
+#include <libmogwai-schedule/peer-priorities.h>
 #include <libmogwai-schedule/scheduler.h>
+#include <libmogwai-schedule/worker-pool.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 
 static void mws_peer_manager_dbus_peer_manager_init (MwsPeerManagerInterface *iface);
 static void mws_peer_manager_dbus_dispose           (GObject                 *object);
+static void mws_peer_manager_dbus_finalize          (GObject                 *object);
 
 static void mws_peer_manager_dbus_get_property (GObject      *object,
                                                 guint         property_id,
@@ -54,6 +60,8 @@ static gchar       *mws_peer_manager_dbus_ensure_peer_credentials_finish (MwsPee
                                                                           GError              **error);
 static const gchar *mws_peer_manager_dbus_get_peer_credentials           (MwsPeerManager       *manager,
                                                                           const gchar          *sender);
+static gint         mws_peer_manager_dbus_get_peer_priority              (MwsPeerManager       *manager,
+                                                                          const gchar          *sender);
 
 /**
  * MwsPeerManagerDBus:
@@ -64,13 +72,30 @@ static const gchar *mws_peer_manager_dbus_get_peer_credentials           (MwsPee
  * easier unit testing of anything which uses it.
  *
  * The credentials of a peer are retrieved from the D-Bus daemon using
- * [`GetConnectionCredentials`](https://dbus.freedesktop.org/doc/dbus-specification.html#bus-messages-get-connection-credentials),
- * and reading `/proc/$pid/cmdline` to get the absolute path to the executable
- * for each peer, which we use as an identifier for it. This is not atomic or
- * particularly trusted, as PIDs can be reused in the time it takes us to query
- * the information, and processes can modify their own cmdline file, but
- * without an LSM enabled in the kernel and dbus-daemon, it’s the best we can do
- * for identifying processes.
+ * [`GetConnectionCredentials`](https://dbus.freedesktop.org/doc/dbus-specification.html#bus-messages-get-connection-credentials).
+ * The absolute path to the executable for each peer is used as an identifier
+ * for it. If the D-Bus daemon provides a `ProcessFD` (a pidfd for the peer),
+ * that is used to find the peer’s process ID without races against PID reuse;
+ * otherwise the `ProcessID` is used. The executable path is read from
+ * `/proc/$pid/exe` where we have permission to do so, falling back to parsing
+ * `/proc/$pid/cmdline`. The cmdline fallback is not particularly trusted, as
+ * processes can modify their own cmdline file, but without an LSM enabled in
+ * the kernel and dbus-daemon, it’s the best we can do for identifying
+ * processes.
+ *
+ * Executable paths are cached by process ID and process start time, so each
+ * process is only examined once, however many connections it makes to the bus.
+ * Examining a process reads from `/proc`, which can block, so it is done in a
+ * worker thread (see mws_worker_pool_run_task()) to avoid delaying other
+ * D-Bus method calls.
+ *
+ * Each peer’s scheduling priority is looked up in
+ * #MwsPeerManagerDBus:priorities once, when its credentials are cached.
+ *
+ * Credentials are cached until the peer disappears from the bus, so each peer
+ * is only queried once. If several queries for the same peer are started
+ * before the first completes, they are merged and share the result of a single
+ * query to the D-Bus daemon.
  *
  * Since: 0.1.0
  */
@@ -83,15 +108,56 @@ struct _MwsPeerManagerDBus
   /* Hold the watch IDs of all peers who have added entries at some point. */
   GPtrArray *peer_watch_ids;  /* (owned) */
 
-  /* Cache of peer credentials (currently only the executable path of each peer). */
-  GHashTable *peer_credentials;  /* (owned) (element-type utf8 filename) */
+  /* Cache of peer credentials: the executable path of each peer, and the
+   * priority calculated from it using @priorities. */
+  GHashTable *peer_credentials;  /* (owned) (element-type utf8 PeerData) */
+  GHashTable *priorities;  /* (owned) (element-type filename gint) */
+
+  /* Queries for peer credentials which are currently in progress, mapping from
+   * the peer’s unique name to the tasks waiting for the result. */
+  GHashTable *pending_queries;  /* (owned) (element-type utf8 GPtrArray<GTask>) */
+
+  /* Cache of executable paths for processes, keyed by a process key (see
+   * process_key_new()), so that a PID which is reused by a later process
+   * doesn’t match. @peer_process_keys maps from a peer’s unique name to the
+   * key for its process, so the cache entry can be dropped when the peer
+   * vanishes. @process_paths is accessed from the worker threads which
+   * examine processes, so must only be accessed with @process_paths_lock
+   * held. */
+  GHashTable *process_paths;  /* (owned) (element-type utf8 filename) */
+  GMutex process_paths_lock;
+  GHashTable *peer_process_keys;  /* (owned) (element-type utf8 utf8) */
 };
 
 typedef enum
 {
   PROP_CONNECTION = 1,
+  PROP_PRIORITIES,
 } MwsPeerManagerDBusProperty;
 
+typedef struct
+{
+  gchar *path;  /* (owned) */
+  gint priority;
+} PeerData;
+
+static PeerData *
+peer_data_new (const gchar *path,
+               gint         priority)
+{
+  PeerData *data = g_new0 (PeerData, 1);
+  data->path = g_strdup (path);
+  data->priority = priority;
+  return data;
+}
+
+static void
+peer_data_free (PeerData *data)
+{
+  g_free (data->path);
+  g_free (data);
+}
+
 G_DEFINE_TYPE_WITH_CODE (MwsPeerManagerDBus, mws_peer_manager_dbus, G_TYPE_OBJECT,
                          G_IMPLEMENT_INTERFACE (MWS_TYPE_PEER_MANAGER,
                                                 mws_peer_manager_dbus_peer_manager_init))
@@ -99,9 +165,10 @@ static void
 mws_peer_manager_dbus_class_init (MwsPeerManagerDBusClass *klass)
 {
   GObjectClass *object_class = (GObjectClass *) klass;
-  GParamSpec *props[PROP_CONNECTION + 1] = { NULL, };
+  GParamSpec *props[PROP_PRIORITIES + 1] = { NULL, };
 
   object_class->dispose = mws_peer_manager_dbus_dispose;
+  object_class->finalize = mws_peer_manager_dbus_finalize;
   object_class->get_property = mws_peer_manager_dbus_get_property;
   object_class->set_property = mws_peer_manager_dbus_set_property;
 
@@ -118,6 +185,22 @@ mws_peer_manager_dbus_class_init (MwsPeerManagerDBusClass *klass)
                            G_TYPE_DBUS_CONNECTION,
                            G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
 
+  /**
+   * MwsPeerManagerDBus:priorities: (element-type filename gint)
+   *
+   * Map from the absolute paths of peer executables to their scheduling
+   * priorities. See mws_peer_priorities_lookup(). If this is not set, the
+   * defaults from mws_peer_priorities_new_default() are used.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_PRIORITIES] =
+      g_param_spec_boxed ("priorities", "Priorities",
+                          "Map from the absolute paths of peer executables to "
+                          "their scheduling priorities.",
+                          G_TYPE_HASH_TABLE,
+                          G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (object_class, G_N_ELEMENTS (props), props);
 }
 
@@ -127,6 +210,7 @@ mws_peer_manager_dbus_peer_manager_init (MwsPeerManagerInterface *iface)
   iface->ensure_peer_credentials_async = mws_peer_manager_dbus_ensure_peer_credentials_async;
   iface->ensure_peer_credentials_finish = mws_peer_manager_dbus_ensure_peer_credentials_finish;
   iface->get_peer_credentials = mws_peer_manager_dbus_get_peer_credentials;
+  iface->get_peer_priority = mws_peer_manager_dbus_get_peer_priority;
 }
 
 static void
@@ -140,7 +224,14 @@ mws_peer_manager_dbus_init (MwsPeerManagerDBus *self)
 {
   self->peer_watch_ids = g_ptr_array_new_with_free_func (watcher_id_free);
   self->peer_credentials = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                  g_free, g_free);
+                                                  g_free, (GDestroyNotify) peer_data_free);
+  self->pending_queries = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                 g_free, (GDestroyNotify) g_ptr_array_unref);
+  self->process_paths = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               g_free, g_free);
+  g_mutex_init (&self->process_paths_lock);
+  self->peer_process_keys = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                   g_free, g_free);
 }
 
 static void
@@ -151,12 +242,29 @@ mws_peer_manager_dbus_dispose (GObject *object)
   g_clear_object (&self->connection);
 
   g_clear_pointer (&self->peer_credentials, g_hash_table_unref);
+  g_clear_pointer (&self->priorities, g_hash_table_unref);
+  g_clear_pointer (&self->pending_queries, g_hash_table_unref);
+  g_mutex_lock (&self->process_paths_lock);
+  g_clear_pointer (&self->process_paths, g_hash_table_unref);
+  g_mutex_unlock (&self->process_paths_lock);
+  g_clear_pointer (&self->peer_process_keys, g_hash_table_unref);
   g_clear_pointer (&self->peer_watch_ids, g_ptr_array_unref);
 
   /* Chain up to the parent class */
   G_OBJECT_CLASS (mws_peer_manager_dbus_parent_class)->dispose (object);
 }
 
+static void
+mws_peer_manager_dbus_finalize (GObject *object)
+{
+  MwsPeerManagerDBus *self = MWS_PEER_MANAGER_DBUS (object);
+
+  g_mutex_clear (&self->process_paths_lock);
+
+  /* Chain up to the parent class */
+  G_OBJECT_CLASS (mws_peer_manager_dbus_parent_class)->finalize (object);
+}
+
 static void
 mws_peer_manager_dbus_get_property (GObject    *object,
                                     guint       property_id,
@@ -170,6 +278,9 @@ mws_peer_manager_dbus_get_property (GObject    *object,
     case PROP_CONNECTION:
       g_value_set_object (value, self->connection);
       break;
+    case PROP_PRIORITIES:
+      g_value_set_boxed (value, self->priorities);
+      break;
     default:
       g_assert_not_reached ();
     }
@@ -190,6 +301,13 @@ mws_peer_manager_dbus_set_property (GObject      *object,
       g_assert (self->connection == NULL);
       self->connection = g_value_dup_object (value);
       break;
+    case PROP_PRIORITIES:
+      /* Construct only. */
+      g_assert (self->priorities == NULL);
+      self->priorities = g_value_dup_boxed (value);
+      if (self->priorities == NULL)
+        self->priorities = mws_peer_priorities_new_default ();
+      break;
     default:
       g_assert_not_reached ();
     }
@@ -203,6 +321,16 @@ peer_vanished_cb (GDBusConnection *connection,
   MwsPeerManagerDBus *self = MWS_PEER_MANAGER_DBUS (user_data);
 
   g_debug ("%s: Removing peer credentials for ‘%s’ from cache", G_STRFUNC, name);
+
+  const gchar *process_key = g_hash_table_lookup (self->peer_process_keys, name);
+  if (process_key != NULL)
+    {
+      g_mutex_lock (&self->process_paths_lock);
+      g_hash_table_remove (self->process_paths, process_key);
+      g_mutex_unlock (&self->process_paths_lock);
+      g_hash_table_remove (self->peer_process_keys, name);
+    }
+
   if (g_hash_table_remove (self->peer_credentials, name))
     {
       /* Notify users of this API. */
@@ -210,6 +338,32 @@ peer_vanished_cb (GDBusConnection *connection,
     }
 }
 
+typedef struct
+{
+  MwsPeerManagerDBus *peer_manager;  /* (owned) */
+  gchar *sender;  /* (owned) */
+} QueryData;
+
+static QueryData *
+query_data_new (MwsPeerManagerDBus *peer_manager,
+                const gchar        *sender)
+{
+  QueryData *data = g_new0 (QueryData, 1);
+  data->peer_manager = g_object_ref (peer_manager);
+  data->sender = g_strdup (sender);
+  return data;
+}
+
+static void
+query_data_free (QueryData *data)
+{
+  g_clear_object (&data->peer_manager);
+  g_free (data->sender);
+  g_free (data);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (QueryData, query_data_free)
+
 /* An async function for getting credentials for D-Bus peers, either by querying
  * the bus, or by getting them from a cache. */
 static void ensure_peer_credentials_cb (GObject      *obj,
@@ -227,11 +381,11 @@ mws_peer_manager_dbus_ensure_peer_credentials_async (MwsPeerManager      *manage
 
   g_autoptr(GTask) task = g_task_new (self, cancellable, callback, user_data);
   g_task_set_source_tag (task, mws_peer_manager_dbus_ensure_peer_credentials_async);
-  g_task_set_task_data (task, g_strdup (sender), g_free);
 
   /* Look up information about the sender so that we can (for example)
    * prioritise downloads by sender. */
   const gchar *peer_path = mws_peer_manager_get_peer_credentials (manager, sender);
+  GPtrArray *pending_tasks = g_hash_table_lookup (self->pending_queries, sender);
 
   if (peer_path != NULL)
     {
@@ -239,6 +393,13 @@ mws_peer_manager_dbus_ensure_peer_credentials_async (MwsPeerManager      *manage
                G_STRFUNC, peer_path);
       g_task_return_pointer (task, g_strdup (peer_path), g_free);
     }
+  else if (pending_tasks != NULL)
+    {
+      /* Another query for this peer is already in progress, so wait for its
+       * result rather than starting another one. */
+      g_debug ("%s: Waiting for pending query for ‘%s’", G_STRFUNC, sender);
+      g_ptr_array_add (pending_tasks, g_steal_pointer (&task));
+    }
   else
     {
       /* Watch the peer so we can know if/when it disappears. */
@@ -248,102 +409,426 @@ mws_peer_manager_dbus_ensure_peer_credentials_async (MwsPeerManager      *manage
                                                        self, NULL);
       g_ptr_array_add (self->peer_watch_ids, GUINT_TO_POINTER (watch_id));
 
-      /* And query for its credentials. */
-      g_dbus_connection_call (self->connection, "org.freedesktop.DBus", "/",
-                              "org.freedesktop.DBus", "GetConnectionCredentials",
-                              g_variant_new ("(s)", sender),
-                              G_VARIANT_TYPE ("(a{sv})"),
-                              G_DBUS_CALL_FLAGS_NONE,
-                              -1  /* default timeout */,
-                              cancellable,
-                              ensure_peer_credentials_cb, g_steal_pointer (&task));
+      pending_tasks = g_ptr_array_new_with_free_func (g_object_unref);
+      g_ptr_array_add (pending_tasks, g_steal_pointer (&task));
+      g_hash_table_replace (self->pending_queries, g_strdup (sender), pending_tasks);
+
+      /* And query for its credentials. The query is shared between all the
+       * tasks waiting for it, so it can’t be cancelled by any one of them;
+       * each task’s cancellable is checked when it’s returned instead. */
+      g_dbus_connection_call_with_unix_fd_list (self->connection,
+                                                "org.freedesktop.DBus", "/",
+                                                "org.freedesktop.DBus",
+                                                "GetConnectionCredentials",
+                                                g_variant_new ("(s)", sender),
+                                                G_VARIANT_TYPE ("(a{sv})"),
+                                                G_DBUS_CALL_FLAGS_NONE,
+                                                -1  /* default timeout */,
+                                                NULL,  /* fd list */
+                                                NULL,
+                                                ensure_peer_credentials_cb,
+                                                query_data_new (self, sender));
     }
 }
 
-static void
-ensure_peer_credentials_cb (GObject      *obj,
-                            GAsyncResult *result,
-                            gpointer      user_data)
+/* Get the process ID which @pidfd refers to, from its fdinfo. Returns 0 if
+ * this can’t be determined (for example, if the kernel is too old to list it),
+ * or -1 if the process has exited. */
+static pid_t
+pidfd_get_pid (int pidfd)
 {
-  g_autoptr(GTask) task = G_TASK (user_data);
-  MwsPeerManagerDBus *self = MWS_PEER_MANAGER_DBUS (g_task_get_source_object (task));
-  GDBusConnection *connection = G_DBUS_CONNECTION (obj);
-  const gchar *sender = g_task_get_task_data (task);
-  g_autoptr(GError) local_error = NULL;
+  g_autofree gchar *fdinfo_path = g_strdup_printf ("/proc/self/fdinfo/%d", pidfd);
+  g_autofree gchar *fdinfo = NULL;
 
-  /* Finish looking up the sender. */
-  g_autoptr(GVariant) retval = NULL;
-  retval = g_dbus_connection_call_finish (connection, result, &local_error);
+  if (!g_file_get_contents (fdinfo_path, &fdinfo, NULL, NULL))
+    return 0;
 
-  if (retval == NULL)
+  const gchar *line = strstr (fdinfo, "\nPid:");
+  if (line == NULL)
+    return 0;
+
+  gint64 pid = g_ascii_strtoll (line + strlen ("\nPid:"), NULL, 10);
+  if (pid < -1 || pid > G_MAXINT32)
+    return 0;
+
+  return (pid_t) pid;
+}
+
+/* Get the start time of process @pid, in clock ticks since boot, from field 22
+ * of `/proc/$pid/stat`. Together with the PID, this uniquely identifies a
+ * process over the lifetime of the system. */
+static gboolean
+process_get_start_time (pid_t     pid,
+                        guint64  *out_start_time,
+                        GError  **error)
+{
+  g_autofree gchar *stat_path = g_strdup_printf ("/proc/%d/stat", (gint) pid);
+  g_autofree gchar *stat = NULL;
+
+  if (!g_file_get_contents (stat_path, &stat, NULL, error))
+    return FALSE;
+
+  /* The command name (field 2) is in parentheses and may contain spaces or
+   * parentheses itself, so skip to the last closing parenthesis. Field 3
+   * follows it. */
+  const gchar *fields = strrchr (stat, ')');
+  g_auto(GStrv) tokens = (fields != NULL) ? g_strsplit (fields + 1, " ", 22) : NULL;
+  const guint start_time_token = 22 - 3 + 1;  /* tokens[0] is empty */
+
+  if (tokens == NULL || g_strv_length (tokens) <= start_time_token ||
+      !g_ascii_string_to_unsigned (tokens[start_time_token], 10, 0, G_MAXUINT64,
+                                   out_start_time, NULL))
     {
-      g_task_return_error (task, g_steal_pointer (&local_error));
-      return;
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   _("Invalid contents of ‘%s’"), stat_path);
+      return FALSE;
     }
 
-  /* From the credentials information from D-Bus, we can get the process ID,
-   * and then look up the process name. Note that this is racy (the process
-   * ID may get recycled between GetConnectionCredentials() returning and us
-   * querying the kernel for the process name), but there’s nothing we can
-   * do about that. The correct approach is to use an LSM label as returned
-   * by GetConnectionCredentials(), but EOS doesn’t support any LSM.
-   * We would look at /proc/$pid/exe, but that requires elevated privileges
-   * (CAP_SYS_PTRACE, but I can’t get that working; so it would require root
-   * privileges). Instead, we look at /proc/$pid/cmdline, which is accessible
-   * by all. Unfortunately, it is also forgeable. Thankfully this only affects
-   * the priority of download scheduling, not anything security critical. */
-  guint process_id;
+  return TRUE;
+}
 
-  g_autoptr(GVariant) credentials = g_variant_get_child_value (retval, 0);
+/* Build a key for the process cache which identifies a process uniquely, even
+ * if its PID is later reused. */
+static gchar *
+process_key_new (pid_t   pid,
+                 guint64 start_time)
+{
+  return g_strdup_printf ("%d:%" G_GUINT64_FORMAT, (gint) pid, start_time);
+}
+
+/* Work out the executable path for process @pid. This tries `/proc/$pid/exe`
+ * first, which requires permission to ptrace the process (so typically only
+ * works for processes owned by the same user, or if we have CAP_SYS_PTRACE).
+ * If that fails, it falls back to `/proc/$pid/cmdline`, which is accessible by
+ * all but forgeable. Thankfully this only affects the priority of download
+ * scheduling, not anything security critical. */
+static gchar *
+process_get_executable_path (pid_t     pid,
+                             GError  **error)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autofree gchar *pid_str = g_strdup_printf ("%d", (gint) pid);
+  g_autofree gchar *proc_pid_exe = g_build_filename ("/proc", pid_str, "exe", NULL);
+  g_autofree gchar *exe = g_file_read_link (proc_pid_exe, &local_error);
 
-  if (!g_variant_lookup (credentials, "ProcessID", "u", &process_id))
+  if (exe != NULL && g_path_is_absolute (exe))
     {
-      g_task_return_new_error (task, MWS_SCHEDULER_ERROR,
-                               MWS_SCHEDULER_ERROR_IDENTIFYING_PEER,
-                               _("Process ID for peer ‘%s’ could not be determined"),
-                               sender);
-      return;
+      g_debug ("%s: Got path ‘%s’ from ‘%s’", G_STRFUNC, exe, proc_pid_exe);
+      return g_steal_pointer (&exe);
     }
 
-  g_autofree gchar *pid_str = g_strdup_printf ("%u", process_id);
+  g_debug ("%s: Could not read ‘%s’; falling back to cmdline: %s",
+           G_STRFUNC, proc_pid_exe,
+           (local_error != NULL) ? local_error->message : "not absolute");
+  g_clear_error (&local_error);
+
   g_autofree gchar *proc_pid_cmdline = g_build_filename ("/proc", pid_str, "cmdline", NULL);
   g_autofree gchar *cmdline = NULL;
 
   g_debug ("%s: Getting contents of ‘%s’", G_STRFUNC, proc_pid_cmdline);
 
   /* Assume the path is always the first nul-terminated segment. */
-  if (!g_file_get_contents (proc_pid_cmdline, &cmdline, NULL, &local_error))
+  if (!g_file_get_contents (proc_pid_cmdline, &cmdline, NULL, error))
+    return NULL;
+
+  /* Resolve to an absolute path, since what we get back might not be absolute.
+   * This searches $PATH, but only happens once per process. */
+  if (g_path_is_absolute (cmdline))
+    return g_steal_pointer (&cmdline);
+
+  g_autofree gchar *sender_path = g_find_program_in_path (cmdline);
+
+  if (sender_path == NULL)
     {
-      g_task_return_new_error (task, MWS_SCHEDULER_ERROR,
-                               MWS_SCHEDULER_ERROR_IDENTIFYING_PEER,
-                               _("Executable path for peer ‘%s’ (process ID: %s) "
-                                 "could not be determined: %s"),
-                               sender, pid_str, local_error->message);
-      return;
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   _("Path ‘%s’ could not be resolved"), cmdline);
+      return NULL;
     }
 
-  /* Resolve to an absolute path, since what we get back might not be absolute. */
-  g_autofree gchar *sender_path = g_find_program_in_path (cmdline);
+  return g_steal_pointer (&sender_path);
+}
+
+/* Get the executable path for @sender from the @credentials returned by the
+ * D-Bus daemon, and @fd_list (if any) which was returned with them. On
+ * success, @out_process_key is set to the key for the process in the cache.
+ * This reads from `/proc`, so is called in a worker thread. */
+static gchar *
+credentials_to_sender_path (MwsPeerManagerDBus  *self,
+                            const gchar         *sender,
+                            GVariant            *credentials,
+                            GUnixFDList         *fd_list,
+                            gchar              **out_process_key,
+                            GError             **error)
+{
+  g_autoptr(GError) local_error = NULL;
+  guint32 process_id = 0;
+  gint32 process_fd_index;
+  int process_fd = -1;
+  pid_t pid = 0;
+
+  g_variant_lookup (credentials, "ProcessID", "u", &process_id);
+
+  /* Prefer the pidfd if we’ve been given one, as it refers to the peer’s
+   * process even if that process later exits and its PID is reused. */
+  if (fd_list != NULL &&
+      g_variant_lookup (credentials, "ProcessFD", "h", &process_fd_index))
+    {
+      process_fd = g_unix_fd_list_get (fd_list, process_fd_index, &local_error);
+
+      if (process_fd < 0)
+        {
+          g_debug ("%s: Error getting ProcessFD for ‘%s’: %s",
+                   G_STRFUNC, sender, local_error->message);
+          g_clear_error (&local_error);
+        }
+      else
+        {
+          pid = pidfd_get_pid (process_fd);
+        }
+    }
+
+  if (pid == 0)
+    pid = (pid_t) process_id;
+
+  if (pid <= 0)
+    {
+      if (process_fd >= 0)
+        close (process_fd);
+
+      g_set_error (error, MWS_SCHEDULER_ERROR,
+                   MWS_SCHEDULER_ERROR_IDENTIFYING_PEER,
+                   _("Process ID for peer ‘%s’ could not be determined"),
+                   sender);
+      return NULL;
+    }
+
+  /* Check the process cache. */
+  guint64 start_time;
+  g_autofree gchar *process_key = NULL;
+  g_autofree gchar *sender_path = NULL;
+
+  if (process_get_start_time (pid, &start_time, &local_error))
+    {
+      process_key = process_key_new (pid, start_time);
+
+      g_mutex_lock (&self->process_paths_lock);
+      sender_path = g_strdup (g_hash_table_lookup (self->process_paths, process_key));
+      g_mutex_unlock (&self->process_paths_lock);
+    }
+
+  if (sender_path != NULL)
+    {
+      g_debug ("%s: Found path ‘%s’ for process %s in cache",
+               G_STRFUNC, sender_path, process_key);
+    }
+  else if (process_key != NULL)
+    {
+      sender_path = process_get_executable_path (pid, &local_error);
+
+      /* Check the process didn’t exit (allowing its PID to be reused) while we
+       * were examining it. With a pidfd, this is definitive; otherwise, check
+       * the start time is unchanged. */
+      guint64 new_start_time;
+
+      if (sender_path != NULL &&
+          ((process_fd >= 0 && pidfd_get_pid (process_fd) == -1) ||
+           !process_get_start_time (pid, &new_start_time, NULL) ||
+           new_start_time != start_time))
+        {
+          g_clear_pointer (&sender_path, g_free);
+          g_set_error_literal (&local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                               _("Process exited while being identified"));
+        }
+
+      if (sender_path != NULL)
+        {
+          g_mutex_lock (&self->process_paths_lock);
+          g_hash_table_replace (self->process_paths,
+                                g_strdup (process_key), g_strdup (sender_path));
+          g_mutex_unlock (&self->process_paths_lock);
+        }
+    }
+
+  if (process_fd >= 0)
+    close (process_fd);
 
   if (sender_path == NULL)
     {
-      g_autofree gchar *message =
-          g_strdup_printf (_("Path ‘%s’ could not be resolved"), cmdline);
-      g_task_return_new_error (task, MWS_SCHEDULER_ERROR,
-                               MWS_SCHEDULER_ERROR_IDENTIFYING_PEER,
-                               _("Executable path for peer ‘%s’ (process ID: %s) "
-                                 "could not be determined: %s"),
-                               sender, pid_str, message);
+      g_set_error (error, MWS_SCHEDULER_ERROR,
+                   MWS_SCHEDULER_ERROR_IDENTIFYING_PEER,
+                   _("Executable path for peer ‘%s’ (process ID: %d) "
+                     "could not be determined: %s"),
+                   sender, (gint) pid, local_error->message);
+      return NULL;
+    }
+
+  g_debug ("%s: Got credentials from D-Bus daemon; path is ‘%s’",
+           G_STRFUNC, sender_path);
+
+  if (out_process_key != NULL)
+    *out_process_key = g_steal_pointer (&process_key);
+
+  return g_steal_pointer (&sender_path);
+}
+
+/* Cache the result of a query for the credentials of @sender, where
+ * @sender_path is %NULL and @error is set on failure, and return it to all the
+ * tasks which are waiting for it. */
+static void
+complete_query (MwsPeerManagerDBus *self,
+                const gchar        *sender,
+                const gchar        *sender_path,
+                gchar              *process_key,
+                const GError       *error)
+{
+  g_autofree gchar *owned_process_key = process_key;
+
+  if (sender_path != NULL)
+    {
+      gint priority = mws_peer_priorities_lookup (self->priorities, sender_path);
+
+      g_debug ("%s: Priority for ‘%s’ is %d", G_STRFUNC, sender, priority);
+      g_hash_table_replace (self->peer_credentials,
+                            g_strdup (sender), peer_data_new (sender_path, priority));
+      if (owned_process_key != NULL)
+        g_hash_table_replace (self->peer_process_keys,
+                              g_strdup (sender), g_steal_pointer (&owned_process_key));
+    }
+
+  /* Return the result to everyone who was waiting for it. */
+  g_autoptr(GPtrArray) pending_tasks = g_hash_table_lookup (self->pending_queries, sender);
+  g_assert (pending_tasks != NULL);
+  g_ptr_array_ref (pending_tasks);
+  g_hash_table_remove (self->pending_queries, sender);
+
+  g_debug ("%s: Returning query result for ‘%s’ to %u tasks",
+           G_STRFUNC, sender, pending_tasks->len);
+
+  for (gsize i = 0; i < pending_tasks->len; i++)
+    {
+      GTask *task = g_ptr_array_index (pending_tasks, i);
+
+      if (sender_path != NULL)
+        g_task_return_pointer (task, g_strdup (sender_path), g_free);
+      else
+        g_task_return_error (task, g_error_copy (error));
+    }
+}
+
+/* Task data for identify_peer_thread_cb(). */
+typedef struct
+{
+  gchar *sender;  /* (owned) */
+  GVariant *credentials;  /* (owned) */
+  GUnixFDList *fd_list;  /* (owned) (nullable) */
+  gchar *process_key;  /* (owned) (nullable); set by identify_peer_thread_cb() */
+} IdentifyData;
+
+static IdentifyData *
+identify_data_new (const gchar *sender,
+                   GVariant    *credentials,
+                   GUnixFDList *fd_list)
+{
+  IdentifyData *data = g_new0 (IdentifyData, 1);
+  data->sender = g_strdup (sender);
+  data->credentials = g_variant_ref (credentials);
+  data->fd_list = (fd_list != NULL) ? g_object_ref (fd_list) : NULL;
+  return data;
+}
+
+static void
+identify_data_free (IdentifyData *data)
+{
+  g_free (data->sender);
+  g_variant_unref (data->credentials);
+  g_clear_object (&data->fd_list);
+  g_free (data->process_key);
+  g_free (data);
+}
+
+static void
+identify_peer_thread_cb (GTask        *task,
+                         gpointer      source_object,
+                         gpointer      task_data,
+                         GCancellable *cancellable)
+{
+  MwsPeerManagerDBus *self = MWS_PEER_MANAGER_DBUS (source_object);
+  IdentifyData *data = task_data;
+  g_autoptr(GError) local_error = NULL;
+
+  g_autofree gchar *sender_path = NULL;
+  sender_path = credentials_to_sender_path (self, data->sender, data->credentials,
+                                            data->fd_list, &data->process_key,
+                                            &local_error);
+
+  if (sender_path != NULL)
+    g_task_return_pointer (task, g_steal_pointer (&sender_path), g_free);
+  else
+    g_task_return_error (task, g_steal_pointer (&local_error));
+}
+
+static void identify_peer_cb (GObject      *obj,
+                              GAsyncResult *result,
+                              gpointer      user_data);
+
+static void
+ensure_peer_credentials_cb (GObject      *obj,
+                            GAsyncResult *result,
+                            gpointer      user_data)
+{
+  g_autoptr(QueryData) data = user_data;
+  MwsPeerManagerDBus *self = data->peer_manager;
+  GDBusConnection *connection = G_DBUS_CONNECTION (obj);
+  const gchar *sender = data->sender;
+  g_autoptr(GError) local_error = NULL;
+
+  /* Finish looking up the sender. */
+  g_autoptr(GVariant) retval = NULL;
+  g_autoptr(GUnixFDList) fd_list = NULL;
+  retval = g_dbus_connection_call_with_unix_fd_list_finish (connection, &fd_list,
+                                                            result, &local_error);
+
+  /* The peer manager may have been disposed in the meantime. */
+  if (self->pending_queries == NULL)
+    return;
+
+  if (retval == NULL)
+    {
+      complete_query (self, sender, NULL, NULL, local_error);
       return;
     }
 
-  g_debug ("%s: Got credentials from D-Bus daemon; path is ‘%s’ (resolved from ‘%s’)",
-           G_STRFUNC, sender_path, cmdline);
+  /* Examine the peer’s process in a worker thread, since that involves
+   * blocking reads from /proc. */
+  g_autoptr(GVariant) credentials = g_variant_get_child_value (retval, 0);
+  g_autoptr(GTask) task = g_task_new (self, NULL, identify_peer_cb,
+                                      g_steal_pointer (&data));
+  g_task_set_source_tag (task, ensure_peer_credentials_cb);
+  g_task_set_task_data (task, identify_data_new (sender, credentials, fd_list),
+                        (GDestroyNotify) identify_data_free);
+
+  mws_worker_pool_run_task (task, identify_peer_thread_cb);
+}
+
+static void
+identify_peer_cb (GObject      *obj,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+  MwsPeerManagerDBus *self = MWS_PEER_MANAGER_DBUS (obj);
+  g_autoptr(QueryData) data = user_data;
+  IdentifyData *identify_data = g_task_get_task_data (G_TASK (result));
+  g_autoptr(GError) local_error = NULL;
+
+  g_autofree gchar *sender_path = g_task_propagate_pointer (G_TASK (result),
+                                                            &local_error);
 
-  g_hash_table_replace (self->peer_credentials,
-                        g_strdup (sender), g_strdup (sender_path));
+  /* The peer manager may have been disposed in the meantime. */
+  if (self->pending_queries == NULL)
+    return;
 
-  g_task_return_pointer (task, g_steal_pointer (&sender_path), g_free);
+  complete_query (self, data->sender, sender_path,
+                  g_steal_pointer (&identify_data->process_key), local_error);
 }
 
 static gchar *
@@ -364,12 +849,26 @@ mws_peer_manager_dbus_get_peer_credentials (MwsPeerManager *manager,
   MwsPeerManagerDBus *self = MWS_PEER_MANAGER_DBUS (manager);
 
   g_debug ("%s: Querying credentials for peer ‘%s’", G_STRFUNC, sender);
-  return g_hash_table_lookup (self->peer_credentials, sender);
+  const PeerData *data = g_hash_table_lookup (self->peer_credentials, sender);
+  return (data != NULL) ? data->path : NULL;
+}
+
+static gint
+mws_peer_manager_dbus_get_peer_priority (MwsPeerManager *manager,
+                                         const gchar    *sender)
+{
+  MwsPeerManagerDBus *self = MWS_PEER_MANAGER_DBUS (manager);
+
+  const PeerData *data = g_hash_table_lookup (self->peer_credentials, sender);
+  return (data != NULL) ? data->priority : G_MININT;
 }
 
 /**
  * mws_peer_manager_dbus_new:
  * @connection: a #GDBusConnection
+ * @priorities: (element-type filename gint) (nullable): map of peer
+ *    priorities, or %NULL to use the defaults; see
+ *    #MwsPeerManagerDBus:priorities
  *
  * Create a #MwsPeerManagerDBus object to wrap the given existing @connection.
  *
@@ -377,11 +876,13 @@ mws_peer_manager_dbus_get_peer_credentials (MwsPeerManager *manager,
  * Since: 0.1.0
  */
 MwsPeerManagerDBus *
-mws_peer_manager_dbus_new (GDBusConnection *connection)
+mws_peer_manager_dbus_new (GDBusConnection *connection,
+                           GHashTable      *priorities)
 {
   g_return_val_if_fail (G_IS_DBUS_CONNECTION (connection), NULL);
 
   return g_object_new (MWS_TYPE_PEER_MANAGER_DBUS,
                        "connection", connection,
+                       "priorities", priorities,
                        NULL);
 }
@@ -31,6 +31,7 @@ G_BEGIN_DECLS
 #define MWS_TYPE_PEER_MANAGER_DBUS mws_peer_manager_dbus_get_type ()
 G_DECLARE_FINAL_TYPE (MwsPeerManagerDBus, mws_peer_manager_dbus, MWS, PEER_MANAGER_DBUS, GObject)
 
-MwsPeerManagerDBus *mws_peer_manager_dbus_new (GDBusConnection *connection);
+MwsPeerManagerDBus *mws_peer_manager_dbus_new (GDBusConnection *connection,
+                                               GHashTable      *priorities);
 
 G_END_DECLS
@@ -157,3 +157,29 @@ mws_peer_manager_get_peer_credentials (MwsPeerManager *self,
 
   return iface->get_peer_credentials (self, sender);
 }
+
+/**
+ * mws_peer_manager_get_peer_priority:
+ * @self: a #MwsPeerManager
+ * @sender: D-Bus unique name for the peer
+ *
+ * Get the scheduling priority for the given peer. Higher numbers indicate
+ * more important peers. The priority is worked out from the peer’s credentials
+ * when they are first cached, so this is cheap to call. If no credentials are
+ * in the cache for @sender, %G_MININT will be returned.
+ *
+ * Returns: priority of the peer, or %G_MININT if it’s unknown
+ * Since: 0.3.0
+ */
+gint
+mws_peer_manager_get_peer_priority (MwsPeerManager *self,
+                                    const gchar    *sender)
+{
+  g_return_val_if_fail (MWS_IS_PEER_MANAGER (self), G_MININT);
+  g_return_val_if_fail (g_dbus_is_unique_name (sender), G_MININT);
+
+  MwsPeerManagerInterface *iface = MWS_PEER_MANAGER_GET_IFACE (self);
+  g_assert (iface->get_peer_priority != NULL);
+
+  return iface->get_peer_priority (self, sender);
+}
@@ -39,6 +39,10 @@ G_DECLARE_INTERFACE (MwsPeerManager, mws_peer_manager, MWS, PEER_MANAGER, GObjec
  *    started with @ensure_peer_credentials_async.
  * @get_peer_credentials: Get credentials for a peer out of the peer manager’s
  *    cache. If the peer is not known to the manager, return %NULL.
+ * @get_peer_priority: Get the scheduling priority for a peer out of the peer
+ *    manager’s cache. This is calculated once, when the peer’s credentials are
+ *    first cached. If the peer is not known to the manager, return %G_MININT.
+ *    (Since: 0.3.0)
  *
  * An interface which exposes peers for the scheduler (typically, D-Bus clients
  * which are adding schedule entries to the scheduler) and allows querying of
@@ -64,6 +68,8 @@ struct _MwsPeerManagerInterface
 
   const gchar *(*get_peer_credentials)           (MwsPeerManager       *manager,
                                                   const gchar          *sender);
+  gint         (*get_peer_priority)              (MwsPeerManager       *manager,
+                                                  const gchar          *sender);
 };
 
 void         mws_peer_manager_ensure_peer_credentials_async  (MwsPeerManager       *self,
@@ -77,5 +83,7 @@ gchar       *mws_peer_manager_ensure_peer_credentials_finish (MwsPeerManager
 
 const gchar *mws_peer_manager_get_peer_credentials           (MwsPeerManager       *self,
                                                               const gchar          *sender);
+gint         mws_peer_manager_get_peer_priority              (MwsPeerManager       *self,
+                                                              const gchar          *sender);
 
 G_END_DECLS
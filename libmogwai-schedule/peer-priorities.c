@@ -0,0 +1,342 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <glib/gi18n-lib.h>
+#include <libmogwai-schedule/peer-priorities.h>
+
+
+/**
+ * SECTION:peer-priorities
+ * @short_description: Mapping from peer executables to scheduling priorities
+ * @include: libmogwai-schedule/peer-priorities.h
+ *
+ * A peer priorities map is a #GHashTable mapping from the absolute path of a
+ * peer’s executable (as returned by mws_peer_manager_get_peer_credentials())
+ * to an integer priority for scheduling that peer’s entries. Higher numbers
+ * indicate more important peers.
+ *
+ * Peers which are not in the map are given a priority derived from a hash of
+ * their executable path, so that the ordering between them is arbitrary but
+ * stable. See mws_peer_priorities_lookup().
+ *
+ * The map is typically loaded from a key file at startup using
+ * mws_peer_priorities_new_from_file(). The key file has a single group,
+ * %MWS_PEER_PRIORITIES_GROUP, with a key for each executable path:
+ * |[
+ * [Peer Priorities]
+ * /usr/libexec/eos-updater=2147483647
+ * /usr/bin/gnome-software=2147483647
+ * ]|
+ *
+ * The same key file may also contain a %MWS_PEER_WEIGHTS_GROUP group, giving
+ * each peer a weight for #MwsScheduler:fair-share scheduling. A peer with
+ * weight 2 gets twice the share of the active download slots of a peer with
+ * weight 1, which is the default. See mws_peer_weights_new_from_key_file().
+ * |[
+ * [Peer Weights]
+ * /usr/libexec/eos-updater=4
+ * ]|
+ *
+ * Since: 0.3.0
+ */
+
+static GHashTable *
+peer_priorities_new_empty (void)
+{
+  return g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+}
+
+/**
+ * mws_peer_priorities_new_default:
+ *
+ * Create a peer priorities map containing the built-in defaults, which are
+ * used if no configuration is provided. The OS and app updaters are equally as
+ * important as each other, and more important than any other peer.
+ *
+ * Returns: (transfer full) (element-type filename gint): a new peer priorities
+ *    map
+ * Since: 0.3.0
+ */
+GHashTable *
+mws_peer_priorities_new_default (void)
+{
+  g_autoptr(GHashTable) priorities = peer_priorities_new_empty ();
+
+  g_hash_table_insert (priorities, g_strdup ("/usr/libexec/eos-updater"),
+                       GINT_TO_POINTER (G_MAXINT));
+  g_hash_table_insert (priorities, g_strdup ("/usr/bin/gnome-software"),
+                       GINT_TO_POINTER (G_MAXINT));
+
+  return g_steal_pointer (&priorities);
+}
+
+/**
+ * mws_peer_priorities_new_from_key_file:
+ * @key_file: a #GKeyFile to load the priorities from
+ * @error: return location for a #GError, or %NULL
+ *
+ * Load a peer priorities map from the %MWS_PEER_PRIORITIES_GROUP group of
+ * @key_file. Each key must be an absolute path, and each value an integer. If
+ * the group is missing, an empty map is returned.
+ *
+ * Returns: (transfer full) (element-type filename gint): a new peer priorities
+ *    map
+ * Since: 0.3.0
+ */
+GHashTable *
+mws_peer_priorities_new_from_key_file (GKeyFile  *key_file,
+                                       GError   **error)
+{
+  g_return_val_if_fail (key_file != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  g_autoptr(GHashTable) priorities = peer_priorities_new_empty ();
+
+  if (!g_key_file_has_group (key_file, MWS_PEER_PRIORITIES_GROUP))
+    return g_steal_pointer (&priorities);
+
+  gsize n_keys = 0;
+  g_auto(GStrv) keys = g_key_file_get_keys (key_file, MWS_PEER_PRIORITIES_GROUP,
+                                            &n_keys, error);
+  if (keys == NULL)
+    return NULL;
+
+  for (gsize i = 0; i < n_keys; i++)
+    {
+      g_autoptr(GError) local_error = NULL;
+
+      if (!g_path_is_absolute (keys[i]))
+        {
+          g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                       _("Peer path ‘%s’ is not absolute"), keys[i]);
+          return NULL;
+        }
+
+      gint64 priority = g_key_file_get_int64 (key_file, MWS_PEER_PRIORITIES_GROUP,
+                                              keys[i], &local_error);
+
+      if (local_error == NULL && (priority < G_MININT || priority > G_MAXINT))
+        g_set_error (&local_error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                     _("Priority %" G_GINT64_FORMAT " is out of range"), priority);
+
+      if (local_error != NULL)
+        {
+          g_propagate_prefixed_error (error, g_steal_pointer (&local_error),
+                                      _("Invalid priority for peer ‘%s’: "),
+                                      keys[i]);
+          return NULL;
+        }
+
+      g_hash_table_replace (priorities, g_strdup (keys[i]),
+                            GINT_TO_POINTER ((gint) priority));
+    }
+
+  return g_steal_pointer (&priorities);
+}
+
+/**
+ * mws_peer_priorities_new_from_file:
+ * @path: path to a key file to load the priorities from
+ * @error: return location for a #GError, or %NULL
+ *
+ * Load a peer priorities map from the key file at @path. See
+ * mws_peer_priorities_new_from_key_file() for the format. If @path doesn’t
+ * exist, %G_FILE_ERROR_NOENT is returned, and the caller will typically want
+ * to fall back to mws_peer_priorities_new_default().
+ *
+ * Returns: (transfer full) (element-type filename gint): a new peer priorities
+ *    map
+ * Since: 0.3.0
+ */
+GHashTable *
+mws_peer_priorities_new_from_file (const gchar  *path,
+                                   GError      **error)
+{
+  g_return_val_if_fail (path != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  g_autoptr(GKeyFile) key_file = g_key_file_new ();
+
+  if (!g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, error))
+    return NULL;
+
+  return mws_peer_priorities_new_from_key_file (key_file, error);
+}
+
+/**
+ * mws_peer_priorities_lookup:
+ * @priorities: (element-type filename gint): a peer priorities map
+ * @peer_path: absolute path to the peer’s executable
+ *
+ * Get the priority for the peer whose executable is at @peer_path. If it’s
+ * listed in @priorities, that priority is returned. Otherwise, a priority in
+ * the open range (%G_MININT, %G_MAXINT) is derived from a hash of
+ * @peer_path; %G_MININT is reserved for peers whose credentials are unknown.
+ *
+ * Returns: priority of the peer; higher numbers are more important
+ * Since: 0.3.0
+ */
+gint
+mws_peer_priorities_lookup (GHashTable  *priorities,
+                            const gchar *peer_path)
+{
+  g_return_val_if_fail (priorities != NULL, G_MININT);
+  g_return_val_if_fail (peer_path != NULL, G_MININT);
+
+  gpointer value;
+
+  if (g_hash_table_lookup_extended (priorities, peer_path, NULL, &value))
+    return GPOINTER_TO_INT (value);
+
+  /* Anything else goes in the range (G_MININT, G_MAXINT). The actual priority
+   * numbers are fairly arbitrary; it’s the partial order over them which is
+   * important. */
+  gint priority = g_str_hash (peer_path) + G_MININT;
+  if (priority == G_MININT)
+    priority += 1;
+  if (priority == G_MAXINT)
+    priority -= 1;
+  return priority;
+}
+
+/**
+ * mws_peer_weights_new_from_key_file:
+ * @key_file: a #GKeyFile to load the weights from
+ * @error: return location for a #GError, or %NULL
+ *
+ * Load a peer weights map from the %MWS_PEER_WEIGHTS_GROUP group of @key_file.
+ * Each key must be an absolute path, and each value an integer in the range
+ * [1, %MWS_PEER_WEIGHT_MAX]. If the group is missing, an empty map is
+ * returned, which gives every peer the same weight.
+ *
+ * Returns: (transfer full) (element-type filename guint): a new peer weights
+ *    map
+ * Since: 0.3.0
+ */
+GHashTable *
+mws_peer_weights_new_from_key_file (GKeyFile  *key_file,
+                                    GError   **error)
+{
+  g_return_val_if_fail (key_file != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  g_autoptr(GHashTable) weights = peer_priorities_new_empty ();
+
+  if (!g_key_file_has_group (key_file, MWS_PEER_WEIGHTS_GROUP))
+    return g_steal_pointer (&weights);
+
+  gsize n_keys = 0;
+  g_auto(GStrv) keys = g_key_file_get_keys (key_file, MWS_PEER_WEIGHTS_GROUP,
+                                            &n_keys, error);
+  if (keys == NULL)
+    return NULL;
+
+  for (gsize i = 0; i < n_keys; i++)
+    {
+      g_autoptr(GError) local_error = NULL;
+
+      if (!g_path_is_absolute (keys[i]))
+        {
+          g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                       _("Peer path ‘%s’ is not absolute"), keys[i]);
+          return NULL;
+        }
+
+      gint64 weight = g_key_file_get_int64 (key_file, MWS_PEER_WEIGHTS_GROUP,
+                                            keys[i], &local_error);
+
+      if (local_error == NULL && (weight < 1 || weight > MWS_PEER_WEIGHT_MAX))
+        g_set_error (&local_error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                     _("Weight %" G_GINT64_FORMAT " is out of range"), weight);
+
+      if (local_error != NULL)
+        {
+          g_propagate_prefixed_error (error, g_steal_pointer (&local_error),
+                                      _("Invalid weight for peer ‘%s’: "),
+                                      keys[i]);
+          return NULL;
+        }
+
+      g_hash_table_replace (weights, g_strdup (keys[i]),
+                            GUINT_TO_POINTER ((guint) weight));
+    }
+
+  return g_steal_pointer (&weights);
+}
+
+/**
+ * mws_peer_weights_new_from_file:
+ * @path: path to a key file to load the weights from
+ * @error: return location for a #GError, or %NULL
+ *
+ * Load a peer weights map from the key file at @path. See
+ * mws_peer_weights_new_from_key_file() for the format. If @path doesn’t exist,
+ * %G_FILE_ERROR_NOENT is returned.
+ *
+ * Returns: (transfer full) (element-type filename guint): a new peer weights
+ *    map
+ * Since: 0.3.0
+ */
+GHashTable *
+mws_peer_weights_new_from_file (const gchar  *path,
+                                GError      **error)
+{
+  g_return_val_if_fail (path != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  g_autoptr(GKeyFile) key_file = g_key_file_new ();
+
+  if (!g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, error))
+    return NULL;
+
+  return mws_peer_weights_new_from_key_file (key_file, error);
+}
+
+/**
+ * mws_peer_weights_lookup:
+ * @weights: (element-type filename guint) (nullable): a peer weights map, or
+ *    %NULL to give every peer the default weight
+ * @peer_path: (nullable): absolute path to the peer’s executable, or %NULL if
+ *    it’s unknown
+ *
+ * Get the fair-share weight for the peer whose executable is at @peer_path.
+ * If it’s listed in @weights, that weight is returned. Otherwise, the default
+ * weight of 1 is returned.
+ *
+ * Returns: weight of the peer, in the range [1, %MWS_PEER_WEIGHT_MAX]
+ * Since: 0.3.0
+ */
+guint
+mws_peer_weights_lookup (GHashTable  *weights,
+                         const gchar *peer_path)
+{
+  gpointer value;
+
+  if (weights != NULL && peer_path != NULL &&
+      g_hash_table_lookup_extended (weights, peer_path, NULL, &value))
+    return GPOINTER_TO_UINT (value);
+
+  return 1;
+}
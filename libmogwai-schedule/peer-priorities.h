@@ -0,0 +1,78 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * MWS_PEER_PRIORITIES_GROUP:
+ *
+ * Name of the group in a peer priorities key file which maps from absolute
+ * executable paths to peer priorities. See
+ * mws_peer_priorities_new_from_key_file().
+ *
+ * Since: 0.3.0
+ */
+#define MWS_PEER_PRIORITIES_GROUP "Peer Priorities"
+
+/**
+ * MWS_PEER_WEIGHTS_GROUP:
+ *
+ * Name of the group in a peer priorities key file which maps from absolute
+ * executable paths to fair-share weights. See
+ * mws_peer_weights_new_from_key_file().
+ *
+ * Since: 0.3.0
+ */
+#define MWS_PEER_WEIGHTS_GROUP "Peer Weights"
+
+/**
+ * MWS_PEER_WEIGHT_MAX:
+ *
+ * Maximum fair-share weight a peer can be given. See
+ * mws_peer_weights_new_from_key_file().
+ *
+ * Since: 0.3.0
+ */
+#define MWS_PEER_WEIGHT_MAX 1000
+
+GHashTable *mws_peer_priorities_new_default       (void);
+GHashTable *mws_peer_priorities_new_from_key_file (GKeyFile     *key_file,
+                                                   GError      **error);
+GHashTable *mws_peer_priorities_new_from_file     (const gchar  *path,
+                                                   GError      **error);
+
+gint        mws_peer_priorities_lookup            (GHashTable   *priorities,
+                                                   const gchar  *peer_path);
+
+GHashTable *mws_peer_weights_new_from_key_file    (GKeyFile     *key_file,
+                                                   GError      **error);
+GHashTable *mws_peer_weights_new_from_file        (const gchar  *path,
+                                                   GError      **error);
+
+guint       mws_peer_weights_lookup               (GHashTable   *weights,
+                                                   const gchar  *peer_path);
+
+G_END_DECLS
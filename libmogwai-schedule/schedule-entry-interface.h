@@ -44,9 +44,32 @@ static const GDBusMethodInfo schedule_entry_interface_remove =
   NULL,  /* annotations */
 };
 
+static const GDBusArgInfo schedule_entry_interface_set_properties_arg_properties =
+{
+  -1,  /* ref count */
+  (gchar *) "properties",
+  (gchar *) "a{sv}",
+  NULL
+};
+
+static const GDBusArgInfo *schedule_entry_interface_set_properties_in_args[] =
+{
+  &schedule_entry_interface_set_properties_arg_properties,
+  NULL,
+};
+static const GDBusMethodInfo schedule_entry_interface_set_properties =
+{
+  -1,  /* ref count */
+  (gchar *) "SetProperties",
+  (GDBusArgInfo **) schedule_entry_interface_set_properties_in_args,
+  NULL,  /* no out args */
+  NULL,  /* annotations */
+};
+
 static const GDBusMethodInfo *schedule_entry_interface_methods[] =
 {
   &schedule_entry_interface_remove,
+  &schedule_entry_interface_set_properties,
   NULL,
 };
 
@@ -89,11 +112,81 @@ static const GDBusPropertyInfo schedule_entry_interface_resumable =
   NULL,  /* no annotations */
 };
 
+static const GDBusPropertyInfo schedule_entry_interface_expected_size =
+{
+  -1,  /* ref count */
+  (gchar *) "ExpectedSize",
+  (gchar *) "t",
+  G_DBUS_PROPERTY_INFO_FLAGS_READABLE | G_DBUS_PROPERTY_INFO_FLAGS_WRITABLE,
+  NULL,  /* no annotations */
+};
+
+static const GDBusPropertyInfo schedule_entry_interface_deadline =
+{
+  -1,  /* ref count */
+  (gchar *) "Deadline",
+  (gchar *) "t",
+  G_DBUS_PROPERTY_INFO_FLAGS_READABLE | G_DBUS_PROPERTY_INFO_FLAGS_WRITABLE,
+  NULL,  /* no annotations */
+};
+
+static const GDBusPropertyInfo schedule_entry_interface_bind_to_connection =
+{
+  -1,  /* ref count */
+  (gchar *) "BindToConnection",
+  (gchar *) "b",
+  G_DBUS_PROPERTY_INFO_FLAGS_READABLE | G_DBUS_PROPERTY_INFO_FLAGS_WRITABLE,
+  NULL,  /* no annotations */
+};
+
+static const GDBusPropertyInfo schedule_entry_interface_connection =
+{
+  -1,  /* ref count */
+  (gchar *) "Connection",
+  (gchar *) "s",
+  G_DBUS_PROPERTY_INFO_FLAGS_READABLE,
+  NULL,  /* no annotations */
+};
+
+static const GDBusPropertyInfo schedule_entry_interface_max_rate =
+{
+  -1,  /* ref count */
+  (gchar *) "MaxRate",
+  (gchar *) "t",
+  G_DBUS_PROPERTY_INFO_FLAGS_READABLE,
+  NULL,  /* no annotations */
+};
+
+static const GDBusPropertyInfo schedule_entry_interface_download_starts_at =
+{
+  -1,  /* ref count */
+  (gchar *) "DownloadStartsAt",
+  (gchar *) "t",
+  G_DBUS_PROPERTY_INFO_FLAGS_READABLE,
+  NULL,  /* no annotations */
+};
+
+static const GDBusPropertyInfo schedule_entry_interface_downloaded_size =
+{
+  -1,  /* ref count */
+  (gchar *) "DownloadedSize",
+  (gchar *) "t",
+  G_DBUS_PROPERTY_INFO_FLAGS_READABLE | G_DBUS_PROPERTY_INFO_FLAGS_WRITABLE,
+  NULL,  /* no annotations */
+};
+
 static const GDBusPropertyInfo *schedule_entry_interface_properties[] =
 {
   &schedule_entry_interface_download_now,
   &schedule_entry_interface_priority,
   &schedule_entry_interface_resumable,
+  &schedule_entry_interface_expected_size,
+  &schedule_entry_interface_deadline,
+  &schedule_entry_interface_bind_to_connection,
+  &schedule_entry_interface_connection,
+  &schedule_entry_interface_max_rate,
+  &schedule_entry_interface_download_starts_at,
+  &schedule_entry_interface_downloaded_size,
   NULL,
 };
 
@@ -28,6 +28,7 @@
 #include <gio/gio.h>
 #include <libmogwai-schedule/schedule-entry.h>
 #include <libmogwai-schedule/scheduler.h>
+#include <string.h>
 
 
 static void mws_schedule_entry_constructed  (GObject      *object);
@@ -59,11 +60,25 @@ struct _MwsScheduleEntry
 {
   GObject parent;
 
-  gchar *id;  /* (owned) (not nullable) */
-  gchar *owner;  /* (owned) (not nullable) */
+  /* The ID is stored inline, rather than as a separate allocation. It’s the
+   * decimal representation of a #guint64, so needs at most 20 digits plus a
+   * nul terminator. */
+  gchar id[21];  /* (not nullable) */
+  const gchar *owner;  /* (owned) (nullable) (interned by owner_pool_ref()) */
 
   gboolean resumable;
   guint32 priority;
+  guint64 expected_size;
+  guint64 deadline;
+  gboolean bind_to_connection;
+  guint64 downloaded_size;
+
+  /* Set by the #MwsScheduler while the entry is active. */
+  gchar *connection_id;  /* (owned) (nullable) */
+  guint64 max_rate;
+
+  /* Set by the #MwsScheduler while the entry is deferred. */
+  guint64 download_starts_at;
 };
 
 typedef enum
@@ -72,6 +87,13 @@ typedef enum
   PROP_OWNER,
   PROP_RESUMABLE,
   PROP_PRIORITY,
+  PROP_EXPECTED_SIZE,
+  PROP_DEADLINE,
+  PROP_BIND_TO_CONNECTION,
+  PROP_CONNECTION_ID,
+  PROP_MAX_RATE,
+  PROP_DOWNLOAD_STARTS_AT,
+  PROP_DOWNLOADED_SIZE,
 } MwsScheduleEntryProperty;
 
 G_DEFINE_TYPE (MwsScheduleEntry, mws_schedule_entry, G_TYPE_OBJECT)
@@ -80,7 +102,7 @@ static void
 mws_schedule_entry_class_init (MwsScheduleEntryClass *klass)
 {
   GObjectClass *object_class = (GObjectClass *) klass;
-  GParamSpec *props[PROP_PRIORITY + 1] = { NULL, };
+  GParamSpec *props[PROP_DOWNLOADED_SIZE + 1] = { NULL, };
 
   object_class->constructed = mws_schedule_entry_constructed;
   object_class->dispose = mws_schedule_entry_dispose;
@@ -147,12 +169,209 @@ mws_schedule_entry_class_init (MwsScheduleEntryClass *klass)
                          0, G_MAXUINT32, 0,
                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
 
+  /**
+   * MwsScheduleEntry:expected-size:
+   *
+   * The number of bytes the owner expects this download to transfer, or zero
+   * if that isn’t known. This is a hint which the scheduler may use to let
+   * small downloads complete before large ones of the same priority; it is not
+   * enforced.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_EXPECTED_SIZE] =
+      g_param_spec_uint64 ("expected-size", "Expected Size",
+                           "Number of bytes this download is expected to "
+                           "transfer, or zero if unknown.",
+                           0, G_MAXUINT64, 0,
+                           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwsScheduleEntry:deadline:
+   *
+   * The time by which the owner would like this download to have started, in
+   * seconds since the Unix epoch, or zero if it has no deadline. Entries with
+   * a deadline tell the scheduler they aren’t urgent: it may defer them to a
+   * cheaper tariff period which starts before the deadline. Entries without a
+   * deadline are scheduled as soon as possible.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_DEADLINE] =
+      g_param_spec_uint64 ("deadline", "Deadline",
+                           "Time by which this download should have started, "
+                           "or zero for no deadline.",
+                           0, G_MAXUINT64, 0,
+                           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwsScheduleEntry:bind-to-connection:
+   *
+   * Whether the owner can bind this download to a specific network connection,
+   * given by #MwsScheduleEntry:connection-id while the entry is active. If
+   * %TRUE, the scheduler may make the entry active when only some of the
+   * active network connections are safe to download on. If %FALSE, the
+   * download is assumed to use any of the connections, so all of them have to
+   * be safe.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_BIND_TO_CONNECTION] =
+      g_param_spec_boolean ("bind-to-connection", "Bind to Connection",
+                            "Whether this download can be bound to a specific "
+                            "network connection.",
+                            FALSE,
+                            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwsScheduleEntry:connection-id:
+   *
+   * ID of the network connection (as used by #MwsConnectionMonitor) which the
+   * scheduler has chosen for this download, or %NULL if none has been chosen.
+   * This is only set while the entry is active, and only if
+   * #MwsScheduleEntry:bind-to-connection is %TRUE. It is set by the
+   * #MwsScheduler.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_CONNECTION_ID] =
+      g_param_spec_string ("connection-id", "Connection ID",
+                           "ID of the network connection chosen for this "
+                           "download, if any.",
+                           NULL,
+                           G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwsScheduleEntry:max-rate:
+   *
+   * Hint for the maximum rate the owner should download at, in bytes per
+   * second, or zero if the download doesn’t need to be throttled. This is only
+   * set while the entry is active, and is calculated by the #MwsScheduler from
+   * the capacity limit of the tariff on the network connection being used, so
+   * that the limit isn’t reached before the end of the tariff period. It is
+   * not enforced by the scheduler.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_MAX_RATE] =
+      g_param_spec_uint64 ("max-rate", "Max. Rate",
+                           "Maximum rate to download at, in bytes per second, "
+                           "or zero for no limit.",
+                           0, G_MAXUINT64, 0,
+                           G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwsScheduleEntry:download-starts-at:
+   *
+   * Prediction of when the entry will next become active, in seconds since
+   * the Unix epoch, or zero if it is active or no prediction can be made. This
+   * is calculated by the #MwsScheduler from the same tariff planning it uses
+   * to defer entries, so owners can prepare (for example, by resolving
+   * mirrors) shortly before the download is due to start. It is only a hint:
+   * the entry may become active earlier or later than predicted if the
+   * network connections or the set of entries change.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_DOWNLOAD_STARTS_AT] =
+      g_param_spec_uint64 ("download-starts-at", "Download Starts At",
+                           "Predicted time the download will start, in "
+                           "seconds since the Unix epoch, or zero if unknown.",
+                           0, G_MAXUINT64, 0,
+                           G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwsScheduleEntry:downloaded-size:
+   *
+   * The number of bytes of this download which the owner reports it has
+   * transferred so far. The owner may update this periodically while the
+   * download is in progress; the scheduler uses it to avoid preempting
+   * non-resumable downloads which are nearly complete (see
+   * #MwsScheduler:non-resumable-protect-size). Changes to it don’t cause a
+   * reschedule.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_DOWNLOADED_SIZE] =
+      g_param_spec_uint64 ("downloaded-size", "Downloaded Size",
+                           "Number of bytes of this download transferred so "
+                           "far.",
+                           0, G_MAXUINT64, 0,
+                           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (object_class, G_N_ELEMENTS (props), props);
 }
 
 static guint64 entry_id_counter = 0;
 G_LOCK_DEFINE_STATIC (entry_id_counter);
 
+/* Pool of reference counted owner strings. Most entries share one of a handful
+ * of owners, so this avoids allocating a copy of the owner for every entry.
+ * Unlike g_intern_string(), strings are freed once the last entry using them
+ * is finalised, since D-Bus unique names are never reused. */
+typedef struct
+{
+  guint ref_count;
+  gchar str[];
+} PooledOwner;
+
+static GHashTable *owner_pool = NULL;  /* (owned) (nullable) (element-type utf8 PooledOwner) */
+G_LOCK_DEFINE_STATIC (owner_pool);
+
+/* Return a pooled copy of @owner, which must be released using
+ * owner_pool_unref(). */
+static const gchar *
+owner_pool_ref (const gchar *owner)
+{
+  PooledOwner *pooled;
+
+  G_LOCK (owner_pool);
+
+  if (owner_pool == NULL)
+    owner_pool = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free);
+
+  pooled = g_hash_table_lookup (owner_pool, owner);
+
+  if (pooled == NULL)
+    {
+      gsize len = strlen (owner);
+
+      pooled = g_malloc (sizeof (PooledOwner) + len + 1);
+      pooled->ref_count = 0;
+      memcpy (pooled->str, owner, len + 1);
+      g_hash_table_insert (owner_pool, pooled->str, pooled);
+    }
+
+  g_assert (pooled->ref_count < G_MAXUINT);
+  pooled->ref_count++;
+
+  G_UNLOCK (owner_pool);
+
+  return pooled->str;
+}
+
+static void
+owner_pool_unref (const gchar *owner)
+{
+  PooledOwner *pooled = (PooledOwner *) (owner - G_STRUCT_OFFSET (PooledOwner, str));
+
+  G_LOCK (owner_pool);
+
+  g_assert (pooled->ref_count > 0);
+  pooled->ref_count--;
+
+  if (pooled->ref_count == 0)
+    {
+      /* This frees @pooled. */
+      g_hash_table_remove (owner_pool, pooled->str);
+
+      if (g_hash_table_size (owner_pool) == 0)
+        g_clear_pointer (&owner_pool, g_hash_table_unref);
+    }
+
+  G_UNLOCK (owner_pool);
+}
+
 static void
 mws_schedule_entry_init (MwsScheduleEntry *self)
 {
@@ -167,7 +386,7 @@ mws_schedule_entry_init (MwsScheduleEntry *self)
   G_UNLOCK (entry_id_counter);
 
   g_assert (our_id < G_MAXUINT64);
-  self->id = g_strdup_printf ("%" G_GUINT64_FORMAT, our_id);
+  g_snprintf (self->id, sizeof (self->id), "%" G_GUINT64_FORMAT, our_id);
 }
 
 static void
@@ -179,7 +398,7 @@ mws_schedule_entry_constructed (GObject *object)
   G_OBJECT_CLASS (mws_schedule_entry_parent_class)->constructed (object);
 
   /* Check all our construct-only properties are set. */
-  g_assert (self->id != NULL && *self->id != '\0');
+  g_assert (*self->id != '\0');
   g_assert (self->owner != NULL && g_dbus_is_unique_name (self->owner));
 }
 
@@ -188,8 +407,13 @@ mws_schedule_entry_dispose (GObject *object)
 {
   MwsScheduleEntry *self = MWS_SCHEDULE_ENTRY (object);
 
-  g_clear_pointer (&self->owner, g_free);
-  g_clear_pointer (&self->id, g_free);
+  if (self->owner != NULL)
+    {
+      owner_pool_unref (self->owner);
+      self->owner = NULL;
+    }
+
+  g_clear_pointer (&self->connection_id, g_free);
 
   /* Chain up to the parent class */
   G_OBJECT_CLASS (mws_schedule_entry_parent_class)->dispose (object);
@@ -217,6 +441,27 @@ mws_schedule_entry_get_property (GObject    *object,
     case PROP_PRIORITY:
       g_value_set_uint (value, self->priority);
       break;
+    case PROP_EXPECTED_SIZE:
+      g_value_set_uint64 (value, self->expected_size);
+      break;
+    case PROP_DEADLINE:
+      g_value_set_uint64 (value, self->deadline);
+      break;
+    case PROP_BIND_TO_CONNECTION:
+      g_value_set_boolean (value, self->bind_to_connection);
+      break;
+    case PROP_CONNECTION_ID:
+      g_value_set_string (value, self->connection_id);
+      break;
+    case PROP_MAX_RATE:
+      g_value_set_uint64 (value, self->max_rate);
+      break;
+    case PROP_DOWNLOAD_STARTS_AT:
+      g_value_set_uint64 (value, self->download_starts_at);
+      break;
+    case PROP_DOWNLOADED_SIZE:
+      g_value_set_uint64 (value, self->downloaded_size);
+      break;
     default:
       g_assert_not_reached ();
     }
@@ -240,7 +485,7 @@ mws_schedule_entry_set_property (GObject      *object,
       /* Construct only. */
       g_assert (self->owner == NULL);
       g_assert (g_dbus_is_unique_name (g_value_get_string (value)));
-      self->owner = g_value_dup_string (value);
+      self->owner = owner_pool_ref (g_value_get_string (value));
       break;
     case PROP_RESUMABLE:
       mws_schedule_entry_set_resumable (self, g_value_get_boolean (value));
@@ -248,6 +493,24 @@ mws_schedule_entry_set_property (GObject      *object,
     case PROP_PRIORITY:
       mws_schedule_entry_set_priority (self, g_value_get_uint (value));
       break;
+    case PROP_EXPECTED_SIZE:
+      mws_schedule_entry_set_expected_size (self, g_value_get_uint64 (value));
+      break;
+    case PROP_DEADLINE:
+      mws_schedule_entry_set_deadline (self, g_value_get_uint64 (value));
+      break;
+    case PROP_BIND_TO_CONNECTION:
+      mws_schedule_entry_set_bind_to_connection (self, g_value_get_boolean (value));
+      break;
+    case PROP_DOWNLOADED_SIZE:
+      mws_schedule_entry_set_downloaded_size (self, g_value_get_uint64 (value));
+      break;
+    case PROP_CONNECTION_ID:
+    case PROP_MAX_RATE:
+    case PROP_DOWNLOAD_STARTS_AT:
+      /* Read only. */
+      g_assert_not_reached ();
+      break;
     default:
       g_assert_not_reached ();
     }
@@ -287,6 +550,10 @@ mws_schedule_entry_new (const gchar *owner)
  *
  *  * `resumable` (`b`): sets #MwsScheduleEntry:resumable
  *  * `priority` (`u`): sets #MwsScheduleEntry:priority
+ *  * `expected-size` (`t`): sets #MwsScheduleEntry:expected-size (since 0.3.0)
+ *  * `deadline` (`t`): sets #MwsScheduleEntry:deadline (since 0.3.0)
+ *  * `bind-to-connection` (`b`): sets #MwsScheduleEntry:bind-to-connection
+ *    (since 0.3.0)
  *
  * If @parameters is floating, it will be consumed.
  *
@@ -330,6 +597,9 @@ mws_schedule_entry_new_from_variant (const gchar  *owner,
             {
               { "resumable", G_VARIANT_TYPE_BOOLEAN },
               { "priority", G_VARIANT_TYPE_UINT32 },
+              { "expected-size", G_VARIANT_TYPE_UINT64 },
+              { "deadline", G_VARIANT_TYPE_UINT64 },
+              { "bind-to-connection", G_VARIANT_TYPE_BOOLEAN },
             };
 
           for (gsize i = 0; i < G_N_ELEMENTS (supported_properties); i++)
@@ -373,6 +643,106 @@ mws_schedule_entry_new_from_variant (const gchar  *owner,
                                                            (const GValue *) (void *) values->data));
 }
 
+/**
+ * mws_schedule_entry_new_with_id:
+ * @owner: the D-Bus unique name of the peer which owns this entry
+ * @entry_id: ID to give the entry
+ * @parameters: (nullable): #GVariant dictionary mapping parameter names to
+ *    values, or %NULL to ignore
+ * @error: return location for a #GError, or %NULL
+ *
+ * Re-create a #MwsScheduleEntry which was previously saved using
+ * mws_schedule_entry_to_variant(), keeping its ID. This is intended for
+ * restoring entries saved by a previous instance of the daemon. @parameters
+ * are handled as in mws_schedule_entry_new_from_variant().
+ *
+ * So that IDs remain unique, @entry_id must be higher than the ID of any
+ * entry created so far in this process (so entries must be restored in
+ * ascending order of ID, before any new entries are created); otherwise
+ * %MWS_SCHEDULER_ERROR_INVALID_PARAMETERS is returned. Entries created
+ * afterwards will be given higher IDs than @entry_id.
+ *
+ * If @parameters is floating, it will be consumed.
+ *
+ * Returns: (transfer full): a new #MwsScheduleEntry
+ * Since: 0.3.0
+ */
+MwsScheduleEntry *
+mws_schedule_entry_new_with_id (const gchar  *owner,
+                                const gchar  *entry_id,
+                                GVariant     *parameters,
+                                GError      **error)
+{
+  g_return_val_if_fail (g_dbus_is_unique_name (owner), NULL);
+  g_return_val_if_fail (entry_id != NULL, NULL);
+  g_return_val_if_fail (parameters == NULL ||
+                        g_variant_is_of_type (parameters, G_VARIANT_TYPE_VARDICT), NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  g_autoptr(GVariant) parameters_sunk = (parameters != NULL) ? g_variant_ref_sink (parameters) : NULL;
+
+  /* The ID must be the decimal representation of a #guint64, as generated by
+   * mws_schedule_entry_init(). */
+  gchar *endptr = NULL;
+  guint64 id = g_ascii_strtoull (entry_id, &endptr, 10);
+  gboolean id_is_valid = (g_ascii_isdigit (*entry_id) && *endptr == '\0' &&
+                          id < G_MAXUINT64);
+
+  /* Reserve the ID, and all the ones before it. */
+  G_LOCK (entry_id_counter);
+  id_is_valid = id_is_valid && (id >= entry_id_counter);
+  if (id_is_valid)
+    entry_id_counter = id + 1;
+  G_UNLOCK (entry_id_counter);
+
+  if (!id_is_valid)
+    {
+      g_set_error (error, MWS_SCHEDULER_ERROR,
+                   MWS_SCHEDULER_ERROR_INVALID_PARAMETERS,
+                   _("Invalid schedule entry ID ‘%s’"), entry_id);
+      return NULL;
+    }
+
+  g_autoptr(MwsScheduleEntry) entry = NULL;
+  entry = mws_schedule_entry_new_from_variant (owner, parameters_sunk, error);
+  if (entry == NULL)
+    return NULL;
+
+  /* The entry was given the next ID from the counter when it was constructed;
+   * replace it. Nothing can have seen it yet. */
+  g_snprintf (entry->id, sizeof (entry->id), "%" G_GUINT64_FORMAT, id);
+
+  return g_steal_pointer (&entry);
+}
+
+/**
+ * mws_schedule_entry_to_variant:
+ * @self: a #MwsScheduleEntry
+ *
+ * Serialise the scheduling parameters of @self, in the format accepted by
+ * mws_schedule_entry_new_from_variant() and mws_schedule_entry_new_with_id().
+ * The ID, owner and any state set by the scheduler (such as
+ * #MwsScheduleEntry:connection-id) are not included.
+ *
+ * Returns: (transfer floating): a `a{sv}` dictionary of parameters
+ * Since: 0.3.0
+ */
+GVariant *
+mws_schedule_entry_to_variant (MwsScheduleEntry *self)
+{
+  g_return_val_if_fail (MWS_IS_SCHEDULE_ENTRY (self), NULL);
+
+  g_auto(GVariantDict) dict = G_VARIANT_DICT_INIT (NULL);
+
+  g_variant_dict_insert (&dict, "resumable", "b", self->resumable);
+  g_variant_dict_insert (&dict, "priority", "u", self->priority);
+  g_variant_dict_insert (&dict, "expected-size", "t", self->expected_size);
+  g_variant_dict_insert (&dict, "deadline", "t", self->deadline);
+  g_variant_dict_insert (&dict, "bind-to-connection", "b", self->bind_to_connection);
+
+  return g_variant_dict_end (&dict);
+}
+
 /**
  * mws_schedule_entry_get_id:
  * @self: a #MwsScheduleEntry
@@ -389,7 +759,7 @@ mws_schedule_entry_get_id (MwsScheduleEntry *self)
 {
   g_return_val_if_fail (MWS_IS_SCHEDULE_ENTRY (self), NULL);
 
-  g_assert (self->id != NULL && *self->id != '\0');
+  g_assert (*self->id != '\0');
   return self->id;
 }
 
@@ -488,3 +858,293 @@ mws_schedule_entry_set_resumable (MwsScheduleEntry *self,
   self->resumable = resumable;
   g_object_notify (G_OBJECT (self), "resumable");
 }
+
+/**
+ * mws_schedule_entry_get_expected_size:
+ * @self: a #MwsScheduleEntry
+ *
+ * Get the value of #MwsScheduleEntry:expected-size.
+ *
+ * Returns: the expected size of the download, in bytes, or zero if unknown
+ * Since: 0.3.0
+ */
+guint64
+mws_schedule_entry_get_expected_size (MwsScheduleEntry *self)
+{
+  g_return_val_if_fail (MWS_IS_SCHEDULE_ENTRY (self), 0);
+
+  return self->expected_size;
+}
+
+/**
+ * mws_schedule_entry_set_expected_size:
+ * @self: a #MwsScheduleEntry
+ * @expected_size: the expected size of the download, in bytes, or zero if
+ *    unknown
+ *
+ * Set the value of #MwsScheduleEntry:expected-size.
+ *
+ * Since: 0.3.0
+ */
+void
+mws_schedule_entry_set_expected_size (MwsScheduleEntry *self,
+                                      guint64           expected_size)
+{
+  g_return_if_fail (MWS_IS_SCHEDULE_ENTRY (self));
+
+  if (self->expected_size == expected_size)
+    return;
+
+  self->expected_size = expected_size;
+  g_object_notify (G_OBJECT (self), "expected-size");
+}
+
+/**
+ * mws_schedule_entry_get_deadline:
+ * @self: a #MwsScheduleEntry
+ *
+ * Get the value of #MwsScheduleEntry:deadline.
+ *
+ * Returns: the entry’s deadline, in seconds since the Unix epoch, or zero if
+ *    it has none
+ * Since: 0.3.0
+ */
+guint64
+mws_schedule_entry_get_deadline (MwsScheduleEntry *self)
+{
+  g_return_val_if_fail (MWS_IS_SCHEDULE_ENTRY (self), 0);
+
+  return self->deadline;
+}
+
+/**
+ * mws_schedule_entry_set_deadline:
+ * @self: a #MwsScheduleEntry
+ * @deadline: the entry’s deadline, in seconds since the Unix epoch, or zero
+ *    for no deadline
+ *
+ * Set the value of #MwsScheduleEntry:deadline.
+ *
+ * Since: 0.3.0
+ */
+void
+mws_schedule_entry_set_deadline (MwsScheduleEntry *self,
+                                 guint64           deadline)
+{
+  g_return_if_fail (MWS_IS_SCHEDULE_ENTRY (self));
+
+  if (self->deadline == deadline)
+    return;
+
+  self->deadline = deadline;
+  g_object_notify (G_OBJECT (self), "deadline");
+}
+
+/**
+ * mws_schedule_entry_get_bind_to_connection:
+ * @self: a #MwsScheduleEntry
+ *
+ * Get the value of #MwsScheduleEntry:bind-to-connection.
+ *
+ * Returns: %TRUE if the download can be bound to a specific connection,
+ *    %FALSE otherwise
+ * Since: 0.3.0
+ */
+gboolean
+mws_schedule_entry_get_bind_to_connection (MwsScheduleEntry *self)
+{
+  g_return_val_if_fail (MWS_IS_SCHEDULE_ENTRY (self), FALSE);
+
+  return self->bind_to_connection;
+}
+
+/**
+ * mws_schedule_entry_set_bind_to_connection:
+ * @self: a #MwsScheduleEntry
+ * @bind_to_connection: %TRUE if the download can be bound to a specific
+ *    connection, %FALSE otherwise
+ *
+ * Set the value of #MwsScheduleEntry:bind-to-connection.
+ *
+ * Since: 0.3.0
+ */
+void
+mws_schedule_entry_set_bind_to_connection (MwsScheduleEntry *self,
+                                           gboolean          bind_to_connection)
+{
+  g_return_if_fail (MWS_IS_SCHEDULE_ENTRY (self));
+
+  bind_to_connection = !!bind_to_connection;
+
+  if (self->bind_to_connection == bind_to_connection)
+    return;
+
+  self->bind_to_connection = bind_to_connection;
+  g_object_notify (G_OBJECT (self), "bind-to-connection");
+}
+
+/**
+ * mws_schedule_entry_get_connection_id:
+ * @self: a #MwsScheduleEntry
+ *
+ * Get the value of #MwsScheduleEntry:connection-id.
+ *
+ * Returns: (nullable): ID of the network connection chosen for the download,
+ *    or %NULL if none has been chosen
+ * Since: 0.3.0
+ */
+const gchar *
+mws_schedule_entry_get_connection_id (MwsScheduleEntry *self)
+{
+  g_return_val_if_fail (MWS_IS_SCHEDULE_ENTRY (self), NULL);
+
+  return self->connection_id;
+}
+
+/**
+ * mws_schedule_entry_set_connection_id:
+ * @self: a #MwsScheduleEntry
+ * @connection_id: (nullable): ID of the network connection chosen for the
+ *    download, or %NULL to clear it
+ *
+ * Set the value of #MwsScheduleEntry:connection-id. This should only be called
+ * by the #MwsScheduler which the entry belongs to.
+ *
+ * Since: 0.3.0
+ */
+void
+mws_schedule_entry_set_connection_id (MwsScheduleEntry *self,
+                                      const gchar      *connection_id)
+{
+  g_return_if_fail (MWS_IS_SCHEDULE_ENTRY (self));
+
+  if (g_strcmp0 (self->connection_id, connection_id) == 0)
+    return;
+
+  g_free (self->connection_id);
+  self->connection_id = g_strdup (connection_id);
+  g_object_notify (G_OBJECT (self), "connection-id");
+}
+
+/**
+ * mws_schedule_entry_get_max_rate:
+ * @self: a #MwsScheduleEntry
+ *
+ * Get the value of #MwsScheduleEntry:max-rate.
+ *
+ * Returns: maximum rate to download at, in bytes per second, or zero for no
+ *    limit
+ * Since: 0.3.0
+ */
+guint64
+mws_schedule_entry_get_max_rate (MwsScheduleEntry *self)
+{
+  g_return_val_if_fail (MWS_IS_SCHEDULE_ENTRY (self), 0);
+
+  return self->max_rate;
+}
+
+/**
+ * mws_schedule_entry_set_max_rate:
+ * @self: a #MwsScheduleEntry
+ * @max_rate: maximum rate to download at, in bytes per second, or zero for no
+ *    limit
+ *
+ * Set the value of #MwsScheduleEntry:max-rate. This should only be called by
+ * the #MwsScheduler which the entry belongs to.
+ *
+ * Since: 0.3.0
+ */
+void
+mws_schedule_entry_set_max_rate (MwsScheduleEntry *self,
+                                 guint64           max_rate)
+{
+  g_return_if_fail (MWS_IS_SCHEDULE_ENTRY (self));
+
+  if (self->max_rate == max_rate)
+    return;
+
+  self->max_rate = max_rate;
+  g_object_notify (G_OBJECT (self), "max-rate");
+}
+
+/**
+ * mws_schedule_entry_get_download_starts_at:
+ * @self: a #MwsScheduleEntry
+ *
+ * Get the value of #MwsScheduleEntry:download-starts-at.
+ *
+ * Returns: predicted time the download will start, in seconds since the Unix
+ *    epoch, or zero if unknown
+ * Since: 0.3.0
+ */
+guint64
+mws_schedule_entry_get_download_starts_at (MwsScheduleEntry *self)
+{
+  g_return_val_if_fail (MWS_IS_SCHEDULE_ENTRY (self), 0);
+
+  return self->download_starts_at;
+}
+
+/**
+ * mws_schedule_entry_set_download_starts_at:
+ * @self: a #MwsScheduleEntry
+ * @download_starts_at: predicted time the download will start, in seconds
+ *    since the Unix epoch, or zero if unknown
+ *
+ * Set the value of #MwsScheduleEntry:download-starts-at. This should only be
+ * called by the #MwsScheduler which the entry belongs to.
+ *
+ * Since: 0.3.0
+ */
+void
+mws_schedule_entry_set_download_starts_at (MwsScheduleEntry *self,
+                                           guint64           download_starts_at)
+{
+  g_return_if_fail (MWS_IS_SCHEDULE_ENTRY (self));
+
+  if (self->download_starts_at == download_starts_at)
+    return;
+
+  self->download_starts_at = download_starts_at;
+  g_object_notify (G_OBJECT (self), "download-starts-at");
+}
+
+/**
+ * mws_schedule_entry_get_downloaded_size:
+ * @self: a #MwsScheduleEntry
+ *
+ * Get the value of #MwsScheduleEntry:downloaded-size.
+ *
+ * Returns: number of bytes of the download transferred so far
+ * Since: 0.3.0
+ */
+guint64
+mws_schedule_entry_get_downloaded_size (MwsScheduleEntry *self)
+{
+  g_return_val_if_fail (MWS_IS_SCHEDULE_ENTRY (self), 0);
+
+  return self->downloaded_size;
+}
+
+/**
+ * mws_schedule_entry_set_downloaded_size:
+ * @self: a #MwsScheduleEntry
+ * @downloaded_size: number of bytes of the download transferred so far
+ *
+ * Set the value of #MwsScheduleEntry:downloaded-size.
+ *
+ * Since: 0.3.0
+ */
+void
+mws_schedule_entry_set_downloaded_size (MwsScheduleEntry *self,
+                                        guint64           downloaded_size)
+{
+  g_return_if_fail (MWS_IS_SCHEDULE_ENTRY (self));
+
+  if (self->downloaded_size == downloaded_size)
+    return;
+
+  self->downloaded_size = downloaded_size;
+  g_object_notify (G_OBJECT (self), "downloaded-size");
+}
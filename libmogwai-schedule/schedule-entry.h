@@ -49,6 +49,12 @@ MwsScheduleEntry   *mws_schedule_entry_new              (const gchar       *owne
 MwsScheduleEntry   *mws_schedule_entry_new_from_variant (const gchar       *owner,
                                                          GVariant          *parameters,
                                                          GError           **error);
+MwsScheduleEntry   *mws_schedule_entry_new_with_id      (const gchar       *owner,
+                                                         const gchar       *entry_id,
+                                                         GVariant          *parameters,
+                                                         GError           **error);
+
+GVariant           *mws_schedule_entry_to_variant       (MwsScheduleEntry  *self);
 
 const gchar        *mws_schedule_entry_get_id           (MwsScheduleEntry  *self);
 const gchar        *mws_schedule_entry_get_owner        (MwsScheduleEntry  *self);
@@ -59,5 +65,26 @@ void                mws_schedule_entry_set_priority     (MwsScheduleEntry  *self
 gboolean            mws_schedule_entry_get_resumable    (MwsScheduleEntry  *self);
 void                mws_schedule_entry_set_resumable    (MwsScheduleEntry  *self,
                                                          gboolean           resumable);
+guint64             mws_schedule_entry_get_expected_size (MwsScheduleEntry *self);
+void                mws_schedule_entry_set_expected_size (MwsScheduleEntry *self,
+                                                          guint64           expected_size);
+guint64             mws_schedule_entry_get_deadline     (MwsScheduleEntry  *self);
+void                mws_schedule_entry_set_deadline     (MwsScheduleEntry  *self,
+                                                         guint64            deadline);
+gboolean            mws_schedule_entry_get_bind_to_connection (MwsScheduleEntry *self);
+void                mws_schedule_entry_set_bind_to_connection (MwsScheduleEntry *self,
+                                                               gboolean          bind_to_connection);
+const gchar        *mws_schedule_entry_get_connection_id (MwsScheduleEntry *self);
+void                mws_schedule_entry_set_connection_id (MwsScheduleEntry *self,
+                                                          const gchar      *connection_id);
+guint64             mws_schedule_entry_get_max_rate     (MwsScheduleEntry  *self);
+void                mws_schedule_entry_set_max_rate     (MwsScheduleEntry  *self,
+                                                         guint64            max_rate);
+guint64             mws_schedule_entry_get_download_starts_at (MwsScheduleEntry *self);
+void                mws_schedule_entry_set_download_starts_at (MwsScheduleEntry *self,
+                                                               guint64           download_starts_at);
+guint64             mws_schedule_entry_get_downloaded_size (MwsScheduleEntry *self);
+void                mws_schedule_entry_set_downloaded_size (MwsScheduleEntry *self,
+                                                            guint64           downloaded_size);
 
 G_END_DECLS
@@ -27,11 +27,19 @@
 #include <glib-unix.h>
 #include <glib/gi18n-lib.h>
 #include <gio/gio.h>
+#include <libmogwai-schedule/connection-monitor-deferred.h>
+#include <libmogwai-schedule/connection-monitor-nm.h>
+#include <libmogwai-schedule/connection-monitor-nm-dbus.h>
+#include <libmogwai-schedule/latency-histogram.h>
+#include <libmogwai-schedule/metrics-interface.h>
+#include <libmogwai-schedule/object-manager-interface.h>
 #include <libmogwai-schedule/schedule-entry.h>
 #include <libmogwai-schedule/schedule-entry-interface.h>
 #include <libmogwai-schedule/schedule-service.h>
 #include <libmogwai-schedule/scheduler.h>
 #include <libmogwai-schedule/scheduler-interface.h>
+#include <libmogwai-schedule/trace-private.h>
+#include <libmogwai-tariff/tariff-loader.h>
 #include <string.h>
 
 
@@ -96,6 +104,12 @@ static void mws_schedule_service_entry_remove                   (MwsScheduleServ
                                                                  const gchar           *sender,
                                                                  GVariant              *parameters,
                                                                  GDBusMethodInvocation *invocation);
+static void mws_schedule_service_entry_set_properties           (MwsScheduleService    *self,
+                                                                 MwsScheduleEntry      *entry,
+                                                                 GDBusConnection       *connection,
+                                                                 const gchar           *sender,
+                                                                 GVariant              *parameters,
+                                                                 GDBusMethodInvocation *invocation);
 
 static void mws_schedule_service_scheduler_method_call (GDBusConnection       *connection,
                                                         const gchar           *sender,
@@ -136,6 +150,94 @@ static void mws_schedule_service_scheduler_release            (MwsScheduleServic
                                                                const gchar           *sender,
                                                                GVariant              *parameters,
                                                                GDBusMethodInvocation *invocation);
+static void mws_schedule_service_scheduler_subscribe          (MwsScheduleService    *self,
+                                                               GDBusConnection       *connection,
+                                                               const gchar           *sender,
+                                                               GVariant              *parameters,
+                                                               GDBusMethodInvocation *invocation);
+static void mws_schedule_service_scheduler_monitor            (MwsScheduleService    *self,
+                                                               GDBusConnection       *connection,
+                                                               const gchar           *sender,
+                                                               GVariant              *parameters,
+                                                               GDBusMethodInvocation *invocation);
+static void mws_schedule_service_scheduler_update_entries     (MwsScheduleService    *self,
+                                                               GDBusConnection       *connection,
+                                                               const gchar           *sender,
+                                                               GVariant              *parameters,
+                                                               GDBusMethodInvocation *invocation);
+static void mws_schedule_service_scheduler_remove_entries     (MwsScheduleService    *self,
+                                                               GDBusConnection       *connection,
+                                                               const gchar           *sender,
+                                                               GVariant              *parameters,
+                                                               GDBusMethodInvocation *invocation);
+static void mws_schedule_service_scheduler_preview            (MwsScheduleService    *self,
+                                                               GDBusConnection       *connection,
+                                                               const gchar           *sender,
+                                                               GVariant              *parameters,
+                                                               GDBusMethodInvocation *invocation);
+
+static void mws_schedule_service_metrics_method_call (GDBusConnection       *connection,
+                                                      const gchar           *sender,
+                                                      const gchar           *object_path,
+                                                      const gchar           *interface_name,
+                                                      const gchar           *method_name,
+                                                      GVariant              *parameters,
+                                                      GDBusMethodInvocation *invocation,
+                                                      gpointer               user_data);
+
+static void mws_schedule_service_metrics_properties_get     (MwsScheduleService    *self,
+                                                             GDBusConnection       *connection,
+                                                             const gchar           *sender,
+                                                             GVariant              *parameters,
+                                                             GDBusMethodInvocation *invocation);
+static void mws_schedule_service_metrics_properties_set     (MwsScheduleService    *self,
+                                                             GDBusConnection       *connection,
+                                                             const gchar           *sender,
+                                                             GVariant              *parameters,
+                                                             GDBusMethodInvocation *invocation);
+static void mws_schedule_service_metrics_properties_get_all (MwsScheduleService    *self,
+                                                             GDBusConnection       *connection,
+                                                             const gchar           *sender,
+                                                             GVariant              *parameters,
+                                                             GDBusMethodInvocation *invocation);
+static void mws_schedule_service_metrics_get_metrics        (MwsScheduleService    *self,
+                                                             GDBusConnection       *connection,
+                                                             const gchar           *sender,
+                                                             GVariant              *parameters,
+                                                             GDBusMethodInvocation *invocation);
+
+static void mws_schedule_service_object_manager_method_call (GDBusConnection       *connection,
+                                                             const gchar           *sender,
+                                                             const gchar           *object_path,
+                                                             const gchar           *interface_name,
+                                                             const gchar           *method_name,
+                                                             GVariant              *parameters,
+                                                             GDBusMethodInvocation *invocation,
+                                                             gpointer               user_data);
+
+static void mws_schedule_service_object_manager_properties_get     (MwsScheduleService    *self,
+                                                                    GDBusConnection       *connection,
+                                                                    const gchar           *sender,
+                                                                    GVariant              *parameters,
+                                                                    GDBusMethodInvocation *invocation);
+static void mws_schedule_service_object_manager_properties_set     (MwsScheduleService    *self,
+                                                                    GDBusConnection       *connection,
+                                                                    const gchar           *sender,
+                                                                    GVariant              *parameters,
+                                                                    GDBusMethodInvocation *invocation);
+static void mws_schedule_service_object_manager_properties_get_all (MwsScheduleService    *self,
+                                                                    GDBusConnection       *connection,
+                                                                    const gchar           *sender,
+                                                                    GVariant              *parameters,
+                                                                    GDBusMethodInvocation *invocation);
+static void mws_schedule_service_object_manager_get_managed_objects (MwsScheduleService    *self,
+                                                                     GDBusConnection       *connection,
+                                                                     const gchar           *sender,
+                                                                     GVariant              *parameters,
+                                                                     GDBusMethodInvocation *invocation);
+
+static GVariant *entry_properties_to_variant (MwsScheduleService *self,
+                                              MwsScheduleEntry   *entry);
 
 static gboolean mws_schedule_service_hold    (MwsScheduleService  *self,
                                               const gchar         *sender,
@@ -192,6 +294,11 @@ struct _MwsScheduleService
   gchar *object_path;  /* (owned) */
   guint entry_subtree_id;
 
+  /* Scratch buffer for building entry object paths, so that
+   * schedule_entry_to_object_path() doesn’t allocate on every call. It always
+   * starts with @object_path and a ‘/’. */
+  GString *entry_path_buf;  /* (owned) (nullable) */
+
   /* Used to cancel any pending operations when the object is unregistered. */
   GCancellable *cancellable;  /* (owned) */
 
@@ -200,8 +307,54 @@ struct _MwsScheduleService
   /* Maps D-Bus unique names to their reasons for holding the service open,
    * provided in calls to Hold(). */
   GHashTable *hold_reasons;  /* (owned) (element-type utf8 utf8) */
+
+  /* Set of D-Bus unique names of peers which have called
+   * SubscribeActiveEntriesChanged(), and hence are sent a single
+   * ActiveEntriesChanged signal for each change to the set of active entries,
+   * rather than a PropertiesChanged signal for each of their entries. */
+  GHashTable *active_entries_changed_subscribers;  /* (owned) (element-type utf8) */
+
+  /* Set of D-Bus unique names of peers which have called Monitor(), and hence
+   * are sent all the signals about every schedule entry, rather than just
+   * those for the entries they own. This is intended for debugging tools.
+   * Peers are only added once polkit has authorised them for
+   * %MONITOR_ACTION_ID. */
+  GHashTable *monitors;  /* (owned) (element-type utf8) */
+
+  /* Maps D-Bus unique names to the number of entries they’ve asked to schedule
+   * which are waiting for their peer credentials to be looked up, so that
+   * those count towards their quota too (see mws_scheduler_check_quota()). A
+   * peer can otherwise get round its quota by making lots of calls before the
+   * first lookup completes. Peers with no pending entries are not in the map. */
+  GHashTable *pending_entries_by_peer;  /* (owned) (element-type utf8 guint) */
+
+  /* Running counts of the entries in the scheduler, and how many of them are
+   * active, so the Scheduler properties don’t need to examine every entry. */
+  guint32 n_entries;
+  guint32 n_active_entries;
+
+  /* Performance counters, exposed by the
+   * com.endlessm.DownloadManager1.Metrics interface. @peer_credentials_latency
+   * only covers lookups which weren’t already cached. @main_loop_lag is
+   * sampled by @main_loop_lag_source every %MAIN_LOOP_LAG_INTERVAL_MS while
+   * the service is registered. */
+  guint64 n_entries_added;
+  guint64 n_entries_removed;
+  guint64 n_entries_rejected;
+  guint64 n_signals_emitted;
+  MwsLatencyHistogram peer_credentials_latency;
+  MwsLatencyHistogram main_loop_lag;
+  GSource *main_loop_lag_source;  /* (owned) (nullable) */
 };
 
+/* polkit action which a peer must be authorised for before it can see other
+ * peers’ schedule entries using Monitor() or Preview(). */
+#define MONITOR_ACTION_ID "com.endlessm.MogwaiSchedule1.Monitor"
+
+/* How often to sample the main loop lag, in milliseconds. This is long enough
+ * that the wakeups are negligible. */
+#define MAIN_LOOP_LAG_INTERVAL_MS 10000
+
 typedef enum
 {
   PROP_CONNECTION = 1,
@@ -302,6 +455,11 @@ mws_schedule_service_init (MwsScheduleService *self)
   self->cancellable = g_cancellable_new ();
   self->hold_reasons = g_hash_table_new_full (g_str_hash, g_str_equal,
                                               g_free, g_free);
+  self->active_entries_changed_subscribers = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                                    g_free, NULL);
+  self->monitors = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->pending_entries_by_peer = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                         g_free, NULL);
 }
 
 static GPtrArray *
@@ -331,6 +489,16 @@ mws_schedule_service_constructed (GObject *object)
   entries = mws_scheduler_get_entries (self->scheduler);
 
   g_autoptr(GPtrArray) entries_array = hash_table_get_values_as_ptr_array (entries);
+
+  /* Initialise the count of active entries. This is the only time it needs
+   * to be calculated from scratch; it’s updated as entries become active or
+   * inactive after this. */
+  for (gsize i = 0; i < entries_array->len; i++)
+    {
+      if (mws_scheduler_is_entry_active (self->scheduler, entries_array->pdata[i]))
+        self->n_active_entries++;
+    }
+
   entries_changed_cb (self->scheduler, entries_array, NULL, self);
 }
 
@@ -340,6 +508,7 @@ mws_schedule_service_dispose (GObject *object)
   MwsScheduleService *self = MWS_SCHEDULE_SERVICE (object);
 
   g_assert (self->entry_subtree_id == 0);
+  g_assert (self->main_loop_lag_source == NULL);
 
   /* Disconnect from signals from the scheduler, and from any remaining
    * schedule entries. */
@@ -359,6 +528,11 @@ mws_schedule_service_dispose (GObject *object)
 
   g_clear_object (&self->connection);
   g_clear_pointer (&self->object_path, g_free);
+  if (self->entry_path_buf != NULL)
+    {
+      g_string_free (self->entry_path_buf, TRUE);
+      self->entry_path_buf = NULL;
+    }
   g_clear_object (&self->cancellable);
 
   if (self->hold_reasons != NULL &&
@@ -382,6 +556,9 @@ mws_schedule_service_dispose (GObject *object)
         }
     }
   g_clear_pointer (&self->hold_reasons, g_hash_table_unref);
+  g_clear_pointer (&self->active_entries_changed_subscribers, g_hash_table_unref);
+  g_clear_pointer (&self->monitors, g_hash_table_unref);
+  g_clear_pointer (&self->pending_entries_by_peer, g_hash_table_unref);
 
   /* Chain up to the parent class */
   G_OBJECT_CLASS (mws_schedule_service_parent_class)->dispose (object);
@@ -472,11 +649,26 @@ object_path_to_schedule_entry (MwsScheduleService *self,
   return mws_scheduler_get_entry (self->scheduler, object_path);
 }
 
-static gchar *
+/* Get the object path for @entry. The returned string is owned by @self, and
+ * is only valid until the next call to this function, so it must be copied if
+ * it needs to be kept. */
+static const gchar *
 schedule_entry_to_object_path (MwsScheduleService *self,
                                MwsScheduleEntry   *entry)
 {
-  return g_strconcat (self->object_path, "/", mws_schedule_entry_get_id (entry), NULL);
+  gsize prefix_len = strlen (self->object_path) + 1;
+
+  if (self->entry_path_buf == NULL)
+    {
+      self->entry_path_buf = g_string_sized_new (prefix_len + 21);
+      g_string_append (self->entry_path_buf, self->object_path);
+      g_string_append_c (self->entry_path_buf, '/');
+    }
+
+  g_string_truncate (self->entry_path_buf, prefix_len);
+  g_string_append (self->entry_path_buf, mws_schedule_entry_get_id (entry));
+
+  return self->entry_path_buf->str;
 }
 
 static void
@@ -484,27 +676,11 @@ count_entries (MwsScheduleService *self,
                guint32            *out_entry_count,
                guint32            *out_active_entry_count)
 {
-  GHashTable *entries;  /* (element-type utf8 MwsScheduleEntry) */
-  entries = mws_scheduler_get_entries (self->scheduler);
-
-  GHashTableIter iter;
-  gpointer value;
-  guint32 active_entries = 0;
-
   g_assert (out_entry_count != NULL);
   g_assert (out_active_entry_count != NULL);
 
-  g_hash_table_iter_init (&iter, entries);
-  while (g_hash_table_iter_next (&iter, NULL, &value))
-    {
-      MwsScheduleEntry *entry = MWS_SCHEDULE_ENTRY (value);
-
-      if (mws_scheduler_is_entry_active (self->scheduler, entry))
-        active_entries++;
-    }
-
-  *out_entry_count = (guint32) g_hash_table_size (entries);
-  *out_active_entry_count = active_entries;
+  *out_entry_count = self->n_entries;
+  *out_active_entry_count = self->n_active_entries;
 
   g_assert (*out_active_entry_count <= *out_entry_count);
 }
@@ -556,6 +732,113 @@ notify_scheduler_properties (MwsScheduleService *self,
   if (local_error != NULL)
     g_debug ("Error emitting PropertiesChanged signal: %s",
              local_error->message);
+  else
+    self->n_signals_emitted++;
+}
+
+/* Emit a signal about @entry from @object_path. Signals about an entry are only
+ * of interest to its owner, so they are unicast to it rather than broadcast, to
+ * avoid waking up every other peer on the bus. They are also unicast to any
+ * monitors (see Monitor()). */
+static void
+emit_entry_signal_from_path (MwsScheduleService *self,
+                             MwsScheduleEntry   *entry,
+                             const gchar        *object_path,
+                             const gchar        *interface_name,
+                             const gchar        *signal_name,
+                             GVariant           *parameters)
+{
+  const gchar *owner = mws_schedule_entry_get_owner (entry);
+  g_autoptr(GVariant) parameters_sunk = (parameters != NULL) ? g_variant_ref_sink (parameters) : NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  g_dbus_connection_emit_signal (self->connection,
+                                 owner,
+                                 object_path,
+                                 interface_name,
+                                 signal_name,
+                                 parameters_sunk,
+                                 &local_error);
+  if (local_error != NULL)
+    g_debug ("Error emitting %s signal for ‘%s’: %s",
+             signal_name, object_path, local_error->message);
+  else
+    self->n_signals_emitted++;
+
+  GHashTableIter iter;
+  gpointer key;
+
+  g_hash_table_iter_init (&iter, self->monitors);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      const gchar *monitor = key;
+
+      if (g_str_equal (monitor, owner))
+        continue;
+
+      g_clear_error (&local_error);
+      g_dbus_connection_emit_signal (self->connection,
+                                     monitor,
+                                     object_path,
+                                     interface_name,
+                                     signal_name,
+                                     parameters_sunk,
+                                     &local_error);
+      if (local_error != NULL)
+        g_debug ("Error emitting %s signal for ‘%s’ to monitor ‘%s’: %s",
+                 signal_name, object_path, monitor, local_error->message);
+      else
+        self->n_signals_emitted++;
+    }
+}
+
+/* Emit a signal from @entry’s object. */
+static void
+emit_entry_signal (MwsScheduleService *self,
+                   MwsScheduleEntry   *entry,
+                   const gchar        *interface_name,
+                   const gchar        *signal_name,
+                   GVariant           *parameters)
+{
+  emit_entry_signal_from_path (self, entry,
+                               schedule_entry_to_object_path (self, entry),
+                               interface_name, signal_name, parameters);
+}
+
+/* Emit an org.freedesktop.DBus.ObjectManager signal from the root object about
+ * @entry being added or removed, so clients which listed the entries with
+ * GetManagedObjects() can keep their view up to date. Like the other entry
+ * signals, these are only sent to the owner of @entry and to authorised
+ * monitors, matching what GetManagedObjects() returns to each peer. */
+static void
+emit_interfaces_added (MwsScheduleService *self,
+                       MwsScheduleEntry   *entry)
+{
+  g_auto(GVariantBuilder) interfaces_builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("a{sa{sv}}"));
+  g_variant_builder_add (&interfaces_builder, "{s@a{sv}}",
+                         "com.endlessm.DownloadManager1.ScheduleEntry",
+                         entry_properties_to_variant (self, entry));
+
+  emit_entry_signal_from_path (self, entry, self->object_path,
+                               "org.freedesktop.DBus.ObjectManager",
+                               "InterfacesAdded",
+                               g_variant_new ("(o@a{sa{sv}})",
+                                              schedule_entry_to_object_path (self, entry),
+                                              g_variant_builder_end (&interfaces_builder)));
+}
+
+static void
+emit_interfaces_removed (MwsScheduleService *self,
+                         MwsScheduleEntry   *entry)
+{
+  const gchar *interfaces[] = { "com.endlessm.DownloadManager1.ScheduleEntry", NULL };
+
+  emit_entry_signal_from_path (self, entry, self->object_path,
+                               "org.freedesktop.DBus.ObjectManager",
+                               "InterfacesRemoved",
+                               g_variant_new ("(o^as)",
+                                              schedule_entry_to_object_path (self, entry),
+                                              interfaces));
 }
 
 static void
@@ -566,12 +849,24 @@ entries_changed_cb (MwsScheduler *scheduler,
 {
   MwsScheduleService *self = MWS_SCHEDULE_SERVICE (user_data);
 
+  /* Update the running count of entries. */
+  if (removed != NULL)
+    {
+      g_assert (self->n_entries >= removed->len);
+      self->n_entries -= removed->len;
+    }
+  if (added != NULL)
+    self->n_entries += added->len;
+
+  self->n_entries_removed += (removed != NULL) ? removed->len : 0;
+  self->n_entries_added += (added != NULL) ? added->len : 0;
+
   /* Update signal subscriptions for the added and removed entries. */
   for (gsize i = 0; removed != NULL && i < removed->len; i++)
     {
       MwsScheduleEntry *entry = MWS_SCHEDULE_ENTRY (removed->pdata[i]);
 
-      g_message ("Removing schedule entry ‘%s’.", mws_schedule_entry_get_id (entry));
+      g_debug ("Removing schedule entry ‘%s’.", mws_schedule_entry_get_id (entry));
 
       g_signal_handlers_disconnect_by_data (entry, self);
     }
@@ -580,7 +875,7 @@ entries_changed_cb (MwsScheduler *scheduler,
     {
       MwsScheduleEntry *entry = MWS_SCHEDULE_ENTRY (added->pdata[i]);
 
-      g_message ("Adding schedule entry ‘%s’.", mws_schedule_entry_get_id (entry));
+      g_debug ("Adding schedule entry ‘%s’.", mws_schedule_entry_get_id (entry));
 
       g_signal_connect (entry, "notify",
                         (GCallback) entry_notify_cb, self);
@@ -590,20 +885,20 @@ entries_changed_cb (MwsScheduler *scheduler,
   for (gsize i = 0; removed != NULL && i < removed->len; i++)
     {
       MwsScheduleEntry *entry = MWS_SCHEDULE_ENTRY (removed->pdata[i]);
-      g_autoptr(GError) local_error = NULL;
 
-      g_autofree gchar *entry_path = schedule_entry_to_object_path (self, entry);
+      emit_entry_signal (self, entry,
+                         "com.endlessm.DownloadManager1.ScheduleEntry",
+                         "Removed",
+                         NULL  /* no arguments */);
+      emit_interfaces_removed (self, entry);
+    }
 
-      g_dbus_connection_emit_signal (self->connection,
-                                     mws_schedule_entry_get_owner (entry),
-                                     entry_path,
-                                     "com.endlessm.DownloadManager1.ScheduleEntry",
-                                     "Removed",
-                                     NULL,  /* no arguments */
-                                     &local_error);
-      if (local_error != NULL)
-        g_debug ("Error emitting Removed signal for ‘%s’: %s",
-                 entry_path, local_error->message);
+  /* Emit InterfacesAdded signals for entries. */
+  for (gsize i = 0; added != NULL && i < added->len; i++)
+    {
+      MwsScheduleEntry *entry = MWS_SCHEDULE_ENTRY (added->pdata[i]);
+
+      emit_interfaces_added (self, entry);
     }
 
   /* The com.endlessm.DownloadManager1.Scheduler properties potentially changed */
@@ -619,41 +914,82 @@ entries_changed_cb (MwsScheduler *scheduler,
 
 static void
 emit_download_now_changed (MwsScheduleService *self,
-                           GPtrArray          *entries,
+                           MwsScheduleEntry   *entry,
                            gboolean            download_now)
 {
   g_auto(GVariantDict) changed_properties_dict = G_VARIANT_DICT_INIT (NULL);
   g_variant_dict_insert (&changed_properties_dict,
                          "DownloadNow", "b", download_now);
 
-  g_autoptr(GVariant) parameters = NULL;
-  parameters = g_variant_ref_sink (
-      g_variant_new ("(s@a{sv}as)",
-                     "com.endlessm.DownloadManager1.ScheduleEntry",
-                     g_variant_dict_end (&changed_properties_dict),
-                     NULL));
+  emit_entry_signal (self, entry,
+                     "org.freedesktop.DBus.Properties",
+                     "PropertiesChanged",
+                     g_variant_new ("(s@a{sv}as)",
+                                    "com.endlessm.DownloadManager1.ScheduleEntry",
+                                    g_variant_dict_end (&changed_properties_dict),
+                                    NULL));
+}
+
+/* The entries for a single owner which have changed state in one
+ * #MwsScheduler::active-entries-changed emission, to be sent in an
+ * ActiveEntriesChanged signal. */
+typedef struct
+{
+  GPtrArray *added_paths;  /* (owned) (element-type utf8) */
+  GPtrArray *removed_paths;  /* (owned) (element-type utf8) */
+} ActiveEntriesBatch;
+
+static ActiveEntriesBatch *
+active_entries_batch_new (void)
+{
+  ActiveEntriesBatch *batch = g_new0 (ActiveEntriesBatch, 1);
+  batch->added_paths = g_ptr_array_new_with_free_func (g_free);
+  batch->removed_paths = g_ptr_array_new_with_free_func (g_free);
+  return batch;
+}
+
+static void
+active_entries_batch_free (ActiveEntriesBatch *batch)
+{
+  g_clear_pointer (&batch->added_paths, g_ptr_array_unref);
+  g_clear_pointer (&batch->removed_paths, g_ptr_array_unref);
+  g_free (batch);
+}
 
+/* Signal that @entries have changed state to @download_now. That’s done with
+ * a PropertiesChanged signal per entry, unless the entry’s owner has
+ * subscribed to ActiveEntriesChanged, in which case the entry is added to the
+ * owner’s batch in @batches, to be emitted later. */
+static void
+queue_download_now_changed (MwsScheduleService *self,
+                            GHashTable         *batches,
+                            GPtrArray          *entries,
+                            gboolean            download_now)
+{
   for (gsize i = 0; entries != NULL && i < entries->len; i++)
     {
       MwsScheduleEntry *entry = MWS_SCHEDULE_ENTRY (entries->pdata[i]);
-      g_autoptr(GError) local_error = NULL;
+      const gchar *owner = mws_schedule_entry_get_owner (entry);
 
-      g_message ("Notifying entry ‘%s’ as %s.",
-                 mws_schedule_entry_get_id (entry),
-                 download_now ? "active" : "inactive");
+      g_debug ("Notifying entry ‘%s’ as %s.",
+               mws_schedule_entry_get_id (entry),
+               download_now ? "active" : "inactive");
 
-      g_autofree gchar *entry_path = schedule_entry_to_object_path (self, entry);
+      if (!g_hash_table_contains (self->active_entries_changed_subscribers, owner))
+        {
+          emit_download_now_changed (self, entry, download_now);
+          continue;
+        }
 
-      g_dbus_connection_emit_signal (self->connection,
-                                     mws_schedule_entry_get_owner (entry),
-                                     entry_path,
-                                     "org.freedesktop.DBus.Properties",
-                                     "PropertiesChanged",
-                                     parameters,
-                                     &local_error);
-      if (local_error != NULL)
-        g_debug ("Error emitting PropertiesChanged signal: %s",
-                 local_error->message);
+      ActiveEntriesBatch *batch = g_hash_table_lookup (batches, owner);
+      if (batch == NULL)
+        {
+          batch = active_entries_batch_new ();
+          g_hash_table_insert (batches, (gpointer) owner, batch);
+        }
+
+      g_ptr_array_add (download_now ? batch->added_paths : batch->removed_paths,
+                       g_strdup (schedule_entry_to_object_path (self, entry)));
     }
 }
 
@@ -665,13 +1001,57 @@ active_entries_changed_cb (MwsScheduler *scheduler,
 {
   MwsScheduleService *self = MWS_SCHEDULE_SERVICE (user_data);
 
+  /* Update the running count of active entries. */
+  if (removed != NULL)
+    {
+      g_assert (self->n_active_entries >= removed->len);
+      self->n_active_entries -= removed->len;
+    }
+  if (added != NULL)
+    self->n_active_entries += added->len;
+
+  /* Mapping from owner to the batch of changes to emit to it. The owners are
+   * owned by the entries in @added and @removed. */
+  g_autoptr(GHashTable) batches = NULL;
+  batches = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                   NULL, (GDestroyNotify) active_entries_batch_free);
+
   /* These entries have become inactive (told to stop downloading).
    * Signal that on the bus. */
-  emit_download_now_changed (self, removed, FALSE);
+  queue_download_now_changed (self, batches, removed, FALSE);
 
   /* These entries have become active (told they can start downloading).
    * Signal that on the bus. */
-  emit_download_now_changed (self, added, TRUE);
+  queue_download_now_changed (self, batches, added, TRUE);
+
+  /* Emit one ActiveEntriesChanged signal to each subscribed owner. */
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_hash_table_iter_init (&iter, batches);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      const gchar *owner = key;
+      ActiveEntriesBatch *batch = value;
+      g_autoptr(GError) local_error = NULL;
+
+      g_dbus_connection_emit_signal (self->connection,
+                                     owner,
+                                     self->object_path,
+                                     "com.endlessm.DownloadManager1.Scheduler",
+                                     "ActiveEntriesChanged",
+                                     g_variant_new ("(@ao@ao)",
+                                                    g_variant_new_objv ((const gchar * const *) batch->added_paths->pdata,
+                                                                        batch->added_paths->len),
+                                                    g_variant_new_objv ((const gchar * const *) batch->removed_paths->pdata,
+                                                                        batch->removed_paths->len)),
+                                     &local_error);
+      if (local_error != NULL)
+        g_debug ("Error emitting ActiveEntriesChanged signal to ‘%s’: %s",
+                 owner, local_error->message);
+      else
+        self->n_signals_emitted++;
+    }
 
   /* The com.endlessm.DownloadManager1.Scheduler properties potentially changed */
   if (((added == NULL) != (removed == NULL)) ||
@@ -693,6 +1073,15 @@ allow_downloads_changed_cb (GObject    *obj,
   notify_scheduler_properties (self, FALSE, TRUE);
 }
 
+/* The Connection property of an entry, which is the empty string if no
+ * connection has been chosen for it. */
+static const gchar *
+entry_connection_id (MwsScheduleEntry *entry)
+{
+  const gchar *connection_id = mws_schedule_entry_get_connection_id (entry);
+  return (connection_id != NULL) ? connection_id : "";
+}
+
 static void
 entry_notify_cb (GObject    *obj,
                  GParamSpec *pspec,
@@ -700,7 +1089,6 @@ entry_notify_cb (GObject    *obj,
 {
   MwsScheduleService *self = MWS_SCHEDULE_SERVICE (user_data);
   MwsScheduleEntry *entry = MWS_SCHEDULE_ENTRY (obj);
-  g_autoptr(GError) local_error = NULL;
 
   /* Propagate the signal as a D-Bus signal. */
   const gchar *property_name = g_param_spec_get_name (pspec);
@@ -712,28 +1100,41 @@ entry_notify_cb (GObject    *obj,
   else if (g_str_equal (property_name, "resumable"))
     g_variant_dict_insert (&changed_properties_dict,
                            "Resumable", "b", mws_schedule_entry_get_resumable (entry));
+  else if (g_str_equal (property_name, "expected-size"))
+    g_variant_dict_insert (&changed_properties_dict,
+                           "ExpectedSize", "t", mws_schedule_entry_get_expected_size (entry));
+  else if (g_str_equal (property_name, "deadline"))
+    g_variant_dict_insert (&changed_properties_dict,
+                           "Deadline", "t", mws_schedule_entry_get_deadline (entry));
+  else if (g_str_equal (property_name, "bind-to-connection"))
+    g_variant_dict_insert (&changed_properties_dict,
+                           "BindToConnection", "b",
+                           mws_schedule_entry_get_bind_to_connection (entry));
+  else if (g_str_equal (property_name, "connection-id"))
+    g_variant_dict_insert (&changed_properties_dict,
+                           "Connection", "s", entry_connection_id (entry));
+  else if (g_str_equal (property_name, "max-rate"))
+    g_variant_dict_insert (&changed_properties_dict,
+                           "MaxRate", "t", mws_schedule_entry_get_max_rate (entry));
+  else if (g_str_equal (property_name, "downloaded-size"))
+    g_variant_dict_insert (&changed_properties_dict,
+                           "DownloadedSize", "t",
+                           mws_schedule_entry_get_downloaded_size (entry));
+  else if (g_str_equal (property_name, "download-starts-at"))
+    g_variant_dict_insert (&changed_properties_dict,
+                           "DownloadStartsAt", "t",
+                           mws_schedule_entry_get_download_starts_at (entry));
   else
     /* Unrecognised property. */
     return;
 
-  g_autofree gchar *entry_path = schedule_entry_to_object_path (self, entry);
-
-  g_autoptr(GVariant) parameters = NULL;
-  parameters = g_variant_ref_sink (
-      g_variant_new ("(s@a{sv}as)",
-                     "com.endlessm.DownloadManager1.ScheduleEntry",
-                     g_variant_dict_end (&changed_properties_dict),
-                     NULL));
-  g_dbus_connection_emit_signal (self->connection,
-                                 NULL,  /* broadcast */
-                                 entry_path,
-                                 "org.freedesktop.DBus.Properties",
-                                 "PropertiesChanged",
-                                 parameters,
-                                 &local_error);
-  if (local_error != NULL)
-    g_debug ("Error emitting PropertiesChanged signal: %s",
-             local_error->message);
+  emit_entry_signal (self, entry,
+                     "org.freedesktop.DBus.Properties",
+                     "PropertiesChanged",
+                     g_variant_new ("(s@a{sv}as)",
+                                    "com.endlessm.DownloadManager1.ScheduleEntry",
+                                    g_variant_dict_end (&changed_properties_dict),
+                                    NULL));
 }
 
 static void
@@ -746,11 +1147,28 @@ peer_vanished_cb (MwsPeerManager *manager,
 
   g_debug ("%s: Peer ‘%s’ vanished", G_STRFUNC, name);
 
+  g_hash_table_remove (self->active_entries_changed_subscribers, name);
+  g_hash_table_remove (self->monitors, name);
+
   if (!mws_schedule_service_release (self, name, &local_error))
     g_debug ("Error releasing service for peer ‘%s’: %s",
              name, local_error->message);
 }
 
+/* Record how late @main_loop_lag_source was dispatched, which is how long the
+ * main loop was busy (or blocked) when it should have been dispatching it. */
+static gboolean
+main_loop_lag_cb (gpointer user_data)
+{
+  MwsScheduleService *self = MWS_SCHEDULE_SERVICE (user_data);
+  gint64 expected_usec = g_source_get_ready_time (self->main_loop_lag_source);
+
+  mws_latency_histogram_record (&self->main_loop_lag,
+                                g_get_monotonic_time () - expected_usec);
+
+  return G_SOURCE_CONTINUE;
+}
+
 /**
  * mws_schedule_service_register:
  * @self: a #MwsScheduleService
@@ -792,6 +1210,11 @@ mws_schedule_service_register (MwsScheduleService  *self,
 
   self->entry_subtree_id = id;
 
+  /* Start sampling the main loop lag. */
+  self->main_loop_lag_source = g_timeout_source_new (MAIN_LOOP_LAG_INTERVAL_MS);
+  g_source_set_callback (self->main_loop_lag_source, main_loop_lag_cb, self, NULL);
+  g_source_attach (self->main_loop_lag_source, NULL);
+
   /* This has potentially changed. */
   g_object_notify (G_OBJECT (self), "busy");
 
@@ -817,6 +1240,12 @@ mws_schedule_service_unregister (MwsScheduleService *self)
                                         self->entry_subtree_id);
   self->entry_subtree_id = 0;
 
+  if (self->main_loop_lag_source != NULL)
+    {
+      g_source_destroy (self->main_loop_lag_source);
+      g_clear_pointer (&self->main_loop_lag_source, g_source_unref);
+    }
+
   /* This has potentially changed. */
   g_object_notify (G_OBJECT (self), "busy");
 }
@@ -867,10 +1296,12 @@ mws_schedule_service_entry_introspect (GDBusConnection *connection,
 
   if (node == NULL)
     {
-      /* The root node implements Scheduler only. */
-      interfaces = g_new0 (GDBusInterfaceInfo *, 2);
+      /* The root node implements Scheduler, Metrics and ObjectManager. */
+      interfaces = g_new0 (GDBusInterfaceInfo *, 4);
       interfaces[0] = (GDBusInterfaceInfo *) &scheduler_interface;
-      interfaces[1] = NULL;
+      interfaces[1] = (GDBusInterfaceInfo *) &metrics_interface;
+      interfaces[2] = (GDBusInterfaceInfo *) &object_manager_interface;
+      interfaces[3] = NULL;
     }
   else if (object_path_to_schedule_entry (self, node) != NULL)
     {
@@ -906,17 +1337,42 @@ mws_schedule_service_entry_dispatch (GDBusConnection *connection,
       NULL,  /* handled in mws_schedule_service_scheduler_method_call() */
       NULL,  /* handled in mws_schedule_service_scheduler_method_call() */
     };
+  static const GDBusInterfaceVTable metrics_interface_vtable =
+    {
+      mws_schedule_service_metrics_method_call,
+      NULL,  /* handled in mws_schedule_service_metrics_method_call() */
+      NULL,  /* handled in mws_schedule_service_metrics_method_call() */
+    };
+  static const GDBusInterfaceVTable object_manager_interface_vtable =
+    {
+      mws_schedule_service_object_manager_method_call,
+      NULL,  /* handled in mws_schedule_service_object_manager_method_call() */
+      NULL,  /* handled in mws_schedule_service_object_manager_method_call() */
+    };
 
   /* Don’t implement any permissions checks here, as they should be specific to
    * the APIs being called and objects being accessed. */
 
-  /* Scheduler is implemented on the root of the tree. */
+  /* Scheduler, Metrics and ObjectManager are implemented on the root of the
+   * tree. */
   if (node == NULL &&
       g_str_equal (interface_name, "com.endlessm.DownloadManager1.Scheduler"))
     {
       *out_user_data = user_data;
       return &scheduler_interface_vtable;
     }
+  else if (node == NULL &&
+           g_str_equal (interface_name, "com.endlessm.DownloadManager1.Metrics"))
+    {
+      *out_user_data = user_data;
+      return &metrics_interface_vtable;
+    }
+  else if (node == NULL &&
+           g_str_equal (interface_name, "org.freedesktop.DBus.ObjectManager"))
+    {
+      *out_user_data = user_data;
+      return &object_manager_interface_vtable;
+    }
   else if (node == NULL)
     {
       return NULL;
@@ -963,6 +1419,8 @@ schedule_entry_methods[] =
     /* Schedule entry methods. */
     { "com.endlessm.DownloadManager1.ScheduleEntry", "Remove",
       mws_schedule_service_entry_remove },
+    { "com.endlessm.DownloadManager1.ScheduleEntry", "SetProperties",
+      mws_schedule_service_entry_set_properties },
   };
 
 G_STATIC_ASSERT (G_N_ELEMENTS (schedule_entry_methods) ==
@@ -1008,8 +1466,10 @@ mws_schedule_service_entry_method_call (GDBusConnection       *connection,
       if (g_str_equal (schedule_entry_methods[i].interface_name, interface_name) &&
           g_str_equal (schedule_entry_methods[i].method_name, method_name))
         {
+          MWS_TRACE3 (dbus_method_start, sender, interface_name, method_name);
           schedule_entry_methods[i].func (self, entry, connection, sender,
                                           parameters, invocation);
+          MWS_TRACE1 (dbus_method_end, method_name);
           return;
         }
     }
@@ -1060,6 +1520,20 @@ mws_schedule_service_entry_properties_get (MwsScheduleService    *self,
         value = g_variant_new_boolean (mws_schedule_entry_get_resumable (entry));
       else if (g_str_equal (property_name, "Priority"))
         value = g_variant_new_uint32 (mws_schedule_entry_get_priority (entry));
+      else if (g_str_equal (property_name, "ExpectedSize"))
+        value = g_variant_new_uint64 (mws_schedule_entry_get_expected_size (entry));
+      else if (g_str_equal (property_name, "Deadline"))
+        value = g_variant_new_uint64 (mws_schedule_entry_get_deadline (entry));
+      else if (g_str_equal (property_name, "BindToConnection"))
+        value = g_variant_new_boolean (mws_schedule_entry_get_bind_to_connection (entry));
+      else if (g_str_equal (property_name, "Connection"))
+        value = g_variant_new_string (entry_connection_id (entry));
+      else if (g_str_equal (property_name, "MaxRate"))
+        value = g_variant_new_uint64 (mws_schedule_entry_get_max_rate (entry));
+      else if (g_str_equal (property_name, "DownloadedSize"))
+        value = g_variant_new_uint64 (mws_schedule_entry_get_downloaded_size (entry));
+      else if (g_str_equal (property_name, "DownloadStartsAt"))
+        value = g_variant_new_uint64 (mws_schedule_entry_get_download_starts_at (entry));
       else if (g_str_equal (property_name, "DownloadNow"))
         value = g_variant_new_boolean (mws_scheduler_is_entry_active (self->scheduler, entry));
     }
@@ -1074,6 +1548,78 @@ mws_schedule_service_entry_properties_get (MwsScheduleService    *self,
                                            interface_name, property_name);
 }
 
+/* Check whether @value is a valid new value for the writeable property
+ * @property_name on the com.endlessm.DownloadManager1.ScheduleEntry interface.
+ * If not, a #GDBusError is set which is suitable for returning to the peer.
+ * Use set_entry_property() to apply the value once it’s checked. */
+static gboolean
+check_entry_property (const gchar  *property_name,
+                      GVariant     *value,
+                      GError      **error)
+{
+  const GVariantType *expected_type = NULL;
+
+  if (g_str_equal (property_name, "Resumable") ||
+      g_str_equal (property_name, "BindToConnection"))
+    expected_type = G_VARIANT_TYPE_BOOLEAN;
+  else if (g_str_equal (property_name, "Priority"))
+    expected_type = G_VARIANT_TYPE_UINT32;
+  else if (g_str_equal (property_name, "ExpectedSize") ||
+           g_str_equal (property_name, "Deadline") ||
+           g_str_equal (property_name, "DownloadedSize"))
+    expected_type = G_VARIANT_TYPE_UINT64;
+  else if (g_str_equal (property_name, "DownloadNow") ||
+           g_str_equal (property_name, "Connection") ||
+           g_str_equal (property_name, "MaxRate") ||
+           g_str_equal (property_name, "DownloadStartsAt"))
+    {
+      g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_PROPERTY_READ_ONLY,
+                   _("Attribute ‘%s.%s’ is read-only."),
+                   "com.endlessm.DownloadManager1.ScheduleEntry", property_name);
+      return FALSE;
+    }
+  else
+    {
+      g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY,
+                   _("Unknown property ‘%s.%s’."),
+                   "com.endlessm.DownloadManager1.ScheduleEntry", property_name);
+      return FALSE;
+    }
+
+  if (!g_variant_is_of_type (value, expected_type))
+    {
+      g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_SIGNATURE,
+                   _("Invalid type value for property ‘%s.%s’."),
+                   "com.endlessm.DownloadManager1.ScheduleEntry", property_name);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Apply a property value which has already been checked using
+ * check_entry_property(). */
+static void
+set_entry_property (MwsScheduleEntry *entry,
+                    const gchar      *property_name,
+                    GVariant         *value)
+{
+  if (g_str_equal (property_name, "Resumable"))
+    mws_schedule_entry_set_resumable (entry, g_variant_get_boolean (value));
+  else if (g_str_equal (property_name, "Priority"))
+    mws_schedule_entry_set_priority (entry, g_variant_get_uint32 (value));
+  else if (g_str_equal (property_name, "ExpectedSize"))
+    mws_schedule_entry_set_expected_size (entry, g_variant_get_uint64 (value));
+  else if (g_str_equal (property_name, "Deadline"))
+    mws_schedule_entry_set_deadline (entry, g_variant_get_uint64 (value));
+  else if (g_str_equal (property_name, "BindToConnection"))
+    mws_schedule_entry_set_bind_to_connection (entry, g_variant_get_boolean (value));
+  else if (g_str_equal (property_name, "DownloadedSize"))
+    mws_schedule_entry_set_downloaded_size (entry, g_variant_get_uint64 (value));
+  else
+    g_assert_not_reached ();
+}
+
 static void
 mws_schedule_service_entry_properties_set (MwsScheduleService    *self,
                                            MwsScheduleEntry      *entry,
@@ -1084,6 +1630,7 @@ mws_schedule_service_entry_properties_set (MwsScheduleService    *self,
 {
   const gchar *interface_name, *property_name;
   g_autoptr(GVariant) value = NULL;
+  g_autoptr(GError) local_error = NULL;
   g_variant_get (parameters, "(&s&sv)", &interface_name, &property_name, &value);
 
   /* D-Bus property names can be anything. */
@@ -1091,51 +1638,52 @@ mws_schedule_service_entry_properties_set (MwsScheduleService    *self,
     return;
 
   /* Try the property. */
-  gboolean read_only = FALSE, type_error = FALSE, handled = FALSE;
-
-  if (g_str_equal (interface_name, "com.endlessm.DownloadManager1.ScheduleEntry"))
-    {
-      if (g_str_equal (property_name, "Resumable"))
-        {
-          if (g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
-            {
-              mws_schedule_entry_set_resumable (entry, g_variant_get_boolean (value));
-              handled = TRUE;
-            }
-          else
-            type_error = TRUE;
-        }
-      else if (g_str_equal (property_name, "Priority"))
-        {
-          if (g_variant_is_of_type (value, G_VARIANT_TYPE_UINT32))
-            {
-              mws_schedule_entry_set_priority (entry, g_variant_get_uint32 (value));
-              handled = TRUE;
-            }
-          else
-            type_error = TRUE;
-        }
-      else if (g_str_equal (property_name, "DownloadNow"))
-        read_only = TRUE;
-    }
-
-  if (read_only)
-    g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
-                                           G_DBUS_ERROR_PROPERTY_READ_ONLY,
-                                           _("Attribute ‘%s.%s’ is read-only."),
-                                           interface_name, property_name);
-  else if (type_error)
-    g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
-                                           G_DBUS_ERROR_INVALID_SIGNATURE,
-                                           _("Invalid type value for property ‘%s.%s’."),
-                                           interface_name, property_name);
-  else if (handled)
-    g_dbus_method_invocation_return_value (invocation, NULL);
-  else
+  if (!g_str_equal (interface_name, "com.endlessm.DownloadManager1.ScheduleEntry"))
     g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
                                            G_DBUS_ERROR_UNKNOWN_PROPERTY,
                                            _("Unknown property ‘%s.%s’."),
                                            interface_name, property_name);
+  else if (!check_entry_property (property_name, value, &local_error))
+    g_dbus_method_invocation_return_gerror (invocation, local_error);
+  else
+    {
+      set_entry_property (entry, property_name, value);
+      g_dbus_method_invocation_return_value (invocation, NULL);
+    }
+}
+
+/* Build an `a{sv}` of all the properties on the
+ * com.endlessm.DownloadManager1.ScheduleEntry interface for @entry, as
+ * returned by GetAll() and ScheduleEntriesFull(). The returned variant is
+ * floating. */
+static GVariant *
+entry_properties_to_variant (MwsScheduleService *self,
+                             MwsScheduleEntry   *entry)
+{
+  g_autoptr(GVariantDict) dict = g_variant_dict_new (NULL);
+
+  g_variant_dict_insert (dict, "Resumable",
+                         "b", mws_schedule_entry_get_resumable (entry));
+  g_variant_dict_insert (dict, "Priority",
+                         "u", mws_schedule_entry_get_priority (entry));
+  g_variant_dict_insert (dict, "ExpectedSize",
+                         "t", mws_schedule_entry_get_expected_size (entry));
+  g_variant_dict_insert (dict, "Deadline",
+                         "t", mws_schedule_entry_get_deadline (entry));
+  g_variant_dict_insert (dict, "BindToConnection",
+                         "b", mws_schedule_entry_get_bind_to_connection (entry));
+  g_variant_dict_insert (dict, "Connection",
+                         "s", entry_connection_id (entry));
+  g_variant_dict_insert (dict, "MaxRate",
+                         "t", mws_schedule_entry_get_max_rate (entry));
+  g_variant_dict_insert (dict, "DownloadedSize",
+                         "t", mws_schedule_entry_get_downloaded_size (entry));
+  g_variant_dict_insert (dict, "DownloadStartsAt",
+                         "t", mws_schedule_entry_get_download_starts_at (entry));
+  g_variant_dict_insert (dict, "DownloadNow",
+                         "b", mws_scheduler_is_entry_active (self->scheduler, entry));
+
+  return g_variant_dict_end (dict);
 }
 
 static void
@@ -1153,24 +1701,10 @@ mws_schedule_service_entry_properties_get_all (MwsScheduleService    *self,
     return;
 
   /* Try the interface. */
-  g_autoptr(GVariantDict) dict = NULL;
-
   if (g_str_equal (interface_name, "com.endlessm.DownloadManager1.ScheduleEntry"))
-    {
-      dict = g_variant_dict_new (NULL);
-
-      g_variant_dict_insert (dict, "Resumable",
-                             "b", mws_schedule_entry_get_resumable (entry));
-      g_variant_dict_insert (dict, "Priority",
-                             "u", mws_schedule_entry_get_priority (entry));
-      g_variant_dict_insert (dict, "DownloadNow",
-                             "b", mws_scheduler_is_entry_active (self->scheduler, entry));
-    }
-
-  if (dict != NULL)
     g_dbus_method_invocation_return_value (invocation,
                                            g_variant_new ("(@a{sv})",
-                                                          g_variant_dict_end (dict)));
+                                                          entry_properties_to_variant (self, entry)));
   else
     g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
                                            G_DBUS_ERROR_UNKNOWN_INTERFACE,
@@ -1203,10 +1737,51 @@ mws_schedule_service_entry_remove (MwsScheduleService    *self,
     }
 }
 
-typedef void (*SchedulerMethodCallFunc) (MwsScheduleService    *self,
-                                         GDBusConnection       *connection,
-                                         const gchar           *sender,
-                                         GVariant              *parameters,
+/* Set several properties on @entry at once, and reschedule only once
+ * afterwards. All the properties are checked before any are applied, so either
+ * all of them are set or none are. Unlike the individual Set() calls, this
+ * means a client updating several properties doesn’t cause a reschedule for
+ * each one. */
+static void
+mws_schedule_service_entry_set_properties (MwsScheduleService    *self,
+                                           MwsScheduleEntry      *entry,
+                                           GDBusConnection       *connection,
+                                           const gchar           *sender,
+                                           GVariant              *parameters,
+                                           GDBusMethodInvocation *invocation)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GVariant) properties = g_variant_get_child_value (parameters, 0);
+  GVariantIter iter;
+  const gchar *property_name;
+  GVariant *value;
+
+  g_variant_iter_init (&iter, properties);
+  while (g_variant_iter_loop (&iter, "{&sv}", &property_name, &value))
+    {
+      if (!check_entry_property (property_name, value, &local_error))
+        {
+          g_dbus_method_invocation_return_gerror (invocation, local_error);
+          g_variant_unref (value);
+          return;
+        }
+    }
+
+  mws_scheduler_freeze_reschedule (self->scheduler);
+
+  g_variant_iter_init (&iter, properties);
+  while (g_variant_iter_loop (&iter, "{&sv}", &property_name, &value))
+    set_entry_property (entry, property_name, value);
+
+  mws_scheduler_thaw_reschedule (self->scheduler);
+
+  g_dbus_method_invocation_return_value (invocation, NULL);
+}
+
+typedef void (*SchedulerMethodCallFunc) (MwsScheduleService    *self,
+                                         GDBusConnection       *connection,
+                                         const gchar           *sender,
+                                         GVariant              *parameters,
                                          GDBusMethodInvocation *invocation);
 
 static const struct
@@ -1230,10 +1805,22 @@ scheduler_methods[] =
       mws_schedule_service_scheduler_schedule_entries },
     { "com.endlessm.DownloadManager1.Scheduler", "ScheduleEntries",
       mws_schedule_service_scheduler_schedule_entries },
+    { "com.endlessm.DownloadManager1.Scheduler", "ScheduleEntriesFull",
+      mws_schedule_service_scheduler_schedule_entries },
     { "com.endlessm.DownloadManager1.Scheduler", "Hold",
       mws_schedule_service_scheduler_hold },
     { "com.endlessm.DownloadManager1.Scheduler", "Release",
       mws_schedule_service_scheduler_release },
+    { "com.endlessm.DownloadManager1.Scheduler", "SubscribeActiveEntriesChanged",
+      mws_schedule_service_scheduler_subscribe },
+    { "com.endlessm.DownloadManager1.Scheduler", "Monitor",
+      mws_schedule_service_scheduler_monitor },
+    { "com.endlessm.DownloadManager1.Scheduler", "UpdateEntries",
+      mws_schedule_service_scheduler_update_entries },
+    { "com.endlessm.DownloadManager1.Scheduler", "RemoveEntries",
+      mws_schedule_service_scheduler_remove_entries },
+    { "com.endlessm.DownloadManager1.Scheduler", "Preview",
+      mws_schedule_service_scheduler_preview },
   };
 
 G_STATIC_ASSERT (G_N_ELEMENTS (scheduler_methods) ==
@@ -1266,8 +1853,10 @@ mws_schedule_service_scheduler_method_call (GDBusConnection       *connection,
       if (g_str_equal (scheduler_methods[i].interface_name, interface_name) &&
           g_str_equal (scheduler_methods[i].method_name, method_name))
         {
+          MWS_TRACE3 (dbus_method_start, sender, interface_name, method_name);
           scheduler_methods[i].func (self, connection, sender,
                                      parameters, invocation);
+          MWS_TRACE1 (dbus_method_end, method_name);
           return;
         }
     }
@@ -1386,8 +1975,41 @@ typedef struct
   MwsScheduleService *schedule_service;  /* (unowned) */
   GDBusMethodInvocation *invocation;  /* (owned) */
   GPtrArray *entries;  /* (element-type MwsScheduleEntry) (owned) */
+  gint64 peer_credentials_start_usec;
 } ScheduleData;
 
+static guint
+get_pending_entries (MwsScheduleService *self,
+                     const gchar        *sender)
+{
+  return GPOINTER_TO_UINT (g_hash_table_lookup (self->pending_entries_by_peer, sender));
+}
+
+static void
+add_pending_entries (MwsScheduleService *self,
+                     const gchar        *sender,
+                     guint               n_entries)
+{
+  guint n_pending = get_pending_entries (self, sender);
+  g_hash_table_insert (self->pending_entries_by_peer, g_strdup (sender),
+                       GUINT_TO_POINTER (n_pending + n_entries));
+}
+
+static void
+remove_pending_entries (MwsScheduleService *self,
+                        const gchar        *sender,
+                        guint               n_entries)
+{
+  guint n_pending = get_pending_entries (self, sender);
+  g_assert (n_pending >= n_entries);
+
+  if (n_pending == n_entries)
+    g_hash_table_remove (self->pending_entries_by_peer, sender);
+  else
+    g_hash_table_insert (self->pending_entries_by_peer, g_strdup (sender),
+                         GUINT_TO_POINTER (n_pending - n_entries));
+}
+
 static ScheduleData *
 schedule_data_new (MwsScheduleService    *schedule_service,
                    GDBusMethodInvocation *invocation,
@@ -1397,6 +2019,7 @@ schedule_data_new (MwsScheduleService    *schedule_service,
   data->schedule_service = schedule_service;
   data->invocation = g_object_ref (invocation);
   data->entries = g_ptr_array_ref (entries);
+  data->peer_credentials_start_usec = g_get_monotonic_time ();
   return data;
 }
 
@@ -1413,6 +2036,9 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC (ScheduleData, schedule_data_free)
 static void schedule_cb (GObject      *obj,
                          GAsyncResult *result,
                          gpointer      user_data);
+static void schedule_entries_for_peer (MwsScheduleService    *self,
+                                       GDBusMethodInvocation *invocation,
+                                       GPtrArray             *entries);
 
 static void
 mws_schedule_service_scheduler_schedule_entries (MwsScheduleService    *self,
@@ -1423,13 +2049,43 @@ mws_schedule_service_scheduler_schedule_entries (MwsScheduleService    *self,
 {
   g_autoptr(GError) local_error = NULL;
 
-  /* This method implements both .Schedule and .ScheduleEntries, switching on
-   * the invoked method name to work out whether to handle one or several
-   * entries. */
-  g_autoptr(GPtrArray) entries = g_ptr_array_new_with_free_func (g_object_unref);
+  /* This method implements .Schedule, .ScheduleEntries and
+   * .ScheduleEntriesFull, switching on the invoked method name to work out
+   * whether to handle one or several entries. */
+  const gchar *method_name = g_dbus_method_invocation_get_method_name (invocation);
+  gsize n_new_entries;
+
+  if (g_str_equal (method_name, "Schedule"))
+    {
+      n_new_entries = 1;
+    }
+  else
+    {
+      g_autoptr(GVariant) properties_array = g_variant_get_child_value (parameters, 0);
+      n_new_entries = g_variant_n_children (properties_array);
+    }
+
+  /* Reject peers which are over quota before doing any work to create their
+   * entries or look up their credentials. This takes constant time, so a peer
+   * which repeatedly tries to schedule too many entries can’t slow the service
+   * down for everyone else. The scheduler checks again when the entries are
+   * added, since other entries may have been added in the meantime. */
+  if (!mws_scheduler_check_quota (self->scheduler, sender,
+                                  n_new_entries + get_pending_entries (self, sender),
+                                  &local_error))
+    {
+      g_debug ("%s: Rejecting %" G_GSIZE_FORMAT " entries from D-Bus peer ‘%s’: %s",
+               G_STRFUNC, n_new_entries, sender, local_error->message);
+      self->n_entries_rejected += n_new_entries;
+      g_prefix_error (&local_error, _("Error adding entry to scheduler: "));
+      g_dbus_method_invocation_return_gerror (invocation, local_error);
+      return;
+    }
+
+  g_autoptr(GPtrArray) entries = g_ptr_array_new_full (n_new_entries, g_object_unref);
 
   /* Create one or more schedule entries, validating the parameters at the time. */
-  if (g_str_equal (g_dbus_method_invocation_get_method_name (invocation), "Schedule"))
+  if (g_str_equal (method_name, "Schedule"))
     {
       g_autoptr(MwsScheduleEntry) entry = NULL;
       g_autoptr(GVariant) properties_variant = NULL;
@@ -1448,7 +2104,8 @@ mws_schedule_service_scheduler_schedule_entries (MwsScheduleService    *self,
 
       g_ptr_array_add (entries, g_steal_pointer (&entry));
     }
-  else if (g_str_equal (g_dbus_method_invocation_get_method_name (invocation), "ScheduleEntries"))
+  else if (g_str_equal (method_name, "ScheduleEntries") ||
+           g_str_equal (method_name, "ScheduleEntriesFull"))
     {
       g_autoptr(GVariantIter) properties_array_iter = NULL;
       g_variant_get (parameters, "(aa{sv})", &properties_array_iter);
@@ -1476,10 +2133,23 @@ mws_schedule_service_scheduler_schedule_entries (MwsScheduleService    *self,
       g_assert_not_reached ();
     }
 
-  /* Load the peer’s credentials and watch to see if it disappears in future (to
-   * allow removing all its schedule entries). The credentials will allow the
-   * scheduler to prioritise entries by sender. */
-  mws_peer_manager_ensure_peer_credentials_async (mws_scheduler_get_peer_manager (self->scheduler),
+  /* If the peer’s credentials are already cached, the peer manager is already
+   * watching it, so the entries can be added straight away without a round
+   * trip through the main loop. This is the common case for peers which
+   * schedule lots of entries. */
+  MwsPeerManager *peer_manager = mws_scheduler_get_peer_manager (self->scheduler);
+
+  if (mws_peer_manager_get_peer_credentials (peer_manager, sender) != NULL)
+    {
+      schedule_entries_for_peer (self, invocation, entries);
+      return;
+    }
+
+  /* Otherwise, load the peer’s credentials and watch to see if it disappears in
+   * future (to allow removing all its schedule entries). The credentials will
+   * allow the scheduler to prioritise entries by sender. */
+  add_pending_entries (self, sender, entries->len);
+  mws_peer_manager_ensure_peer_credentials_async (peer_manager,
                                                   sender, self->cancellable,
                                                   schedule_cb,
                                                   schedule_data_new (self, invocation, entries));
@@ -1501,6 +2171,12 @@ schedule_cb (GObject      *obj,
   g_autofree gchar *sender_path = NULL;
   sender_path = mws_peer_manager_ensure_peer_credentials_finish (peer_manager,
                                                                  result, &local_error);
+  mws_latency_histogram_record (&self->peer_credentials_latency,
+                                g_get_monotonic_time () - data->peer_credentials_start_usec);
+
+  if (self->pending_entries_by_peer != NULL)
+    remove_pending_entries (self, g_dbus_method_invocation_get_sender (invocation),
+                            entries->len);
 
   if (sender_path == NULL)
     {
@@ -1509,34 +2185,69 @@ schedule_cb (GObject      *obj,
       return;
     }
 
+  schedule_entries_for_peer (self, invocation, entries);
+}
+
+/* Add @entries to the scheduler and return their paths from @invocation, once
+ * the credentials for the peer which is scheduling them are known. */
+static void
+schedule_entries_for_peer (MwsScheduleService    *self,
+                           GDBusMethodInvocation *invocation,
+                           GPtrArray             *entries)
+{
+  g_autoptr(GError) local_error = NULL;
+
   /* Add the entries to the scheduler. */
   if (!mws_scheduler_update_entries (self->scheduler, entries, NULL, &local_error))
     {
       /* We know this error domain is registered with #GDBusError. */
       g_warn_if_fail (local_error->domain == MWS_SCHEDULER_ERROR);
+      if (g_error_matches (local_error, MWS_SCHEDULER_ERROR, MWS_SCHEDULER_ERROR_FULL))
+        self->n_entries_rejected += entries->len;
       g_prefix_error (&local_error, _("Error adding entry to scheduler: "));
       g_dbus_method_invocation_return_gerror (invocation, local_error);
       return;
     }
 
   /* Build paths for the entries and return them. */
-  if (g_str_equal (g_dbus_method_invocation_get_method_name (invocation), "Schedule"))
+  const gchar *method_name = g_dbus_method_invocation_get_method_name (invocation);
+
+  if (g_str_equal (method_name, "Schedule"))
     {
       g_assert (entries->len == 1);
       MwsScheduleEntry *entry = g_ptr_array_index (entries, 0);
-      g_autofree gchar *entry_path = schedule_entry_to_object_path (self, entry);
+      const gchar *entry_path = schedule_entry_to_object_path (self, entry);
       g_dbus_method_invocation_return_value (invocation,
                                              g_variant_new ("(o)", entry_path));
     }
-  else if (g_str_equal (g_dbus_method_invocation_get_method_name (invocation), "ScheduleEntries"))
+  else if (g_str_equal (method_name, "ScheduleEntries"))
     {
       g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("(ao)"));
       g_variant_builder_open (&builder, G_VARIANT_TYPE ("ao"));
       for (gsize i = 0; i < entries->len; i++)
         {
           MwsScheduleEntry *entry = g_ptr_array_index (entries, i);
-          g_autofree gchar *entry_path = schedule_entry_to_object_path (self, entry);
-          g_variant_builder_add (&builder, "o", entry_path);
+          g_variant_builder_add (&builder, "o",
+                                 schedule_entry_to_object_path (self, entry));
+        }
+      g_variant_builder_close (&builder);
+
+      g_dbus_method_invocation_return_value (invocation,
+                                             g_variant_builder_end (&builder));
+    }
+  else if (g_str_equal (method_name, "ScheduleEntriesFull"))
+    {
+      /* As with ScheduleEntries, but return the initial properties of each
+       * entry too, so the client doesn’t need to call GetAll() on each. The
+       * scheduler has already run, so DownloadNow is up to date. */
+      g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("(a(oa{sv}))"));
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(oa{sv})"));
+      for (gsize i = 0; i < entries->len; i++)
+        {
+          MwsScheduleEntry *entry = g_ptr_array_index (entries, i);
+          g_variant_builder_add (&builder, "(o@a{sv})",
+                                 schedule_entry_to_object_path (self, entry),
+                                 entry_properties_to_variant (self, entry));
         }
       g_variant_builder_close (&builder);
 
@@ -1553,6 +2264,7 @@ typedef struct
 {
   MwsScheduleService *schedule_service;  /* (owned) */
   GDBusMethodInvocation *invocation;  /* (owned) */
+  gint64 peer_credentials_start_usec;
 } HoldData;
 
 static void
@@ -1572,6 +2284,7 @@ hold_data_new (MwsScheduleService    *schedule_service,
   g_autoptr(HoldData) data = g_new0 (HoldData, 1);
   data->schedule_service = g_object_ref (schedule_service);
   data->invocation = g_object_ref (invocation);
+  data->peer_credentials_start_usec = g_get_monotonic_time ();
   return g_steal_pointer (&data);
 }
 
@@ -1607,6 +2320,8 @@ hold_cb (GObject      *obj,
   g_autofree gchar *sender_path = NULL;
   sender_path = mws_peer_manager_ensure_peer_credentials_finish (peer_manager,
                                                                  result, &local_error);
+  mws_latency_histogram_record (&self->peer_credentials_latency,
+                                g_get_monotonic_time () - data->peer_credentials_start_usec);
 
   if (sender_path == NULL)
     {
@@ -1640,101 +2355,1014 @@ mws_schedule_service_scheduler_release (MwsScheduleService    *self,
     g_dbus_method_invocation_return_value (invocation, NULL);
 }
 
-static gboolean
-mws_schedule_service_hold (MwsScheduleService  *self,
-                           const gchar         *sender,
-                           const gchar         *reason,
-                           GError             **error)
+typedef struct
 {
-  /* Has this client already got a hold on the service? */
-  const gchar *old_reason = g_hash_table_lookup (self->hold_reasons, sender);
+  MwsScheduleService *schedule_service;  /* (owned) */
+  GDBusMethodInvocation *invocation;  /* (owned) */
+  SchedulerMethodCallFunc authorized_func;
+} AuthorizeData;
 
-  if (old_reason != NULL)
+static void
+authorize_data_free (AuthorizeData *data)
+{
+  g_clear_object (&data->invocation);
+  g_clear_object (&data->schedule_service);
+  g_free (data);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (AuthorizeData, authorize_data_free)
+
+static void check_authorization_cb (GObject      *obj,
+                                    GAsyncResult *result,
+                                    gpointer      user_data);
+
+/* Ask polkit whether the sender of @invocation is authorised for @action_id,
+ * and call @authorized_func to handle the method call if so. Otherwise, return
+ * %G_DBUS_ERROR_ACCESS_DENIED. Authentication is interactive if the caller set
+ * %G_DBUS_MESSAGE_FLAGS_ALLOW_INTERACTIVE_AUTHORIZATION on its call. If polkit
+ * can’t be reached, the call is denied. */
+static void
+check_authorization (MwsScheduleService      *self,
+                     GDBusMethodInvocation   *invocation,
+                     const gchar             *action_id,
+                     SchedulerMethodCallFunc  authorized_func)
+{
+  const gchar *sender = g_dbus_method_invocation_get_sender (invocation);
+  GDBusMessage *message = g_dbus_method_invocation_get_message (invocation);
+  gboolean interactive = (g_dbus_message_get_flags (message) &
+                          G_DBUS_MESSAGE_FLAGS_ALLOW_INTERACTIVE_AUTHORIZATION);
+
+  g_auto(GVariantBuilder) subject_builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&subject_builder, "{sv}", "name", g_variant_new_string (sender));
+
+  g_autoptr(AuthorizeData) data = g_new0 (AuthorizeData, 1);
+  data->schedule_service = g_object_ref (self);
+  data->invocation = g_object_ref (invocation);
+  data->authorized_func = authorized_func;
+
+  /* The flags are POLKIT_CHECK_AUTHORIZATION_FLAGS_ALLOW_USER_INTERACTION. If
+   * interactive, polkit may take as long as the user does to authenticate. */
+  g_dbus_connection_call (self->connection,
+                          "org.freedesktop.PolicyKit1",
+                          "/org/freedesktop/PolicyKit1/Authority",
+                          "org.freedesktop.PolicyKit1.Authority",
+                          "CheckAuthorization",
+                          g_variant_new ("((sa{sv})sa{ss}us)",
+                                         "system-bus-name", &subject_builder,
+                                         action_id, NULL,
+                                         interactive ? 1 : 0,
+                                         ""  /* cancellation ID */),
+                          G_VARIANT_TYPE ("((bba{ss}))"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          interactive ? G_MAXINT : -1,
+                          self->cancellable,
+                          check_authorization_cb,
+                          g_steal_pointer (&data));
+}
+
+static void
+check_authorization_cb (GObject      *obj,
+                        GAsyncResult *result,
+                        gpointer      user_data)
+{
+  GDBusConnection *connection = G_DBUS_CONNECTION (obj);
+  g_autoptr(AuthorizeData) data = user_data;
+  MwsScheduleService *self = data->schedule_service;
+  GDBusMethodInvocation *invocation = data->invocation;
+  const gchar *sender = g_dbus_method_invocation_get_sender (invocation);
+  const gchar *method_name = g_dbus_method_invocation_get_method_name (invocation);
+  g_autoptr(GError) local_error = NULL;
+  gboolean is_authorized = FALSE;
+
+  g_autoptr(GVariant) reply = NULL;
+  reply = g_dbus_connection_call_finish (connection, result, &local_error);
+
+  if (reply != NULL)
+    g_variant_get (reply, "((bb@a{ss}))", &is_authorized, NULL, NULL);
+  else
+    g_debug ("%s: Error checking authorization of ‘%s’ for %s(): %s",
+             G_STRFUNC, sender, method_name, local_error->message);
+
+  if (!is_authorized)
     {
-      g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
-                   _("D-Bus peer ‘%s’ already has a hold on the scheduler"),
-                   sender);
-      return FALSE;
+      g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+                                             G_DBUS_ERROR_ACCESS_DENIED,
+                                             _("Peer ‘%s’ is not authorized to call %s()."),
+                                             sender, method_name);
+      return;
     }
 
-  /* Add the hold. */
-  g_message ("Holding service for D-Bus peer ‘%s’ because: %s", sender, reason);
-  g_hash_table_insert (self->hold_reasons, g_strdup (sender), g_strdup (reason));
+  data->authorized_func (self, connection, sender,
+                         g_dbus_method_invocation_get_parameters (invocation),
+                         invocation);
+}
 
-  if (g_hash_table_size (self->hold_reasons) == 1)
+static void subscribe_cb (GObject      *obj,
+                          GAsyncResult *result,
+                          gpointer      user_data);
+
+/* Handle the SubscribeActiveEntriesChanged() and Monitor() methods, which both
+ * add the sender to a set of subscribers. */
+static void
+mws_schedule_service_scheduler_subscribe (MwsScheduleService    *self,
+                                          GDBusConnection       *connection,
+                                          const gchar           *sender,
+                                          GVariant              *parameters,
+                                          GDBusMethodInvocation *invocation)
+{
+  /* Load the peer’s credentials so we can watch to see if it disappears in
+   * future, and drop its subscription then. The closure is the same as for
+   * Hold(). */
+  mws_peer_manager_ensure_peer_credentials_async (mws_scheduler_get_peer_manager (self->scheduler),
+                                                  sender, self->cancellable,
+                                                  subscribe_cb,
+                                                  hold_data_new (self, invocation));
+}
+
+/* Handle the Monitor() method. Since monitors see every peer’s entries, the
+ * peer has to be authorised by polkit first. */
+static void
+mws_schedule_service_scheduler_monitor (MwsScheduleService    *self,
+                                        GDBusConnection       *connection,
+                                        const gchar           *sender,
+                                        GVariant              *parameters,
+                                        GDBusMethodInvocation *invocation)
+{
+  check_authorization (self, invocation, MONITOR_ACTION_ID,
+                       mws_schedule_service_scheduler_subscribe);
+}
+
+static void
+subscribe_cb (GObject      *obj,
+              GAsyncResult *result,
+              gpointer      user_data)
+{
+  MwsPeerManager *peer_manager = MWS_PEER_MANAGER (obj);
+  g_autoptr(HoldData) data = user_data;
+  MwsScheduleService *self = data->schedule_service;
+  GDBusMethodInvocation *invocation = data->invocation;
+  g_autoptr(GError) local_error = NULL;
+
+  /* Finish looking up the sender. */
+  g_autofree gchar *sender_path = NULL;
+  sender_path = mws_peer_manager_ensure_peer_credentials_finish (peer_manager,
+                                                                 result, &local_error);
+  mws_latency_histogram_record (&self->peer_credentials_latency,
+                                g_get_monotonic_time () - data->peer_credentials_start_usec);
+
+  if (sender_path == NULL)
     {
-      /* This has potentially changed. */
-      g_object_notify (G_OBJECT (self), "busy");
+      g_prefix_error (&local_error, _("Error looking up peer credentials: "));
+      g_dbus_method_invocation_return_gerror (invocation, local_error);
+      return;
     }
 
-  return TRUE;
+  /* Subscribing twice is harmless. */
+  const gchar *sender = g_dbus_method_invocation_get_sender (invocation);
+  const gchar *method_name = g_dbus_method_invocation_get_method_name (invocation);
+  GHashTable *subscribers;
+
+  if (g_str_equal (method_name, "Monitor"))
+    subscribers = self->monitors;
+  else if (g_str_equal (method_name, "SubscribeActiveEntriesChanged"))
+    subscribers = self->active_entries_changed_subscribers;
+  else
+    g_assert_not_reached ();
+
+  g_debug ("%s: Subscribing D-Bus peer ‘%s’ using %s()",
+           G_STRFUNC, sender, method_name);
+  g_hash_table_add (subscribers, g_strdup (sender));
+
+  g_dbus_method_invocation_return_value (invocation, NULL);
 }
 
-static gboolean
-mws_schedule_service_release (MwsScheduleService  *self,
-                              const gchar         *sender,
-                              GError             **error)
+/* Look up the schedule entry for a full @object_path which was passed to a
+ * method on the scheduler by @sender. Entries which don’t exist, or which are
+ * owned by another peer, are treated the same, as in
+ * mws_schedule_service_entry_method_call(). */
+static MwsScheduleEntry *
+sender_object_path_to_schedule_entry (MwsScheduleService  *self,
+                                      const gchar         *sender,
+                                      const gchar         *object_path,
+                                      GError             **error)
 {
-  /* Has this client actually got a hold on the service? */
-  const gchar *reason = g_hash_table_lookup (self->hold_reasons, sender);
+  MwsScheduleEntry *entry = NULL;
 
-  if (reason == NULL)
+  if (g_str_has_prefix (object_path, self->object_path) &&
+      object_path[strlen (self->object_path)] == '/')
+    entry = object_path_to_schedule_entry (self,
+                                           object_path +
+                                           strlen (self->object_path) + 1);
+
+  if (entry == NULL ||
+      !g_str_equal (mws_schedule_entry_get_owner (entry), sender))
     {
-      g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
-                   _("D-Bus peer ‘%s’ does not have a hold on the scheduler"),
-                   sender);
-      return FALSE;
+      g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_OBJECT,
+                   _("Unknown object ‘%s’."), object_path);
+      return NULL;
     }
 
-  /* Drop the hold. */
-  g_message ("Releasing hold on service for D-Bus peer ‘%s’", sender);
-  g_hash_table_remove (self->hold_reasons, sender);
+  return entry;
+}
 
-  if (g_hash_table_size (self->hold_reasons) == 0)
+static void
+mws_schedule_service_scheduler_update_entries (MwsScheduleService    *self,
+                                               GDBusConnection       *connection,
+                                               const gchar           *sender,
+                                               GVariant              *parameters,
+                                               GDBusMethodInvocation *invocation)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GVariant) updates = g_variant_get_child_value (parameters, 0);
+  gsize n_updates = g_variant_n_children (updates);
+
+  /* Check all the updates before applying any of them, so that either all of
+   * them are applied or none are. */
+  g_autoptr(GPtrArray) entries = g_ptr_array_new_full (n_updates, NULL);
+
+  for (gsize i = 0; i < n_updates; i++)
     {
-      /* This has potentially changed. */
-      g_object_notify (G_OBJECT (self), "busy");
+      const gchar *object_path;
+      g_autoptr(GVariantIter) properties_iter = NULL;
+
+      g_variant_get_child (updates, i, "(&oa{sv})", &object_path, &properties_iter);
+
+      MwsScheduleEntry *entry = sender_object_path_to_schedule_entry (self, sender,
+                                                                       object_path,
+                                                                       &local_error);
+      if (entry == NULL)
+        {
+          g_dbus_method_invocation_return_gerror (invocation, local_error);
+          return;
+        }
+
+      const gchar *property_name;
+      GVariant *value;
+
+      while (g_variant_iter_loop (properties_iter, "{&sv}", &property_name, &value))
+        {
+          if (!check_entry_property (property_name, value, &local_error))
+            {
+              g_prefix_error (&local_error,
+                              _("Invalid update for schedule entry ‘%s’: "),
+                              object_path);
+              g_dbus_method_invocation_return_gerror (invocation, local_error);
+              g_variant_unref (value);
+              return;
+            }
+        }
+
+      g_ptr_array_add (entries, entry);
     }
 
-  return TRUE;
+  /* Apply the updates, and reschedule once at the end. */
+  g_debug ("%s: Updating %" G_GSIZE_FORMAT " entries for ‘%s’",
+           G_STRFUNC, n_updates, sender);
+
+  mws_scheduler_freeze_reschedule (self->scheduler);
+
+  for (gsize i = 0; i < n_updates; i++)
+    {
+      MwsScheduleEntry *entry = g_ptr_array_index (entries, i);
+      g_autoptr(GVariantIter) properties_iter = NULL;
+      const gchar *property_name;
+      GVariant *value;
+
+      g_variant_get_child (updates, i, "(&oa{sv})", NULL, &properties_iter);
+
+      while (g_variant_iter_loop (properties_iter, "{&sv}", &property_name, &value))
+        set_entry_property (entry, property_name, value);
+    }
+
+  mws_scheduler_thaw_reschedule (self->scheduler);
+
+  g_dbus_method_invocation_return_value (invocation, NULL);
 }
 
-/**
- * mws_schedule_service_new:
- * @connection: (transfer none): D-Bus connection to export objects on
- * @object_path: root path to export objects below; must be a valid D-Bus object
- *    path
- * @scheduler: (transfer none): scheduler to expose
- *
- * Create a new #MwsScheduleService instance which is set up to run as a
- * service.
- *
- * Returns: (transfer full): a new #MwsScheduleService
- * Since: 0.1.0
- */
-MwsScheduleService *
-mws_schedule_service_new (GDBusConnection *connection,
-                          const gchar     *object_path,
-                          MwsScheduler    *scheduler)
+static void
+mws_schedule_service_scheduler_remove_entries (MwsScheduleService    *self,
+                                               GDBusConnection       *connection,
+                                               const gchar           *sender,
+                                               GVariant              *parameters,
+                                               GDBusMethodInvocation *invocation)
 {
-  g_return_val_if_fail (G_IS_DBUS_CONNECTION (connection), NULL);
-  g_return_val_if_fail (g_variant_is_object_path (object_path), NULL);
-  g_return_val_if_fail (MWS_IS_SCHEDULER (scheduler), NULL);
+  g_autoptr(GError) local_error = NULL;
+  g_autofree const gchar **object_paths = NULL;
+  g_variant_get (parameters, "(^a&o)", &object_paths);
 
-  return g_object_new (MWS_TYPE_SCHEDULE_SERVICE,
-                       "connection", connection,
-                       "object-path", object_path,
-                       "scheduler", scheduler,
-                       NULL);
-}
+  /* Check all the entries before removing any of them, so that either all of
+   * them are removed or none are. */
+  g_autoptr(GPtrArray) removed = g_ptr_array_new_with_free_func (NULL);
 
-/**
- * mws_schedule_service_get_busy:
- * @self: a #MwsScheduleService
- *
- * Get the value of #MwsScheduleService:busy.
- *
- * Returns: %TRUE if the service is busy, %FALSE otherwise
+  for (gsize i = 0; object_paths[i] != NULL; i++)
+    {
+      MwsScheduleEntry *entry = sender_object_path_to_schedule_entry (self, sender,
+                                                                       object_paths[i],
+                                                                       &local_error);
+      if (entry == NULL)
+        {
+          g_dbus_method_invocation_return_gerror (invocation, local_error);
+          return;
+        }
+
+      g_ptr_array_add (removed, (gpointer) mws_schedule_entry_get_id (entry));
+    }
+
+  /* Remove them all in one go, so there’s only one reschedule. */
+  g_debug ("%s: Removing %u entries for ‘%s’",
+           G_STRFUNC, removed->len, sender);
+
+  if (mws_scheduler_update_entries (self->scheduler, NULL, removed, &local_error))
+    {
+      g_dbus_method_invocation_return_value (invocation, NULL);
+    }
+  else
+    {
+      /* We know this error domain is registered with #GDBusError. */
+      g_warn_if_fail (local_error->domain == MWS_SCHEDULER_ERROR);
+      g_prefix_error (&local_error, _("Error removing entries from scheduler: "));
+      g_dbus_method_invocation_return_gerror (invocation, local_error);
+    }
+}
+
+static void
+connection_details_free (MwsConnectionDetails *details)
+{
+  mws_connection_details_clear (details);
+  g_free (details);
+}
+
+/* Parse the a{sv} @properties of a connection override passed to Preview()
+ * into @details. The details start from the connection’s current details, or
+ * from the defaults set by mws_connection_details_clear() if it’s not
+ * currently active. If any of the properties are invalid, a
+ * %G_DBUS_ERROR_INVALID_ARGS error is set which is suitable for returning to
+ * the peer. */
+static gboolean
+connection_override_from_variant (MwsScheduleService    *self,
+                                  const gchar           *connection_id,
+                                  GVariant              *properties,
+                                  MwsConnectionDetails  *details,
+                                  GError               **error)
+{
+  MwsConnectionMonitor *connection_monitor = mws_scheduler_get_connection_monitor (self->scheduler);
+
+  if (!mws_connection_monitor_get_connection_details (connection_monitor,
+                                                      connection_id, details))
+    mws_connection_details_clear (details);
+
+  GVariantIter iter;
+  const gchar *property_name;
+  GVariant *value;
+
+  g_variant_iter_init (&iter, properties);
+  while (g_variant_iter_loop (&iter, "{&sv}", &property_name, &value))
+    {
+      if (g_str_equal (property_name, "Metered") &&
+          g_variant_is_of_type (value, G_VARIANT_TYPE_UINT32) &&
+          g_variant_get_uint32 (value) <= MWS_METERED_GUESS_NO)
+        {
+          details->metered = (MwsMetered) g_variant_get_uint32 (value);
+        }
+      else if (g_str_equal (property_name, "AllowDownloads") &&
+               g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
+        {
+          details->allow_downloads = g_variant_get_boolean (value);
+        }
+      else if (g_str_equal (property_name, "AllowDownloadsWhenMetered") &&
+               g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
+        {
+          details->allow_downloads_when_metered = g_variant_get_boolean (value);
+        }
+      else if (g_str_equal (property_name, "Tariff"))
+        {
+          g_autoptr(MwtTariffLoader) loader = mwt_tariff_loader_new ();
+          g_autoptr(GError) local_error = NULL;
+
+          if (!mwt_tariff_loader_load_from_variant (loader, value, &local_error))
+            {
+              g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                           _("Invalid tariff for connection ‘%s’: %s"),
+                           connection_id, local_error->message);
+              g_variant_unref (value);
+              return FALSE;
+            }
+
+          g_set_object (&details->tariff, mwt_tariff_loader_get_tariff (loader));
+        }
+      else
+        {
+          g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                       _("Invalid override ‘%s’ for connection ‘%s’."),
+                       property_name, connection_id);
+          g_variant_unref (value);
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+/* Parse the a{sv} @overrides passed to Preview() into a table of connection
+ * IDs to #MwsConnectionDetails for mws_scheduler_compute_plan(), and the time
+ * to compute the plan for (in microseconds since the Unix epoch, or zero for
+ * the current time). If any of the overrides are invalid, a
+ * %G_DBUS_ERROR_INVALID_ARGS error is set which is suitable for returning to
+ * the peer. */
+static GHashTable *
+preview_overrides_from_variant (MwsScheduleService  *self,
+                                GVariant            *overrides,
+                                gint64              *out_now_usec,
+                                GError             **error)
+{
+  g_autoptr(GHashTable) connection_overrides = NULL;
+  connection_overrides = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                                (GDestroyNotify) connection_details_free);
+  gint64 now_usec = 0;
+
+  GVariantIter iter;
+  const gchar *key;
+  GVariant *value;
+
+  g_variant_iter_init (&iter, overrides);
+  while (g_variant_iter_loop (&iter, "{&sv}", &key, &value))
+    {
+      if (g_str_equal (key, "Time") &&
+          g_variant_is_of_type (value, G_VARIANT_TYPE_UINT64) &&
+          g_variant_get_uint64 (value) > 0 &&
+          g_variant_get_uint64 (value) <= G_MAXINT64 / G_USEC_PER_SEC)
+        {
+          now_usec = (gint64) g_variant_get_uint64 (value) * G_USEC_PER_SEC;
+        }
+      else if (g_str_equal (key, "Connections") &&
+               g_variant_is_of_type (value, G_VARIANT_TYPE ("a{sa{sv}}")))
+        {
+          GVariantIter connections_iter;
+          const gchar *connection_id;
+          GVariant *properties;
+
+          g_variant_iter_init (&connections_iter, value);
+          while (g_variant_iter_loop (&connections_iter, "{&s@a{sv}}",
+                                      &connection_id, &properties))
+            {
+              g_autofree MwsConnectionDetails *details = g_new0 (MwsConnectionDetails, 1);
+
+              if (!connection_override_from_variant (self, connection_id,
+                                                     properties, details, error))
+                {
+                  mws_connection_details_clear (details);
+                  g_variant_unref (properties);
+                  g_variant_unref (value);
+                  return NULL;
+                }
+
+              g_hash_table_replace (connection_overrides, g_strdup (connection_id),
+                                    g_steal_pointer (&details));
+            }
+        }
+      else
+        {
+          g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                       _("Invalid override ‘%s’."), key);
+          g_variant_unref (value);
+          return NULL;
+        }
+    }
+
+  *out_now_usec = now_usec;
+
+  return g_steal_pointer (&connection_overrides);
+}
+
+/* Handle the Preview() method once the caller has been authorised. This
+ * computes which entries would be active if the scheduler were rescheduled
+ * with some of its inputs overridden, without changing anything. The overrides
+ * are:
+ *  - `Time` (`t`): seconds since the Unix epoch to compute the plan for
+ *  - `Connections` (`a{sa{sv}}`): connection IDs mapped to overrides for their
+ *    `Metered` (`u`, an #MwsMetered), `AllowDownloads` (`b`),
+ *    `AllowDownloadsWhenMetered` (`b`) and `Tariff` (a serialised #MwtTariff)
+ *    details; connections which aren’t currently active are treated as if
+ *    they were
+ *
+ * The next reschedule time is returned in seconds since the Unix epoch, to
+ * match #MwsScheduleEntry:deadline, or zero if the plan would never change.
+ *
+ * Like Monitor(), this returns all the active entries, not just the ones owned
+ * by @sender. */
+static void
+mws_schedule_service_scheduler_preview_authorized (MwsScheduleService    *self,
+                                                   GDBusConnection       *connection,
+                                                   const gchar           *sender,
+                                                   GVariant              *parameters,
+                                                   GDBusMethodInvocation *invocation)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GVariant) overrides = g_variant_get_child_value (parameters, 0);
+  g_autoptr(GHashTable) connection_overrides = NULL;
+  gint64 now_usec;
+
+  connection_overrides = preview_overrides_from_variant (self, overrides,
+                                                         &now_usec, &local_error);
+  if (connection_overrides == NULL)
+    {
+      g_dbus_method_invocation_return_gerror (invocation, local_error);
+      return;
+    }
+
+  g_autoptr(GPtrArray) active_entries = NULL;
+  gint64 next_reschedule_usec;
+
+  mws_scheduler_compute_plan (self->scheduler, connection_overrides, now_usec,
+                              &active_entries, &next_reschedule_usec);
+
+  g_debug ("%s: Previewed %u active entries for ‘%s’",
+           G_STRFUNC, active_entries->len, sender);
+
+  g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("ao"));
+
+  for (guint i = 0; i < active_entries->len; i++)
+    g_variant_builder_add (&builder, "o",
+                           schedule_entry_to_object_path (self, active_entries->pdata[i]));
+
+  /* Round up, so the plan has definitely changed by the returned time. */
+  guint64 next_reschedule_secs = 0;
+  if (next_reschedule_usec != G_MAXINT64)
+    next_reschedule_secs = (next_reschedule_usec + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC;
+
+  g_dbus_method_invocation_return_value (invocation,
+                                         g_variant_new ("(@aot)",
+                                                        g_variant_builder_end (&builder),
+                                                        next_reschedule_secs));
+}
+
+/* Handle the Preview() method. This exposes all the active entries, as
+ * Monitor() does, and is expensive to compute, so it needs the same
+ * authorisation as Monitor(). */
+static void
+mws_schedule_service_scheduler_preview (MwsScheduleService    *self,
+                                        GDBusConnection       *connection,
+                                        const gchar           *sender,
+                                        GVariant              *parameters,
+                                        GDBusMethodInvocation *invocation)
+{
+  check_authorization (self, invocation, MONITOR_ACTION_ID,
+                       mws_schedule_service_scheduler_preview_authorized);
+}
+
+static const struct
+  {
+    const gchar *interface_name;
+    const gchar *method_name;
+    SchedulerMethodCallFunc func;
+  }
+metrics_methods[] =
+  {
+    /* Handle properties. */
+    { "org.freedesktop.DBus.Properties", "Get",
+      mws_schedule_service_metrics_properties_get },
+    { "org.freedesktop.DBus.Properties", "Set",
+      mws_schedule_service_metrics_properties_set },
+    { "org.freedesktop.DBus.Properties", "GetAll",
+      mws_schedule_service_metrics_properties_get_all },
+
+    /* Metrics methods. */
+    { "com.endlessm.DownloadManager1.Metrics", "GetMetrics",
+      mws_schedule_service_metrics_get_metrics },
+  };
+
+G_STATIC_ASSERT (G_N_ELEMENTS (metrics_methods) ==
+                 G_N_ELEMENTS (metrics_interface_methods) +
+                 -1  /* NULL terminator */ +
+                 3  /* o.fdo.DBus.Properties */);
+
+static void
+mws_schedule_service_metrics_method_call (GDBusConnection       *connection,
+                                          const gchar           *sender,
+                                          const gchar           *object_path,
+                                          const gchar           *interface_name,
+                                          const gchar           *method_name,
+                                          GVariant              *parameters,
+                                          GDBusMethodInvocation *invocation,
+                                          gpointer               user_data)
+{
+  MwsScheduleService *self = MWS_SCHEDULE_SERVICE (user_data);
+
+  g_assert (g_str_equal (object_path, self->object_path));
+
+  /* Work out which method to call. */
+  for (gsize i = 0; i < G_N_ELEMENTS (metrics_methods); i++)
+    {
+      if (g_str_equal (metrics_methods[i].interface_name, interface_name) &&
+          g_str_equal (metrics_methods[i].method_name, method_name))
+        {
+          metrics_methods[i].func (self, connection, sender,
+                                   parameters, invocation);
+          return;
+        }
+    }
+
+  /* Make sure we actually called a method implementation. GIO guarantees that
+   * this function is only called with methods we’ve declared in the interface
+   * info, so this should never fail. */
+  g_assert_not_reached ();
+}
+
+static void
+mws_schedule_service_metrics_properties_get (MwsScheduleService    *self,
+                                             GDBusConnection       *connection,
+                                             const gchar           *sender,
+                                             GVariant              *parameters,
+                                             GDBusMethodInvocation *invocation)
+{
+  const gchar *interface_name, *property_name;
+  g_variant_get (parameters, "(&s&s)", &interface_name, &property_name);
+
+  /* D-Bus property names can be anything. */
+  if (!validate_dbus_interface_name (invocation, interface_name))
+    return;
+
+  /* No properties exposed. */
+  g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+                                         G_DBUS_ERROR_UNKNOWN_PROPERTY,
+                                         _("Unknown property ‘%s.%s’."),
+                                         interface_name, property_name);
+}
+
+static void
+mws_schedule_service_metrics_properties_set (MwsScheduleService    *self,
+                                             GDBusConnection       *connection,
+                                             const gchar           *sender,
+                                             GVariant              *parameters,
+                                             GDBusMethodInvocation *invocation)
+{
+  const gchar *interface_name, *property_name;
+  g_variant_get (parameters, "(&s&sv)", &interface_name, &property_name, NULL);
+
+  /* D-Bus property names can be anything. */
+  if (!validate_dbus_interface_name (invocation, interface_name))
+    return;
+
+  /* No properties exposed. */
+  g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+                                         G_DBUS_ERROR_UNKNOWN_PROPERTY,
+                                         _("Unknown property ‘%s.%s’."),
+                                         interface_name, property_name);
+}
+
+static void
+mws_schedule_service_metrics_properties_get_all (MwsScheduleService    *self,
+                                                 GDBusConnection       *connection,
+                                                 const gchar           *sender,
+                                                 GVariant              *parameters,
+                                                 GDBusMethodInvocation *invocation)
+{
+  const gchar *interface_name;
+  g_variant_get (parameters, "(&s)", &interface_name);
+
+  if (!validate_dbus_interface_name (invocation, interface_name))
+    return;
+
+  /* No properties exposed. */
+  if (g_str_equal (interface_name, "com.endlessm.DownloadManager1.Metrics"))
+    g_dbus_method_invocation_return_value (invocation,
+                                           g_variant_new ("(@a{sv})",
+                                                          g_variant_new_array (G_VARIANT_TYPE ("{sv}"),
+                                                                               NULL, 0)));
+  else
+    g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+                                           G_DBUS_ERROR_UNKNOWN_INTERFACE,
+                                           _("Unknown interface ‘%s’."),
+                                           interface_name);
+}
+
+/* Return a snapshot of all the performance counters. The histograms are each
+ * an `a{sv}` as described by mws_latency_histogram_to_variant(). The counters
+ * only ever increase, so clients can compute rates by sampling periodically.
+ * `TariffParseTime` is only present if the connection monitor parses tariffs
+ * itself. */
+static void
+mws_schedule_service_metrics_get_metrics (MwsScheduleService    *self,
+                                          GDBusConnection       *connection,
+                                          const gchar           *sender,
+                                          GVariant              *parameters,
+                                          GDBusMethodInvocation *invocation)
+{
+  g_auto(GVariantDict) dict = G_VARIANT_DICT_INIT (NULL);
+  const MwsLatencyHistogram *reschedule_latency;
+  MwsConnectionMonitor *connection_monitor;
+
+  reschedule_latency = mws_scheduler_get_reschedule_latency (self->scheduler);
+  connection_monitor = mws_scheduler_get_connection_monitor (self->scheduler);
+
+  /* The daemon’s real connection monitor is wrapped until it’s ready. */
+  if (MWS_IS_CONNECTION_MONITOR_DEFERRED (connection_monitor))
+    connection_monitor = mws_connection_monitor_deferred_get_target (MWS_CONNECTION_MONITOR_DEFERRED (connection_monitor));
+
+  g_variant_dict_insert (&dict, "RescheduleCount",
+                         "t", reschedule_latency->n_samples);
+  g_variant_dict_insert_value (&dict, "RescheduleLatency",
+                               mws_latency_histogram_to_variant (reschedule_latency));
+  g_variant_dict_insert (&dict, "EntriesAdded", "t", self->n_entries_added);
+  g_variant_dict_insert (&dict, "EntriesRemoved", "t", self->n_entries_removed);
+  g_variant_dict_insert (&dict, "EntriesRejected", "t", self->n_entries_rejected);
+  g_variant_dict_insert (&dict, "SignalsEmitted", "t", self->n_signals_emitted);
+  g_variant_dict_insert_value (&dict, "PeerCredentialsLatency",
+                               mws_latency_histogram_to_variant (&self->peer_credentials_latency));
+  g_variant_dict_insert_value (&dict, "MainLoopLag",
+                               mws_latency_histogram_to_variant (&self->main_loop_lag));
+
+  if (MWS_IS_CONNECTION_MONITOR_NM (connection_monitor))
+    {
+      MwsConnectionMonitorNm *monitor_nm = MWS_CONNECTION_MONITOR_NM (connection_monitor);
+      g_variant_dict_insert_value (&dict, "TariffParseTime",
+                                   mws_latency_histogram_to_variant (mws_connection_monitor_nm_get_tariff_parse_time (monitor_nm)));
+    }
+  else if (MWS_IS_CONNECTION_MONITOR_NM_DBUS (connection_monitor))
+    {
+      MwsConnectionMonitorNmDbus *monitor_nm_dbus = MWS_CONNECTION_MONITOR_NM_DBUS (connection_monitor);
+      g_variant_dict_insert_value (&dict, "TariffParseTime",
+                                   mws_latency_histogram_to_variant (mws_connection_monitor_nm_dbus_get_tariff_parse_time (monitor_nm_dbus)));
+    }
+
+  g_dbus_method_invocation_return_value (invocation,
+                                         g_variant_new ("(@a{sv})",
+                                                        g_variant_dict_end (&dict)));
+}
+
+static const struct
+  {
+    const gchar *interface_name;
+    const gchar *method_name;
+    SchedulerMethodCallFunc func;
+  }
+object_manager_methods[] =
+  {
+    /* Handle properties. */
+    { "org.freedesktop.DBus.Properties", "Get",
+      mws_schedule_service_object_manager_properties_get },
+    { "org.freedesktop.DBus.Properties", "Set",
+      mws_schedule_service_object_manager_properties_set },
+    { "org.freedesktop.DBus.Properties", "GetAll",
+      mws_schedule_service_object_manager_properties_get_all },
+
+    /* ObjectManager methods. */
+    { "org.freedesktop.DBus.ObjectManager", "GetManagedObjects",
+      mws_schedule_service_object_manager_get_managed_objects },
+  };
+
+G_STATIC_ASSERT (G_N_ELEMENTS (object_manager_methods) ==
+                 G_N_ELEMENTS (object_manager_interface_methods) +
+                 -1  /* NULL terminator */ +
+                 3  /* o.fdo.DBus.Properties */);
+
+static void
+mws_schedule_service_object_manager_method_call (GDBusConnection       *connection,
+                                                 const gchar           *sender,
+                                                 const gchar           *object_path,
+                                                 const gchar           *interface_name,
+                                                 const gchar           *method_name,
+                                                 GVariant              *parameters,
+                                                 GDBusMethodInvocation *invocation,
+                                                 gpointer               user_data)
+{
+  MwsScheduleService *self = MWS_SCHEDULE_SERVICE (user_data);
+
+  g_assert (g_str_equal (object_path, self->object_path));
+
+  /* Work out which method to call. */
+  for (gsize i = 0; i < G_N_ELEMENTS (object_manager_methods); i++)
+    {
+      if (g_str_equal (object_manager_methods[i].interface_name, interface_name) &&
+          g_str_equal (object_manager_methods[i].method_name, method_name))
+        {
+          object_manager_methods[i].func (self, connection, sender,
+                                          parameters, invocation);
+          return;
+        }
+    }
+
+  /* Make sure we actually called a method implementation. GIO guarantees that
+   * this function is only called with methods we’ve declared in the interface
+   * info, so this should never fail. */
+  g_assert_not_reached ();
+}
+
+static void
+mws_schedule_service_object_manager_properties_get (MwsScheduleService    *self,
+                                                    GDBusConnection       *connection,
+                                                    const gchar           *sender,
+                                                    GVariant              *parameters,
+                                                    GDBusMethodInvocation *invocation)
+{
+  const gchar *interface_name, *property_name;
+  g_variant_get (parameters, "(&s&s)", &interface_name, &property_name);
+
+  /* D-Bus property names can be anything. */
+  if (!validate_dbus_interface_name (invocation, interface_name))
+    return;
+
+  /* No properties exposed. */
+  g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+                                         G_DBUS_ERROR_UNKNOWN_PROPERTY,
+                                         _("Unknown property ‘%s.%s’."),
+                                         interface_name, property_name);
+}
+
+static void
+mws_schedule_service_object_manager_properties_set (MwsScheduleService    *self,
+                                                    GDBusConnection       *connection,
+                                                    const gchar           *sender,
+                                                    GVariant              *parameters,
+                                                    GDBusMethodInvocation *invocation)
+{
+  const gchar *interface_name, *property_name;
+  g_variant_get (parameters, "(&s&sv)", &interface_name, &property_name, NULL);
+
+  /* D-Bus property names can be anything. */
+  if (!validate_dbus_interface_name (invocation, interface_name))
+    return;
+
+  /* No properties exposed. */
+  g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+                                         G_DBUS_ERROR_UNKNOWN_PROPERTY,
+                                         _("Unknown property ‘%s.%s’."),
+                                         interface_name, property_name);
+}
+
+static void
+mws_schedule_service_object_manager_properties_get_all (MwsScheduleService    *self,
+                                                        GDBusConnection       *connection,
+                                                        const gchar           *sender,
+                                                        GVariant              *parameters,
+                                                        GDBusMethodInvocation *invocation)
+{
+  const gchar *interface_name;
+  g_variant_get (parameters, "(&s)", &interface_name);
+
+  if (!validate_dbus_interface_name (invocation, interface_name))
+    return;
+
+  /* No properties exposed. */
+  if (g_str_equal (interface_name, "org.freedesktop.DBus.ObjectManager"))
+    g_dbus_method_invocation_return_value (invocation,
+                                           g_variant_new ("(@a{sv})",
+                                                          g_variant_new_array (G_VARIANT_TYPE ("{sv}"),
+                                                                               NULL, 0)));
+  else
+    g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+                                           G_DBUS_ERROR_UNKNOWN_INTERFACE,
+                                           _("Unknown interface ‘%s’."),
+                                           interface_name);
+}
+
+/* Return all the schedule entries visible to @sender, with all their
+ * properties, in one round trip. As with the methods on the entry objects,
+ * peers can only see the entries they own, unless they have successfully
+ * called Monitor(), in which case they can see all of them.
+ *
+ * Peers are only added to @self->monitors once polkit has authorised them for
+ * %MONITOR_ACTION_ID, so membership there is the authorisation check; a peer
+ * whose Monitor() call was denied is treated like any other peer. */
+static void
+mws_schedule_service_object_manager_get_managed_objects (MwsScheduleService    *self,
+                                                         GDBusConnection       *connection,
+                                                         const gchar           *sender,
+                                                         GVariant              *parameters,
+                                                         GDBusMethodInvocation *invocation)
+{
+  GHashTable *entries = mws_scheduler_get_entries (self->scheduler);
+  gboolean is_authorized_monitor = g_hash_table_contains (self->monitors, sender);
+  g_auto(GVariantBuilder) objects_builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("a{oa{sa{sv}}}"));
+  GHashTableIter iter;
+  gpointer value;
+  gsize n_objects = 0;
+
+  g_hash_table_iter_init (&iter, entries);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      MwsScheduleEntry *entry = MWS_SCHEDULE_ENTRY (value);
+
+      if (!is_authorized_monitor &&
+          !g_str_equal (mws_schedule_entry_get_owner (entry), sender))
+        continue;
+
+      g_variant_builder_open (&objects_builder, G_VARIANT_TYPE ("{oa{sa{sv}}}"));
+      g_variant_builder_add (&objects_builder, "o",
+                             schedule_entry_to_object_path (self, entry));
+      g_variant_builder_open (&objects_builder, G_VARIANT_TYPE ("a{sa{sv}}"));
+      g_variant_builder_add (&objects_builder, "{s@a{sv}}",
+                             "com.endlessm.DownloadManager1.ScheduleEntry",
+                             entry_properties_to_variant (self, entry));
+      g_variant_builder_close (&objects_builder);
+      g_variant_builder_close (&objects_builder);
+
+      n_objects++;
+    }
+
+  g_debug ("%s: Returning %" G_GSIZE_FORMAT " entries to D-Bus peer ‘%s’",
+           G_STRFUNC, n_objects, sender);
+
+  g_dbus_method_invocation_return_value (invocation,
+                                         g_variant_new ("(@a{oa{sa{sv}}})",
+                                                        g_variant_builder_end (&objects_builder)));
+}
+
+static gboolean
+mws_schedule_service_hold (MwsScheduleService  *self,
+                           const gchar         *sender,
+                           const gchar         *reason,
+                           GError             **error)
+{
+  /* Has this client already got a hold on the service? */
+  const gchar *old_reason = g_hash_table_lookup (self->hold_reasons, sender);
+
+  if (old_reason != NULL)
+    {
+      g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
+                   _("D-Bus peer ‘%s’ already has a hold on the scheduler"),
+                   sender);
+      return FALSE;
+    }
+
+  /* Add the hold. */
+  g_message ("Holding service for D-Bus peer ‘%s’ because: %s", sender, reason);
+  g_hash_table_insert (self->hold_reasons, g_strdup (sender), g_strdup (reason));
+
+  if (g_hash_table_size (self->hold_reasons) == 1)
+    {
+      /* This has potentially changed. */
+      g_object_notify (G_OBJECT (self), "busy");
+    }
+
+  return TRUE;
+}
+
+static gboolean
+mws_schedule_service_release (MwsScheduleService  *self,
+                              const gchar         *sender,
+                              GError             **error)
+{
+  /* Has this client actually got a hold on the service? */
+  const gchar *reason = g_hash_table_lookup (self->hold_reasons, sender);
+
+  if (reason == NULL)
+    {
+      g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
+                   _("D-Bus peer ‘%s’ does not have a hold on the scheduler"),
+                   sender);
+      return FALSE;
+    }
+
+  /* Drop the hold. */
+  g_message ("Releasing hold on service for D-Bus peer ‘%s’", sender);
+  g_hash_table_remove (self->hold_reasons, sender);
+
+  if (g_hash_table_size (self->hold_reasons) == 0)
+    {
+      /* This has potentially changed. */
+      g_object_notify (G_OBJECT (self), "busy");
+    }
+
+  return TRUE;
+}
+
+/**
+ * mws_schedule_service_new:
+ * @connection: (transfer none): D-Bus connection to export objects on
+ * @object_path: root path to export objects below; must be a valid D-Bus object
+ *    path
+ * @scheduler: (transfer none): scheduler to expose
+ *
+ * Create a new #MwsScheduleService instance which is set up to run as a
+ * service.
+ *
+ * Returns: (transfer full): a new #MwsScheduleService
+ * Since: 0.1.0
+ */
+MwsScheduleService *
+mws_schedule_service_new (GDBusConnection *connection,
+                          const gchar     *object_path,
+                          MwsScheduler    *scheduler)
+{
+  g_return_val_if_fail (G_IS_DBUS_CONNECTION (connection), NULL);
+  g_return_val_if_fail (g_variant_is_object_path (object_path), NULL);
+  g_return_val_if_fail (MWS_IS_SCHEDULER (scheduler), NULL);
+
+  return g_object_new (MWS_TYPE_SCHEDULE_SERVICE,
+                       "connection", connection,
+                       "object-path", object_path,
+                       "scheduler", scheduler,
+                       NULL);
+}
+
+/**
+ * mws_schedule_service_get_busy:
+ * @self: a #MwsScheduleService
+ *
+ * Get the value of #MwsScheduleService:busy.
+ *
+ * Returns: %TRUE if the service is busy, %FALSE otherwise
  * Since: 0.1.0
  */
 gboolean
@@ -1742,7 +3370,367 @@ mws_schedule_service_get_busy (MwsScheduleService *self)
 {
   g_return_val_if_fail (MWS_IS_SCHEDULE_SERVICE (self), FALSE);
 
-  GHashTable *entries = mws_scheduler_get_entries (self->scheduler);
-  return ((self->entry_subtree_id != 0 && g_hash_table_size (entries) > 0) ||
+  return ((self->entry_subtree_id != 0 &&
+           mws_scheduler_get_n_entries (self->scheduler) > 0) ||
           g_hash_table_size (self->hold_reasons) > 0);
 }
+
+/**
+ * mws_schedule_service_get_waiting:
+ * @self: a #MwsScheduleService
+ *
+ * Get whether the service is busy only because it has schedule entries which
+ * are waiting for the scheduler to let them start downloading: it is
+ * registered and has at least one entry, but none of them are active and no
+ * peers are holding it with Hold().
+ *
+ * While this is the case, nothing will change until the scheduler next
+ * reschedules (see #MwsScheduler:next-reschedule) unless a peer calls a method
+ * or a connection changes.
+ *
+ * Returns: %TRUE if the service is waiting, %FALSE otherwise
+ * Since: 0.3.0
+ */
+gboolean
+mws_schedule_service_get_waiting (MwsScheduleService *self)
+{
+  g_return_val_if_fail (MWS_IS_SCHEDULE_SERVICE (self), FALSE);
+
+  return (self->entry_subtree_id != 0 &&
+          self->n_entries > 0 &&
+          self->n_active_entries == 0 &&
+          g_hash_table_size (self->hold_reasons) == 0);
+}
+
+static gint
+entry_compare_id (gconstpointer a,
+                  gconstpointer b)
+{
+  MwsScheduleEntry *entry_a = *((MwsScheduleEntry **) a);
+  MwsScheduleEntry *entry_b = *((MwsScheduleEntry **) b);
+  guint64 id_a = g_ascii_strtoull (mws_schedule_entry_get_id (entry_a), NULL, 10);
+  guint64 id_b = g_ascii_strtoull (mws_schedule_entry_get_id (entry_b), NULL, 10);
+
+  return (id_a < id_b) ? -1 : (id_a > id_b) ? 1 : 0;
+}
+
+static GVariant *
+hash_table_keys_to_variant (GHashTable *table)
+{
+  g_autofree const gchar **keys = NULL;
+  guint n_keys = 0;
+
+  keys = (const gchar **) g_hash_table_get_keys_as_array (table, &n_keys);
+
+  return g_variant_new_strv (keys, n_keys);
+}
+
+/**
+ * mws_schedule_service_save_state:
+ * @self: a #MwsScheduleService
+ *
+ * Save the state of the service which is needed for another instance of the
+ * daemon to carry on where this one left off: the schedule entries (with
+ * their IDs, owners and scheduling parameters), and the peers which have
+ * subscribed to signals. Holds are not saved, since a peer which is holding
+ * the service expects it to stay running.
+ *
+ * The state can be restored using mws_schedule_service_restore_state_async().
+ * Its format is internal, but it can be stored to disk; unknown keys are
+ * ignored when restoring it.
+ *
+ * Returns: (transfer floating): the service’s state, as an `a{sv}`
+ * Since: 0.3.0
+ */
+GVariant *
+mws_schedule_service_save_state (MwsScheduleService *self)
+{
+  g_return_val_if_fail (MWS_IS_SCHEDULE_SERVICE (self), NULL);
+
+  /* Save the entries in order of ID, so they can be re-created in that order
+   * (as required by mws_schedule_entry_new_with_id()). */
+  GHashTable *entries = mws_scheduler_get_entries (self->scheduler);
+  g_autoptr(GPtrArray) entries_array = hash_table_get_values_as_ptr_array (entries);
+  g_ptr_array_sort (entries_array, entry_compare_id);
+
+  g_auto(GVariantBuilder) entries_builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("a(ssa{sv})"));
+
+  for (gsize i = 0; i < entries_array->len; i++)
+    {
+      MwsScheduleEntry *entry = MWS_SCHEDULE_ENTRY (entries_array->pdata[i]);
+
+      g_variant_builder_add (&entries_builder, "(ss@a{sv})",
+                             mws_schedule_entry_get_id (entry),
+                             mws_schedule_entry_get_owner (entry),
+                             mws_schedule_entry_to_variant (entry));
+    }
+
+  g_auto(GVariantDict) dict = G_VARIANT_DICT_INIT (NULL);
+  g_variant_dict_insert_value (&dict, "entries",
+                               g_variant_builder_end (&entries_builder));
+  g_variant_dict_insert_value (&dict, "active-entries-changed-subscribers",
+                               hash_table_keys_to_variant (self->active_entries_changed_subscribers));
+  g_variant_dict_insert_value (&dict, "monitors",
+                               hash_table_keys_to_variant (self->monitors));
+
+  return g_variant_dict_end (&dict);
+}
+
+typedef struct
+{
+  GPtrArray *entries;  /* (owned) (element-type MwsScheduleEntry) */
+  GStrv active_entries_changed_subscribers;  /* (owned) */
+  GStrv monitors;  /* (owned) */
+  guint n_pending_lookups;
+} RestoreData;
+
+static void
+restore_data_free (RestoreData *data)
+{
+  g_clear_pointer (&data->entries, g_ptr_array_unref);
+  g_strfreev (data->active_entries_changed_subscribers);
+  g_strfreev (data->monitors);
+  g_free (data);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (RestoreData, restore_data_free)
+
+static void restore_state_lookup_cb (GObject      *obj,
+                                     GAsyncResult *result,
+                                     gpointer      user_data);
+static void restore_state_finish_lookups (GTask *task);
+
+/**
+ * mws_schedule_service_restore_state_async:
+ * @self: a #MwsScheduleService
+ * @state: state previously returned by mws_schedule_service_save_state()
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: callback to invoke once the state is restored
+ * @user_data: data to pass to @callback
+ *
+ * Restore the state saved by a previous instance of the daemon using
+ * mws_schedule_service_save_state(). This must be called before any other
+ * schedule entries are created, and before mws_schedule_service_register(),
+ * so that peers can’t see the service until its state is complete.
+ *
+ * Entries whose owners, and subscriptions from peers, which are no longer on
+ * the bus are dropped: the peers will have lost track of them anyway. Invalid
+ * entries are dropped with a warning.
+ *
+ * If @state is floating, it will be consumed.
+ *
+ * Since: 0.3.0
+ */
+void
+mws_schedule_service_restore_state_async (MwsScheduleService  *self,
+                                          GVariant            *state,
+                                          GCancellable        *cancellable,
+                                          GAsyncReadyCallback  callback,
+                                          gpointer             user_data)
+{
+  g_return_if_fail (MWS_IS_SCHEDULE_SERVICE (self));
+  g_return_if_fail (g_variant_is_of_type (state, G_VARIANT_TYPE_VARDICT));
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+  g_return_if_fail (self->entry_subtree_id == 0);
+
+  g_autoptr(GTask) task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, mws_schedule_service_restore_state_async);
+
+  g_autoptr(GVariant) state_sunk = g_variant_ref_sink (state);
+  g_auto(GVariantDict) dict = G_VARIANT_DICT_INIT (state_sunk);
+  g_autoptr(RestoreData) data = g_new0 (RestoreData, 1);
+  g_autoptr(GVariantIter) entries_iter = NULL;
+
+  data->entries = g_ptr_array_new_with_free_func (g_object_unref);
+
+  if (!g_variant_dict_lookup (&dict, "active-entries-changed-subscribers", "^as",
+                              &data->active_entries_changed_subscribers))
+    data->active_entries_changed_subscribers = g_new0 (gchar *, 1);
+  if (!g_variant_dict_lookup (&dict, "monitors", "^as", &data->monitors))
+    data->monitors = g_new0 (gchar *, 1);
+
+  /* Re-create the entries straight away, so their IDs are reserved before
+   * anything else can create an entry. */
+  if (g_variant_dict_lookup (&dict, "entries", "a(ssa{sv})", &entries_iter))
+    {
+      const gchar *entry_id, *owner;
+      g_autoptr(GVariant) parameters = NULL;
+
+      while (g_variant_iter_loop (entries_iter, "(&s&s@a{sv})",
+                                  &entry_id, &owner, &parameters))
+        {
+          g_autoptr(MwsScheduleEntry) entry = NULL;
+          g_autoptr(GError) local_error = NULL;
+
+          if (!g_dbus_is_unique_name (owner))
+            {
+              g_warning ("Dropping saved schedule entry ‘%s’ with invalid "
+                         "owner ‘%s’", entry_id, owner);
+              continue;
+            }
+
+          entry = mws_schedule_entry_new_with_id (owner, entry_id, parameters,
+                                                  &local_error);
+          if (entry == NULL)
+            {
+              g_warning ("Dropping saved schedule entry ‘%s’: %s",
+                         entry_id, local_error->message);
+              continue;
+            }
+
+          g_ptr_array_add (data->entries, g_steal_pointer (&entry));
+        }
+    }
+
+  /* Look up the credentials of every peer mentioned in the state, which also
+   * starts watching them to see if they vanish in future. */
+  g_autoptr(GHashTable) peers = g_hash_table_new (g_str_hash, g_str_equal);
+
+  for (gsize i = 0; i < data->entries->len; i++)
+    g_hash_table_add (peers, (gpointer) mws_schedule_entry_get_owner (data->entries->pdata[i]));
+  for (gsize i = 0; data->active_entries_changed_subscribers[i] != NULL; i++)
+    g_hash_table_add (peers, data->active_entries_changed_subscribers[i]);
+  for (gsize i = 0; data->monitors[i] != NULL; i++)
+    g_hash_table_add (peers, data->monitors[i]);
+
+  g_debug ("%s: Restoring %u entries for %u peers",
+           G_STRFUNC, data->entries->len, g_hash_table_size (peers));
+
+  /* Hold a pending lookup until they have all been started, in case any of
+   * them complete synchronously. */
+  data->n_pending_lookups = 1;
+  g_task_set_task_data (task, g_steal_pointer (&data), (GDestroyNotify) restore_data_free);
+
+  GHashTableIter iter;
+  gpointer key;
+  MwsPeerManager *peer_manager = mws_scheduler_get_peer_manager (self->scheduler);
+  RestoreData *task_data = g_task_get_task_data (task);
+
+  g_hash_table_iter_init (&iter, peers);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      const gchar *peer = key;
+
+      if (!g_dbus_is_unique_name (peer))
+        continue;
+
+      task_data->n_pending_lookups++;
+      mws_peer_manager_ensure_peer_credentials_async (peer_manager, peer,
+                                                      cancellable,
+                                                      restore_state_lookup_cb,
+                                                      g_object_ref (task));
+    }
+
+  restore_state_finish_lookups (task);
+}
+
+static void
+restore_state_lookup_cb (GObject      *obj,
+                         GAsyncResult *result,
+                         gpointer      user_data)
+{
+  MwsPeerManager *peer_manager = MWS_PEER_MANAGER (obj);
+  g_autoptr(GTask) task = G_TASK (user_data);
+  g_autofree gchar *sender_path = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  /* Failure is expected for peers which have gone away since the state was
+   * saved; they’re filtered out once all the lookups are complete. */
+  sender_path = mws_peer_manager_ensure_peer_credentials_finish (peer_manager,
+                                                                 result, &local_error);
+  if (sender_path == NULL)
+    g_debug ("%s: Error looking up saved peer: %s", G_STRFUNC, local_error->message);
+
+  restore_state_finish_lookups (task);
+}
+
+/* Called once for each completed lookup. When the last lookup completes, add
+ * everything belonging to peers which still exist. */
+static void
+restore_state_finish_lookups (GTask *task)
+{
+  MwsScheduleService *self = g_task_get_source_object (task);
+  RestoreData *data = g_task_get_task_data (task);
+  MwsPeerManager *peer_manager = mws_scheduler_get_peer_manager (self->scheduler);
+  g_autoptr(GError) local_error = NULL;
+
+  g_assert (data->n_pending_lookups > 0);
+  data->n_pending_lookups--;
+
+  if (data->n_pending_lookups > 0)
+    return;
+
+  if (g_task_return_error_if_cancelled (task))
+    return;
+
+  /* Peers which vanished, or which couldn’t be identified, don’t have
+   * credentials in the cache. */
+  g_autoptr(GPtrArray) added = g_ptr_array_new_with_free_func (NULL);
+
+  for (gsize i = 0; i < data->entries->len; i++)
+    {
+      MwsScheduleEntry *entry = MWS_SCHEDULE_ENTRY (data->entries->pdata[i]);
+      const gchar *owner = mws_schedule_entry_get_owner (entry);
+
+      if (mws_peer_manager_get_peer_credentials (peer_manager, owner) != NULL)
+        g_ptr_array_add (added, entry);
+      else
+        g_debug ("%s: Dropping saved schedule entry ‘%s’ as its owner ‘%s’ "
+                 "has vanished", G_STRFUNC, mws_schedule_entry_get_id (entry),
+                 owner);
+    }
+
+  for (gsize i = 0; data->active_entries_changed_subscribers[i] != NULL; i++)
+    {
+      const gchar *peer = data->active_entries_changed_subscribers[i];
+
+      if (mws_peer_manager_get_peer_credentials (peer_manager, peer) != NULL)
+        g_hash_table_add (self->active_entries_changed_subscribers, g_strdup (peer));
+    }
+
+  for (gsize i = 0; data->monitors[i] != NULL; i++)
+    {
+      const gchar *peer = data->monitors[i];
+
+      if (mws_peer_manager_get_peer_credentials (peer_manager, peer) != NULL)
+        g_hash_table_add (self->monitors, g_strdup (peer));
+    }
+
+  if (added->len > 0 &&
+      !mws_scheduler_update_entries (self->scheduler, added, NULL, &local_error))
+    {
+      g_prefix_error (&local_error, _("Error restoring schedule entries: "));
+      g_task_return_error (task, g_steal_pointer (&local_error));
+      return;
+    }
+
+  g_message ("Restored %u schedule entries from a previous instance",
+             added->len);
+
+  g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * mws_schedule_service_restore_state_finish:
+ * @self: a #MwsScheduleService
+ * @result: asynchronous operation result
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish restoring the service’s state. See
+ * mws_schedule_service_restore_state_async().
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 0.3.0
+ */
+gboolean
+mws_schedule_service_restore_state_finish (MwsScheduleService  *self,
+                                           GAsyncResult        *result,
+                                           GError             **error)
+{
+  g_return_val_if_fail (MWS_IS_SCHEDULE_SERVICE (self), FALSE);
+  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+  g_return_val_if_fail (g_async_result_is_tagged (result, mws_schedule_service_restore_state_async), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
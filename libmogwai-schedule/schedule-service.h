@@ -42,5 +42,16 @@ gboolean mws_schedule_service_register   (MwsScheduleService  *self,
 void     mws_schedule_service_unregister (MwsScheduleService  *self);
 
 gboolean mws_schedule_service_get_busy   (MwsScheduleService  *self);
+gboolean mws_schedule_service_get_waiting (MwsScheduleService  *self);
+
+GVariant *mws_schedule_service_save_state           (MwsScheduleService   *self);
+void      mws_schedule_service_restore_state_async  (MwsScheduleService   *self,
+                                                     GVariant             *state,
+                                                     GCancellable         *cancellable,
+                                                     GAsyncReadyCallback   callback,
+                                                     gpointer              user_data);
+gboolean  mws_schedule_service_restore_state_finish (MwsScheduleService   *self,
+                                                     GAsyncResult         *result,
+                                                     GError              **error);
 
 G_END_DECLS
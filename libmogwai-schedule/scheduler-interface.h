@@ -105,6 +105,28 @@ static const GDBusMethodInfo scheduler_interface_schedule_entries =
   NULL,  /* annotations */
 };
 
+static const GDBusArgInfo scheduler_interface_schedule_entries_full_arg_entries =
+{
+  -1,  /* ref count */
+  (gchar *) "entry_array",
+  (gchar *) "a(oa{sv})",
+  NULL
+};
+
+static const GDBusArgInfo *scheduler_interface_schedule_entries_full_out_args[] =
+{
+  &scheduler_interface_schedule_entries_full_arg_entries,
+  NULL,
+};
+static const GDBusMethodInfo scheduler_interface_schedule_entries_full =
+{
+  -1,  /* ref count */
+  (gchar *) "ScheduleEntriesFull",
+  (GDBusArgInfo **) scheduler_interface_schedule_entries_in_args,
+  (GDBusArgInfo **) scheduler_interface_schedule_entries_full_out_args,
+  NULL,  /* annotations */
+};
+
 static const GDBusArgInfo scheduler_interface_hold_arg_reason =
 {
   -1,  /* ref count */
@@ -136,12 +158,160 @@ static const GDBusMethodInfo scheduler_interface_release =
   NULL,  /* annotations */
 };
 
+static const GDBusMethodInfo scheduler_interface_subscribe_active_entries_changed =
+{
+  -1,  /* ref count */
+  (gchar *) "SubscribeActiveEntriesChanged",
+  NULL,  /* in args */
+  NULL,  /* out args */
+  NULL,  /* annotations */
+};
+
+static const GDBusMethodInfo scheduler_interface_monitor =
+{
+  -1,  /* ref count */
+  (gchar *) "Monitor",
+  NULL,  /* in args */
+  NULL,  /* out args */
+  NULL,  /* annotations */
+};
+
+static const GDBusArgInfo scheduler_interface_update_entries_arg_entries =
+{
+  -1,  /* ref count */
+  (gchar *) "entries",
+  (gchar *) "a(oa{sv})",
+  NULL
+};
+
+static const GDBusArgInfo *scheduler_interface_update_entries_in_args[] =
+{
+  &scheduler_interface_update_entries_arg_entries,
+  NULL,
+};
+static const GDBusMethodInfo scheduler_interface_update_entries =
+{
+  -1,  /* ref count */
+  (gchar *) "UpdateEntries",
+  (GDBusArgInfo **) scheduler_interface_update_entries_in_args,
+  NULL,  /* out args */
+  NULL,  /* annotations */
+};
+
+static const GDBusArgInfo scheduler_interface_remove_entries_arg_entries =
+{
+  -1,  /* ref count */
+  (gchar *) "entries",
+  (gchar *) "ao",
+  NULL
+};
+
+static const GDBusArgInfo *scheduler_interface_remove_entries_in_args[] =
+{
+  &scheduler_interface_remove_entries_arg_entries,
+  NULL,
+};
+static const GDBusMethodInfo scheduler_interface_remove_entries =
+{
+  -1,  /* ref count */
+  (gchar *) "RemoveEntries",
+  (GDBusArgInfo **) scheduler_interface_remove_entries_in_args,
+  NULL,  /* out args */
+  NULL,  /* annotations */
+};
+
+static const GDBusArgInfo scheduler_interface_preview_arg_overrides =
+{
+  -1,  /* ref count */
+  (gchar *) "overrides",
+  (gchar *) "a{sv}",
+  NULL
+};
+
+static const GDBusArgInfo scheduler_interface_preview_arg_active_entries =
+{
+  -1,  /* ref count */
+  (gchar *) "active_entries",
+  (gchar *) "ao",
+  NULL
+};
+
+static const GDBusArgInfo scheduler_interface_preview_arg_next_reschedule =
+{
+  -1,  /* ref count */
+  (gchar *) "next_reschedule",
+  (gchar *) "t",
+  NULL
+};
+
+static const GDBusArgInfo *scheduler_interface_preview_in_args[] =
+{
+  &scheduler_interface_preview_arg_overrides,
+  NULL,
+};
+static const GDBusArgInfo *scheduler_interface_preview_out_args[] =
+{
+  &scheduler_interface_preview_arg_active_entries,
+  &scheduler_interface_preview_arg_next_reschedule,
+  NULL,
+};
+static const GDBusMethodInfo scheduler_interface_preview =
+{
+  -1,  /* ref count */
+  (gchar *) "Preview",
+  (GDBusArgInfo **) scheduler_interface_preview_in_args,
+  (GDBusArgInfo **) scheduler_interface_preview_out_args,
+  NULL,  /* annotations */
+};
+
 static const GDBusMethodInfo *scheduler_interface_methods[] =
 {
   &scheduler_interface_schedule,
   &scheduler_interface_schedule_entries,
+  &scheduler_interface_schedule_entries_full,
   &scheduler_interface_hold,
   &scheduler_interface_release,
+  &scheduler_interface_subscribe_active_entries_changed,
+  &scheduler_interface_monitor,
+  &scheduler_interface_update_entries,
+  &scheduler_interface_remove_entries,
+  &scheduler_interface_preview,
+  NULL,
+};
+
+static const GDBusArgInfo scheduler_interface_active_entries_changed_arg_added =
+{
+  -1,  /* ref count */
+  (gchar *) "added",
+  (gchar *) "ao",
+  NULL
+};
+
+static const GDBusArgInfo scheduler_interface_active_entries_changed_arg_removed =
+{
+  -1,  /* ref count */
+  (gchar *) "removed",
+  (gchar *) "ao",
+  NULL
+};
+
+static const GDBusArgInfo *scheduler_interface_active_entries_changed_args[] =
+{
+  &scheduler_interface_active_entries_changed_arg_added,
+  &scheduler_interface_active_entries_changed_arg_removed,
+  NULL,
+};
+static const GDBusSignalInfo scheduler_interface_active_entries_changed =
+{
+  -1,  /* ref count */
+  (gchar *) "ActiveEntriesChanged",
+  (GDBusArgInfo **) scheduler_interface_active_entries_changed_args,
+  NULL,  /* annotations */
+};
+
+static const GDBusSignalInfo *scheduler_interface_signals[] =
+{
+  &scheduler_interface_active_entries_changed,
   NULL,
 };
 
@@ -185,7 +355,7 @@ static const GDBusInterfaceInfo scheduler_interface =
   -1,  /* ref count */
   (gchar *) "com.endlessm.DownloadManager1.Scheduler",
   (GDBusMethodInfo **) scheduler_interface_methods,
-  NULL,  /* no signals */
+  (GDBusSignalInfo **) scheduler_interface_signals,
   (GDBusPropertyInfo **) scheduler_interface_properties,
   NULL,  /* no annotations */
 };
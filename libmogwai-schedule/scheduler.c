@@ -27,42 +27,391 @@
 #include <glib/gi18n-lib.h>
 #include <gio/gio.h>
 #include <libmogwai-schedule/clock.h>
+#include <libmogwai-schedule/concurrency-controller.h>
 #include <libmogwai-schedule/connection-monitor.h>
+#include <libmogwai-schedule/latency-histogram.h>
 #include <libmogwai-schedule/peer-manager.h>
+#include <libmogwai-schedule/peer-priorities.h>
 #include <libmogwai-schedule/schedule-entry.h>
 #include <libmogwai-schedule/scheduler.h>
+#include <libmogwai-schedule/trace-private.h>
+#include <libmogwai-schedule/usage-ledger.h>
 
 
 /* These errors do go over the bus, and are registered in schedule-service.c. */
 G_DEFINE_QUARK (MwsSchedulerError, mws_scheduler_error)
 
-/* Cached state for a schedule entry, including its current active state, and
- * any calculated state which is not trivially derivable from the properties of
- * the #MwsScheduleEntry itself. */
+/* A slot in #MwsScheduler.entry_slots, holding a schedule entry and its cached
+ * state, including its current active state, and any calculated state which is
+ * not trivially derivable from the properties of the #MwsScheduleEntry itself.
+ *
+ * Slots are identified by their index in #MwsScheduler.entry_slots, which is a
+ * stable handle for the entry while it’s in the scheduler. Pointers to slots
+ * are only valid until the next slot is allocated, since that may reallocate
+ * the array. Free slots have a %NULL @entry, and are chained together through
+ * @next_free_slot. */
 typedef struct
 {
+  MwsScheduleEntry *entry;  /* (owned) (nullable) */
   gboolean is_active;
+
+  /* Scratch space for update_active_entries(); always %FALSE outside it. */
+  gboolean is_selected;
+
+  /* Whether the entry is in #MwsScheduler.predicted_entries, so has a
+   * non-zero #MwsScheduleEntry:download-starts-at set by the scheduler. */
+  gboolean is_predicted;
+
+  /* Index of the next free slot, if this slot is free; otherwise
+   * %INVALID_ENTRY_SLOT. */
+  guint next_free_slot;
+
+  /* Links to the previous and next slots with entries for the same owner, in
+   * the list headed by the owner’s #OwnerEntries; %INVALID_ENTRY_SLOT at the
+   * ends of the list. */
+  guint owner_prev_slot;
+  guint owner_next_slot;
+
+  /* Position of the entry in #MwsScheduler.entries_by_priority. */
+  GSequenceIter *priority_iter;  /* (unowned) (nullable) */
+
+  /* Position of the entry in #MwsScheduler.small_entries_by_priority, or %NULL
+   * if it’s not a small entry; see entry_data_is_small(). */
+  GSequenceIter *small_iter;  /* (unowned) (nullable) */
+
+  /* Sort key for the entry; see entry_data_compare(). These are precomputed
+   * so that sorting doesn’t need to query the peer manager or do any string
+   * hashing. @entry_priority and @expected_size are copies of
+   * #MwsScheduleEntry:priority and #MwsScheduleEntry:expected-size, which are
+   * updated when those properties change. @peer_priority is calculated when the
+   * entry is added, and doesn’t change afterwards (even if the peer’s
+   * credentials do), so the ordering in #MwsScheduler.entries_by_priority stays
+   * consistent. */
+  gint peer_priority;
+  guint32 entry_priority;
+  guint64 expected_size;
+
+  /* #MwsScheduleEntry:deadline converted to microseconds since the Unix epoch,
+   * or zero if the entry has no deadline. This isn’t part of the sort key. */
+  gint64 deadline_usec;
+
+  /* Cache of #MwsScheduleEntry:bind-to-connection. */
+  gboolean bind_to_connection;
+
+  /* Time the entry last became active, in microseconds since the Unix epoch,
+   * for #MwsScheduler:min-run-time. Only meaningful while @is_active. */
+  gint64 active_since_usec;
 } EntryData;
 
-static EntryData *entry_data_new  (void);
-static void       entry_data_free (EntryData *data);
+/* Sentinel for the end of the free list in #MwsScheduler.entry_slots. */
+#define INVALID_ENTRY_SLOT G_MAXUINT
 
-G_DEFINE_AUTOPTR_CLEANUP_FUNC (EntryData, entry_data_free);
+/* An entry which select_entries() deferred, and the time plan_entry_start()
+ * planned for it to start, in microseconds since the Unix epoch. */
+typedef struct
+{
+  guint handle;
+  gint64 start_usec;
+} DeferredEntry;
 
-/* Create a new #EntryData struct with default values. */
-static EntryData *
-entry_data_new (void)
+static void
+entry_data_clear (EntryData *data)
+{
+  g_clear_object (&data->entry);
+}
+
+/* Index of the entries belonging to a single owner, as a doubly linked list
+ * threaded through their slots in #MwsScheduler.entry_slots, in the order they
+ * were added.
+ *
+ * @weight and @service_usec are only used if #MwsScheduler:fair-share is
+ * enabled. @weight is looked up in #MwsScheduler:peer-weights when the owner
+ * is added. @service_usec is the time the owner’s entries have spent active,
+ * divided by @weight; see charge_fair_share(). */
+typedef struct
+{
+  gchar *owner;  /* (owned) (not nullable) */
+  guint first_slot;
+  guint last_slot;
+  guint n_entries;  /* always > 0 */
+  guint weight;  /* always > 0 */
+  gint64 service_usec;
+} OwnerEntries;
+
+static OwnerEntries *owner_entries_new  (const gchar  *owner);
+static void          owner_entries_free (OwnerEntries *owner_entries);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (OwnerEntries, owner_entries_free);
+
+/* Create a new, empty #OwnerEntries for @owner. */
+static OwnerEntries *
+owner_entries_new (const gchar *owner)
+{
+  g_autoptr(OwnerEntries) owner_entries = g_new0 (OwnerEntries, 1);
+  owner_entries->owner = g_strdup (owner);
+  owner_entries->first_slot = INVALID_ENTRY_SLOT;
+  owner_entries->last_slot = INVALID_ENTRY_SLOT;
+  owner_entries->weight = 1;
+  return g_steal_pointer (&owner_entries);
+}
+
+static void
+owner_entries_free (OwnerEntries *owner_entries)
+{
+  g_free (owner_entries->owner);
+  g_free (owner_entries);
+}
+
+/* A future span of time during which a connection’s tariff doesn’t change,
+ * used to plan when entries with a deadline should start; see
+ * plan_entry_start(). @capacity_limit is %G_MAXUINT64 if the window has no
+ * limit (including if no tariff period covers it). */
+typedef struct
+{
+  gint64 start_usec;
+  gint64 end_usec;
+  guint64 capacity_limit;
+} TariffWindow;
+
+/* How far ahead, and how many tariff windows, to plan deferred entries over.
+ * Entries with deadlines further in the future are treated as if their
+ * deadline was at the horizon. Arbitrarily chosen to cover a week of tariffs
+ * with a few periods each day. */
+static const gint64 PLANNING_HORIZON_USEC = G_GINT64_CONSTANT (7) * 24 * 60 * 60 * G_USEC_PER_SEC;
+static const guint MAX_PLANNING_WINDOWS = 32;
+
+/* Cached verdict for a network connection, calculated from its details and
+ * tariff at a particular time. It remains valid until the connection’s details
+ * change, the clock changes, or the time reaches @next_transition_usec. */
+typedef struct
+{
+  gchar *connection_id;  /* (owned) (not nullable) */
+
+  /* Index of this connection in #MwsScheduler.transitions_heap. */
+  guint heap_index;
+
+  /* Whether the user’s preferences allow downloads on this connection; used
+   * for #MwsScheduler:allow-downloads. */
+  gboolean allow_downloads;
+
+  /* Whether it’s currently safe to download on this connection. */
+  gboolean is_safe;
+
+  /* Current tariff period for the connection, if it has a tariff. */
+  MwtPeriod *tariff_period;  /* (owned) (nullable) */
+
+  /* Next time the tariff changes period, in microseconds since the Unix
+   * epoch, or %G_MAXINT64 if it never does. This is always in the future
+   * relative to when the data was calculated. */
+  gint64 next_transition_usec;
+
+  /* Capacity limit of the current tariff period (%G_MAXUINT64 if it has none),
+   * and how much of it was left when the data was calculated. */
+  guint64 capacity_limit;
+  guint64 capacity_remaining;
+
+  /* Rate (in bytes per second) at which @capacity_remaining would be used up
+   * at the end of the current recurrence of the tariff period, or zero if
+   * downloads on this connection don’t need to be throttled. This is shared
+   * between all the active entries using the connection. */
+  guint64 max_rate;
+
+  /* Upcoming tariff windows, in order, starting at @next_transition_usec; or
+   * %NULL if the connection has no tariff. */
+  GArray *windows;  /* (owned) (nullable) (element-type TariffWindow) */
+} ConnectionData;
+
+static ConnectionData *connection_data_new  (const gchar    *connection_id);
+static void            connection_data_free (ConnectionData *data);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ConnectionData, connection_data_free);
+
+/* Create a new #ConnectionData struct with default values. */
+static ConnectionData *
+connection_data_new (const gchar *connection_id)
 {
-  g_autoptr(EntryData) data = g_new0 (EntryData, 1);
+  g_autoptr(ConnectionData) data = g_new0 (ConnectionData, 1);
+  data->connection_id = g_strdup (connection_id);
+  data->next_transition_usec = G_MAXINT64;
+  data->capacity_limit = G_MAXUINT64;
+  data->capacity_remaining = G_MAXUINT64;
   return g_steal_pointer (&data);
 }
 
 static void
-entry_data_free (EntryData *data)
+connection_data_free (ConnectionData *data)
 {
+  g_free (data->connection_id);
+  g_clear_object (&data->tariff_period);
+  g_clear_pointer (&data->windows, g_array_unref);
   g_free (data);
 }
 
+/* Number of bytes received over a connection during one recurrence of one of
+ * its tariff periods, to compare against the period’s capacity limit. */
+typedef struct
+{
+  MwtPeriod *period;  /* (owned) (not nullable) */
+  gint64 recurrence_start_usec;
+  gint64 recurrence_end_usec;
+  guint64 capacity_limit;
+  guint64 n_bytes;
+} PeriodUsage;
+
+static void
+period_usage_clear (PeriodUsage *usage)
+{
+  g_clear_object (&usage->period);
+}
+
+/* Byte accounting for a network connection. This is updated on every
+ * #MwsConnectionMonitor::connection-statistics-changed emission, so it must be
+ * cheap: the bytes received since the last emission are added to the usage
+ * for the tariff period recurrence at index @current_usage (if any), which is
+ * selected by calculate_connection_data().
+ *
+ * Usage is kept for each recurrence which hasn’t finished yet, so that if a
+ * period is interrupted by a shorter one (for example, a monthly period with
+ * free downloads at night), the count for the longer period resumes where it
+ * left off afterwards. It is kept across the connection being deactivated and
+ * reactivated, for the same reason. */
+typedef struct
+{
+  guint64 last_rx_bytes;
+  gboolean have_last_rx_bytes;
+
+  GArray *period_usages;  /* (owned) (element-type PeriodUsage) */
+  guint current_usage;  /* index into @period_usages, or %G_MAXUINT if none */
+} ConnectionUsage;
+
+static ConnectionUsage *
+connection_usage_new (void)
+{
+  ConnectionUsage *usage = g_new0 (ConnectionUsage, 1);
+  usage->period_usages = g_array_new (FALSE, TRUE, sizeof (PeriodUsage));
+  g_array_set_clear_func (usage->period_usages, (GDestroyNotify) period_usage_clear);
+  usage->current_usage = G_MAXUINT;
+  return usage;
+}
+
+static void
+connection_usage_free (ConnectionUsage *usage)
+{
+  g_clear_pointer (&usage->period_usages, g_array_unref);
+  g_free (usage);
+}
+
+/* Whether @usage has used up the capacity limit of its period. A limit of
+ * %G_MAXUINT64 means the period is unlimited. */
+static gboolean
+period_usage_reached_limit (const PeriodUsage *usage)
+{
+  return (usage->capacity_limit != G_MAXUINT64 &&
+          usage->n_bytes >= usage->capacity_limit);
+}
+
+/* Make the recurrence of @period starting at @recurrence_start_usec the one
+ * which bytes are counted against, adding a new #PeriodUsage for it if it
+ * hasn’t been seen before. A new #PeriodUsage starts from the count in
+ * @ledger for @connection_id, if there is one, so that usage persists across
+ * restarts. Usage for recurrences which have finished by @now_usec is
+ * discarded. If @period is %NULL, bytes are not counted against anything.
+ * Returns the current #PeriodUsage, which is only valid until the next call; or
+ * %NULL if @period is %NULL. */
+static PeriodUsage *
+connection_usage_select_period (ConnectionUsage *usage,
+                                MwsUsageLedger  *ledger,
+                                const gchar     *connection_id,
+                                MwtPeriod       *period,
+                                gint64           recurrence_start_usec,
+                                gint64           recurrence_end_usec,
+                                gint64           now_usec)
+{
+  usage->current_usage = G_MAXUINT;
+
+  for (guint i = usage->period_usages->len; i > 0; i--)
+    {
+      const PeriodUsage *period_usage = &g_array_index (usage->period_usages,
+                                                        PeriodUsage, i - 1);
+      if (period_usage->recurrence_end_usec <= now_usec)
+        g_array_remove_index_fast (usage->period_usages, i - 1);
+    }
+
+  if (period == NULL)
+    return NULL;
+
+  for (guint i = 0; i < usage->period_usages->len; i++)
+    {
+      PeriodUsage *period_usage = &g_array_index (usage->period_usages,
+                                                  PeriodUsage, i);
+
+      if (period_usage->period == period &&
+          period_usage->recurrence_start_usec == recurrence_start_usec)
+        {
+          usage->current_usage = i;
+          return period_usage;
+        }
+    }
+
+  PeriodUsage new_usage =
+    {
+      .period = g_object_ref (period),
+      .recurrence_start_usec = recurrence_start_usec,
+      .recurrence_end_usec = recurrence_end_usec,
+      .capacity_limit = mwt_period_get_capacity_limit (period),
+      .n_bytes = (ledger != NULL) ? mws_usage_ledger_lookup (ledger, connection_id,
+                                                             recurrence_start_usec,
+                                                             recurrence_end_usec) : 0,
+    };
+  g_array_append_val (usage->period_usages, new_usage);
+  usage->current_usage = usage->period_usages->len - 1;
+
+  return &g_array_index (usage->period_usages, PeriodUsage, usage->current_usage);
+}
+
+/* Like connection_usage_select_period(), but without modifying @usage (which
+ * may be %NULL if nothing has been counted for @connection_id yet), for use
+ * when computing a plan which shouldn’t have any side effects. The returned
+ * #PeriodUsage doesn’t own a reference to its @period. */
+static PeriodUsage
+connection_usage_peek_period (const ConnectionUsage *usage,
+                              MwsUsageLedger        *ledger,
+                              const gchar           *connection_id,
+                              MwtPeriod             *period,
+                              gint64                 recurrence_start_usec,
+                              gint64                 recurrence_end_usec)
+{
+  for (guint i = 0; usage != NULL && i < usage->period_usages->len; i++)
+    {
+      const PeriodUsage *period_usage = &g_array_index (usage->period_usages,
+                                                        PeriodUsage, i);
+
+      if (period_usage->period == period &&
+          period_usage->recurrence_start_usec == recurrence_start_usec)
+        return *period_usage;
+    }
+
+  PeriodUsage peeked_usage =
+    {
+      .period = period,
+      .recurrence_start_usec = recurrence_start_usec,
+      .recurrence_end_usec = recurrence_end_usec,
+      .capacity_limit = mwt_period_get_capacity_limit (period),
+      .n_bytes = (ledger != NULL) ? mws_usage_ledger_lookup (ledger, connection_id,
+                                                             recurrence_start_usec,
+                                                             recurrence_end_usec) : 0,
+    };
+
+  return peeked_usage;
+}
+
+static gint64
+date_time_to_usec (GDateTime *date_time)
+{
+  return (g_date_time_to_unix (date_time) * G_USEC_PER_SEC +
+          g_date_time_get_microsecond (date_time));
+}
+
 static void mws_scheduler_constructed  (GObject      *object);
 static void mws_scheduler_dispose      (GObject      *object);
 
@@ -82,11 +431,43 @@ static void connection_monitor_connections_changed_cb        (MwsConnectionMonit
 static void connection_monitor_connection_details_changed_cb (MwsConnectionMonitor *connection_monitor,
                                                               const gchar          *connection_id,
                                                               gpointer              user_data);
+static void connection_monitor_connection_statistics_changed_cb (MwsConnectionMonitor *connection_monitor,
+                                                                 const gchar          *connection_id,
+                                                                 guint64               rx_bytes,
+                                                                 gpointer              user_data);
 static void peer_manager_peer_vanished_cb                    (MwsPeerManager       *manager,
                                                               const gchar          *name,
                                                               gpointer              user_data);
 static void clock_offset_changed_cb                          (MwsClock             *clock,
                                                               gpointer              user_data);
+static void entry_notify_priority_cb                         (GObject              *obj,
+                                                              GParamSpec           *pspec,
+                                                              gpointer              user_data);
+static void entry_notify_expected_size_cb                    (GObject              *obj,
+                                                              GParamSpec           *pspec,
+                                                              gpointer              user_data);
+static void entry_notify_deadline_cb                         (GObject              *obj,
+                                                              GParamSpec           *pspec,
+                                                              gpointer              user_data);
+static void entry_notify_bind_to_connection_cb               (GObject              *obj,
+                                                              GParamSpec           *pspec,
+                                                              gpointer              user_data);
+
+static gint get_peer_priority              (MwsScheduler     *self,
+                                            MwsScheduleEntry *entry);
+static gint entry_data_sequence_compare_cb (gconstpointer     a,
+                                            gconstpointer     b,
+                                            gpointer          user_data);
+static void update_small_entry             (MwsScheduler     *self,
+                                            guint             handle);
+
+static void invalidate_connections_verdict      (MwsScheduler *self);
+static void invalidate_connection               (MwsScheduler *self,
+                                                 const gchar  *connection_id);
+static void invalidate_connections_transitioned (MwsScheduler *self,
+                                                 GDateTime    *now);
+static void update_active_entries               (MwsScheduler *self);
+static void queue_update_active_entries         (MwsScheduler *self);
 
 /**
  * MwsScheduler:
@@ -105,27 +486,155 @@ struct _MwsScheduler
   MwsConnectionMonitor *connection_monitor;  /* (owned) */
   MwsPeerManager *peer_manager;  /* (owned) */
   MwsClock *clock;  /* (owned) */
-
-  /* Time tracking. */
+  MwsUsageLedger *usage_ledger;  /* (owned) (nullable) */
+  MwsConcurrencyController *concurrency_controller;  /* (owned) (nullable) */
+
+  /* Time tracking. There is only ever one alarm, for the earliest of the next
+   * events which could change the schedule: the top of @transitions_heap,
+   * or @next_deferral_usec. It is only re-armed when that changes.
+   * @reschedule_alarm_usec is the time it’s set for, in microseconds since the
+   * Unix epoch. */
   guint reschedule_alarm_id;  /* 0 when no reschedule is scheduled */
-
-  /* Mapping from entry ID to (not nullable) entry. */
-  GHashTable *entries;  /* (owned) (element-type utf8 MwsScheduleEntry) */
+  gint64 reschedule_alarm_usec;
+
+  /* Binary min-heap of the #ConnectionData in @connections_data, ordered by
+   * #ConnectionData.next_transition_usec (the next tariff transition or
+   * capacity limit reset for the connection), so the next transition out of
+   * all the connections is at index 0. Each #ConnectionData stores its index
+   * in #ConnectionData.heap_index. The elements are owned by
+   * @connections_data. */
+  GPtrArray *transitions_heap;  /* (owned) (element-type ConnectionData) */
+
+  /* Earliest time a deferred entry is planned to start (see
+   * plan_entry_start()), or an active entry stops being protected from
+   * preemption by #MwsScheduler:min-run-time, as of the last reschedule; or
+   * %G_MAXINT64 if there are none. */
+  gint64 next_deferral_usec;
+
+  /* Coalescing of reschedules. If @reschedule_delay_ms is non-zero, changes to
+   * the scheduler’s inputs mark it as needing a reschedule, and a single
+   * reschedule is done @reschedule_delay_ms after the first of them. */
+  guint reschedule_delay_ms;
+  guint reschedule_source_id;  /* 0 when no coalesced reschedule is pending */
+
+  /* Reschedules can be frozen by mws_scheduler_freeze_reschedule() while a
+   * batch of changes is made. While @reschedule_freeze_count is non-zero,
+   * changes only set @reschedule_pending, and the reschedule is queued when
+   * the scheduler is thawed. */
+  guint reschedule_freeze_count;
+  gboolean reschedule_pending;
+
+  /* Dense store of all the entries and their data, indexed by slot handle.
+   * Slots freed by removing entries are reused (most recently freed first)
+   * before the array is grown. */
+  GArray *entry_slots;  /* (owned) (element-type EntryData) */
+  guint first_free_slot;  /* INVALID_ENTRY_SLOT if there are no free slots */
   gsize max_entries;
-
-  /* Mapping from entry ID to (not nullable) entry data. We can’t use the same
-   * hash table as @entries since we need to be able to return that one in
-   * mws_scheduler_get_entries(). Always has the same set of keys as @entries. */
-  GHashTable *entries_data;  /* (owned) (element-type utf8 EntryData) */
-
-  /* Maximum number of downloads allowed to be active at the same time. */
+  gsize max_entries_per_owner;
+
+  /* Mapping from entry ID to slot handle in @entry_slots. This is the only
+   * index of the entries by ID. The keys are owned by the entries. */
+  GHashTable *entry_handles;  /* (owned) (element-type utf8 guint) */
+
+  /* Mapping from owner to the list of that owner’s entries in @entry_slots,
+   * so that the entries for an owner can be found without examining all the
+   * entries. Owners with no entries are not in the map. The keys are owned by
+   * the values. */
+  GHashTable *entries_by_owner;  /* (owned) (element-type utf8 OwnerEntries) */
+
+  /* Lazily built mapping from entry ID to entry, for
+   * mws_scheduler_get_entries(). This is cleared whenever the set of entries
+   * changes, and rebuilt on the next call. */
+  GHashTable *entries_view;  /* (owned) (nullable) (element-type utf8 MwsScheduleEntry) */
+
+  /* Handles of all the entries from @entry_slots, kept sorted by
+   * entry_data_compare() so that the most important entries are first. This is
+   * a balanced tree, updated incrementally as entries are added and removed,
+   * or as their priorities change, so that scheduling doesn’t need to sort
+   * every entry on every reschedule. */
+  GSequence *entries_by_priority;  /* (owned) (element-type guint) */
+
+  /* Handles of the entries whose expected size is at most
+   * @small_entry_threshold, sorted in the same order as @entries_by_priority.
+   * This is used to find the most important small entry to put in the
+   * reserved slot without examining all the entries. It is always empty if
+   * @small_entry_threshold is zero. */
+  GSequence *small_entries_by_priority;  /* (owned) (element-type guint) */
+  guint64 small_entry_threshold;
+
+  /* Preemption policy; see retain_preempted_entries(). All of these are zero
+   * (the default) to always let the most important entries preempt active
+   * ones. */
+  guint min_run_time_secs;
+  guint preemption_priority_margin;
+  guint non_resumable_protect_percent;  /* 0–100 */
+  guint64 non_resumable_protect_size;
+
+  /* Fair-share policy; see select_fair_share_entries(). If @fair_share is
+   * %FALSE, slots are given out strictly in the order of @entries_by_priority.
+   * @fair_share_charged_usec is the time (in microseconds since the Unix
+   * epoch) up to which the active entries’ owners have been charged, or zero if
+   * they never have. */
+  gboolean fair_share;
+  guint fair_share_quantum_secs;
+  GHashTable *peer_weights;  /* (owned) (nullable) (element-type filename guint) */
+  gint64 fair_share_charged_usec;
+
+  /* Handles of the subset of the entries which are currently active, in
+   * the order select_entries() returned them. Always has at most @max_active_entries elements,
+   * and contains exactly those entries whose #EntryData.is_active is %TRUE. */
+  GArray *active_entries;  /* (owned) (element-type guint) */
+
+  /* Handles of the entries which were given a prediction for
+   * #MwsScheduleEntry:download-starts-at in the last reschedule, so that the
+   * prediction can be cleared once it no longer applies. This may contain
+   * handles whose slots have been freed or reused since; those have
+   * #EntryData.is_predicted cleared. */
+  GArray *predicted_entries;  /* (owned) (element-type guint) */
+
+  /* Maximum number of downloads allowed to be active at the same time. If
+   * @concurrency_controller is set, its limit may lower this; see
+   * get_max_active_entries(). */
   guint max_active_entries;
 
+  /* Running total of bytes received over all connections, to feed
+   * @concurrency_controller. */
+  guint64 total_rx_bytes;
+
   /* Cache of some of the connection data used by our properties. */
   gboolean cached_allow_downloads;
 
+  /* Cached verdict on the network connections, which only depends on the
+   * connection monitor and the clock, and not on the set of entries. This is
+   * recalculated lazily when it’s invalidated by a change to the connections,
+   * their details, or the clock. @cached_connections_safe is %TRUE if it’s
+   * currently safe to download on all the active connections.
+   * @cached_safe_connection_ids lists the connections which are individually
+   * safe to download on, in the order the connection monitor returns them;
+   * entries which can be bound to a connection are assigned one of them.
+   *
+   * @connections_data caches the verdict for each connection individually, so
+   * that only the connections which have changed need their details and
+   * tariffs re-examining. Connections which are missing from it are
+   * recalculated when the verdict is next needed. Its keys are owned by the
+   * values. Every #ConnectionData in it is also in @transitions_heap. */
+  gboolean connections_verdict_valid;
+  gboolean cached_connections_safe;
+  GPtrArray *cached_safe_connection_ids;  /* (owned) (element-type utf8) */
+  GHashTable *connections_data;  /* (owned) (element-type utf8 ConnectionData) */
+
+  /* Byte accounting for each connection which has been seen, used to enforce
+   * the capacity limits of their tariffs. Entries are not removed when
+   * connections are removed, so that usage persists if they’re re-added. */
+  GHashTable *connections_usage;  /* (owned) (element-type utf8 ConnectionUsage) */
+
   /* Sanity check that we don’t reschedule re-entrantly. */
   gboolean in_reschedule;
+
+  /* How long each call to update_active_entries() has taken, including
+   * emitting #MwsScheduler::active-entries-changed. Exposed for performance
+   * monitoring by mws_scheduler_get_reschedule_latency(). */
+  MwsLatencyHistogram reschedule_latency;
 };
 
 /* Arbitrarily chosen. */
@@ -150,6 +659,19 @@ typedef enum
   PROP_PEER_MANAGER,
   PROP_ALLOW_DOWNLOADS,
   PROP_CLOCK,
+  PROP_RESCHEDULE_DELAY,
+  PROP_USAGE_LEDGER,
+  PROP_CONCURRENCY_CONTROLLER,
+  PROP_SMALL_ENTRY_THRESHOLD,
+  PROP_NEXT_RESCHEDULE,
+  PROP_MIN_RUN_TIME,
+  PROP_PREEMPTION_PRIORITY_MARGIN,
+  PROP_NON_RESUMABLE_PROTECT_PERCENT,
+  PROP_NON_RESUMABLE_PROTECT_SIZE,
+  PROP_FAIR_SHARE,
+  PROP_FAIR_SHARE_QUANTUM,
+  PROP_PEER_WEIGHTS,
+  PROP_MAX_ENTRIES_PER_OWNER,
 } MwsSchedulerProperty;
 
 G_DEFINE_TYPE (MwsScheduler, mws_scheduler, G_TYPE_OBJECT)
@@ -158,7 +680,7 @@ static void
 mws_scheduler_class_init (MwsSchedulerClass *klass)
 {
   GObjectClass *object_class = (GObjectClass *) klass;
-  GParamSpec *props[PROP_CLOCK + 1] = { NULL, };
+  GParamSpec *props[PROP_MAX_ENTRIES_PER_OWNER + 1] = { NULL, };
 
   object_class->constructed = mws_scheduler_constructed;
   object_class->dispose = mws_scheduler_dispose;
@@ -288,6 +810,262 @@ mws_scheduler_class_init (MwsSchedulerClass *klass)
                            MWS_TYPE_CLOCK,
                            G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
 
+  /**
+   * MwsScheduler:reschedule-delay:
+   *
+   * Delay, in milliseconds, for coalescing reschedules. If this is zero (the
+   * default), the scheduler reschedules synchronously whenever one of its
+   * inputs changes (the set of entries, their priorities, the network
+   * connections or the clock).
+   *
+   * If it is non-zero, changes to the inputs mark the scheduler as needing a
+   * reschedule, and a single reschedule is done from the main context this
+   * long after the first change. This means that a burst of changes results
+   * in one reschedule rather than one per change, at the cost of the set of
+   * active entries lagging behind the changes by up to this delay.
+   * mws_scheduler_reschedule() always reschedules synchronously.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_RESCHEDULE_DELAY] =
+      g_param_spec_uint ("reschedule-delay", "Reschedule Delay",
+                         "Delay, in milliseconds, for coalescing reschedules.",
+                         0, G_MAXUINT, 0,
+                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwsScheduler:usage-ledger:
+   *
+   * A #MwsUsageLedger to persist the number of bytes downloaded over each
+   * connection in the current recurrence of its tariff period, so that
+   * capacity limits are enforced correctly across restarts. If this is %NULL
+   * (the default), usage is only counted in memory.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_USAGE_LEDGER] =
+      g_param_spec_object ("usage-ledger", "Usage Ledger",
+                           "A #MwsUsageLedger to persist connection usage in.",
+                           MWS_TYPE_USAGE_LEDGER,
+                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwsScheduler:concurrency-controller:
+   *
+   * A #MwsConcurrencyController to adapt the number of schedule entries which
+   * can be active at once to the measured throughput and system load. If this
+   * is set, #MwsScheduler:max-active-entries is an upper bound on its limit.
+   * If it is %NULL (the default), #MwsScheduler:max-active-entries is used as
+   * the limit directly.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_CONCURRENCY_CONTROLLER] =
+      g_param_spec_object ("concurrency-controller", "Concurrency Controller",
+                           "A #MwsConcurrencyController to adapt the number of "
+                           "active entries.",
+                           MWS_TYPE_CONCURRENCY_CONTROLLER,
+                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwsScheduler:small-entry-threshold:
+   *
+   * Largest #MwsScheduleEntry:expected-size, in bytes, for an entry to be
+   * considered small. If more than one entry can be active, and none of the
+   * most important entries are small, one of the active slots is reserved for
+   * the most important small entry, so that small downloads don’t have to
+   * wait behind large ones. Entries with an unknown expected size are never
+   * small.
+   *
+   * If this is zero (the default), no slot is reserved.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_SMALL_ENTRY_THRESHOLD] =
+      g_param_spec_uint64 ("small-entry-threshold", "Small Entry Threshold",
+                           "Largest expected size, in bytes, for an entry to "
+                           "be considered small.",
+                           0, G_MAXUINT64, 0,
+                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwsScheduler:next-reschedule:
+   *
+   * Time of the next planned reschedule, in microseconds since the Unix epoch,
+   * or %G_MAXINT64 if none is planned. This is the earliest tariff transition
+   * of any of the current connections, the planned start of a deferred entry,
+   * or the end of an active entry’s #MwsScheduler:min-run-time (if that’s
+   * stopping it being preempted), whichever is sooner; nothing else about the
+   * plan can change before then unless the entries, connections or peers
+   * change.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_NEXT_RESCHEDULE] =
+      g_param_spec_int64 ("next-reschedule", "Next Reschedule",
+                          "Time of the next planned reschedule, in "
+                          "microseconds since the Unix epoch.",
+                          G_MININT64, G_MAXINT64, G_MAXINT64,
+                          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwsScheduler:min-run-time:
+   *
+   * Minimum time, in seconds, an entry stays active once it becomes active
+   * before a more important entry can take its slot. This stops a burst of
+   * new entries or priority changes from repeatedly pausing and restarting
+   * downloads. It doesn’t stop entries being made inactive when the network
+   * connections stop being safe to download on, or when fewer entries can be
+   * active.
+   *
+   * If this is zero (the default), entries can be preempted straight away.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_MIN_RUN_TIME] =
+      g_param_spec_uint ("min-run-time", "Min. Run Time",
+                         "Minimum time, in seconds, an entry is active for "
+                         "before it can be preempted.",
+                         0, G_MAXUINT, 0,
+                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwsScheduler:preemption-priority-margin:
+   *
+   * How much higher the #MwsScheduleEntry:priority of an entry must be than
+   * that of an active entry from the same peer for it to take the active
+   * entry’s slot. Entries from more important peers always preempt entries
+   * from less important ones.
+   *
+   * If this is zero (the default), any entry which would be ordered before an
+   * active entry can preempt it.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_PREEMPTION_PRIORITY_MARGIN] =
+      g_param_spec_uint ("preemption-priority-margin", "Preemption Priority Margin",
+                         "Difference in priority needed for an entry to "
+                         "preempt an active one.",
+                         0, G_MAXUINT32, 0,
+                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwsScheduler:non-resumable-protect-percent:
+   *
+   * Percentage of its #MwsScheduleEntry:expected-size which an active,
+   * non-resumable entry must have downloaded (according to its
+   * #MwsScheduleEntry:downloaded-size) for it to be protected from preemption.
+   * Preempting such an entry would waste everything it has downloaded so far.
+   * Entries with an unknown expected size are only covered by
+   * #MwsScheduler:non-resumable-protect-size.
+   *
+   * If this is zero (the default), entries aren’t protected by percentage.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_NON_RESUMABLE_PROTECT_PERCENT] =
+      g_param_spec_uint ("non-resumable-protect-percent", "Non-Resumable Protect Percent",
+                         "Percentage of a non-resumable entry which must be "
+                         "downloaded for it to be protected from preemption.",
+                         0, 100, 0,
+                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwsScheduler:non-resumable-protect-size:
+   *
+   * Number of bytes which an active, non-resumable entry must have downloaded
+   * (according to its #MwsScheduleEntry:downloaded-size) for it to be
+   * protected from preemption. See
+   * #MwsScheduler:non-resumable-protect-percent.
+   *
+   * If this is zero (the default), entries aren’t protected by size.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_NON_RESUMABLE_PROTECT_SIZE] =
+      g_param_spec_uint64 ("non-resumable-protect-size", "Non-Resumable Protect Size",
+                           "Number of bytes of a non-resumable entry which "
+                           "must be downloaded for it to be protected from "
+                           "preemption.",
+                           0, G_MAXUINT64, 0,
+                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwsScheduler:fair-share:
+   *
+   * Whether to share the active slots fairly between peers, rather than giving
+   * them all to the entries from the most important peer. If this is enabled,
+   * each peer gets a share of the slots proportional to its weight (see
+   * #MwsScheduler:peer-weights), measured over time: a peer whose entries have
+   * spent less time active, relative to its weight, is given the next slot.
+   * Peers’ priorities are then only used to break ties, and each peer’s
+   * entries are still ordered by their #MwsScheduleEntry:priority.
+   *
+   * If this is %FALSE (the default), entries from more important peers always
+   * take precedence over those from less important peers.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_FAIR_SHARE] =
+      g_param_spec_boolean ("fair-share", "Fair Share",
+                            "Whether to share active slots fairly between "
+                            "peers.",
+                            FALSE,
+                            G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwsScheduler:fair-share-quantum:
+   *
+   * Quantum, in seconds, for #MwsScheduler:fair-share: how long a weight-1
+   * peer keeps an active slot for beyond its fair share before another peer
+   * which is waiting takes it. While any peer is waiting for a slot, the
+   * scheduler reschedules this often. Lower values share the slots more
+   * evenly over short periods, at the cost of pausing and resuming downloads
+   * more often.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_FAIR_SHARE_QUANTUM] =
+      g_param_spec_uint ("fair-share-quantum", "Fair Share Quantum",
+                         "Time, in seconds, a peer can exceed its fair share "
+                         "of the active slots for.",
+                         1, G_MAXUINT, 300,
+                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwsScheduler:peer-weights: (element-type filename guint)
+   *
+   * Map from the absolute paths of peers’ executables to their weights for
+   * #MwsScheduler:fair-share; see mws_peer_weights_lookup(). Peers which
+   * aren’t in the map have weight 1. If this is %NULL (the default), all peers
+   * have the same weight.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_PEER_WEIGHTS] =
+      g_param_spec_boxed ("peer-weights", "Peer Weights",
+                          "Map from peer executable paths to their fair-share "
+                          "weights.",
+                          G_TYPE_HASH_TABLE,
+                          G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * MwsScheduler:max-entries-per-owner:
+   *
+   * Maximum number of schedule entries which any single owner can have in the
+   * scheduler at any time, so that one misbehaving peer can’t use up all of
+   * #MwsScheduler:max-entries. By default, this is %G_MAXUINT, so only
+   * #MwsScheduler:max-entries applies. See mws_scheduler_check_quota().
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_MAX_ENTRIES_PER_OWNER] =
+      g_param_spec_uint ("max-entries-per-owner", "Max. Entries Per Owner",
+                         "Maximum number of schedule entries present in the "
+                         "scheduler for any one owner.",
+                         1, G_MAXUINT, G_MAXUINT,
+                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (object_class, G_N_ELEMENTS (props), props);
 
   /**
@@ -336,11 +1114,25 @@ mws_scheduler_class_init (MwsSchedulerClass *klass)
 static void
 mws_scheduler_init (MwsScheduler *self)
 {
-  self->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                         NULL, g_object_unref);
+  self->entry_slots = g_array_new (FALSE, TRUE, sizeof (EntryData));
+  g_array_set_clear_func (self->entry_slots, (GDestroyNotify) entry_data_clear);
+  self->first_free_slot = INVALID_ENTRY_SLOT;
   self->max_entries = DEFAULT_MAX_ENTRIES;
-  self->entries_data = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                              NULL, (GDestroyNotify) entry_data_free);
+  self->max_entries_per_owner = G_MAXUINT;
+  self->entry_handles = g_hash_table_new (g_str_hash, g_str_equal);
+  self->entries_by_owner = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                  NULL, (GDestroyNotify) owner_entries_free);
+  self->entries_by_priority = g_sequence_new (NULL);
+  self->small_entries_by_priority = g_sequence_new (NULL);
+  self->active_entries = g_array_new (FALSE, FALSE, sizeof (guint));
+  self->predicted_entries = g_array_new (FALSE, FALSE, sizeof (guint));
+  self->cached_safe_connection_ids = g_ptr_array_new_with_free_func (g_free);
+  self->connections_data = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                  NULL, (GDestroyNotify) connection_data_free);
+  self->transitions_heap = g_ptr_array_new_with_free_func (NULL);
+  self->next_deferral_usec = G_MAXINT64;
+  self->connections_usage = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                   g_free, (GDestroyNotify) connection_usage_free);
   self->max_active_entries = DEFAULT_MAX_ACTIVE_ENTRIES;
 }
 
@@ -362,6 +1154,8 @@ mws_scheduler_constructed (GObject *object)
                     (GCallback) connection_monitor_connections_changed_cb, self);
   g_signal_connect (self->connection_monitor, "connection-details-changed",
                     (GCallback) connection_monitor_connection_details_changed_cb, self);
+  g_signal_connect (self->connection_monitor, "connection-statistics-changed",
+                    (GCallback) connection_monitor_connection_statistics_changed_cb, self);
 
   /* Connect to signals from the peer manager, which will trigger removal of
    * entries when a peer disappears. */
@@ -382,8 +1176,39 @@ mws_scheduler_dispose (GObject *object)
 {
   MwsScheduler *self = MWS_SCHEDULER (object);
 
-  g_clear_pointer (&self->entries, g_hash_table_unref);
-  g_clear_pointer (&self->entries_data, g_hash_table_unref);
+  if (self->entry_slots != NULL)
+    {
+      for (guint i = 0; i < self->entry_slots->len; i++)
+        {
+          EntryData *data = &g_array_index (self->entry_slots, EntryData, i);
+
+          if (data->entry != NULL)
+            {
+              g_signal_handlers_disconnect_by_func (data->entry,
+                                                    entry_notify_priority_cb, self);
+              g_signal_handlers_disconnect_by_func (data->entry,
+                                                    entry_notify_expected_size_cb, self);
+              g_signal_handlers_disconnect_by_func (data->entry,
+                                                    entry_notify_deadline_cb, self);
+              g_signal_handlers_disconnect_by_func (data->entry,
+                                                    entry_notify_bind_to_connection_cb, self);
+            }
+        }
+    }
+
+  g_clear_pointer (&self->active_entries, g_array_unref);
+  g_clear_pointer (&self->predicted_entries, g_array_unref);
+  g_clear_pointer (&self->entries_by_priority, g_sequence_free);
+  g_clear_pointer (&self->small_entries_by_priority, g_sequence_free);
+  g_clear_pointer (&self->entries_view, g_hash_table_unref);
+  g_clear_pointer (&self->entry_handles, g_hash_table_unref);
+  g_clear_pointer (&self->entries_by_owner, g_hash_table_unref);
+  g_clear_pointer (&self->peer_weights, g_hash_table_unref);
+  g_clear_pointer (&self->entry_slots, g_array_unref);
+  g_clear_pointer (&self->cached_safe_connection_ids, g_ptr_array_unref);
+  g_clear_pointer (&self->transitions_heap, g_ptr_array_unref);
+  g_clear_pointer (&self->connections_data, g_hash_table_unref);
+  g_clear_pointer (&self->connections_usage, g_hash_table_unref);
 
   if (self->connection_monitor != NULL)
     {
@@ -393,6 +1218,9 @@ mws_scheduler_dispose (GObject *object)
       g_signal_handlers_disconnect_by_func (self->connection_monitor,
                                             connection_monitor_connection_details_changed_cb,
                                             self);
+      g_signal_handlers_disconnect_by_func (self->connection_monitor,
+                                            connection_monitor_connection_statistics_changed_cb,
+                                            self);
     }
 
   g_clear_object (&self->connection_monitor);
@@ -412,6 +1240,8 @@ mws_scheduler_dispose (GObject *object)
       self->reschedule_alarm_id = 0;
     }
 
+  g_clear_handle_id (&self->reschedule_source_id, g_source_remove);
+
   if (self->clock != NULL)
     {
       g_signal_handlers_disconnect_by_func (self->clock,
@@ -420,6 +1250,8 @@ mws_scheduler_dispose (GObject *object)
     }
 
   g_clear_object (&self->clock);
+  g_clear_object (&self->usage_ledger);
+  g_clear_object (&self->concurrency_controller);
 
   g_assert (!self->in_reschedule);
 
@@ -438,7 +1270,7 @@ mws_scheduler_get_property (GObject    *object,
   switch ((MwsSchedulerProperty) property_id)
     {
     case PROP_ENTRIES:
-      g_value_set_boxed (value, self->entries);
+      g_value_set_boxed (value, mws_scheduler_get_entries (self));
       break;
     case PROP_MAX_ENTRIES:
       g_value_set_uint (value, self->max_entries);
@@ -458,6 +1290,45 @@ mws_scheduler_get_property (GObject    *object,
     case PROP_CLOCK:
       g_value_set_object (value, self->clock);
       break;
+    case PROP_RESCHEDULE_DELAY:
+      g_value_set_uint (value, self->reschedule_delay_ms);
+      break;
+    case PROP_USAGE_LEDGER:
+      g_value_set_object (value, self->usage_ledger);
+      break;
+    case PROP_CONCURRENCY_CONTROLLER:
+      g_value_set_object (value, self->concurrency_controller);
+      break;
+    case PROP_SMALL_ENTRY_THRESHOLD:
+      g_value_set_uint64 (value, self->small_entry_threshold);
+      break;
+    case PROP_MIN_RUN_TIME:
+      g_value_set_uint (value, self->min_run_time_secs);
+      break;
+    case PROP_PREEMPTION_PRIORITY_MARGIN:
+      g_value_set_uint (value, self->preemption_priority_margin);
+      break;
+    case PROP_NON_RESUMABLE_PROTECT_PERCENT:
+      g_value_set_uint (value, self->non_resumable_protect_percent);
+      break;
+    case PROP_NON_RESUMABLE_PROTECT_SIZE:
+      g_value_set_uint64 (value, self->non_resumable_protect_size);
+      break;
+    case PROP_FAIR_SHARE:
+      g_value_set_boolean (value, self->fair_share);
+      break;
+    case PROP_FAIR_SHARE_QUANTUM:
+      g_value_set_uint (value, self->fair_share_quantum_secs);
+      break;
+    case PROP_PEER_WEIGHTS:
+      g_value_set_boxed (value, self->peer_weights);
+      break;
+    case PROP_MAX_ENTRIES_PER_OWNER:
+      g_value_set_uint (value, self->max_entries_per_owner);
+      break;
+    case PROP_NEXT_RESCHEDULE:
+      g_value_set_int64 (value, mws_scheduler_get_next_reschedule (self));
+      break;
     default:
       g_assert_not_reached ();
     }
@@ -475,6 +1346,7 @@ mws_scheduler_set_property (GObject      *object,
     {
     case PROP_ENTRIES:
     case PROP_ALLOW_DOWNLOADS:
+    case PROP_NEXT_RESCHEDULE:
       /* Read only. */
       g_assert_not_reached ();
       break;
@@ -501,6 +1373,57 @@ mws_scheduler_set_property (GObject      *object,
       g_assert (self->clock == NULL);
       self->clock = g_value_dup_object (value);
       break;
+    case PROP_RESCHEDULE_DELAY:
+      /* Construct only. */
+      self->reschedule_delay_ms = g_value_get_uint (value);
+      break;
+    case PROP_USAGE_LEDGER:
+      /* Construct only. */
+      g_assert (self->usage_ledger == NULL);
+      self->usage_ledger = g_value_dup_object (value);
+      break;
+    case PROP_CONCURRENCY_CONTROLLER:
+      /* Construct only. */
+      g_assert (self->concurrency_controller == NULL);
+      self->concurrency_controller = g_value_dup_object (value);
+      break;
+    case PROP_SMALL_ENTRY_THRESHOLD:
+      /* Construct only. */
+      self->small_entry_threshold = g_value_get_uint64 (value);
+      break;
+    case PROP_MIN_RUN_TIME:
+      /* Construct only. */
+      self->min_run_time_secs = g_value_get_uint (value);
+      break;
+    case PROP_PREEMPTION_PRIORITY_MARGIN:
+      /* Construct only. */
+      self->preemption_priority_margin = g_value_get_uint (value);
+      break;
+    case PROP_NON_RESUMABLE_PROTECT_PERCENT:
+      /* Construct only. */
+      self->non_resumable_protect_percent = g_value_get_uint (value);
+      break;
+    case PROP_NON_RESUMABLE_PROTECT_SIZE:
+      /* Construct only. */
+      self->non_resumable_protect_size = g_value_get_uint64 (value);
+      break;
+    case PROP_FAIR_SHARE:
+      /* Construct only. */
+      self->fair_share = g_value_get_boolean (value);
+      break;
+    case PROP_FAIR_SHARE_QUANTUM:
+      /* Construct only. */
+      self->fair_share_quantum_secs = g_value_get_uint (value);
+      break;
+    case PROP_PEER_WEIGHTS:
+      /* Construct only. */
+      g_assert (self->peer_weights == NULL);
+      self->peer_weights = g_value_dup_boxed (value);
+      break;
+    case PROP_MAX_ENTRIES_PER_OWNER:
+      /* Construct only. */
+      self->max_entries_per_owner = g_value_get_uint (value);
+      break;
     default:
       g_assert_not_reached ();
     }
@@ -518,7 +1441,27 @@ connection_monitor_connections_changed_cb (MwsConnectionMonitor *connection_moni
   g_debug ("%s: Connections changed (%u added, %u removed)",
            G_STRFUNC, (added != NULL) ? added->len : 0,
            (removed != NULL) ? removed->len : 0);
-  mws_scheduler_reschedule (self);
+
+  /* Only the added and removed connections need to be re-examined. */
+  for (gsize i = 0; added != NULL && i < added->len; i++)
+    invalidate_connection (self, g_ptr_array_index (added, i));
+  for (gsize i = 0; removed != NULL && i < removed->len; i++)
+    {
+      const gchar *connection_id = g_ptr_array_index (removed, i);
+      ConnectionUsage *usage = g_hash_table_lookup (self->connections_usage,
+                                                    connection_id);
+
+      invalidate_connection (self, connection_id);
+
+      /* The connection’s byte counter will restart if it’s re-added. */
+      if (usage != NULL)
+        usage->have_last_rx_bytes = FALSE;
+    }
+
+  /* Make sure the aggregate verdict is recalculated even if both arrays are
+   * empty. */
+  self->connections_verdict_valid = FALSE;
+  queue_update_active_entries (self);
 }
 
 static void
@@ -530,37 +1473,432 @@ connection_monitor_connection_details_changed_cb (MwsConnectionMonitor *connecti
 
   /* This needs to update self->cached_allow_downloads too. */
   g_debug ("%s: Connection ‘%s’ changed details", G_STRFUNC, connection_id);
-  mws_scheduler_reschedule (self);
+  invalidate_connection (self, connection_id);
+  queue_update_active_entries (self);
 }
 
-static void
-peer_manager_peer_vanished_cb (MwsPeerManager *manager,
-                               const gchar    *name,
-                               gpointer        user_data)
+/* Get the #ConnectionUsage for @connection_id, creating it if needed. */
+static ConnectionUsage *
+get_connection_usage (MwsScheduler *self,
+                      const gchar  *connection_id)
 {
-  MwsScheduler *self = MWS_SCHEDULER (user_data);
-  g_autoptr(GError) local_error = NULL;
+  ConnectionUsage *usage = g_hash_table_lookup (self->connections_usage,
+                                                connection_id);
 
-  /* Remove the schedule entries for this peer. */
-  if (!mws_scheduler_remove_entries_for_owner (self, name, &local_error))
+  if (usage == NULL)
     {
-      g_debug ("Failed to remove schedule entries for owner ‘%s’: %s",
-               name, local_error->message);
+      usage = connection_usage_new ();
+      g_hash_table_insert (self->connections_usage, g_strdup (connection_id), usage);
     }
+
+  return usage;
 }
 
 static void
-clock_offset_changed_cb (MwsClock *clock,
-                         gpointer  user_data)
+connection_monitor_connection_statistics_changed_cb (MwsConnectionMonitor *connection_monitor,
+                                                     const gchar          *connection_id,
+                                                     guint64               rx_bytes,
+                                                     gpointer              user_data)
 {
   MwsScheduler *self = MWS_SCHEDULER (user_data);
+  ConnectionUsage *usage = get_connection_usage (self, connection_id);
+  guint64 n_received = 0;
 
-  g_autoptr(GDateTime) now = mws_clock_get_now_local (clock);
-  g_autofree gchar *now_str = g_date_time_format (now, "%FT%T%:::z");
+  /* The first value seen is a baseline. If the counter goes backwards, the
+   * connection’s devices have changed, so count from the new value instead. */
+  if (usage->have_last_rx_bytes && rx_bytes >= usage->last_rx_bytes)
+    n_received = rx_bytes - usage->last_rx_bytes;
 
-  g_debug ("%s: Clock offset changed; time is now %s", G_STRFUNC, now_str);
-  mws_scheduler_reschedule (self);
-}
+  usage->last_rx_bytes = rx_bytes;
+  usage->have_last_rx_bytes = TRUE;
+
+  /* Feed the aggregate throughput to the concurrency controller, even if
+   * nothing was received, since that’s a sample too. */
+  self->total_rx_bytes += n_received;
+
+  if (self->concurrency_controller != NULL)
+    {
+      g_autoptr(GDateTime) now = mws_clock_get_now_local (self->clock);
+
+      if (mws_concurrency_controller_update (self->concurrency_controller,
+                                             date_time_to_usec (now),
+                                             self->total_rx_bytes,
+                                             self->active_entries->len))
+        queue_update_active_entries (self);
+    }
+
+  if (n_received == 0 || usage->current_usage == G_MAXUINT)
+    return;
+
+  PeriodUsage *period_usage = &g_array_index (usage->period_usages, PeriodUsage,
+                                              usage->current_usage);
+  gboolean reached_limit = period_usage_reached_limit (period_usage);
+
+  if (G_MAXUINT64 - period_usage->n_bytes < n_received)
+    period_usage->n_bytes = G_MAXUINT64;
+  else
+    period_usage->n_bytes += n_received;
+
+  if (self->usage_ledger != NULL)
+    mws_usage_ledger_record (self->usage_ledger, connection_id,
+                             period_usage->recurrence_start_usec,
+                             period_usage->recurrence_end_usec,
+                             period_usage->n_bytes);
+
+  /* Only reschedule when the limit is first reached. The limit is reset when
+   * the next recurrence of the period starts, which is always a transition
+   * and hence already has a reschedule scheduled. */
+  if (!reached_limit && period_usage_reached_limit (period_usage))
+    {
+      g_debug ("%s: Connection ‘%s’ has reached its capacity limit of "
+               "%" G_GUINT64_FORMAT " bytes", G_STRFUNC, connection_id,
+               period_usage->capacity_limit);
+      invalidate_connection (self, connection_id);
+      queue_update_active_entries (self);
+    }
+}
+
+static void
+peer_manager_peer_vanished_cb (MwsPeerManager *manager,
+                               const gchar    *name,
+                               gpointer        user_data)
+{
+  MwsScheduler *self = MWS_SCHEDULER (user_data);
+  g_autoptr(GError) local_error = NULL;
+
+  /* Remove the schedule entries for this peer. */
+  if (!mws_scheduler_remove_entries_for_owner (self, name, &local_error))
+    {
+      g_debug ("Failed to remove schedule entries for owner ‘%s’: %s",
+               name, local_error->message);
+    }
+}
+
+static void
+clock_offset_changed_cb (MwsClock *clock,
+                         gpointer  user_data)
+{
+  MwsScheduler *self = MWS_SCHEDULER (user_data);
+
+  g_autoptr(GDateTime) now = mws_clock_get_now_local (clock);
+  g_autofree gchar *now_str = g_date_time_format (now, "%FT%T%:::z");
+
+  g_debug ("%s: Clock offset changed; time is now %s", G_STRFUNC, now_str);
+  invalidate_connections_verdict (self);
+  queue_update_active_entries (self);
+}
+
+/* Get the slot for @handle. The returned pointer is only valid until the next
+ * call to alloc_entry_slot(). */
+static EntryData *
+get_entry_slot (MwsScheduler *self,
+                guint         handle)
+{
+  g_assert (handle < self->entry_slots->len);
+  return &g_array_index (self->entry_slots, EntryData, handle);
+}
+
+/* Look up the slot handle for the entry with ID @entry_id, returning %FALSE if
+ * it’s not in the scheduler. */
+static gboolean
+lookup_entry_handle (MwsScheduler *self,
+                     const gchar  *entry_id,
+                     guint        *out_handle)
+{
+  gpointer value;
+
+  if (!g_hash_table_lookup_extended (self->entry_handles, entry_id, NULL, &value))
+    return FALSE;
+
+  *out_handle = GPOINTER_TO_UINT (value);
+  return TRUE;
+}
+
+/* Convert a #MwsScheduleEntry:deadline to microseconds since the Unix epoch,
+ * saturating rather than overflowing. */
+static gint64
+deadline_to_usec (guint64 deadline)
+{
+  if (deadline > (guint64) (G_MAXINT64 / G_USEC_PER_SEC))
+    return G_MAXINT64;
+
+  return (gint64) deadline * G_USEC_PER_SEC;
+}
+
+/* Store @entry in a free slot, growing @entry_slots if there are none, and
+ * return the slot’s handle. The entry is not added to any of the indexes. */
+static guint
+alloc_entry_slot (MwsScheduler     *self,
+                  MwsScheduleEntry *entry,
+                  gint              peer_priority)
+{
+  guint handle;
+
+  if (self->first_free_slot != INVALID_ENTRY_SLOT)
+    {
+      handle = self->first_free_slot;
+      self->first_free_slot = get_entry_slot (self, handle)->next_free_slot;
+    }
+  else
+    {
+      g_assert (self->entry_slots->len < INVALID_ENTRY_SLOT);
+      handle = self->entry_slots->len;
+      g_array_set_size (self->entry_slots, handle + 1);
+    }
+
+  EntryData *data = get_entry_slot (self, handle);
+  data->entry = g_object_ref (entry);
+  data->is_active = FALSE;
+  data->is_predicted = FALSE;
+  data->next_free_slot = INVALID_ENTRY_SLOT;
+  data->owner_prev_slot = INVALID_ENTRY_SLOT;
+  data->owner_next_slot = INVALID_ENTRY_SLOT;
+  data->priority_iter = NULL;
+  data->small_iter = NULL;
+  data->peer_priority = peer_priority;
+  data->entry_priority = mws_schedule_entry_get_priority (entry);
+  data->expected_size = mws_schedule_entry_get_expected_size (entry);
+  data->deadline_usec = deadline_to_usec (mws_schedule_entry_get_deadline (entry));
+  data->bind_to_connection = mws_schedule_entry_get_bind_to_connection (entry);
+
+  return handle;
+}
+
+/* Put the slot for @handle on the free list, and return its entry. The entry
+ * must already have been removed from all the indexes. */
+static MwsScheduleEntry *
+free_entry_slot (MwsScheduler *self,
+                 guint         handle)
+{
+  EntryData *data = get_entry_slot (self, handle);
+  MwsScheduleEntry *entry = g_steal_pointer (&data->entry);
+
+  g_assert (entry != NULL);
+
+  data->is_active = FALSE;
+  data->is_predicted = FALSE;
+  data->priority_iter = NULL;
+  data->small_iter = NULL;
+  data->next_free_slot = self->first_free_slot;
+  self->first_free_slot = handle;
+
+  return entry;
+}
+
+/* Set up the fair-share state for @owner_entries, which is about to be added
+ * to @entries_by_owner. A new owner starts with the least service of the
+ * existing owners, so it can’t claim all the slots to catch up with owners
+ * which have been waiting or downloading for a long time, but is next in line
+ * for a slot. */
+static void
+init_owner_fair_share (MwsScheduler *self,
+                       OwnerEntries *owner_entries)
+{
+  GHashTableIter iter;
+  gpointer value;
+  gboolean any_owners = FALSE;
+  gint64 min_service_usec = 0;
+
+  owner_entries->weight =
+      mws_peer_weights_lookup (self->peer_weights,
+                               mws_peer_manager_get_peer_credentials (self->peer_manager,
+                                                                      owner_entries->owner));
+
+  g_hash_table_iter_init (&iter, self->entries_by_owner);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      const OwnerEntries *other = value;
+
+      if (!any_owners || other->service_usec < min_service_usec)
+        min_service_usec = other->service_usec;
+      any_owners = TRUE;
+    }
+
+  owner_entries->service_usec = min_service_usec;
+}
+
+/* Append the slot for @handle to the list of entries for its owner in
+ * @entries_by_owner, adding the owner if needed. */
+static void
+link_owner_entry (MwsScheduler *self,
+                  guint         handle)
+{
+  EntryData *data = get_entry_slot (self, handle);
+  const gchar *owner = mws_schedule_entry_get_owner (data->entry);
+  OwnerEntries *owner_entries = g_hash_table_lookup (self->entries_by_owner, owner);
+
+  if (owner_entries == NULL)
+    {
+      owner_entries = owner_entries_new (owner);
+      if (self->fair_share)
+        init_owner_fair_share (self, owner_entries);
+      g_hash_table_insert (self->entries_by_owner, owner_entries->owner, owner_entries);
+    }
+
+  data->owner_prev_slot = owner_entries->last_slot;
+  data->owner_next_slot = INVALID_ENTRY_SLOT;
+
+  if (owner_entries->last_slot != INVALID_ENTRY_SLOT)
+    get_entry_slot (self, owner_entries->last_slot)->owner_next_slot = handle;
+  else
+    owner_entries->first_slot = handle;
+
+  owner_entries->last_slot = handle;
+  owner_entries->n_entries++;
+}
+
+/* Reverse link_owner_entry(), removing the owner from @entries_by_owner if
+ * this was its last entry. */
+static void
+unlink_owner_entry (MwsScheduler *self,
+                    guint         handle)
+{
+  EntryData *data = get_entry_slot (self, handle);
+  const gchar *owner = mws_schedule_entry_get_owner (data->entry);
+  OwnerEntries *owner_entries = g_hash_table_lookup (self->entries_by_owner, owner);
+
+  g_assert (owner_entries != NULL);
+  g_assert (owner_entries->n_entries > 0);
+
+  if (data->owner_prev_slot != INVALID_ENTRY_SLOT)
+    get_entry_slot (self, data->owner_prev_slot)->owner_next_slot = data->owner_next_slot;
+  else
+    owner_entries->first_slot = data->owner_next_slot;
+
+  if (data->owner_next_slot != INVALID_ENTRY_SLOT)
+    get_entry_slot (self, data->owner_next_slot)->owner_prev_slot = data->owner_prev_slot;
+  else
+    owner_entries->last_slot = data->owner_prev_slot;
+
+  data->owner_prev_slot = INVALID_ENTRY_SLOT;
+  data->owner_next_slot = INVALID_ENTRY_SLOT;
+  owner_entries->n_entries--;
+
+  if (owner_entries->n_entries == 0)
+    g_hash_table_remove (self->entries_by_owner, owner);
+}
+
+/* Remove @handle from @active_entries, preserving the order of the others. */
+static void
+remove_active_entry (MwsScheduler *self,
+                     guint         handle)
+{
+  for (guint i = 0; i < self->active_entries->len; i++)
+    {
+      if (g_array_index (self->active_entries, guint, i) == handle)
+        {
+          g_array_remove_index (self->active_entries, i);
+          return;
+        }
+    }
+
+  g_assert_not_reached ();
+}
+
+static void
+entry_notify_priority_cb (GObject    *obj,
+                          GParamSpec *pspec,
+                          gpointer    user_data)
+{
+  MwsScheduler *self = MWS_SCHEDULER (user_data);
+  MwsScheduleEntry *entry = MWS_SCHEDULE_ENTRY (obj);
+  const gchar *entry_id = mws_schedule_entry_get_id (entry);
+  guint handle;
+  gboolean found = lookup_entry_handle (self, entry_id, &handle);
+  g_assert (found);
+  EntryData *data = get_entry_slot (self, handle);
+
+  g_debug ("%s: Priority of entry ‘%s’ changed to %u",
+           G_STRFUNC, entry_id, mws_schedule_entry_get_priority (entry));
+
+  guint32 entry_priority = mws_schedule_entry_get_priority (entry);
+  if (entry_priority == data->entry_priority)
+    return;
+
+  /* Only this entry’s position in the ordering can have changed. */
+  data->entry_priority = entry_priority;
+  g_sequence_sort_changed (data->priority_iter, entry_data_sequence_compare_cb, self);
+  update_small_entry (self, handle);
+  queue_update_active_entries (self);
+}
+
+static void
+entry_notify_expected_size_cb (GObject    *obj,
+                               GParamSpec *pspec,
+                               gpointer    user_data)
+{
+  MwsScheduler *self = MWS_SCHEDULER (user_data);
+  MwsScheduleEntry *entry = MWS_SCHEDULE_ENTRY (obj);
+  const gchar *entry_id = mws_schedule_entry_get_id (entry);
+  guint handle;
+  gboolean found = lookup_entry_handle (self, entry_id, &handle);
+  g_assert (found);
+  EntryData *data = get_entry_slot (self, handle);
+
+  guint64 expected_size = mws_schedule_entry_get_expected_size (entry);
+  if (expected_size == data->expected_size)
+    return;
+
+  g_debug ("%s: Expected size of entry ‘%s’ changed to %" G_GUINT64_FORMAT,
+           G_STRFUNC, entry_id, expected_size);
+
+  data->expected_size = expected_size;
+  g_sequence_sort_changed (data->priority_iter, entry_data_sequence_compare_cb, self);
+  update_small_entry (self, handle);
+  queue_update_active_entries (self);
+}
+
+static void
+entry_notify_deadline_cb (GObject    *obj,
+                          GParamSpec *pspec,
+                          gpointer    user_data)
+{
+  MwsScheduler *self = MWS_SCHEDULER (user_data);
+  MwsScheduleEntry *entry = MWS_SCHEDULE_ENTRY (obj);
+  const gchar *entry_id = mws_schedule_entry_get_id (entry);
+  guint handle;
+  gboolean found = lookup_entry_handle (self, entry_id, &handle);
+  g_assert (found);
+  EntryData *data = get_entry_slot (self, handle);
+
+  gint64 deadline_usec = deadline_to_usec (mws_schedule_entry_get_deadline (entry));
+  if (deadline_usec == data->deadline_usec)
+    return;
+
+  g_debug ("%s: Deadline of entry ‘%s’ changed to %" G_GUINT64_FORMAT,
+           G_STRFUNC, entry_id, mws_schedule_entry_get_deadline (entry));
+
+  /* The deadline doesn’t affect the ordering, only whether the entry is
+   * deferred. */
+  data->deadline_usec = deadline_usec;
+  queue_update_active_entries (self);
+}
+
+static void
+entry_notify_bind_to_connection_cb (GObject    *obj,
+                                    GParamSpec *pspec,
+                                    gpointer    user_data)
+{
+  MwsScheduler *self = MWS_SCHEDULER (user_data);
+  MwsScheduleEntry *entry = MWS_SCHEDULE_ENTRY (obj);
+  const gchar *entry_id = mws_schedule_entry_get_id (entry);
+  guint handle;
+  gboolean found = lookup_entry_handle (self, entry_id, &handle);
+  g_assert (found);
+  EntryData *data = get_entry_slot (self, handle);
+
+  gboolean bind_to_connection = mws_schedule_entry_get_bind_to_connection (entry);
+  if (bind_to_connection == data->bind_to_connection)
+    return;
+
+  g_debug ("%s: Entry ‘%s’ can%s be bound to a connection",
+           G_STRFUNC, entry_id, bind_to_connection ? "" : "not");
+
+  /* This doesn’t affect the ordering, only whether the entry can be active
+   * when some connections aren’t safe, and whether it’s given a connection. */
+  data->bind_to_connection = bind_to_connection;
+  queue_update_active_entries (self);
+}
 
 /**
  * mws_scheduler_new:
@@ -609,6 +1947,23 @@ mws_scheduler_get_peer_manager (MwsScheduler *self)
   return self->peer_manager;
 }
 
+/**
+ * mws_scheduler_get_connection_monitor:
+ * @self: a #MwsScheduler
+ *
+ * Get the value of #MwsScheduler:connection-monitor.
+ *
+ * Returns: (transfer none): the connection monitor for the scheduler
+ * Since: 0.3.0
+ */
+MwsConnectionMonitor *
+mws_scheduler_get_connection_monitor (MwsScheduler *self)
+{
+  g_return_val_if_fail (MWS_IS_SCHEDULER (self), NULL);
+
+  return self->connection_monitor;
+}
+
 /**
  * mws_scheduler_update_entries:
  * @self: a #MwsScheduler
@@ -625,9 +1980,10 @@ mws_scheduler_get_peer_manager (MwsScheduler *self)
  * which are not in the scheduler, are ignored.
  *
  * If adding any of @added to the scheduler would cause it to exceed
- * #MwsScheduler:max-entries, %MWS_SCHEDULER_ERROR_FULL will be returned and
- * the scheduler will not be modified to add or remove any of @added or
- * @removed.
+ * #MwsScheduler:max-entries, or would give any owner more than
+ * #MwsScheduler:max-entries-per-owner entries, %MWS_SCHEDULER_ERROR_FULL will
+ * be returned and the scheduler will not be modified to add or remove any of
+ * @added or @removed.
  *
  * Returns: %TRUE on success, %FALSE otherwise
  * Since: 0.1.0
@@ -650,16 +2006,43 @@ mws_scheduler_update_entries (MwsScheduler  *self,
 
   /* Check resource limits. */
   if (added != NULL &&
-      added->len > self->max_entries - g_hash_table_size (self->entries))
+      added->len > self->max_entries - g_hash_table_size (self->entry_handles))
     {
       g_set_error (error, MWS_SCHEDULER_ERROR, MWS_SCHEDULER_ERROR_FULL,
                    _("Too many ongoing downloads already."));
       return FALSE;
     }
 
-  /* Remove and add entries. Throughout, we need to ensure that @entries and
-   * @entries_data always have identical sets of keys; that reduces the number
-   * of checks needed in other places in the code. */
+  if (added != NULL && added->len > 0 &&
+      self->max_entries_per_owner < self->max_entries)
+    {
+      /* Count the new entries for each owner. Batches almost always come from
+       * a single owner, so this is typically only one lookup per owner. */
+      g_autoptr(GHashTable) n_added_by_owner = g_hash_table_new (g_str_hash, g_str_equal);
+
+      for (gsize i = 0; i < added->len; i++)
+        {
+          const gchar *owner = mws_schedule_entry_get_owner (added->pdata[i]);
+          guint n_added = GPOINTER_TO_UINT (g_hash_table_lookup (n_added_by_owner, owner));
+          g_hash_table_insert (n_added_by_owner, (gpointer) owner,
+                               GUINT_TO_POINTER (n_added + 1));
+        }
+
+      GHashTableIter iter;
+      gpointer key, value;
+
+      g_hash_table_iter_init (&iter, n_added_by_owner);
+      while (g_hash_table_iter_next (&iter, &key, &value))
+        {
+          if (!mws_scheduler_check_quota (self, key, GPOINTER_TO_UINT (value), error))
+            return FALSE;
+        }
+    }
+
+  /* Remove and add entries. Throughout, we need to ensure that @entry_handles
+   * and @entries_by_priority always index exactly the occupied slots in
+   * @entry_slots; that reduces the number of checks needed in other places in
+   * the code. */
   for (gsize i = 0; removed != NULL && i < removed->len; i++)
     {
       const gchar *entry_id = removed->pdata[i];
@@ -667,16 +2050,28 @@ mws_scheduler_update_entries (MwsScheduler  *self,
 
       g_debug ("Removing schedule entry ‘%s’.", entry_id);
 
-      /* FIXME: Upstream a g_hash_table_steal_extended() function which combines these two.
-       * See: https://bugzilla.gnome.org/show_bug.cgi?id=795302 */
-      gpointer value;
-      if (g_hash_table_lookup_extended (self->entries, entry_id, NULL, &value))
+      guint handle;
+      if (lookup_entry_handle (self, entry_id, &handle))
         {
-          gboolean was_active = mws_scheduler_is_entry_active (self, MWS_SCHEDULE_ENTRY (value));
+          EntryData *data = get_entry_slot (self, handle);
+          gboolean was_active = data->is_active;
+
+          g_signal_handlers_disconnect_by_func (data->entry, entry_notify_priority_cb, self);
+          g_signal_handlers_disconnect_by_func (data->entry, entry_notify_expected_size_cb, self);
+          g_signal_handlers_disconnect_by_func (data->entry, entry_notify_deadline_cb, self);
+          g_signal_handlers_disconnect_by_func (data->entry, entry_notify_bind_to_connection_cb, self);
+          g_sequence_remove (data->priority_iter);
+          if (data->small_iter != NULL)
+            g_sequence_remove (data->small_iter);
+          if (was_active)
+            remove_active_entry (self, handle);
+
+          /* The key is owned by the entry, so this has to be done before the
+           * slot is freed. */
+          g_assert (g_hash_table_remove (self->entry_handles, entry_id));
+          unlink_owner_entry (self, handle);
 
-          g_autoptr(MwsScheduleEntry) entry = value;
-          g_hash_table_steal (self->entries, entry_id);
-          g_assert (g_hash_table_remove (self->entries_data, entry_id));
+          g_autoptr(MwsScheduleEntry) entry = free_entry_slot (self, handle);
 
           if (was_active)
             g_ptr_array_add (actually_removed_active, g_object_ref (entry));
@@ -686,7 +2081,6 @@ mws_scheduler_update_entries (MwsScheduler  *self,
         {
           g_debug ("Schedule entry ‘%s’ did not exist in MwsScheduler %p.",
                    entry_id, self);
-          g_assert (g_hash_table_lookup (self->entries_data, entry_id) == NULL);
         }
     }
 
@@ -698,18 +2092,36 @@ mws_scheduler_update_entries (MwsScheduler  *self,
 
       g_debug ("Adding schedule entry ‘%s’.", entry_id);
 
-      if (g_hash_table_replace (self->entries,
-                                (gpointer) entry_id, g_object_ref (entry)))
+      if (!g_hash_table_contains (self->entry_handles, entry_id))
         {
-          g_hash_table_replace (self->entries_data,
-                                (gpointer) entry_id, entry_data_new ());
+          /* Work out the entry’s sort key once, here, rather than on every
+           * comparison. */
+          guint handle = alloc_entry_slot (self, entry,
+                                           get_peer_priority (self, entry));
+          g_hash_table_insert (self->entry_handles, (gpointer) entry_id,
+                               GUINT_TO_POINTER (handle));
+          link_owner_entry (self, handle);
+
+          EntryData *data = get_entry_slot (self, handle);
+          data->priority_iter = g_sequence_insert_sorted (self->entries_by_priority,
+                                                          GUINT_TO_POINTER (handle),
+                                                          entry_data_sequence_compare_cb,
+                                                          self);
+          update_small_entry (self, handle);
+          g_signal_connect (entry, "notify::priority",
+                            (GCallback) entry_notify_priority_cb, self);
+          g_signal_connect (entry, "notify::expected-size",
+                            (GCallback) entry_notify_expected_size_cb, self);
+          g_signal_connect (entry, "notify::deadline",
+                            (GCallback) entry_notify_deadline_cb, self);
+          g_signal_connect (entry, "notify::bind-to-connection",
+                            (GCallback) entry_notify_bind_to_connection_cb, self);
           g_ptr_array_add (actually_added, g_object_ref (entry));
         }
       else
         {
           g_debug ("Schedule entry ‘%s’ already existed in MwsScheduler %p.",
                    entry_id, self);
-          g_assert (g_hash_table_lookup (self->entries_data, entry_id) != NULL);
         }
     }
 
@@ -725,12 +2137,15 @@ mws_scheduler_update_entries (MwsScheduler  *self,
     {
       g_debug ("%s: Emitting entries-changed with %u added, %u removed",
                G_STRFUNC, actually_added->len, actually_removed->len);
+      g_clear_pointer (&self->entries_view, g_hash_table_unref);
       g_object_notify (G_OBJECT (self), "entries");
       g_signal_emit_by_name (G_OBJECT (self), "entries-changed",
                              actually_added, actually_removed);
 
-      /* Trigger a reschedule due to the new or removed entries. */
-      mws_scheduler_reschedule (self);
+      /* Update the set of active entries due to the new or removed entries.
+       * This doesn’t need to re-examine the network connections, since they
+       * haven’t changed. */
+      queue_update_active_entries (self);
     }
 
   return TRUE;
@@ -757,21 +2172,25 @@ mws_scheduler_remove_entries_for_owner (MwsScheduler  *self,
   g_return_val_if_fail (g_dbus_is_unique_name (owner), FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
-  g_autoptr(GPtrArray) entries_to_remove = g_ptr_array_new_with_free_func (NULL);
+  const OwnerEntries *owner_entries = g_hash_table_lookup (self->entries_by_owner, owner);
 
-  GHashTableIter iter;
-  gpointer value;
+  if (owner_entries == NULL)
+    return TRUE;
 
-  g_hash_table_iter_init (&iter, self->entries);
-  while (g_hash_table_iter_next (&iter, NULL, &value))
-    {
-      MwsScheduleEntry *entry = MWS_SCHEDULE_ENTRY (value);
+  g_autoptr(GPtrArray) entries_to_remove = NULL;
+  entries_to_remove = g_ptr_array_new_full (owner_entries->n_entries, NULL);
 
-      if (g_str_equal (mws_schedule_entry_get_owner (entry), owner))
-        g_ptr_array_add (entries_to_remove,
-                         (gpointer) mws_schedule_entry_get_id (entry));
+  for (guint handle = owner_entries->first_slot;
+       handle != INVALID_ENTRY_SLOT;
+       handle = get_entry_slot (self, handle)->owner_next_slot)
+    {
+      MwsScheduleEntry *entry = get_entry_slot (self, handle)->entry;
+      g_ptr_array_add (entries_to_remove,
+                       (gpointer) mws_schedule_entry_get_id (entry));
     }
 
+  g_assert (entries_to_remove->len == owner_entries->n_entries);
+
   return mws_scheduler_update_entries (self, NULL, entries_to_remove, error);
 }
 
@@ -793,7 +2212,11 @@ mws_scheduler_get_entry (MwsScheduler *self,
   g_return_val_if_fail (MWS_IS_SCHEDULER (self), NULL);
   g_return_val_if_fail (mws_schedule_entry_id_is_valid (entry_id), NULL);
 
-  return g_hash_table_lookup (self->entries, entry_id);
+  guint handle;
+  if (!lookup_entry_handle (self, entry_id, &handle))
+    return NULL;
+
+  return get_entry_slot (self, handle)->entry;
 }
 
 /**
@@ -803,6 +2226,12 @@ mws_scheduler_get_entry (MwsScheduler *self,
  * Get the complete set of schedule entries known to the scheduler, as a map of
  * #MwsScheduleEntry instances indexed by entry ID.
  *
+ * The map is built on demand, and is only valid until the set of entries in
+ * the scheduler next changes (as signalled by #MwsScheduler::entries-changed).
+ * Take a reference to it to keep it (unchanging) for longer. Use
+ * mws_scheduler_get_n_entries() or mws_scheduler_get_entry() where possible,
+ * as they don’t need to build the map.
+ *
  * Returns: (transfer none) (element-type utf8 MwsScheduleEntry): mapping of
  *    entry IDs to entries
  * Since: 0.1.0
@@ -812,7 +2241,115 @@ mws_scheduler_get_entries (MwsScheduler *self)
 {
   g_return_val_if_fail (MWS_IS_SCHEDULER (self), NULL);
 
-  return self->entries;
+  if (self->entries_view == NULL)
+    {
+      self->entries_view = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                  NULL, g_object_unref);
+
+      for (guint i = 0; i < self->entry_slots->len; i++)
+        {
+          MwsScheduleEntry *entry = get_entry_slot (self, i)->entry;
+
+          if (entry != NULL)
+            g_hash_table_insert (self->entries_view,
+                                 (gpointer) mws_schedule_entry_get_id (entry),
+                                 g_object_ref (entry));
+        }
+    }
+
+  return self->entries_view;
+}
+
+/**
+ * mws_scheduler_get_n_entries:
+ * @self: a #MwsScheduler
+ *
+ * Get the number of schedule entries known to the scheduler. This is
+ * equivalent to the size of mws_scheduler_get_entries(), but is cheaper.
+ *
+ * Returns: number of entries in the scheduler
+ * Since: 0.3.0
+ */
+guint
+mws_scheduler_get_n_entries (MwsScheduler *self)
+{
+  g_return_val_if_fail (MWS_IS_SCHEDULER (self), 0);
+
+  return g_hash_table_size (self->entry_handles);
+}
+
+/**
+ * mws_scheduler_get_n_entries_for_owner:
+ * @self: a #MwsScheduler
+ * @owner: the D-Bus unique name of the peer to count entries for
+ *
+ * Get the number of schedule entries in the scheduler whose owner is @owner.
+ * This takes time independent of the number of entries.
+ *
+ * Returns: number of entries in the scheduler belonging to @owner
+ * Since: 0.3.0
+ */
+guint
+mws_scheduler_get_n_entries_for_owner (MwsScheduler *self,
+                                       const gchar  *owner)
+{
+  g_return_val_if_fail (MWS_IS_SCHEDULER (self), 0);
+  g_return_val_if_fail (g_dbus_is_unique_name (owner), 0);
+
+  const OwnerEntries *owner_entries = g_hash_table_lookup (self->entries_by_owner, owner);
+
+  return (owner_entries != NULL) ? owner_entries->n_entries : 0;
+}
+
+/**
+ * mws_scheduler_check_quota:
+ * @self: a #MwsScheduler
+ * @owner: the D-Bus unique name of the peer which wants to add entries
+ * @n_entries: number of entries @owner wants to add
+ * @error: return location for a #GError, or %NULL
+ *
+ * Check whether @owner can add @n_entries more schedule entries to the
+ * scheduler without exceeding #MwsScheduler:max-entries or
+ * #MwsScheduler:max-entries-per-owner. This takes time independent of the
+ * number of entries, so can be used to reject requests from peers which are
+ * over quota before doing any work to create their entries.
+ *
+ * mws_scheduler_update_entries() does the same checks, so this is purely an
+ * optimisation.
+ *
+ * Returns: %TRUE if the entries can be added, %FALSE (with
+ *    %MWS_SCHEDULER_ERROR_FULL set) otherwise
+ * Since: 0.3.0
+ */
+gboolean
+mws_scheduler_check_quota (MwsScheduler  *self,
+                           const gchar   *owner,
+                           gsize          n_entries,
+                           GError       **error)
+{
+  g_return_val_if_fail (MWS_IS_SCHEDULER (self), FALSE);
+  g_return_val_if_fail (g_dbus_is_unique_name (owner), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  if (n_entries > self->max_entries - g_hash_table_size (self->entry_handles))
+    {
+      g_set_error (error, MWS_SCHEDULER_ERROR, MWS_SCHEDULER_ERROR_FULL,
+                   _("Too many ongoing downloads already."));
+      return FALSE;
+    }
+
+  guint n_owner_entries = mws_scheduler_get_n_entries_for_owner (self, owner);
+
+  if (n_owner_entries > self->max_entries_per_owner ||
+      n_entries > self->max_entries_per_owner - n_owner_entries)
+    {
+      g_set_error (error, MWS_SCHEDULER_ERROR, MWS_SCHEDULER_ERROR_FULL,
+                   _("Too many ongoing downloads already for peer ‘%s’."),
+                   owner);
+      return FALSE;
+    }
+
+  return TRUE;
 }
 
 /**
@@ -837,8 +2374,9 @@ mws_scheduler_is_entry_active (MwsScheduler     *self,
   g_return_val_if_fail (MWS_IS_SCHEDULE_ENTRY (entry), FALSE);
 
   const gchar *entry_id = mws_schedule_entry_get_id (entry);
-  const EntryData *data = g_hash_table_lookup (self->entries_data, entry_id);
-  g_return_val_if_fail (data != NULL, FALSE);
+  guint handle;
+  g_return_val_if_fail (lookup_entry_handle (self, entry_id, &handle), FALSE);
+  const EntryData *data = get_entry_slot (self, handle);
 
   g_debug ("%s: Entry ‘%s’, active: %s",
            G_STRFUNC, entry_id, data->is_active ? "yes" : "no");
@@ -850,39 +2388,30 @@ static gboolean
 reschedule_cb (gpointer user_data)
 {
   MwsScheduler *self = MWS_SCHEDULER (user_data);
-  mws_scheduler_reschedule (self);
+
+  /* The alarm has been consumed. */
+  self->reschedule_alarm_id = 0;
+
+  /* Only the connections whose tariffs have changed period need to be
+   * re-examined. */
+  g_autoptr(GDateTime) now = mws_clock_get_now_local (self->clock);
+  invalidate_connections_transitioned (self, now);
+  queue_update_active_entries (self);
+
   return G_SOURCE_REMOVE;
 }
 
 /* Get the priority of a given peer. Higher returned numbers indicate more
- * important peers. */
+ * important peers. This is worked out by the peer manager when it first gets
+ * the peer’s credentials. */
 static gint
 get_peer_priority (MwsScheduler     *self,
                    MwsScheduleEntry *entry)
 {
-  const gchar *owner = mws_schedule_entry_get_owner (entry);
-  const gchar *owner_path =
-      mws_peer_manager_get_peer_credentials (self->peer_manager, owner);
-
   /* If we haven’t got credentials for this peer (which would be unexpected and
-   * indicate a serious problem), give it a low priority. */
-  if (owner_path == NULL)
-    return G_MININT;
-
-  /* The OS and app updaters are equally as important as each other. The actual
-   * priority numbers chosen here are fairly arbitrary; it’s the partial order
-   * over them which is important. */
-  if (g_str_equal (owner_path, "/usr/libexec/eos-updater") ||
-      g_str_equal (owner_path, "/usr/bin/gnome-software"))
-    return G_MAXINT;
-
-  /* Anything else goes in the range (G_MININT, G_MAXINT). */
-  gint priority = g_str_hash (owner_path) + G_MININT;
-  if (priority == G_MININT)
-    priority += 1;
-  if (priority == G_MAXINT)
-    priority -= 1;
-  return priority;
+   * indicate a serious problem), this gives it a low priority. */
+  return mws_peer_manager_get_peer_priority (self->peer_manager,
+                                             mws_schedule_entry_get_owner (entry));
 }
 
 /* Compare entries to give a total order by scheduling priority, with the most
@@ -892,16 +2421,14 @@ get_peer_priority (MwsScheduler     *self,
  * trim any entries which can’t be scheduled (for example, due to wanting to use
  * a metered connection when the user has disallowed it); later stages select
  * the most important N entries to actually schedule, according to
- * parallelisation limits. */
+ * parallelisation limits.
+ *
+ * This is called O(log n) times for every change to the set of entries, so
+ * only uses the sort keys precomputed in #EntryData. */
 static gint
-entry_compare_cb (gconstpointer a_,
-                  gconstpointer b_,
-                  gpointer      user_data)
+entry_data_compare (const EntryData *a,
+                    const EntryData *b)
 {
-  MwsScheduler *self = MWS_SCHEDULER (user_data);
-  MwsScheduleEntry *a = MWS_SCHEDULE_ENTRY (*((MwsScheduleEntry **) a_));
-  MwsScheduleEntry *b = MWS_SCHEDULE_ENTRY (*((MwsScheduleEntry **) b_));
-
   /* As per https://phabricator.endlessm.com/T21327, we want the following
    * priority order (most important first):
    *  1. App extensions to com.endlessm.* apps
@@ -920,320 +2447,1648 @@ entry_compare_cb (gconstpointer a_,
    * entries, which is possible since we control all of that code. */
 
   /* Sort by peer first. */
-  gint a_peer_priority = get_peer_priority (self, a);
-  gint b_peer_priority = get_peer_priority (self, b);
-
-  if (a_peer_priority != b_peer_priority)
-    {
-      g_debug ("%s: Comparing schedule entries ‘%s’ and ‘%s’ by peer priority: %d vs %d",
-               G_STRFUNC, mws_schedule_entry_get_id (a),
-               mws_schedule_entry_get_id (b), a_peer_priority, b_peer_priority);
-      return (b_peer_priority > a_peer_priority) ? 1 : -1;
-    }
+  if (a->peer_priority != b->peer_priority)
+    return (b->peer_priority > a->peer_priority) ? 1 : -1;
 
   /* Within the peer, sort by the priority assigned by that peer to the entry. */
-  guint32 a_entry_priority = mws_schedule_entry_get_priority (a);
-  guint32 b_entry_priority = mws_schedule_entry_get_priority (b);
+  if (a->entry_priority != b->entry_priority)
+    return (b->entry_priority > a->entry_priority) ? 1 : -1;
 
-  if (a_entry_priority != b_entry_priority)
-    {
-      g_debug ("%s: Comparing schedule entries ‘%s’ and ‘%s’ by entry priority: %u vs %u",
-               G_STRFUNC, mws_schedule_entry_get_id (a),
-               mws_schedule_entry_get_id (b), a_entry_priority,
-               b_entry_priority);
-      return (b_entry_priority > a_entry_priority) ? 1 : -1;
-    }
+  /* Within the priority, schedule the shortest download first, to minimise
+   * the average time for entries to complete. Entries whose expected size isn’t
+   * known are assumed to be larger than any other. */
+  guint64 a_size = (a->expected_size != 0) ? a->expected_size : G_MAXUINT64;
+  guint64 b_size = (b->expected_size != 0) ? b->expected_size : G_MAXUINT64;
+
+  if (a_size != b_size)
+    return (a_size < b_size) ? -1 : 1;
 
   /* Arbitrarily break ties using the entries’ IDs, which should always be
    * different. */
-  g_debug ("%s: Comparing schedule entries ‘%s’ and ‘%s’ by entry ID",
-           G_STRFUNC, mws_schedule_entry_get_id (a),
-           mws_schedule_entry_get_id (b));
-  return g_strcmp0 (mws_schedule_entry_get_id (a),
-                    mws_schedule_entry_get_id (b));
+  return g_strcmp0 (mws_schedule_entry_get_id (a->entry),
+                    mws_schedule_entry_get_id (b->entry));
 }
 
-/**
- * mws_scheduler_reschedule:
- * @self: a #MwsScheduler
- *
- * Calculate an updated download schedule for all currently active entries, and
- * update the set of active entries if necessary. Changes to the set of active
- * entries will be signalled using #MwsScheduler::active-entries-changed.
- *
- * This is called automatically when the set of entries in the scheduler
- * changes, or when any relevant input to the scheduler changes; so should not
- * normally need to be called manually. It is exposed mainly for unit testing.
- *
- * Since: 0.1.0
- */
-void
-mws_scheduler_reschedule (MwsScheduler *self)
+/* #GCompareDataFunc version of entry_data_compare(), for use with
+ * #MwsScheduler.entries_by_priority, whose elements are slot handles. */
+static gint
+entry_data_sequence_compare_cb (gconstpointer a,
+                                gconstpointer b,
+                                gpointer      user_data)
 {
-  g_return_if_fail (MWS_IS_SCHEDULER (self));
+  MwsScheduler *self = MWS_SCHEDULER (user_data);
 
-  g_assert (!self->in_reschedule);
-  self->in_reschedule = TRUE;
+  return entry_data_compare (get_entry_slot (self, GPOINTER_TO_UINT (a)),
+                             get_entry_slot (self, GPOINTER_TO_UINT (b)));
+}
 
-  g_debug ("%s: Rescheduling %u entries",
-           G_STRFUNC, g_hash_table_size (self->entries));
+/* Whether the entry in @data is small enough to use the slot reserved for
+ * small entries; see #MwsScheduler:small-entry-threshold. */
+static gboolean
+entry_data_is_small (MwsScheduler    *self,
+                     const EntryData *data)
+{
+  return (self->small_entry_threshold > 0 &&
+          data->expected_size > 0 &&
+          data->expected_size <= self->small_entry_threshold);
+}
 
-  /* Sanity checks. */
-  g_assert (g_hash_table_size (self->entries) ==
-            g_hash_table_size (self->entries_data));
+/* Update the membership and position of the entry for @handle in
+ * #MwsScheduler.small_entries_by_priority after it’s been added, or after its
+ * sort key has changed. */
+static void
+update_small_entry (MwsScheduler *self,
+                    guint         handle)
+{
+  EntryData *data = get_entry_slot (self, handle);
+  gboolean is_small = entry_data_is_small (self, data);
+
+  if (is_small && data->small_iter == NULL)
+    data->small_iter = g_sequence_insert_sorted (self->small_entries_by_priority,
+                                                 GUINT_TO_POINTER (handle),
+                                                 entry_data_sequence_compare_cb,
+                                                 self);
+  else if (is_small)
+    g_sequence_sort_changed (data->small_iter, entry_data_sequence_compare_cb, self);
+  else if (data->small_iter != NULL)
+    g_clear_pointer (&data->small_iter, g_sequence_remove);
+}
+
+/* Swap the elements at @i and @j in #MwsScheduler.transitions_heap, keeping
+ * their #ConnectionData.heap_index up to date. */
+static void
+transitions_heap_swap (MwsScheduler *self,
+                       guint         i,
+                       guint         j)
+{
+  ConnectionData **pdata = (ConnectionData **) self->transitions_heap->pdata;
+  ConnectionData *tmp = pdata[i];
+
+  pdata[i] = pdata[j];
+  pdata[j] = tmp;
+  pdata[i]->heap_index = i;
+  pdata[j]->heap_index = j;
+}
+
+/* Restore the heap ordering of #MwsScheduler.transitions_heap after the
+ * element at @i has been added or changed. */
+static void
+transitions_heap_sift (MwsScheduler *self,
+                       guint         i)
+{
+  ConnectionData **pdata = (ConnectionData **) self->transitions_heap->pdata;
+  guint len = self->transitions_heap->len;
+
+  while (i > 0 &&
+         pdata[i]->next_transition_usec < pdata[(i - 1) / 2]->next_transition_usec)
+    {
+      transitions_heap_swap (self, i, (i - 1) / 2);
+      i = (i - 1) / 2;
+    }
+
+  while (TRUE)
+    {
+      guint smallest = i;
+      guint left = 2 * i + 1, right = 2 * i + 2;
+
+      if (left < len &&
+          pdata[left]->next_transition_usec < pdata[smallest]->next_transition_usec)
+        smallest = left;
+      if (right < len &&
+          pdata[right]->next_transition_usec < pdata[smallest]->next_transition_usec)
+        smallest = right;
+
+      if (smallest == i)
+        break;
+
+      transitions_heap_swap (self, i, smallest);
+      i = smallest;
+    }
+}
+
+/* Add @data to #MwsScheduler.connections_data and
+ * #MwsScheduler.transitions_heap, taking ownership of it. There must be no
+ * existing data for the connection. */
+static void
+add_connection_data (MwsScheduler   *self,
+                     ConnectionData *data)
+{
+  g_assert (!g_hash_table_contains (self->connections_data, data->connection_id));
+
+  g_hash_table_insert (self->connections_data, data->connection_id, data);
+  data->heap_index = self->transitions_heap->len;
+  g_ptr_array_add (self->transitions_heap, data);
+  transitions_heap_sift (self, data->heap_index);
+}
+
+/* Remove @data from #MwsScheduler.transitions_heap and
+ * #MwsScheduler.connections_data, and free it. */
+static void
+remove_connection_data (MwsScheduler   *self,
+                        ConnectionData *data)
+{
+  guint i = data->heap_index;
+  guint last = self->transitions_heap->len - 1;
+
+  g_assert (g_ptr_array_index (self->transitions_heap, i) == data);
+
+  if (i != last)
+    transitions_heap_swap (self, i, last);
+  g_ptr_array_set_size (self->transitions_heap, last);
+  if (i != last)
+    transitions_heap_sift (self, i);
+
+  g_hash_table_remove (self->connections_data, data->connection_id);
+}
+
+/* Mark the cached verdict on the network connections as stale, so that it is
+ * recalculated on the next call to update_active_entries(). This must be called
+ * whenever the set of connections or the clock changes. The cached data for
+ * every connection is discarded. */
+static void
+invalidate_connections_verdict (MwsScheduler *self)
+{
+  g_ptr_array_set_size (self->transitions_heap, 0);
+  g_hash_table_remove_all (self->connections_data);
+  self->connections_verdict_valid = FALSE;
+}
+
+/* Version of invalidate_connections_verdict() which only discards the cached
+ * data for a single connection, such as when its details have changed. */
+static void
+invalidate_connection (MwsScheduler *self,
+                       const gchar  *connection_id)
+{
+  ConnectionData *data = g_hash_table_lookup (self->connections_data, connection_id);
 
-  /* Clear any pending reschedule. */
+  if (data != NULL)
+    remove_connection_data (self, data);
+  self->connections_verdict_valid = FALSE;
+}
+
+/* Version of invalidate_connections_verdict() which only discards the cached
+ * data for connections whose tariff has changed period at or before @now.
+ * These are found from the top of #MwsScheduler.transitions_heap, so the
+ * connections which haven’t changed aren’t examined. */
+static void
+invalidate_connections_transitioned (MwsScheduler *self,
+                                     GDateTime    *now)
+{
+  gint64 now_usec = date_time_to_usec (now);
+
+  while (self->transitions_heap->len > 0)
+    {
+      ConnectionData *data = g_ptr_array_index (self->transitions_heap, 0);
+
+      if (data->next_transition_usec > now_usec)
+        break;
+
+      g_debug ("%s: Connection ‘%s’ has changed tariff period",
+               G_STRFUNC, data->connection_id);
+      remove_connection_data (self, data);
+    }
+
+  self->connections_verdict_valid = FALSE;
+}
+
+/* Make sure the reschedule alarm is set for the earliest event which could
+ * change the schedule: the next transition of any of the connections, or the
+ * planned start of a deferred entry. The alarm is only re-armed if that has
+ * changed since it was last set. */
+static void
+update_reschedule_alarm (MwsScheduler *self)
+{
+  gint64 next_reschedule_usec = self->next_deferral_usec;
+
+  if (self->transitions_heap->len > 0)
+    {
+      const ConnectionData *data = g_ptr_array_index (self->transitions_heap, 0);
+      next_reschedule_usec = MIN (next_reschedule_usec, data->next_transition_usec);
+    }
+
+  if ((self->reschedule_alarm_id != 0 &&
+       self->reschedule_alarm_usec == next_reschedule_usec) ||
+      (self->reschedule_alarm_id == 0 && next_reschedule_usec == G_MAXINT64))
+    return;
+
+  /* Set up the next scheduling run, replacing any pending one. */
   if (self->reschedule_alarm_id != 0)
     {
       mws_clock_remove_alarm (self->clock, self->reschedule_alarm_id);
       self->reschedule_alarm_id = 0;
     }
 
-  /* Preload information from the connection monitor. */
-  const gchar * const *all_connection_ids = NULL;
-  all_connection_ids = mws_connection_monitor_get_connection_ids (self->connection_monitor);
-  gsize n_connections = g_strv_length ((gchar **) all_connection_ids);
+  if (next_reschedule_usec != G_MAXINT64)
+    {
+      g_autoptr(GDateTime) epoch = g_date_time_new_from_unix_local (0);
+      g_autoptr(GDateTime) next_reschedule = g_date_time_add (epoch, next_reschedule_usec);
+
+      /* The alarm is on wall clock time, so it’s up to the #MwsClock to
+       * trigger it at the right time across suspend, and to emit
+       * #MwsClock::offset-changed (which causes a reschedule) if the wall clock
+       * or the time zone changes underneath it. */
+      self->reschedule_alarm_id = mws_clock_add_alarm (self->clock, next_reschedule,
+                                                       reschedule_cb, self, NULL);
+      self->reschedule_alarm_usec = next_reschedule_usec;
+
+      g_debug ("%s: Setting next reschedule for %" G_GINT64_FORMAT "µs since "
+               "the epoch", G_STRFUNC, next_reschedule_usec);
+    }
+  else
+    {
+      g_debug ("%s: Setting next reschedule to never", G_STRFUNC);
+    }
+
+  g_object_notify (G_OBJECT (self), "next-reschedule");
+}
+
+/* Get the number of entries which can currently be active, taking the
+ * concurrency controller into account (if there is one). */
+static guint
+get_max_active_entries (MwsScheduler *self)
+{
+  if (self->concurrency_controller == NULL)
+    return self->max_active_entries;
+
+  return MIN (self->max_active_entries,
+              mws_concurrency_controller_get_limit (self->concurrency_controller));
+}
+
+/* List the windows of @tariff which start between @from_usec (which must be a
+ * transition) and @horizon_usec, with a window ending at each transition of
+ * the tariff or at the end of a recurrence of its period, whichever comes
+ * first. At most %MAX_PLANNING_WINDOWS are returned. */
+static GArray *
+calculate_tariff_windows (MwtTariff *tariff,
+                          gint64     from_usec,
+                          gint64     horizon_usec)
+{
+  g_autoptr(GArray) windows = g_array_new (FALSE, FALSE, sizeof (TariffWindow));
+  gint64 start_usec = from_usec;
+
+  while (start_usec < horizon_usec && windows->len < MAX_PLANNING_WINDOWS)
+    {
+      TariffWindow window = { start_usec, G_MAXINT64, G_MAXUINT64 };
+      MwtPeriod *period = mwt_tariff_lookup_period_usec (tariff, start_usec);
+      gint64 recurrence_end_usec, next_transition_usec;
+
+      if (period != NULL)
+        {
+          window.capacity_limit = mwt_period_get_capacity_limit (period);
+
+          if (mwt_period_contains_time_usec (period, start_usec, NULL,
+                                             &recurrence_end_usec))
+            window.end_usec = recurrence_end_usec;
+        }
+
+      if (mwt_tariff_get_next_transition_usec (tariff, start_usec,
+                                               &next_transition_usec, NULL, NULL))
+        window.end_usec = MIN (window.end_usec, next_transition_usec);
+
+      g_array_append_val (windows, window);
+
+      if (window.end_usec <= start_usec || window.end_usec == G_MAXINT64)
+        break;
+
+      start_usec = window.end_usec;
+    }
+
+  return g_steal_pointer (&windows);
+}
+
+/* Get the details of @connection_id from the connection monitor into
+ * @details, which must be cleared with mws_connection_details_clear()
+ * afterwards. If that fails, @details is left as dummy values. */
+static void
+get_connection_details (MwsScheduler         *self,
+                        const gchar          *connection_id,
+                        MwsConnectionDetails *details)
+{
+  if (!mws_connection_monitor_get_connection_details (self->connection_monitor,
+                                                      connection_id,
+                                                      details))
+    {
+      /* Treat the details as dummy values. */
+      g_debug ("%s: Failed to get details for connection ‘%s’.",
+               G_STRFUNC, connection_id);
+      mws_connection_details_clear (details);
+    }
+}
+
+/* Work out whether it’s permissible to download on the given connection at
+ * @now, given its @details, and when that might next change due to its tariff
+ * changing period. This does the tariff lookups, so the result is cached in
+ * #MwsScheduler.connections_data until it’s invalidated.
+ *
+ * If @update_usage is %TRUE, the #ConnectionUsage for the connection is
+ * updated to count bytes against the current tariff period. Otherwise, this
+ * has no side effects, so it can be used by mws_scheduler_compute_plan(). */
+static ConnectionData *
+calculate_connection_data (MwsScheduler               *self,
+                           const gchar                *connection_id,
+                           const MwsConnectionDetails *details,
+                           gint64                      now_usec,
+                           gboolean                    update_usage)
+{
+  g_autoptr(ConnectionData) data = connection_data_new (connection_id);
+
+  data->allow_downloads = ((details->metered == MWS_METERED_NO ||
+                            details->metered == MWS_METERED_GUESS_NO ||
+                            details->allow_downloads_when_metered) &&
+                           details->allow_downloads);
+
+  /* If this connection has a tariff specified, work out whether we’ve
+   * hit any of the limits for the current tariff period. */
+  gboolean tariff_period_reached_capacity_limit = FALSE;
+  gint64 recurrence_end_usec = G_MAXINT64;
+  ConnectionUsage *usage = update_usage ? get_connection_usage (self, connection_id)
+                                        : g_hash_table_lookup (self->connections_usage,
+                                                               connection_id);
+
+  if (details->tariff != NULL)
+    {
+      MwtPeriod *tariff_period = mwt_tariff_lookup_period_usec (details->tariff, now_usec);
+      if (tariff_period != NULL)
+        data->tariff_period = g_object_ref (tariff_period);
+    }
+
+  if (data->tariff_period != NULL)
+    {
+      g_debug ("%s: Considering tariff period %p: %" G_GINT64_FORMAT "µs to "
+               "%" G_GINT64_FORMAT "µs since the epoch",
+               G_STRFUNC, data->tariff_period,
+               mwt_period_get_start_usec (data->tariff_period),
+               mwt_period_get_end_usec (data->tariff_period));
+
+      /* Count bytes against the current recurrence of the period, and check
+       * whether they’ve reached its limit. A limit of zero indicates a period
+       * when downloads are banned. Reaching the limit part-way through a
+       * recurrence is detected by
+       * connection_monitor_connection_statistics_changed_cb(). */
+      gint64 recurrence_start_usec;
+
+      if (!mwt_period_contains_time_usec (data->tariff_period, now_usec,
+                                          &recurrence_start_usec,
+                                          &recurrence_end_usec))
+        {
+          recurrence_start_usec = mwt_period_get_start_usec (data->tariff_period);
+          recurrence_end_usec = mwt_period_get_end_usec (data->tariff_period);
+        }
+
+      PeriodUsage peeked_usage;
+      const PeriodUsage *period_usage;
+
+      if (update_usage)
+        {
+          period_usage = connection_usage_select_period (usage, self->usage_ledger,
+                                                         connection_id, data->tariff_period,
+                                                         recurrence_start_usec,
+                                                         recurrence_end_usec, now_usec);
+        }
+      else
+        {
+          peeked_usage = connection_usage_peek_period (usage, self->usage_ledger,
+                                                       connection_id, data->tariff_period,
+                                                       recurrence_start_usec,
+                                                       recurrence_end_usec);
+          period_usage = &peeked_usage;
+        }
+
+      tariff_period_reached_capacity_limit = period_usage_reached_limit (period_usage);
+
+      data->capacity_limit = period_usage->capacity_limit;
+      if (data->capacity_limit != G_MAXUINT64)
+        data->capacity_remaining = data->capacity_limit - MIN (period_usage->n_bytes,
+                                                               data->capacity_limit);
+
+      /* Spread what’s left of the capacity limit over the rest of the
+       * recurrence, so that downloads don’t use it all up early and get
+       * stopped part-way through. */
+      if (data->capacity_limit != G_MAXUINT64 && data->capacity_remaining > 0 &&
+          recurrence_end_usec != G_MAXINT64 && now_usec < recurrence_end_usec)
+        {
+          guint64 remaining_secs = MAX ((recurrence_end_usec - now_usec) / G_USEC_PER_SEC, 1);
+          data->max_rate = MAX (data->capacity_remaining / remaining_secs, 1);
+        }
+
+      g_debug ("%s: Used %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " bytes "
+               "in tariff period",
+               G_STRFUNC, period_usage->n_bytes, period_usage->capacity_limit);
+    }
+  else
+    {
+      g_debug ("%s: No tariff period found", G_STRFUNC);
+      if (update_usage)
+        connection_usage_select_period (usage, NULL, connection_id, NULL, 0, 0,
+                                        now_usec);
+    }
+
+  /* Is it safe to schedule entries on this connection now? */
+  data->is_safe = ((details->metered == MWS_METERED_NO ||
+                    details->metered == MWS_METERED_GUESS_NO ||
+                    details->allow_downloads_when_metered) &&
+                   details->allow_downloads &&
+                   !tariff_period_reached_capacity_limit);
+  g_debug ("%s: Connection ‘%s’ is %s to download on "
+           "(metered: %s, allow-downloads-when-metered: %s, "
+           "allow-downloads: %s, tariff-period-reached-capacity-limit: %s).",
+           G_STRFUNC, connection_id,
+           data->is_safe ? "safe" : "not safe",
+           mws_metered_to_string (details->metered),
+           details->allow_downloads_when_metered ? "yes" : "no",
+           details->allow_downloads ? "yes" : "no",
+           tariff_period_reached_capacity_limit ? "yes" : "no");
+
+  /* Work out when the verdict for this connection might next change due to
+   * its tariff changing periods. */
+  if (details->tariff != NULL)
+    {
+      gint64 next_transition_usec;
+
+      if (mwt_tariff_get_next_transition_usec (details->tariff, now_usec,
+                                               &next_transition_usec, NULL, NULL))
+        {
+          g_debug ("%s: Connection ‘%s’ next transition is in %" G_GINT64_FORMAT "µs",
+                   G_STRFUNC, connection_id, next_transition_usec - now_usec);
+
+          if (now_usec < next_transition_usec)
+            data->next_transition_usec = next_transition_usec;
+        }
+      else
+        {
+          g_debug ("%s: Connection ‘%s’ next transition is never",
+                   G_STRFUNC, connection_id);
+        }
+    }
+
+  /* The capacity limit is reset at the end of the current recurrence, even if
+   * the tariff doesn’t report that as a transition because the period repeats
+   * back-to-back. */
+  if (now_usec < recurrence_end_usec)
+    data->next_transition_usec = MIN (data->next_transition_usec, recurrence_end_usec);
+
+  if (details->tariff != NULL)
+    MWS_TRACE4 (tariff_lookup, connection_id, now_usec, data->tariff_period,
+                data->next_transition_usec);
+
+  /* Work out the upcoming tariff windows, for planning when to start entries
+   * which have deadlines. These are only valid until the next transition, as
+   * is the rest of the data. */
+  if (details->tariff != NULL)
+    data->windows = calculate_tariff_windows (details->tariff,
+                                              data->next_transition_usec,
+                                              now_usec + PLANNING_HORIZON_USEC);
+
+  return g_steal_pointer (&data);
+}
+
+/* Recalculate the cached verdict on the network connections if it has been
+ * invalidated. This is the only part of scheduling which has to query the
+ * connection monitor and look up tariffs, and it only does so for connections
+ * whose cached data has been invalidated. It also updates
+ * #MwsScheduler:allow-downloads. Newly calculated connections are added to
+ * #MwsScheduler.transitions_heap, so that update_reschedule_alarm() can find
+ * when the next reschedule is needed due to a tariff period changing. */
+static void
+update_connections_verdict (MwsScheduler *self)
+{
+  if (self->connections_verdict_valid)
+    return;
+
+  g_autoptr(GDateTime) now = NULL;
+  gint64 now_usec = 0;
+
+  const gchar * const *all_connection_ids = NULL;
+  all_connection_ids = mws_connection_monitor_get_connection_ids (self->connection_monitor);
+
+  gboolean cached_allow_downloads = TRUE;
+  gboolean all_connections_safe = TRUE;
+
+  g_ptr_array_set_size (self->cached_safe_connection_ids, 0);
+
+  for (gsize i = 0; all_connection_ids[i] != NULL; i++)
+    {
+      ConnectionData *data = g_hash_table_lookup (self->connections_data,
+                                                  all_connection_ids[i]);
+
+      if (data == NULL)
+        {
+          if (now == NULL)
+            {
+              now = mws_clock_get_now_local (self->clock);
+              now_usec = date_time_to_usec (now);
+
+              g_debug ("%s: Considering now = %" G_GINT64_FORMAT "µs since "
+                       "the epoch", G_STRFUNC, now_usec);
+
+              if (self->usage_ledger != NULL)
+                mws_usage_ledger_expire (self->usage_ledger, now_usec);
+            }
+
+          MwsConnectionDetails details = { 0, };
+
+          get_connection_details (self, all_connection_ids[i], &details);
+          data = calculate_connection_data (self, all_connection_ids[i], &details,
+                                            now_usec, TRUE);
+          add_connection_data (self, data);
+          mws_connection_details_clear (&details);
+        }
+
+      cached_allow_downloads = cached_allow_downloads && data->allow_downloads;
+
+      /* If all the active connections are safe, any entry can be made active.
+       * Otherwise, only entries whose clients can bind their downloads to a
+       * particular connection can be made active, on one of the connections
+       * which is safe. */
+      all_connections_safe = all_connections_safe && data->is_safe;
+      if (data->is_safe)
+        g_ptr_array_add (self->cached_safe_connection_ids,
+                         g_strdup (all_connection_ids[i]));
+    }
+
+  self->cached_connections_safe = all_connections_safe;
+  self->connections_verdict_valid = TRUE;
+
+  if (self->cached_allow_downloads != cached_allow_downloads)
+    {
+      g_debug ("%s: Updating cached_allow_downloads from %u to %u",
+               G_STRFUNC, (guint) self->cached_allow_downloads,
+               (guint) cached_allow_downloads);
+      self->cached_allow_downloads = cached_allow_downloads;
+      g_object_notify (G_OBJECT (self), "allow-downloads");
+    }
+}
+
+/* Work out when the entry in @data should start downloading, given the
+ * upcoming tariff windows of all the connections. Entries without a deadline
+ * aren’t deferred. Otherwise, on each connection, the entry is deferred to the
+ * cheapest window which starts before its deadline and has enough capacity
+ * for the entry’s expected size; the earliest of those windows is chosen if
+ * several are equally cheap. The current window is preferred if it’s as cheap
+ * as any of them. The entry has to wait for the latest of those start times,
+ * since all connections have to be safe to download on.
+ *
+ * The tariff format has no notion of price, so the capacity limit of each
+ * window is used as a proxy for its cost: a window with a larger limit (or
+ * none) is assumed to be cheaper.
+ *
+ * @connections_data is the #ConnectionData for all the connections, normally
+ * #MwsScheduler.connections_data. Returns @now_usec if the entry should not be
+ * deferred. */
+static gint64
+plan_entry_start (GHashTable      *connections_data,
+                  const EntryData *data,
+                  gint64           now_usec)
+{
+  if (data->deadline_usec == 0 || data->deadline_usec <= now_usec)
+    return now_usec;
+
+  gint64 start_usec = now_usec;
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, connections_data);
+
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      const ConnectionData *connection_data = value;
+
+      if (connection_data->windows == NULL)
+        continue;
+
+      /* If the entry won’t fit in what’s left of the current window, any later
+       * window it fits in is better. */
+      guint64 best_capacity_limit = connection_data->capacity_limit;
+      gint64 best_start_usec = now_usec;
+
+      if (connection_data->capacity_remaining < MAX (data->expected_size, 1))
+        best_capacity_limit = 0;
+
+      for (guint i = 0; i < connection_data->windows->len; i++)
+        {
+          const TariffWindow *window = &g_array_index (connection_data->windows,
+                                                       TariffWindow, i);
+
+          if (window->start_usec >= data->deadline_usec)
+            break;
+
+          if (window->capacity_limit < MAX (data->expected_size, 1))
+            continue;
+
+          if (window->capacity_limit > best_capacity_limit)
+            {
+              best_capacity_limit = window->capacity_limit;
+              best_start_usec = window->start_usec;
+            }
+        }
+
+      start_usec = MAX (start_usec, best_start_usec);
+    }
+
+  return start_usec;
+}
+
+/* Fire the `entry_verdict` tracepoint for @data, if a tracer is attached. */
+static inline void
+trace_entry_verdict (const EntryData      *data,
+                     MwsTraceEntryVerdict  verdict)
+{
+  if (MWS_TRACE_ENABLED (entry_verdict))
+    MWS_TRACE2 (entry_verdict, mws_schedule_entry_get_id (data->entry), verdict);
+}
+
+/* Query the current time into @now_usec, a cache of it in microseconds since
+ * the Unix epoch, unless it’s already been queried (in which case it’s
+ * non-zero). */
+static void
+ensure_now_usec (MwsScheduler *self,
+                 gint64       *now_usec)
+{
+  if (*now_usec == 0)
+    {
+      g_autoptr(GDateTime) now = mws_clock_get_now_local (self->clock);
+      *now_usec = date_time_to_usec (now);
+    }
+}
+
+/* Whether the entry in @data should wait for a cheaper tariff window, rather
+ * than being made active now. Entries which are already active are never
+ * deferred, so that their downloads aren’t interrupted. @now_usec is a cache
+ * of the current time, which is only queried from the clock if needed; it must
+ * be initialised to zero. If the entry is deferred, @next_deferral_usec is
+ * lowered to the time it’s planned to start, if that’s earlier, and the entry
+ * and that time are appended to @deferred (an array of #DeferredEntry), if
+ * it’s non-%NULL. See plan_entry_start() for @connections_data. */
+static gboolean
+entry_is_deferred (MwsScheduler    *self,
+                   GHashTable      *connections_data,
+                   guint            handle,
+                   const EntryData *data,
+                   gint64          *now_usec,
+                   gint64          *next_deferral_usec,
+                   GArray          *deferred)
+{
+  if (data->deadline_usec == 0 || data->is_active)
+    return FALSE;
+
+  ensure_now_usec (self, now_usec);
+
+  gint64 start_usec = plan_entry_start (connections_data, data, *now_usec);
+
+  if (start_usec > *now_usec)
+    {
+      g_debug ("%s: Entry ‘%s’ is deferred for %" G_GINT64_FORMAT "µs",
+               G_STRFUNC, mws_schedule_entry_get_id (data->entry),
+               start_usec - *now_usec);
+      *next_deferral_usec = MIN (*next_deferral_usec, start_usec);
+      trace_entry_verdict (data, MWS_TRACE_ENTRY_DEFERRED);
+
+      if (deferred != NULL)
+        {
+          const DeferredEntry deferred_entry = { handle, start_usec };
+          g_array_append_val (deferred, deferred_entry);
+        }
+
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* Assign each of the entries in @selected (an array of handles) which can be
+ * bound to a connection to one of the safe connections, spreading them evenly
+ * so that all the available bandwidth can be used. Entries which are already
+ * assigned to a connection which is still safe keep it, so their downloads
+ * aren’t interrupted. Other entries have their connection cleared.
+ *
+ * This runs in time proportional to the number of selected entries multiplied
+ * by the number of safe connections, both of which are small. */
+static void
+assign_connections (MwsScheduler *self,
+                    GArray       *selected)
+{
+  GPtrArray *safe_ids = self->cached_safe_connection_ids;
+  g_autofree guint *n_assigned = g_new0 (guint, MAX (safe_ids->len, 1));
+  g_autoptr(GArray) unassigned = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  /* Keep existing assignments where possible. */
+  for (guint i = 0; i < selected->len; i++)
+    {
+      guint handle = g_array_index (selected, guint, i);
+      EntryData *data = get_entry_slot (self, handle);
+      const gchar *connection_id = mws_schedule_entry_get_connection_id (data->entry);
+      guint index;
+
+      if (!data->bind_to_connection || safe_ids->len == 0)
+        mws_schedule_entry_set_connection_id (data->entry, NULL);
+      else if (connection_id != NULL &&
+               g_ptr_array_find_with_equal_func (safe_ids, connection_id,
+                                                 g_str_equal, &index))
+        n_assigned[index]++;
+      else
+        g_array_append_val (unassigned, handle);
+    }
+
+  /* Give the remaining entries the least loaded safe connection, preferring
+   * the connections listed first by the connection monitor. */
+  for (guint i = 0; i < unassigned->len; i++)
+    {
+      EntryData *data = get_entry_slot (self, g_array_index (unassigned, guint, i));
+      guint best = 0;
+
+      for (guint j = 1; j < safe_ids->len; j++)
+        {
+          if (n_assigned[j] < n_assigned[best])
+            best = j;
+        }
+
+      g_debug ("%s: Assigning entry ‘%s’ to connection ‘%s’",
+               G_STRFUNC, mws_schedule_entry_get_id (data->entry),
+               (const gchar *) safe_ids->pdata[best]);
+      mws_schedule_entry_set_connection_id (data->entry, safe_ids->pdata[best]);
+      n_assigned[best]++;
+    }
+}
+
+/* Set #MwsScheduleEntry:max-rate on each of the entries in @selected (an array
+ * of handles), once they’ve been assigned connections by assign_connections().
+ * Each connection’s #ConnectionData.max_rate is shared equally between the
+ * entries bound to it and the entries which aren’t bound to any connection
+ * (since they could be using any of them). Entries which aren’t bound to a
+ * connection get the lowest of their shares of all the connections.
+ *
+ * This runs in time proportional to the number of selected entries multiplied
+ * by the number of safe connections, both of which are small. */
+static void
+assign_max_rates (MwsScheduler *self,
+                  GArray       *selected)
+{
+  GPtrArray *safe_ids = self->cached_safe_connection_ids;
+  g_autofree guint *n_sharing = g_new0 (guint, MAX (safe_ids->len, 1));
+  guint n_unbound = 0;
+
+  for (guint i = 0; i < selected->len; i++)
+    {
+      const EntryData *data = get_entry_slot (self, g_array_index (selected, guint, i));
+      const gchar *connection_id = mws_schedule_entry_get_connection_id (data->entry);
+      guint index;
+
+      if (connection_id == NULL)
+        n_unbound++;
+      else if (g_ptr_array_find_with_equal_func (safe_ids, connection_id,
+                                                 g_str_equal, &index))
+        n_sharing[index]++;
+    }
+
+  for (guint i = 0; i < selected->len; i++)
+    {
+      const EntryData *data = get_entry_slot (self, g_array_index (selected, guint, i));
+      const gchar *connection_id = mws_schedule_entry_get_connection_id (data->entry);
+      guint64 max_rate = 0;
+
+      for (guint j = 0; j < safe_ids->len; j++)
+        {
+          if (connection_id != NULL && !g_str_equal (connection_id, safe_ids->pdata[j]))
+            continue;
+
+          const ConnectionData *connection_data =
+              g_hash_table_lookup (self->connections_data, safe_ids->pdata[j]);
+
+          if (connection_data == NULL || connection_data->max_rate == 0)
+            continue;
+
+          guint64 share = MAX (connection_data->max_rate / (n_sharing[j] + n_unbound), 1);
+          max_rate = (max_rate == 0) ? share : MIN (max_rate, share);
+        }
+
+      if (max_rate != mws_schedule_entry_get_max_rate (data->entry))
+        g_debug ("%s: Limiting entry ‘%s’ to %" G_GUINT64_FORMAT " bytes/s",
+                 G_STRFUNC, mws_schedule_entry_get_id (data->entry), max_rate);
+
+      mws_schedule_entry_set_max_rate (data->entry, max_rate);
+    }
+}
+
+/* Whether the active entry in @data is protected from preemption by the
+ * scheduler’s policy: it became active less than #MwsScheduler:min-run-time
+ * ago, or it’s non-resumable and has downloaded enough (see
+ * #MwsScheduler:non-resumable-protect-percent and
+ * #MwsScheduler:non-resumable-protect-size). If it’s protected by its run
+ * time, @next_unprotected_usec is lowered to the time that protection ends, if
+ * that’s earlier. @now_usec is as for entry_is_deferred(). */
+static gboolean
+entry_is_protected (MwsScheduler    *self,
+                    const EntryData *data,
+                    gint64          *now_usec,
+                    gint64          *next_unprotected_usec)
+{
+  g_assert (data->is_active);
+
+  if (self->min_run_time_secs > 0)
+    {
+      ensure_now_usec (self, now_usec);
+
+      gint64 run_time_end_usec = data->active_since_usec +
+                                 (gint64) self->min_run_time_secs * G_USEC_PER_SEC;
+
+      if (run_time_end_usec > *now_usec)
+        {
+          *next_unprotected_usec = MIN (*next_unprotected_usec, run_time_end_usec);
+          return TRUE;
+        }
+    }
+
+  if (mws_schedule_entry_get_resumable (data->entry))
+    return FALSE;
+
+  guint64 downloaded_size = mws_schedule_entry_get_downloaded_size (data->entry);
+
+  if (self->non_resumable_protect_size > 0 &&
+      downloaded_size >= self->non_resumable_protect_size)
+    return TRUE;
+
+  /* Calculate expected_size × percent / 100 without overflowing. */
+  if (self->non_resumable_protect_percent > 0 && data->expected_size > 0)
+    {
+      guint64 threshold = (data->expected_size / 100) * self->non_resumable_protect_percent +
+                          (data->expected_size % 100) * self->non_resumable_protect_percent / 100;
+
+      if (downloaded_size >= threshold)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* Whether the entry in @challenger is important enough to preempt the active
+ * entry in @incumbent, taking #MwsScheduler:preemption-priority-margin into
+ * account. @challenger must be ordered before @incumbent, or be in the slot
+ * reserved for a small entry, or have been given the slot by
+ * select_fair_share_entries(). In the latter case, the peer priorities have
+ * already been weighed up against fairness; so only the margin applies. */
+static gboolean
+entry_data_preempts (MwsScheduler    *self,
+                     const EntryData *challenger,
+                     const EntryData *incumbent)
+{
+  if (challenger->peer_priority != incumbent->peer_priority)
+    return (self->fair_share ||
+            challenger->peer_priority > incumbent->peer_priority);
+
+  return ((guint64) challenger->entry_priority >=
+          (guint64) incumbent->entry_priority + self->preemption_priority_margin);
+}
+
+/* Apply the preemption policy to @selected (an array of handles from
+ * select_entries()). Each active entry which wasn’t selected, but which could
+ * still be active (according to @all_safe), takes back the slot of the least
+ * important selected entry which isn’t active yet, if it’s protected (see
+ * entry_is_protected()) or that entry doesn’t preempt it (see
+ * entry_data_preempts()). Active entries which lost their slot because fewer
+ * entries can be active, rather than to another entry, aren’t kept.
+ *
+ * @now_usec and @next_unprotected_usec are as for entry_is_protected().
+ *
+ * This runs in time proportional to the square of
+ * #MwsScheduler:max-active-entries, which is small, and doesn’t change any of
+ * the scheduler’s state. */
+static void
+retain_preempted_entries (MwsScheduler *self,
+                          GArray       *selected,
+                          gboolean      all_safe,
+                          gint64       *now_usec,
+                          gint64       *next_unprotected_usec)
+{
+  if (self->min_run_time_secs == 0 &&
+      self->preemption_priority_margin == 0 &&
+      self->non_resumable_protect_percent == 0 &&
+      self->non_resumable_protect_size == 0)
+    return;
+
+  for (guint i = 0; i < self->active_entries->len; i++)
+    {
+      guint handle = g_array_index (self->active_entries, guint, i);
+      const EntryData *data = get_entry_slot (self, handle);
+      gboolean is_selected = FALSE;
+      guint victim_index = G_MAXUINT;
+
+      if (!all_safe && !data->bind_to_connection)
+        continue;
+
+      for (guint j = 0; j < selected->len && !is_selected; j++)
+        is_selected = (g_array_index (selected, guint, j) == handle);
+
+      if (is_selected)
+        continue;
+
+      for (guint j = selected->len; j > 0 && victim_index == G_MAXUINT; j--)
+        {
+          if (!get_entry_slot (self, g_array_index (selected, guint, j - 1))->is_active)
+            victim_index = j - 1;
+        }
+
+      if (victim_index == G_MAXUINT)
+        continue;
+
+      const EntryData *victim_data =
+          get_entry_slot (self, g_array_index (selected, guint, victim_index));
+
+      if (!entry_is_protected (self, data, now_usec, next_unprotected_usec) &&
+          entry_data_preempts (self, victim_data, data))
+        continue;
+
+      g_debug ("%s: Keeping entry ‘%s’ active rather than preempting it with "
+               "entry ‘%s’", G_STRFUNC, mws_schedule_entry_get_id (data->entry),
+               mws_schedule_entry_get_id (victim_data->entry));
+
+      /* Swap it in, keeping @selected in priority order. */
+      g_array_remove_index (selected, victim_index);
+
+      guint insert_index = 0;
+      while (insert_index < selected->len &&
+             entry_data_compare (get_entry_slot (self, g_array_index (selected, guint, insert_index)),
+                                 data) < 0)
+        insert_index++;
+
+      g_array_insert_val (selected, insert_index, handle);
+    }
+}
+
+/* One owner’s candidates for the active slots in select_fair_share_entries():
+ * the handles of its eligible entries, in priority order. */
+typedef struct
+{
+  const OwnerEntries *owner;  /* (unowned) */
+  GArray *handles;  /* (owned) (element-type guint) */
+  guint n_given;
+} FairShareQueue;
+
+static void
+fair_share_queue_clear (FairShareQueue *queue)
+{
+  g_clear_pointer (&queue->handles, g_array_unref);
+}
+
+/* Virtual time at which @queue would finish using its next slot, if it were
+ * given one: the owner’s service so far, plus a quantum (scaled by its weight)
+ * for each slot it’s already been given in this selection. An entry which is
+ * already active gets a quantum’s head start, so it keeps its slot until its
+ * owner has had a quantum more than its fair share. */
+static gint64
+fair_share_queue_key (MwsScheduler         *self,
+                      const FairShareQueue *queue)
+{
+  const EntryData *head = get_entry_slot (self, g_array_index (queue->handles, guint,
+                                                               queue->n_given));
+  gint64 quantum_usec = (gint64) self->fair_share_quantum_secs * G_USEC_PER_SEC /
+                        queue->owner->weight;
+
+  return (queue->owner->service_usec +
+          quantum_usec * (queue->n_given + 1) -
+          (head->is_active ? quantum_usec : 0));
+}
+
+/* Fair-share equivalent of choosing the first @n_active eligible entries from
+ * #MwsScheduler.entries_by_priority, for #MwsScheduler:fair-share. This is
+ * weighted fair queueing over the slots, with the owners’ service as the
+ * virtual time: each slot goes to the next entry (in priority order) of the
+ * owner which would finish using it first, according to
+ * fair_share_queue_key(). Ties are broken by entry_data_compare(), so by peer
+ * priority. The selected handles are appended to @selected in the order they
+ * were chosen; the other arguments are as for select_entries().
+ *
+ * This examines up to @n_active eligible entries per owner (and any deferred
+ * entries ordered before them), rather than @n_active in total. If any owner
+ * is left waiting, @out_next_deferral_usec is lowered to a quantum from now, so
+ * the shares are re-evaluated once its owner may have caught up. */
+static void
+select_fair_share_entries (MwsScheduler *self,
+                           GHashTable   *connections_data,
+                           gboolean      all_safe,
+                           guint         n_active,
+                           gint64       *now_usec,
+                           gint64       *out_next_deferral_usec,
+                           GArray       *out_deferred,
+                           GArray       *selected)
+{
+  if (n_active == 0)
+    return;
+
+  g_autoptr(GArray) queues = g_array_new (FALSE, TRUE, sizeof (FairShareQueue));
+  g_array_set_clear_func (queues, (GDestroyNotify) fair_share_queue_clear);
+  g_autoptr(GHashTable) queue_indices = g_hash_table_new (g_direct_hash, g_direct_equal);
+  guint n_owners = g_hash_table_size (self->entries_by_owner);
+  guint n_full_queues = 0;
+
+  /* Gather each owner’s eligible entries, in priority order, stopping once
+   * every owner has enough to fill all the slots. */
+  for (GSequenceIter *iter = g_sequence_get_begin_iter (self->entries_by_priority);
+       n_full_queues < n_owners && !g_sequence_iter_is_end (iter);
+       iter = g_sequence_iter_next (iter))
+    {
+      guint handle = GPOINTER_TO_UINT (g_sequence_get (iter));
+      const EntryData *data = get_entry_slot (self, handle);
+      const OwnerEntries *owner =
+          g_hash_table_lookup (self->entries_by_owner,
+                               mws_schedule_entry_get_owner (data->entry));
+      gpointer queue_index;
+      FairShareQueue *queue;
+
+      g_assert (owner != NULL);
+
+      if (g_hash_table_lookup_extended (queue_indices, owner, NULL, &queue_index))
+        {
+          queue = &g_array_index (queues, FairShareQueue, GPOINTER_TO_UINT (queue_index));
+        }
+      else
+        {
+          FairShareQueue new_queue = { owner, NULL, 0 };
+          new_queue.handles = g_array_sized_new (FALSE, FALSE, sizeof (guint), n_active);
+
+          g_hash_table_insert (queue_indices, (gpointer) owner,
+                               GUINT_TO_POINTER (queues->len));
+          g_array_append_val (queues, new_queue);
+          queue = &g_array_index (queues, FairShareQueue, queues->len - 1);
+        }
+
+      if (queue->handles->len >= n_active)
+        continue;
+
+      if (!all_safe && !data->bind_to_connection)
+        {
+          trace_entry_verdict (data, MWS_TRACE_ENTRY_NOT_SAFE);
+          continue;
+        }
+
+      if (entry_is_deferred (self, connections_data, handle, data, now_usec,
+                             out_next_deferral_usec, out_deferred))
+        continue;
+
+      g_array_append_val (queue->handles, handle);
+      if (queue->handles->len == n_active)
+        n_full_queues++;
+    }
+
+  /* Hand out the slots. */
+  while (selected->len < n_active)
+    {
+      FairShareQueue *best = NULL;
+      gint64 best_key = 0;
+
+      for (guint i = 0; i < queues->len; i++)
+        {
+          FairShareQueue *queue = &g_array_index (queues, FairShareQueue, i);
+
+          if (queue->n_given >= queue->handles->len)
+            continue;
+
+          gint64 key = fair_share_queue_key (self, queue);
+
+          if (best == NULL || key < best_key ||
+              (key == best_key &&
+               entry_data_compare (get_entry_slot (self, g_array_index (queue->handles, guint, queue->n_given)),
+                                   get_entry_slot (self, g_array_index (best->handles, guint, best->n_given))) < 0))
+            {
+              best = queue;
+              best_key = key;
+            }
+        }
+
+      if (best == NULL)
+        break;
+
+      guint handle = g_array_index (best->handles, guint, best->n_given);
+      best->n_given++;
+
+      trace_entry_verdict (get_entry_slot (self, handle), MWS_TRACE_ENTRY_SELECTED);
+      g_array_append_val (selected, handle);
+    }
+
+  /* If any owner is left waiting, come back to it after a quantum. */
+  for (guint i = 0; i < queues->len; i++)
+    {
+      const FairShareQueue *queue = &g_array_index (queues, FairShareQueue, i);
+
+      if (queue->n_given < queue->handles->len)
+        {
+          g_debug ("%s: Owner ‘%s’ is waiting for a slot", G_STRFUNC,
+                   queue->owner->owner);
+          ensure_now_usec (self, now_usec);
+          *out_next_deferral_usec = MIN (*out_next_deferral_usec,
+                                         *now_usec +
+                                         (gint64) self->fair_share_quantum_secs * G_USEC_PER_SEC);
+          break;
+        }
+    }
+}
+
+/* Charge the owners of the active entries for the time since they were last
+ * charged, for #MwsScheduler:fair-share. Each owner’s service grows by the
+ * time each of its entries has been active, divided by its weight. This must
+ * be called before the active entries change.
+ *
+ * Owners which have fallen more than two quanta behind the least-served active
+ * owner (for example, because all their entries were deferred) are brought up
+ * to that, so they can’t build up enough credit to monopolise the slots when
+ * their entries become eligible again. That’s still far enough behind for
+ * them to win the next slot outright (see fair_share_queue_key()). */
+static void
+charge_fair_share (MwsScheduler *self,
+                   gint64       *now_usec)
+{
+  if (!self->fair_share)
+    return;
+
+  ensure_now_usec (self, now_usec);
+
+  gint64 elapsed_usec = 0;
+  if (self->fair_share_charged_usec != 0 && *now_usec > self->fair_share_charged_usec)
+    elapsed_usec = *now_usec - self->fair_share_charged_usec;
+  self->fair_share_charged_usec = *now_usec;
+
+  if (elapsed_usec == 0 || self->active_entries->len == 0)
+    return;
+
+  for (guint i = 0; i < self->active_entries->len; i++)
+    {
+      const EntryData *data = get_entry_slot (self, g_array_index (self->active_entries, guint, i));
+      OwnerEntries *owner = g_hash_table_lookup (self->entries_by_owner,
+                                                 mws_schedule_entry_get_owner (data->entry));
+
+      g_assert (owner != NULL);
+      owner->service_usec += elapsed_usec / owner->weight;
+    }
+
+  gint64 min_active_service_usec = G_MAXINT64;
+
+  for (guint i = 0; i < self->active_entries->len; i++)
+    {
+      const EntryData *data = get_entry_slot (self, g_array_index (self->active_entries, guint, i));
+      const OwnerEntries *owner = g_hash_table_lookup (self->entries_by_owner,
+                                                       mws_schedule_entry_get_owner (data->entry));
+
+      min_active_service_usec = MIN (min_active_service_usec, owner->service_usec);
+    }
+
+  GHashTableIter iter;
+  gpointer value;
 
-  g_autoptr(GArray) all_connection_details = g_array_sized_new (FALSE, FALSE,
-                                                                sizeof (MwsConnectionDetails),
-                                                                n_connections);
-  g_array_set_clear_func (all_connection_details,
-                          (GDestroyNotify) mws_connection_details_clear);
-  g_array_set_size (all_connection_details, n_connections);
+  g_hash_table_iter_init (&iter, self->entries_by_owner);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      OwnerEntries *owner = value;
+      gint64 max_lag_usec = 2 * (gint64) self->fair_share_quantum_secs * G_USEC_PER_SEC /
+                            owner->weight;
 
-  gboolean cached_allow_downloads = TRUE;
+      if (owner->service_usec < min_active_service_usec - max_lag_usec)
+        owner->service_usec = min_active_service_usec - max_lag_usec;
+    }
+}
 
-  for (gsize i = 0; all_connection_ids[i] != NULL; i++)
+/* Select the entries which should be active, given a verdict on the network
+ * connections: @connections_data (as for plan_entry_start()), whether they are
+ * @all_safe, and whether @some_safe of them are safe. If only some of the
+ * connections are safe, only entries which can be bound to one of those
+ * connections can be active. @now_usec, @out_next_deferral_usec and
+ * @out_deferred are as for entry_is_deferred(); @out_deferred may be %NULL.
+ * @out_next_deferral_usec is also lowered to the time the preemption policy
+ * next changes (see retain_preempted_entries()).
+ *
+ * If #MwsScheduler:fair-share is enabled, the slots are shared between owners
+ * by select_fair_share_entries() instead of going to the most important
+ * entries.
+ *
+ * This doesn’t change any of the scheduler’s state, so it’s shared between
+ * update_active_entries() and mws_scheduler_compute_plan(). Returns an
+ * array of the handles of the selected entries, in priority order (or the
+ * order select_fair_share_entries() chose them in) except for any slot
+ * reserved for a small entry, which is last. */
+static GArray *
+select_entries (MwsScheduler *self,
+                GHashTable   *connections_data,
+                gboolean      all_safe,
+                gboolean      some_safe,
+                gint64       *now_usec,
+                gint64       *out_next_deferral_usec,
+                GArray       *out_deferred)
+{
+  guint n_active = (all_safe || some_safe) ? get_max_active_entries (self) : 0;
+  g_debug ("%s: Connections are %s; up to %u entries can be active",
+           G_STRFUNC,
+           all_safe ? "safe" : (some_safe ? "partially safe" : "not safe"),
+           n_active);
+
+  /* Select the most important N entries which aren’t deferred, and which can
+   * use the safe connections. N is the maximum number of active entries set at
+   * construction time for the scheduler, or the concurrency controller’s
+   * current limit if that’s lower. */
+  g_autoptr(GArray) selected = g_array_sized_new (FALSE, FALSE, sizeof (guint), n_active);
+  gboolean any_selected_small = FALSE;
+
+  if (self->fair_share)
     {
-      MwsConnectionDetails *out_details = &g_array_index (all_connection_details,
-                                                          MwsConnectionDetails, i);
+      select_fair_share_entries (self, connections_data, all_safe, n_active,
+                                 now_usec, out_next_deferral_usec, out_deferred,
+                                 selected);
 
-      if (!mws_connection_monitor_get_connection_details (self->connection_monitor,
-                                                          all_connection_ids[i],
-                                                          out_details))
+      for (guint i = 0; i < selected->len; i++)
         {
-          /* Fill the details with dummy values. */
-          g_debug ("%s: Failed to get details for connection ‘%s’.",
-                   G_STRFUNC, all_connection_ids[i]);
-          mws_connection_details_clear (out_details);
-          continue;
+          const EntryData *data = get_entry_slot (self, g_array_index (selected, guint, i));
+          any_selected_small = any_selected_small || entry_data_is_small (self, data);
         }
-
-      /* FIXME: See FIXME below by `can_be_active` about allowing clients to
-       * specify whether they support downloading from selective connections.
-       * If that logic changes, so does this. */
-      cached_allow_downloads = cached_allow_downloads && (out_details->metered == MWS_METERED_NO ||
-                                                          out_details->metered == MWS_METERED_GUESS_NO ||
-                                                          out_details->allow_downloads_when_metered);
-      cached_allow_downloads = cached_allow_downloads && out_details->allow_downloads;
     }
+  else
+    for (GSequenceIter *iter = g_sequence_get_begin_iter (self->entries_by_priority);
+         selected->len < n_active && !g_sequence_iter_is_end (iter);
+         iter = g_sequence_iter_next (iter))
+      {
+        guint handle = GPOINTER_TO_UINT (g_sequence_get (iter));
+        const EntryData *data = get_entry_slot (self, handle);
+
+        if (!all_safe && !data->bind_to_connection)
+          {
+            trace_entry_verdict (data, MWS_TRACE_ENTRY_NOT_SAFE);
+            continue;
+          }
+
+        if (entry_is_deferred (self, connections_data, handle, data, now_usec,
+                               out_next_deferral_usec, out_deferred))
+          continue;
 
-  if (self->cached_allow_downloads != cached_allow_downloads)
-    {
-      g_debug ("%s: Updating cached_allow_downloads from %u to %u",
-               G_STRFUNC, (guint) self->cached_allow_downloads,
-               (guint) cached_allow_downloads);
-      self->cached_allow_downloads = cached_allow_downloads;
-      g_object_notify (G_OBJECT (self), "allow-downloads");
-    }
+        trace_entry_verdict (data, MWS_TRACE_ENTRY_SELECTED);
+        any_selected_small = any_selected_small || entry_data_is_small (self, data);
+        g_array_append_val (selected, handle);
+      }
 
-  /* Fast path. We still have to load the connection monitor information above,
-   * though, so that we can update self->cached_allow_downloads. */
-  if (g_hash_table_size (self->entries) == 0)
+  /* If more than one entry can be active, and none of the selected entries are
+   * small, give the last slot to the most important small entry which isn’t
+   * deferred. If fewer than N entries were selected, every entry which isn’t
+   * deferred already has a slot. */
+  if (n_active > 1 && selected->len == n_active && !any_selected_small)
     {
-      self->in_reschedule = FALSE;
-      return;
+      for (GSequenceIter *iter = g_sequence_get_begin_iter (self->small_entries_by_priority);
+           !g_sequence_iter_is_end (iter);
+           iter = g_sequence_iter_next (iter))
+        {
+          guint handle = GPOINTER_TO_UINT (g_sequence_get (iter));
+          const EntryData *data = get_entry_slot (self, handle);
+
+          if ((!all_safe && !data->bind_to_connection) ||
+              entry_is_deferred (self, connections_data, handle, data, now_usec,
+                                 out_next_deferral_usec, out_deferred))
+            continue;
+
+          g_debug ("%s: Reserving a slot for small entry ‘%s’",
+                   G_STRFUNC, mws_schedule_entry_get_id (data->entry));
+          trace_entry_verdict (data, MWS_TRACE_ENTRY_SELECTED);
+          g_array_index (selected, guint, n_active - 1) = handle;
+          break;
+        }
     }
 
-  /* As we iterate over all the entries, see when the earliest time we next need
-   * to reschedule is. */
-  g_autoptr(GDateTime) now = mws_clock_get_now_local (self->clock);
-  g_autoptr(GDateTime) next_reschedule = NULL;
+  retain_preempted_entries (self, selected, all_safe, now_usec,
+                            out_next_deferral_usec);
 
-  g_autofree gchar *now_str = g_date_time_format (now, "%FT%T%:::z");
-  g_debug ("%s: Considering now = %s", G_STRFUNC, now_str);
+  return g_steal_pointer (&selected);
+}
 
-  /* For each entry, see if it’s permissible to start downloading it. For the
-   * moment, we only use whether the network is metered as a basis for this
-   * calculation. In future, we can factor in the tariff on each connection,
-   * bandwidth usage, capacity limits, etc. */
-  g_autoptr(GPtrArray) entries_now_active = g_ptr_array_new_with_free_func (NULL);
-  g_autoptr(GPtrArray) entries_were_active = g_ptr_array_new_with_free_func (NULL);
+/* Convert microseconds since the Unix epoch to a
+ * #MwsScheduleEntry:download-starts-at, rounding up to the next second. */
+static guint64
+usec_to_download_starts_at (gint64 usec)
+{
+  g_assert (usec > 0);
+  return (guint64) (usec / G_USEC_PER_SEC) + ((usec % G_USEC_PER_SEC != 0) ? 1 : 0);
+}
 
-  /* An array of the entries which can be active within the user’s preferences
-   * for cost. Not necessarily all of them will be chosen to be active, though,
-   * based on parallelisation limits and prioritisation. */
-  g_autoptr(GPtrArray) entries_can_be_active = g_ptr_array_new_with_free_func (NULL);
+/* Set #MwsScheduleEntry:download-starts-at on the entry in @handle to
+ * @start_usec (in microseconds since the Unix epoch), and add it to @predicted
+ * if it wasn’t already given a prediction in this reschedule. */
+static void
+predict_entry_start (MwsScheduler *self,
+                     GArray       *predicted,
+                     guint         handle,
+                     gint64        start_usec)
+{
+  EntryData *data = get_entry_slot (self, handle);
+  g_assert (!data->is_active);
 
-  g_autoptr(GPtrArray) safe_connections = g_ptr_array_new_full (n_connections, NULL);
+  if (data->is_selected)
+    return;
 
-  GHashTableIter iter;
-  gpointer key, value;
-  g_hash_table_iter_init (&iter, self->entries);
+  guint64 download_starts_at = usec_to_download_starts_at (start_usec);
 
-  while (g_hash_table_iter_next (&iter, &key, &value))
-    {
-      const gchar *entry_id = key;
-      MwsScheduleEntry *entry = value;
-      EntryData *data = g_hash_table_lookup (self->entries_data, entry_id);
-      g_assert (data != NULL);
+  if (download_starts_at != mws_schedule_entry_get_download_starts_at (data->entry))
+    g_debug ("%s: Entry ‘%s’ is predicted to start at %" G_GUINT64_FORMAT,
+             G_STRFUNC, mws_schedule_entry_get_id (data->entry),
+             download_starts_at);
+
+  mws_schedule_entry_set_download_starts_at (data->entry, download_starts_at);
+
+  /* Reuse @is_selected (which is always %FALSE for inactive entries at this
+   * point) to avoid predicting the same entry twice. */
+  data->is_selected = TRUE;
+  g_array_append_val (predicted, handle);
+}
 
-      g_debug ("%s: Scheduling entry ‘%s’", G_STRFUNC, entry_id);
+/* Work out what the cached #ConnectionData for each connection in
+ * #MwsScheduler.connections_data will be at @at_usec, from the tariff windows
+ * already calculated for it, and return it in a new table of the same form.
+ * Unlike mws_scheduler_compute_plan(), this doesn’t query the connection
+ * monitor or look up any tariffs, so it only costs time proportional to the
+ * number of connections and their windows.
+ *
+ * Connections whose next transition is after @at_usec are unchanged. For the
+ * others, the window containing @at_usec gives the capacity limit, which is
+ * assumed not to have been used yet (since its recurrence is yet to start), so
+ * they’re safe to download on if their details allow it and the limit is
+ * non-zero. This is an approximation, since the connection’s details and its
+ * usage of a resumed period might differ by then, but it’s only used for
+ * predictions. @out_all_safe and @out_some_safe are set as in
+ * update_connections_verdict(). */
+static GHashTable *
+project_connections_data (MwsScheduler *self,
+                          gint64        at_usec,
+                          gboolean     *out_all_safe,
+                          gboolean     *out_some_safe)
+{
+  g_autoptr(GHashTable) projected = NULL;
+  projected = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                     (GDestroyNotify) connection_data_free);
+  gboolean all_safe = TRUE;
+  gboolean some_safe = FALSE;
+  GHashTableIter iter;
+  gpointer value;
 
-      /* Work out which connections this entry could be downloaded on safely. */
-      g_ptr_array_set_size (safe_connections, 0);
+  g_hash_table_iter_init (&iter, self->connections_data);
 
-      for (gsize i = 0; all_connection_ids[i] != NULL; i++)
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      const ConnectionData *data = value;
+      g_autoptr(ConnectionData) projected_data = connection_data_new (data->connection_id);
+
+      projected_data->allow_downloads = data->allow_downloads;
+      projected_data->is_safe = data->is_safe;
+      projected_data->next_transition_usec = data->next_transition_usec;
+      projected_data->capacity_limit = data->capacity_limit;
+      projected_data->capacity_remaining = data->capacity_remaining;
+      projected_data->max_rate = data->max_rate;
+      if (data->windows != NULL)
+        projected_data->windows = g_array_ref (data->windows);
+
+      if (at_usec >= data->next_transition_usec && data->windows != NULL)
         {
-          /* FIXME: Support multi-path properly by allowing each
-           * #MwsScheduleEntry to specify which connections it might download
-           * over. Currently we assume the client might download over any
-           * active connection. (Typically only one connection will ever be
-           * active anyway.) */
-          const MwsConnectionDetails *details = &g_array_index (all_connection_details,
-                                                                MwsConnectionDetails, i);
-
-          /* If this connection has a tariff specified, work out whether we’ve
-           * hit any of the limits for the current tariff period. */
-          MwtPeriod *tariff_period = NULL;
-          gboolean tariff_period_reached_capacity_limit = FALSE;
-
-          if (details->tariff != NULL)
+          for (guint i = 0; i < data->windows->len; i++)
             {
-              tariff_period = mwt_tariff_lookup_period (details->tariff, now);
+              const TariffWindow *window = &g_array_index (data->windows, TariffWindow, i);
+
+              if (at_usec < window->start_usec || at_usec >= window->end_usec)
+                continue;
+
+              projected_data->is_safe = (data->allow_downloads &&
+                                         window->capacity_limit > 0);
+              projected_data->next_transition_usec = window->end_usec;
+              projected_data->capacity_limit = window->capacity_limit;
+              projected_data->capacity_remaining = window->capacity_limit;
+              projected_data->max_rate = 0;
+
+              /* Only the windows after this one are still upcoming. */
+              g_clear_pointer (&projected_data->windows, g_array_unref);
+              projected_data->windows = g_array_sized_new (FALSE, FALSE, sizeof (TariffWindow),
+                                                           data->windows->len - i - 1);
+              g_array_append_vals (projected_data->windows, window + 1,
+                                   data->windows->len - i - 1);
+              break;
             }
+        }
 
-          if (tariff_period != NULL)
-            {
-              g_autofree gchar *tariff_period_start_str =
-                  g_date_time_format (mwt_period_get_start (tariff_period), "%FT%T%:::z");
-              g_autofree gchar *tariff_period_end_str =
-                  g_date_time_format (mwt_period_get_end (tariff_period), "%FT%T%:::z");
-              g_debug ("%s: Considering tariff period %p: %s to %s",
-                       G_STRFUNC, tariff_period, tariff_period_start_str,
-                       tariff_period_end_str);
-            }
-          else
-            {
-              g_debug ("%s: No tariff period found", G_STRFUNC);
-            }
+      all_safe = all_safe && projected_data->is_safe;
+      some_safe = some_safe || projected_data->is_safe;
 
-          if (tariff_period != NULL)
-            {
-              /* FIXME: For the moment, we can only see if the capacity limit is
-               * hard-coded to zero to indicate a period when downloads are
-               * banned. In future, we will need to query the amount of data
-               * downloaded in the current period and check it against the
-               * limit (plus do a reschedule when the amount of data downloaded
-               * does reach the limit). */
-              tariff_period_reached_capacity_limit =
-                  (mwt_period_get_capacity_limit (tariff_period) == 0);
-            }
+      ConnectionData *projected_data_unowned = g_steal_pointer (&projected_data);
+      g_hash_table_replace (projected, projected_data_unowned->connection_id,
+                            projected_data_unowned);
+    }
 
-          /* Is it safe to schedule this entry on this connection now? */
-          gboolean is_safe = ((details->metered == MWS_METERED_NO ||
-                               details->metered == MWS_METERED_GUESS_NO ||
-                               details->allow_downloads_when_metered) &&
-                              details->allow_downloads &&
-                              !tariff_period_reached_capacity_limit);
-          g_debug ("%s: Connection ‘%s’ is %s to download entry ‘%s’ on "
-                   "(metered: %s, allow-downloads-when-metered: %s, "
-                   "allow-downloads: %s, tariff-period-reached-capacity-limit: %s).",
-                   G_STRFUNC, all_connection_ids[i],
-                   is_safe ? "safe" : "not safe", entry_id,
-                   mws_metered_to_string (details->metered),
-                   details->allow_downloads_when_metered ? "yes" : "no",
-                   details->allow_downloads ? "yes" : "no",
-                   tariff_period_reached_capacity_limit ? "yes" : "no");
-
-          if (is_safe)
-            g_ptr_array_add (safe_connections, (gpointer) all_connection_ids[i]);
-
-          /* Work out when to do the next reschedule due to this tariff changing
-           * periods. */
-          if (details->tariff != NULL)
-            {
-              g_autoptr(GDateTime) next_transition = NULL;
-              next_transition = mwt_tariff_get_next_transition (details->tariff, now,
-                                                                NULL, NULL);
-
-              g_autofree gchar *next_transition_str = NULL;
-              if (next_transition != NULL)
-                next_transition_str = g_date_time_format (next_transition, "%FT%T%:::z");
-              else
-                next_transition_str = g_strdup ("never");
-              g_debug ("%s: Connection ‘%s’ next transition is %s",
-                       G_STRFUNC, all_connection_ids[i], next_transition_str);
-
-              if (next_transition != NULL &&
-                  g_date_time_compare (now, next_transition) < 0 &&
-                  (next_reschedule == NULL ||
-                   g_date_time_compare (next_transition, next_reschedule) < 0))
-                {
-                  g_clear_pointer (&next_reschedule, g_date_time_unref);
-                  next_reschedule = g_date_time_ref (next_transition);
-                }
-            }
-        }
+  *out_all_safe = all_safe;
+  *out_some_safe = some_safe;
+
+  return g_steal_pointer (&projected);
+}
+
+/* Update #MwsScheduleEntry:download-starts-at on the entries which aren’t
+ * active, after the active entries and the reschedule alarm have been updated.
+ *
+ * Each entry in @deferred (an array of #DeferredEntry, from select_entries())
+ * is predicted to start at the time plan_entry_start() gave it. If the
+ * connections aren’t all safe to download on, select_entries() is run again on
+ * the connections as they will be at the next reschedule (the next tariff
+ * transition or deferred entry start), projected from the cached connection
+ * data by project_connections_data(), to work out which other entries would
+ * become active then; and those are predicted to start then. This only looks
+ * one reschedule ahead, so entries which would need several transitions before
+ * they become active get no prediction, and the lookahead is skipped if
+ * downloading is already safe, since the remaining entries are then only
+ * waiting for a free slot.
+ *
+ * Entries which were given a prediction in the previous reschedule, but not
+ * in this one (including entries which have become active), have it cleared
+ * to zero.
+ *
+ * This runs in time proportional to the number of deferred entries, plus the
+ * cost of a select_entries() call while downloading isn’t safe. It doesn’t
+ * query the connection monitor or look up tariffs. */
+static void
+update_predicted_entries (MwsScheduler *self,
+                          GArray       *deferred)
+{
+  g_autoptr(GArray) predicted = g_array_sized_new (FALSE, FALSE, sizeof (guint),
+                                                   deferred->len);
+
+  for (guint i = 0; i < deferred->len; i++)
+    {
+      const DeferredEntry *deferred_entry = &g_array_index (deferred, DeferredEntry, i);
+      predict_entry_start (self, predicted, deferred_entry->handle,
+                           deferred_entry->start_usec);
+    }
 
-      /* If all the active connections are safe for this entry, it can be made
-       * active. We assume that the client cannot support downloading over a
-       * particular connection and ignoring another: all active connections have
-       * to be safe to start a download.
-       * FIXME: Allow clients to specify whether they support downloading from
-       * selective connections. If so, their downloads could be made active
-       * without all active connections having to be safe. */
-      gboolean can_be_active = (safe_connections->len == n_connections);
-      g_debug ("%s: Entry ‘%s’ %s (%u of %" G_GSIZE_FORMAT " connections are safe)",
-               G_STRFUNC, entry_id,
-               can_be_active ? "can be active" : "cannot be active",
-               safe_connections->len, n_connections);
-
-      if (can_be_active)
+  gint64 next_reschedule_usec = mws_scheduler_get_next_reschedule (self);
+
+  if (!self->cached_connections_safe &&
+      next_reschedule_usec != G_MAXINT64 &&
+      g_hash_table_size (self->entry_handles) > self->active_entries->len + predicted->len)
+    {
+      gboolean all_safe, some_safe;
+      g_autoptr(GHashTable) projected_connections_data = NULL;
+      projected_connections_data = project_connections_data (self, next_reschedule_usec,
+                                                             &all_safe, &some_safe);
+
+      gint64 plan_usec = next_reschedule_usec;
+      gint64 next_deferral_usec = G_MAXINT64;
+      g_autoptr(GArray) planned = NULL;
+
+      planned = select_entries (self, projected_connections_data, all_safe, some_safe,
+                                &plan_usec, &next_deferral_usec, NULL);
+
+      for (guint i = 0; i < planned->len; i++)
         {
-          g_ptr_array_add (entries_can_be_active, entry);
+          guint handle = g_array_index (planned, guint, i);
+
+          if (!get_entry_slot (self, handle)->is_active)
+            predict_entry_start (self, predicted, handle, next_reschedule_usec);
         }
-      else
+    }
+
+  /* Clear the old predictions which haven’t been renewed, then mark the new
+   * ones. Slots which have been freed since the last reschedule already have
+   * @is_predicted cleared. */
+  for (guint i = 0; i < predicted->len; i++)
+    {
+      EntryData *data = get_entry_slot (self, g_array_index (predicted, guint, i));
+      data->is_selected = FALSE;
+      data->is_predicted = FALSE;
+    }
+
+  for (guint i = 0; i < self->predicted_entries->len; i++)
+    {
+      EntryData *data = get_entry_slot (self, g_array_index (self->predicted_entries, guint, i));
+
+      if (data->is_predicted)
         {
-          /* Accounting for the signal emission at the end of the function. */
-          if (data->is_active)
-            g_ptr_array_add (entries_were_active, entry);
+          data->is_predicted = FALSE;
+          mws_schedule_entry_set_download_starts_at (data->entry, 0);
+        }
+    }
+
+  for (guint i = 0; i < predicted->len; i++)
+    get_entry_slot (self, g_array_index (predicted, guint, i))->is_predicted = TRUE;
+
+  g_array_unref (self->predicted_entries);
+  self->predicted_entries = g_steal_pointer (&predicted);
+}
+
+/* Update the set of active entries so that it contains the most important
+ * #MwsScheduler:max-active-entries entries from @entries_by_priority (or none
+ * of them if it’s currently not safe to download on the network connections,
+ * or only ones which can be bound to a connection if it’s only safe to
+ * download on some of them), and signal the changes using
+ * #MwsScheduler::active-entries-changed. Entries
+ * which are deferred to a cheaper tariff window are skipped (see
+ * plan_entry_start()), and one of the slots may be reserved for a small entry
+ * (see #MwsScheduler:small-entry-threshold).
+ *
+ * This only examines the entries which are active, which are about to become
+ * active, or which are deferred and ordered before those, so (apart from
+ * recalculating an invalidated connections verdict) it runs in time
+ * proportional to #MwsScheduler:max-active-entries plus the number of deferred
+ * entries, rather than the total number of entries. With
+ * #MwsScheduler:fair-share, that’s multiplied by the number of owners. */
+static void
+update_active_entries (MwsScheduler *self)
+{
+  g_assert (!self->in_reschedule);
+  self->in_reschedule = TRUE;
+
+  gint64 reschedule_start_usec = g_get_monotonic_time ();
+
+  /* Any pending coalesced reschedule is satisfied by this one. */
+  g_clear_handle_id (&self->reschedule_source_id, g_source_remove);
+  self->reschedule_pending = FALSE;
+
+  g_debug ("%s: Rescheduling %u entries",
+           G_STRFUNC, g_hash_table_size (self->entry_handles));
+  MWS_TRACE1 (reschedule_start, g_hash_table_size (self->entry_handles));
+
+  /* Sanity checks. */
+  g_assert ((guint) g_sequence_get_length (self->entries_by_priority) ==
+            g_hash_table_size (self->entry_handles));
+  g_assert (g_hash_table_size (self->entry_handles) <= self->entry_slots->len);
+  g_assert (self->active_entries->len <= self->max_active_entries);
+
+  /* This needs to be done even if there are no entries, so that
+   * self->cached_allow_downloads is kept up to date. */
+  update_connections_verdict (self);
+
+  /* Select the most important entries which aren’t deferred, and which
+   * can use the safe connections. The owners of the current active entries
+   * are charged for their time first, if sharing fairly. */
+  gint64 now_usec = 0;
+  gint64 next_deferral_usec = G_MAXINT64;
+
+  charge_fair_share (self, &now_usec);
+  g_autoptr(GArray) selected = NULL;
+  g_autoptr(GArray) deferred = g_array_new (FALSE, FALSE, sizeof (DeferredEntry));
+
+  selected = select_entries (self, self->connections_data,
+                             self->cached_connections_safe,
+                             (self->cached_safe_connection_ids->len > 0),
+                             &now_usec, &next_deferral_usec, deferred);
+
+  for (guint i = 0; i < selected->len; i++)
+    get_entry_slot (self, g_array_index (selected, guint, i))->is_selected = TRUE;
+
+  g_autoptr(GPtrArray) entries_now_active = g_ptr_array_new_with_free_func (NULL);
+  g_autoptr(GPtrArray) entries_were_active = g_ptr_array_new_with_free_func (NULL);
+
+  /* Any currently active entries which weren’t selected are no longer
+   * active. */
+  for (gsize i = 0; i < self->active_entries->len; i++)
+    {
+      EntryData *data = get_entry_slot (self, g_array_index (self->active_entries, guint, i));
+      g_assert (data->is_active);
 
-          /* Update this entry’s status. */
+      if (!data->is_selected)
+        {
+          g_debug ("%s: Entry ‘%s’ will not be active",
+                   G_STRFUNC, mws_schedule_entry_get_id (data->entry));
           data->is_active = FALSE;
+          mws_schedule_entry_set_connection_id (data->entry, NULL);
+          mws_schedule_entry_set_max_rate (data->entry, 0);
+          g_ptr_array_add (entries_were_active, data->entry);
         }
     }
 
-  /* Order the potentially-active entries by priority. */
-  g_ptr_array_sort_with_data (entries_can_be_active, entry_compare_cb, self);
+  /* Give each selected entry which can be bound to a connection one of the
+   * safe connections, and each selected entry its share of the connections’
+   * rate limits, before it’s signalled as active. */
+  assign_connections (self, selected);
+  assign_max_rates (self, selected);
 
-  /* Take the most important N potentially-active entries and actually mark them
-   * as active; mark the rest as not active. N is the maximum number of active
-   * entries set at construction time for the scheduler. */
-  for (gsize i = 0; i < entries_can_be_active->len; i++)
+  /* Mark the selected entries as active. */
+  g_array_set_size (self->active_entries, 0);
+
+  for (guint i = 0; i < selected->len; i++)
     {
-      MwsScheduleEntry *entry = MWS_SCHEDULE_ENTRY (g_ptr_array_index (entries_can_be_active, i));
-      const gchar *entry_id = mws_schedule_entry_get_id (entry);
-      EntryData *data = g_hash_table_lookup (self->entries_data, entry_id);
-      g_assert (data != NULL);
+      guint handle = g_array_index (selected, guint, i);
+      EntryData *data = get_entry_slot (self, handle);
 
-      gboolean active = (i < self->max_active_entries);
-      g_debug ("%s: Entry ‘%s’ %s (index %" G_GSIZE_FORMAT " of %u sorted "
-               "entries which can be active; limit of %u which will be active)",
-               G_STRFUNC, entry_id,
-               active ? "will be active" : "will not be active",
-               i, entries_can_be_active->len, self->max_active_entries);
+      g_debug ("%s: Entry ‘%s’ will be active (index %u; limit of %u which "
+               "will be active)", G_STRFUNC,
+               mws_schedule_entry_get_id (data->entry), i,
+               get_max_active_entries (self));
 
       /* Accounting for the signal emission at the end of the function. */
-      if (data->is_active && !active)
-        g_ptr_array_add (entries_were_active, entry);
-      else if (!data->is_active && active)
-        g_ptr_array_add (entries_now_active, entry);
+      if (!data->is_active)
+        {
+          ensure_now_usec (self, &now_usec);
+          data->active_since_usec = now_usec;
+          g_ptr_array_add (entries_now_active, data->entry);
+        }
 
       /* Update this entry’s status. */
-      data->is_active = active;
+      data->is_active = TRUE;
+      data->is_selected = FALSE;
+      g_array_append_val (self->active_entries, handle);
     }
 
+  /* Only one alarm is needed, for the earliest of the connections’ next
+   * transitions and the deferred entries’ planned starts. */
+  self->next_deferral_usec = next_deferral_usec;
+  update_reschedule_alarm (self);
+
+  /* Tell the entries which are still waiting when they’re likely to start. */
+  update_predicted_entries (self, deferred);
+
   /* Signal the changes. */
   if (entries_now_active->len > 0 || entries_were_active->len > 0)
     {
@@ -1243,30 +4098,273 @@ mws_scheduler_reschedule (MwsScheduler *self)
                              entries_now_active, entries_were_active);
     }
 
-  /* Set up the next scheduling run. */
-  if (next_reschedule != NULL)
+  MWS_TRACE3 (reschedule_end, self->active_entries->len,
+              entries_now_active->len, entries_were_active->len);
+
+  mws_latency_histogram_record (&self->reschedule_latency,
+                                g_get_monotonic_time () - reschedule_start_usec);
+
+  self->in_reschedule = FALSE;
+}
+
+static gboolean
+coalesced_reschedule_cb (gpointer user_data)
+{
+  MwsScheduler *self = MWS_SCHEDULER (user_data);
+
+  /* The source has been consumed. */
+  self->reschedule_source_id = 0;
+
+  g_debug ("%s: Running coalesced reschedule", G_STRFUNC);
+  update_active_entries (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Update the active entries after a change to the scheduler’s inputs. If
+ * #MwsScheduler:reschedule-delay is zero, this is done immediately; otherwise
+ * it is deferred so that the changes which happen within the delay are all
+ * handled by a single call to update_active_entries(). */
+static void
+queue_update_active_entries (MwsScheduler *self)
+{
+  if (self->reschedule_freeze_count > 0)
+    {
+      self->reschedule_pending = TRUE;
+      return;
+    }
+
+  if (self->reschedule_delay_ms == 0)
     {
-      /* FIXME: This doesn’t take into account the difference between monotonic
-       * and wall clock time: if the computer suspends, or the timezone changes,
-       * the reschedule will happen at the wrong time. We probably want to split
-       * this out into a separate interface, with an implementation which can
-       * monitor org.freedesktop.timedate1. */
-      GTimeSpan interval = g_date_time_difference (next_reschedule, now);
-      g_assert (interval >= 0);
+      update_active_entries (self);
+      return;
+    }
+
+  if (self->reschedule_source_id != 0)
+    return;
+
+  g_debug ("%s: Queuing reschedule in %ums", G_STRFUNC, self->reschedule_delay_ms);
+  self->reschedule_source_id = g_timeout_add_full (G_PRIORITY_DEFAULT_IDLE,
+                                                   self->reschedule_delay_ms,
+                                                   coalesced_reschedule_cb,
+                                                   self, NULL);
+}
+
+/**
+ * mws_scheduler_reschedule:
+ * @self: a #MwsScheduler
+ *
+ * Calculate an updated download schedule for all currently active entries, and
+ * update the set of active entries if necessary. Changes to the set of active
+ * entries will be signalled using #MwsScheduler::active-entries-changed.
+ *
+ * This is called automatically when any relevant input to the scheduler
+ * changes; so should not normally need to be called manually. It is exposed
+ * mainly for unit testing. Changes to the set of entries, or to their
+ * priorities, are handled incrementally without a full reschedule.
+ *
+ * This always reschedules synchronously, even if
+ * #MwsScheduler:reschedule-delay is non-zero, and it cancels any pending
+ * coalesced reschedule.
+ *
+ * Since: 0.1.0
+ */
+void
+mws_scheduler_reschedule (MwsScheduler *self)
+{
+  g_return_if_fail (MWS_IS_SCHEDULER (self));
+
+  invalidate_connections_verdict (self);
+  update_active_entries (self);
+}
 
-      mws_clock_add_alarm (self->clock, next_reschedule, reschedule_cb, self, NULL);
+/**
+ * mws_scheduler_compute_plan:
+ * @self: a #MwsScheduler
+ * @connection_overrides: (nullable) (element-type utf8 MwsConnectionDetails):
+ *    details to use for some of the network connections instead of their
+ *    current details, or %NULL; connections in here which aren’t currently
+ *    active are treated as if they were
+ * @now_usec: time to compute the plan for, in microseconds since the Unix
+ *    epoch, or zero to use the current time
+ * @out_active_entries: (out) (transfer full) (element-type MwsScheduleEntry) (optional):
+ *    return location for the entries which would be active, in priority order
+ * @out_next_reschedule_usec: (out) (optional): return location for the time
+ *    when the plan would next change due to a tariff transition or a deferred
+ *    entry starting, in microseconds since the Unix epoch; or %G_MAXINT64 if
+ *    it wouldn’t change
+ *
+ * Work out which entries would be active if the scheduler were rescheduled at
+ * @now_usec with the given @connection_overrides, without changing any of the
+ * scheduler’s state: no signals are emitted, no alarms are set, and no bytes
+ * are counted against any tariff periods. This is a dry run, for debugging and
+ * for answering ‘what if’ questions about the schedule.
+ *
+ * Entries which are currently active are never deferred, so the plan may
+ * differ from what a reschedule on a freshly started scheduler would give. The
+ * connections’ verdicts are always recalculated, so this is as expensive as a
+ * mws_scheduler_reschedule() after all the connections have changed.
+ *
+ * Since: 0.3.0
+ */
+void
+mws_scheduler_compute_plan (MwsScheduler  *self,
+                            GHashTable    *connection_overrides,
+                            gint64         now_usec,
+                            GPtrArray    **out_active_entries,
+                            gint64        *out_next_reschedule_usec)
+{
+  g_return_if_fail (MWS_IS_SCHEDULER (self));
+  g_return_if_fail (now_usec >= 0);
 
-      g_autofree gchar *next_reschedule_str = NULL;
-      next_reschedule_str = g_date_time_format (next_reschedule, "%FT%T%:::z");
-      g_debug ("%s: Setting next reschedule for %s (in %" G_GUINT64_FORMAT " seconds)",
-               G_STRFUNC, next_reschedule_str, (guint64) interval / G_USEC_PER_SEC);
+  if (now_usec == 0)
+    {
+      g_autoptr(GDateTime) now = mws_clock_get_now_local (self->clock);
+      now_usec = date_time_to_usec (now);
     }
-  else
+
+  g_debug ("%s: Computing plan for %" G_GINT64_FORMAT "µs since the epoch "
+           "with %u overridden connections",
+           G_STRFUNC, now_usec,
+           (connection_overrides != NULL) ? g_hash_table_size (connection_overrides) : 0);
+
+  /* Consider the current connections, plus any hypothetical ones from
+   * @connection_overrides. */
+  g_autoptr(GPtrArray) connection_ids = g_ptr_array_new_with_free_func (NULL);
+  const gchar * const *all_connection_ids = NULL;
+  all_connection_ids = mws_connection_monitor_get_connection_ids (self->connection_monitor);
+
+  for (gsize i = 0; all_connection_ids[i] != NULL; i++)
+    g_ptr_array_add (connection_ids, (gpointer) all_connection_ids[i]);
+
+  if (connection_overrides != NULL)
     {
-      g_debug ("%s: Setting next reschedule to never", G_STRFUNC);
+      GHashTableIter iter;
+      gpointer key;
+
+      g_hash_table_iter_init (&iter, connection_overrides);
+
+      while (g_hash_table_iter_next (&iter, &key, NULL))
+        {
+          if (!g_ptr_array_find_with_equal_func (connection_ids, key,
+                                                 g_str_equal, NULL))
+            g_ptr_array_add (connection_ids, key);
+        }
     }
 
-  self->in_reschedule = FALSE;
+  /* Calculate a verdict on each of the connections from scratch, without
+   * touching the cached one in #MwsScheduler.connections_data. */
+  g_autoptr(GHashTable) connections_data = NULL;
+  connections_data = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                            (GDestroyNotify) connection_data_free);
+  gboolean all_safe = TRUE;
+  gboolean some_safe = FALSE;
+  gint64 next_reschedule_usec = G_MAXINT64;
+
+  for (guint i = 0; i < connection_ids->len; i++)
+    {
+      const gchar *connection_id = connection_ids->pdata[i];
+      const MwsConnectionDetails *override = NULL;
+      ConnectionData *data;
+
+      if (connection_overrides != NULL)
+        override = g_hash_table_lookup (connection_overrides, connection_id);
+
+      if (override != NULL)
+        {
+          data = calculate_connection_data (self, connection_id, override,
+                                            now_usec, FALSE);
+        }
+      else
+        {
+          MwsConnectionDetails details = { 0, };
+
+          get_connection_details (self, connection_id, &details);
+          data = calculate_connection_data (self, connection_id, &details,
+                                            now_usec, FALSE);
+          mws_connection_details_clear (&details);
+        }
+
+      all_safe = all_safe && data->is_safe;
+      some_safe = some_safe || data->is_safe;
+      next_reschedule_usec = MIN (next_reschedule_usec, data->next_transition_usec);
+
+      g_hash_table_replace (connections_data, data->connection_id, data);
+    }
+
+  gint64 next_deferral_usec = G_MAXINT64;
+  g_autoptr(GArray) selected = NULL;
+
+  selected = select_entries (self, connections_data, all_safe, some_safe,
+                             &now_usec, &next_deferral_usec, NULL);
+  next_reschedule_usec = MIN (next_reschedule_usec, next_deferral_usec);
+
+  g_debug ("%s: Plan has %u active entries", G_STRFUNC, selected->len);
+
+  if (out_active_entries != NULL)
+    {
+      g_autoptr(GPtrArray) active_entries = NULL;
+      active_entries = g_ptr_array_new_full (selected->len, g_object_unref);
+
+      for (guint i = 0; i < selected->len; i++)
+        {
+          const EntryData *data = get_entry_slot (self, g_array_index (selected, guint, i));
+          g_ptr_array_add (active_entries, g_object_ref (data->entry));
+        }
+
+      *out_active_entries = g_steal_pointer (&active_entries);
+    }
+  if (out_next_reschedule_usec != NULL)
+    *out_next_reschedule_usec = next_reschedule_usec;
+}
+
+/**
+ * mws_scheduler_freeze_reschedule:
+ * @self: a #MwsScheduler
+ *
+ * Stop changes to the schedule entries, their priorities, or any of the other
+ * inputs to the scheduler from causing a reschedule, until
+ * mws_scheduler_thaw_reschedule() is called. This allows a batch of changes to
+ * be applied with a single reschedule at the end.
+ *
+ * Calls to this function nest, and each must be paired with a call to
+ * mws_scheduler_thaw_reschedule(). Explicit calls to
+ * mws_scheduler_reschedule() are not affected.
+ *
+ * Since: 0.3.0
+ */
+void
+mws_scheduler_freeze_reschedule (MwsScheduler *self)
+{
+  g_return_if_fail (MWS_IS_SCHEDULER (self));
+  g_return_if_fail (self->reschedule_freeze_count < G_MAXUINT);
+
+  self->reschedule_freeze_count++;
+}
+
+/**
+ * mws_scheduler_thaw_reschedule:
+ * @self: a #MwsScheduler
+ *
+ * Reverse a call to mws_scheduler_freeze_reschedule(). When the last freeze is
+ * thawed, a single reschedule is queued if any changes were made while the
+ * scheduler was frozen.
+ *
+ * Since: 0.3.0
+ */
+void
+mws_scheduler_thaw_reschedule (MwsScheduler *self)
+{
+  g_return_if_fail (MWS_IS_SCHEDULER (self));
+  g_return_if_fail (self->reschedule_freeze_count > 0);
+
+  self->reschedule_freeze_count--;
+
+  if (self->reschedule_freeze_count == 0 && self->reschedule_pending)
+    {
+      self->reschedule_pending = FALSE;
+      queue_update_active_entries (self);
+    }
 }
 
 /**
@@ -1286,3 +4384,40 @@ mws_scheduler_get_allow_downloads (MwsScheduler *self)
 
   return self->cached_allow_downloads;
 }
+
+/**
+ * mws_scheduler_get_next_reschedule:
+ * @self: a #MwsScheduler
+ *
+ * Get the value of #MwsScheduler:next-reschedule.
+ *
+ * Returns: time of the next planned reschedule, in microseconds since the Unix
+ *    epoch, or %G_MAXINT64 if none is planned
+ * Since: 0.3.0
+ */
+gint64
+mws_scheduler_get_next_reschedule (MwsScheduler *self)
+{
+  g_return_val_if_fail (MWS_IS_SCHEDULER (self), G_MAXINT64);
+
+  return (self->reschedule_alarm_id != 0) ? self->reschedule_alarm_usec : G_MAXINT64;
+}
+
+/**
+ * mws_scheduler_get_reschedule_latency:
+ * @self: a #MwsScheduler
+ *
+ * Get a histogram of how long each reschedule has taken since the scheduler
+ * was created, including emitting #MwsScheduler::active-entries-changed. Its
+ * #MwsLatencyHistogram.n_samples is the number of reschedules.
+ *
+ * Returns: (transfer none): histogram of reschedule durations
+ * Since: 0.3.0
+ */
+const MwsLatencyHistogram *
+mws_scheduler_get_reschedule_latency (MwsScheduler *self)
+{
+  g_return_val_if_fail (MWS_IS_SCHEDULER (self), NULL);
+
+  return &self->reschedule_latency;
+}
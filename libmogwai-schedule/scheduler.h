@@ -26,6 +26,7 @@
 #include <glib-object.h>
 #include <libmogwai-schedule/clock.h>
 #include <libmogwai-schedule/connection-monitor.h>
+#include <libmogwai-schedule/latency-histogram.h>
 #include <libmogwai-schedule/peer-manager.h>
 #include <libmogwai-schedule/schedule-entry.h>
 
@@ -63,6 +64,7 @@ MwsScheduler     *mws_scheduler_new             (MwsConnectionMonitor *connectio
                                                  MwsClock             *clock);
 
 MwsPeerManager   *mws_scheduler_get_peer_manager (MwsScheduler     *self);
+MwsConnectionMonitor *mws_scheduler_get_connection_monitor (MwsScheduler *self);
 
 gboolean          mws_scheduler_update_entries  (MwsScheduler      *self,
                                                  GPtrArray         *added,
@@ -75,12 +77,29 @@ gboolean          mws_scheduler_remove_entries_for_owner (MwsScheduler  *self,
 MwsScheduleEntry *mws_scheduler_get_entry       (MwsScheduler      *self,
                                                  const gchar       *entry_id);
 GHashTable       *mws_scheduler_get_entries     (MwsScheduler      *self);
+guint             mws_scheduler_get_n_entries   (MwsScheduler      *self);
+guint             mws_scheduler_get_n_entries_for_owner (MwsScheduler *self,
+                                                         const gchar  *owner);
+gboolean          mws_scheduler_check_quota     (MwsScheduler      *self,
+                                                 const gchar       *owner,
+                                                 gsize              n_entries,
+                                                 GError           **error);
 
 gboolean          mws_scheduler_is_entry_active (MwsScheduler      *self,
                                                  MwsScheduleEntry  *entry);
 
 void              mws_scheduler_reschedule      (MwsScheduler *self);
+void              mws_scheduler_compute_plan    (MwsScheduler  *self,
+                                                 GHashTable    *connection_overrides,
+                                                 gint64         now_usec,
+                                                 GPtrArray    **out_active_entries,
+                                                 gint64        *out_next_reschedule_usec);
+void              mws_scheduler_freeze_reschedule (MwsScheduler *self);
+void              mws_scheduler_thaw_reschedule   (MwsScheduler *self);
 
 gboolean          mws_scheduler_get_allow_downloads (MwsScheduler *self);
+gint64            mws_scheduler_get_next_reschedule (MwsScheduler *self);
+
+const MwsLatencyHistogram *mws_scheduler_get_reschedule_latency (MwsScheduler *self);
 
 G_END_DECLS
@@ -22,17 +22,25 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <glib.h>
 #include <glib-object.h>
 #include <glib-unix.h>
 #include <glib/gi18n-lib.h>
+#include <glib/gstdio.h>
 #include <gio/gio.h>
 #include <libmogwai-schedule/clock-system.h>
+#include <libmogwai-schedule/concurrency-controller.h>
+#include <libmogwai-schedule/connection-monitor-deferred.h>
 #include <libmogwai-schedule/connection-monitor-nm.h>
+#include <libmogwai-schedule/connection-monitor-nm-dbus.h>
 #include <libmogwai-schedule/peer-manager-dbus.h>
+#include <libmogwai-schedule/peer-priorities.h>
 #include <libmogwai-schedule/schedule-service.h>
 #include <libmogwai-schedule/scheduler.h>
 #include <libmogwai-schedule/service.h>
+#include <libmogwai-schedule/usage-ledger.h>
+#include <libmogwai-schedule/wake-timer.h>
 #include <locale.h>
 
 
@@ -50,6 +58,14 @@ static void mws_service_shutdown (GssService *service);
 static void notify_busy_cb (GObject    *obj,
                             GParamSpec *pspec,
                             gpointer    user_data);
+static void notify_next_reschedule_cb (GObject    *obj,
+                                       GParamSpec *pspec,
+                                       gpointer    user_data);
+static void active_entries_changed_cb (MwsScheduler *scheduler,
+                                       GPtrArray    *added,
+                                       GPtrArray    *removed,
+                                       gpointer      user_data);
+static void update_wake_timer (MwsService *self);
 
 /**
  * MwsService:
@@ -65,12 +81,87 @@ struct _MwsService
 
   MwsScheduler *scheduler;  /* (owned) */
   MwsScheduleService *schedule_service;  /* (owned) */
+  MwsUsageLedger *usage_ledger;  /* (owned) */
+  MwsConnectionMonitorDeferred *connection_monitor;  /* (owned) */
 
   GCancellable *cancellable;  /* (owned) */
 
-  gboolean busy;
+  /* Whether we hold the #GssService, which is the case while the schedule
+   * service is busy, unless the wake timer has been armed. */
+  gboolean held;
+
+  /* If @wake_on_transition is set, the daemon exits while all its entries are
+   * waiting for the next reschedule, having armed a wake timer to start it
+   * again then. @wake_reschedule_usec is the #MwsScheduler:next-reschedule
+   * which the wake timer is armed for (%G_MAXINT64 meaning the maximum
+   * sleep), or 0 if it’s not armed. While @wake_timer_busy, the timer is being
+   * armed (for @arming_reschedule_usec) or disarmed, and the daemon stays
+   * held. If arming the timer fails, @wake_timer_failed is set and the
+   * daemon stays resident from then on. */
+  gboolean wake_on_transition;
+  gint64 wake_reschedule_usec;
+  gint64 arming_reschedule_usec;
+  gboolean wake_timer_busy;
+  gboolean wake_timer_failed;
 };
 
+/* Default for #MwsScheduler:max-active-entries; see the rationale for the
+ * default in scheduler.c. */
+static const guint DEFAULT_MAX_ACTIVE_ENTRIES = 1;
+
+/* Upper bound on the number of active entries when adaptive concurrency is
+ * enabled and no explicit limit is configured. Arbitrarily chosen. */
+static const guint DEFAULT_ADAPTIVE_MAX_ACTIVE_ENTRIES = 8;
+
+/* Default for #MwsScheduler:small-entry-threshold: content updates are
+ * typically tens of megabytes, whereas OS and large app updates are hundreds.
+ * This has no effect unless more than one entry can be active. */
+static const guint64 DEFAULT_SMALL_ENTRY_THRESHOLD = 50 * 1024 * 1024;
+
+/* Defaults for the #MwsScheduler preemption policy. A minute is long enough
+ * to absorb a burst of new entries or priority changes (such as when an app
+ * store refreshes) without noticeably delaying an urgent download. A
+ * non-resumable download which is 90% complete loses more by being restarted
+ * later than the preempting download gains by starting now. */
+static const guint DEFAULT_MIN_RUN_TIME_SECS = 60;
+static const guint DEFAULT_NON_RESUMABLE_PROTECT_PERCENT = 90;
+
+/* Default for #MwsScheduler:fair-share-quantum: five minutes is long enough
+ * that most small downloads complete within one turn, so sharing the slots
+ * doesn’t cause much pausing and resuming. */
+static const guint DEFAULT_FAIR_SHARE_QUANTUM_SECS = 5 * 60;
+
+/* Default for #MwsScheduler:max-entries-per-owner: half of the scheduler’s
+ * default #MwsScheduler:max-entries, which is far more than any well-behaved
+ * updater needs, but means a single misbehaving peer can’t fill the scheduler
+ * and lock everyone else out. */
+static const guint DEFAULT_MAX_ENTRIES_PER_PEER = 512;
+
+/* Bounds on how long the daemon will exit for when waiting for its next
+ * reschedule. Below the minimum, restarting (and reloading the connection
+ * monitor) costs more than staying resident. The maximum bounds how late a
+ * change of network connection can be noticed, since connections aren’t
+ * monitored while the daemon isn’t running. */
+static const gint64 MIN_SLEEP_USEC = 5 * G_TIME_SPAN_MINUTE;
+static const gint64 MAX_SLEEP_USEC = G_TIME_SPAN_HOUR;
+
+/* Settings from the scheduler configuration file. */
+typedef struct
+{
+  guint max_active_entries;  /* 0 if not configured */
+  guint max_entries_per_peer;
+  gboolean adaptive_concurrency;
+  guint64 small_entry_threshold;
+  guint min_run_time_secs;
+  guint preemption_priority_margin;
+  guint non_resumable_protect_percent;
+  guint64 non_resumable_protect_size;
+  gboolean fair_share;
+  guint fair_share_quantum_secs;
+  gboolean lightweight_connection_monitor;
+  gboolean wake_on_transition;
+} SchedulerConfig;
+
 G_DEFINE_TYPE (MwsService, mws_service, GSS_TYPE_SERVICE)
 
 static void
@@ -104,70 +195,542 @@ mws_service_dispose (GObject *object)
 
   if (self->schedule_service != NULL)
     g_signal_handlers_disconnect_by_func (self->schedule_service, notify_busy_cb, self);
+  if (self->scheduler != NULL)
+    {
+      g_signal_handlers_disconnect_by_func (self->scheduler, notify_next_reschedule_cb, self);
+      g_signal_handlers_disconnect_by_func (self->scheduler, active_entries_changed_cb, self);
+    }
 
   g_clear_object (&self->schedule_service);
   g_clear_object (&self->scheduler);
+  g_clear_object (&self->usage_ledger);
+  g_clear_object (&self->connection_monitor);
 
   /* Chain up to the parent class */
   G_OBJECT_CLASS (mws_service_parent_class)->dispose (object);
 }
 
+/* Load the peer priorities from the system configuration, falling back to the
+ * defaults if there is none, or if it’s invalid. */
+static GHashTable *
+load_peer_priorities (void)
+{
+  g_autofree gchar *path = g_build_filename (SYSCONFDIR, "mogwai",
+                                             "peer-priorities.conf", NULL);
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GHashTable) priorities = NULL;
+
+  priorities = mws_peer_priorities_new_from_file (path, &local_error);
+
+  if (g_error_matches (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+    {
+      g_debug ("%s: No peer priorities in ‘%s’; using defaults", G_STRFUNC, path);
+      return mws_peer_priorities_new_default ();
+    }
+  else if (local_error != NULL)
+    {
+      g_warning ("Error loading peer priorities from ‘%s’; using defaults: %s",
+                 path, local_error->message);
+      return mws_peer_priorities_new_default ();
+    }
+
+  g_debug ("%s: Loaded %u peer priorities from ‘%s’",
+           G_STRFUNC, g_hash_table_size (priorities), path);
+
+  return g_steal_pointer (&priorities);
+}
+
+/* Load the peer weights for #MwsScheduler:fair-share from the same file as the
+ * peer priorities. If there are none, or they’re invalid, %NULL is returned,
+ * which gives all peers the same weight. */
+static GHashTable *
+load_peer_weights (void)
+{
+  g_autofree gchar *path = g_build_filename (SYSCONFDIR, "mogwai",
+                                             "peer-priorities.conf", NULL);
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GHashTable) weights = NULL;
+
+  weights = mws_peer_weights_new_from_file (path, &local_error);
+
+  if (g_error_matches (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+    {
+      g_debug ("%s: No peer weights in ‘%s’; using defaults", G_STRFUNC, path);
+      return NULL;
+    }
+  else if (local_error != NULL)
+    {
+      g_warning ("Error loading peer weights from ‘%s’; using defaults: %s",
+                 path, local_error->message);
+      return NULL;
+    }
+
+  g_debug ("%s: Loaded %u peer weights from ‘%s’",
+           G_STRFUNC, g_hash_table_size (weights), path);
+
+  return g_steal_pointer (&weights);
+}
+
+/* Whether @error indicates that a key file setting is absent, rather than
+ * invalid. */
+static gboolean
+key_file_error_is_missing (const GError *error)
+{
+  return (g_error_matches (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND) ||
+          g_error_matches (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_GROUP_NOT_FOUND));
+}
+
+/* Load the scheduler configuration from the system configuration, falling back
+ * to the defaults for any settings which are missing or invalid. The file is a
+ * key file with a `Scheduler` group, which may contain:
+ *  * `MaxActiveEntries` (integer): see #MwsScheduler:max-active-entries, or
+ *    the upper bound for it if adaptive concurrency is enabled.
+ *  * `MaxEntriesPerPeer` (integer): see #MwsScheduler:max-entries-per-owner.
+ *    (Default: 512.)
+ *  * `AdaptiveConcurrency` (boolean): whether to adapt the number of active
+ *    entries to the measured throughput and system pressure, using a
+ *    #MwsConcurrencyController. (Default: `false`.)
+ *  * `SmallEntryThreshold` (integer): see #MwsScheduler:small-entry-threshold;
+ *    zero disables reserving a slot for small entries.
+ *  * `MinRunTime` (integer, in seconds): see #MwsScheduler:min-run-time.
+ *    (Default: 60.)
+ *  * `PreemptionPriorityMargin` (integer): see
+ *    #MwsScheduler:preemption-priority-margin. (Default: 0.)
+ *  * `NonResumableProtectPercent` (integer, 0–100): see
+ *    #MwsScheduler:non-resumable-protect-percent. (Default: 90.)
+ *  * `NonResumableProtectSize` (integer, in bytes): see
+ *    #MwsScheduler:non-resumable-protect-size. (Default: 0.)
+ *  * `FairShare` (boolean): see #MwsScheduler:fair-share. Peers’ weights are
+ *    loaded from the `Peer Weights` group of `peer-priorities.conf`; see
+ *    mws_peer_weights_new_from_key_file(). (Default: `false`.)
+ *  * `FairShareQuantum` (integer, in seconds): see
+ *    #MwsScheduler:fair-share-quantum. (Default: 300.)
+ *  * `LightweightConnectionMonitor` (boolean): whether to use
+ *    #MwsConnectionMonitorNmDbus, which talks to NetworkManager over D-Bus
+ *    directly, rather than #MwsConnectionMonitorNm, which uses libnm’s full
+ *    object cache. (Default: `false`.)
+ *  * `WakeOnTransition` (boolean): whether to exit while all the pending
+ *    entries are waiting for the next tariff transition (or other reschedule),
+ *    saving their state and arming a systemd timer to restart the daemon
+ *    then. (Default: `false`.) */
+static void
+load_scheduler_config (SchedulerConfig *out_config)
+{
+  g_autofree gchar *path = g_build_filename (SYSCONFDIR, "mogwai",
+                                             "scheduler.conf", NULL);
+  g_autoptr(GKeyFile) key_file = g_key_file_new ();
+  g_autoptr(GError) local_error = NULL;
+
+  out_config->max_active_entries = 0;
+  out_config->max_entries_per_peer = DEFAULT_MAX_ENTRIES_PER_PEER;
+  out_config->adaptive_concurrency = FALSE;
+  out_config->small_entry_threshold = DEFAULT_SMALL_ENTRY_THRESHOLD;
+  out_config->min_run_time_secs = DEFAULT_MIN_RUN_TIME_SECS;
+  out_config->preemption_priority_margin = 0;
+  out_config->non_resumable_protect_percent = DEFAULT_NON_RESUMABLE_PROTECT_PERCENT;
+  out_config->non_resumable_protect_size = 0;
+  out_config->fair_share = FALSE;
+  out_config->fair_share_quantum_secs = DEFAULT_FAIR_SHARE_QUANTUM_SECS;
+  out_config->lightweight_connection_monitor = FALSE;
+  out_config->wake_on_transition = FALSE;
+
+  if (!g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, &local_error))
+    {
+      if (g_error_matches (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_debug ("%s: No scheduler configuration in ‘%s’; using defaults",
+                 G_STRFUNC, path);
+      else
+        g_warning ("Error loading scheduler configuration from ‘%s’; using "
+                   "defaults: %s", path, local_error->message);
+      return;
+    }
+
+  gint max_active_entries = g_key_file_get_integer (key_file, "Scheduler",
+                                                    "MaxActiveEntries",
+                                                    &local_error);
+  if (local_error == NULL && max_active_entries >= 1)
+    out_config->max_active_entries = max_active_entries;
+  else if (local_error == NULL || !key_file_error_is_missing (local_error))
+    g_warning ("Invalid MaxActiveEntries in ‘%s’; using default", path);
+  g_clear_error (&local_error);
+
+  gint max_entries_per_peer = g_key_file_get_integer (key_file, "Scheduler",
+                                                      "MaxEntriesPerPeer",
+                                                      &local_error);
+  if (local_error == NULL && max_entries_per_peer >= 1)
+    out_config->max_entries_per_peer = max_entries_per_peer;
+  else if (local_error == NULL || !key_file_error_is_missing (local_error))
+    g_warning ("Invalid MaxEntriesPerPeer in ‘%s’; using default", path);
+  g_clear_error (&local_error);
+
+  gboolean adaptive_concurrency = g_key_file_get_boolean (key_file, "Scheduler",
+                                                          "AdaptiveConcurrency",
+                                                          &local_error);
+  if (local_error == NULL)
+    out_config->adaptive_concurrency = adaptive_concurrency;
+  else if (!key_file_error_is_missing (local_error))
+    g_warning ("Invalid AdaptiveConcurrency in ‘%s’; using default", path);
+  g_clear_error (&local_error);
+
+  guint64 small_entry_threshold = g_key_file_get_uint64 (key_file, "Scheduler",
+                                                         "SmallEntryThreshold",
+                                                         &local_error);
+  if (local_error == NULL)
+    out_config->small_entry_threshold = small_entry_threshold;
+  else if (!key_file_error_is_missing (local_error))
+    g_warning ("Invalid SmallEntryThreshold in ‘%s’; using default", path);
+  g_clear_error (&local_error);
+
+  gint min_run_time = g_key_file_get_integer (key_file, "Scheduler",
+                                              "MinRunTime", &local_error);
+  if (local_error == NULL && min_run_time >= 0)
+    out_config->min_run_time_secs = min_run_time;
+  else if (local_error == NULL || !key_file_error_is_missing (local_error))
+    g_warning ("Invalid MinRunTime in ‘%s’; using default", path);
+  g_clear_error (&local_error);
+
+  gint preemption_priority_margin = g_key_file_get_integer (key_file, "Scheduler",
+                                                            "PreemptionPriorityMargin",
+                                                            &local_error);
+  if (local_error == NULL && preemption_priority_margin >= 0)
+    out_config->preemption_priority_margin = preemption_priority_margin;
+  else if (local_error == NULL || !key_file_error_is_missing (local_error))
+    g_warning ("Invalid PreemptionPriorityMargin in ‘%s’; using default", path);
+  g_clear_error (&local_error);
+
+  gint non_resumable_protect_percent = g_key_file_get_integer (key_file, "Scheduler",
+                                                               "NonResumableProtectPercent",
+                                                               &local_error);
+  if (local_error == NULL &&
+      non_resumable_protect_percent >= 0 && non_resumable_protect_percent <= 100)
+    out_config->non_resumable_protect_percent = non_resumable_protect_percent;
+  else if (local_error == NULL || !key_file_error_is_missing (local_error))
+    g_warning ("Invalid NonResumableProtectPercent in ‘%s’; using default", path);
+  g_clear_error (&local_error);
+
+  guint64 non_resumable_protect_size = g_key_file_get_uint64 (key_file, "Scheduler",
+                                                              "NonResumableProtectSize",
+                                                              &local_error);
+  if (local_error == NULL)
+    out_config->non_resumable_protect_size = non_resumable_protect_size;
+  else if (!key_file_error_is_missing (local_error))
+    g_warning ("Invalid NonResumableProtectSize in ‘%s’; using default", path);
+  g_clear_error (&local_error);
+
+  gboolean fair_share = g_key_file_get_boolean (key_file, "Scheduler",
+                                                "FairShare", &local_error);
+  if (local_error == NULL)
+    out_config->fair_share = fair_share;
+  else if (!key_file_error_is_missing (local_error))
+    g_warning ("Invalid FairShare in ‘%s’; using default", path);
+  g_clear_error (&local_error);
+
+  gint fair_share_quantum = g_key_file_get_integer (key_file, "Scheduler",
+                                                    "FairShareQuantum", &local_error);
+  if (local_error == NULL && fair_share_quantum >= 1)
+    out_config->fair_share_quantum_secs = fair_share_quantum;
+  else if (local_error == NULL || !key_file_error_is_missing (local_error))
+    g_warning ("Invalid FairShareQuantum in ‘%s’; using default", path);
+  g_clear_error (&local_error);
+
+  gboolean lightweight_connection_monitor = g_key_file_get_boolean (key_file, "Scheduler",
+                                                                    "LightweightConnectionMonitor",
+                                                                    &local_error);
+  if (local_error == NULL)
+    out_config->lightweight_connection_monitor = lightweight_connection_monitor;
+  else if (!key_file_error_is_missing (local_error))
+    g_warning ("Invalid LightweightConnectionMonitor in ‘%s’; using default", path);
+  g_clear_error (&local_error);
+
+  gboolean wake_on_transition = g_key_file_get_boolean (key_file, "Scheduler",
+                                                        "WakeOnTransition",
+                                                        &local_error);
+  if (local_error == NULL)
+    out_config->wake_on_transition = wake_on_transition;
+  else if (!key_file_error_is_missing (local_error))
+    g_warning ("Invalid WakeOnTransition in ‘%s’; using default", path);
+  g_clear_error (&local_error);
+}
+
+/* Build the path of @filename in the daemon’s state directory. systemd tells us
+ * where that is; otherwise fall back to the default location. */
+static gchar *
+build_state_path (const gchar *filename)
+{
+  const gchar *state_directory = g_getenv ("STATE_DIRECTORY");
+
+  if (state_directory == NULL || *state_directory == '\0')
+    return g_build_filename (LOCALSTATEDIR, "lib", "mogwai", filename, NULL);
+
+  return g_build_filename (state_directory, filename, NULL);
+}
+
+/* Load the usage ledger from the daemon’s state directory. If the ledger
+ * can’t be loaded, it’s started afresh, so capacity limits may be enforced
+ * late in the current tariff period. */
+static MwsUsageLedger *
+load_usage_ledger (void)
+{
+  g_autofree gchar *path = build_state_path ("usage-ledger");
+  g_autoptr(MwsUsageLedger) ledger = mws_usage_ledger_new (path);
+  g_autoptr(GError) local_error = NULL;
+
+  if (!mws_usage_ledger_load (ledger, &local_error))
+    g_warning ("%s; starting a new one", local_error->message);
+
+  return g_steal_pointer (&ledger);
+}
+
+/* Load the state saved by a previous instance of the daemon which exited to
+ * wait for its wake timer (see mws_service_shutdown()), and delete it so it’s
+ * only restored once. Returns %NULL if there is none, or it’s invalid. */
+static GVariant *
+load_saved_state (void)
+{
+  g_autofree gchar *path = build_state_path ("saved-state");
+  g_autofree gchar *contents = NULL;
+  gsize contents_len = 0;
+  g_autoptr(GError) local_error = NULL;
+
+  if (!g_file_get_contents (path, &contents, &contents_len, &local_error))
+    {
+      if (!g_error_matches (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning ("Error loading saved state from ‘%s’: %s",
+                   path, local_error->message);
+      return NULL;
+    }
+
+  if (g_unlink (path) != 0)
+    g_warning ("Error deleting saved state ‘%s’: %s", path, g_strerror (errno));
+
+  /* The file is untrusted, so make sure it’s in normal form before using it. */
+  g_autoptr(GBytes) bytes = g_bytes_new_take (g_steal_pointer (&contents), contents_len);
+  g_autoptr(GVariant) state = g_variant_new_from_bytes (G_VARIANT_TYPE ("(xa{sv})"),
+                                                        bytes, FALSE);
+
+  return g_variant_get_normal_form (state);
+}
+
+/* Save the state needed for the next instance of the daemon to carry on where
+ * this one left off. */
+static void
+save_state (MwsService *self)
+{
+  g_autofree gchar *path = build_state_path ("saved-state");
+  g_autoptr(GError) local_error = NULL;
+
+  g_autoptr(GVariant) state = NULL;
+  state = g_variant_ref_sink (g_variant_new ("(x@a{sv})",
+                                             self->wake_reschedule_usec,
+                                             mws_schedule_service_save_state (self->schedule_service)));
+
+  if (!g_file_set_contents (path, g_variant_get_data (state),
+                            g_variant_get_size (state), &local_error))
+    g_warning ("Error saving state to ‘%s’; pending entries will be lost: %s",
+               path, local_error->message);
+}
+
 static void connection_monitor_new_cb (GObject      *source_object,
                                        GAsyncResult *result,
                                        gpointer      user_data);
-
+static void restore_state_cb          (GObject      *source_object,
+                                       GAsyncResult *result,
+                                       gpointer      user_data);
+static void wake_timer_disarm_cb      (GObject      *source_object,
+                                       GAsyncResult *result,
+                                       gpointer      user_data);
+static void register_schedule_service (MwsService *self,
+                                       GTask      *task);
+
+/* Set up the scheduler and register it on the bus straight away, so that the
+ * daemon can start answering calls as soon as it’s activated. Creating the
+ * connection monitor can be slow (#NMClient loads NetworkManager’s entire
+ * object graph), so until it’s ready the scheduler uses a
+ * #MwsConnectionMonitorDeferred with no connections: entries can be scheduled,
+ * queried and removed, but none are allowed to download yet.
+ *
+ * If a previous instance of the daemon exited to wait for its wake timer, its
+ * schedule entries are restored before registering, so that peers which call
+ * in the meantime (and so activate the daemon) don’t see them missing. */
 static void
 mws_service_startup_async (GssService          *service,
                            GCancellable        *cancellable,
                            GAsyncReadyCallback  callback,
                            gpointer             user_data)
 {
+  MwsService *self = MWS_SERVICE (service);
   g_autoptr(GTask) task = g_task_new (service, cancellable, callback, user_data);
   g_task_set_source_tag (task, mws_service_startup_async);
 
-  /* Get a connection monitor first. */
-  mws_connection_monitor_nm_new_async (cancellable, connection_monitor_new_cb,
-                                       g_steal_pointer (&task));
-}
+  GDBusConnection *connection = gss_service_get_dbus_connection (service);
 
-static void
-connection_monitor_new_cb (GObject      *source_object,
-                           GAsyncResult *result,
-                           gpointer      user_data)
-{
-  g_autoptr(GTask) task = G_TASK (user_data);
-  MwsService *self = MWS_SERVICE (g_task_get_source_object (task));
-  g_autoptr(GError) local_error = NULL;
+  SchedulerConfig config;
+  load_scheduler_config (&config);
+  self->wake_on_transition = config.wake_on_transition;
 
-  g_autoptr(MwsConnectionMonitor) connection_monitor = NULL;
-  connection_monitor = MWS_CONNECTION_MONITOR (mws_connection_monitor_nm_new_finish (result, &local_error));
-  if (local_error != NULL)
-    {
-      g_task_return_error (task, g_steal_pointer (&local_error));
-      return;
-    }
+  /* Start creating the connection monitor first, so it can load while
+   * everything else is set up. */
+  self->connection_monitor = mws_connection_monitor_deferred_new ();
 
-  GDBusConnection *connection = gss_service_get_dbus_connection (GSS_SERVICE (self));
+  if (config.lightweight_connection_monitor)
+    mws_connection_monitor_nm_dbus_new_async (connection, self->cancellable,
+                                              connection_monitor_new_cb,
+                                              g_object_ref (self));
+  else
+    mws_connection_monitor_nm_new_async (self->cancellable,
+                                         connection_monitor_new_cb,
+                                         g_object_ref (self));
 
   g_autoptr(MwsPeerManager) peer_manager = NULL;
-  peer_manager = MWS_PEER_MANAGER (mws_peer_manager_dbus_new (connection));
+  g_autoptr(GHashTable) peer_priorities = load_peer_priorities ();
+  peer_manager = MWS_PEER_MANAGER (mws_peer_manager_dbus_new (connection, peer_priorities));
+
+  g_autoptr(GHashTable) peer_weights = config.fair_share ? load_peer_weights () : NULL;
 
   g_autoptr(MwsClock) clock = MWS_CLOCK (mws_clock_system_new ());
 
-  self->scheduler = mws_scheduler_new (connection_monitor, peer_manager, clock);
+  self->usage_ledger = load_usage_ledger ();
+
+  g_autoptr(MwsConcurrencyController) concurrency_controller = NULL;
+  if (config.max_active_entries == 0)
+    config.max_active_entries = config.adaptive_concurrency ?
+                                DEFAULT_ADAPTIVE_MAX_ACTIVE_ENTRIES :
+                                DEFAULT_MAX_ACTIVE_ENTRIES;
+
+  if (config.adaptive_concurrency)
+    concurrency_controller = mws_concurrency_controller_new (config.max_active_entries,
+                                                             "/proc/pressure");
+
+  /* Coalesce bursts of changes (for example, NetworkManager flapping, or a
+   * peer removing lots of entries one at a time) into a single reschedule. */
+  self->scheduler = g_object_new (MWS_TYPE_SCHEDULER,
+                                  "connection-monitor", self->connection_monitor,
+                                  "peer-manager", peer_manager,
+                                  "clock", clock,
+                                  "reschedule-delay", MWS_SERVICE_RESCHEDULE_DELAY_MS,
+                                  "usage-ledger", self->usage_ledger,
+                                  "concurrency-controller", concurrency_controller,
+                                  "max-active-entries", config.max_active_entries,
+                                  "max-entries-per-owner", config.max_entries_per_peer,
+                                  "small-entry-threshold", config.small_entry_threshold,
+                                  "min-run-time", config.min_run_time_secs,
+                                  "preemption-priority-margin", config.preemption_priority_margin,
+                                  "non-resumable-protect-percent", config.non_resumable_protect_percent,
+                                  "non-resumable-protect-size", config.non_resumable_protect_size,
+                                  "fair-share", config.fair_share,
+                                  "fair-share-quantum", config.fair_share_quantum_secs,
+                                  "peer-weights", peer_weights,
+                                  NULL);
   self->schedule_service = mws_schedule_service_new (connection,
                                                      "/com/endlessm/DownloadManager1",
                                                      self->scheduler);
   g_signal_connect (self->schedule_service, "notify::busy",
                     (GCallback) notify_busy_cb, self);
+  g_signal_connect (self->scheduler, "notify::next-reschedule",
+                    (GCallback) notify_next_reschedule_cb, self);
+  g_signal_connect (self->scheduler, "active-entries-changed",
+                    (GCallback) active_entries_changed_cb, self);
   notify_busy_cb (G_OBJECT (self->schedule_service), NULL, self);
 
+  g_autoptr(GVariant) saved_state = load_saved_state ();
+
+  if (saved_state != NULL)
+    {
+      gint64 saved_wake_reschedule_usec;
+      g_autoptr(GVariant) schedule_service_state = NULL;
+
+      g_variant_get (saved_state, "(x@a{sv})",
+                     &saved_wake_reschedule_usec, &schedule_service_state);
+      g_debug ("%s: Restoring state saved to wait for reschedule at %"
+               G_GINT64_FORMAT "µs since the epoch",
+               G_STRFUNC, saved_wake_reschedule_usec);
+
+      /* The wake timer might still be armed, if something else activated us
+       * first. */
+      self->wake_timer_busy = TRUE;
+      mws_wake_timer_disarm_async (connection, self->cancellable,
+                                   wake_timer_disarm_cb, g_object_ref (self));
+
+      mws_schedule_service_restore_state_async (self->schedule_service,
+                                                schedule_service_state,
+                                                cancellable, restore_state_cb,
+                                                g_steal_pointer (&task));
+      return;
+    }
+
+  register_schedule_service (self, task);
+}
+
+static void
+restore_state_cb (GObject      *source_object,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+  MwsScheduleService *schedule_service = MWS_SCHEDULE_SERVICE (source_object);
+  g_autoptr(GTask) task = G_TASK (user_data);
+  MwsService *self = g_task_get_source_object (task);
+  g_autoptr(GError) local_error = NULL;
+
+  /* The daemon can carry on without the restored entries; their owners will
+   * see them as having been removed. */
+  if (!mws_schedule_service_restore_state_finish (schedule_service, result,
+                                                  &local_error))
+    {
+      if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          g_task_return_error (task, g_steal_pointer (&local_error));
+          return;
+        }
+
+      g_warning ("%s", local_error->message);
+    }
+
+  register_schedule_service (self, task);
+}
+
+static void
+register_schedule_service (MwsService *self,
+                           GTask      *task)
+{
+  g_autoptr(GError) local_error = NULL;
+
   if (!mws_schedule_service_register (self->schedule_service, &local_error))
     g_task_return_error (task, g_steal_pointer (&local_error));
   else
     g_task_return_boolean (task, TRUE);
 }
 
+static void
+connection_monitor_new_cb (GObject      *source_object,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+  g_autoptr(MwsService) self = MWS_SERVICE (user_data);
+  g_autoptr(GError) local_error = NULL;
+
+  /* Both connection monitor implementations are #GAsyncInitable. */
+  g_autoptr(MwsConnectionMonitor) connection_monitor = NULL;
+  connection_monitor = MWS_CONNECTION_MONITOR (g_async_initable_new_finish (G_ASYNC_INITABLE (source_object),
+                                                                            result, &local_error));
+
+  if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    return;
+
+  /* Without a connection monitor, nothing can ever be scheduled, so give up. */
+  if (local_error != NULL)
+    {
+      g_warning ("Error creating connection monitor: %s", local_error->message);
+      gss_service_exit (GSS_SERVICE (self), local_error, 0);
+      return;
+    }
+
+  g_debug ("%s: Connection monitor ready", G_STRFUNC);
+
+  mws_connection_monitor_deferred_set_target (self->connection_monitor,
+                                              connection_monitor);
+  update_wake_timer (self);
+}
+
 static void
 mws_service_startup_finish (GssService    *service,
                             GAsyncResult  *result,
@@ -176,6 +739,27 @@ mws_service_startup_finish (GssService    *service,
   g_task_propagate_boolean (G_TASK (result), error);
 }
 
+/* Hold the #GssService while the schedule service is busy, unless the wake
+ * timer is armed, in which case the daemon can safely exit once the
+ * inactivity timeout is reached. */
+static void
+update_hold (MwsService *self)
+{
+  gboolean was_held = self->held;
+  gboolean now_held = (mws_schedule_service_get_busy (self->schedule_service) &&
+                       self->wake_reschedule_usec == 0);
+
+  g_debug ("%s: was_held: %s, now_held: %s",
+           G_STRFUNC, was_held ? "yes" : "no", now_held ? "yes" : "no");
+
+  if (was_held && !now_held)
+    gss_service_release (GSS_SERVICE (self));
+  else if (!was_held && now_held)
+    gss_service_hold (GSS_SERVICE (self));
+
+  self->held = now_held;
+}
+
 static void
 notify_busy_cb (GObject    *obj,
                 GParamSpec *pspec,
@@ -183,27 +767,172 @@ notify_busy_cb (GObject    *obj,
 {
   MwsService *self = MWS_SERVICE (user_data);
 
-  gboolean was_busy = self->busy;
-  gboolean now_busy = mws_schedule_service_get_busy (self->schedule_service);
+  update_wake_timer (self);
+  update_hold (self);
+}
 
-  g_debug ("%s: was_busy: %s, now_busy: %s",
-           G_STRFUNC, was_busy ? "yes" : "no", now_busy ? "yes" : "no");
+static void
+notify_next_reschedule_cb (GObject    *obj,
+                           GParamSpec *pspec,
+                           gpointer    user_data)
+{
+  MwsService *self = MWS_SERVICE (user_data);
 
-  if (was_busy && !now_busy)
-    gss_service_release (GSS_SERVICE (self));
-  else if (!was_busy && now_busy)
-    gss_service_hold (GSS_SERVICE (self));
+  update_wake_timer (self);
+}
+
+static void
+active_entries_changed_cb (MwsScheduler *scheduler,
+                           GPtrArray    *added,
+                           GPtrArray    *removed,
+                           gpointer      user_data)
+{
+  MwsService *self = MWS_SERVICE (user_data);
 
-  self->busy = now_busy;
+  update_wake_timer (self);
+}
+
+/* Work out whether the daemon can exit until its next reschedule, returning
+ * the #MwsScheduler:next-reschedule to arm the wake timer for if so, or 0 if
+ * it should stay resident. %G_MAXINT64 is returned if there’s no planned
+ * reschedule, but nothing can happen until a connection changes; the daemon
+ * then wakes periodically to check. */
+static gint64
+get_wake_reschedule (MwsService *self)
+{
+  /* The plan isn’t known until the connection monitor has loaded. */
+  if (mws_connection_monitor_deferred_get_target (self->connection_monitor) == NULL)
+    return 0;
+
+  if (!mws_schedule_service_get_waiting (self->schedule_service))
+    return 0;
+
+  gint64 next_reschedule_usec = mws_scheduler_get_next_reschedule (self->scheduler);
+
+  if (next_reschedule_usec - g_get_real_time () < MIN_SLEEP_USEC)
+    return 0;
+
+  return next_reschedule_usec;
+}
+
+static void wake_timer_arm_cb (GObject      *source_object,
+                               GAsyncResult *result,
+                               gpointer      user_data);
+
+/* Arm, re-arm or disarm the wake timer according to get_wake_reschedule(),
+ * if it’s changed. The daemon is held while the timer is being changed. */
+static void
+update_wake_timer (MwsService *self)
+{
+  if (!self->wake_on_transition || self->wake_timer_failed ||
+      self->wake_timer_busy || self->schedule_service == NULL)
+    return;
+
+  gint64 wake_reschedule_usec = get_wake_reschedule (self);
+
+  if (wake_reschedule_usec == self->wake_reschedule_usec)
+    return;
+
+  GDBusConnection *connection = gss_service_get_dbus_connection (GSS_SERVICE (self));
+
+  self->wake_reschedule_usec = 0;
+  self->wake_timer_busy = TRUE;
+  update_hold (self);
+
+  if (wake_reschedule_usec == 0)
+    {
+      g_debug ("%s: Disarming wake timer", G_STRFUNC);
+      mws_wake_timer_disarm_async (connection, self->cancellable,
+                                   wake_timer_disarm_cb, g_object_ref (self));
+    }
+  else
+    {
+      gint64 wake_usec = MIN (wake_reschedule_usec,
+                              g_get_real_time () + MAX_SLEEP_USEC);
+      g_autoptr(GDateTime) epoch = g_date_time_new_from_unix_utc (0);
+      g_autoptr(GDateTime) wake_time = g_date_time_add (epoch, wake_usec);
+
+      self->arming_reschedule_usec = wake_reschedule_usec;
+      mws_wake_timer_arm_async (connection, wake_time, self->cancellable,
+                                wake_timer_arm_cb, g_object_ref (self));
+    }
+}
+
+static void
+wake_timer_arm_cb (GObject      *source_object,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+  g_autoptr(MwsService) self = MWS_SERVICE (user_data);
+  g_autoptr(GError) local_error = NULL;
+
+  if (!mws_wake_timer_arm_finish (result, &local_error))
+    {
+      if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        return;
+
+      /* Most likely the daemon isn’t allowed to manage the timer unit. Don’t
+       * keep trying. */
+      g_warning ("%s; staying resident while entries are pending",
+                 local_error->message);
+      self->wake_timer_failed = TRUE;
+    }
+  else
+    {
+      g_debug ("%s: Wake timer armed; the daemon will exit when idle", G_STRFUNC);
+      self->wake_reschedule_usec = self->arming_reschedule_usec;
+    }
+
+  self->wake_timer_busy = FALSE;
+
+  /* Things might have changed while the timer was being armed. */
+  update_wake_timer (self);
+  update_hold (self);
+}
+
+static void
+wake_timer_disarm_cb (GObject      *source_object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+  g_autoptr(MwsService) self = MWS_SERVICE (user_data);
+  g_autoptr(GError) local_error = NULL;
+
+  /* If the timer can’t be disarmed, it will just start the daemon early (or
+   * while it’s already running), which is harmless. */
+  if (!mws_wake_timer_disarm_finish (result, &local_error))
+    {
+      if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        return;
+
+      g_debug ("%s: %s", G_STRFUNC, local_error->message);
+    }
+
+  self->wake_timer_busy = FALSE;
+
+  update_wake_timer (self);
+  update_hold (self);
 }
 
 static void
 mws_service_shutdown (GssService *service)
 {
   MwsService *self = MWS_SERVICE (service);
+  g_autoptr(GError) local_error = NULL;
 
   g_cancellable_cancel (self->cancellable);
+
+  /* If the wake timer is armed, the next instance of the daemon will carry on
+   * with the pending entries. */
+  if (self->wake_reschedule_usec != 0 && !self->wake_timer_busy)
+    save_state (self);
+
   mws_schedule_service_unregister (self->schedule_service);
+
+  /* Make sure the latest usage is persisted before we exit. */
+  if (self->usage_ledger != NULL &&
+      !mws_usage_ledger_flush (self->usage_ledger, &local_error))
+    g_warning ("%s", local_error->message);
 }
 
 /**
@@ -28,6 +28,15 @@
 
 G_BEGIN_DECLS
 
+/**
+ * MWS_SERVICE_RESCHEDULE_DELAY_MS:
+ *
+ * Delay for coalescing reschedules in the daemon, in milliseconds; see
+ * #MwsScheduler:reschedule-delay. Arbitrarily chosen to be short enough not to
+ * be noticeable to users.
+ */
+#define MWS_SERVICE_RESCHEDULE_DELAY_MS 100
+
 #define MWS_TYPE_SERVICE mws_service_get_type ()
 G_DECLARE_FINAL_TYPE (MwsService, mws_service, MWS, SERVICE, GssService)
 
@@ -0,0 +1,104 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <libmogwai-schedule/tariff-setting.h>
+#include <libmogwai-tariff/tariff-loader.h>
+#include <libmogwai-tariff/tariff.h>
+
+
+/* Load a tariff from @tariff_str, the base64-encoded form of the output of
+ * mwt_tariff_builder_get_tariff_as_bytes(). This avoids the cost of
+ * g_variant_parse() for the text form. */
+static gboolean
+load_tariff_from_base64 (MwtTariffLoader  *loader,
+                         const gchar      *tariff_str,
+                         GError          **error)
+{
+  g_autofree guchar *data = NULL;
+  gsize data_len = 0;
+
+  /* g_base64_decode() doesn’t report errors, and ignores invalid characters,
+   * so any corruption will be caught by the loader’s validation instead. */
+  data = g_base64_decode (tariff_str, &data_len);
+  g_autoptr(GBytes) bytes = g_bytes_new_take (g_steal_pointer (&data), data_len);
+
+  return mwt_tariff_loader_load_from_bytes (loader, bytes, error);
+}
+
+/**
+ * mws_tariff_setting_parse:
+ * @tariff_str: value of the setting
+ * @tariff_is_binary: %TRUE if @tariff_str is from `connection.tariff-bin`,
+ *    %FALSE if it is from `connection.tariff`
+ * @error: return location for a #GError, or %NULL
+ *
+ * Parse @tariff_str, the value of the `connection.tariff-bin` or
+ * `connection.tariff` user setting of a NetworkManager connection. The former
+ * is a base64-encoded serialised tariff (see
+ * mwt_tariff_builder_get_tariff_as_bytes()); the latter is a tariff in
+ * #GVariant text format (see mwt_tariff_builder_get_tariff_as_variant()).
+ *
+ * The returned tariff has a timeline materialised up to
+ * %MWS_TARIFF_SETTING_TIMELINE_HORIZON, since the scheduler queries it
+ * repeatedly for the current time.
+ *
+ * This doesn’t touch any shared state, so may be called from a worker thread.
+ *
+ * Returns: (transfer full): the parsed tariff, or %NULL on error
+ * Since: 0.3.0
+ */
+MwtTariff *
+mws_tariff_setting_parse (const gchar  *tariff_str,
+                          gboolean      tariff_is_binary,
+                          GError      **error)
+{
+  g_return_val_if_fail (tariff_str != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  g_autoptr(MwtTariffLoader) loader = mwt_tariff_loader_new ();
+  gboolean loaded;
+
+  if (tariff_is_binary)
+    {
+      loaded = load_tariff_from_base64 (loader, tariff_str, error);
+    }
+  else
+    {
+      g_autoptr(GVariant) tariff_variant = NULL;
+      tariff_variant = g_variant_parse (NULL, tariff_str, NULL, NULL, error);
+      loaded = (tariff_variant != NULL &&
+                mwt_tariff_loader_load_from_variant (loader, tariff_variant,
+                                                     error));
+    }
+
+  if (!loaded)
+    return NULL;
+
+  g_autoptr(MwtTariff) tariff = g_object_ref (mwt_tariff_loader_get_tariff (loader));
+  mwt_tariff_set_timeline_horizon (tariff, MWS_TARIFF_SETTING_TIMELINE_HORIZON);
+
+  return g_steal_pointer (&tariff);
+}
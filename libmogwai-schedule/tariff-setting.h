@@ -0,0 +1,45 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <libmogwai-tariff/tariff.h>
+
+G_BEGIN_DECLS
+
+/**
+ * MWS_TARIFF_SETTING_TIMELINE_HORIZON:
+ *
+ * Horizon of the materialised timeline of transitions kept for each tariff
+ * returned by mws_tariff_setting_parse(). See
+ * mwt_tariff_set_timeline_horizon().
+ *
+ * Since: 0.3.0
+ */
+#define MWS_TARIFF_SETTING_TIMELINE_HORIZON (7 * G_TIME_SPAN_DAY)
+
+MwtTariff *mws_tariff_setting_parse (const gchar  *tariff_str,
+                                     gboolean      tariff_is_binary,
+                                     GError      **error);
+
+G_END_DECLS
@@ -244,7 +244,9 @@ mws_clock_dummy_remove_alarm (MwsClock *clock,
   GSource *source = GUINT_TO_POINTER (id);
 
   /* The source will be destroyed by the free function set up on the array. */
-  g_return_if_fail (g_ptr_array_remove_fast (self->alarms, source));
+  /* Use g_ptr_array_remove() rather than g_ptr_array_remove_fast() to keep
+   * the array sorted. */
+  g_return_if_fail (g_ptr_array_remove (self->alarms, source));
 }
 
 /**
@@ -384,6 +386,23 @@ mws_clock_dummy_get_next_alarm_time (MwsClockDummy *self)
   return data->alarm_time;
 }
 
+/**
+ * mws_clock_dummy_get_n_alarms:
+ * @self: a #MwsClockDummy
+ *
+ * Get the number of alarms which are currently scheduled.
+ *
+ * Returns: number of pending alarms
+ * Since: 0.3.0
+ */
+guint
+mws_clock_dummy_get_n_alarms (MwsClockDummy *self)
+{
+  g_return_val_if_fail (MWS_IS_CLOCK_DUMMY (self), 0);
+
+  return self->alarms->len;
+}
+
 /**
  * mws_clock_dummy_next_alarm:
  * @self: a #MwsClockDummy
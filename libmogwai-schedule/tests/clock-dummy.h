@@ -38,6 +38,7 @@ void       mws_clock_dummy_set_time            (MwsClockDummy *self,
 void       mws_clock_dummy_set_time_zone       (MwsClockDummy *self,
                                                 GTimeZone     *tz);
 GDateTime *mws_clock_dummy_get_next_alarm_time (MwsClockDummy *self);
+guint      mws_clock_dummy_get_n_alarms        (MwsClockDummy *self);
 gboolean   mws_clock_dummy_next_alarm          (MwsClockDummy *self);
 
 G_END_DECLS
@@ -0,0 +1,220 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+
+#include "config.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <libmogwai-schedule/concurrency-controller.h>
+#include <locale.h>
+
+
+/* Length of a sample window in the controller, plus a bit. */
+#define WINDOW_USEC (31 * G_USEC_PER_SEC)
+
+/* Simulated download state, fed to the controller one window at a time. */
+typedef struct
+{
+  gint64 now_usec;
+  guint64 total_rx_bytes;
+} Simulation;
+
+/* Simulate a window passing with the given @throughput (in bytes per second)
+ * and @n_active entries, and return whether the controller changed its
+ * limit. */
+static gboolean
+simulate_window (MwsConcurrencyController *controller,
+                 Simulation               *simulation,
+                 guint64                   throughput,
+                 guint                     n_active)
+{
+  simulation->now_usec += WINDOW_USEC;
+  simulation->total_rx_bytes += throughput * WINDOW_USEC / G_USEC_PER_SEC;
+
+  return mws_concurrency_controller_update (controller, simulation->now_usec,
+                                            simulation->total_rx_bytes, n_active);
+}
+
+/* Start @simulation at an arbitrary time, and give the controller its first
+ * sample. */
+static void
+simulation_start (MwsConcurrencyController *controller,
+                  Simulation               *simulation)
+{
+  simulation->now_usec = 1000 * G_USEC_PER_SEC;
+  simulation->total_rx_bytes = 0;
+
+  g_assert_false (mws_concurrency_controller_update (controller,
+                                                     simulation->now_usec,
+                                                     simulation->total_rx_bytes,
+                                                     0));
+}
+
+/* Test that constructing a #MwsConcurrencyController works. */
+static void
+test_concurrency_controller_construction (void)
+{
+  g_autoptr(MwsConcurrencyController) controller = mws_concurrency_controller_new (4, NULL);
+
+  g_assert_cmpuint (mws_concurrency_controller_get_limit (controller), ==, 1);
+  g_assert_cmpuint (mws_concurrency_controller_get_max_limit (controller), ==, 4);
+}
+
+/* Test that the limit grows while throughput scales with it, and backs off to
+ * the point where it stopped scaling. Throughput here scales linearly up to 3
+ * active entries, then is flat. */
+static void
+test_concurrency_controller_scaling (void)
+{
+  g_autoptr(MwsConcurrencyController) controller = mws_concurrency_controller_new (10, NULL);
+  Simulation simulation;
+
+  simulation_start (controller, &simulation);
+
+  for (guint expected_limit = 2; expected_limit <= 4; expected_limit++)
+    {
+      guint limit = mws_concurrency_controller_get_limit (controller);
+      g_assert_true (simulate_window (controller, &simulation,
+                                      MIN (limit, 3) * 1000, limit));
+      g_assert_cmpuint (mws_concurrency_controller_get_limit (controller), ==,
+                        expected_limit);
+    }
+
+  /* 4 gives no more throughput than 3, so it should back off. */
+  g_assert_true (simulate_window (controller, &simulation, 3000, 4));
+  g_assert_cmpuint (mws_concurrency_controller_get_limit (controller), ==, 3);
+
+  /* And stay there for a while. */
+  for (guint i = 0; i < 5; i++)
+    {
+      g_assert_false (simulate_window (controller, &simulation, 3000, 3));
+      g_assert_cmpuint (mws_concurrency_controller_get_limit (controller), ==, 3);
+    }
+}
+
+/* Test that the limit never exceeds the maximum, even if throughput keeps
+ * scaling. */
+static void
+test_concurrency_controller_max_limit (void)
+{
+  g_autoptr(MwsConcurrencyController) controller = mws_concurrency_controller_new (2, NULL);
+  Simulation simulation;
+
+  simulation_start (controller, &simulation);
+
+  for (guint i = 0; i < 10; i++)
+    {
+      guint limit = mws_concurrency_controller_get_limit (controller);
+      simulate_window (controller, &simulation, limit * 1000, limit);
+      g_assert_cmpuint (mws_concurrency_controller_get_limit (controller), <=, 2);
+    }
+
+  g_assert_cmpuint (mws_concurrency_controller_get_limit (controller), ==, 2);
+}
+
+/* Test that the limit isn’t increased if it isn’t being used in full, or if
+ * nothing is being downloaded. */
+static void
+test_concurrency_controller_unsaturated (void)
+{
+  g_autoptr(MwsConcurrencyController) controller = mws_concurrency_controller_new (4, NULL);
+  Simulation simulation;
+
+  simulation_start (controller, &simulation);
+
+  for (guint i = 0; i < 5; i++)
+    {
+      g_assert_false (simulate_window (controller, &simulation, 1000, 0));
+      g_assert_false (simulate_window (controller, &simulation, 0, 1));
+    }
+
+  g_assert_cmpuint (mws_concurrency_controller_get_limit (controller), ==, 1);
+}
+
+/* Test that high CPU or I/O pressure reduces the limit, even if throughput is
+ * scaling. */
+static void
+test_concurrency_controller_pressure (void)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autofree gchar *tmp_dir = g_dir_make_tmp ("mogwai-pressure-XXXXXX", &local_error);
+  g_assert_no_error (local_error);
+
+  g_autofree gchar *cpu_path = g_build_filename (tmp_dir, "cpu", NULL);
+  g_autofree gchar *io_path = g_build_filename (tmp_dir, "io", NULL);
+  const gchar *low_pressure =
+      "some avg10=1.50 avg60=1.00 avg300=0.50 total=12345\n"
+      "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n";
+  const gchar *high_pressure =
+      "some avg10=60.00 avg60=30.00 avg300=10.00 total=1234567\n"
+      "full avg10=40.00 avg60=20.00 avg300=5.00 total=123456\n";
+
+  g_file_set_contents (cpu_path, low_pressure, -1, &local_error);
+  g_assert_no_error (local_error);
+  g_file_set_contents (io_path, low_pressure, -1, &local_error);
+  g_assert_no_error (local_error);
+
+  g_autoptr(MwsConcurrencyController) controller = mws_concurrency_controller_new (4, tmp_dir);
+  Simulation simulation;
+
+  simulation_start (controller, &simulation);
+
+  g_assert_true (simulate_window (controller, &simulation, 1000, 1));
+  g_assert_cmpuint (mws_concurrency_controller_get_limit (controller), ==, 2);
+
+  /* Now the I/O is contended. */
+  g_file_set_contents (io_path, high_pressure, -1, &local_error);
+  g_assert_no_error (local_error);
+
+  g_assert_true (simulate_window (controller, &simulation, 2000, 2));
+  g_assert_cmpuint (mws_concurrency_controller_get_limit (controller), ==, 1);
+
+  /* It can’t go lower than 1. */
+  g_assert_false (simulate_window (controller, &simulation, 1000, 1));
+  g_assert_cmpuint (mws_concurrency_controller_get_limit (controller), ==, 1);
+
+  g_unlink (cpu_path);
+  g_unlink (io_path);
+  g_rmdir (tmp_dir);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  setlocale (LC_ALL, "");
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/concurrency-controller/construction",
+                   test_concurrency_controller_construction);
+  g_test_add_func ("/concurrency-controller/scaling",
+                   test_concurrency_controller_scaling);
+  g_test_add_func ("/concurrency-controller/max-limit",
+                   test_concurrency_controller_max_limit);
+  g_test_add_func ("/concurrency-controller/unsaturated",
+                   test_concurrency_controller_unsaturated);
+  g_test_add_func ("/concurrency-controller/pressure",
+                   test_concurrency_controller_pressure);
+
+  return g_test_run ();
+}
@@ -0,0 +1,146 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+
+#include "config.h"
+
+#include <glib.h>
+#include <glib-object.h>
+#include <libmogwai-schedule/connection-monitor.h>
+#include <libmogwai-schedule/connection-monitor-deferred.h>
+#include <libmogwai-schedule/tests/connection-monitor-dummy.h>
+#include <libmogwai-schedule/tests/signal-logger.h>
+#include <locale.h>
+
+
+/* Test that a deferred connection monitor reports no connections before its
+ * target is set. */
+static void
+test_connection_monitor_deferred_provisional (void)
+{
+  g_autoptr(MwsConnectionMonitorDeferred) deferred = mws_connection_monitor_deferred_new ();
+  MwsConnectionMonitor *monitor = MWS_CONNECTION_MONITOR (deferred);
+  MwsConnectionDetails details;
+
+  g_assert_null (mws_connection_monitor_deferred_get_target (deferred));
+
+  const gchar * const *connection_ids = mws_connection_monitor_get_connection_ids (monitor);
+  g_assert_nonnull (connection_ids);
+  g_assert_null (connection_ids[0]);
+
+  g_assert_false (mws_connection_monitor_get_connection_details (monitor, "c1", &details));
+}
+
+/* Test that setting the target adds its existing connections, and that calls
+ * and signals are forwarded from then on. */
+static void
+test_connection_monitor_deferred_set_target (void)
+{
+  g_autoptr(MwsConnectionMonitorDeferred) deferred = mws_connection_monitor_deferred_new ();
+  g_autoptr(MwsConnectionMonitorDummy) dummy = mws_connection_monitor_dummy_new ();
+  MwsConnectionMonitor *monitor = MWS_CONNECTION_MONITOR (deferred);
+  g_autoptr(MwsSignalLogger) logger = mws_signal_logger_new ();
+
+  mws_signal_logger_connect (logger, deferred, "connections-changed");
+  mws_signal_logger_connect (logger, deferred, "connection-details-changed");
+  mws_signal_logger_connect (logger, deferred, "connection-statistics-changed");
+
+  /* Add a connection to the target before it’s set. */
+  const MwsConnectionDetails connection_details =
+    {
+      .metered = MWS_METERED_YES,
+      .allow_downloads_when_metered = TRUE,
+      .allow_downloads = TRUE,
+      .tariff = NULL,
+    };
+  g_autoptr(GHashTable) added = g_hash_table_new (g_str_hash, g_str_equal);
+  g_hash_table_insert (added, "c1", (gpointer) &connection_details);
+  mws_connection_monitor_dummy_update_connections (dummy, added, NULL);
+
+  mws_signal_logger_assert_no_emissions (logger);
+
+  mws_connection_monitor_deferred_set_target (deferred, MWS_CONNECTION_MONITOR (dummy));
+  g_assert_true (mws_connection_monitor_deferred_get_target (deferred) ==
+                 MWS_CONNECTION_MONITOR (dummy));
+
+  g_autoptr(GPtrArray) changed_added = NULL;
+  g_autoptr(GPtrArray) changed_removed = NULL;
+  mws_signal_logger_assert_emission_pop (logger, deferred, "connections-changed",
+                                         &changed_added, &changed_removed);
+  g_assert_nonnull (changed_added);
+  g_assert_cmpuint (changed_added->len, ==, 1);
+  g_assert_cmpstr (g_ptr_array_index (changed_added, 0), ==, "c1");
+  g_assert_null (changed_removed);
+  g_clear_pointer (&changed_added, g_ptr_array_unref);
+  mws_signal_logger_assert_no_emissions (logger);
+
+  /* Calls are forwarded. */
+  const gchar * const *connection_ids = mws_connection_monitor_get_connection_ids (monitor);
+  g_assert_cmpuint (g_strv_length ((gchar **) connection_ids), ==, 1);
+  g_assert_cmpstr (connection_ids[0], ==, "c1");
+
+  MwsConnectionDetails details;
+  g_assert_true (mws_connection_monitor_get_connection_details (monitor, "c1", &details));
+  g_assert_cmpint (details.metered, ==, MWS_METERED_YES);
+  mws_connection_details_clear (&details);
+
+  /* Signals are forwarded. */
+  g_autofree gchar *changed_connection_id = NULL;
+  mws_connection_monitor_dummy_update_connection (dummy, "c1", &connection_details);
+  mws_signal_logger_assert_emission_pop (logger, deferred, "connection-details-changed",
+                                         &changed_connection_id);
+  g_assert_cmpstr (changed_connection_id, ==, "c1");
+  g_clear_pointer (&changed_connection_id, g_free);
+
+  guint64 rx_bytes = 0;
+  mws_connection_monitor_dummy_update_statistics (dummy, "c1", 1000);
+  mws_signal_logger_assert_emission_pop (logger, deferred, "connection-statistics-changed",
+                                         &changed_connection_id, &rx_bytes);
+  g_assert_cmpstr (changed_connection_id, ==, "c1");
+  g_assert_cmpuint (rx_bytes, ==, 1000);
+
+  g_autoptr(GPtrArray) removed = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (removed, "c1");
+  mws_connection_monitor_dummy_update_connections (dummy, NULL, removed);
+  mws_signal_logger_assert_emission_pop (logger, deferred, "connections-changed",
+                                         &changed_added, &changed_removed);
+  g_assert_cmpuint (changed_added->len, ==, 0);
+  g_assert_cmpuint (changed_removed->len, ==, 1);
+  g_assert_cmpstr (g_ptr_array_index (changed_removed, 0), ==, "c1");
+
+  mws_signal_logger_assert_no_emissions (logger);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  setlocale (LC_ALL, "");
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/connection-monitor-deferred/provisional",
+                   test_connection_monitor_deferred_provisional);
+  g_test_add_func ("/connection-monitor-deferred/set-target",
+                   test_connection_monitor_deferred_set_target);
+
+  return g_test_run ();
+}
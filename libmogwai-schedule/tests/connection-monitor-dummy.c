@@ -60,8 +60,9 @@ static gboolean             mws_connection_monitor_dummy_get_connection_details
  * MwsConnectionMonitorDummy:
  *
  * An implementation of the #MwsConnectionMonitor interface which returns dummy
- * results provided using mws_connection_monitor_dummy_update_connections() and
- * mws_connection_monitor_dummy_update_connection(). To be used for testing
+ * results provided using mws_connection_monitor_dummy_update_connections(),
+ * mws_connection_monitor_dummy_update_connection() and
+ * mws_connection_monitor_dummy_update_statistics(). To be used for testing
  * only.
  *
  * Since: 0.1.0
@@ -263,3 +264,31 @@ mws_connection_monitor_dummy_update_connection (MwsConnectionMonitorDummy  *self
   g_clear_pointer (&self->cached_connection_ids, g_free);
   g_signal_emit_by_name (self, "connection-details-changed", connection_id);
 }
+
+/**
+ * mws_connection_monitor_dummy_update_statistics:
+ * @self: a #MwsConnectionMonitorDummy
+ * @connection_id: ID of the connection to update
+ * @rx_bytes: new value for the connection’s received bytes counter
+ *
+ * Emit #MwsConnectionMonitor::connection-statistics-changed for the existing
+ * connection identified by @connection_id, as if @rx_bytes had been received
+ * over it in total.
+ *
+ * It is an error to call this with a @connection_id which does not exist in the
+ * connection monitor.
+ *
+ * Since: 0.3.0
+ */
+void
+mws_connection_monitor_dummy_update_statistics (MwsConnectionMonitorDummy *self,
+                                                const gchar               *connection_id,
+                                                guint64                    rx_bytes)
+{
+  g_return_if_fail (MWS_IS_CONNECTION_MONITOR_DUMMY (self));
+  g_return_if_fail (connection_id != NULL);
+
+  g_assert (g_hash_table_lookup (self->connections, connection_id) != NULL);
+
+  g_signal_emit_by_name (self, "connection-statistics-changed", connection_id, rx_bytes);
+}
@@ -39,5 +39,8 @@ void mws_connection_monitor_dummy_update_connections (MwsConnectionMonitorDummy
 void mws_connection_monitor_dummy_update_connection  (MwsConnectionMonitorDummy  *self,
                                                       const gchar                *connection_id,
                                                       const MwsConnectionDetails *details);
+void mws_connection_monitor_dummy_update_statistics (MwsConnectionMonitorDummy  *self,
+                                                      const gchar                *connection_id,
+                                                      guint64                     rx_bytes);
 
 G_END_DECLS
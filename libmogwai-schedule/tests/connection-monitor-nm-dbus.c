@@ -0,0 +1,866 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <libmogwai-schedule/connection-monitor.h>
+#include <libmogwai-schedule/connection-monitor-nm-dbus.h>
+#include <libmogwai-schedule/tests/signal-logger.h>
+#include <locale.h>
+
+
+#define NM_DBUS_NAME "org.freedesktop.NetworkManager"
+#define NM_DBUS_PATH "/org/freedesktop/NetworkManager"
+#define NM_DBUS_INTERFACE "org.freedesktop.NetworkManager"
+#define NM_DBUS_INTERFACE_ACTIVE_CONNECTION "org.freedesktop.NetworkManager.Connection.Active"
+#define NM_DBUS_INTERFACE_DEVICE "org.freedesktop.NetworkManager.Device"
+#define NM_DBUS_INTERFACE_STATISTICS "org.freedesktop.NetworkManager.Device.Statistics"
+#define NM_DBUS_INTERFACE_SETTINGS_CONNECTION "org.freedesktop.NetworkManager.Settings.Connection"
+
+/* `NMMetered` values, as sent over D-Bus. */
+#define NM_METERED_UNKNOWN 0
+#define NM_METERED_YES 1
+#define NM_METERED_NO 2
+
+static void
+async_result_cb (GObject      *obj,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  GAsyncResult **result_out = user_data;
+  *result_out = g_object_ref (result);
+}
+
+/* The subset of NetworkManager’s D-Bus API which #MwsConnectionMonitorNmDbus
+ * uses. */
+static const gchar mock_nm_xml[] =
+  "<node>"
+    "<interface name='" NM_DBUS_INTERFACE "'>"
+      "<property name='ActiveConnections' type='ao' access='read'/>"
+    "</interface>"
+    "<interface name='" NM_DBUS_INTERFACE_ACTIVE_CONNECTION "'>"
+      "<property name='Id' type='s' access='read'/>"
+      "<property name='Connection' type='o' access='read'/>"
+      "<property name='Devices' type='ao' access='read'/>"
+    "</interface>"
+    "<interface name='" NM_DBUS_INTERFACE_DEVICE "'>"
+      "<property name='Metered' type='u' access='read'/>"
+    "</interface>"
+    "<interface name='" NM_DBUS_INTERFACE_STATISTICS "'>"
+      "<property name='RefreshRateMs' type='u' access='readwrite'/>"
+      "<property name='RxBytes' type='t' access='read'/>"
+    "</interface>"
+    "<interface name='" NM_DBUS_INTERFACE_SETTINGS_CONNECTION "'>"
+      "<method name='GetSettings'>"
+        "<arg type='a{sa{sv}}' name='settings' direction='out'/>"
+      "</method>"
+      "<signal name='Updated'/>"
+    "</interface>"
+  "</node>";
+
+typedef struct _MockNm MockNm;
+
+/* An object exported by #MockNm, with the values of all the properties of all
+ * its interfaces in @properties (none of the mocked interfaces share property
+ * names), and the settings returned by `GetSettings` if it’s a settings
+ * connection. */
+typedef struct
+{
+  MockNm *nm;  /* (unowned) */
+  gchar *path;  /* (owned) */
+  GHashTable *properties;  /* (owned) (element-type utf8 GVariant) */
+  GVariant *settings;  /* (owned) (nullable) (type a{sa{sv}}) */
+  GArray *registration_ids;  /* (owned) (element-type guint) */
+} MockObject;
+
+/* A mock NetworkManager, exporting objects on its own connection to the
+ * #GTestDBus. It only owns the `org.freedesktop.NetworkManager` name once
+ * mock_nm_request_name() is called.
+ *
+ * While @hold_get_settings is %TRUE, `GetSettings` calls aren’t replied to
+ * until mock_nm_release_get_settings() is called, so that tests can change
+ * things while the connection monitor is part way through loading. */
+struct _MockNm
+{
+  GDBusConnection *connection;  /* (owned) */
+  GDBusNodeInfo *node_info;  /* (owned) */
+  GHashTable *objects;  /* (owned) (element-type utf8 MockObject) */
+  gboolean hold_get_settings;
+  GPtrArray *held_invocations;  /* (owned) (element-type GDBusMethodInvocation) */
+};
+
+static void
+mock_object_free (MockObject *object)
+{
+  for (gsize i = 0; i < object->registration_ids->len; i++)
+    g_dbus_connection_unregister_object (object->nm->connection,
+                                         g_array_index (object->registration_ids, guint, i));
+
+  g_clear_pointer (&object->registration_ids, g_array_unref);
+  g_clear_pointer (&object->settings, g_variant_unref);
+  g_clear_pointer (&object->properties, g_hash_table_unref);
+  g_free (object->path);
+  g_free (object);
+}
+
+static void
+mock_nm_return_settings (MockNm                *nm,
+                         GDBusMethodInvocation *invocation)
+{
+  const gchar *path = g_dbus_method_invocation_get_object_path (invocation);
+  MockObject *object = g_hash_table_lookup (nm->objects, path);
+
+  g_assert_nonnull (object);
+  g_assert_nonnull (object->settings);
+
+  g_dbus_method_invocation_return_value (invocation,
+                                         g_variant_new ("(@a{sa{sv}})",
+                                                        object->settings));
+}
+
+static void
+mock_nm_method_call (GDBusConnection       *connection,
+                     const gchar           *sender,
+                     const gchar           *object_path,
+                     const gchar           *interface_name,
+                     const gchar           *method_name,
+                     GVariant              *parameters,
+                     GDBusMethodInvocation *invocation,
+                     gpointer               user_data)
+{
+  MockNm *nm = user_data;
+
+  g_assert_cmpstr (interface_name, ==, NM_DBUS_INTERFACE_SETTINGS_CONNECTION);
+  g_assert_cmpstr (method_name, ==, "GetSettings");
+
+  /* This takes ownership of @invocation until it’s returned. */
+  if (nm->hold_get_settings)
+    g_ptr_array_add (nm->held_invocations, invocation);
+  else
+    mock_nm_return_settings (nm, invocation);
+}
+
+static GVariant *
+mock_nm_get_property (GDBusConnection  *connection,
+                      const gchar      *sender,
+                      const gchar      *object_path,
+                      const gchar      *interface_name,
+                      const gchar      *property_name,
+                      GError          **error,
+                      gpointer          user_data)
+{
+  MockNm *nm = user_data;
+  MockObject *object = g_hash_table_lookup (nm->objects, object_path);
+  GVariant *value = (object != NULL) ? g_hash_table_lookup (object->properties, property_name) : NULL;
+
+  if (value == NULL)
+    {
+      g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY,
+                   "No property ‘%s’ on ‘%s’", property_name, object_path);
+      return NULL;
+    }
+
+  return g_variant_ref (value);
+}
+
+static gboolean
+mock_nm_set_property (GDBusConnection  *connection,
+                      const gchar      *sender,
+                      const gchar      *object_path,
+                      const gchar      *interface_name,
+                      const gchar      *property_name,
+                      GVariant         *value,
+                      GError          **error,
+                      gpointer          user_data)
+{
+  MockNm *nm = user_data;
+  MockObject *object = g_hash_table_lookup (nm->objects, object_path);
+
+  g_assert_nonnull (object);
+  g_hash_table_replace (object->properties, g_strdup (property_name),
+                        g_variant_ref (value));
+
+  return TRUE;
+}
+
+static const GDBusInterfaceVTable mock_nm_vtable =
+{
+  mock_nm_method_call,
+  mock_nm_get_property,
+  mock_nm_set_property,
+};
+
+/* Export an object at @path on @nm, implementing the given %NULL-terminated
+ * list of @interface_names. Its properties are initially all unset. */
+static MockObject *
+mock_nm_add_object (MockNm              *nm,
+                    const gchar         *path,
+                    const gchar * const *interface_names)
+{
+  g_autoptr(GError) local_error = NULL;
+  MockObject *object = g_new0 (MockObject, 1);
+
+  object->nm = nm;
+  object->path = g_strdup (path);
+  object->properties = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                              g_free, (GDestroyNotify) g_variant_unref);
+  object->registration_ids = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  for (gsize i = 0; interface_names[i] != NULL; i++)
+    {
+      GDBusInterfaceInfo *interface_info =
+          g_dbus_node_info_lookup_interface (nm->node_info, interface_names[i]);
+      g_assert_nonnull (interface_info);
+
+      guint registration_id =
+          g_dbus_connection_register_object (nm->connection, path,
+                                             interface_info, &mock_nm_vtable,
+                                             nm, NULL, &local_error);
+      g_assert_no_error (local_error);
+      g_array_append_val (object->registration_ids, registration_id);
+    }
+
+  g_hash_table_insert (nm->objects, object->path, object);
+
+  return object;
+}
+
+static void
+mock_object_set_property (MockObject  *object,
+                          const gchar *property_name,
+                          GVariant    *value)
+{
+  g_hash_table_replace (object->properties, g_strdup (property_name),
+                        g_variant_ref_sink (value));
+}
+
+static MockNm *
+mock_nm_new (GTestDBus *bus)
+{
+  g_autoptr(GError) local_error = NULL;
+  MockNm *nm = g_new0 (MockNm, 1);
+
+  nm->connection = g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (bus),
+                                                           G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION |
+                                                           G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+                                                           NULL, NULL,
+                                                           &local_error);
+  g_assert_no_error (local_error);
+
+  nm->node_info = g_dbus_node_info_new_for_xml (mock_nm_xml, &local_error);
+  g_assert_no_error (local_error);
+
+  nm->objects = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                       NULL, (GDestroyNotify) mock_object_free);
+  nm->held_invocations = g_ptr_array_new_with_free_func (NULL);
+
+  /* Start with no active connections. */
+  const gchar * const manager_interfaces[] = { NM_DBUS_INTERFACE, NULL };
+  MockObject *manager = mock_nm_add_object (nm, NM_DBUS_PATH, manager_interfaces);
+  mock_object_set_property (manager, "ActiveConnections",
+                            g_variant_new_objv (NULL, 0));
+
+  return nm;
+}
+
+static void
+mock_nm_release_get_settings (MockNm *nm)
+{
+  for (gsize i = 0; i < nm->held_invocations->len; i++)
+    mock_nm_return_settings (nm, g_ptr_array_index (nm->held_invocations, i));
+
+  g_ptr_array_set_size (nm->held_invocations, 0);
+}
+
+static void
+mock_nm_free (MockNm *nm)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  mock_nm_release_get_settings (nm);
+  g_clear_pointer (&nm->held_invocations, g_ptr_array_unref);
+  g_clear_pointer (&nm->objects, g_hash_table_unref);
+  g_clear_pointer (&nm->node_info, g_dbus_node_info_unref);
+
+  g_dbus_connection_close_sync (nm->connection, NULL, &local_error);
+  g_assert_no_error (local_error);
+  g_clear_object (&nm->connection);
+
+  g_free (nm);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (MockNm, mock_nm_free)
+
+/* Claim the NetworkManager name, so that the mock appears to have started. */
+static void
+mock_nm_request_name (MockNm *nm)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GVariant) reply = NULL;
+  guint32 result;
+
+  reply = g_dbus_connection_call_sync (nm->connection,
+                                       "org.freedesktop.DBus",
+                                       "/org/freedesktop/DBus",
+                                       "org.freedesktop.DBus",
+                                       "RequestName",
+                                       g_variant_new ("(su)", NM_DBUS_NAME,
+                                                      4  /* DBUS_NAME_FLAG_DO_NOT_QUEUE */),
+                                       G_VARIANT_TYPE ("(u)"),
+                                       G_DBUS_CALL_FLAGS_NONE,
+                                       -1, NULL, &local_error);
+  g_assert_no_error (local_error);
+
+  g_variant_get (reply, "(u)", &result);
+  g_assert_cmpuint (result, ==, 1  /* DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER */);
+}
+
+/* Release the NetworkManager name, so that the mock appears to have exited.
+ * Its objects stay exported, so it can be restarted by calling
+ * mock_nm_request_name() again. */
+static void
+mock_nm_release_name (MockNm *nm)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GVariant) reply = NULL;
+  guint32 result;
+
+  reply = g_dbus_connection_call_sync (nm->connection,
+                                       "org.freedesktop.DBus",
+                                       "/org/freedesktop/DBus",
+                                       "org.freedesktop.DBus",
+                                       "ReleaseName",
+                                       g_variant_new ("(s)", NM_DBUS_NAME),
+                                       G_VARIANT_TYPE ("(u)"),
+                                       G_DBUS_CALL_FLAGS_NONE,
+                                       -1, NULL, &local_error);
+  g_assert_no_error (local_error);
+
+  g_variant_get (reply, "(u)", &result);
+  g_assert_cmpuint (result, ==, 1  /* DBUS_RELEASE_NAME_REPLY_RELEASED */);
+}
+
+/* Change the @property_name property of the object at @path, and emit
+ * `PropertiesChanged` for it on @interface_name. */
+static void
+mock_nm_update_property (MockNm      *nm,
+                         const gchar *path,
+                         const gchar *interface_name,
+                         const gchar *property_name,
+                         GVariant    *value)
+{
+  g_autoptr(GError) local_error = NULL;
+  MockObject *object = g_hash_table_lookup (nm->objects, path);
+  g_auto(GVariantBuilder) changed_builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE_VARDICT);
+
+  g_assert_nonnull (object);
+  mock_object_set_property (object, property_name, value);
+
+  g_variant_builder_add (&changed_builder, "{sv}", property_name, value);
+  g_dbus_connection_emit_signal (nm->connection, NULL, path,
+                                 "org.freedesktop.DBus.Properties",
+                                 "PropertiesChanged",
+                                 g_variant_new ("(sa{sv}@as)", interface_name,
+                                                &changed_builder,
+                                                g_variant_new_strv (NULL, 0)),
+                                 &local_error);
+  g_assert_no_error (local_error);
+}
+
+static void
+mock_nm_set_active_connections (MockNm              *nm,
+                                const gchar * const *paths)
+{
+  mock_nm_update_property (nm, NM_DBUS_PATH, NM_DBUS_INTERFACE,
+                           "ActiveConnections", g_variant_new_objv (paths, -1));
+}
+
+static void
+mock_nm_add_device (MockNm      *nm,
+                    const gchar *path,
+                    guint32      metered,
+                    guint64      rx_bytes)
+{
+  const gchar * const interfaces[] =
+    {
+      NM_DBUS_INTERFACE_DEVICE,
+      NM_DBUS_INTERFACE_STATISTICS,
+      NULL
+    };
+  MockObject *object = mock_nm_add_object (nm, path, interfaces);
+
+  mock_object_set_property (object, "Metered", g_variant_new_uint32 (metered));
+  mock_object_set_property (object, "RxBytes", g_variant_new_uint64 (rx_bytes));
+  /* Statistics are disabled until something enables them. */
+  mock_object_set_property (object, "RefreshRateMs", g_variant_new_uint32 (0));
+}
+
+static void
+mock_nm_add_settings_connection (MockNm      *nm,
+                                 const gchar *path,
+                                 GVariant    *settings)
+{
+  const gchar * const interfaces[] = { NM_DBUS_INTERFACE_SETTINGS_CONNECTION, NULL };
+  MockObject *object = mock_nm_add_object (nm, path, interfaces);
+
+  object->settings = g_variant_ref_sink (settings);
+}
+
+/* Replace the settings of the settings connection at @path, and emit
+ * `Updated` for it. */
+static void
+mock_nm_update_settings (MockNm      *nm,
+                         const gchar *path,
+                         GVariant    *settings)
+{
+  g_autoptr(GError) local_error = NULL;
+  MockObject *object = g_hash_table_lookup (nm->objects, path);
+
+  g_assert_nonnull (object);
+  g_clear_pointer (&object->settings, g_variant_unref);
+  object->settings = g_variant_ref_sink (settings);
+
+  g_dbus_connection_emit_signal (nm->connection, NULL, path,
+                                 NM_DBUS_INTERFACE_SETTINGS_CONNECTION,
+                                 "Updated", NULL, &local_error);
+  g_assert_no_error (local_error);
+}
+
+static void
+mock_nm_add_active_connection (MockNm              *nm,
+                               const gchar         *path,
+                               const gchar         *id,
+                               const gchar         *settings_path,
+                               const gchar * const *device_paths)
+{
+  const gchar * const interfaces[] = { NM_DBUS_INTERFACE_ACTIVE_CONNECTION, NULL };
+  MockObject *object = mock_nm_add_object (nm, path, interfaces);
+
+  mock_object_set_property (object, "Id", g_variant_new_string (id));
+  mock_object_set_property (object, "Connection", g_variant_new_object_path (settings_path));
+  mock_object_set_property (object, "Devices", g_variant_new_objv (device_paths, -1));
+}
+
+/* A test fixture which runs a #MockNm on a private #GTestDBus instance, and
+ * provides a second #GDBusConnection to the same bus for the connection
+ * monitor under test. The mock doesn’t own the NetworkManager name until the
+ * test calls mock_nm_request_name(). */
+typedef struct
+{
+  GTestDBus *bus;  /* (owned) */
+  GDBusConnection *client_connection;  /* (owned) */
+  MockNm *nm;  /* (owned) */
+} BusFixture;
+
+static void
+bus_setup (BusFixture    *fixture,
+           gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  fixture->bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+  g_test_dbus_up (fixture->bus);
+
+  fixture->client_connection = g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (fixture->bus),
+                                                                       G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION |
+                                                                       G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+                                                                       NULL, NULL,
+                                                                       &local_error);
+  g_assert_no_error (local_error);
+
+  fixture->nm = mock_nm_new (fixture->bus);
+}
+
+static void
+bus_teardown (BusFixture    *fixture,
+              gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  g_clear_pointer (&fixture->nm, mock_nm_free);
+
+  g_dbus_connection_close_sync (fixture->client_connection, NULL, &local_error);
+  g_assert_no_error (local_error);
+  g_clear_object (&fixture->client_connection);
+
+  g_test_dbus_down (fixture->bus);
+  g_clear_object (&fixture->bus);
+}
+
+/* Create a #MwsConnectionMonitorNmDbus on #BusFixture.client_connection, and
+ * wait for it to finish initialising. */
+static MwsConnectionMonitorNmDbus *
+monitor_new (BusFixture *fixture)
+{
+  g_autoptr(GAsyncResult) result = NULL;
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(MwsConnectionMonitorNmDbus) monitor = NULL;
+
+  mws_connection_monitor_nm_dbus_new_async (fixture->client_connection, NULL,
+                                            async_result_cb, &result);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  monitor = mws_connection_monitor_nm_dbus_new_finish (result, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (monitor);
+
+  return g_steal_pointer (&monitor);
+}
+
+/* Assert that @monitor reports exactly the connections in @expected_ids, in
+ * any order. */
+static void
+assert_connection_ids (MwsConnectionMonitorNmDbus *monitor,
+                       const gchar * const        *expected_ids)
+{
+  const gchar * const *connection_ids =
+      mws_connection_monitor_get_connection_ids (MWS_CONNECTION_MONITOR (monitor));
+
+  g_assert_nonnull (connection_ids);
+  g_assert_cmpuint (g_strv_length ((gchar **) connection_ids), ==,
+                    g_strv_length ((gchar **) expected_ids));
+
+  for (gsize i = 0; expected_ids[i] != NULL; i++)
+    g_assert_true (g_strv_contains (connection_ids, expected_ids[i]));
+}
+
+static void
+wait_for_emission (MwsSignalLogger *logger)
+{
+  while (mws_signal_logger_get_n_emissions (logger) == 0)
+    g_main_context_iteration (NULL, TRUE);
+}
+
+/* Set up a single active connection, `/ac1` with ID `c1`, using the settings
+ * connection `/s1` with @settings, and the device `/d1`. */
+static void
+add_single_connection (BusFixture *fixture,
+                       GVariant   *settings,
+                       guint32     device_metered)
+{
+  const gchar * const device_paths[] = { "/d1", NULL };
+  const gchar * const active_connection_paths[] = { "/ac1", NULL };
+
+  mock_nm_add_device (fixture->nm, "/d1", device_metered, 1000);
+  mock_nm_add_settings_connection (fixture->nm, "/s1", settings);
+  mock_nm_add_active_connection (fixture->nm, "/ac1", "c1", "/s1", device_paths);
+  mock_nm_set_active_connections (fixture->nm, active_connection_paths);
+}
+
+/* Test that initialisation completes straight away with no connections if
+ * NetworkManager isn’t running. */
+static void
+test_connection_monitor_nm_dbus_no_nm (BusFixture    *fixture,
+                                       gconstpointer  test_data)
+{
+  g_autoptr(MwsConnectionMonitorNmDbus) monitor = monitor_new (fixture);
+  const gchar * const expected_ids[] = { NULL };
+
+  assert_connection_ids (monitor, expected_ids);
+  g_assert_false (mws_connection_monitor_get_connection_details (MWS_CONNECTION_MONITOR (monitor),
+                                                                 "c1", NULL));
+}
+
+/* Test that the connections which are active when the monitor is created are
+ * loaded, with their details combined from the settings and devices, and that
+ * statistics are enabled on their devices. */
+static void
+test_connection_monitor_nm_dbus_initial_load (BusFixture    *fixture,
+                                              gconstpointer  test_data)
+{
+  add_single_connection (fixture,
+                         g_variant_new_parsed ("@a{sa{sv}} {"
+                                                 "'connection': {'metered': <int32 1>},"
+                                                 "'user': {'data': <@a{ss} {"
+                                                   "'connection.allow-downloads-when-metered': '1'"
+                                                 "}>}"
+                                               "}"),
+                         NM_METERED_NO);
+  mock_nm_request_name (fixture->nm);
+
+  g_autoptr(MwsConnectionMonitorNmDbus) monitor = monitor_new (fixture);
+  const gchar * const expected_ids[] = { "c1", NULL };
+
+  assert_connection_ids (monitor, expected_ids);
+
+  /* The settings connection is metered, which overrides the device. */
+  MwsConnectionDetails details;
+  g_assert_true (mws_connection_monitor_get_connection_details (MWS_CONNECTION_MONITOR (monitor),
+                                                                "c1", &details));
+  g_assert_cmpint (details.metered, ==, MWS_METERED_YES);
+  g_assert_true (details.allow_downloads_when_metered);
+  g_assert_true (details.allow_downloads);
+  g_assert_null (details.tariff);
+  mws_connection_details_clear (&details);
+
+  /* The monitor should enable statistics on the device. This isn’t waited
+   * for during initialisation. */
+  MockObject *device = g_hash_table_lookup (fixture->nm->objects, "/d1");
+
+  while (g_variant_get_uint32 (g_hash_table_lookup (device->properties, "RefreshRateMs")) == 0)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (g_variant_get_uint32 (g_hash_table_lookup (device->properties, "RefreshRateMs")),
+                    ==, 5000);
+}
+
+/* Test that initialisation waits for connections which are added part way
+ * through, and doesn’t wait for (or report) connections which are removed
+ * part way through. */
+static void
+test_connection_monitor_nm_dbus_init_changed (BusFixture    *fixture,
+                                              gconstpointer  test_data)
+{
+  const gchar * const no_devices[] = { NULL };
+  const gchar * const initial_paths[] = { "/ac1", "/ac2", NULL };
+  const gchar * const changed_paths[] = { "/ac2", "/ac3", NULL };
+  g_autoptr(GAsyncResult) result = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  mock_nm_add_settings_connection (fixture->nm, "/s1",
+                                   g_variant_new_parsed ("@a{sa{sv}} {}"));
+  mock_nm_add_active_connection (fixture->nm, "/ac1", "c1", "/s1", no_devices);
+  mock_nm_add_active_connection (fixture->nm, "/ac2", "c2", "/s1", no_devices);
+  mock_nm_add_active_connection (fixture->nm, "/ac3", "c3", "/s1", no_devices);
+  mock_nm_set_active_connections (fixture->nm, initial_paths);
+  mock_nm_request_name (fixture->nm);
+
+  /* Start initialising, and wait until both initial connections are waiting
+   * for their settings. */
+  fixture->nm->hold_get_settings = TRUE;
+  mws_connection_monitor_nm_dbus_new_async (fixture->client_connection, NULL,
+                                            async_result_cb, &result);
+
+  while (fixture->nm->held_invocations->len < 2)
+    g_main_context_iteration (NULL, TRUE);
+
+  /* Remove `/ac1` and add `/ac3`. The signal is sent before the settings
+   * replies, so is handled first. */
+  mock_nm_set_active_connections (fixture->nm, changed_paths);
+  mock_nm_release_get_settings (fixture->nm);
+
+  /* Initialisation must not complete until `/ac3` has loaded. */
+  while (fixture->nm->held_invocations->len < 1)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_null (result);
+
+  fixture->nm->hold_get_settings = FALSE;
+  mock_nm_release_get_settings (fixture->nm);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_autoptr(MwsConnectionMonitorNmDbus) monitor =
+      mws_connection_monitor_nm_dbus_new_finish (result, &local_error);
+  g_assert_no_error (local_error);
+
+  const gchar * const expected_ids[] = { "c2", "c3", NULL };
+  assert_connection_ids (monitor, expected_ids);
+}
+
+/* Test that the settings are re-fetched when the settings connection emits
+ * `Updated`, and that the change is reported once they have been. */
+static void
+test_connection_monitor_nm_dbus_settings_updated (BusFixture    *fixture,
+                                                  gconstpointer  test_data)
+{
+  add_single_connection (fixture,
+                         g_variant_new_parsed ("@a{sa{sv}} {"
+                                                 "'connection': {'metered': <int32 2>}"
+                                               "}"),
+                         NM_METERED_UNKNOWN);
+  mock_nm_request_name (fixture->nm);
+
+  g_autoptr(MwsConnectionMonitorNmDbus) monitor = monitor_new (fixture);
+  g_autoptr(MwsSignalLogger) logger = mws_signal_logger_new ();
+  mws_signal_logger_connect (logger, monitor, "connections-changed");
+  mws_signal_logger_connect (logger, monitor, "connection-details-changed");
+
+  MwsConnectionDetails details;
+  g_assert_true (mws_connection_monitor_get_connection_details (MWS_CONNECTION_MONITOR (monitor),
+                                                                "c1", &details));
+  g_assert_cmpint (details.metered, ==, MWS_METERED_NO);
+  g_assert_true (details.allow_downloads);
+  mws_connection_details_clear (&details);
+
+  mock_nm_update_settings (fixture->nm, "/s1",
+                           g_variant_new_parsed ("@a{sa{sv}} {"
+                                                   "'connection': {'metered': <int32 1>},"
+                                                   "'user': {'data': <@a{ss} {"
+                                                     "'connection.allow-downloads': '0'"
+                                                   "}>}"
+                                                 "}"));
+
+  g_autofree gchar *changed_connection_id = NULL;
+  wait_for_emission (logger);
+  mws_signal_logger_assert_emission_pop (logger, monitor, "connection-details-changed",
+                                         &changed_connection_id);
+  g_assert_cmpstr (changed_connection_id, ==, "c1");
+  mws_signal_logger_assert_no_emissions (logger);
+
+  g_assert_true (mws_connection_monitor_get_connection_details (MWS_CONNECTION_MONITOR (monitor),
+                                                                "c1", &details));
+  g_assert_cmpint (details.metered, ==, MWS_METERED_YES);
+  g_assert_false (details.allow_downloads);
+  mws_connection_details_clear (&details);
+}
+
+/* Test that changes to the `Metered` property and the statistics of a device
+ * are reported for its active connection. */
+static void
+test_connection_monitor_nm_dbus_device_changed (BusFixture    *fixture,
+                                                gconstpointer  test_data)
+{
+  /* No `connection.metered` setting, so only the device’s status counts. */
+  add_single_connection (fixture,
+                         g_variant_new_parsed ("@a{sa{sv}} {'connection': @a{sv} {}}"),
+                         NM_METERED_NO);
+  mock_nm_request_name (fixture->nm);
+
+  g_autoptr(MwsConnectionMonitorNmDbus) monitor = monitor_new (fixture);
+  g_autoptr(MwsSignalLogger) logger = mws_signal_logger_new ();
+  mws_signal_logger_connect (logger, monitor, "connections-changed");
+  mws_signal_logger_connect (logger, monitor, "connection-details-changed");
+  mws_signal_logger_connect (logger, monitor, "connection-statistics-changed");
+
+  MwsConnectionDetails details;
+  g_assert_true (mws_connection_monitor_get_connection_details (MWS_CONNECTION_MONITOR (monitor),
+                                                                "c1", &details));
+  g_assert_cmpint (details.metered, ==, MWS_METERED_NO);
+  mws_connection_details_clear (&details);
+
+  mock_nm_update_property (fixture->nm, "/d1", NM_DBUS_INTERFACE_DEVICE,
+                           "Metered", g_variant_new_uint32 (NM_METERED_YES));
+
+  g_autofree gchar *changed_connection_id = NULL;
+  wait_for_emission (logger);
+  mws_signal_logger_assert_emission_pop (logger, monitor, "connection-details-changed",
+                                         &changed_connection_id);
+  g_assert_cmpstr (changed_connection_id, ==, "c1");
+  g_clear_pointer (&changed_connection_id, g_free);
+  mws_signal_logger_assert_no_emissions (logger);
+
+  g_assert_true (mws_connection_monitor_get_connection_details (MWS_CONNECTION_MONITOR (monitor),
+                                                                "c1", &details));
+  g_assert_cmpint (details.metered, ==, MWS_METERED_YES);
+  mws_connection_details_clear (&details);
+
+  mock_nm_update_property (fixture->nm, "/d1", NM_DBUS_INTERFACE_STATISTICS,
+                           "RxBytes", g_variant_new_uint64 (2000));
+
+  guint64 rx_bytes = 0;
+  wait_for_emission (logger);
+  mws_signal_logger_assert_emission_pop (logger, monitor, "connection-statistics-changed",
+                                         &changed_connection_id, &rx_bytes);
+  g_assert_cmpstr (changed_connection_id, ==, "c1");
+  g_assert_cmpuint (rx_bytes, ==, 2000);
+  mws_signal_logger_assert_no_emissions (logger);
+}
+
+/* Test that all connections are removed when NetworkManager disappears, and
+ * re-added when it comes back. */
+static void
+test_connection_monitor_nm_dbus_vanished (BusFixture    *fixture,
+                                          gconstpointer  test_data)
+{
+  add_single_connection (fixture,
+                         g_variant_new_parsed ("@a{sa{sv}} {}"),
+                         NM_METERED_NO);
+  mock_nm_request_name (fixture->nm);
+
+  g_autoptr(MwsConnectionMonitorNmDbus) monitor = monitor_new (fixture);
+  g_autoptr(MwsSignalLogger) logger = mws_signal_logger_new ();
+  mws_signal_logger_connect (logger, monitor, "connections-changed");
+  mws_signal_logger_connect (logger, monitor, "connection-details-changed");
+  mws_signal_logger_connect (logger, monitor, "connection-statistics-changed");
+
+  const gchar * const expected_ids[] = { "c1", NULL };
+  const gchar * const no_ids[] = { NULL };
+  assert_connection_ids (monitor, expected_ids);
+
+  mock_nm_release_name (fixture->nm);
+
+  g_autoptr(GPtrArray) changed_added = NULL;
+  g_autoptr(GPtrArray) changed_removed = NULL;
+  wait_for_emission (logger);
+  mws_signal_logger_assert_emission_pop (logger, monitor, "connections-changed",
+                                         &changed_added, &changed_removed);
+  g_assert_null (changed_added);
+  g_assert_nonnull (changed_removed);
+  g_assert_cmpuint (changed_removed->len, ==, 1);
+  g_assert_cmpstr (g_ptr_array_index (changed_removed, 0), ==, "c1");
+  g_clear_pointer (&changed_removed, g_ptr_array_unref);
+  mws_signal_logger_assert_no_emissions (logger);
+
+  assert_connection_ids (monitor, no_ids);
+  g_assert_false (mws_connection_monitor_get_connection_details (MWS_CONNECTION_MONITOR (monitor),
+                                                                 "c1", NULL));
+
+  /* Restart NetworkManager. The connection is re-added once it has loaded,
+   * followed by its statistics. */
+  mock_nm_request_name (fixture->nm);
+
+  g_autofree gchar *changed_connection_id = NULL;
+  guint64 rx_bytes = 0;
+  wait_for_emission (logger);
+  mws_signal_logger_assert_emission_pop (logger, monitor, "connections-changed",
+                                         &changed_added, &changed_removed);
+  g_assert_nonnull (changed_added);
+  g_assert_cmpuint (changed_added->len, ==, 1);
+  g_assert_cmpstr (g_ptr_array_index (changed_added, 0), ==, "c1");
+  g_assert_null (changed_removed);
+  mws_signal_logger_assert_emission_pop (logger, monitor, "connection-statistics-changed",
+                                         &changed_connection_id, &rx_bytes);
+  g_assert_cmpstr (changed_connection_id, ==, "c1");
+  g_assert_cmpuint (rx_bytes, ==, 1000);
+  mws_signal_logger_assert_no_emissions (logger);
+
+  assert_connection_ids (monitor, expected_ids);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  setlocale (LC_ALL, "");
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add ("/connection-monitor-nm-dbus/no-nm", BusFixture, NULL, bus_setup,
+              test_connection_monitor_nm_dbus_no_nm, bus_teardown);
+  g_test_add ("/connection-monitor-nm-dbus/initial-load", BusFixture, NULL, bus_setup,
+              test_connection_monitor_nm_dbus_initial_load, bus_teardown);
+  g_test_add ("/connection-monitor-nm-dbus/init-changed", BusFixture, NULL, bus_setup,
+              test_connection_monitor_nm_dbus_init_changed, bus_teardown);
+  g_test_add ("/connection-monitor-nm-dbus/settings-updated", BusFixture, NULL, bus_setup,
+              test_connection_monitor_nm_dbus_settings_updated, bus_teardown);
+  g_test_add ("/connection-monitor-nm-dbus/device-changed", BusFixture, NULL, bus_setup,
+              test_connection_monitor_nm_dbus_device_changed, bus_teardown);
+  g_test_add ("/connection-monitor-nm-dbus/vanished", BusFixture, NULL, bus_setup,
+              test_connection_monitor_nm_dbus_vanished, bus_teardown);
+
+  return g_test_run ();
+}
@@ -27,6 +27,7 @@
 #include <glib/gi18n-lib.h>
 #include <gio/gio.h>
 #include <libmogwai-schedule/peer-manager.h>
+#include <libmogwai-schedule/peer-priorities.h>
 #include <libmogwai-schedule/scheduler.h>
 #include <libmogwai-schedule/tests/peer-manager-dummy.h>
 #include <stdlib.h>
@@ -54,6 +55,8 @@ static gchar       *mws_peer_manager_dummy_ensure_peer_credentials_finish (MwsPe
                                                                            GError              **error);
 static const gchar *mws_peer_manager_dummy_get_peer_credentials           (MwsPeerManager       *manager,
                                                                            const gchar          *sender);
+static gint         mws_peer_manager_dummy_get_peer_priority              (MwsPeerManager       *manager,
+                                                                           const gchar          *sender);
 
 /**
  * MwsPeerManagerDummy:
@@ -117,6 +120,7 @@ mws_peer_manager_dummy_peer_manager_init (MwsPeerManagerInterface *iface)
   iface->ensure_peer_credentials_async = mws_peer_manager_dummy_ensure_peer_credentials_async;
   iface->ensure_peer_credentials_finish = mws_peer_manager_dummy_ensure_peer_credentials_finish;
   iface->get_peer_credentials = mws_peer_manager_dummy_get_peer_credentials;
+  iface->get_peer_priority = mws_peer_manager_dummy_get_peer_priority;
 }
 
 static void
@@ -212,9 +216,28 @@ mws_peer_manager_dummy_get_peer_credentials (MwsPeerManager *manager,
 {
   MwsPeerManagerDummy *self = MWS_PEER_MANAGER_DUMMY (manager);
 
+  /* Behave as if nothing is in the cache if we’re meant to be failing. */
+  if (self->fail)
+    return NULL;
+
   return g_hash_table_lookup (self->peer_credentials, sender);
 }
 
+static gint
+mws_peer_manager_dummy_get_peer_priority (MwsPeerManager *manager,
+                                          const gchar    *sender)
+{
+  const gchar *path = mws_peer_manager_dummy_get_peer_credentials (manager, sender);
+  g_autoptr(GHashTable) priorities = NULL;
+
+  if (path == NULL)
+    return G_MININT;
+
+  /* Efficiency doesn’t matter here, so don’t bother caching anything. */
+  priorities = mws_peer_priorities_new_default ();
+  return mws_peer_priorities_lookup (priorities, path);
+}
+
 /**
  * mws_peer_manager_dummy_new:
  * @fail: %TRUE to always return %MWS_SCHEDULER_ERROR_IDENTIFYING_PEER; %FALSE
@@ -0,0 +1,246 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <libmogwai-schedule/peer-priorities.h>
+#include <locale.h>
+
+
+/* Test that the default peer priorities give the updaters the highest
+ * priority, and everything else a lower one. */
+static void
+test_peer_priorities_default (void)
+{
+  g_autoptr(GHashTable) priorities = mws_peer_priorities_new_default ();
+
+  g_assert_nonnull (priorities);
+  g_assert_cmpint (mws_peer_priorities_lookup (priorities, "/usr/libexec/eos-updater"),
+                   ==, G_MAXINT);
+  g_assert_cmpint (mws_peer_priorities_lookup (priorities, "/usr/bin/gnome-software"),
+                   ==, G_MAXINT);
+  g_assert_cmpint (mws_peer_priorities_lookup (priorities, "/usr/bin/other"),
+                   <, G_MAXINT);
+}
+
+/* Test that peers not in the map are given a stable priority in the open
+ * range (G_MININT, G_MAXINT). */
+static void
+test_peer_priorities_lookup_unknown (void)
+{
+  g_autoptr(GHashTable) priorities = mws_peer_priorities_new_default ();
+  const gchar *paths[] =
+    {
+      "/usr/bin/one",
+      "/usr/bin/two",
+      "/opt/three",
+      "/",
+    };
+
+  for (gsize i = 0; i < G_N_ELEMENTS (paths); i++)
+    {
+      gint priority = mws_peer_priorities_lookup (priorities, paths[i]);
+
+      g_test_message ("Path ‘%s’ has priority %d", paths[i], priority);
+
+      g_assert_cmpint (priority, >, G_MININT);
+      g_assert_cmpint (priority, <, G_MAXINT);
+      g_assert_cmpint (priority, ==, mws_peer_priorities_lookup (priorities, paths[i]));
+    }
+}
+
+/* Test loading a valid peer priorities key file. */
+static void
+test_peer_priorities_key_file (void)
+{
+  g_autoptr(GKeyFile) key_file = g_key_file_new ();
+  g_autoptr(GHashTable) priorities = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  g_key_file_load_from_data (key_file,
+                             "[Peer Priorities]\n"
+                             "/usr/bin/important=100\n"
+                             "/usr/bin/unimportant=-100\n"
+                             "[Other Group]\n"
+                             "/usr/bin/ignored=5\n",
+                             -1, G_KEY_FILE_NONE, &local_error);
+  g_assert_no_error (local_error);
+
+  priorities = mws_peer_priorities_new_from_key_file (key_file, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (priorities);
+
+  g_assert_cmpuint (g_hash_table_size (priorities), ==, 2);
+  g_assert_cmpint (mws_peer_priorities_lookup (priorities, "/usr/bin/important"),
+                   ==, 100);
+  g_assert_cmpint (mws_peer_priorities_lookup (priorities, "/usr/bin/unimportant"),
+                   ==, -100);
+
+  /* The defaults are not merged in. */
+  g_assert_false (g_hash_table_contains (priorities, "/usr/libexec/eos-updater"));
+}
+
+/* Test that a key file without the peer priorities group gives an empty map. */
+static void
+test_peer_priorities_key_file_empty (void)
+{
+  g_autoptr(GKeyFile) key_file = g_key_file_new ();
+  g_autoptr(GHashTable) priorities = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  priorities = mws_peer_priorities_new_from_key_file (key_file, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (priorities);
+  g_assert_cmpuint (g_hash_table_size (priorities), ==, 0);
+}
+
+/* Test that invalid peer priorities key files are rejected. */
+static void
+test_peer_priorities_key_file_invalid (void)
+{
+  const gchar *invalid_data[] =
+    {
+      "[Peer Priorities]\nrelative/path=5\n",
+      "[Peer Priorities]\n/usr/bin/not-a-number=high\n",
+      "[Peer Priorities]\n/usr/bin/too-big=2147483648\n",
+      "[Peer Priorities]\n/usr/bin/too-small=-2147483649\n",
+    };
+
+  for (gsize i = 0; i < G_N_ELEMENTS (invalid_data); i++)
+    {
+      g_autoptr(GKeyFile) key_file = g_key_file_new ();
+      g_autoptr(GHashTable) priorities = NULL;
+      g_autoptr(GError) local_error = NULL;
+
+      g_test_message ("%" G_GSIZE_FORMAT ": %s", i, invalid_data[i]);
+
+      g_key_file_load_from_data (key_file, invalid_data[i], -1,
+                                 G_KEY_FILE_NONE, &local_error);
+      g_assert_no_error (local_error);
+
+      priorities = mws_peer_priorities_new_from_key_file (key_file, &local_error);
+      g_assert_error (local_error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE);
+      g_assert_null (priorities);
+    }
+}
+
+/* Test that loading a non-existent file returns %G_FILE_ERROR_NOENT. */
+static void
+test_peer_priorities_file_missing (void)
+{
+  g_autoptr(GHashTable) priorities = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  priorities = mws_peer_priorities_new_from_file ("/nonexistent/peer-priorities.conf",
+                                                  &local_error);
+  g_assert_error (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT);
+  g_assert_null (priorities);
+}
+
+/* Test loading peer weights from a key file, and that peers which aren’t
+ * listed get the default weight. */
+static void
+test_peer_weights_key_file (void)
+{
+  g_autoptr(GKeyFile) key_file = g_key_file_new ();
+  g_autoptr(GHashTable) weights = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  g_key_file_load_from_data (key_file,
+                             "[Peer Priorities]\n"
+                             "/usr/bin/important=100\n"
+                             "[Peer Weights]\n"
+                             "/usr/bin/heavy=4\n"
+                             "/usr/bin/light=1\n",
+                             -1, G_KEY_FILE_NONE, &local_error);
+  g_assert_no_error (local_error);
+
+  weights = mws_peer_weights_new_from_key_file (key_file, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (weights);
+
+  g_assert_cmpuint (g_hash_table_size (weights), ==, 2);
+  g_assert_cmpuint (mws_peer_weights_lookup (weights, "/usr/bin/heavy"), ==, 4);
+  g_assert_cmpuint (mws_peer_weights_lookup (weights, "/usr/bin/light"), ==, 1);
+  g_assert_cmpuint (mws_peer_weights_lookup (weights, "/usr/bin/important"), ==, 1);
+  g_assert_cmpuint (mws_peer_weights_lookup (weights, NULL), ==, 1);
+  g_assert_cmpuint (mws_peer_weights_lookup (NULL, "/usr/bin/heavy"), ==, 1);
+}
+
+/* Test that invalid peer weights are rejected. */
+static void
+test_peer_weights_key_file_invalid (void)
+{
+  const gchar *invalid_data[] =
+    {
+      "[Peer Weights]\nrelative/path=5\n",
+      "[Peer Weights]\n/usr/bin/not-a-number=heavy\n",
+      "[Peer Weights]\n/usr/bin/zero=0\n",
+      "[Peer Weights]\n/usr/bin/negative=-1\n",
+      "[Peer Weights]\n/usr/bin/too-big=1001\n",
+    };
+
+  for (gsize i = 0; i < G_N_ELEMENTS (invalid_data); i++)
+    {
+      g_autoptr(GKeyFile) key_file = g_key_file_new ();
+      g_autoptr(GHashTable) weights = NULL;
+      g_autoptr(GError) local_error = NULL;
+
+      g_test_message ("%" G_GSIZE_FORMAT ": %s", i, invalid_data[i]);
+
+      g_key_file_load_from_data (key_file, invalid_data[i], -1,
+                                 G_KEY_FILE_NONE, &local_error);
+      g_assert_no_error (local_error);
+
+      weights = mws_peer_weights_new_from_key_file (key_file, &local_error);
+      g_assert_error (local_error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE);
+      g_assert_null (weights);
+    }
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  setlocale (LC_ALL, "");
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/peer-priorities/default",
+                   test_peer_priorities_default);
+  g_test_add_func ("/peer-priorities/lookup/unknown",
+                   test_peer_priorities_lookup_unknown);
+  g_test_add_func ("/peer-priorities/key-file",
+                   test_peer_priorities_key_file);
+  g_test_add_func ("/peer-priorities/key-file/empty",
+                   test_peer_priorities_key_file_empty);
+  g_test_add_func ("/peer-priorities/key-file/invalid",
+                   test_peer_priorities_key_file_invalid);
+  g_test_add_func ("/peer-priorities/file/missing",
+                   test_peer_priorities_file_missing);
+  g_test_add_func ("/peer-weights/key-file",
+                   test_peer_weights_key_file);
+  g_test_add_func ("/peer-weights/key-file/invalid",
+                   test_peer_weights_key_file_invalid);
+
+  return g_test_run ();
+}
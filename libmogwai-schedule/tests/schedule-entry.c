@@ -44,6 +44,10 @@ test_schedule_entry_construction (void)
   g_assert_cmpstr (mws_schedule_entry_get_owner (entry), ==, ":owner.1");
   g_assert_false (mws_schedule_entry_get_resumable (entry));
   g_assert_cmpuint (mws_schedule_entry_get_priority (entry), ==, 0);
+  g_assert_cmpuint (mws_schedule_entry_get_expected_size (entry), ==, 0);
+  g_assert_cmpuint (mws_schedule_entry_get_deadline (entry), ==, 0);
+  g_assert_false (mws_schedule_entry_get_bind_to_connection (entry));
+  g_assert_null (mws_schedule_entry_get_connection_id (entry));
 }
 
 /* Test that constructing a complete #MwsScheduleEntry from a #GVariant works. */
@@ -56,7 +60,10 @@ test_schedule_entry_construction_variant (void)
                                                g_variant_new_parsed (
                                                  "@a{sv} {"
                                                    "'resumable': <@b true>,"
-                                                   "'priority': <@u 5>"
+                                                   "'priority': <@u 5>,"
+                                                   "'expected-size': <@t 1000000>,"
+                                                   "'deadline': <@t 1500000000>,"
+                                                   "'bind-to-connection': <@b true>"
                                                  "}"),
                                                &local_error);
 
@@ -69,6 +76,9 @@ test_schedule_entry_construction_variant (void)
   g_assert_cmpstr (mws_schedule_entry_get_owner (entry), ==, ":owner.1");
   g_assert_true (mws_schedule_entry_get_resumable (entry));
   g_assert_cmpuint (mws_schedule_entry_get_priority (entry), ==, 5);
+  g_assert_cmpuint (mws_schedule_entry_get_expected_size (entry), ==, 1000000);
+  g_assert_cmpuint (mws_schedule_entry_get_deadline (entry), ==, 1500000000);
+  g_assert_true (mws_schedule_entry_get_bind_to_connection (entry));
 }
 
 /* Test that constructing a complete #MwsScheduleEntry from a %NULL #GVariant
@@ -138,6 +148,73 @@ test_schedule_entry_construction_variant_invalid_type (void)
   g_assert_null (entry);
 }
 
+/* Test that an entry serialised with mws_schedule_entry_to_variant() can be
+ * re-created with the same ID and parameters using
+ * mws_schedule_entry_new_with_id(), and that IDs are still unique afterwards. */
+static void
+test_schedule_entry_construction_with_id (void)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(MwsScheduleEntry) entry1 = mws_schedule_entry_new (":owner.1");
+
+  mws_schedule_entry_set_resumable (entry1, TRUE);
+  mws_schedule_entry_set_priority (entry1, 5);
+  mws_schedule_entry_set_expected_size (entry1, 1024);
+  mws_schedule_entry_set_deadline (entry1, 123456789);
+  mws_schedule_entry_set_bind_to_connection (entry1, TRUE);
+
+  /* Pick an ID which hasn’t been used yet. */
+  guint64 id1 = g_ascii_strtoull (mws_schedule_entry_get_id (entry1), NULL, 10);
+  g_autofree gchar *restored_id = g_strdup_printf ("%" G_GUINT64_FORMAT, id1 + 10);
+
+  g_autoptr(MwsScheduleEntry) entry2 = NULL;
+  entry2 = mws_schedule_entry_new_with_id (":owner.2", restored_id,
+                                           mws_schedule_entry_to_variant (entry1),
+                                           &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (entry2);
+
+  g_assert_cmpstr (mws_schedule_entry_get_id (entry2), ==, restored_id);
+  g_assert_cmpstr (mws_schedule_entry_get_owner (entry2), ==, ":owner.2");
+  g_assert_true (mws_schedule_entry_get_resumable (entry2));
+  g_assert_cmpuint (mws_schedule_entry_get_priority (entry2), ==, 5);
+  g_assert_cmpuint (mws_schedule_entry_get_expected_size (entry2), ==, 1024);
+  g_assert_cmpuint (mws_schedule_entry_get_deadline (entry2), ==, 123456789);
+  g_assert_true (mws_schedule_entry_get_bind_to_connection (entry2));
+
+  /* New entries must get higher IDs than the restored one. */
+  g_autoptr(MwsScheduleEntry) entry3 = mws_schedule_entry_new (":owner.1");
+  guint64 id3 = g_ascii_strtoull (mws_schedule_entry_get_id (entry3), NULL, 10);
+  g_assert_cmpuint (id3, >, id1 + 10);
+
+  /* Restoring an ID which might already be in use must fail, as must invalid
+   * IDs. */
+  const gchar *invalid_ids[] =
+    {
+      mws_schedule_entry_get_id (entry1),
+      restored_id,
+      "",
+      "not a number",
+      "12x",
+      "-1",
+      "18446744073709551615",
+    };
+
+  for (gsize i = 0; i < G_N_ELEMENTS (invalid_ids); i++)
+    {
+      g_autoptr(MwsScheduleEntry) entry4 = NULL;
+
+      g_test_message ("Invalid ID %" G_GSIZE_FORMAT ": %s", i, invalid_ids[i]);
+
+      entry4 = mws_schedule_entry_new_with_id (":owner.1", invalid_ids[i], NULL,
+                                               &local_error);
+      g_assert_error (local_error, MWS_SCHEDULER_ERROR,
+                      MWS_SCHEDULER_ERROR_INVALID_PARAMETERS);
+      g_assert_null (entry4);
+      g_clear_error (&local_error);
+    }
+}
+
 /* Check that newly constructed entries all have different IDs. */
 static void
 test_schedule_entry_different_ids (void)
@@ -155,6 +232,32 @@ test_schedule_entry_different_ids (void)
   g_assert_cmpstr (id3, !=, id1);
 }
 
+/* Check that entries with the same owner share a copy of the owner string, and
+ * that it stays valid while any of them exist. */
+static void
+test_schedule_entry_shared_owners (void)
+{
+  g_autoptr(MwsScheduleEntry) entry1 = mws_schedule_entry_new (":owner.1");
+  g_autoptr(MwsScheduleEntry) entry2 = mws_schedule_entry_new (":owner.1");
+  g_autoptr(MwsScheduleEntry) entry3 = mws_schedule_entry_new (":owner.2");
+
+  g_assert_true (mws_schedule_entry_get_owner (entry1) ==
+                 mws_schedule_entry_get_owner (entry2));
+  g_assert_true (mws_schedule_entry_get_owner (entry1) !=
+                 mws_schedule_entry_get_owner (entry3));
+
+  g_clear_object (&entry1);
+  g_assert_cmpstr (mws_schedule_entry_get_owner (entry2), ==, ":owner.1");
+  g_assert_cmpstr (mws_schedule_entry_get_owner (entry3), ==, ":owner.2");
+
+  g_clear_object (&entry2);
+  g_clear_object (&entry3);
+
+  /* The owners should be recreated after the last user of them has gone. */
+  g_autoptr(MwsScheduleEntry) entry4 = mws_schedule_entry_new (":owner.1");
+  g_assert_cmpstr (mws_schedule_entry_get_owner (entry4), ==, ":owner.1");
+}
+
 /* Check that g_object_get() and g_object_set() work on #MwsScheduleEntry
  * properties. */
 static void
@@ -238,6 +341,85 @@ test_schedule_entry_properties_resumable (void)
   g_assert_true (mws_schedule_entry_get_resumable (entry));
 }
 
+/* Test getting and setting the expected-size property. */
+static void
+test_schedule_entry_properties_expected_size (void)
+{
+  g_autoptr(MwsScheduleEntry) entry = mws_schedule_entry_new (":owner.1");
+
+  g_autoptr(MwsSignalLogger) logger = mws_signal_logger_new ();
+  mws_signal_logger_connect (logger, entry, "notify::expected-size");
+
+  g_assert_cmpuint (mws_schedule_entry_get_expected_size (entry), ==, 0);
+
+  mws_schedule_entry_set_expected_size (entry, 0);
+  mws_signal_logger_assert_no_emissions (logger);
+
+  mws_schedule_entry_set_expected_size (entry, G_MAXUINT64);
+  mws_signal_logger_assert_notify_emission_pop (logger, entry, "expected-size");
+  mws_signal_logger_assert_no_emissions (logger);
+
+  g_assert_cmpuint (mws_schedule_entry_get_expected_size (entry), ==, G_MAXUINT64);
+}
+
+/* Test getting and setting the deadline property. */
+static void
+test_schedule_entry_properties_deadline (void)
+{
+  g_autoptr(MwsScheduleEntry) entry = mws_schedule_entry_new (":owner.1");
+
+  g_autoptr(MwsSignalLogger) logger = mws_signal_logger_new ();
+  mws_signal_logger_connect (logger, entry, "notify::deadline");
+
+  g_assert_cmpuint (mws_schedule_entry_get_deadline (entry), ==, 0);
+
+  mws_schedule_entry_set_deadline (entry, 0);
+  mws_signal_logger_assert_no_emissions (logger);
+
+  mws_schedule_entry_set_deadline (entry, 1500000000);
+  mws_signal_logger_assert_notify_emission_pop (logger, entry, "deadline");
+  mws_signal_logger_assert_no_emissions (logger);
+
+  g_assert_cmpuint (mws_schedule_entry_get_deadline (entry), ==, 1500000000);
+}
+
+/* Test getting and setting the bind-to-connection and connection-id
+ * properties. */
+static void
+test_schedule_entry_properties_bind_to_connection (void)
+{
+  g_autoptr(MwsScheduleEntry) entry = mws_schedule_entry_new (":owner.1");
+
+  g_autoptr(MwsSignalLogger) logger = mws_signal_logger_new ();
+  mws_signal_logger_connect (logger, entry, "notify::bind-to-connection");
+  mws_signal_logger_connect (logger, entry, "notify::connection-id");
+
+  mws_schedule_entry_set_bind_to_connection (entry, FALSE);
+  mws_signal_logger_assert_no_emissions (logger);
+
+  mws_schedule_entry_set_bind_to_connection (entry, TRUE);
+  mws_signal_logger_assert_notify_emission_pop (logger, entry, "bind-to-connection");
+  mws_signal_logger_assert_no_emissions (logger);
+
+  g_assert_true (mws_schedule_entry_get_bind_to_connection (entry));
+
+  mws_schedule_entry_set_connection_id (entry, NULL);
+  mws_signal_logger_assert_no_emissions (logger);
+
+  mws_schedule_entry_set_connection_id (entry, "connection0");
+  mws_signal_logger_assert_notify_emission_pop (logger, entry, "connection-id");
+  mws_signal_logger_assert_no_emissions (logger);
+  g_assert_cmpstr (mws_schedule_entry_get_connection_id (entry), ==, "connection0");
+
+  mws_schedule_entry_set_connection_id (entry, "connection0");
+  mws_signal_logger_assert_no_emissions (logger);
+
+  mws_schedule_entry_set_connection_id (entry, NULL);
+  mws_signal_logger_assert_notify_emission_pop (logger, entry, "connection-id");
+  mws_signal_logger_assert_no_emissions (logger);
+  g_assert_null (mws_schedule_entry_get_connection_id (entry));
+}
+
 int
 main (int    argc,
       char **argv)
@@ -255,14 +437,24 @@ main (int    argc,
                    test_schedule_entry_construction_variant_unknown);
   g_test_add_func ("/schedule-entry/construction/variant/invalid-type",
                    test_schedule_entry_construction_variant_invalid_type);
+  g_test_add_func ("/schedule-entry/construction/with-id",
+                   test_schedule_entry_construction_with_id);
   g_test_add_func ("/schedule-entry/different-ids",
                    test_schedule_entry_different_ids);
+  g_test_add_func ("/schedule-entry/shared-owners",
+                   test_schedule_entry_shared_owners);
   g_test_add_func ("/schedule-entry/properties",
                    test_schedule_entry_properties);
   g_test_add_func ("/schedule-entry/properties/priority",
                    test_schedule_entry_properties_priority);
   g_test_add_func ("/schedule-entry/properties/resumable",
                    test_schedule_entry_properties_resumable);
+  g_test_add_func ("/schedule-entry/properties/expected-size",
+                   test_schedule_entry_properties_expected_size);
+  g_test_add_func ("/schedule-entry/properties/deadline",
+                   test_schedule_entry_properties_deadline);
+  g_test_add_func ("/schedule-entry/properties/bind-to-connection",
+                   test_schedule_entry_properties_bind_to_connection);
 
   return g_test_run ();
 }
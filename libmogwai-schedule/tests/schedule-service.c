@@ -25,6 +25,7 @@
 #include <glib.h>
 #include <gio/gio.h>
 #include <libmogwai-schedule/connection-monitor.h>
+#include <libmogwai-schedule/latency-histogram.h>
 #include <libmogwai-schedule/peer-manager.h>
 #include <libmogwai-schedule/scheduler.h>
 #include <libmogwai-schedule/schedule-service.h>
@@ -33,6 +34,7 @@
 #include <libmogwai-schedule/tests/connection-monitor-dummy.h>
 #include <libmogwai-schedule/tests/peer-manager-dummy.h>
 #include <locale.h>
+#include <string.h>
 
 
 static void
@@ -47,12 +49,18 @@ async_result_cb (GObject      *obj,
 /* A test fixture which creates an in-process #MwsScheduleService and all the
  * associated state management, a #GDBusConnection for it, and a
  * #GDBusConnection for the client. Both connections are on a private
- * #GTestDBus instance. */
+ * #GTestDBus instance.
+ *
+ * It also runs a fake polkit authority on a third connection, which authorises
+ * the peers in @authorized_names for every action, and nobody else. */
 typedef struct
 {
   GTestDBus *bus;  /* (owned) */
   GDBusConnection *server_connection;  /* (owned) */
   GDBusConnection *client_connection;  /* (owned) */
+  GDBusConnection *polkit_connection;  /* (owned) */
+  guint polkit_registration_id;
+  GHashTable *authorized_names;  /* (owned) (element-type utf8) */
   MwsConnectionMonitor *connection_monitor;  /* (owned) */
   MwsPeerManager *peer_manager;  /* (owned) */
   MwsClock *clock;  /* (owned) */
@@ -60,6 +68,58 @@ typedef struct
   MwsScheduleService *service;  /* (owned) */
 } BusFixture;
 
+static const gchar fake_authority_xml[] =
+  "<node>"
+    "<interface name='org.freedesktop.PolicyKit1.Authority'>"
+      "<method name='CheckAuthorization'>"
+        "<arg type='(sa{sv})' name='subject' direction='in'/>"
+        "<arg type='s' name='action_id' direction='in'/>"
+        "<arg type='a{ss}' name='details' direction='in'/>"
+        "<arg type='u' name='flags' direction='in'/>"
+        "<arg type='s' name='cancellation_id' direction='in'/>"
+        "<arg type='(bba{ss})' name='result' direction='out'/>"
+      "</method>"
+    "</interface>"
+  "</node>";
+
+static void
+fake_authority_method_call (GDBusConnection       *connection,
+                            const gchar           *sender,
+                            const gchar           *object_path,
+                            const gchar           *interface_name,
+                            const gchar           *method_name,
+                            GVariant              *parameters,
+                            GDBusMethodInvocation *invocation,
+                            gpointer               user_data)
+{
+  BusFixture *fixture = user_data;
+  const gchar *subject_kind;
+  g_autoptr(GVariant) subject_details = NULL;
+  const gchar *subject_name = NULL;
+
+  g_assert_cmpstr (method_name, ==, "CheckAuthorization");
+
+  g_variant_get (parameters, "((&s@a{sv})&sa{ss}u&s)",
+                 &subject_kind, &subject_details, NULL, NULL, NULL, NULL);
+  g_assert_cmpstr (subject_kind, ==, "system-bus-name");
+  g_assert_true (g_variant_lookup (subject_details, "name", "&s", &subject_name));
+
+  gboolean is_authorized = g_hash_table_contains (fixture->authorized_names,
+                                                  subject_name);
+
+  g_dbus_method_invocation_return_value (invocation,
+                                         g_variant_new ("((bba{ss}))",
+                                                        is_authorized, FALSE,
+                                                        NULL));
+}
+
+static const GDBusInterfaceVTable fake_authority_vtable =
+{
+  fake_authority_method_call,
+  NULL,  /* get_property */
+  NULL,  /* set_property */
+};
+
 static void
 bus_setup (BusFixture    *fixture,
            gconstpointer  test_data)
@@ -84,6 +144,46 @@ bus_setup (BusFixture    *fixture,
                                                                        &local_error);
   g_assert_no_error (local_error);
 
+  /* Set up the fake polkit authority. */
+  fixture->polkit_connection = g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (fixture->bus),
+                                                                       G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION |
+                                                                       G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+                                                                       NULL, NULL,
+                                                                       &local_error);
+  g_assert_no_error (local_error);
+
+  fixture->authorized_names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  g_autoptr(GDBusNodeInfo) authority_info = g_dbus_node_info_new_for_xml (fake_authority_xml,
+                                                                          &local_error);
+  g_assert_no_error (local_error);
+
+  fixture->polkit_registration_id =
+      g_dbus_connection_register_object (fixture->polkit_connection,
+                                         "/org/freedesktop/PolicyKit1/Authority",
+                                         authority_info->interfaces[0],
+                                         &fake_authority_vtable,
+                                         fixture, NULL, &local_error);
+  g_assert_no_error (local_error);
+
+  g_autoptr(GVariant) request_name_reply = NULL;
+  request_name_reply = g_dbus_connection_call_sync (fixture->polkit_connection,
+                                                    "org.freedesktop.DBus",
+                                                    "/org/freedesktop/DBus",
+                                                    "org.freedesktop.DBus",
+                                                    "RequestName",
+                                                    g_variant_new ("(su)",
+                                                                   "org.freedesktop.PolicyKit1",
+                                                                   4  /* DBUS_NAME_FLAG_DO_NOT_QUEUE */),
+                                                    G_VARIANT_TYPE ("(u)"),
+                                                    G_DBUS_CALL_FLAGS_NONE,
+                                                    -1, NULL, &local_error);
+  g_assert_no_error (local_error);
+
+  guint32 request_name_result;
+  g_variant_get (request_name_reply, "(u)", &request_name_result);
+  g_assert_cmpuint (request_name_result, ==, 1  /* DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER */);
+
   fixture->connection_monitor = MWS_CONNECTION_MONITOR (mws_connection_monitor_dummy_new ());
   fixture->peer_manager = MWS_PEER_MANAGER (mws_peer_manager_dummy_new (FALSE));
   fixture->clock = MWS_CLOCK (mws_clock_dummy_new ());
@@ -93,12 +193,14 @@ bus_setup (BusFixture    *fixture,
   mws_peer_manager_dummy_set_peer_credentials (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
                                                ":1.1", "/some/peer/path");
 
-  /* Construct the scheduler manually so we can set max-entries. */
+  /* Construct the scheduler manually so we can set max-entries and
+   * max-entries-per-owner. */
   fixture->scheduler = g_object_new (MWS_TYPE_SCHEDULER,
                                      "connection-monitor", fixture->connection_monitor,
                                      "peer-manager", fixture->peer_manager,
                                      "clock", fixture->clock,
                                      "max-entries", 10,
+                                     "max-entries-per-owner", 8,
                                      NULL);
 
   fixture->service = mws_schedule_service_new (fixture->server_connection, "/test",
@@ -130,6 +232,13 @@ bus_teardown (BusFixture    *fixture,
   g_assert_no_error (local_error);
   g_clear_object (&fixture->server_connection);
 
+  g_dbus_connection_unregister_object (fixture->polkit_connection,
+                                       fixture->polkit_registration_id);
+  g_dbus_connection_close_sync (fixture->polkit_connection, NULL, &local_error);
+  g_assert_no_error (local_error);
+  g_clear_object (&fixture->polkit_connection);
+  g_clear_pointer (&fixture->authorized_names, g_hash_table_unref);
+
   g_test_dbus_down (fixture->bus);
   g_clear_object (&fixture->bus);
 }
@@ -161,6 +270,34 @@ scheduler_call_method (BusFixture    *fixture,
                                         result, error);
 }
 
+/* Helper function to synchronously call a D-Bus method on the schedule entry
+ * at @entry_path using the #BusFixture.client_connection. */
+static GVariant *
+entry_call_method (BusFixture    *fixture,
+                   const gchar   *entry_path,
+                   const gchar   *method_name,
+                   GVariant      *parameters,
+                   GVariantType  *reply_type,
+                   GError       **error)
+{
+  g_assert (reply_type != NULL);
+
+  g_autoptr(GAsyncResult) result = NULL;
+  g_dbus_connection_call (fixture->client_connection,
+                          g_dbus_connection_get_unique_name (fixture->server_connection),
+                          entry_path,
+                          "com.endlessm.DownloadManager1.ScheduleEntry",
+                          method_name, parameters, reply_type,
+                          G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                          1000, NULL, async_result_cb, &result);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  return g_dbus_connection_call_finish (fixture->client_connection,
+                                        result, error);
+}
+
 /* Test a normal call to Schedule() succeeds. */
 static void
 test_service_dbus_schedule (BusFixture    *fixture,
@@ -339,6 +476,196 @@ test_service_dbus_schedule_entries_full (BusFixture    *fixture,
   g_assert_null (entry_paths_variant);
 }
 
+/* Test that ScheduleEntries() rejects entries which would take the calling peer
+ * over its own quota, without affecting other peers, and that the rejections are
+ * counted in the metrics. */
+static void
+test_service_dbus_schedule_entries_quota (BusFixture    *fixture,
+                                          gconstpointer  test_data)
+{
+  guint max_entries_per_owner;
+  g_autoptr(GError) local_error = NULL;
+
+  /* bus_setup() already sets a per-owner limit below the overall limit. */
+  g_object_get (G_OBJECT (fixture->scheduler),
+                "max-entries-per-owner", &max_entries_per_owner, NULL);
+  g_test_message ("max-entries-per-owner: %u", max_entries_per_owner);
+
+  /* Fill the peer’s quota. */
+  g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("aa{sv}"));
+
+  for (gsize i = 0; i < max_entries_per_owner; i++)
+    g_variant_builder_add (&builder, "a{sv}", NULL);
+
+  g_autoptr(GVariant) entry_paths_variant = NULL;
+  entry_paths_variant = scheduler_call_method (fixture, "ScheduleEntries",
+                                               g_variant_new ("(aa{sv})", &builder),
+                                               G_VARIANT_TYPE ("(ao)"),
+                                               &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (entry_paths_variant);
+
+  /* Any more from the same peer should be rejected, even though the scheduler
+   * as a whole isn’t full. */
+  g_autoptr(GVariant) entry_path_variant = NULL;
+  entry_path_variant = scheduler_call_method (fixture, "Schedule",
+                                              g_variant_new ("(a{sv})", NULL),
+                                              G_VARIANT_TYPE ("(o)"),
+                                              &local_error);
+  g_assert_error (local_error, MWS_SCHEDULER_ERROR, MWS_SCHEDULER_ERROR_FULL);
+  g_assert_null (entry_path_variant);
+  g_clear_error (&local_error);
+
+  g_assert_cmpuint (mws_scheduler_get_n_entries (fixture->scheduler), ==,
+                    max_entries_per_owner);
+
+  /* Another peer can still schedule entries. */
+  g_autoptr(GDBusConnection) other_connection = NULL;
+  other_connection = g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (fixture->bus),
+                                                             G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION |
+                                                             G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+                                                             NULL, NULL,
+                                                             &local_error);
+  g_assert_no_error (local_error);
+
+  mws_peer_manager_dummy_set_peer_credentials (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
+                                               g_dbus_connection_get_unique_name (other_connection),
+                                               "/some/other/path");
+
+  g_autoptr(GAsyncResult) other_result = NULL;
+  g_dbus_connection_call (other_connection,
+                          g_dbus_connection_get_unique_name (fixture->server_connection),
+                          "/test",
+                          "com.endlessm.DownloadManager1.Scheduler",
+                          "Schedule",
+                          g_variant_new ("(a{sv})", NULL),
+                          G_VARIANT_TYPE ("(o)"),
+                          G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                          1000, NULL, async_result_cb, &other_result);
+
+  while (other_result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_autoptr(GVariant) other_entry_path_variant = NULL;
+  other_entry_path_variant = g_dbus_connection_call_finish (other_connection,
+                                                            other_result, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (other_entry_path_variant);
+
+  /* Check the rejection was counted. */
+  g_autoptr(GAsyncResult) metrics_result = NULL;
+  g_dbus_connection_call (fixture->client_connection,
+                          g_dbus_connection_get_unique_name (fixture->server_connection),
+                          "/test",
+                          "com.endlessm.DownloadManager1.Metrics",
+                          "GetMetrics", NULL, G_VARIANT_TYPE ("(a{sv})"),
+                          G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                          1000, NULL, async_result_cb, &metrics_result);
+
+  while (metrics_result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_autoptr(GVariant) reply = NULL;
+  reply = g_dbus_connection_call_finish (fixture->client_connection,
+                                         metrics_result, &local_error);
+  g_assert_no_error (local_error);
+
+  g_autoptr(GVariant) metrics_variant = g_variant_get_child_value (reply, 0);
+  g_auto(GVariantDict) metrics = G_VARIANT_DICT_INIT (metrics_variant);
+  guint64 entries_rejected;
+
+  g_assert_true (g_variant_dict_lookup (&metrics, "EntriesRejected", "t", &entries_rejected));
+  g_assert_cmpuint (entries_rejected, ==, 1);
+}
+
+/* Test that ScheduleEntriesFull() returns the same initial properties for each
+ * new entry as a subsequent GetAll() call on that entry would. */
+static void
+test_service_dbus_schedule_entries_properties (BusFixture    *fixture,
+                                               gconstpointer  test_data)
+{
+  const guint32 priorities[] = { 5, 10 };
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GVariant) entries_variant = NULL;
+
+  g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("aa{sv}"));
+
+  for (gsize i = 0; i < G_N_ELEMENTS (priorities); i++)
+    {
+      g_auto(GVariantDict) dict;
+      g_variant_dict_init (&dict, NULL);
+      g_variant_dict_insert (&dict, "priority", "u", priorities[i]);
+      g_variant_builder_add (&builder, "@a{sv}", g_variant_dict_end (&dict));
+    }
+
+  entries_variant = scheduler_call_method (fixture, "ScheduleEntriesFull",
+                                           g_variant_new ("(aa{sv})", &builder),
+                                           G_VARIANT_TYPE ("(a(oa{sv}))"),
+                                           &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (entries_variant);
+
+  g_autoptr(GVariant) entries = g_variant_get_child_value (entries_variant, 0);
+  g_assert_cmpuint (g_variant_n_children (entries), ==, G_N_ELEMENTS (priorities));
+
+  for (gsize i = 0; i < g_variant_n_children (entries); i++)
+    {
+      const gchar *entry_path;
+      g_autoptr(GVariant) properties = NULL;
+      g_variant_get_child (entries, i, "(&o@a{sv})", &entry_path, &properties);
+
+      g_assert_cmpstr (entry_path, !=, "");
+
+      guint32 priority;
+      gboolean download_now;
+      guint64 max_rate;
+      guint64 download_starts_at;
+      g_assert_true (g_variant_lookup (properties, "Priority", "u", &priority));
+      g_assert_cmpuint (priority, ==, priorities[i]);
+      g_assert_true (g_variant_lookup (properties, "DownloadNow", "b", &download_now));
+      g_assert_true (g_variant_lookup (properties, "MaxRate", "t", &max_rate));
+      g_assert_cmpuint (max_rate, ==, 0);
+      g_assert_true (g_variant_lookup (properties, "DownloadStartsAt", "t", &download_starts_at));
+      g_assert_cmpuint (download_starts_at, ==, 0);
+
+      /* Compare against GetAll(). */
+      g_autoptr(GAsyncResult) result = NULL;
+      g_dbus_connection_call (fixture->client_connection,
+                              g_dbus_connection_get_unique_name (fixture->server_connection),
+                              entry_path,
+                              "org.freedesktop.DBus.Properties",
+                              "GetAll",
+                              g_variant_new ("(s)", "com.endlessm.DownloadManager1.ScheduleEntry"),
+                              G_VARIANT_TYPE ("(a{sv})"),
+                              G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                              1000, NULL, async_result_cb, &result);
+
+      while (result == NULL)
+        g_main_context_iteration (NULL, TRUE);
+
+      g_autoptr(GVariant) get_all_variant = NULL;
+      get_all_variant = g_dbus_connection_call_finish (fixture->client_connection,
+                                                       result, &local_error);
+      g_assert_no_error (local_error);
+
+      g_autoptr(GVariant) get_all_properties = g_variant_get_child_value (get_all_variant, 0);
+      g_assert_cmpuint (g_variant_n_children (properties), ==,
+                        g_variant_n_children (get_all_properties));
+
+      GVariantIter iter;
+      const gchar *key;
+      GVariant *value;
+      g_variant_iter_init (&iter, properties);
+      while (g_variant_iter_loop (&iter, "{&sv}", &key, &value))
+        {
+          g_autoptr(GVariant) get_all_value = NULL;
+          get_all_value = g_variant_lookup_value (get_all_properties, key, NULL);
+          g_assert_nonnull (get_all_value);
+          g_assert_true (g_variant_equal (value, get_all_value));
+        }
+    }
+}
+
 /* Test that Hold() and Release() affect mws_schedule_service_get_busy(). */
 static void
 test_service_dbus_hold_normal (BusFixture    *fixture,
@@ -433,6 +760,1217 @@ test_service_dbus_release_twice (BusFixture    *fixture,
   g_assert_false (mws_schedule_service_get_busy (fixture->service));
 }
 
+static void
+signal_cb (GDBusConnection *connection,
+           const gchar     *sender_name,
+           const gchar     *object_path,
+           const gchar     *interface_name,
+           const gchar     *signal_name,
+           GVariant        *parameters,
+           gpointer         user_data)
+{
+  GPtrArray *signals = user_data;
+  g_ptr_array_add (signals, g_variant_ref (parameters));
+}
+
+/* Test that after calling SubscribeActiveEntriesChanged(), a peer is sent a
+ * single ActiveEntriesChanged signal for a change in the active entries,
+ * rather than a PropertiesChanged signal for each of its entries. Also check
+ * that the ActiveEntryCount and EntryCount properties are kept up to date. */
+static void
+test_service_dbus_active_entries_changed (BusFixture    *fixture,
+                                          gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  g_autoptr(GPtrArray) active_entries_changed_signals = NULL;
+  active_entries_changed_signals = g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+  g_autoptr(GPtrArray) properties_changed_signals = NULL;
+  properties_changed_signals = g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+
+  guint active_entries_changed_id =
+      g_dbus_connection_signal_subscribe (fixture->client_connection,
+                                          NULL,  /* sender */
+                                          "com.endlessm.DownloadManager1.Scheduler",
+                                          "ActiveEntriesChanged",
+                                          "/test",
+                                          NULL,  /* arg0 */
+                                          G_DBUS_SIGNAL_FLAGS_NONE,
+                                          signal_cb,
+                                          active_entries_changed_signals, NULL);
+  guint properties_changed_id =
+      g_dbus_connection_signal_subscribe (fixture->client_connection,
+                                          NULL,  /* sender */
+                                          "org.freedesktop.DBus.Properties",
+                                          "PropertiesChanged",
+                                          NULL,  /* object path */
+                                          "com.endlessm.DownloadManager1.ScheduleEntry",
+                                          G_DBUS_SIGNAL_FLAGS_NONE,
+                                          signal_cb,
+                                          properties_changed_signals, NULL);
+
+  g_autoptr(GVariant) unit_variant = NULL;
+  unit_variant = scheduler_call_method (fixture, "SubscribeActiveEntriesChanged",
+                                        NULL,  /* no arguments */
+                                        G_VARIANT_TYPE_UNIT,
+                                        &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (unit_variant);
+
+  /* Schedule two entries. Only one can be active at once. */
+  g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("aa{sv}"));
+  g_variant_builder_add (&builder, "a{sv}", NULL);
+  g_variant_builder_add (&builder, "a{sv}", NULL);
+
+  g_autoptr(GVariant) entry_paths_variant = NULL;
+  entry_paths_variant = scheduler_call_method (fixture, "ScheduleEntries",
+                                               g_variant_new ("(aa{sv})", &builder),
+                                               G_VARIANT_TYPE ("(ao)"),
+                                               &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (entry_paths_variant);
+
+  g_autofree const gchar **entry_paths = NULL;
+  g_variant_get (entry_paths_variant, "(^a&o)", &entry_paths);
+  g_assert_cmpuint (g_strv_length ((gchar **) entry_paths), ==, 2);
+
+  while (active_entries_changed_signals->len == 0)
+    g_main_context_iteration (NULL, TRUE);
+
+  /* Do a round trip to make sure any other signals have been received. */
+  g_autoptr(GVariant) unit_variant2 = NULL;
+  unit_variant2 = scheduler_call_method (fixture, "SubscribeActiveEntriesChanged",
+                                         NULL,  /* no arguments */
+                                         G_VARIANT_TYPE_UNIT,
+                                         &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (unit_variant2);
+
+  g_assert_cmpuint (active_entries_changed_signals->len, ==, 1);
+  g_assert_cmpuint (properties_changed_signals->len, ==, 0);
+
+  g_autofree const gchar **added_paths = NULL;
+  g_autofree const gchar **removed_paths = NULL;
+  g_variant_get (active_entries_changed_signals->pdata[0], "(^a&o^a&o)",
+                 &added_paths, &removed_paths);
+  g_assert_cmpuint (g_strv_length ((gchar **) added_paths), ==, 1);
+  g_assert_true (g_strv_contains (entry_paths, added_paths[0]));
+  g_assert_cmpuint (g_strv_length ((gchar **) removed_paths), ==, 0);
+
+  /* Check the counts. */
+  g_autoptr(GAsyncResult) result = NULL;
+  g_dbus_connection_call (fixture->client_connection,
+                          g_dbus_connection_get_unique_name (fixture->server_connection),
+                          "/test",
+                          "org.freedesktop.DBus.Properties",
+                          "GetAll",
+                          g_variant_new ("(s)", "com.endlessm.DownloadManager1.Scheduler"),
+                          G_VARIANT_TYPE ("(a{sv})"),
+                          G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                          1000, NULL, async_result_cb, &result);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_autoptr(GVariant) properties_variant = NULL;
+  properties_variant = g_dbus_connection_call_finish (fixture->client_connection,
+                                                      result, &local_error);
+  g_assert_no_error (local_error);
+
+  g_autoptr(GVariant) properties = g_variant_get_child_value (properties_variant, 0);
+  guint32 entry_count, active_entry_count;
+  g_assert_true (g_variant_lookup (properties, "EntryCount", "u", &entry_count));
+  g_assert_true (g_variant_lookup (properties, "ActiveEntryCount", "u", &active_entry_count));
+  g_assert_cmpuint (entry_count, ==, 2);
+  g_assert_cmpuint (active_entry_count, ==, 1);
+
+  g_dbus_connection_signal_unsubscribe (fixture->client_connection, properties_changed_id);
+  g_dbus_connection_signal_unsubscribe (fixture->client_connection, active_entries_changed_id);
+}
+
+/* Count the PropertiesChanged signals in @signals which contain a change to
+ * the Priority property. */
+static guint
+count_priority_changes (GPtrArray *signals)
+{
+  guint n_changes = 0;
+
+  for (gsize i = 0; i < signals->len; i++)
+    {
+      g_autoptr(GVariant) changed_properties = NULL;
+      g_autoptr(GVariant) priority_variant = NULL;
+
+      g_variant_get (signals->pdata[i], "(&s@a{sv}^a&s)", NULL,
+                     &changed_properties, NULL);
+      priority_variant = g_variant_lookup_value (changed_properties, "Priority",
+                                                 G_VARIANT_TYPE_UINT32);
+      if (priority_variant != NULL)
+        n_changes++;
+    }
+
+  return n_changes;
+}
+
+static guint
+subscribe_properties_changed (GDBusConnection *connection,
+                              GPtrArray       *signals)
+{
+  return g_dbus_connection_signal_subscribe (connection,
+                                             NULL,  /* sender */
+                                             "org.freedesktop.DBus.Properties",
+                                             "PropertiesChanged",
+                                             NULL,  /* object path */
+                                             "com.endlessm.DownloadManager1.ScheduleEntry",
+                                             G_DBUS_SIGNAL_FLAGS_NONE,
+                                             signal_cb,
+                                             signals, NULL);
+}
+
+/* Test that PropertiesChanged signals for a schedule entry are sent to its
+ * owner, and to peers which have called Monitor(), but not to other peers on
+ * the bus. */
+static void
+test_service_dbus_entry_signals_unicast (BusFixture    *fixture,
+                                         gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  /* Set up two more connections: one which will be a monitor, and one which
+   * is an unrelated peer. */
+  g_autoptr(GDBusConnection) monitor_connection = NULL;
+  monitor_connection = g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (fixture->bus),
+                                                               G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION |
+                                                               G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+                                                               NULL, NULL,
+                                                               &local_error);
+  g_assert_no_error (local_error);
+
+  g_autoptr(GDBusConnection) other_connection = NULL;
+  other_connection = g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (fixture->bus),
+                                                             G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION |
+                                                             G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+                                                             NULL, NULL,
+                                                             &local_error);
+  g_assert_no_error (local_error);
+
+  mws_peer_manager_dummy_set_peer_credentials (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
+                                               g_dbus_connection_get_unique_name (monitor_connection),
+                                               "/some/monitor/path");
+  g_hash_table_add (fixture->authorized_names,
+                    g_strdup (g_dbus_connection_get_unique_name (monitor_connection)));
+
+  g_autoptr(GPtrArray) owner_signals = NULL;
+  owner_signals = g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+  g_autoptr(GPtrArray) monitor_signals = NULL;
+  monitor_signals = g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+  g_autoptr(GPtrArray) other_signals = NULL;
+  other_signals = g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+
+  guint owner_id = subscribe_properties_changed (fixture->client_connection, owner_signals);
+  guint monitor_id = subscribe_properties_changed (monitor_connection, monitor_signals);
+  guint other_id = subscribe_properties_changed (other_connection, other_signals);
+
+  /* Start monitoring. */
+  g_autoptr(GAsyncResult) monitor_result = NULL;
+  g_dbus_connection_call (monitor_connection,
+                          g_dbus_connection_get_unique_name (fixture->server_connection),
+                          "/test",
+                          "com.endlessm.DownloadManager1.Scheduler",
+                          "Monitor",
+                          NULL,  /* no arguments */
+                          G_VARIANT_TYPE_UNIT,
+                          G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                          1000, NULL, async_result_cb, &monitor_result);
+
+  while (monitor_result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_autoptr(GVariant) unit_variant = NULL;
+  unit_variant = g_dbus_connection_call_finish (monitor_connection,
+                                                monitor_result, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (unit_variant);
+
+  /* Schedule an entry from the client connection and change its priority. */
+  g_autoptr(GVariant) entry_path_variant = NULL;
+  entry_path_variant = scheduler_call_method (fixture, "Schedule",
+                                              g_variant_new ("(a{sv})", NULL),
+                                              G_VARIANT_TYPE ("(o)"),
+                                              &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (entry_path_variant);
+
+  const gchar *entry_path;
+  g_variant_get (entry_path_variant, "(&o)", &entry_path);
+
+  g_autoptr(GAsyncResult) set_result = NULL;
+  g_dbus_connection_call (fixture->client_connection,
+                          g_dbus_connection_get_unique_name (fixture->server_connection),
+                          entry_path,
+                          "org.freedesktop.DBus.Properties",
+                          "Set",
+                          g_variant_new ("(ssv)",
+                                         "com.endlessm.DownloadManager1.ScheduleEntry",
+                                         "Priority",
+                                         g_variant_new_uint32 (5)),
+                          G_VARIANT_TYPE_UNIT,
+                          G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                          1000, NULL, async_result_cb, &set_result);
+
+  while (set_result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_autoptr(GVariant) set_variant = NULL;
+  set_variant = g_dbus_connection_call_finish (fixture->client_connection,
+                                               set_result, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (set_variant);
+
+  while (count_priority_changes (owner_signals) == 0 ||
+         count_priority_changes (monitor_signals) == 0)
+    g_main_context_iteration (NULL, TRUE);
+
+  /* Do a round trip on the other connection to make sure any signals sent to
+   * it have been received. */
+  g_autoptr(GAsyncResult) ping_result = NULL;
+  g_dbus_connection_call (other_connection,
+                          g_dbus_connection_get_unique_name (fixture->server_connection),
+                          "/test",
+                          "org.freedesktop.DBus.Peer",
+                          "Ping",
+                          NULL,  /* no arguments */
+                          G_VARIANT_TYPE_UNIT,
+                          G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                          1000, NULL, async_result_cb, &ping_result);
+
+  while (ping_result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_autoptr(GVariant) ping_variant = NULL;
+  ping_variant = g_dbus_connection_call_finish (other_connection,
+                                                ping_result, &local_error);
+  g_assert_no_error (local_error);
+
+  g_assert_cmpuint (count_priority_changes (owner_signals), ==, 1);
+  g_assert_cmpuint (count_priority_changes (monitor_signals), ==, 1);
+  g_assert_cmpuint (other_signals->len, ==, 0);
+
+  g_dbus_connection_signal_unsubscribe (other_connection, other_id);
+  g_dbus_connection_signal_unsubscribe (monitor_connection, monitor_id);
+  g_dbus_connection_signal_unsubscribe (fixture->client_connection, owner_id);
+}
+
+/* Test that Monitor() is only allowed for peers which polkit authorises. */
+static void
+test_service_dbus_monitor_authorization (BusFixture    *fixture,
+                                         gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GVariant) unit_variant = NULL;
+
+  unit_variant = scheduler_call_method (fixture, "Monitor", NULL,
+                                        G_VARIANT_TYPE_UNIT, &local_error);
+  g_assert_error (local_error, G_DBUS_ERROR, G_DBUS_ERROR_ACCESS_DENIED);
+  g_assert_null (unit_variant);
+  g_clear_error (&local_error);
+
+  g_hash_table_add (fixture->authorized_names,
+                    g_strdup (g_dbus_connection_get_unique_name (fixture->client_connection)));
+
+  unit_variant = scheduler_call_method (fixture, "Monitor", NULL,
+                                        G_VARIANT_TYPE_UNIT, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (unit_variant);
+}
+
+/* Test that UpdateEntries() applies all the property changes it’s given, and
+ * that if any of them are invalid, none are applied. */
+static void
+test_service_dbus_update_entries (BusFixture    *fixture,
+                                  gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  /* Schedule some entries. */
+  g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("aa{sv}"));
+  g_variant_builder_add (&builder, "a{sv}", NULL);
+  g_variant_builder_add (&builder, "a{sv}", NULL);
+  g_variant_builder_add (&builder, "a{sv}", NULL);
+
+  g_autoptr(GVariant) entry_paths_variant = NULL;
+  entry_paths_variant = scheduler_call_method (fixture, "ScheduleEntries",
+                                               g_variant_new ("(aa{sv})", &builder),
+                                               G_VARIANT_TYPE ("(ao)"),
+                                               &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (entry_paths_variant);
+
+  g_autofree const gchar **entry_paths = NULL;
+  g_variant_get (entry_paths_variant, "(^a&o)", &entry_paths);
+  g_assert_cmpuint (g_strv_length ((gchar **) entry_paths), ==, 3);
+
+  MwsScheduleEntry *entries[3];
+  for (gsize i = 0; i < G_N_ELEMENTS (entries); i++)
+    {
+      g_assert_true (g_str_has_prefix (entry_paths[i], "/test/"));
+      entries[i] = mws_scheduler_get_entry (fixture->scheduler,
+                                            entry_paths[i] + strlen ("/test/"));
+      g_assert_nonnull (entries[i]);
+    }
+
+  /* Update all of them at once. */
+  g_auto(GVariantBuilder) updates_builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("a(oa{sv})"));
+  for (gsize i = 0; i < G_N_ELEMENTS (entries); i++)
+    {
+      g_auto(GVariantDict) dict = G_VARIANT_DICT_INIT (NULL);
+      g_variant_dict_insert (&dict, "Priority", "u", (guint32) (i + 10));
+      g_variant_dict_insert (&dict, "Resumable", "b", TRUE);
+      g_variant_dict_insert (&dict, "ExpectedSize", "t", (guint64) (i + 1) * 1000);
+      g_variant_builder_add (&updates_builder, "(o@a{sv})",
+                             entry_paths[i], g_variant_dict_end (&dict));
+    }
+
+  g_autoptr(GVariant) unit_variant = NULL;
+  unit_variant = scheduler_call_method (fixture, "UpdateEntries",
+                                        g_variant_new ("(a(oa{sv}))", &updates_builder),
+                                        G_VARIANT_TYPE_UNIT,
+                                        &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (unit_variant);
+
+  for (gsize i = 0; i < G_N_ELEMENTS (entries); i++)
+    {
+      g_assert_cmpuint (mws_schedule_entry_get_priority (entries[i]), ==, i + 10);
+      g_assert_true (mws_schedule_entry_get_resumable (entries[i]));
+      g_assert_cmpuint (mws_schedule_entry_get_expected_size (entries[i]), ==, (i + 1) * 1000);
+    }
+
+  /* Try an update where the second change is invalid. The first change must
+   * not be applied. */
+  const struct
+    {
+      const gchar *object_path;
+      const gchar *property_name;
+      GVariant *value;  /* (owned) (floating) */
+      GQuark expected_error_domain;
+      gint expected_error_code;
+    }
+  invalid_updates[] =
+    {
+      { entry_paths[1], "DownloadNow", g_variant_new_boolean (TRUE),
+        G_DBUS_ERROR, G_DBUS_ERROR_PROPERTY_READ_ONLY },
+      { entry_paths[1], "MaxRate", g_variant_new_uint64 (1000),
+        G_DBUS_ERROR, G_DBUS_ERROR_PROPERTY_READ_ONLY },
+      { entry_paths[1], "DownloadStartsAt", g_variant_new_uint64 (1000),
+        G_DBUS_ERROR, G_DBUS_ERROR_PROPERTY_READ_ONLY },
+      { entry_paths[1], "Priority", g_variant_new_boolean (TRUE),
+        G_DBUS_ERROR, G_DBUS_ERROR_INVALID_SIGNATURE },
+      { entry_paths[1], "NotAProperty", g_variant_new_boolean (TRUE),
+        G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY },
+      { "/test/not_an_entry", "Priority", g_variant_new_uint32 (1),
+        G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_OBJECT },
+      { "/not/the/service", "Priority", g_variant_new_uint32 (1),
+        G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_OBJECT },
+    };
+
+  for (gsize i = 0; i < G_N_ELEMENTS (invalid_updates); i++)
+    {
+      g_auto(GVariantBuilder) invalid_builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("a(oa{sv})"));
+      g_auto(GVariantDict) valid_dict = G_VARIANT_DICT_INIT (NULL);
+      g_auto(GVariantDict) invalid_dict = G_VARIANT_DICT_INIT (NULL);
+
+      g_test_message ("Invalid update %" G_GSIZE_FORMAT, i);
+
+      g_variant_dict_insert (&valid_dict, "Priority", "u", (guint32) 100);
+      g_variant_builder_add (&invalid_builder, "(o@a{sv})",
+                             entry_paths[0], g_variant_dict_end (&valid_dict));
+
+      g_variant_dict_insert_value (&invalid_dict, invalid_updates[i].property_name,
+                                   invalid_updates[i].value);
+      g_variant_builder_add (&invalid_builder, "(o@a{sv})",
+                             invalid_updates[i].object_path,
+                             g_variant_dict_end (&invalid_dict));
+
+      g_autoptr(GVariant) error_variant = NULL;
+      error_variant = scheduler_call_method (fixture, "UpdateEntries",
+                                             g_variant_new ("(a(oa{sv}))", &invalid_builder),
+                                             G_VARIANT_TYPE_UNIT,
+                                             &local_error);
+      g_assert_error (local_error, invalid_updates[i].expected_error_domain,
+                      invalid_updates[i].expected_error_code);
+      g_assert_null (error_variant);
+      g_clear_error (&local_error);
+
+      g_assert_cmpuint (mws_schedule_entry_get_priority (entries[0]), ==, 10);
+    }
+}
+
+/* Test that SetProperties() on an entry applies all the given properties, and
+ * that if any of them are invalid, none are applied. */
+static void
+test_service_dbus_entry_set_properties (BusFixture    *fixture,
+                                        gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  /* Schedule an entry. */
+  g_autoptr(GVariant) entry_path_variant = NULL;
+  entry_path_variant = scheduler_call_method (fixture, "Schedule",
+                                              g_variant_new ("(a{sv})", NULL),
+                                              G_VARIANT_TYPE ("(o)"),
+                                              &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (entry_path_variant);
+
+  const gchar *entry_path;
+  g_variant_get (entry_path_variant, "(&o)", &entry_path);
+  g_assert_true (g_str_has_prefix (entry_path, "/test/"));
+
+  MwsScheduleEntry *entry = mws_scheduler_get_entry (fixture->scheduler,
+                                                     entry_path + strlen ("/test/"));
+  g_assert_nonnull (entry);
+
+  /* Set several properties at once. */
+  g_auto(GVariantDict) dict = G_VARIANT_DICT_INIT (NULL);
+  g_variant_dict_insert (&dict, "Priority", "u", (guint32) 10);
+  g_variant_dict_insert (&dict, "Resumable", "b", TRUE);
+  g_variant_dict_insert (&dict, "ExpectedSize", "t", (guint64) 1000);
+
+  g_autoptr(GVariant) unit_variant = NULL;
+  unit_variant = entry_call_method (fixture, entry_path, "SetProperties",
+                                    g_variant_new ("(@a{sv})", g_variant_dict_end (&dict)),
+                                    G_VARIANT_TYPE_UNIT,
+                                    &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (unit_variant);
+
+  g_assert_cmpuint (mws_schedule_entry_get_priority (entry), ==, 10);
+  g_assert_true (mws_schedule_entry_get_resumable (entry));
+  g_assert_cmpuint (mws_schedule_entry_get_expected_size (entry), ==, 1000);
+
+  /* Try an update where the second property is invalid. The first must not be
+   * applied. */
+  g_auto(GVariantDict) invalid_dict = G_VARIANT_DICT_INIT (NULL);
+  g_variant_dict_insert (&invalid_dict, "Priority", "u", (guint32) 100);
+  g_variant_dict_insert (&invalid_dict, "DownloadNow", "b", TRUE);
+
+  g_autoptr(GVariant) error_variant = NULL;
+  error_variant = entry_call_method (fixture, entry_path, "SetProperties",
+                                     g_variant_new ("(@a{sv})", g_variant_dict_end (&invalid_dict)),
+                                     G_VARIANT_TYPE_UNIT,
+                                     &local_error);
+  g_assert_error (local_error, G_DBUS_ERROR, G_DBUS_ERROR_PROPERTY_READ_ONLY);
+  g_assert_null (error_variant);
+
+  g_assert_cmpuint (mws_schedule_entry_get_priority (entry), ==, 10);
+}
+
+/* Test that RemoveEntries() removes all the given entries, and that if any of
+ * them are unknown, none are removed. */
+static void
+test_service_dbus_remove_entries (BusFixture    *fixture,
+                                  gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  /* Schedule some entries. */
+  g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("aa{sv}"));
+  g_variant_builder_add (&builder, "a{sv}", NULL);
+  g_variant_builder_add (&builder, "a{sv}", NULL);
+  g_variant_builder_add (&builder, "a{sv}", NULL);
+
+  g_autoptr(GVariant) entry_paths_variant = NULL;
+  entry_paths_variant = scheduler_call_method (fixture, "ScheduleEntries",
+                                               g_variant_new ("(aa{sv})", &builder),
+                                               G_VARIANT_TYPE ("(ao)"),
+                                               &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (entry_paths_variant);
+
+  g_autofree const gchar **entry_paths = NULL;
+  g_variant_get (entry_paths_variant, "(^a&o)", &entry_paths);
+  g_assert_cmpuint (g_strv_length ((gchar **) entry_paths), ==, 3);
+  g_assert_cmpuint (g_hash_table_size (mws_scheduler_get_entries (fixture->scheduler)), ==, 3);
+
+  /* Try to remove two entries, one of which doesn’t exist. Nothing should be
+   * removed. */
+  const gchar *invalid_paths[] = { entry_paths[0], "/test/not_an_entry", NULL };
+
+  g_autoptr(GVariant) error_variant = NULL;
+  error_variant = scheduler_call_method (fixture, "RemoveEntries",
+                                         g_variant_new ("(^ao)", invalid_paths),
+                                         G_VARIANT_TYPE_UNIT,
+                                         &local_error);
+  g_assert_error (local_error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_OBJECT);
+  g_assert_null (error_variant);
+  g_clear_error (&local_error);
+
+  g_assert_cmpuint (g_hash_table_size (mws_scheduler_get_entries (fixture->scheduler)), ==, 3);
+
+  /* Remove two entries properly. */
+  const gchar *removed_paths[] = { entry_paths[0], entry_paths[2], NULL };
+
+  g_autoptr(GVariant) unit_variant = NULL;
+  unit_variant = scheduler_call_method (fixture, "RemoveEntries",
+                                        g_variant_new ("(^ao)", removed_paths),
+                                        G_VARIANT_TYPE_UNIT,
+                                        &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (unit_variant);
+
+  GHashTable *entries = mws_scheduler_get_entries (fixture->scheduler);
+  g_assert_cmpuint (g_hash_table_size (entries), ==, 1);
+  g_assert_nonnull (mws_scheduler_get_entry (fixture->scheduler,
+                                             entry_paths[1] + strlen ("/test/")));
+}
+
+/* Test that Preview() computes the active entries with the given overrides
+ * applied, without changing the real schedule, and that it rejects invalid
+ * overrides. */
+static void
+test_service_dbus_preview (BusFixture    *fixture,
+                           gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  /* Schedule an entry, which should become active since there are no
+   * connections to worry about. */
+  g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("aa{sv}"));
+  g_variant_builder_add (&builder, "a{sv}", NULL);
+
+  g_autoptr(GVariant) entry_paths_variant = NULL;
+  entry_paths_variant = scheduler_call_method (fixture, "ScheduleEntries",
+                                               g_variant_new ("(aa{sv})", &builder),
+                                               G_VARIANT_TYPE ("(ao)"),
+                                               &local_error);
+  g_assert_no_error (local_error);
+
+  g_autofree const gchar **entry_paths = NULL;
+  g_variant_get (entry_paths_variant, "(^a&o)", &entry_paths);
+  MwsScheduleEntry *entry = mws_scheduler_get_entry (fixture->scheduler,
+                                                     entry_paths[0] + strlen ("/test/"));
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry));
+
+  /* Preview() is refused until polkit authorises the caller. */
+  g_autoptr(GVariant) unauthorized_variant = NULL;
+  unauthorized_variant = scheduler_call_method (fixture, "Preview",
+                                                g_variant_new_parsed ("(@a{sv} {},)"),
+                                                G_VARIANT_TYPE ("(aot)"),
+                                                &local_error);
+  g_assert_error (local_error, G_DBUS_ERROR, G_DBUS_ERROR_ACCESS_DENIED);
+  g_assert_null (unauthorized_variant);
+  g_clear_error (&local_error);
+
+  g_hash_table_add (fixture->authorized_names,
+                    g_strdup (g_dbus_connection_get_unique_name (fixture->client_connection)));
+
+  /* With no overrides, the preview should match the real schedule. */
+  g_autoptr(GVariant) preview1_variant = NULL;
+  preview1_variant = scheduler_call_method (fixture, "Preview",
+                                            g_variant_new_parsed ("(@a{sv} {},)"),
+                                            G_VARIANT_TYPE ("(aot)"),
+                                            &local_error);
+  g_assert_no_error (local_error);
+
+  g_autofree const gchar **active_paths = NULL;
+  guint64 next_reschedule;
+  g_variant_get (preview1_variant, "(^a&ot)", &active_paths, &next_reschedule);
+  g_assert_cmpuint (g_strv_length ((gchar **) active_paths), ==, 1);
+  g_assert_cmpstr (active_paths[0], ==, entry_paths[0]);
+  g_assert_cmpuint (next_reschedule, ==, 0);
+  g_clear_pointer (&active_paths, g_free);
+
+  /* If a metered connection appeared at a different time, nothing would be
+   * active. */
+  g_autoptr(GVariant) preview2_variant = NULL;
+  preview2_variant = scheduler_call_method (fixture, "Preview",
+                                            g_variant_new_parsed ("({'Time': <uint64 1517616000>, "
+                                                                  "'Connections': <{'connection0': {'Metered': <uint32 1>}}>},)"),
+                                            G_VARIANT_TYPE ("(aot)"),
+                                            &local_error);
+  g_assert_no_error (local_error);
+
+  g_variant_get (preview2_variant, "(^a&ot)", &active_paths, &next_reschedule);
+  g_assert_cmpuint (g_strv_length ((gchar **) active_paths), ==, 0);
+  g_assert_cmpuint (next_reschedule, ==, 0);
+
+  /* The real schedule shouldn’t have changed. */
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry));
+
+  /* Invalid overrides should be rejected. */
+  const gchar *invalid_overrides[] =
+    {
+      "({'NotAnOverride': <true>},)",
+      "({'Time': <'not a time'>},)",
+      "({'Time': <uint64 0>},)",
+      "({'Connections': <{'connection0': {'Metered': <uint32 100>}}>},)",
+      "({'Connections': <{'connection0': {'NotAnOverride': <true>}}>},)",
+      "({'Connections': <{'connection0': {'Tariff': <'not a tariff'>}}>},)",
+    };
+
+  for (gsize i = 0; i < G_N_ELEMENTS (invalid_overrides); i++)
+    {
+      g_autoptr(GVariant) error_variant = NULL;
+
+      g_test_message ("Invalid overrides %" G_GSIZE_FORMAT ": %s",
+                      i, invalid_overrides[i]);
+
+      error_variant = scheduler_call_method (fixture, "Preview",
+                                             g_variant_new_parsed (invalid_overrides[i]),
+                                             G_VARIANT_TYPE ("(aot)"),
+                                             &local_error);
+      g_assert_error (local_error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS);
+      g_assert_null (error_variant);
+      g_clear_error (&local_error);
+    }
+}
+
+/* Test that GetMetrics() on the Metrics interface returns counters which
+ * reflect the entries which have been added and removed. */
+static void
+test_service_dbus_metrics (BusFixture    *fixture,
+                           gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  /* Schedule some entries and remove one of them. */
+  g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("aa{sv}"));
+  g_variant_builder_add (&builder, "a{sv}", NULL);
+  g_variant_builder_add (&builder, "a{sv}", NULL);
+  g_variant_builder_add (&builder, "a{sv}", NULL);
+
+  g_autoptr(GVariant) entry_paths_variant = NULL;
+  entry_paths_variant = scheduler_call_method (fixture, "ScheduleEntries",
+                                               g_variant_new ("(aa{sv})", &builder),
+                                               G_VARIANT_TYPE ("(ao)"),
+                                               &local_error);
+  g_assert_no_error (local_error);
+
+  g_autofree const gchar **entry_paths = NULL;
+  g_variant_get (entry_paths_variant, "(^a&o)", &entry_paths);
+  const gchar *removed_paths[] = { entry_paths[0], NULL };
+
+  g_autoptr(GVariant) unit_variant = NULL;
+  unit_variant = scheduler_call_method (fixture, "RemoveEntries",
+                                        g_variant_new ("(^ao)", removed_paths),
+                                        G_VARIANT_TYPE_UNIT,
+                                        &local_error);
+  g_assert_no_error (local_error);
+
+  /* Get the metrics. */
+  g_autoptr(GAsyncResult) result = NULL;
+  g_dbus_connection_call (fixture->client_connection,
+                          g_dbus_connection_get_unique_name (fixture->server_connection),
+                          "/test",
+                          "com.endlessm.DownloadManager1.Metrics",
+                          "GetMetrics", NULL, G_VARIANT_TYPE ("(a{sv})"),
+                          G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                          1000, NULL, async_result_cb, &result);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_autoptr(GVariant) reply = NULL;
+  reply = g_dbus_connection_call_finish (fixture->client_connection,
+                                         result, &local_error);
+  g_assert_no_error (local_error);
+
+  g_autoptr(GVariant) metrics_variant = g_variant_get_child_value (reply, 0);
+  g_auto(GVariantDict) metrics = G_VARIANT_DICT_INIT (metrics_variant);
+  guint64 entries_added, entries_removed, reschedule_count;
+
+  g_assert_true (g_variant_dict_lookup (&metrics, "EntriesAdded", "t", &entries_added));
+  g_assert_cmpuint (entries_added, ==, 3);
+  g_assert_true (g_variant_dict_lookup (&metrics, "EntriesRemoved", "t", &entries_removed));
+  g_assert_cmpuint (entries_removed, ==, 1);
+  g_assert_true (g_variant_dict_lookup (&metrics, "RescheduleCount", "t", &reschedule_count));
+  g_assert_cmpuint (reschedule_count, >=, 2);
+
+  /* Check the histogram format. */
+  g_autoptr(GVariant) latency_variant = NULL;
+  latency_variant = g_variant_dict_lookup_value (&metrics, "RescheduleLatency",
+                                                 G_VARIANT_TYPE_VARDICT);
+  g_assert_nonnull (latency_variant);
+
+  g_auto(GVariantDict) latency = G_VARIANT_DICT_INIT (latency_variant);
+  guint64 count;
+  g_assert_true (g_variant_dict_lookup (&latency, "Count", "t", &count));
+  g_assert_cmpuint (count, ==, reschedule_count);
+
+  g_autoptr(GVariant) buckets_variant = NULL;
+  buckets_variant = g_variant_dict_lookup_value (&latency, "Buckets",
+                                                 G_VARIANT_TYPE ("at"));
+  g_assert_nonnull (buckets_variant);
+
+  gsize n_buckets;
+  const guint64 *buckets = g_variant_get_fixed_array (buckets_variant, &n_buckets,
+                                                      sizeof (guint64));
+  guint64 bucket_total = 0;
+  g_assert_cmpuint (n_buckets, ==, MWS_LATENCY_HISTOGRAM_N_BUCKETS);
+  for (gsize i = 0; i < n_buckets; i++)
+    bucket_total += buckets[i];
+  g_assert_cmpuint (bucket_total, ==, count);
+
+  g_assert_true (g_variant_dict_contains (&metrics, "SignalsEmitted"));
+  g_assert_true (g_variant_dict_contains (&metrics, "PeerCredentialsLatency"));
+  g_assert_true (g_variant_dict_contains (&metrics, "MainLoopLag"));
+
+  /* The dummy connection monitor doesn’t parse tariffs. */
+  g_assert_false (g_variant_dict_contains (&metrics, "TariffParseTime"));
+}
+
+/* Helper function to synchronously call GetManagedObjects() on the scheduler
+ * from @connection. */
+static GVariant *
+get_managed_objects (BusFixture       *fixture,
+                     GDBusConnection  *connection,
+                     GError          **error)
+{
+  g_autoptr(GAsyncResult) result = NULL;
+  g_dbus_connection_call (connection,
+                          g_dbus_connection_get_unique_name (fixture->server_connection),
+                          "/test",
+                          "org.freedesktop.DBus.ObjectManager",
+                          "GetManagedObjects", NULL,
+                          G_VARIANT_TYPE ("(a{oa{sa{sv}}})"),
+                          G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                          1000, NULL, async_result_cb, &result);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  return g_dbus_connection_call_finish (connection, result, error);
+}
+
+/* Test that GetManagedObjects() returns all the entries owned by the caller,
+ * with their properties, but none of the entries owned by other peers unless
+ * the caller is an authorised monitor; and that InterfacesAdded and
+ * InterfacesRemoved signals are sent for entries as they are added and
+ * removed. */
+static void
+test_service_dbus_get_managed_objects (BusFixture    *fixture,
+                                       gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  g_autoptr(GDBusConnection) other_connection = NULL;
+  other_connection = g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (fixture->bus),
+                                                             G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION |
+                                                             G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+                                                             NULL, NULL,
+                                                             &local_error);
+  g_assert_no_error (local_error);
+
+  g_autoptr(GPtrArray) added_signals = NULL;
+  added_signals = g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+  g_autoptr(GPtrArray) removed_signals = NULL;
+  removed_signals = g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+
+  guint added_id =
+      g_dbus_connection_signal_subscribe (fixture->client_connection,
+                                          NULL,  /* sender */
+                                          "org.freedesktop.DBus.ObjectManager",
+                                          "InterfacesAdded",
+                                          "/test",
+                                          NULL,  /* arg0 */
+                                          G_DBUS_SIGNAL_FLAGS_NONE,
+                                          signal_cb,
+                                          added_signals, NULL);
+  guint removed_id =
+      g_dbus_connection_signal_subscribe (fixture->client_connection,
+                                          NULL,  /* sender */
+                                          "org.freedesktop.DBus.ObjectManager",
+                                          "InterfacesRemoved",
+                                          "/test",
+                                          NULL,  /* arg0 */
+                                          G_DBUS_SIGNAL_FLAGS_NONE,
+                                          signal_cb,
+                                          removed_signals, NULL);
+
+  /* There are no entries to start with. */
+  g_autoptr(GVariant) objects_variant = NULL;
+  objects_variant = get_managed_objects (fixture, fixture->client_connection,
+                                         &local_error);
+  g_assert_no_error (local_error);
+
+  g_autoptr(GVariant) objects = g_variant_get_child_value (objects_variant, 0);
+  g_assert_cmpuint (g_variant_n_children (objects), ==, 0);
+  g_clear_pointer (&objects, g_variant_unref);
+  g_clear_pointer (&objects_variant, g_variant_unref);
+
+  /* Schedule two entries from the client connection, and one from the other
+   * connection. */
+  g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("aa{sv}"));
+  g_variant_builder_add_parsed (&builder, "{'priority': <@u 5>}");
+  g_variant_builder_add (&builder, "a{sv}", NULL);
+
+  g_autoptr(GVariant) entry_paths_variant = NULL;
+  entry_paths_variant = scheduler_call_method (fixture, "ScheduleEntries",
+                                               g_variant_new ("(aa{sv})", &builder),
+                                               G_VARIANT_TYPE ("(ao)"),
+                                               &local_error);
+  g_assert_no_error (local_error);
+
+  g_autofree const gchar **entry_paths = NULL;
+  g_variant_get (entry_paths_variant, "(^a&o)", &entry_paths);
+  g_assert_cmpuint (g_strv_length ((gchar **) entry_paths), ==, 2);
+
+  mws_peer_manager_dummy_set_peer_credentials (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
+                                               g_dbus_connection_get_unique_name (other_connection),
+                                               "/some/other/path");
+
+  g_autoptr(GAsyncResult) other_result = NULL;
+  g_dbus_connection_call (other_connection,
+                          g_dbus_connection_get_unique_name (fixture->server_connection),
+                          "/test",
+                          "com.endlessm.DownloadManager1.Scheduler",
+                          "Schedule",
+                          g_variant_new ("(a{sv})", NULL),
+                          G_VARIANT_TYPE ("(o)"),
+                          G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                          1000, NULL, async_result_cb, &other_result);
+
+  while (other_result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_autoptr(GVariant) other_entry_path_variant = NULL;
+  other_entry_path_variant = g_dbus_connection_call_finish (other_connection,
+                                                            other_result, &local_error);
+  g_assert_no_error (local_error);
+
+  const gchar *other_entry_path;
+  g_variant_get (other_entry_path_variant, "(&o)", &other_entry_path);
+
+  /* The client connection should only see its own entries. */
+  objects_variant = get_managed_objects (fixture, fixture->client_connection,
+                                         &local_error);
+  g_assert_no_error (local_error);
+
+  objects = g_variant_get_child_value (objects_variant, 0);
+  g_assert_cmpuint (g_variant_n_children (objects), ==, 2);
+
+  g_autoptr(GVariant) interfaces = NULL;
+  g_assert_false (g_variant_lookup (objects, other_entry_path, "@a{sa{sv}}", NULL));
+  g_assert_true (g_variant_lookup (objects, entry_paths[0], "@a{sa{sv}}", &interfaces));
+  g_assert_cmpuint (g_variant_n_children (interfaces), ==, 1);
+
+  g_autoptr(GVariant) properties = NULL;
+  guint32 priority;
+  g_assert_true (g_variant_lookup (interfaces,
+                                   "com.endlessm.DownloadManager1.ScheduleEntry",
+                                   "@a{sv}", &properties));
+  g_assert_true (g_variant_lookup (properties, "Priority", "u", &priority));
+  g_assert_cmpuint (priority, ==, 5);
+  g_assert_true (g_variant_lookup (objects, entry_paths[1], "@a{sa{sv}}", NULL));
+
+  g_clear_pointer (&objects, g_variant_unref);
+  g_clear_pointer (&objects_variant, g_variant_unref);
+
+  /* And the other connection should only see its entry. */
+  objects_variant = get_managed_objects (fixture, other_connection, &local_error);
+  g_assert_no_error (local_error);
+
+  objects = g_variant_get_child_value (objects_variant, 0);
+  g_assert_cmpuint (g_variant_n_children (objects), ==, 1);
+  g_assert_true (g_variant_lookup (objects, other_entry_path, "@a{sa{sv}}", NULL));
+
+  g_clear_pointer (&objects, g_variant_unref);
+  g_clear_pointer (&objects_variant, g_variant_unref);
+
+  /* A denied Monitor() call must not widen the client connection’s view; once
+   * polkit authorises it as a monitor, it should see all the entries. */
+  g_autoptr(GVariant) monitor_variant = NULL;
+  monitor_variant = scheduler_call_method (fixture, "Monitor", NULL,
+                                           G_VARIANT_TYPE_UNIT, &local_error);
+  g_assert_error (local_error, G_DBUS_ERROR, G_DBUS_ERROR_ACCESS_DENIED);
+  g_assert_null (monitor_variant);
+  g_clear_error (&local_error);
+
+  objects_variant = get_managed_objects (fixture, fixture->client_connection,
+                                         &local_error);
+  g_assert_no_error (local_error);
+
+  objects = g_variant_get_child_value (objects_variant, 0);
+  g_assert_cmpuint (g_variant_n_children (objects), ==, 2);
+
+  g_clear_pointer (&objects, g_variant_unref);
+  g_clear_pointer (&objects_variant, g_variant_unref);
+
+  g_hash_table_add (fixture->authorized_names,
+                    g_strdup (g_dbus_connection_get_unique_name (fixture->client_connection)));
+  monitor_variant = scheduler_call_method (fixture, "Monitor", NULL,
+                                           G_VARIANT_TYPE_UNIT, &local_error);
+  g_assert_no_error (local_error);
+
+  objects_variant = get_managed_objects (fixture, fixture->client_connection,
+                                         &local_error);
+  g_assert_no_error (local_error);
+
+  objects = g_variant_get_child_value (objects_variant, 0);
+  g_assert_cmpuint (g_variant_n_children (objects), ==, 3);
+  g_assert_true (g_variant_lookup (objects, other_entry_path, "@a{sa{sv}}", NULL));
+
+  /* The client connection should have been told about its own entries being
+   * added, and then about them being removed. */
+  while (added_signals->len < 2)
+    g_main_context_iteration (NULL, TRUE);
+
+  const gchar *removed_paths[] = { entry_paths[0], NULL };
+  g_autoptr(GVariant) unit_variant = NULL;
+  unit_variant = scheduler_call_method (fixture, "RemoveEntries",
+                                        g_variant_new ("(^ao)", removed_paths),
+                                        G_VARIANT_TYPE_UNIT,
+                                        &local_error);
+  g_assert_no_error (local_error);
+
+  while (removed_signals->len < 1)
+    g_main_context_iteration (NULL, TRUE);
+
+  const gchar *signal_path;
+  g_autofree const gchar **signal_interfaces = NULL;
+
+  g_assert_cmpuint (added_signals->len, ==, 2);
+  g_variant_get (added_signals->pdata[0], "(&o@a{sa{sv}})", &signal_path, NULL);
+  g_assert_true (g_str_equal (signal_path, entry_paths[0]) ||
+                 g_str_equal (signal_path, entry_paths[1]));
+
+  g_assert_cmpuint (removed_signals->len, ==, 1);
+  g_variant_get (removed_signals->pdata[0], "(&o^a&s)", &signal_path, &signal_interfaces);
+  g_assert_cmpstr (signal_path, ==, entry_paths[0]);
+  g_assert_cmpuint (g_strv_length ((gchar **) signal_interfaces), ==, 1);
+  g_assert_cmpstr (signal_interfaces[0], ==, "com.endlessm.DownloadManager1.ScheduleEntry");
+
+  g_dbus_connection_signal_unsubscribe (fixture->client_connection, removed_id);
+  g_dbus_connection_signal_unsubscribe (fixture->client_connection, added_id);
+}
+
+/* Helper function to synchronously call Schedule() with @parameters (of type
+ * `a{sv}`) from @connection, returning the new entry’s object path. */
+static gchar *
+schedule_from_connection (BusFixture      *fixture,
+                          GDBusConnection *connection,
+                          GVariant        *parameters)
+{
+  g_autoptr(GAsyncResult) result = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  g_dbus_connection_call (connection,
+                          g_dbus_connection_get_unique_name (fixture->server_connection),
+                          "/test",
+                          "com.endlessm.DownloadManager1.Scheduler",
+                          "Schedule",
+                          g_variant_new ("(@a{sv})", parameters),
+                          G_VARIANT_TYPE ("(o)"),
+                          G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                          1000, NULL, async_result_cb, &result);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_autoptr(GVariant) entry_path_variant = NULL;
+  entry_path_variant = g_dbus_connection_call_finish (connection, result, &local_error);
+  g_assert_no_error (local_error);
+
+  gchar *entry_path = NULL;
+  g_variant_get (entry_path_variant, "(o)", &entry_path);
+
+  return entry_path;
+}
+
+/* Get the object path an entry at @entry_path will have once its ID has been
+ * shifted by @offset. */
+static gchar *
+shift_entry_path (const gchar *entry_path,
+                  guint64      offset)
+{
+  g_assert_true (g_str_has_prefix (entry_path, "/test/"));
+  guint64 id = g_ascii_strtoull (entry_path + strlen ("/test/"), NULL, 10);
+
+  return g_strdup_printf ("/test/%" G_GUINT64_FORMAT, id + offset);
+}
+
+/* Test that the state saved by mws_schedule_service_save_state() can be
+ * restored into a new service using mws_schedule_service_restore_state_async(),
+ * as happens when the daemon is restarted: the entries keep their owners and
+ * parameters, monitors are kept, and anything belonging to a peer which has
+ * vanished in the meantime is dropped. */
+static void
+test_service_save_restore_state (BusFixture    *fixture,
+                                 gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+  const gchar *client_name = g_dbus_connection_get_unique_name (fixture->client_connection);
+
+  g_autoptr(GDBusConnection) other_connection = NULL;
+  other_connection = g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (fixture->bus),
+                                                             G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION |
+                                                             G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+                                                             NULL, NULL,
+                                                             &local_error);
+  g_assert_no_error (local_error);
+  g_autoptr(GDBusConnection) vanishing_connection = NULL;
+  vanishing_connection = g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (fixture->bus),
+                                                                 G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION |
+                                                                 G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+                                                                 NULL, NULL,
+                                                                 &local_error);
+  g_assert_no_error (local_error);
+
+  g_autofree gchar *other_name = g_strdup (g_dbus_connection_get_unique_name (other_connection));
+  mws_peer_manager_dummy_set_peer_credentials (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
+                                               other_name, "/some/other/path");
+  mws_peer_manager_dummy_set_peer_credentials (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
+                                               g_dbus_connection_get_unique_name (vanishing_connection),
+                                               "/some/vanishing/path");
+
+  /* Make the client a monitor, and schedule two entries from it and one from
+   * each of the other connections. */
+  g_hash_table_add (fixture->authorized_names, g_strdup (client_name));
+  g_autoptr(GVariant) monitor_variant = NULL;
+  monitor_variant = scheduler_call_method (fixture, "Monitor", NULL,
+                                           G_VARIANT_TYPE_UNIT, &local_error);
+  g_assert_no_error (local_error);
+
+  g_autofree gchar *client_entry_path1 =
+      schedule_from_connection (fixture, fixture->client_connection,
+                                g_variant_new_parsed ("{'priority': <@u 5>}"));
+  g_autofree gchar *client_entry_path2 =
+      schedule_from_connection (fixture, fixture->client_connection,
+                                g_variant_new ("a{sv}", NULL));
+  g_autofree gchar *other_entry_path =
+      schedule_from_connection (fixture, other_connection,
+                                g_variant_new ("a{sv}", NULL));
+  g_autofree gchar *vanishing_entry_path =
+      schedule_from_connection (fixture, vanishing_connection,
+                                g_variant_new ("a{sv}", NULL));
+
+  g_autoptr(GVariant) state = g_variant_ref_sink (mws_schedule_service_save_state (fixture->service));
+
+  g_autoptr(GVariant) entries_variant = NULL;
+  entries_variant = g_variant_lookup_value (state, "entries", G_VARIANT_TYPE ("a(ssa{sv})"));
+  g_assert_nonnull (entries_variant);
+  g_assert_cmpuint (g_variant_n_children (entries_variant), ==, 4);
+
+  g_autofree const gchar **monitors = NULL;
+  g_assert_true (g_variant_lookup (state, "monitors", "^a&s", &monitors));
+  g_assert_cmpuint (g_strv_length ((gchar **) monitors), ==, 1);
+  g_assert_cmpstr (monitors[0], ==, client_name);
+
+  /* IDs can’t be re-used within a process (see
+   * mws_schedule_entry_new_with_id()), so shift the saved IDs past all the ones
+   * used so far, as if the state were being loaded by a new process. */
+  GVariantIter iter;
+  const gchar *entry_id, *owner;
+  GVariant *parameters;
+  guint64 offset = 0;
+
+  g_variant_iter_init (&iter, entries_variant);
+  while (g_variant_iter_next (&iter, "(&s&s@a{sv})", &entry_id, &owner, &parameters))
+    {
+      offset = MAX (offset, g_ascii_strtoull (entry_id, NULL, 10) + 1);
+      g_variant_unref (parameters);
+    }
+
+  g_auto(GVariantBuilder) entries_builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("a(ssa{sv})"));
+
+  g_variant_iter_init (&iter, entries_variant);
+  while (g_variant_iter_next (&iter, "(&s&s@a{sv})", &entry_id, &owner, &parameters))
+    {
+      g_autofree gchar *shifted_id = NULL;
+      shifted_id = g_strdup_printf ("%" G_GUINT64_FORMAT,
+                                    g_ascii_strtoull (entry_id, NULL, 10) + offset);
+      g_variant_builder_add (&entries_builder, "(ss@a{sv})",
+                             shifted_id, owner, parameters);
+      g_variant_unref (parameters);
+    }
+
+  g_auto(GVariantDict) state_dict = G_VARIANT_DICT_INIT (state);
+  g_variant_dict_insert_value (&state_dict, "entries",
+                               g_variant_builder_end (&entries_builder));
+
+  /* Replace the service and scheduler with new ones, as if the daemon had been
+   * restarted. One of the peers has vanished in the meantime, so the new peer
+   * manager doesn’t know about it. */
+  g_dbus_connection_close_sync (vanishing_connection, NULL, &local_error);
+  g_assert_no_error (local_error);
+
+  mws_schedule_service_unregister (fixture->service);
+  g_clear_object (&fixture->service);
+  g_clear_object (&fixture->scheduler);
+  g_clear_object (&fixture->peer_manager);
+
+  fixture->peer_manager = MWS_PEER_MANAGER (mws_peer_manager_dummy_new (FALSE));
+  mws_peer_manager_dummy_set_peer_credentials (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
+                                               client_name, "/some/peer/path");
+  mws_peer_manager_dummy_set_peer_credentials (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
+                                               other_name, "/some/other/path");
+
+  fixture->scheduler = g_object_new (MWS_TYPE_SCHEDULER,
+                                     "connection-monitor", fixture->connection_monitor,
+                                     "peer-manager", fixture->peer_manager,
+                                     "clock", fixture->clock,
+                                     "max-entries", 10,
+                                     "max-entries-per-owner", 8,
+                                     NULL);
+  fixture->service = mws_schedule_service_new (fixture->server_connection, "/test",
+                                               fixture->scheduler);
+
+  g_autoptr(GAsyncResult) result = NULL;
+  mws_schedule_service_restore_state_async (fixture->service,
+                                            g_variant_dict_end (&state_dict),
+                                            NULL, async_result_cb, &result);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_true (mws_schedule_service_restore_state_finish (fixture->service,
+                                                            result, &local_error));
+  g_assert_no_error (local_error);
+
+  g_assert_true (mws_schedule_service_register (fixture->service, &local_error));
+  g_assert_no_error (local_error);
+
+  /* The client is still a monitor, so it should see all the entries except
+   * the one whose owner vanished, with their parameters intact. */
+  g_autofree gchar *shifted_client_entry_path1 = shift_entry_path (client_entry_path1, offset);
+  g_autofree gchar *shifted_client_entry_path2 = shift_entry_path (client_entry_path2, offset);
+  g_autofree gchar *shifted_other_entry_path = shift_entry_path (other_entry_path, offset);
+  g_autofree gchar *shifted_vanishing_entry_path = shift_entry_path (vanishing_entry_path, offset);
+
+  g_autoptr(GVariant) objects_variant = NULL;
+  objects_variant = get_managed_objects (fixture, fixture->client_connection,
+                                         &local_error);
+  g_assert_no_error (local_error);
+
+  g_autoptr(GVariant) objects = g_variant_get_child_value (objects_variant, 0);
+  g_assert_cmpuint (g_variant_n_children (objects), ==, 3);
+  g_assert_true (g_variant_lookup (objects, shifted_client_entry_path2, "@a{sa{sv}}", NULL));
+  g_assert_true (g_variant_lookup (objects, shifted_other_entry_path, "@a{sa{sv}}", NULL));
+  g_assert_false (g_variant_lookup (objects, shifted_vanishing_entry_path, "@a{sa{sv}}", NULL));
+
+  g_autoptr(GVariant) interfaces = NULL;
+  g_autoptr(GVariant) properties = NULL;
+  guint32 priority;
+  g_assert_true (g_variant_lookup (objects, shifted_client_entry_path1, "@a{sa{sv}}", &interfaces));
+  g_assert_true (g_variant_lookup (interfaces,
+                                   "com.endlessm.DownloadManager1.ScheduleEntry",
+                                   "@a{sv}", &properties));
+  g_assert_true (g_variant_lookup (properties, "Priority", "u", &priority));
+  g_assert_cmpuint (priority, ==, 5);
+
+  g_clear_pointer (&objects, g_variant_unref);
+  g_clear_pointer (&objects_variant, g_variant_unref);
+
+  /* The other peer isn’t a monitor, so it should only see its own entry, which
+   * shows the owners were restored. */
+  objects_variant = get_managed_objects (fixture, other_connection, &local_error);
+  g_assert_no_error (local_error);
+
+  objects = g_variant_get_child_value (objects_variant, 0);
+  g_assert_cmpuint (g_variant_n_children (objects), ==, 1);
+  g_assert_true (g_variant_lookup (objects, shifted_other_entry_path, "@a{sa{sv}}", NULL));
+}
+
 int
 main (int    argc,
       char **argv)
@@ -462,12 +2000,36 @@ main (int    argc,
               bus_teardown);
   g_test_add ("/schedule-service/dbus/schedule-entries/full", BusFixture, NULL,
               bus_setup, test_service_dbus_schedule_entries_full, bus_teardown);
+  g_test_add ("/schedule-service/dbus/schedule-entries/quota", BusFixture, NULL,
+              bus_setup, test_service_dbus_schedule_entries_quota, bus_teardown);
+  g_test_add ("/schedule-service/dbus/schedule-entries-full", BusFixture, NULL,
+              bus_setup, test_service_dbus_schedule_entries_properties, bus_teardown);
   g_test_add ("/schedule-service/dbus/hold/normal", BusFixture, NULL,
               bus_setup, test_service_dbus_hold_normal, bus_teardown);
   g_test_add ("/schedule-service/dbus/hold/twice", BusFixture, NULL,
               bus_setup, test_service_dbus_hold_twice, bus_teardown);
   g_test_add ("/schedule-service/dbus/release/twice", BusFixture, NULL,
               bus_setup, test_service_dbus_release_twice, bus_teardown);
+  g_test_add ("/schedule-service/dbus/active-entries-changed", BusFixture, NULL,
+              bus_setup, test_service_dbus_active_entries_changed, bus_teardown);
+  g_test_add ("/schedule-service/dbus/entry-signals/unicast", BusFixture, NULL,
+              bus_setup, test_service_dbus_entry_signals_unicast, bus_teardown);
+  g_test_add ("/schedule-service/dbus/monitor/authorization", BusFixture, NULL,
+              bus_setup, test_service_dbus_monitor_authorization, bus_teardown);
+  g_test_add ("/schedule-service/dbus/update-entries", BusFixture, NULL,
+              bus_setup, test_service_dbus_update_entries, bus_teardown);
+  g_test_add ("/schedule-service/dbus/entry-set-properties", BusFixture, NULL,
+              bus_setup, test_service_dbus_entry_set_properties, bus_teardown);
+  g_test_add ("/schedule-service/dbus/remove-entries", BusFixture, NULL,
+              bus_setup, test_service_dbus_remove_entries, bus_teardown);
+  g_test_add ("/schedule-service/dbus/preview", BusFixture, NULL,
+              bus_setup, test_service_dbus_preview, bus_teardown);
+  g_test_add ("/schedule-service/dbus/metrics", BusFixture, NULL,
+              bus_setup, test_service_dbus_metrics, bus_teardown);
+  g_test_add ("/schedule-service/dbus/get-managed-objects", BusFixture, NULL,
+              bus_setup, test_service_dbus_get_managed_objects, bus_teardown);
+  g_test_add ("/schedule-service/save-restore-state", BusFixture, NULL,
+              bus_setup, test_service_save_restore_state, bus_teardown);
 
   return g_test_run ();
 }
@@ -0,0 +1,386 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <libmogwai-schedule/scheduler.h>
+#include <libmogwai-schedule/tests/clock-dummy.h>
+#include <libmogwai-schedule/tests/connection-monitor-dummy.h>
+#include <libmogwai-schedule/tests/peer-manager-dummy.h>
+#include <libmogwai-tariff/period.h>
+#include <libmogwai-tariff/tariff.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+/* Microbenchmarks for the hot paths in #MwsScheduler: a full reschedule
+ * (including recalculating the verdict on every connection and looking up
+ * their tariffs), and adding and removing a single entry with
+ * mws_scheduler_update_entries() when the scheduler already contains a lot of
+ * entries. They use the same dummy connection monitor, peer manager and clock
+ * as the unit tests, so they measure only the scheduler itself.
+ *
+ * The results are printed to stdout as tab-separated values, with a header
+ * line, so they can be compared between builds by other tools. Each
+ * measurement is repeated until it has taken at least --min-time
+ * milliseconds in total (and at least %MIN_ITERATIONS times), and the minimum,
+ * median, mean and maximum times are reported in nanoseconds. */
+
+#define MIN_ITERATIONS 5
+#define MAX_ITERATIONS 100000
+
+static const guint entry_counts[] = { 10, 100, 1000, 10000 };
+static const guint connection_counts[] = { 1, 2, 4, 8 };
+static const guint period_counts[] = { 1, 10, 100, 1000 };
+
+/* Limits used with --quick, so the benchmarks can be run as a smoketest. */
+#define QUICK_MAX_ENTRIES 1000
+#define QUICK_MAX_CONNECTIONS 2
+#define QUICK_MAX_PERIODS 100
+
+static gint64
+get_time_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (gint64) ts.tv_sec * G_GINT64_CONSTANT (1000000000) + ts.tv_nsec;
+}
+
+/* Samples for one measurement. */
+typedef struct
+{
+  GArray *samples_ns;  /* (owned) (element-type gint64) */
+  gint64 total_ns;
+} Samples;
+
+static void
+samples_init (Samples *samples)
+{
+  samples->samples_ns = g_array_new (FALSE, FALSE, sizeof (gint64));
+  samples->total_ns = 0;
+}
+
+static void
+samples_clear (Samples *samples)
+{
+  g_clear_pointer (&samples->samples_ns, g_array_unref);
+}
+
+G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC (Samples, samples_clear)
+
+static void
+samples_add (Samples *samples,
+             gint64   duration_ns)
+{
+  g_array_append_val (samples->samples_ns, duration_ns);
+  samples->total_ns += duration_ns;
+}
+
+/* Whether enough samples have been taken to finish the measurement. */
+static gboolean
+samples_done (const Samples *samples,
+              gint64         min_time_ns)
+{
+  return (samples->samples_ns->len >= MAX_ITERATIONS ||
+          (samples->samples_ns->len >= MIN_ITERATIONS &&
+           samples->total_ns >= min_time_ns));
+}
+
+static gint
+compare_gint64 (gconstpointer a,
+                gconstpointer b)
+{
+  gint64 a_val = *((const gint64 *) a);
+  gint64 b_val = *((const gint64 *) b);
+
+  return (a_val > b_val) - (a_val < b_val);
+}
+
+static void
+print_header (void)
+{
+  g_print ("benchmark\tentries\tconnections\tperiods\titerations\t"
+           "min_ns\tmedian_ns\tmean_ns\tmax_ns\n");
+}
+
+static void
+print_samples (const gchar *benchmark_name,
+               guint        n_entries,
+               guint        n_connections,
+               guint        n_periods,
+               Samples     *samples)
+{
+  GArray *s = samples->samples_ns;
+
+  g_assert (s->len > 0);
+  g_array_sort (s, compare_gint64);
+
+  g_print ("%s\t%u\t%u\t%u\t%u\t"
+           "%" G_GINT64_FORMAT "\t%" G_GINT64_FORMAT "\t%" G_GINT64_FORMAT "\t"
+           "%" G_GINT64_FORMAT "\n",
+           benchmark_name, n_entries, n_connections, n_periods, s->len,
+           g_array_index (s, gint64, 0),
+           g_array_index (s, gint64, s->len / 2),
+           samples->total_ns / s->len,
+           g_array_index (s, gint64, s->len - 1));
+}
+
+/* Build a tariff with @n_periods periods which divide up each day equally,
+ * repeating daily. Alternate periods have a capacity limit, so that the
+ * scheduler has to account for usage on them. */
+static MwtTariff *
+build_tariff (guint n_periods)
+{
+  g_autoptr(GPtrArray) periods = g_ptr_array_new_with_free_func (g_object_unref);
+  g_autoptr(GDateTime) day_start = g_date_time_new_utc (2018, 1, 1, 0, 0, 0);
+  GTimeSpan period_span = G_TIME_SPAN_DAY / n_periods;
+
+  for (guint i = 0; i < n_periods; i++)
+    {
+      g_autoptr(GDateTime) start = g_date_time_add (day_start, period_span * i);
+      g_autoptr(GDateTime) end = g_date_time_add (start, period_span);
+      guint64 capacity_limit = (i % 2 == 0) ? G_MAXUINT64 : G_GUINT64_CONSTANT (1000000000);
+
+      g_ptr_array_add (periods, mwt_period_new (start, end,
+                                                MWT_PERIOD_REPEAT_DAY, 1,
+                                                "capacity-limit", capacity_limit,
+                                                NULL));
+    }
+
+  g_autoptr(GError) local_error = NULL;
+  g_autofree gchar *name = g_strdup_printf ("tariff%u", n_periods);
+
+  if (!mwt_tariff_validate (name, periods, &local_error))
+    g_error ("Invalid benchmark tariff: %s", local_error->message);
+
+  return mwt_tariff_new (name, periods);
+}
+
+/* Set of dummy objects and a scheduler to benchmark, with @n_entries entries
+ * and @n_connections connections which all use @tariff. */
+typedef struct
+{
+  MwsConnectionMonitor *connection_monitor;  /* (owned) */
+  MwsPeerManager *peer_manager;  /* (owned) */
+  MwsClock *clock;  /* (owned) */
+  MwsScheduler *scheduler;  /* (owned) */
+} Fixture;
+
+static void
+fixture_set_up (Fixture   *fixture,
+                guint      n_entries,
+                guint      n_connections,
+                MwtTariff *tariff)
+{
+  fixture->connection_monitor = MWS_CONNECTION_MONITOR (mws_connection_monitor_dummy_new ());
+  fixture->peer_manager = MWS_PEER_MANAGER (mws_peer_manager_dummy_new (FALSE));
+  fixture->clock = MWS_CLOCK (mws_clock_dummy_new ());
+
+  g_autoptr(GTimeZone) tz = g_time_zone_new_utc ();
+  g_autoptr(GDateTime) now = g_date_time_new_utc (2018, 2, 3, 12, 34, 56);
+  mws_clock_dummy_set_time_zone (MWS_CLOCK_DUMMY (fixture->clock), tz);
+  mws_clock_dummy_set_time (MWS_CLOCK_DUMMY (fixture->clock), now);
+
+  /* Leave room for the entries added while benchmarking. */
+  fixture->scheduler = g_object_new (MWS_TYPE_SCHEDULER,
+                                     "connection-monitor", fixture->connection_monitor,
+                                     "peer-manager", fixture->peer_manager,
+                                     "clock", fixture->clock,
+                                     "max-entries", n_entries + 1,
+                                     "max-active-entries", 4,
+                                     NULL);
+
+  MwsConnectionDetails details =
+    {
+      .metered = MWS_METERED_NO,
+      .allow_downloads_when_metered = FALSE,
+      .allow_downloads = TRUE,
+      .tariff = tariff,
+    };
+  g_autoptr(GHashTable) connections = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                             g_free, NULL);
+
+  for (guint i = 0; i < n_connections; i++)
+    g_hash_table_insert (connections, g_strdup_printf ("connection%u", i), &details);
+
+  mws_connection_monitor_dummy_update_connections (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                   connections, NULL);
+
+  /* Add the entries in one batch, spread over a few owners and priorities. */
+  g_autoptr(GPtrArray) entries = g_ptr_array_new_full (n_entries, g_object_unref);
+  g_autoptr(GError) local_error = NULL;
+
+  for (guint i = 0; i < n_entries; i++)
+    {
+      g_autofree gchar *owner = g_strdup_printf (":owner.%u", i % 10);
+      MwsScheduleEntry *entry = mws_schedule_entry_new (owner);
+      mws_schedule_entry_set_priority (entry, (guint32) g_random_int_range (0, 100));
+      mws_schedule_entry_set_bind_to_connection (entry, (i % 2 == 0));
+      g_ptr_array_add (entries, entry);
+    }
+
+  if (!mws_scheduler_update_entries (fixture->scheduler, entries, NULL, &local_error))
+    g_error ("Error adding benchmark entries: %s", local_error->message);
+}
+
+static void
+fixture_tear_down (Fixture *fixture)
+{
+  g_clear_object (&fixture->scheduler);
+  g_clear_object (&fixture->clock);
+  g_clear_object (&fixture->peer_manager);
+  g_clear_object (&fixture->connection_monitor);
+}
+
+/* Benchmark a full reschedule, which discards the cached connection data. */
+static void
+benchmark_reschedule (Fixture *fixture,
+                      gint64   min_time_ns,
+                      Samples *samples)
+{
+  while (!samples_done (samples, min_time_ns))
+    {
+      gint64 start_ns = get_time_ns ();
+      mws_scheduler_reschedule (fixture->scheduler);
+      samples_add (samples, get_time_ns () - start_ns);
+    }
+}
+
+/* Benchmark adding a single entry to the scheduler, and removing it again. */
+static void
+benchmark_update_entries (Fixture *fixture,
+                          gint64   min_time_ns,
+                          Samples *add_samples,
+                          Samples *remove_samples)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  while (!samples_done (add_samples, min_time_ns) ||
+         !samples_done (remove_samples, min_time_ns))
+    {
+      /* Give the entry a high priority, so it becomes active and the active
+       * entries change on each iteration. */
+      g_autoptr(MwsScheduleEntry) entry = mws_schedule_entry_new (":owner.0");
+      mws_schedule_entry_set_priority (entry, 1000);
+
+      g_autoptr(GPtrArray) added = g_ptr_array_new_with_free_func (NULL);
+      g_ptr_array_add (added, entry);
+      g_autoptr(GPtrArray) removed = g_ptr_array_new_with_free_func (NULL);
+      g_ptr_array_add (removed, (gpointer) mws_schedule_entry_get_id (entry));
+
+      gint64 start_ns = get_time_ns ();
+      if (!mws_scheduler_update_entries (fixture->scheduler, added, NULL, &local_error))
+        g_error ("Error adding entry: %s", local_error->message);
+      samples_add (add_samples, get_time_ns () - start_ns);
+
+      start_ns = get_time_ns ();
+      if (!mws_scheduler_update_entries (fixture->scheduler, NULL, removed, &local_error))
+        g_error ("Error removing entry: %s", local_error->message);
+      samples_add (remove_samples, get_time_ns () - start_ns);
+    }
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  gboolean quick = FALSE;
+  gint min_time_ms = 100;
+  g_autoptr(GError) local_error = NULL;
+
+  setlocale (LC_ALL, "");
+
+  const GOptionEntry entries[] =
+    {
+      { "quick", 'q', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &quick,
+        "Only run the smaller benchmarks", NULL },
+      { "min-time", 't', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &min_time_ms,
+        "Minimum time to spend on each measurement, in milliseconds", "MS" },
+      { NULL, },
+    };
+
+  g_autoptr(GOptionContext) context = g_option_context_new ("— benchmark the scheduler");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &local_error) ||
+      min_time_ms < 0)
+    {
+      g_printerr ("%s: %s\n", g_get_prgname (),
+                  (local_error != NULL) ? local_error->message : "Invalid --min-time");
+      return EXIT_FAILURE;
+    }
+
+  gint64 min_time_ns = (gint64) min_time_ms * 1000000;
+
+  print_header ();
+
+  for (gsize p = 0; p < G_N_ELEMENTS (period_counts); p++)
+    {
+      if (quick && period_counts[p] > QUICK_MAX_PERIODS)
+        continue;
+
+      g_autoptr(MwtTariff) tariff = build_tariff (period_counts[p]);
+
+      for (gsize c = 0; c < G_N_ELEMENTS (connection_counts); c++)
+        {
+          if (quick && connection_counts[c] > QUICK_MAX_CONNECTIONS)
+            continue;
+
+          for (gsize e = 0; e < G_N_ELEMENTS (entry_counts); e++)
+            {
+              if (quick && entry_counts[e] > QUICK_MAX_ENTRIES)
+                continue;
+
+              Fixture fixture = { NULL, };
+              g_auto(Samples) reschedule_samples = { NULL, 0 };
+              g_auto(Samples) add_samples = { NULL, 0 };
+              g_auto(Samples) remove_samples = { NULL, 0 };
+
+              samples_init (&reschedule_samples);
+              samples_init (&add_samples);
+              samples_init (&remove_samples);
+
+              fixture_set_up (&fixture, entry_counts[e], connection_counts[c], tariff);
+
+              benchmark_reschedule (&fixture, min_time_ns, &reschedule_samples);
+              benchmark_update_entries (&fixture, min_time_ns,
+                                        &add_samples, &remove_samples);
+
+              print_samples ("reschedule", entry_counts[e], connection_counts[c],
+                             period_counts[p], &reschedule_samples);
+              print_samples ("update-entries-add", entry_counts[e], connection_counts[c],
+                             period_counts[p], &add_samples);
+              print_samples ("update-entries-remove", entry_counts[e], connection_counts[c],
+                             period_counts[p], &remove_samples);
+
+              fixture_tear_down (&fixture);
+            }
+        }
+    }
+
+  return EXIT_SUCCESS;
+}
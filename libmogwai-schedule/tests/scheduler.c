@@ -24,6 +24,7 @@
 
 #include <glib.h>
 #include <gio/gio.h>
+#include <libmogwai-schedule/peer-priorities.h>
 #include <libmogwai-schedule/scheduler.h>
 #include <libmogwai-schedule/tests/clock-dummy.h>
 #include <libmogwai-schedule/tests/connection-monitor-dummy.h>
@@ -50,6 +51,16 @@ typedef struct
 typedef struct
 {
   guint max_active_entries;  /* > 1 */
+  guint reschedule_delay_ms;
+  guint64 small_entry_threshold;
+  guint min_run_time_secs;
+  guint preemption_priority_margin;
+  guint non_resumable_protect_percent;
+  guint64 non_resumable_protect_size;
+  gboolean fair_share;
+  guint fair_share_quantum_secs;  /* 0 for the default */
+  const gchar *peer_weights;  /* (nullable) key file data */
+  guint max_entries_per_owner;  /* 0 for the default */
 } TestData;
 
 static void
@@ -64,12 +75,36 @@ setup (Fixture       *fixture,
   fixture->peer_manager = MWS_PEER_MANAGER (mws_peer_manager_dummy_new (FALSE));
   fixture->clock = MWS_CLOCK (mws_clock_dummy_new ());
 
+  g_autoptr(GHashTable) peer_weights = NULL;
+
+  if (data->peer_weights != NULL)
+    {
+      g_autoptr(GKeyFile) key_file = g_key_file_new ();
+      g_autoptr(GError) local_error = NULL;
+
+      g_key_file_load_from_data (key_file, data->peer_weights, -1,
+                                 G_KEY_FILE_NONE, &local_error);
+      g_assert_no_error (local_error);
+      peer_weights = mws_peer_weights_new_from_key_file (key_file, &local_error);
+      g_assert_no_error (local_error);
+    }
+
   /* Construct the scheduler manually so we can set max-active-entries. */
   fixture->scheduler = g_object_new (MWS_TYPE_SCHEDULER,
                                      "connection-monitor", fixture->connection_monitor,
                                      "peer-manager", fixture->peer_manager,
                                      "clock", fixture->clock,
                                      "max-active-entries", data->max_active_entries,
+                                     "reschedule-delay", data->reschedule_delay_ms,
+                                     "small-entry-threshold", data->small_entry_threshold,
+                                     "min-run-time", data->min_run_time_secs,
+                                     "preemption-priority-margin", data->preemption_priority_margin,
+                                     "non-resumable-protect-percent", data->non_resumable_protect_percent,
+                                     "non-resumable-protect-size", data->non_resumable_protect_size,
+                                     "fair-share", data->fair_share,
+                                     "fair-share-quantum", (data->fair_share_quantum_secs != 0) ? data->fair_share_quantum_secs : 300,
+                                     "peer-weights", peer_weights,
+                                     "max-entries-per-owner", (data->max_entries_per_owner != 0) ? data->max_entries_per_owner : G_MAXUINT,
                                      NULL);
   fixture->scheduler_signals = mws_signal_logger_new ();
   mws_signal_logger_connect (fixture->scheduler_signals,
@@ -363,6 +398,9 @@ test_scheduler_entries_remove_for_owner (Fixture       *fixture,
 
   entries = mws_scheduler_get_entries (fixture->scheduler);
   g_assert_cmpuint (g_hash_table_size (entries), ==, 3);
+  g_assert_cmpuint (mws_scheduler_get_n_entries_for_owner (fixture->scheduler, ":owner.1"), ==, 2);
+  g_assert_cmpuint (mws_scheduler_get_n_entries_for_owner (fixture->scheduler, ":owner.2"), ==, 1);
+  g_assert_cmpuint (mws_scheduler_get_n_entries_for_owner (fixture->scheduler, ":owner.100"), ==, 0);
   assert_entries_changed_signals (fixture, added1, NULL, added_active1, NULL, NULL);
 
   /* Remove all entries from one owner, including the active entry. */
@@ -382,6 +420,8 @@ test_scheduler_entries_remove_for_owner (Fixture       *fixture,
 
   entries = mws_scheduler_get_entries (fixture->scheduler);
   g_assert_cmpuint (g_hash_table_size (entries), ==, 1);
+  g_assert_cmpuint (mws_scheduler_get_n_entries_for_owner (fixture->scheduler, ":owner.1"), ==, 0);
+  g_assert_cmpuint (mws_scheduler_get_n_entries_for_owner (fixture->scheduler, ":owner.2"), ==, 1);
   assert_entries_changed_signals (fixture, NULL, removed1, added_active2, added_active1, NULL);
 
   /* Remove entries from a non-existent owner. */
@@ -406,6 +446,178 @@ test_scheduler_entries_remove_for_owner (Fixture       *fixture,
   assert_entries_changed_signals (fixture, NULL, removed2, NULL, added_active2, NULL);
 }
 
+/* Test that #MwsScheduler:max-entries-per-owner limits the number of entries
+ * each owner can add, independently of other owners, and that a batch which
+ * would take any owner over its limit is rejected entirely. */
+static void
+test_scheduler_entries_quota (Fixture       *fixture,
+                              gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+  gboolean success;
+
+  /* Fill the quota for one owner. */
+  g_autoptr(GPtrArray) added1 = g_ptr_array_new_with_free_func (g_object_unref);
+  g_ptr_array_add (added1, mws_schedule_entry_new (":owner.1"));
+  g_ptr_array_add (added1, mws_schedule_entry_new (":owner.1"));
+  mws_schedule_entry_set_priority (added1->pdata[0], 2);
+  mws_schedule_entry_set_priority (added1->pdata[1], 1);
+
+  g_autoptr(GPtrArray) added_active1 = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (added_active1, added1->pdata[0]);
+
+  success = mws_scheduler_check_quota (fixture->scheduler, ":owner.1",
+                                       added1->len, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_true (success);
+
+  success = mws_scheduler_update_entries (fixture->scheduler, added1, NULL, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_true (success);
+
+  assert_entries_changed_signals (fixture, added1, NULL, added_active1, NULL, NULL);
+
+  /* The owner can’t add any more, but a different owner can. */
+  success = mws_scheduler_check_quota (fixture->scheduler, ":owner.1", 1, &local_error);
+  g_assert_error (local_error, MWS_SCHEDULER_ERROR, MWS_SCHEDULER_ERROR_FULL);
+  g_assert_false (success);
+  g_clear_error (&local_error);
+
+  success = mws_scheduler_check_quota (fixture->scheduler, ":owner.2", 2, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_true (success);
+
+  success = mws_scheduler_check_quota (fixture->scheduler, ":owner.2", 3, &local_error);
+  g_assert_error (local_error, MWS_SCHEDULER_ERROR, MWS_SCHEDULER_ERROR_FULL);
+  g_assert_false (success);
+  g_clear_error (&local_error);
+
+  /* A batch which would take one of its owners over quota is rejected, even
+   * if the other owners in it are within their quotas. */
+  g_autoptr(GPtrArray) added2 = g_ptr_array_new_with_free_func (g_object_unref);
+  g_ptr_array_add (added2, mws_schedule_entry_new (":owner.2"));
+  g_ptr_array_add (added2, mws_schedule_entry_new (":owner.1"));
+
+  success = mws_scheduler_update_entries (fixture->scheduler, added2, NULL, &local_error);
+  g_assert_error (local_error, MWS_SCHEDULER_ERROR, MWS_SCHEDULER_ERROR_FULL);
+  g_assert_false (success);
+  g_clear_error (&local_error);
+
+  g_assert_cmpuint (mws_scheduler_get_n_entries (fixture->scheduler), ==, 2);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+
+  /* Removing one of the first owner’s entries frees up its quota again. */
+  g_autoptr(GPtrArray) removed3 = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (removed3, (gpointer) mws_schedule_entry_get_id (added1->pdata[1]));
+  g_autoptr(GPtrArray) expected_removed3 = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (expected_removed3, added1->pdata[1]);
+
+  success = mws_scheduler_update_entries (fixture->scheduler, NULL, removed3, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_true (success);
+
+  assert_entries_changed_signals (fixture, NULL, expected_removed3, NULL, NULL, NULL);
+
+  success = mws_scheduler_check_quota (fixture->scheduler, ":owner.1", 1, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_true (success);
+}
+
+/* Test that entries can be looked up correctly after others have been removed
+ * and their storage reused by new entries, and that mws_scheduler_get_entries()
+ * and mws_scheduler_get_n_entries() stay consistent with the changes. */
+static void
+test_scheduler_entries_reuse (Fixture       *fixture,
+                              gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+  gboolean success;
+
+  /* Add several entries, with distinct priorities so which is active is
+   * predictable. */
+  g_autoptr(GPtrArray) added1 = g_ptr_array_new_with_free_func (g_object_unref);
+  g_ptr_array_add (added1, mws_schedule_entry_new (":owner.1"));
+  g_ptr_array_add (added1, mws_schedule_entry_new (":owner.1"));
+  g_ptr_array_add (added1, mws_schedule_entry_new (":owner.1"));
+  mws_schedule_entry_set_priority (added1->pdata[0], 3);
+  mws_schedule_entry_set_priority (added1->pdata[1], 2);
+  mws_schedule_entry_set_priority (added1->pdata[2], 1);
+
+  g_autoptr(GPtrArray) added_active1 = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (added_active1, added1->pdata[0]);
+
+  success = mws_scheduler_update_entries (fixture->scheduler, added1, NULL, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_true (success);
+
+  g_assert_cmpuint (mws_scheduler_get_n_entries (fixture->scheduler), ==, 3);
+  assert_entries_changed_signals (fixture, added1, NULL, added_active1, NULL, NULL);
+
+  /* Keep a reference to the current view of the entries; it shouldn’t change
+   * when the scheduler does. */
+  g_autoptr(GHashTable) old_entries = g_hash_table_ref (mws_scheduler_get_entries (fixture->scheduler));
+  g_assert_cmpuint (g_hash_table_size (old_entries), ==, 3);
+
+  /* Remove an inactive entry from the middle, then add a new one. */
+  g_autoptr(GPtrArray) removed2 = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (removed2, (gpointer) mws_schedule_entry_get_id (added1->pdata[1]));
+  g_autoptr(GPtrArray) expected_removed2 = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (expected_removed2, added1->pdata[1]);
+
+  success = mws_scheduler_update_entries (fixture->scheduler, NULL, removed2, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_true (success);
+  assert_entries_changed_signals (fixture, NULL, expected_removed2, NULL, NULL, NULL);
+
+  g_autoptr(GPtrArray) added3 = g_ptr_array_new_with_free_func (g_object_unref);
+  g_ptr_array_add (added3, mws_schedule_entry_new (":owner.1"));
+
+  success = mws_scheduler_update_entries (fixture->scheduler, added3, NULL, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_true (success);
+  assert_entries_changed_signals (fixture, added3, NULL, NULL, NULL, NULL);
+
+  /* Check all the lookups. */
+  g_assert_cmpuint (mws_scheduler_get_n_entries (fixture->scheduler), ==, 3);
+  g_assert_cmpuint (g_hash_table_size (old_entries), ==, 3);
+  g_assert_true (g_hash_table_contains (old_entries,
+                                        mws_schedule_entry_get_id (added1->pdata[1])));
+
+  GHashTable *entries = mws_scheduler_get_entries (fixture->scheduler);
+  g_assert_cmpuint (g_hash_table_size (entries), ==, 3);
+  g_assert_false (g_hash_table_contains (entries,
+                                         mws_schedule_entry_get_id (added1->pdata[1])));
+
+  g_assert_true (mws_scheduler_get_entry (fixture->scheduler,
+                                          mws_schedule_entry_get_id (added1->pdata[0])) == added1->pdata[0]);
+  g_assert_null (mws_scheduler_get_entry (fixture->scheduler,
+                                          mws_schedule_entry_get_id (added1->pdata[1])));
+  g_assert_true (mws_scheduler_get_entry (fixture->scheduler,
+                                          mws_schedule_entry_get_id (added1->pdata[2])) == added1->pdata[2]);
+  g_assert_true (mws_scheduler_get_entry (fixture->scheduler,
+                                          mws_schedule_entry_get_id (added3->pdata[0])) == added3->pdata[0]);
+
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, added1->pdata[0]));
+  g_assert_false (mws_scheduler_is_entry_active (fixture->scheduler, added1->pdata[2]));
+  g_assert_false (mws_scheduler_is_entry_active (fixture->scheduler, added3->pdata[0]));
+
+  /* Remove the active entry; the next most important should become active. */
+  g_autoptr(GPtrArray) removed4 = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (removed4, (gpointer) mws_schedule_entry_get_id (added1->pdata[0]));
+  g_autoptr(GPtrArray) expected_removed4 = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (expected_removed4, added1->pdata[0]);
+  g_autoptr(GPtrArray) added_active4 = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (added_active4, added1->pdata[2]);
+
+  success = mws_scheduler_update_entries (fixture->scheduler, NULL, removed4, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_true (success);
+
+  g_assert_cmpuint (mws_scheduler_get_n_entries (fixture->scheduler), ==, 2);
+  assert_entries_changed_signals (fixture, NULL, expected_removed4, added_active4,
+                                  added_active1, NULL);
+}
+
 /* Test that getting the properties from a #MwsScheduler works. */
 static void
 test_scheduler_properties (Fixture       *fixture,
@@ -418,6 +630,7 @@ test_scheduler_properties (Fixture       *fixture,
   g_autoptr(MwsPeerManager) peer_manager = NULL;
   gboolean allow_downloads;
   g_autoptr(MwsClock) clock = NULL;
+  guint reschedule_delay;
 
   g_object_get (fixture->scheduler,
                 "entries", &entries,
@@ -427,6 +640,7 @@ test_scheduler_properties (Fixture       *fixture,
                 "peer-manager", &peer_manager,
                 "allow-downloads", &allow_downloads,
                 "clock", &clock,
+                "reschedule-delay", &reschedule_delay,
                 NULL);
 
   g_assert_nonnull (entries);
@@ -435,6 +649,7 @@ test_scheduler_properties (Fixture       *fixture,
   g_assert_cmpuint (max_active_entries, >, 0);
   g_assert_nonnull (peer_manager);
   g_assert_nonnull (clock);
+  g_assert_cmpuint (reschedule_delay, ==, 0);
 }
 
 /* Convenience method to create a new schedule entry and set its priority. */
@@ -560,6 +775,90 @@ test_scheduler_scheduling_peer_priorities (Fixture       *fixture,
                            G_N_ELEMENTS (expected_scheduling_order));
 }
 
+/* Test that schedule entries with the same priority are ordered by their
+ * expected size, smallest first, with entries of unknown size last. */
+static void
+test_scheduler_scheduling_expected_size (Fixture       *fixture,
+                                         gconstpointer  test_data)
+{
+  g_autoptr(MwsScheduleEntry) entry1 = schedule_entry_new_with_priority (":owner.1", 5);
+  g_autoptr(MwsScheduleEntry) entry2 = schedule_entry_new_with_priority (":owner.1", 5);
+  g_autoptr(MwsScheduleEntry) entry3 = schedule_entry_new_with_priority (":owner.1", 5);
+  g_autoptr(MwsScheduleEntry) entry4 = schedule_entry_new_with_priority (":owner.1", 6);
+
+  mws_schedule_entry_set_expected_size (entry2, 1000);
+  mws_schedule_entry_set_expected_size (entry3, 10);
+  mws_schedule_entry_set_expected_size (entry4, 1000000000);
+
+  /* @entry4 is first, despite being largest, because it’s a higher priority.
+   * @entry1 is last, as its size is unknown. */
+  const MwsScheduleEntry *expected_scheduling_order[] = { entry4, entry3, entry2, entry1 };
+
+  assert_scheduling_order (fixture, expected_scheduling_order,
+                           G_N_ELEMENTS (expected_scheduling_order));
+}
+
+/* Test that one of the active slots is reserved for a small entry if none of
+ * the most important entries are small, and that changes to the expected size
+ * of an entry update the reservation. */
+static void
+test_scheduler_scheduling_small_entry (Fixture       *fixture,
+                                       gconstpointer  test_data)
+{
+  const TestData *data = test_data;
+  g_assert (data->max_active_entries == 2);
+  g_assert (data->small_entry_threshold == 1000);
+
+  g_autoptr(GError) local_error = NULL;
+
+  g_autoptr(MwsScheduleEntry) entry1 = schedule_entry_new_with_priority (":owner.1", 10);
+  g_autoptr(MwsScheduleEntry) entry2 = schedule_entry_new_with_priority (":owner.1", 9);
+  g_autoptr(MwsScheduleEntry) entry3 = schedule_entry_new_with_priority (":owner.1", 1);
+
+  mws_schedule_entry_set_expected_size (entry1, 1000000000);
+  mws_schedule_entry_set_expected_size (entry2, 1000000000);
+  mws_schedule_entry_set_expected_size (entry3, 100);
+
+  mws_peer_manager_dummy_set_peer_credentials (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
+                                               ":owner.1", "/some/owner");
+
+  g_autoptr(GPtrArray) added = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (added, entry1);
+  g_ptr_array_add (added, entry2);
+  g_ptr_array_add (added, entry3);
+
+  /* @entry3 is small, so takes the second slot ahead of @entry2. */
+  g_autoptr(GPtrArray) expected_active = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (expected_active, entry1);
+  g_ptr_array_add (expected_active, entry3);
+
+  g_autoptr(GPtrArray) entry2_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry2_array, entry2);
+  g_autoptr(GPtrArray) entry3_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry3_array, entry3);
+
+  mws_scheduler_update_entries (fixture->scheduler, added, NULL, &local_error);
+  g_assert_no_error (local_error);
+  assert_entries_changed_signals (fixture, added, NULL, expected_active, NULL, NULL);
+
+  /* If @entry3 turns out to be large, it loses its slot. */
+  mws_schedule_entry_set_expected_size (entry3, 1000000000);
+  assert_entries_changed_signals (fixture, NULL, NULL, entry2_array, NULL, entry3_array);
+
+  /* And gets it back if it’s small again. */
+  mws_schedule_entry_set_expected_size (entry3, 1000);
+  assert_entries_changed_signals (fixture, NULL, NULL, entry3_array, NULL, entry2_array);
+
+  /* If a more important entry is small, no slot needs to be reserved, and
+   * the entries are scheduled by priority. */
+  mws_schedule_entry_set_expected_size (entry1, 500);
+  assert_entries_changed_signals (fixture, NULL, NULL, entry2_array, NULL, entry3_array);
+
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry1));
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry2));
+  g_assert_false (mws_scheduler_is_entry_active (fixture->scheduler, entry3));
+}
+
 /* Test that the size of the set of active entries is limited by
  * #MwsScheduler:max-active-entries, and that only elements in that set are
  * mentioned in #MwsScheduler::active-entries-changed signals.
@@ -646,635 +945,1940 @@ test_scheduler_scheduling_max_active_entries (Fixture       *fixture,
   assert_entries_changed_signals (fixture, NULL, removed2, NULL, NULL, NULL);
 }
 
-/* Test that the schedule entries for a given peer are automatically removed if
- * that peer vanishes, whether they are active or not. */
+/* Test that changing the priority of an entry which is already in the
+ * scheduler causes the set of active entries to be updated, without any other
+ * changes to the scheduler. */
 static void
-test_scheduler_scheduling_peer_vanished (Fixture       *fixture,
-                                         gconstpointer  test_data)
+test_scheduler_scheduling_priority_changed (Fixture       *fixture,
+                                            gconstpointer  test_data)
 {
   g_autoptr(GError) local_error = NULL;
 
-  /* Add several entries. */
+  /* Add two entries. */
   g_autoptr(MwsScheduleEntry) entry1 = schedule_entry_new_with_priority (":owner.1", 5);
   g_autoptr(MwsScheduleEntry) entry2 = schedule_entry_new_with_priority (":owner.1", 10);
-  g_autoptr(MwsScheduleEntry) entry3 = schedule_entry_new_with_priority (":owner.2", 2);
 
-  /* Set up the peer credentials. Make sure :owner.1 is scheduled first, by
-   * making it gnome-software. */
   mws_peer_manager_dummy_set_peer_credentials (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
-                                               ":owner.1", "/usr/bin/gnome-software");
-  mws_peer_manager_dummy_set_peer_credentials (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
-                                               ":owner.2", "/some/other/path");
+                                               ":owner.1", "/some/owner");
 
-  /* Add all the entries to the scheduler. */
   g_autoptr(GPtrArray) added = g_ptr_array_new_with_free_func (NULL);
   g_ptr_array_add (added, entry1);
   g_ptr_array_add (added, entry2);
-  g_ptr_array_add (added, entry3);
 
-  g_autoptr(GPtrArray) expected_active1 = g_ptr_array_new_with_free_func (NULL);
-  g_ptr_array_add (expected_active1, entry2);
+  g_autoptr(GPtrArray) entry1_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry1_array, entry1);
+  g_autoptr(GPtrArray) entry2_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry2_array, entry2);
 
   mws_scheduler_update_entries (fixture->scheduler, added, NULL, &local_error);
   g_assert_no_error (local_error);
-  assert_entries_changed_signals (fixture, added, NULL, expected_active1, NULL, NULL);
+  assert_entries_changed_signals (fixture, added, NULL, entry2_array, NULL, NULL);
 
-  /* Make `:owner.1` vanish, and check that both its entries (but not the third
-   * entry) disappear. */
-  mws_peer_manager_dummy_remove_peer (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
-                                      ":owner.1");
+  /* Bump the priority of @entry1 so it should take over from @entry2. */
+  mws_schedule_entry_set_priority (entry1, 15);
+  assert_entries_changed_signals (fixture, NULL, NULL, entry1_array, NULL, entry2_array);
 
-  g_autoptr(GPtrArray) expected_removed = g_ptr_array_new_with_free_func (NULL);
-  g_ptr_array_add (expected_removed, entry2);
-  g_ptr_array_add (expected_removed, entry1);
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry1));
+  g_assert_false (mws_scheduler_is_entry_active (fixture->scheduler, entry2));
 
-  g_autoptr(GPtrArray) expected_active2 = g_ptr_array_new_with_free_func (NULL);
-  g_ptr_array_add (expected_active2, entry3);
+  /* Changing the priority without changing the order should do nothing. */
+  mws_schedule_entry_set_priority (entry1, 12);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
 
-  assert_entries_changed_signals (fixture, NULL, expected_removed,
-                                  expected_active2, expected_active1, NULL);
+  /* And dropping it back below @entry2 should swap them back. */
+  mws_schedule_entry_set_priority (entry1, 1);
+  assert_entries_changed_signals (fixture, NULL, NULL, entry2_array, NULL, entry1_array);
+}
 
-  /* Now make `:owner.2` vanish, to test what happens when there will be no new
-   * active entry to take the place of the one being removed. */
-  mws_peer_manager_dummy_remove_peer (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
-                                      ":owner.2");
+/* Test that an active entry isn’t preempted by a more important entry until
+ * it’s been active for #MwsScheduler:min-run-time, and that the scheduler
+ * reschedules when that time is up. */
+static void
+test_scheduler_preemption_min_run_time (Fixture       *fixture,
+                                        gconstpointer  test_data)
+{
+  const TestData *data = test_data;
+  g_assert (data->min_run_time_secs == 60);
 
-  assert_entries_changed_signals (fixture, NULL, expected_active2, NULL, expected_active2, NULL);
+  g_autoptr(GError) local_error = NULL;
+
+  g_autoptr(GTimeZone) tz = g_time_zone_new_utc ();
+  g_autoptr(GDateTime) start_time = g_date_time_new_utc (2018, 2, 3, 0, 30, 0);
+  mws_clock_dummy_set_time_zone (MWS_CLOCK_DUMMY (fixture->clock), tz);
+  mws_clock_dummy_set_time (MWS_CLOCK_DUMMY (fixture->clock), start_time);
+
+  /* Add two entries. */
+  g_autoptr(MwsScheduleEntry) entry1 = schedule_entry_new_with_priority (":owner.1", 5);
+  g_autoptr(MwsScheduleEntry) entry2 = schedule_entry_new_with_priority (":owner.1", 10);
+
+  mws_peer_manager_dummy_set_peer_credentials (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
+                                               ":owner.1", "/some/owner");
+
+  g_autoptr(GPtrArray) added = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (added, entry1);
+  g_ptr_array_add (added, entry2);
+
+  g_autoptr(GPtrArray) entry1_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry1_array, entry1);
+  g_autoptr(GPtrArray) entry2_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry2_array, entry2);
+
+  mws_scheduler_update_entries (fixture->scheduler, added, NULL, &local_error);
+  g_assert_no_error (local_error);
+  assert_entries_changed_signals (fixture, added, NULL, entry2_array, NULL, NULL);
+
+  /* Bumping the priority of @entry1 shouldn’t preempt @entry2 yet, but there
+   * should be an alarm for when it can. */
+  mws_schedule_entry_set_priority (entry1, 15);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry2));
+
+  g_autoptr(GDateTime) expected_alarm = g_date_time_add_seconds (start_time, 60);
+  g_assert_true (g_date_time_equal (mws_clock_dummy_get_next_alarm_time (MWS_CLOCK_DUMMY (fixture->clock)),
+                                    expected_alarm));
+  g_assert_true (mws_clock_dummy_next_alarm (MWS_CLOCK_DUMMY (fixture->clock)));
+  assert_entries_changed_signals (fixture, NULL, NULL, entry1_array, NULL, entry2_array);
+
+  /* Removing @entry1 before its minimum run time is up should still make
+   * @entry2 active again straight away. */
+  g_autoptr(GPtrArray) removed = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (removed, (gpointer) mws_schedule_entry_get_id (entry1));
+
+  mws_scheduler_update_entries (fixture->scheduler, NULL, removed, &local_error);
+  g_assert_no_error (local_error);
+  assert_entries_changed_signals (fixture, NULL, entry1_array, entry2_array, entry1_array, NULL);
 }
 
-/* Test the transitions between different network connection states, checking
- * whether they cause a single entry to be scheduled/unscheduled
- * appropriately. Each test vector provides two states of a set of network
- * connections. The test starts in state 1, checks whether the entry is
- * scheduled appropriately, transitions to state 2, checks again, and then
- * transitions back to state 1 to test the reverse transition (and checks
- * again). */
+/* Test that an entry only preempts an active entry from the same peer if its
+ * priority is higher by at least #MwsScheduler:preemption-priority-margin. */
 static void
-test_scheduler_scheduling_metered_connection (Fixture       *fixture,
-                                              gconstpointer  test_data)
+test_scheduler_preemption_priority_margin (Fixture       *fixture,
+                                           gconstpointer  test_data)
 {
-  /* Various pre-defined connection details, which can be assigned for use below. */
-  const MwsConnectionDetails connection_metered =
-    {
-      .metered = MWS_METERED_YES,
-      .allow_downloads_when_metered = FALSE,
-      .allow_downloads = TRUE,
-      .tariff = NULL,
-    };
-  const MwsConnectionDetails connection_maybe_metered =
-    {
-      .metered = MWS_METERED_GUESS_YES,
-      .allow_downloads_when_metered = FALSE,
-      .allow_downloads = TRUE,
-      .tariff = NULL,
-    };
-  const MwsConnectionDetails connection_unmetered =
-    {
-      .metered = MWS_METERED_NO,
-      .allow_downloads_when_metered = FALSE,
-      .allow_downloads = TRUE,
-      .tariff = NULL,
-    };
-  const MwsConnectionDetails connection_metered_allow_downloads =
-    {
-      .metered = MWS_METERED_YES,
-      .allow_downloads_when_metered = TRUE,
-      .allow_downloads = TRUE,
-      .tariff = NULL,
-    };
-  const MwsConnectionDetails connection_metered_no_downloads =
-    {
-      .metered = MWS_METERED_YES,
-      .allow_downloads_when_metered = FALSE,
-      .allow_downloads = FALSE,
-      .tariff = NULL,
-    };
-  const MwsConnectionDetails connection_unmetered_no_downloads =
-    {
-      .metered = MWS_METERED_NO,
-      .allow_downloads_when_metered = FALSE,
-      .allow_downloads = FALSE,
-      .tariff = NULL,
-    };
+  const TestData *data = test_data;
+  g_assert (data->preemption_priority_margin == 10);
 
   g_autoptr(GError) local_error = NULL;
-  struct
-    {
-      /* We use a fixed limit of 3 connections in these tests, because we should
-       * be able to simulate any condition we care about using 3. Typically,
-       * systems will have only 1 active connection (maybe 2 if they have wired
-       * and Wi-Fi enabled at the same time). */
-      const MwsConnectionDetails *state1_connections[3];
-      gboolean state1_expected_allow_downloads;
-      gboolean state1_expected_active;
-      const MwsConnectionDetails *state2_connections[3];
-      gboolean state2_expected_allow_downloads;
-      gboolean state2_expected_active;
-    }
-  transitions[] =
-    {
-      /* Transition from definitely metered to definitely unmetered. */
-      { { &connection_metered, }, FALSE, FALSE,
-        { &connection_unmetered, }, TRUE, TRUE },
-      /* Transition from maybe metered to definitely unmetered. */
-      { { &connection_maybe_metered, }, FALSE, FALSE,
-        { &connection_unmetered, }, TRUE, TRUE },
-      /* Transition from maybe metered to definitely unmetered. */
-      { { &connection_maybe_metered, }, FALSE, FALSE,
-        { &connection_unmetered, }, TRUE, TRUE },
-      /* Transition from definitely metered to definitely unmetered, but with
-       * downloads disabled. */
-      { { &connection_metered_no_downloads, }, FALSE, FALSE,
-        { &connection_unmetered_no_downloads, }, FALSE, FALSE },
-      /* Transition from unmetered to metered (but with downloads allowed). */
-      { { &connection_unmetered, }, TRUE, TRUE,
-        { &connection_metered_allow_downloads, }, TRUE, TRUE },
-      /* Transition from metered to metered (but with downloads allowed). */
-      { { &connection_metered, }, FALSE, FALSE,
-        { &connection_metered_allow_downloads, }, TRUE, TRUE },
-      /* Transition from two definitely metered connections to having both of
-       * them definitely unmetered. */
-      { { &connection_metered, &connection_metered }, FALSE, FALSE,
-        { &connection_unmetered, &connection_unmetered, }, TRUE, TRUE },
-      /* Transition from two definitely metered connections to having one of
-       * them definitely unmetered. */
-      { { &connection_metered, &connection_metered }, FALSE, FALSE,
-        { &connection_metered, &connection_unmetered, }, FALSE, FALSE },
-      /* Transition from a metered and an unmetered connection to having one of
-       * them allow downloads. */
-      { { &connection_unmetered, &connection_metered }, FALSE, FALSE,
-        { &connection_unmetered, &connection_metered_allow_downloads, }, TRUE, TRUE },
-      /* Transition from a selection of connections to various unmetered ones
-       * with downloads disallowed. allow-downloads must remain false. */
-      { { &connection_unmetered, &connection_metered, &connection_unmetered }, FALSE, FALSE,
-        { &connection_unmetered_no_downloads, &connection_unmetered_no_downloads, &connection_unmetered_no_downloads }, FALSE, FALSE },
-    };
 
-  for (gsize i = 0; i < G_N_ELEMENTS (transitions); i++)
-    {
-      /* We only care about transitions within a given connection in this test,
-       * so the set of connections available in states 1 and 2 must be the same */
-      for (gsize j = 0; j < G_N_ELEMENTS (transitions[i].state1_connections); j++)
-        g_assert ((transitions[i].state1_connections[j] == NULL) ==
-                  (transitions[i].state2_connections[j] == NULL));
+  /* Add two entries. */
+  g_autoptr(MwsScheduleEntry) entry1 = schedule_entry_new_with_priority (":owner.1", 5);
+  g_autoptr(MwsScheduleEntry) entry2 = schedule_entry_new_with_priority (":owner.1", 10);
 
-      g_test_message ("Transition test %" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT,
-                      i + 1, G_N_ELEMENTS (transitions));
+  mws_peer_manager_dummy_set_peer_credentials (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
+                                               ":owner.1", "/some/owner");
 
-      gboolean initial_allow_downloads = mws_scheduler_get_allow_downloads (fixture->scheduler);
+  g_autoptr(GPtrArray) added = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (added, entry1);
+  g_ptr_array_add (added, entry2);
 
-      /* Set up the connections in state 1. */
-      g_autoptr(GHashTable) state1_connections =
-          g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_autoptr(GPtrArray) entry1_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry1_array, entry1);
+  g_autoptr(GPtrArray) entry2_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry2_array, entry2);
 
-      for (gsize j = 0; j < G_N_ELEMENTS (transitions[i].state1_connections); j++)
-        {
-          if (transitions[i].state1_connections[j] != NULL)
-            {
-              g_autofree gchar *id = g_strdup_printf ("connection%" G_GSIZE_FORMAT, j);
-              g_hash_table_insert (state1_connections, g_steal_pointer (&id),
-                                   transitions[i].state1_connections[j]);
-            }
-        }
+  mws_scheduler_update_entries (fixture->scheduler, added, NULL, &local_error);
+  g_assert_no_error (local_error);
+  assert_entries_changed_signals (fixture, added, NULL, entry2_array, NULL, NULL);
 
-      mws_connection_monitor_dummy_update_connections (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
-                                                       state1_connections, NULL);
+  /* A priority which is higher, but not by enough, shouldn’t preempt. */
+  mws_schedule_entry_set_priority (entry1, 19);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry2));
 
-      if (transitions[i].state1_expected_allow_downloads != initial_allow_downloads)
-        mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
-                                               fixture->scheduler,
-                                               "notify::allow-downloads", NULL);
-      mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+  /* One which is higher by the margin should. */
+  mws_schedule_entry_set_priority (entry1, 20);
+  assert_entries_changed_signals (fixture, NULL, NULL, entry1_array, NULL, entry2_array);
 
-      /* Add a single entry to the scheduler. */
-      g_autoptr(MwsScheduleEntry) entry = mws_schedule_entry_new (":owner.1");
+  /* The priority of the inactive entry can then be raised past the active one
+   * without swapping them back. */
+  mws_schedule_entry_set_priority (entry2, 25);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry1));
+}
 
-      g_autoptr(GPtrArray) entry_array = g_ptr_array_new_with_free_func (NULL);
-      g_ptr_array_add (entry_array, entry);
+/* Test that non-resumable entries which have downloaded at least
+ * #MwsScheduler:non-resumable-protect-percent of their expected size, or
+ * #MwsScheduler:non-resumable-protect-size bytes, aren’t preempted, but
+ * resumable ones are. */
+static void
+test_scheduler_preemption_non_resumable (Fixture       *fixture,
+                                         gconstpointer  test_data)
+{
+  const TestData *data = test_data;
+  g_assert (data->non_resumable_protect_percent == 90);
+  g_assert (data->non_resumable_protect_size == 1000);
 
-      mws_scheduler_update_entries (fixture->scheduler, entry_array, NULL, &local_error);
-      g_assert_no_error (local_error);
-      assert_entries_changed_signals (fixture, entry_array, NULL,
-                                      (transitions[i].state1_expected_active ? entry_array : NULL),
-                                      NULL, NULL);
+  g_autoptr(GError) local_error = NULL;
 
-      /* Change to the next connection state. */
-      for (gsize j = 0; j < G_N_ELEMENTS (transitions[i].state2_connections); j++)
-        {
-          if (transitions[i].state2_connections[j] != NULL)
-            {
-              g_autofree gchar *id = g_strdup_printf ("connection%" G_GSIZE_FORMAT, j);
-              mws_connection_monitor_dummy_update_connection (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
-                                                              id, transitions[i].state2_connections[j]);
-            }
-        }
+  /* Add two entries. @entry2 is non-resumable and expected to be 100 bytes;
+   * @entry1 is non-resumable with an unknown size. */
+  g_autoptr(MwsScheduleEntry) entry1 = schedule_entry_new_with_priority (":owner.1", 5);
+  g_autoptr(MwsScheduleEntry) entry2 = schedule_entry_new_with_priority (":owner.1", 10);
+  mws_schedule_entry_set_resumable (entry1, FALSE);
+  mws_schedule_entry_set_resumable (entry2, FALSE);
+  mws_schedule_entry_set_expected_size (entry2, 100);
 
-      if (transitions[i].state2_expected_allow_downloads != transitions[i].state1_expected_allow_downloads)
-        mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
-                                               fixture->scheduler,
-                                               "notify::allow-downloads", NULL);
+  mws_peer_manager_dummy_set_peer_credentials (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
+                                               ":owner.1", "/some/owner");
 
-      if (transitions[i].state1_expected_active == transitions[i].state2_expected_active)
-        mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
-      else if (transitions[i].state1_expected_active)
-        assert_entries_changed_signals (fixture, NULL, NULL, NULL, entry_array, NULL);
-      else
-        assert_entries_changed_signals (fixture, NULL, NULL, entry_array, NULL, NULL);
+  g_autoptr(GPtrArray) added = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (added, entry1);
+  g_ptr_array_add (added, entry2);
 
-      /* Change back to the previous connection state. The entry’s scheduled
-       * state should always be the same as before. */
-      for (gsize j = 0; j < G_N_ELEMENTS (transitions[i].state1_connections); j++)
-        {
-          if (transitions[i].state1_connections[j] != NULL)
-            {
-              g_autofree gchar *id = g_strdup_printf ("connection%" G_GSIZE_FORMAT, j);
-              mws_connection_monitor_dummy_update_connection (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
-                                                              id, transitions[i].state1_connections[j]);
-            }
-        }
+  g_autoptr(GPtrArray) entry1_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry1_array, entry1);
+  g_autoptr(GPtrArray) entry2_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry2_array, entry2);
 
-      if (transitions[i].state1_expected_allow_downloads != transitions[i].state2_expected_allow_downloads)
-        mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
-                                               fixture->scheduler,
-                                               "notify::allow-downloads", NULL);
+  mws_scheduler_update_entries (fixture->scheduler, added, NULL, &local_error);
+  g_assert_no_error (local_error);
+  assert_entries_changed_signals (fixture, added, NULL, entry2_array, NULL, NULL);
 
-      if (transitions[i].state1_expected_active == transitions[i].state2_expected_active)
-        mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
-      else if (transitions[i].state2_expected_active)
-        assert_entries_changed_signals (fixture, NULL, NULL, NULL, entry_array, NULL);
-      else
-        assert_entries_changed_signals (fixture, NULL, NULL, entry_array, NULL, NULL);
+  /* Reporting progress shouldn’t cause a reschedule. Once @entry2 is 95%
+   * downloaded, a more important entry shouldn’t preempt it. */
+  mws_schedule_entry_set_downloaded_size (entry2, 95);
+  mws_schedule_entry_set_priority (entry1, 15);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry2));
 
-      /* Clean up. */
-      teardown (fixture, test_data);
-      setup (fixture, test_data);
-    }
-}
+  /* If it was resumable, it could be preempted. */
+  mws_schedule_entry_set_resumable (entry2, TRUE);
+  mws_scheduler_reschedule (fixture->scheduler);
+  assert_entries_changed_signals (fixture, NULL, NULL, entry1_array, NULL, entry2_array);
 
-static GTimeZone *
-time_zone_new (const gchar *tz_str)
-{
-  if (tz_str != NULL)
-    {
-#if GLIB_CHECK_VERSION(2, 68, 0)
-      g_autoptr(GTimeZone) tz = g_time_zone_new_identifier (tz_str);
-      g_assert_nonnull (tz);
-      return g_steal_pointer (&tz);
-#else
-      return g_time_zone_new (tz_str);
-#endif
-    }
-  else
-    {
-      return g_time_zone_new_utc ();
-    }
+  /* @entry1 has an unknown size, so is only protected once it’s downloaded
+   * 1000 bytes. */
+  mws_schedule_entry_set_downloaded_size (entry1, 999);
+  mws_schedule_entry_set_priority (entry2, 20);
+  assert_entries_changed_signals (fixture, NULL, NULL, entry2_array, NULL, entry1_array);
+
+  mws_schedule_entry_set_priority (entry1, 25);
+  assert_entries_changed_signals (fixture, NULL, NULL, entry1_array, NULL, entry2_array);
+
+  mws_schedule_entry_set_downloaded_size (entry1, 1000);
+  mws_schedule_entry_set_priority (entry2, 30);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry1));
 }
 
-/* Test the transitions between different tariffs, checking whether they cause a
- * single entry to be scheduled/unscheduled appropriately. Each test vector
- * provides two states of a set of tariffs, and two times. Either the set of
- * tariffs can vary, or the time can vary in a single vector — not both. The
- * test starts in state 1 at time 1, checks whether the entry is scheduled
- * appropriately, transitions to state 2 at time 2, checks again, and then
- * transitions back to state 1 at time 1 to test the reverse transition (and
- * checks again). */
+/* Test that #MwsScheduler:fair-share gives each peer a slot, rather than giving
+ * them all to the most important peer, and that the slots stay put while the
+ * peers are getting equal shares. */
 static void
-test_scheduler_scheduling_tariff (Fixture       *fixture,
-                                  gconstpointer  test_data)
+test_scheduler_fair_share_peers (Fixture       *fixture,
+                                 gconstpointer  test_data)
 {
-  /* A tariff which is normally unmetered, but has a period from 01:00–02:00
-   * each day which has zero capacity limit. */
-  g_autoptr(GPtrArray) tariff1_periods = g_ptr_array_new_with_free_func (NULL);
+  const TestData *data = test_data;
+  g_assert (data->max_active_entries == 2);
+  g_assert (data->fair_share);
 
-  g_autoptr(GDateTime) tariff1_period1_start = g_date_time_new_utc (2018, 1, 1, 0, 0, 0);
-  g_autoptr(GDateTime) tariff1_period1_end = g_date_time_new_utc (2018, 1, 2, 0, 0, 0);
-  g_autoptr(MwtPeriod) tariff1_period1 = mwt_period_new (tariff1_period1_start,
-                                                         tariff1_period1_end,
-                                                         MWT_PERIOD_REPEAT_DAY,
-                                                         1,
-                                                         "capacity-limit", G_MAXUINT64,
-                                                         NULL);
-  g_ptr_array_add (tariff1_periods, tariff1_period1);
+  g_autoptr(GError) local_error = NULL;
 
-  g_autoptr(GDateTime) tariff1_period2_start = g_date_time_new_utc (2018, 1, 1, 1, 0, 0);
-  g_autoptr(GDateTime) tariff1_period2_end = g_date_time_new_utc (2018, 1, 1, 2, 0, 0);
-  g_autoptr(MwtPeriod) tariff1_period2 = mwt_period_new (tariff1_period2_start,
-                                                         tariff1_period2_end,
-                                                         MWT_PERIOD_REPEAT_DAY,
-                                                         1,
-                                                         "capacity-limit", G_GUINT64_CONSTANT (0),
-                                                         NULL);
-  g_ptr_array_add (tariff1_periods, tariff1_period2);
+  g_autoptr(GTimeZone) tz = g_time_zone_new_utc ();
+  g_autoptr(GDateTime) start_time = g_date_time_new_utc (2018, 2, 3, 0, 30, 0);
+  mws_clock_dummy_set_time_zone (MWS_CLOCK_DUMMY (fixture->clock), tz);
+  mws_clock_dummy_set_time (MWS_CLOCK_DUMMY (fixture->clock), start_time);
 
-  g_autoptr(MwtTariff) tariff1 = mwt_tariff_new ("tariff1", tariff1_periods);
+  /* gnome-software is more important than any other peer, so would normally
+   * get both slots. */
+  mws_peer_manager_dummy_set_peer_credentials (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
+                                               ":owner.1", "/usr/bin/gnome-software");
+  mws_peer_manager_dummy_set_peer_credentials (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
+                                               ":owner.2", "/some/other/owner");
 
-  /* A tariff which is always unmetered (infinite capacity limit). */
-  g_autoptr(GPtrArray) tariff_unmetered_periods = g_ptr_array_new_with_free_func (NULL);
+  g_autoptr(MwsScheduleEntry) entry1a = schedule_entry_new_with_priority (":owner.1", 10);
+  g_autoptr(MwsScheduleEntry) entry1b = schedule_entry_new_with_priority (":owner.1", 5);
+  g_autoptr(MwsScheduleEntry) entry2 = schedule_entry_new_with_priority (":owner.2", 1);
 
-  g_autoptr(GDateTime) tariff_unmetered_period1_start = g_date_time_new_utc (2018, 1, 1, 0, 0, 0);
-  g_autoptr(GDateTime) tariff_unmetered_period1_end = g_date_time_new_utc (2018, 1, 2, 0, 0, 0);
-  g_autoptr(MwtPeriod) tariff_unmetered_period1 = mwt_period_new (tariff_unmetered_period1_start,
-                                                                  tariff_unmetered_period1_end,
-                                                                  MWT_PERIOD_REPEAT_DAY,
-                                                                  1,
-                                                                  "capacity-limit", G_MAXUINT64,
-                                                                  NULL);
-  g_ptr_array_add (tariff_unmetered_periods, tariff_unmetered_period1);
+  g_autoptr(GPtrArray) added = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (added, entry1a);
+  g_ptr_array_add (added, entry1b);
+  g_ptr_array_add (added, entry2);
 
-  g_autoptr(MwtTariff) tariff_unmetered = mwt_tariff_new ("tariff_unmetered",
-                                                          tariff_unmetered_periods);
+  /* Ties between the peers go to the more important one. */
+  g_autoptr(GPtrArray) expected_active = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (expected_active, entry1a);
+  g_ptr_array_add (expected_active, entry2);
 
-  /* A tariff which is normally metered, but has a period from 01:30–02:00
-   * each day which has unlimited capacity. */
-  g_autoptr(GPtrArray) tariff2_periods = g_ptr_array_new_with_free_func (NULL);
+  mws_scheduler_update_entries (fixture->scheduler, added, NULL, &local_error);
+  g_assert_no_error (local_error);
+  assert_entries_changed_signals (fixture, added, NULL, expected_active, NULL, NULL);
 
-  g_autoptr(GDateTime) tariff2_period1_start = g_date_time_new_utc (2018, 1, 1, 0, 0, 0);
-  g_autoptr(GDateTime) tariff2_period1_end = g_date_time_new_utc (2018, 1, 2, 0, 0, 0);
-  g_autoptr(MwtPeriod) tariff2_period1 = mwt_period_new (tariff2_period1_start,
-                                                         tariff2_period1_end,
-                                                         MWT_PERIOD_REPEAT_DAY,
-                                                         1,
-                                                         "capacity-limit", G_GUINT64_CONSTANT (0),
-                                                         NULL);
-  g_ptr_array_add (tariff2_periods, tariff2_period1);
+  /* @entry1b is waiting, so the shares should be re-evaluated after a quantum.
+   * Both peers have had the same share by then, so nothing should change. */
+  g_autoptr(GDateTime) expected_alarm = g_date_time_add_seconds (start_time, data->fair_share_quantum_secs);
+  g_assert_true (g_date_time_equal (mws_clock_dummy_get_next_alarm_time (MWS_CLOCK_DUMMY (fixture->clock)),
+                                    expected_alarm));
+  g_assert_true (mws_clock_dummy_next_alarm (MWS_CLOCK_DUMMY (fixture->clock)));
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
 
-  g_autoptr(GDateTime) tariff2_period2_start = g_date_time_new_utc (2018, 1, 1, 1, 30, 0);
-  g_autoptr(GDateTime) tariff2_period2_end = g_date_time_new_utc (2018, 1, 1, 2, 30, 0);
-  g_autoptr(MwtPeriod) tariff2_period2 = mwt_period_new (tariff2_period2_start,
-                                                         tariff2_period2_end,
-                                                         MWT_PERIOD_REPEAT_DAY,
-                                                         1,
-                                                         "capacity-limit", G_MAXUINT64,
-                                                         NULL);
-  g_ptr_array_add (tariff2_periods, tariff2_period2);
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry1a));
+  g_assert_false (mws_scheduler_is_entry_active (fixture->scheduler, entry1b));
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry2));
 
-  g_autoptr(MwtTariff) tariff2 = mwt_tariff_new ("tariff2", tariff2_periods);
+  /* Once @entry2 is removed, owner 2 has nothing more to download, so
+   * @entry1b can have its slot. */
+  g_autoptr(GPtrArray) removed = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (removed, (gpointer) mws_schedule_entry_get_id (entry2));
+  g_autoptr(GPtrArray) entry2_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry2_array, entry2);
+  g_autoptr(GPtrArray) entry1b_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry1b_array, entry1b);
 
-  /* A tariff has a single period and no recurrence. */
-  g_autoptr(GPtrArray) tariff3_periods = g_ptr_array_new_with_free_func (NULL);
+  mws_scheduler_update_entries (fixture->scheduler, NULL, removed, &local_error);
+  g_assert_no_error (local_error);
+  assert_entries_changed_signals (fixture, NULL, entry2_array, entry1b_array, entry2_array, NULL);
+}
 
-  g_autoptr(GDateTime) tariff3_period1_start = g_date_time_new_utc (2018, 1, 1, 0, 0, 0);
-  g_autoptr(GDateTime) tariff3_period1_end = g_date_time_new_utc (2018, 1, 2, 0, 0, 0);
-  g_autoptr(MwtPeriod) tariff3_period1 = mwt_period_new (tariff3_period1_start,
-                                                         tariff3_period1_end,
-                                                         MWT_PERIOD_REPEAT_NONE,
-                                                         0,
-                                                         "capacity-limit", G_GUINT64_CONSTANT (0),
-                                                         NULL);
-  g_ptr_array_add (tariff3_periods, tariff3_period1);
+/* Test that #MwsScheduler:peer-weights are taken into account when sharing
+ * the slots: a peer with weight 2 should get twice as many as one with
+ * weight 1. */
+static void
+test_scheduler_fair_share_weights (Fixture       *fixture,
+                                   gconstpointer  test_data)
+{
+  const TestData *data = test_data;
+  g_assert (data->max_active_entries == 3);
+  g_assert (data->fair_share);
 
-  g_autoptr(MwtTariff) tariff3 = mwt_tariff_new ("tariff3", tariff3_periods);
+  g_autoptr(GError) local_error = NULL;
+
+  mws_peer_manager_dummy_set_peer_credentials (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
+                                               ":owner.1", "/some/heavy/owner");
+  mws_peer_manager_dummy_set_peer_credentials (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
+                                               ":owner.2", "/some/light/owner");
+
+  g_autoptr(MwsScheduleEntry) entry1a = schedule_entry_new_with_priority (":owner.1", 10);
+  g_autoptr(MwsScheduleEntry) entry1b = schedule_entry_new_with_priority (":owner.1", 9);
+  g_autoptr(MwsScheduleEntry) entry1c = schedule_entry_new_with_priority (":owner.1", 8);
+  g_autoptr(MwsScheduleEntry) entry2a = schedule_entry_new_with_priority (":owner.2", 10);
+  g_autoptr(MwsScheduleEntry) entry2b = schedule_entry_new_with_priority (":owner.2", 9);
+
+  g_autoptr(GPtrArray) added = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (added, entry1a);
+  g_ptr_array_add (added, entry1b);
+  g_ptr_array_add (added, entry1c);
+  g_ptr_array_add (added, entry2a);
+  g_ptr_array_add (added, entry2b);
+
+  mws_scheduler_update_entries (fixture->scheduler, added, NULL, &local_error);
+  g_assert_no_error (local_error);
+
+  /* Don’t depend on the order of the active entries, since that depends on
+   * the relative priorities of the two peers, which are arbitrary. */
+  mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
+                                         fixture->scheduler, "notify::entries",
+                                         NULL);
+  mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
+                                         fixture->scheduler, "entries-changed",
+                                         NULL, NULL);
+  mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
+                                         fixture->scheduler, "active-entries-changed",
+                                         NULL, NULL);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry1a));
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry1b));
+  g_assert_false (mws_scheduler_is_entry_active (fixture->scheduler, entry1c));
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry2a));
+  g_assert_false (mws_scheduler_is_entry_active (fixture->scheduler, entry2b));
+}
+
+/* Test that with a single slot, #MwsScheduler:fair-share takes turns between
+ * the peers over time, each keeping the slot for a quantum beyond its fair
+ * share before handing it over. */
+static void
+test_scheduler_fair_share_turns (Fixture       *fixture,
+                                 gconstpointer  test_data)
+{
+  const TestData *data = test_data;
+  g_assert (data->max_active_entries == 1);
+  g_assert (data->fair_share);
+  g_assert (data->fair_share_quantum_secs == 60);
+
+  g_autoptr(GError) local_error = NULL;
+
+  g_autoptr(GTimeZone) tz = g_time_zone_new_utc ();
+  g_autoptr(GDateTime) start_time = g_date_time_new_utc (2018, 2, 3, 0, 30, 0);
+  mws_clock_dummy_set_time_zone (MWS_CLOCK_DUMMY (fixture->clock), tz);
+  mws_clock_dummy_set_time (MWS_CLOCK_DUMMY (fixture->clock), start_time);
+
+  mws_peer_manager_dummy_set_peer_credentials (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
+                                               ":owner.1", "/usr/bin/gnome-software");
+  mws_peer_manager_dummy_set_peer_credentials (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
+                                               ":owner.2", "/some/other/owner");
+
+  g_autoptr(MwsScheduleEntry) entry1 = schedule_entry_new_with_priority (":owner.1", 1);
+  g_autoptr(MwsScheduleEntry) entry2 = schedule_entry_new_with_priority (":owner.2", 1);
+
+  g_autoptr(GPtrArray) added = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (added, entry1);
+  g_ptr_array_add (added, entry2);
+
+  g_autoptr(GPtrArray) entry1_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry1_array, entry1);
+  g_autoptr(GPtrArray) entry2_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry2_array, entry2);
+
+  mws_scheduler_update_entries (fixture->scheduler, added, NULL, &local_error);
+  g_assert_no_error (local_error);
+  assert_entries_changed_signals (fixture, added, NULL, entry1_array, NULL, NULL);
+
+  /* After one quantum, owner 1 has had its fair share, but keeps the slot
+   * for another quantum. */
+  g_autoptr(GDateTime) expected_alarm1 = g_date_time_add_seconds (start_time, 60);
+  g_assert_true (g_date_time_equal (mws_clock_dummy_get_next_alarm_time (MWS_CLOCK_DUMMY (fixture->clock)),
+                                    expected_alarm1));
+  g_assert_true (mws_clock_dummy_next_alarm (MWS_CLOCK_DUMMY (fixture->clock)));
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+
+  /* After two quanta, owner 2 gets its turn. */
+  g_autoptr(GDateTime) expected_alarm2 = g_date_time_add_seconds (start_time, 120);
+  g_assert_true (g_date_time_equal (mws_clock_dummy_get_next_alarm_time (MWS_CLOCK_DUMMY (fixture->clock)),
+                                    expected_alarm2));
+  g_assert_true (mws_clock_dummy_next_alarm (MWS_CLOCK_DUMMY (fixture->clock)));
+  assert_entries_changed_signals (fixture, NULL, NULL, entry2_array, NULL, entry1_array);
+}
+
+/* Test that changes made while rescheduling is frozen are all handled by a
+ * single reschedule when it’s thawed, and that freezes nest. */
+static void
+test_scheduler_scheduling_frozen (Fixture       *fixture,
+                                  gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  /* Add two entries. */
+  g_autoptr(MwsScheduleEntry) entry1 = schedule_entry_new_with_priority (":owner.1", 5);
+  g_autoptr(MwsScheduleEntry) entry2 = schedule_entry_new_with_priority (":owner.1", 10);
+
+  mws_peer_manager_dummy_set_peer_credentials (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
+                                               ":owner.1", "/some/owner");
+
+  g_autoptr(GPtrArray) added = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (added, entry1);
+  g_ptr_array_add (added, entry2);
+
+  g_autoptr(GPtrArray) entry1_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry1_array, entry1);
+  g_autoptr(GPtrArray) entry2_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry2_array, entry2);
+
+  mws_scheduler_update_entries (fixture->scheduler, added, NULL, &local_error);
+  g_assert_no_error (local_error);
+  assert_entries_changed_signals (fixture, added, NULL, entry2_array, NULL, NULL);
+
+  /* Freeze rescheduling and change both priorities so that @entry1 should end
+   * up active. Nothing should be rescheduled until the outer thaw. */
+  mws_scheduler_freeze_reschedule (fixture->scheduler);
+  mws_scheduler_freeze_reschedule (fixture->scheduler);
+
+  mws_schedule_entry_set_priority (entry1, 15);
+  mws_schedule_entry_set_priority (entry2, 1);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+
+  mws_scheduler_thaw_reschedule (fixture->scheduler);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry2));
+
+  mws_scheduler_thaw_reschedule (fixture->scheduler);
+  assert_entries_changed_signals (fixture, NULL, NULL, entry1_array, NULL, entry2_array);
+
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry1));
+  g_assert_false (mws_scheduler_is_entry_active (fixture->scheduler, entry2));
+
+  /* Thawing without any changes should do nothing. */
+  mws_scheduler_freeze_reschedule (fixture->scheduler);
+  mws_scheduler_thaw_reschedule (fixture->scheduler);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+}
+
+/* Test that the schedule entries for a given peer are automatically removed if
+ * that peer vanishes, whether they are active or not. */
+static void
+test_scheduler_scheduling_peer_vanished (Fixture       *fixture,
+                                         gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  /* Add several entries. */
+  g_autoptr(MwsScheduleEntry) entry1 = schedule_entry_new_with_priority (":owner.1", 5);
+  g_autoptr(MwsScheduleEntry) entry2 = schedule_entry_new_with_priority (":owner.1", 10);
+  g_autoptr(MwsScheduleEntry) entry3 = schedule_entry_new_with_priority (":owner.2", 2);
+
+  /* Set up the peer credentials. Make sure :owner.1 is scheduled first, by
+   * making it gnome-software. */
+  mws_peer_manager_dummy_set_peer_credentials (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
+                                               ":owner.1", "/usr/bin/gnome-software");
+  mws_peer_manager_dummy_set_peer_credentials (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
+                                               ":owner.2", "/some/other/path");
+
+  /* Add all the entries to the scheduler. */
+  g_autoptr(GPtrArray) added = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (added, entry1);
+  g_ptr_array_add (added, entry2);
+  g_ptr_array_add (added, entry3);
+
+  g_autoptr(GPtrArray) expected_active1 = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (expected_active1, entry2);
+
+  mws_scheduler_update_entries (fixture->scheduler, added, NULL, &local_error);
+  g_assert_no_error (local_error);
+  assert_entries_changed_signals (fixture, added, NULL, expected_active1, NULL, NULL);
+
+  /* Make `:owner.1` vanish, and check that both its entries (but not the third
+   * entry) disappear. */
+  mws_peer_manager_dummy_remove_peer (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
+                                      ":owner.1");
+
+  g_autoptr(GPtrArray) expected_removed = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (expected_removed, entry2);
+  g_ptr_array_add (expected_removed, entry1);
+
+  g_autoptr(GPtrArray) expected_active2 = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (expected_active2, entry3);
+
+  assert_entries_changed_signals (fixture, NULL, expected_removed,
+                                  expected_active2, expected_active1, NULL);
+
+  /* Now make `:owner.2` vanish, to test what happens when there will be no new
+   * active entry to take the place of the one being removed. */
+  mws_peer_manager_dummy_remove_peer (MWS_PEER_MANAGER_DUMMY (fixture->peer_manager),
+                                      ":owner.2");
+
+  assert_entries_changed_signals (fixture, NULL, expected_active2, NULL, expected_active2, NULL);
+}
+
+/* Test the transitions between different network connection states, checking
+ * whether they cause a single entry to be scheduled/unscheduled
+ * appropriately. Each test vector provides two states of a set of network
+ * connections. The test starts in state 1, checks whether the entry is
+ * scheduled appropriately, transitions to state 2, checks again, and then
+ * transitions back to state 1 to test the reverse transition (and checks
+ * again). */
+static void
+test_scheduler_scheduling_metered_connection (Fixture       *fixture,
+                                              gconstpointer  test_data)
+{
+  /* Various pre-defined connection details, which can be assigned for use below. */
+  const MwsConnectionDetails connection_metered =
+    {
+      .metered = MWS_METERED_YES,
+      .allow_downloads_when_metered = FALSE,
+      .allow_downloads = TRUE,
+      .tariff = NULL,
+    };
+  const MwsConnectionDetails connection_maybe_metered =
+    {
+      .metered = MWS_METERED_GUESS_YES,
+      .allow_downloads_when_metered = FALSE,
+      .allow_downloads = TRUE,
+      .tariff = NULL,
+    };
+  const MwsConnectionDetails connection_unmetered =
+    {
+      .metered = MWS_METERED_NO,
+      .allow_downloads_when_metered = FALSE,
+      .allow_downloads = TRUE,
+      .tariff = NULL,
+    };
+  const MwsConnectionDetails connection_metered_allow_downloads =
+    {
+      .metered = MWS_METERED_YES,
+      .allow_downloads_when_metered = TRUE,
+      .allow_downloads = TRUE,
+      .tariff = NULL,
+    };
+  const MwsConnectionDetails connection_metered_no_downloads =
+    {
+      .metered = MWS_METERED_YES,
+      .allow_downloads_when_metered = FALSE,
+      .allow_downloads = FALSE,
+      .tariff = NULL,
+    };
+  const MwsConnectionDetails connection_unmetered_no_downloads =
+    {
+      .metered = MWS_METERED_NO,
+      .allow_downloads_when_metered = FALSE,
+      .allow_downloads = FALSE,
+      .tariff = NULL,
+    };
 
   g_autoptr(GError) local_error = NULL;
   struct
     {
-      /* We use a fixed limit of 3 tariffs in these tests, because we should
+      /* We use a fixed limit of 3 connections in these tests, because we should
        * be able to simulate any condition we care about using 3. Typically,
        * systems will have only 1 active connection (maybe 2 if they have wired
-       * and Wi-Fi enabled at the same time). Each tariff listed here will
-       * result in a separate network connection being configured.
-       *
-       * The dates/times below are given in UTC, and then converted to the
-       * timezone given as @state1_tz or @state2_tz. This means they represent
-       * the same instant as the UTC time, and hence @state1_expected_active
-       * and @state2_expected_active are independent of @state1_tz and
-       * @state2_tz. */
-      const MwtTariff *state1_tariffs[3];
-      gint state1_year;
-      gint state1_month;
-      gint state1_day;
-      gint state1_hour;
-      gint state1_minute;
-      gdouble state1_seconds;
-      const gchar *state1_tz;
+       * and Wi-Fi enabled at the same time). */
+      const MwsConnectionDetails *state1_connections[3];
+      gboolean state1_expected_allow_downloads;
       gboolean state1_expected_active;
-      const MwtTariff *state2_tariffs[3];
-      gint state2_year;
-      gint state2_month;
-      gint state2_day;
-      gint state2_hour;
-      gint state2_minute;
-      gdouble state2_seconds;
-      const gchar *state2_tz;
+      const MwsConnectionDetails *state2_connections[3];
+      gboolean state2_expected_allow_downloads;
       gboolean state2_expected_active;
     }
   transitions[] =
     {
-      /* Transition from an unmetered period to a metered period in the same
-       * tariff. */
-      { { tariff1, }, 2018, 2, 3, 17, 0, 0, NULL, TRUE,
-        { tariff1, }, 2018, 2, 4, 1, 30, 0, NULL, FALSE },
-      /* Transition within an unmetered period, and within a metered period. */
-      { { tariff1, }, 2018, 2, 3, 17, 0, 0, NULL, TRUE,
-        { tariff1, }, 2018, 2, 3, 17, 30, 0, NULL, TRUE },
-      { { tariff1, }, 2018, 2, 4, 1, 15, 0, NULL, FALSE,
-        { tariff1, }, 2018, 2, 4, 1, 30, 0, NULL, FALSE },
-      /* Transition between an unmetered tariff and a normal tariff, for a time
-       * which is and is not in the tariff metered period. */
-      { { tariff_unmetered, }, 2018, 2, 3, 17, 0, 0, NULL, TRUE,
-        { tariff1, }, 2018, 2, 3, 17, 0, 0, NULL, TRUE },
-      { { tariff_unmetered, }, 2018, 2, 4, 1, 30, 0, NULL, TRUE,
-        { tariff1, }, 2018, 2, 4, 1, 30, 0, NULL, FALSE },
-      /* Transition from an unmetered period and a metered period in one
-       * tariff, to a metered period in one and an unmetered period in another.
-       * Since the scheduler requires *all* connections to be safe in order to
-       * start a download, this leads to very limited active downloads. */
-      { { tariff1, tariff2, }, 2018, 2, 4, 0, 30, 0, NULL, FALSE,
-        { tariff1, tariff2, }, 2018, 2, 4, 1, 15, 0, NULL, FALSE },
-      { { tariff1, tariff2, }, 2018, 2, 4, 1, 45, 0, NULL, FALSE,
-        { tariff1, tariff2, }, 2018, 2, 4, 1, 59, 0, NULL, FALSE },
-      { { tariff1, tariff2, }, 2018, 2, 4, 2, 0, 0, NULL, TRUE,
-        { tariff1, tariff2, }, 2018, 2, 4, 2, 15, 0, NULL, TRUE },
-      /* Timezone change in metered and unmetered periods. The underlying UTC
-       * time may change at the same time, to either give a timezone change only
-       * (where the underlying UTC time is the same) or a timezone and time
-       * change such that the resolved wall clock time stays the same */
-      /* Change timezone only: */
-      { { tariff1, }, 2018, 2, 3, 15, 30, 0, "Europe/London" /* UTC+0 */, TRUE,
-        { tariff1, }, 2018, 2, 3, 15, 30, 0, "Australia/Brisbane" /* UTC+10 */, TRUE },
-      /* Keep wall clock time unchanged: */
-      { { tariff1, }, 2018, 2, 3, 1, 30, 0, "Australia/Brisbane" /* UTC+10 */, FALSE,
-        { tariff1, }, 2018, 2, 3, 11, 30, 0, "Europe/London" /* UTC+0 */, TRUE },
+      /* Transition from definitely metered to definitely unmetered. */
+      { { &connection_metered, }, FALSE, FALSE,
+        { &connection_unmetered, }, TRUE, TRUE },
+      /* Transition from maybe metered to definitely unmetered. */
+      { { &connection_maybe_metered, }, FALSE, FALSE,
+        { &connection_unmetered, }, TRUE, TRUE },
+      /* Transition from maybe metered to definitely unmetered. */
+      { { &connection_maybe_metered, }, FALSE, FALSE,
+        { &connection_unmetered, }, TRUE, TRUE },
+      /* Transition from definitely metered to definitely unmetered, but with
+       * downloads disabled. */
+      { { &connection_metered_no_downloads, }, FALSE, FALSE,
+        { &connection_unmetered_no_downloads, }, FALSE, FALSE },
+      /* Transition from unmetered to metered (but with downloads allowed). */
+      { { &connection_unmetered, }, TRUE, TRUE,
+        { &connection_metered_allow_downloads, }, TRUE, TRUE },
+      /* Transition from metered to metered (but with downloads allowed). */
+      { { &connection_metered, }, FALSE, FALSE,
+        { &connection_metered_allow_downloads, }, TRUE, TRUE },
+      /* Transition from two definitely metered connections to having both of
+       * them definitely unmetered. */
+      { { &connection_metered, &connection_metered }, FALSE, FALSE,
+        { &connection_unmetered, &connection_unmetered, }, TRUE, TRUE },
+      /* Transition from two definitely metered connections to having one of
+       * them definitely unmetered. */
+      { { &connection_metered, &connection_metered }, FALSE, FALSE,
+        { &connection_metered, &connection_unmetered, }, FALSE, FALSE },
+      /* Transition from a metered and an unmetered connection to having one of
+       * them allow downloads. */
+      { { &connection_unmetered, &connection_metered }, FALSE, FALSE,
+        { &connection_unmetered, &connection_metered_allow_downloads, }, TRUE, TRUE },
+      /* Transition from a selection of connections to various unmetered ones
+       * with downloads disallowed. allow-downloads must remain false. */
+      { { &connection_unmetered, &connection_metered, &connection_unmetered }, FALSE, FALSE,
+        { &connection_unmetered_no_downloads, &connection_unmetered_no_downloads, &connection_unmetered_no_downloads }, FALSE, FALSE },
+    };
+
+  for (gsize i = 0; i < G_N_ELEMENTS (transitions); i++)
+    {
+      /* We only care about transitions within a given connection in this test,
+       * so the set of connections available in states 1 and 2 must be the same */
+      for (gsize j = 0; j < G_N_ELEMENTS (transitions[i].state1_connections); j++)
+        g_assert ((transitions[i].state1_connections[j] == NULL) ==
+                  (transitions[i].state2_connections[j] == NULL));
+
+      g_test_message ("Transition test %" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT,
+                      i + 1, G_N_ELEMENTS (transitions));
+
+      gboolean initial_allow_downloads = mws_scheduler_get_allow_downloads (fixture->scheduler);
+
+      /* Set up the connections in state 1. */
+      g_autoptr(GHashTable) state1_connections =
+          g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+      for (gsize j = 0; j < G_N_ELEMENTS (transitions[i].state1_connections); j++)
+        {
+          if (transitions[i].state1_connections[j] != NULL)
+            {
+              g_autofree gchar *id = g_strdup_printf ("connection%" G_GSIZE_FORMAT, j);
+              g_hash_table_insert (state1_connections, g_steal_pointer (&id),
+                                   transitions[i].state1_connections[j]);
+            }
+        }
+
+      mws_connection_monitor_dummy_update_connections (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                       state1_connections, NULL);
+
+      if (transitions[i].state1_expected_allow_downloads != initial_allow_downloads)
+        mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
+                                               fixture->scheduler,
+                                               "notify::allow-downloads", NULL);
+      mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+
+      /* Add a single entry to the scheduler. */
+      g_autoptr(MwsScheduleEntry) entry = mws_schedule_entry_new (":owner.1");
+
+      g_autoptr(GPtrArray) entry_array = g_ptr_array_new_with_free_func (NULL);
+      g_ptr_array_add (entry_array, entry);
+
+      mws_scheduler_update_entries (fixture->scheduler, entry_array, NULL, &local_error);
+      g_assert_no_error (local_error);
+      assert_entries_changed_signals (fixture, entry_array, NULL,
+                                      (transitions[i].state1_expected_active ? entry_array : NULL),
+                                      NULL, NULL);
+
+      /* Change to the next connection state. */
+      for (gsize j = 0; j < G_N_ELEMENTS (transitions[i].state2_connections); j++)
+        {
+          if (transitions[i].state2_connections[j] != NULL)
+            {
+              g_autofree gchar *id = g_strdup_printf ("connection%" G_GSIZE_FORMAT, j);
+              mws_connection_monitor_dummy_update_connection (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                              id, transitions[i].state2_connections[j]);
+            }
+        }
+
+      if (transitions[i].state2_expected_allow_downloads != transitions[i].state1_expected_allow_downloads)
+        mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
+                                               fixture->scheduler,
+                                               "notify::allow-downloads", NULL);
+
+      if (transitions[i].state1_expected_active == transitions[i].state2_expected_active)
+        mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+      else if (transitions[i].state1_expected_active)
+        assert_entries_changed_signals (fixture, NULL, NULL, NULL, entry_array, NULL);
+      else
+        assert_entries_changed_signals (fixture, NULL, NULL, entry_array, NULL, NULL);
+
+      /* Change back to the previous connection state. The entry’s scheduled
+       * state should always be the same as before. */
+      for (gsize j = 0; j < G_N_ELEMENTS (transitions[i].state1_connections); j++)
+        {
+          if (transitions[i].state1_connections[j] != NULL)
+            {
+              g_autofree gchar *id = g_strdup_printf ("connection%" G_GSIZE_FORMAT, j);
+              mws_connection_monitor_dummy_update_connection (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                              id, transitions[i].state1_connections[j]);
+            }
+        }
+
+      if (transitions[i].state1_expected_allow_downloads != transitions[i].state2_expected_allow_downloads)
+        mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
+                                               fixture->scheduler,
+                                               "notify::allow-downloads", NULL);
+
+      if (transitions[i].state1_expected_active == transitions[i].state2_expected_active)
+        mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+      else if (transitions[i].state2_expected_active)
+        assert_entries_changed_signals (fixture, NULL, NULL, NULL, entry_array, NULL);
+      else
+        assert_entries_changed_signals (fixture, NULL, NULL, entry_array, NULL, NULL);
+
+      /* Clean up. */
+      teardown (fixture, test_data);
+      setup (fixture, test_data);
+    }
+}
+
+static GTimeZone *
+time_zone_new (const gchar *tz_str)
+{
+  if (tz_str != NULL)
+    {
+#if GLIB_CHECK_VERSION(2, 68, 0)
+      g_autoptr(GTimeZone) tz = g_time_zone_new_identifier (tz_str);
+      g_assert_nonnull (tz);
+      return g_steal_pointer (&tz);
+#else
+      return g_time_zone_new (tz_str);
+#endif
+    }
+  else
+    {
+      return g_time_zone_new_utc ();
+    }
+}
+
+/* Test the transitions between different tariffs, checking whether they cause a
+ * single entry to be scheduled/unscheduled appropriately. Each test vector
+ * provides two states of a set of tariffs, and two times. Either the set of
+ * tariffs can vary, or the time can vary in a single vector — not both. The
+ * test starts in state 1 at time 1, checks whether the entry is scheduled
+ * appropriately, transitions to state 2 at time 2, checks again, and then
+ * transitions back to state 1 at time 1 to test the reverse transition (and
+ * checks again). */
+static void
+test_scheduler_scheduling_tariff (Fixture       *fixture,
+                                  gconstpointer  test_data)
+{
+  /* A tariff which is normally unmetered, but has a period from 01:00–02:00
+   * each day which has zero capacity limit. */
+  g_autoptr(GPtrArray) tariff1_periods = g_ptr_array_new_with_free_func (NULL);
+
+  g_autoptr(GDateTime) tariff1_period1_start = g_date_time_new_utc (2018, 1, 1, 0, 0, 0);
+  g_autoptr(GDateTime) tariff1_period1_end = g_date_time_new_utc (2018, 1, 2, 0, 0, 0);
+  g_autoptr(MwtPeriod) tariff1_period1 = mwt_period_new (tariff1_period1_start,
+                                                         tariff1_period1_end,
+                                                         MWT_PERIOD_REPEAT_DAY,
+                                                         1,
+                                                         "capacity-limit", G_MAXUINT64,
+                                                         NULL);
+  g_ptr_array_add (tariff1_periods, tariff1_period1);
+
+  g_autoptr(GDateTime) tariff1_period2_start = g_date_time_new_utc (2018, 1, 1, 1, 0, 0);
+  g_autoptr(GDateTime) tariff1_period2_end = g_date_time_new_utc (2018, 1, 1, 2, 0, 0);
+  g_autoptr(MwtPeriod) tariff1_period2 = mwt_period_new (tariff1_period2_start,
+                                                         tariff1_period2_end,
+                                                         MWT_PERIOD_REPEAT_DAY,
+                                                         1,
+                                                         "capacity-limit", G_GUINT64_CONSTANT (0),
+                                                         NULL);
+  g_ptr_array_add (tariff1_periods, tariff1_period2);
+
+  g_autoptr(MwtTariff) tariff1 = mwt_tariff_new ("tariff1", tariff1_periods);
+
+  /* A tariff which is always unmetered (infinite capacity limit). */
+  g_autoptr(GPtrArray) tariff_unmetered_periods = g_ptr_array_new_with_free_func (NULL);
+
+  g_autoptr(GDateTime) tariff_unmetered_period1_start = g_date_time_new_utc (2018, 1, 1, 0, 0, 0);
+  g_autoptr(GDateTime) tariff_unmetered_period1_end = g_date_time_new_utc (2018, 1, 2, 0, 0, 0);
+  g_autoptr(MwtPeriod) tariff_unmetered_period1 = mwt_period_new (tariff_unmetered_period1_start,
+                                                                  tariff_unmetered_period1_end,
+                                                                  MWT_PERIOD_REPEAT_DAY,
+                                                                  1,
+                                                                  "capacity-limit", G_MAXUINT64,
+                                                                  NULL);
+  g_ptr_array_add (tariff_unmetered_periods, tariff_unmetered_period1);
+
+  g_autoptr(MwtTariff) tariff_unmetered = mwt_tariff_new ("tariff_unmetered",
+                                                          tariff_unmetered_periods);
+
+  /* A tariff which is normally metered, but has a period from 01:30–02:00
+   * each day which has unlimited capacity. */
+  g_autoptr(GPtrArray) tariff2_periods = g_ptr_array_new_with_free_func (NULL);
+
+  g_autoptr(GDateTime) tariff2_period1_start = g_date_time_new_utc (2018, 1, 1, 0, 0, 0);
+  g_autoptr(GDateTime) tariff2_period1_end = g_date_time_new_utc (2018, 1, 2, 0, 0, 0);
+  g_autoptr(MwtPeriod) tariff2_period1 = mwt_period_new (tariff2_period1_start,
+                                                         tariff2_period1_end,
+                                                         MWT_PERIOD_REPEAT_DAY,
+                                                         1,
+                                                         "capacity-limit", G_GUINT64_CONSTANT (0),
+                                                         NULL);
+  g_ptr_array_add (tariff2_periods, tariff2_period1);
+
+  g_autoptr(GDateTime) tariff2_period2_start = g_date_time_new_utc (2018, 1, 1, 1, 30, 0);
+  g_autoptr(GDateTime) tariff2_period2_end = g_date_time_new_utc (2018, 1, 1, 2, 30, 0);
+  g_autoptr(MwtPeriod) tariff2_period2 = mwt_period_new (tariff2_period2_start,
+                                                         tariff2_period2_end,
+                                                         MWT_PERIOD_REPEAT_DAY,
+                                                         1,
+                                                         "capacity-limit", G_MAXUINT64,
+                                                         NULL);
+  g_ptr_array_add (tariff2_periods, tariff2_period2);
+
+  g_autoptr(MwtTariff) tariff2 = mwt_tariff_new ("tariff2", tariff2_periods);
+
+  /* A tariff has a single period and no recurrence. */
+  g_autoptr(GPtrArray) tariff3_periods = g_ptr_array_new_with_free_func (NULL);
+
+  g_autoptr(GDateTime) tariff3_period1_start = g_date_time_new_utc (2018, 1, 1, 0, 0, 0);
+  g_autoptr(GDateTime) tariff3_period1_end = g_date_time_new_utc (2018, 1, 2, 0, 0, 0);
+  g_autoptr(MwtPeriod) tariff3_period1 = mwt_period_new (tariff3_period1_start,
+                                                         tariff3_period1_end,
+                                                         MWT_PERIOD_REPEAT_NONE,
+                                                         0,
+                                                         "capacity-limit", G_GUINT64_CONSTANT (0),
+                                                         NULL);
+  g_ptr_array_add (tariff3_periods, tariff3_period1);
+
+  g_autoptr(MwtTariff) tariff3 = mwt_tariff_new ("tariff3", tariff3_periods);
+
+  g_autoptr(GError) local_error = NULL;
+  struct
+    {
+      /* We use a fixed limit of 3 tariffs in these tests, because we should
+       * be able to simulate any condition we care about using 3. Typically,
+       * systems will have only 1 active connection (maybe 2 if they have wired
+       * and Wi-Fi enabled at the same time). Each tariff listed here will
+       * result in a separate network connection being configured.
+       *
+       * The dates/times below are given in UTC, and then converted to the
+       * timezone given as @state1_tz or @state2_tz. This means they represent
+       * the same instant as the UTC time, and hence @state1_expected_active
+       * and @state2_expected_active are independent of @state1_tz and
+       * @state2_tz. */
+      const MwtTariff *state1_tariffs[3];
+      gint state1_year;
+      gint state1_month;
+      gint state1_day;
+      gint state1_hour;
+      gint state1_minute;
+      gdouble state1_seconds;
+      const gchar *state1_tz;
+      gboolean state1_expected_active;
+      const MwtTariff *state2_tariffs[3];
+      gint state2_year;
+      gint state2_month;
+      gint state2_day;
+      gint state2_hour;
+      gint state2_minute;
+      gdouble state2_seconds;
+      const gchar *state2_tz;
+      gboolean state2_expected_active;
+    }
+  transitions[] =
+    {
+      /* Transition from an unmetered period to a metered period in the same
+       * tariff. */
+      { { tariff1, }, 2018, 2, 3, 17, 0, 0, NULL, TRUE,
+        { tariff1, }, 2018, 2, 4, 1, 30, 0, NULL, FALSE },
+      /* Transition within an unmetered period, and within a metered period. */
+      { { tariff1, }, 2018, 2, 3, 17, 0, 0, NULL, TRUE,
+        { tariff1, }, 2018, 2, 3, 17, 30, 0, NULL, TRUE },
+      { { tariff1, }, 2018, 2, 4, 1, 15, 0, NULL, FALSE,
+        { tariff1, }, 2018, 2, 4, 1, 30, 0, NULL, FALSE },
+      /* Transition between an unmetered tariff and a normal tariff, for a time
+       * which is and is not in the tariff metered period. */
+      { { tariff_unmetered, }, 2018, 2, 3, 17, 0, 0, NULL, TRUE,
+        { tariff1, }, 2018, 2, 3, 17, 0, 0, NULL, TRUE },
+      { { tariff_unmetered, }, 2018, 2, 4, 1, 30, 0, NULL, TRUE,
+        { tariff1, }, 2018, 2, 4, 1, 30, 0, NULL, FALSE },
+      /* Transition from an unmetered period and a metered period in one
+       * tariff, to a metered period in one and an unmetered period in another.
+       * Since the scheduler requires *all* connections to be safe in order to
+       * start a download, this leads to very limited active downloads. */
+      { { tariff1, tariff2, }, 2018, 2, 4, 0, 30, 0, NULL, FALSE,
+        { tariff1, tariff2, }, 2018, 2, 4, 1, 15, 0, NULL, FALSE },
+      { { tariff1, tariff2, }, 2018, 2, 4, 1, 45, 0, NULL, FALSE,
+        { tariff1, tariff2, }, 2018, 2, 4, 1, 59, 0, NULL, FALSE },
+      { { tariff1, tariff2, }, 2018, 2, 4, 2, 0, 0, NULL, TRUE,
+        { tariff1, tariff2, }, 2018, 2, 4, 2, 15, 0, NULL, TRUE },
+      /* Timezone change in metered and unmetered periods. The underlying UTC
+       * time may change at the same time, to either give a timezone change only
+       * (where the underlying UTC time is the same) or a timezone and time
+       * change such that the resolved wall clock time stays the same */
+      /* Change timezone only: */
+      { { tariff1, }, 2018, 2, 3, 15, 30, 0, "Europe/London" /* UTC+0 */, TRUE,
+        { tariff1, }, 2018, 2, 3, 15, 30, 0, "Australia/Brisbane" /* UTC+10 */, TRUE },
+      /* Keep wall clock time unchanged: */
+      { { tariff1, }, 2018, 2, 3, 1, 30, 0, "Australia/Brisbane" /* UTC+10 */, FALSE,
+        { tariff1, }, 2018, 2, 3, 11, 30, 0, "Europe/London" /* UTC+0 */, TRUE },
+
+      { { tariff1, }, 2018, 2, 3, 16, 30, 0, "Europe/London" /* UTC+0 */, TRUE,
+        { tariff1, }, 2018, 2, 3, 16, 30, 0, "Europe/Berlin" /* UTC+1 */, TRUE },
+      { { tariff1, }, 2018, 2, 3, 15, 30, 0, "Europe/Berlin" /* UTC+1 */, TRUE,
+        { tariff1, }, 2018, 2, 3, 16, 30, 0, "Europe/London" /* UTC+0 */, TRUE },
+
+      { { tariff1, }, 2018, 2, 3, 1, 30, 0, "Europe/London" /* UTC+0 */, FALSE,
+        { tariff1, }, 2018, 2, 3, 1, 30, 0, "Australia/Brisbane" /* UTC+10 */, FALSE },
+      { { tariff1, }, 2018, 2, 2, 15, 30, 0, "Australia/Brisbane" /* UTC+10 */, TRUE,
+        { tariff1, }, 2018, 2, 3, 1, 30, 0, "Europe/London" /* UTC+0 */, FALSE },
+
+      { { tariff1, }, 2018, 2, 3, 1, 30, 0, "Europe/London", FALSE,
+        { tariff1, }, 2018, 2, 3, 1, 30, 0, "Europe/Isle_of_Man", FALSE },
+      /* Test different times in (and out of) a tariff which doesn’t repeat. */
+      { { tariff3, }, 2017, 12, 30, 0, 0, 0, NULL, TRUE,
+        { tariff3, }, 2018, 1, 1, 1, 30, 0, NULL, FALSE },
+      { { tariff3, }, 2018, 1, 1, 0, 0, 0, NULL, FALSE,
+        { tariff3, }, 2018, 1, 2, 0, 0, 0, NULL, TRUE },
+    };
+
+  for (gsize i = 0; i < G_N_ELEMENTS (transitions); i++)
+    {
+      /* Set up the dates/times. The date/time figures in the test vector are
+       * given in UTC and converted to the stated timezone, so they represent
+       * the same instant as the UTC time, but with a likely different wall
+       * clock time. */
+      g_autoptr(GTimeZone) state1_tz = time_zone_new (transitions[i].state1_tz);
+      g_autoptr(GDateTime) state1_time_utc = g_date_time_new_utc (transitions[i].state1_year,
+                                                                  transitions[i].state1_month,
+                                                                  transitions[i].state1_day,
+                                                                  transitions[i].state1_hour,
+                                                                  transitions[i].state1_minute,
+                                                                  transitions[i].state1_seconds);
+      g_autoptr(GDateTime) state1_time = g_date_time_to_timezone (state1_time_utc,
+                                                                  state1_tz);
+
+      g_autoptr(GTimeZone) state2_tz = time_zone_new (transitions[i].state2_tz);
+      g_autoptr(GDateTime) state2_time_utc = g_date_time_new_utc (transitions[i].state2_year,
+                                                                  transitions[i].state2_month,
+                                                                  transitions[i].state2_day,
+                                                                  transitions[i].state2_hour,
+                                                                  transitions[i].state2_minute,
+                                                                  transitions[i].state2_seconds);
+      g_autoptr(GDateTime) state2_time = g_date_time_to_timezone (state2_time_utc,
+                                                                  state2_tz);
+
+      /* We only care about transitions within a given connection in this test,
+       * so the set of connections available in states 1 and 2 must be the same */
+      for (gsize j = 0; j < G_N_ELEMENTS (transitions[i].state1_tariffs); j++)
+        g_assert ((transitions[i].state1_tariffs[j] == NULL) ==
+                  (transitions[i].state2_tariffs[j] == NULL));
+      /* Similarly, we can vary either the wall clock time, or the connection
+       * tariff, between states 1 and 2 — but varying both would give too many
+       * axes of freedom in the test. Ensure only one varies. */
+      gboolean all_tariffs_equal = TRUE;
+      for (gsize j = 0; j < G_N_ELEMENTS (transitions[i].state1_tariffs); j++)
+        all_tariffs_equal =
+            all_tariffs_equal &&
+            transitions[i].state1_tariffs[j] == transitions[i].state2_tariffs[j];
+      g_assert (all_tariffs_equal ||
+                g_date_time_equal (state1_time, state2_time));
+      /* We want a monotonic wall clock. */
+      g_assert_cmpint (g_date_time_compare (state1_time, state2_time), <=, 0);
+
+      g_test_message ("Transition test %" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT,
+                      i + 1, G_N_ELEMENTS (transitions));
+
+      gboolean initial_allow_downloads = mws_scheduler_get_allow_downloads (fixture->scheduler);
+
+      /* Set the time in state 1. */
+      mws_clock_dummy_set_time_zone (MWS_CLOCK_DUMMY (fixture->clock), state1_tz);
+      mws_clock_dummy_set_time (MWS_CLOCK_DUMMY (fixture->clock), state1_time);
+
+      /* Set up the connections in state 1. */
+      g_autoptr(GHashTable) state1_connections =
+          g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+      for (gsize j = 0; j < G_N_ELEMENTS (transitions[i].state1_tariffs); j++)
+        {
+          if (transitions[i].state1_tariffs[j] != NULL)
+            {
+              g_autofree gchar *id = g_strdup_printf ("connection%" G_GSIZE_FORMAT, j);
+
+              g_autofree MwsConnectionDetails *connection = g_new0 (MwsConnectionDetails, 1);
+              connection->metered = MWS_METERED_NO;
+              connection->allow_downloads_when_metered = FALSE;
+              connection->allow_downloads = TRUE;
+              connection->tariff = transitions[i].state1_tariffs[j];
+
+              g_hash_table_insert (state1_connections, g_steal_pointer (&id),
+                                   g_steal_pointer (&connection));
+            }
+        }
+
+      mws_connection_monitor_dummy_update_connections (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                       state1_connections, NULL);
+
+      /* Due to the test setup, we always expect allow-downloads=true. */
+      if (!initial_allow_downloads)
+        mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
+                                               fixture->scheduler,
+                                               "notify::allow-downloads", NULL);
+      mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+
+      /* Add a single entry to the scheduler. */
+      g_autoptr(MwsScheduleEntry) entry = mws_schedule_entry_new (":owner.1");
+
+      g_autoptr(GPtrArray) entry_array = g_ptr_array_new_with_free_func (NULL);
+      g_ptr_array_add (entry_array, entry);
+
+      mws_scheduler_update_entries (fixture->scheduler, entry_array, NULL, &local_error);
+      g_assert_no_error (local_error);
+      assert_entries_changed_signals (fixture, entry_array, NULL,
+                                      (transitions[i].state1_expected_active ? entry_array : NULL),
+                                      NULL, NULL);
+
+      /* Change to the next time. */
+      mws_clock_dummy_set_time_zone (MWS_CLOCK_DUMMY (fixture->clock), state2_tz);
+      mws_clock_dummy_set_time (MWS_CLOCK_DUMMY (fixture->clock), state2_time);
+
+      /* Change to the next connection state. */
+      for (gsize j = 0; j < G_N_ELEMENTS (transitions[i].state2_tariffs); j++)
+        {
+          if (transitions[i].state2_tariffs[j] != NULL)
+            {
+              g_autofree gchar *id = g_strdup_printf ("connection%" G_GSIZE_FORMAT, j);
+
+              g_autofree MwsConnectionDetails *connection = g_new0 (MwsConnectionDetails, 1);
+              connection->metered = MWS_METERED_NO;
+              connection->allow_downloads_when_metered = FALSE;
+              connection->allow_downloads = TRUE;
+              connection->tariff = transitions[i].state2_tariffs[j];
+
+              mws_connection_monitor_dummy_update_connection (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                              id, connection);
+            }
+        }
+
+      if (transitions[i].state1_expected_active == transitions[i].state2_expected_active)
+        mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+      else if (transitions[i].state1_expected_active)
+        assert_entries_changed_signals (fixture, NULL, NULL, NULL, entry_array, NULL);
+      else
+        assert_entries_changed_signals (fixture, NULL, NULL, entry_array, NULL, NULL);
+
+      /* Change back to the previous time. This might not be very realistic,
+       * but the scheduler should deal with it. */
+      mws_clock_dummy_set_time_zone (MWS_CLOCK_DUMMY (fixture->clock), state1_tz);
+      mws_clock_dummy_set_time (MWS_CLOCK_DUMMY (fixture->clock), state1_time);
+
+      /* Change back to the previous connection state. The entry’s scheduled
+       * state should always be the same as before. */
+      for (gsize j = 0; j < G_N_ELEMENTS (transitions[i].state1_tariffs); j++)
+        {
+          if (transitions[i].state1_tariffs[j] != NULL)
+            {
+              g_autofree gchar *id = g_strdup_printf ("connection%" G_GSIZE_FORMAT, j);
+
+              g_autofree MwsConnectionDetails *connection = g_new0 (MwsConnectionDetails, 1);
+              connection->metered = MWS_METERED_NO;
+              connection->allow_downloads_when_metered = FALSE;
+              connection->allow_downloads = TRUE;
+              connection->tariff = transitions[i].state1_tariffs[j];
+
+              mws_connection_monitor_dummy_update_connection (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                              id, connection);
+            }
+        }
+
+      if (transitions[i].state1_expected_active == transitions[i].state2_expected_active)
+        mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+      else if (transitions[i].state2_expected_active)
+        assert_entries_changed_signals (fixture, NULL, NULL, NULL, entry_array, NULL);
+      else
+        assert_entries_changed_signals (fixture, NULL, NULL, entry_array, NULL, NULL);
+
+      /* Clean up. */
+      teardown (fixture, test_data);
+      setup (fixture, test_data);
+    }
+}
+
+/* Test that the scheduler sets an alarm for the next tariff transition, and
+ * reschedules when it fires, without any other input. The tariff is unmetered
+ * apart from 01:00–02:00 each day, when the capacity limit is zero. */
+static void
+test_scheduler_scheduling_tariff_alarm (Fixture       *fixture,
+                                        gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  g_autoptr(GPtrArray) periods = g_ptr_array_new_with_free_func (g_object_unref);
+
+  g_autoptr(GDateTime) period1_start = g_date_time_new_utc (2018, 1, 1, 0, 0, 0);
+  g_autoptr(GDateTime) period1_end = g_date_time_new_utc (2018, 1, 2, 0, 0, 0);
+  g_ptr_array_add (periods, mwt_period_new (period1_start, period1_end,
+                                            MWT_PERIOD_REPEAT_DAY, 1,
+                                            "capacity-limit", G_MAXUINT64,
+                                            NULL));
+
+  g_autoptr(GDateTime) period2_start = g_date_time_new_utc (2018, 1, 1, 1, 0, 0);
+  g_autoptr(GDateTime) period2_end = g_date_time_new_utc (2018, 1, 1, 2, 0, 0);
+  g_ptr_array_add (periods, mwt_period_new (period2_start, period2_end,
+                                            MWT_PERIOD_REPEAT_DAY, 1,
+                                            "capacity-limit", G_GUINT64_CONSTANT (0),
+                                            NULL));
+
+  g_autoptr(MwtTariff) tariff = mwt_tariff_new ("tariff1", periods);
+
+  /* Start at 00:30, when downloads are allowed. */
+  g_autoptr(GTimeZone) tz = g_time_zone_new_utc ();
+  g_autoptr(GDateTime) start_time = g_date_time_new_utc (2018, 2, 3, 0, 30, 0);
+  mws_clock_dummy_set_time_zone (MWS_CLOCK_DUMMY (fixture->clock), tz);
+  mws_clock_dummy_set_time (MWS_CLOCK_DUMMY (fixture->clock), start_time);
+
+  MwsConnectionDetails connection =
+    {
+      .metered = MWS_METERED_NO,
+      .allow_downloads_when_metered = FALSE,
+      .allow_downloads = TRUE,
+      .tariff = tariff,
+    };
+  g_autoptr(GHashTable) connections = g_hash_table_new (g_str_hash, g_str_equal);
+  g_hash_table_insert (connections, "connection0", &connection);
+
+  gboolean initial_allow_downloads = mws_scheduler_get_allow_downloads (fixture->scheduler);
+  mws_connection_monitor_dummy_update_connections (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                   connections, NULL);
+  if (!initial_allow_downloads)
+    mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
+                                           fixture->scheduler,
+                                           "notify::allow-downloads", NULL);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+
+  /* Add an entry, which should become active. */
+  g_autoptr(MwsScheduleEntry) entry = mws_schedule_entry_new (":owner.1");
+  g_autoptr(GPtrArray) entry_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry_array, entry);
+
+  mws_scheduler_update_entries (fixture->scheduler, entry_array, NULL, &local_error);
+  g_assert_no_error (local_error);
+  assert_entries_changed_signals (fixture, entry_array, NULL, entry_array, NULL, NULL);
+
+  /* There should be exactly one alarm, for 01:00. Advancing to it should
+   * deactivate the entry. */
+  g_autoptr(GDateTime) expected_alarm1 = g_date_time_new_utc (2018, 2, 3, 1, 0, 0);
+  g_assert_true (g_date_time_equal (mws_clock_dummy_get_next_alarm_time (MWS_CLOCK_DUMMY (fixture->clock)),
+                                    expected_alarm1));
+  g_assert_true (mws_clock_dummy_next_alarm (MWS_CLOCK_DUMMY (fixture->clock)));
+  assert_entries_changed_signals (fixture, NULL, NULL, NULL, entry_array, NULL);
+
+  /* The next alarm should be for 02:00, which should reactivate the entry. */
+  g_autoptr(GDateTime) expected_alarm2 = g_date_time_new_utc (2018, 2, 3, 2, 0, 0);
+  g_assert_true (g_date_time_equal (mws_clock_dummy_get_next_alarm_time (MWS_CLOCK_DUMMY (fixture->clock)),
+                                    expected_alarm2));
+  g_assert_true (mws_clock_dummy_next_alarm (MWS_CLOCK_DUMMY (fixture->clock)));
+  assert_entries_changed_signals (fixture, NULL, NULL, entry_array, NULL, NULL);
+}
+
+/* Test that with several connections with tariffs, the scheduler only ever
+ * has one alarm pending, for the earliest transition out of all of them, and
+ * that it moves on to the next connection’s transition after that. */
+static void
+test_scheduler_scheduling_tariff_alarm_multiple (Fixture       *fixture,
+                                                 gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  /* Two tariffs which each ban downloads for an hour a day, at different
+   * times. */
+  g_autoptr(GPtrArray) periods0 = g_ptr_array_new_with_free_func (g_object_unref);
+  g_autoptr(GPtrArray) periods1 = g_ptr_array_new_with_free_func (g_object_unref);
+
+  g_autoptr(GDateTime) day_start = g_date_time_new_utc (2018, 1, 1, 0, 0, 0);
+  g_autoptr(GDateTime) day_end = g_date_time_new_utc (2018, 1, 2, 0, 0, 0);
+  g_autoptr(GDateTime) ban0_start = g_date_time_new_utc (2018, 1, 1, 1, 0, 0);
+  g_autoptr(GDateTime) ban0_end = g_date_time_new_utc (2018, 1, 1, 2, 0, 0);
+  g_autoptr(GDateTime) ban1_start = g_date_time_new_utc (2018, 1, 1, 3, 0, 0);
+  g_autoptr(GDateTime) ban1_end = g_date_time_new_utc (2018, 1, 1, 4, 0, 0);
+
+  g_ptr_array_add (periods0, mwt_period_new (day_start, day_end,
+                                             MWT_PERIOD_REPEAT_DAY, 1,
+                                             "capacity-limit", G_MAXUINT64,
+                                             NULL));
+  g_ptr_array_add (periods0, mwt_period_new (ban0_start, ban0_end,
+                                             MWT_PERIOD_REPEAT_DAY, 1,
+                                             "capacity-limit", G_GUINT64_CONSTANT (0),
+                                             NULL));
+  g_ptr_array_add (periods1, mwt_period_new (day_start, day_end,
+                                             MWT_PERIOD_REPEAT_DAY, 1,
+                                             "capacity-limit", G_MAXUINT64,
+                                             NULL));
+  g_ptr_array_add (periods1, mwt_period_new (ban1_start, ban1_end,
+                                             MWT_PERIOD_REPEAT_DAY, 1,
+                                             "capacity-limit", G_GUINT64_CONSTANT (0),
+                                             NULL));
+
+  g_autoptr(MwtTariff) tariff0 = mwt_tariff_new ("tariff0", periods0);
+  g_autoptr(MwtTariff) tariff1 = mwt_tariff_new ("tariff1", periods1);
+
+  /* Start at 00:30, when downloads are allowed on both connections. */
+  g_autoptr(GTimeZone) tz = g_time_zone_new_utc ();
+  g_autoptr(GDateTime) start_time = g_date_time_new_utc (2018, 2, 3, 0, 30, 0);
+  mws_clock_dummy_set_time_zone (MWS_CLOCK_DUMMY (fixture->clock), tz);
+  mws_clock_dummy_set_time (MWS_CLOCK_DUMMY (fixture->clock), start_time);
+
+  MwsConnectionDetails connection0 =
+    {
+      .metered = MWS_METERED_NO,
+      .allow_downloads_when_metered = FALSE,
+      .allow_downloads = TRUE,
+      .tariff = tariff0,
+    };
+  MwsConnectionDetails connection1 =
+    {
+      .metered = MWS_METERED_NO,
+      .allow_downloads_when_metered = FALSE,
+      .allow_downloads = TRUE,
+      .tariff = tariff1,
+    };
+  g_autoptr(GHashTable) connections = g_hash_table_new (g_str_hash, g_str_equal);
+  g_hash_table_insert (connections, "connection0", &connection0);
+  g_hash_table_insert (connections, "connection1", &connection1);
+
+  gboolean initial_allow_downloads = mws_scheduler_get_allow_downloads (fixture->scheduler);
+  mws_connection_monitor_dummy_update_connections (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                   connections, NULL);
+  if (!initial_allow_downloads)
+    mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
+                                           fixture->scheduler,
+                                           "notify::allow-downloads", NULL);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+
+  /* Add an entry, which should become active. */
+  g_autoptr(MwsScheduleEntry) entry = mws_schedule_entry_new (":owner.1");
+  g_autoptr(GPtrArray) entry_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry_array, entry);
+
+  mws_scheduler_update_entries (fixture->scheduler, entry_array, NULL, &local_error);
+  g_assert_no_error (local_error);
+  assert_entries_changed_signals (fixture, entry_array, NULL, entry_array, NULL, NULL);
+
+  /* Each transition should be reached in turn, with only one alarm pending at
+   * a time. The entry is only active when neither connection is banned. */
+  const struct
+    {
+      guint alarm_hour;
+      gboolean active_after;
+    }
+  transitions[] =
+    {
+      { 1, FALSE },
+      { 2, TRUE },
+      { 3, FALSE },
+      { 4, TRUE },
+    };
+
+  for (gsize i = 0; i < G_N_ELEMENTS (transitions); i++)
+    {
+      g_autoptr(GDateTime) expected_alarm =
+          g_date_time_new_utc (2018, 2, 3, transitions[i].alarm_hour, 0, 0);
+
+      g_test_message ("Transition %" G_GSIZE_FORMAT, i);
+
+      g_assert_cmpuint (mws_clock_dummy_get_n_alarms (MWS_CLOCK_DUMMY (fixture->clock)), ==, 1);
+      g_assert_true (g_date_time_equal (mws_clock_dummy_get_next_alarm_time (MWS_CLOCK_DUMMY (fixture->clock)),
+                                        expected_alarm));
+      g_assert_true (mws_clock_dummy_next_alarm (MWS_CLOCK_DUMMY (fixture->clock)));
+
+      if (transitions[i].active_after)
+        assert_entries_changed_signals (fixture, NULL, NULL, entry_array, NULL, NULL);
+      else
+        assert_entries_changed_signals (fixture, NULL, NULL, NULL, entry_array, NULL);
+    }
+
+  /* The next alarm is the start of the next day, when both tariffs’ daily
+   * periods recur. */
+  g_autoptr(GDateTime) expected_alarm = g_date_time_new_utc (2018, 2, 4, 0, 0, 0);
+  g_assert_cmpuint (mws_clock_dummy_get_n_alarms (MWS_CLOCK_DUMMY (fixture->clock)), ==, 1);
+  g_assert_true (g_date_time_equal (mws_clock_dummy_get_next_alarm_time (MWS_CLOCK_DUMMY (fixture->clock)),
+                                    expected_alarm));
+}
+
+/* Test that the bytes received over a connection are counted against the
+ * capacity limit of its current tariff period, that entries are deactivated
+ * when the limit is reached, and that they are reactivated when the next
+ * recurrence of the period starts. */
+static void
+test_scheduler_scheduling_capacity_limit (Fixture       *fixture,
+                                          gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  g_autoptr(GPtrArray) periods = g_ptr_array_new_with_free_func (g_object_unref);
+
+  g_autoptr(GDateTime) period1_start = g_date_time_new_utc (2018, 1, 1, 0, 0, 0);
+  g_autoptr(GDateTime) period1_end = g_date_time_new_utc (2018, 1, 2, 0, 0, 0);
+  g_ptr_array_add (periods, mwt_period_new (period1_start, period1_end,
+                                            MWT_PERIOD_REPEAT_DAY, 1,
+                                            "capacity-limit", G_GUINT64_CONSTANT (1000),
+                                            NULL));
+
+  g_autoptr(MwtTariff) tariff = mwt_tariff_new ("tariff1", periods);
+
+  g_autoptr(GTimeZone) tz = g_time_zone_new_utc ();
+  g_autoptr(GDateTime) start_time = g_date_time_new_utc (2018, 2, 3, 12, 0, 0);
+  mws_clock_dummy_set_time_zone (MWS_CLOCK_DUMMY (fixture->clock), tz);
+  mws_clock_dummy_set_time (MWS_CLOCK_DUMMY (fixture->clock), start_time);
+
+  MwsConnectionDetails connection =
+    {
+      .metered = MWS_METERED_NO,
+      .allow_downloads_when_metered = FALSE,
+      .allow_downloads = TRUE,
+      .tariff = tariff,
+    };
+  g_autoptr(GHashTable) connections = g_hash_table_new (g_str_hash, g_str_equal);
+  g_hash_table_insert (connections, "connection0", &connection);
+
+  gboolean initial_allow_downloads = mws_scheduler_get_allow_downloads (fixture->scheduler);
+  mws_connection_monitor_dummy_update_connections (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                   connections, NULL);
+  if (!initial_allow_downloads)
+    mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
+                                           fixture->scheduler,
+                                           "notify::allow-downloads", NULL);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+
+  /* Add an entry, which should become active. */
+  g_autoptr(MwsScheduleEntry) entry = mws_schedule_entry_new (":owner.1");
+  g_autoptr(GPtrArray) entry_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry_array, entry);
+
+  mws_scheduler_update_entries (fixture->scheduler, entry_array, NULL, &local_error);
+  g_assert_no_error (local_error);
+  assert_entries_changed_signals (fixture, entry_array, NULL, entry_array, NULL, NULL);
+
+  /* The first counter value is a baseline, so receiving 500 bytes after it
+   * shouldn’t change anything. Nor should the counter going backwards. */
+  mws_connection_monitor_dummy_update_statistics (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                  "connection0", 5000);
+  mws_connection_monitor_dummy_update_statistics (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                  "connection0", 5500);
+  mws_connection_monitor_dummy_update_statistics (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                  "connection0", 100);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry));
+
+  /* Receiving another 500 bytes reaches the limit, which should deactivate
+   * the entry. */
+  mws_connection_monitor_dummy_update_statistics (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                  "connection0", 600);
+  assert_entries_changed_signals (fixture, NULL, NULL, NULL, entry_array, NULL);
+
+  /* Further data shouldn’t trigger another reschedule. */
+  mws_connection_monitor_dummy_update_statistics (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                  "connection0", 700);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+
+  /* The next alarm should be for the start of the next recurrence of the
+   * period, which should reactivate the entry. */
+  g_autoptr(GDateTime) expected_alarm = g_date_time_new_utc (2018, 2, 4, 0, 0, 0);
+  g_assert_true (g_date_time_equal (mws_clock_dummy_get_next_alarm_time (MWS_CLOCK_DUMMY (fixture->clock)),
+                                    expected_alarm));
+  g_assert_true (mws_clock_dummy_next_alarm (MWS_CLOCK_DUMMY (fixture->clock)));
+  assert_entries_changed_signals (fixture, NULL, NULL, entry_array, NULL, NULL);
+}
+
+/* Test that an entry which can be bound to a connection can be active when
+ * only some of the connections are safe, that it’s assigned one of the safe
+ * connections, and that entries which can’t be bound still need all the
+ * connections to be safe. */
+static void
+test_scheduler_scheduling_bind_to_connection (Fixture       *fixture,
+                                              gconstpointer  test_data)
+{
+  const TestData *data = test_data;
+  g_assert (data->max_active_entries == 2);
+
+  const MwsConnectionDetails connection_metered =
+    {
+      .metered = MWS_METERED_YES,
+      .allow_downloads_when_metered = FALSE,
+      .allow_downloads = TRUE,
+      .tariff = NULL,
+    };
+  const MwsConnectionDetails connection_unmetered =
+    {
+      .metered = MWS_METERED_NO,
+      .allow_downloads_when_metered = FALSE,
+      .allow_downloads = TRUE,
+      .tariff = NULL,
+    };
+
+  g_autoptr(GError) local_error = NULL;
+
+  /* Start with one metered and one unmetered connection. */
+  g_autoptr(GHashTable) connections = g_hash_table_new (g_str_hash, g_str_equal);
+  g_hash_table_insert (connections, "connection0", (gpointer) &connection_metered);
+  g_hash_table_insert (connections, "connection1", (gpointer) &connection_unmetered);
+
+  gboolean initial_allow_downloads = mws_scheduler_get_allow_downloads (fixture->scheduler);
+  mws_connection_monitor_dummy_update_connections (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                   connections, NULL);
+  if (initial_allow_downloads)
+    mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
+                                           fixture->scheduler,
+                                           "notify::allow-downloads", NULL);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+
+  /* Add an entry which can’t be bound to a connection, and one which can. Only
+   * the second should become active, on the unmetered connection. */
+  g_autoptr(MwsScheduleEntry) entry1 = mws_schedule_entry_new (":owner.1");
+  g_autoptr(MwsScheduleEntry) entry2 = mws_schedule_entry_new (":owner.1");
+  mws_schedule_entry_set_bind_to_connection (entry2, TRUE);
+
+  g_autoptr(GPtrArray) added_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (added_array, entry1);
+  g_ptr_array_add (added_array, entry2);
+  g_autoptr(GPtrArray) entry1_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry1_array, entry1);
+  g_autoptr(GPtrArray) entry2_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry2_array, entry2);
+
+  mws_scheduler_update_entries (fixture->scheduler, added_array, NULL, &local_error);
+  g_assert_no_error (local_error);
+  assert_entries_changed_signals (fixture, added_array, NULL, entry2_array, NULL, NULL);
+  g_assert_cmpstr (mws_schedule_entry_get_connection_id (entry1), ==, NULL);
+  g_assert_cmpstr (mws_schedule_entry_get_connection_id (entry2), ==, "connection1");
+
+  /* If neither connection is safe, the entry should become inactive. */
+  mws_connection_monitor_dummy_update_connection (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                  "connection1", &connection_metered);
+  assert_entries_changed_signals (fixture, NULL, NULL, NULL, entry2_array, NULL);
+  g_assert_cmpstr (mws_schedule_entry_get_connection_id (entry2), ==, NULL);
+
+  /* And it should become active on the other connection if that becomes
+   * safe. */
+  mws_connection_monitor_dummy_update_connection (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                  "connection0", &connection_unmetered);
+  assert_entries_changed_signals (fixture, NULL, NULL, entry2_array, NULL, NULL);
+  g_assert_cmpstr (mws_schedule_entry_get_connection_id (entry2), ==, "connection0");
+
+  /* Once both connections are safe, the other entry can be active too, and
+   * the bound entry should keep its connection. */
+  mws_connection_monitor_dummy_update_connection (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                  "connection1", &connection_unmetered);
+  mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
+                                         fixture->scheduler,
+                                         "notify::allow-downloads", NULL);
+  assert_entries_changed_signals (fixture, NULL, NULL, entry1_array, NULL, NULL);
+  g_assert_cmpstr (mws_schedule_entry_get_connection_id (entry1), ==, NULL);
+  g_assert_cmpstr (mws_schedule_entry_get_connection_id (entry2), ==, "connection0");
+}
+
+/* Test that active entries are given a max-rate hint which spreads the rest of
+ * the capacity limit of the current tariff period over the rest of the period,
+ * shared between the active entries, and that entries on connections with no
+ * capacity limit aren’t throttled. */
+static void
+test_scheduler_scheduling_max_rate (Fixture       *fixture,
+                                    gconstpointer  test_data)
+{
+  const TestData *data = test_data;
+  g_assert (data->max_active_entries == 2);
+
+  g_autoptr(GError) local_error = NULL;
+
+  /* A tariff which allows 86400000 bytes each day. Half the day is left at
+   * the start time, so the connection can be used at 2000 bytes/s. */
+  g_autoptr(GPtrArray) periods = g_ptr_array_new_with_free_func (g_object_unref);
+
+  g_autoptr(GDateTime) period1_start = g_date_time_new_utc (2018, 1, 1, 0, 0, 0);
+  g_autoptr(GDateTime) period1_end = g_date_time_new_utc (2018, 1, 2, 0, 0, 0);
+  g_ptr_array_add (periods, mwt_period_new (period1_start, period1_end,
+                                            MWT_PERIOD_REPEAT_DAY, 1,
+                                            "capacity-limit", G_GUINT64_CONSTANT (86400000),
+                                            NULL));
+
+  g_autoptr(MwtTariff) tariff = mwt_tariff_new ("tariff1", periods);
+
+  g_autoptr(GTimeZone) tz = g_time_zone_new_utc ();
+  g_autoptr(GDateTime) start_time = g_date_time_new_utc (2018, 2, 3, 12, 0, 0);
+  mws_clock_dummy_set_time_zone (MWS_CLOCK_DUMMY (fixture->clock), tz);
+  mws_clock_dummy_set_time (MWS_CLOCK_DUMMY (fixture->clock), start_time);
+
+  const MwsConnectionDetails connection_limited =
+    {
+      .metered = MWS_METERED_NO,
+      .allow_downloads_when_metered = FALSE,
+      .allow_downloads = TRUE,
+      .tariff = tariff,
+    };
+  const MwsConnectionDetails connection_unlimited =
+    {
+      .metered = MWS_METERED_NO,
+      .allow_downloads_when_metered = FALSE,
+      .allow_downloads = TRUE,
+      .tariff = NULL,
+    };
+  g_autoptr(GHashTable) connections = g_hash_table_new (g_str_hash, g_str_equal);
+  g_hash_table_insert (connections, "connection0", (gpointer) &connection_limited);
+
+  gboolean initial_allow_downloads = mws_scheduler_get_allow_downloads (fixture->scheduler);
+  mws_connection_monitor_dummy_update_connections (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                   connections, NULL);
+  if (!initial_allow_downloads)
+    mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
+                                           fixture->scheduler,
+                                           "notify::allow-downloads", NULL);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+
+  /* Add two entries, which should both become active and share the rate. */
+  g_autoptr(MwsScheduleEntry) entry1 = mws_schedule_entry_new (":owner.1");
+  g_autoptr(MwsScheduleEntry) entry2 = mws_schedule_entry_new (":owner.1");
+  g_autoptr(GPtrArray) added_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (added_array, entry1);
+  g_ptr_array_add (added_array, entry2);
+
+  mws_scheduler_update_entries (fixture->scheduler, added_array, NULL, &local_error);
+  g_assert_no_error (local_error);
+  assert_entries_changed_signals (fixture, added_array, NULL, added_array, NULL, NULL);
+  g_assert_cmpuint (mws_schedule_entry_get_max_rate (entry1), ==, 1000);
+  g_assert_cmpuint (mws_schedule_entry_get_max_rate (entry2), ==, 1000);
+
+  /* Removing one of them should give the other the whole rate. */
+  g_autoptr(GPtrArray) removed_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (removed_array, (gpointer) mws_schedule_entry_get_id (entry2));
+  g_autoptr(GPtrArray) entry2_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry2_array, entry2);
+
+  mws_scheduler_update_entries (fixture->scheduler, NULL, removed_array, &local_error);
+  g_assert_no_error (local_error);
+  assert_entries_changed_signals (fixture, NULL, entry2_array, NULL, entry2_array, NULL);
+  g_assert_cmpuint (mws_schedule_entry_get_max_rate (entry1), ==, 2000);
+
+  /* If the connection loses its capacity limit, the entry shouldn’t be
+   * throttled any more. */
+  mws_connection_monitor_dummy_update_connection (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                  "connection0", &connection_unlimited);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry1));
+  g_assert_cmpuint (mws_schedule_entry_get_max_rate (entry1), ==, 0);
+}
+
+/* Test that an entry with a deadline is deferred to a cheaper tariff window
+ * which starts before the deadline, and becomes active when that window
+ * starts, while an entry without a deadline is active straight away. The
+ * tariff has a capacity limit apart from 02:00–04:00 each day, when it’s
+ * unlimited. */
+static void
+test_scheduler_scheduling_deadline (Fixture       *fixture,
+                                    gconstpointer  test_data)
+{
+  const TestData *data = test_data;
+  g_assert (data->max_active_entries == 2);
+
+  g_autoptr(GError) local_error = NULL;
+
+  g_autoptr(GPtrArray) periods = g_ptr_array_new_with_free_func (g_object_unref);
+
+  g_autoptr(GDateTime) period1_start = g_date_time_new_utc (2018, 1, 1, 0, 0, 0);
+  g_autoptr(GDateTime) period1_end = g_date_time_new_utc (2018, 1, 2, 0, 0, 0);
+  g_ptr_array_add (periods, mwt_period_new (period1_start, period1_end,
+                                            MWT_PERIOD_REPEAT_DAY, 1,
+                                            "capacity-limit", G_GUINT64_CONSTANT (1000000),
+                                            NULL));
+
+  g_autoptr(GDateTime) period2_start = g_date_time_new_utc (2018, 1, 1, 2, 0, 0);
+  g_autoptr(GDateTime) period2_end = g_date_time_new_utc (2018, 1, 1, 4, 0, 0);
+  g_ptr_array_add (periods, mwt_period_new (period2_start, period2_end,
+                                            MWT_PERIOD_REPEAT_DAY, 1,
+                                            "capacity-limit", G_MAXUINT64,
+                                            NULL));
+
+  g_autoptr(MwtTariff) tariff = mwt_tariff_new ("tariff1", periods);
+
+  /* Start at 00:30, in the capped period. */
+  g_autoptr(GTimeZone) tz = g_time_zone_new_utc ();
+  g_autoptr(GDateTime) start_time = g_date_time_new_utc (2018, 2, 3, 0, 30, 0);
+  mws_clock_dummy_set_time_zone (MWS_CLOCK_DUMMY (fixture->clock), tz);
+  mws_clock_dummy_set_time (MWS_CLOCK_DUMMY (fixture->clock), start_time);
+
+  MwsConnectionDetails connection =
+    {
+      .metered = MWS_METERED_NO,
+      .allow_downloads_when_metered = FALSE,
+      .allow_downloads = TRUE,
+      .tariff = tariff,
+    };
+  g_autoptr(GHashTable) connections = g_hash_table_new (g_str_hash, g_str_equal);
+  g_hash_table_insert (connections, "connection0", &connection);
+
+  gboolean initial_allow_downloads = mws_scheduler_get_allow_downloads (fixture->scheduler);
+  mws_connection_monitor_dummy_update_connections (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                   connections, NULL);
+  if (!initial_allow_downloads)
+    mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
+                                           fixture->scheduler,
+                                           "notify::allow-downloads", NULL);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
 
-      { { tariff1, }, 2018, 2, 3, 16, 30, 0, "Europe/London" /* UTC+0 */, TRUE,
-        { tariff1, }, 2018, 2, 3, 16, 30, 0, "Europe/Berlin" /* UTC+1 */, TRUE },
-      { { tariff1, }, 2018, 2, 3, 15, 30, 0, "Europe/Berlin" /* UTC+1 */, TRUE,
-        { tariff1, }, 2018, 2, 3, 16, 30, 0, "Europe/London" /* UTC+0 */, TRUE },
+  /* Add an entry with no deadline, and an entry with a deadline of 06:00. Only
+   * the first should become active. */
+  g_autoptr(GDateTime) deadline = g_date_time_new_utc (2018, 2, 3, 6, 0, 0);
+  g_autoptr(MwsScheduleEntry) entry1 = mws_schedule_entry_new (":owner.1");
+  g_autoptr(MwsScheduleEntry) entry2 = mws_schedule_entry_new (":owner.1");
+  mws_schedule_entry_set_deadline (entry2, g_date_time_to_unix (deadline));
+
+  g_autoptr(GPtrArray) added_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (added_array, entry1);
+  g_ptr_array_add (added_array, entry2);
+  g_autoptr(GPtrArray) entry1_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry1_array, entry1);
+  g_autoptr(GPtrArray) entry2_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry2_array, entry2);
+
+  mws_scheduler_update_entries (fixture->scheduler, added_array, NULL, &local_error);
+  g_assert_no_error (local_error);
+  assert_entries_changed_signals (fixture, added_array, NULL, entry1_array, NULL, NULL);
+  g_assert_false (mws_scheduler_is_entry_active (fixture->scheduler, entry2));
+
+  /* The deferred entry should be predicted to start at 02:00. */
+  g_autoptr(GDateTime) expected_alarm = g_date_time_new_utc (2018, 2, 3, 2, 0, 0);
+  g_assert_cmpuint (mws_schedule_entry_get_download_starts_at (entry1), ==, 0);
+  g_assert_cmpuint (mws_schedule_entry_get_download_starts_at (entry2), ==,
+                    g_date_time_to_unix (expected_alarm));
+
+  /* The next alarm should be for 02:00, which should activate the deferred
+   * entry without affecting the other one. */
+  g_assert_true (g_date_time_equal (mws_clock_dummy_get_next_alarm_time (MWS_CLOCK_DUMMY (fixture->clock)),
+                                    expected_alarm));
+  g_assert_true (mws_clock_dummy_next_alarm (MWS_CLOCK_DUMMY (fixture->clock)));
+  assert_entries_changed_signals (fixture, NULL, NULL, entry2_array, NULL, NULL);
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry1));
+  g_assert_cmpuint (mws_schedule_entry_get_download_starts_at (entry2), ==, 0);
+
+  /* Clearing the deadline of an active entry shouldn’t change anything. */
+  mws_schedule_entry_set_deadline (entry2, 0);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+}
 
-      { { tariff1, }, 2018, 2, 3, 1, 30, 0, "Europe/London" /* UTC+0 */, FALSE,
-        { tariff1, }, 2018, 2, 3, 1, 30, 0, "Australia/Brisbane" /* UTC+10 */, FALSE },
-      { { tariff1, }, 2018, 2, 2, 15, 30, 0, "Australia/Brisbane" /* UTC+10 */, TRUE,
-        { tariff1, }, 2018, 2, 3, 1, 30, 0, "Europe/London" /* UTC+0 */, FALSE },
+/* Test that entries which are waiting for a tariff to allow downloads are
+ * predicted to start when it next does, and that the prediction is cleared
+ * when they become active or it stops applying. The tariff bans downloads
+ * from 01:00–02:00 each day. */
+static void
+test_scheduler_scheduling_download_starts_at (Fixture       *fixture,
+                                              gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
 
-      { { tariff1, }, 2018, 2, 3, 1, 30, 0, "Europe/London", FALSE,
-        { tariff1, }, 2018, 2, 3, 1, 30, 0, "Europe/Isle_of_Man", FALSE },
-      /* Test different times in (and out of) a tariff which doesn’t repeat. */
-      { { tariff3, }, 2017, 12, 30, 0, 0, 0, NULL, TRUE,
-        { tariff3, }, 2018, 1, 1, 1, 30, 0, NULL, FALSE },
-      { { tariff3, }, 2018, 1, 1, 0, 0, 0, NULL, FALSE,
-        { tariff3, }, 2018, 1, 2, 0, 0, 0, NULL, TRUE },
-    };
+  g_autoptr(GPtrArray) periods = g_ptr_array_new_with_free_func (g_object_unref);
 
-  for (gsize i = 0; i < G_N_ELEMENTS (transitions); i++)
+  g_autoptr(GDateTime) period1_start = g_date_time_new_utc (2018, 1, 1, 0, 0, 0);
+  g_autoptr(GDateTime) period1_end = g_date_time_new_utc (2018, 1, 2, 0, 0, 0);
+  g_ptr_array_add (periods, mwt_period_new (period1_start, period1_end,
+                                            MWT_PERIOD_REPEAT_DAY, 1,
+                                            "capacity-limit", G_MAXUINT64,
+                                            NULL));
+
+  g_autoptr(GDateTime) period2_start = g_date_time_new_utc (2018, 1, 1, 1, 0, 0);
+  g_autoptr(GDateTime) period2_end = g_date_time_new_utc (2018, 1, 1, 2, 0, 0);
+  g_ptr_array_add (periods, mwt_period_new (period2_start, period2_end,
+                                            MWT_PERIOD_REPEAT_DAY, 1,
+                                            "capacity-limit", G_GUINT64_CONSTANT (0),
+                                            NULL));
+
+  g_autoptr(MwtTariff) tariff = mwt_tariff_new ("tariff1", periods);
+
+  /* Start at 01:30, when downloads are banned. */
+  g_autoptr(GTimeZone) tz = g_time_zone_new_utc ();
+  g_autoptr(GDateTime) start_time = g_date_time_new_utc (2018, 2, 3, 1, 30, 0);
+  mws_clock_dummy_set_time_zone (MWS_CLOCK_DUMMY (fixture->clock), tz);
+  mws_clock_dummy_set_time (MWS_CLOCK_DUMMY (fixture->clock), start_time);
+
+  MwsConnectionDetails connection =
     {
-      /* Set up the dates/times. The date/time figures in the test vector are
-       * given in UTC and converted to the stated timezone, so they represent
-       * the same instant as the UTC time, but with a likely different wall
-       * clock time. */
-      g_autoptr(GTimeZone) state1_tz = time_zone_new (transitions[i].state1_tz);
-      g_autoptr(GDateTime) state1_time_utc = g_date_time_new_utc (transitions[i].state1_year,
-                                                                  transitions[i].state1_month,
-                                                                  transitions[i].state1_day,
-                                                                  transitions[i].state1_hour,
-                                                                  transitions[i].state1_minute,
-                                                                  transitions[i].state1_seconds);
-      g_autoptr(GDateTime) state1_time = g_date_time_to_timezone (state1_time_utc,
-                                                                  state1_tz);
+      .metered = MWS_METERED_NO,
+      .allow_downloads_when_metered = FALSE,
+      .allow_downloads = TRUE,
+      .tariff = tariff,
+    };
+  g_autoptr(GHashTable) connections = g_hash_table_new (g_str_hash, g_str_equal);
+  g_hash_table_insert (connections, "connection0", &connection);
 
-      g_autoptr(GTimeZone) state2_tz = time_zone_new (transitions[i].state2_tz);
-      g_autoptr(GDateTime) state2_time_utc = g_date_time_new_utc (transitions[i].state2_year,
-                                                                  transitions[i].state2_month,
-                                                                  transitions[i].state2_day,
-                                                                  transitions[i].state2_hour,
-                                                                  transitions[i].state2_minute,
-                                                                  transitions[i].state2_seconds);
-      g_autoptr(GDateTime) state2_time = g_date_time_to_timezone (state2_time_utc,
-                                                                  state2_tz);
+  gboolean initial_allow_downloads = mws_scheduler_get_allow_downloads (fixture->scheduler);
+  mws_connection_monitor_dummy_update_connections (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                   connections, NULL);
+  if (!initial_allow_downloads)
+    mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
+                                           fixture->scheduler,
+                                           "notify::allow-downloads", NULL);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
 
-      /* We only care about transitions within a given connection in this test,
-       * so the set of connections available in states 1 and 2 must be the same */
-      for (gsize j = 0; j < G_N_ELEMENTS (transitions[i].state1_tariffs); j++)
-        g_assert ((transitions[i].state1_tariffs[j] == NULL) ==
-                  (transitions[i].state2_tariffs[j] == NULL));
-      /* Similarly, we can vary either the wall clock time, or the connection
-       * tariff, between states 1 and 2 — but varying both would give too many
-       * axes of freedom in the test. Ensure only one varies. */
-      gboolean all_tariffs_equal = TRUE;
-      for (gsize j = 0; j < G_N_ELEMENTS (transitions[i].state1_tariffs); j++)
-        all_tariffs_equal =
-            all_tariffs_equal &&
-            transitions[i].state1_tariffs[j] == transitions[i].state2_tariffs[j];
-      g_assert (all_tariffs_equal ||
-                g_date_time_equal (state1_time, state2_time));
-      /* We want a monotonic wall clock. */
-      g_assert_cmpint (g_date_time_compare (state1_time, state2_time), <=, 0);
+  /* Add an entry. It shouldn’t become active, but should be predicted to start
+   * at 02:00. */
+  g_autoptr(MwsScheduleEntry) entry = mws_schedule_entry_new (":owner.1");
+  g_autoptr(GPtrArray) entry_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (entry_array, entry);
 
-      g_test_message ("Transition test %" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT,
-                      i + 1, G_N_ELEMENTS (transitions));
+  mws_scheduler_update_entries (fixture->scheduler, entry_array, NULL, &local_error);
+  g_assert_no_error (local_error);
+  assert_entries_changed_signals (fixture, entry_array, NULL, NULL, NULL, NULL);
+  g_assert_false (mws_scheduler_is_entry_active (fixture->scheduler, entry));
+
+  g_autoptr(GDateTime) expected_alarm = g_date_time_new_utc (2018, 2, 3, 2, 0, 0);
+  g_assert_cmpuint (mws_schedule_entry_get_download_starts_at (entry), ==,
+                    g_date_time_to_unix (expected_alarm));
+
+  /* Disallowing downloads on the connection altogether should clear the
+   * prediction, since there’s no transition to wait for. */
+  connection.allow_downloads = FALSE;
+  mws_connection_monitor_dummy_update_connection (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                  "connection0", &connection);
+  mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
+                                         fixture->scheduler,
+                                         "notify::allow-downloads", NULL);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+  g_assert_cmpuint (mws_schedule_entry_get_download_starts_at (entry), ==, 0);
+
+  /* Allowing them again should bring it back. */
+  connection.allow_downloads = TRUE;
+  mws_connection_monitor_dummy_update_connection (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                  "connection0", &connection);
+  mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
+                                         fixture->scheduler,
+                                         "notify::allow-downloads", NULL);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+  g_assert_cmpuint (mws_schedule_entry_get_download_starts_at (entry), ==,
+                    g_date_time_to_unix (expected_alarm));
+
+  /* Advancing to 02:00 should activate the entry and clear the prediction. */
+  g_assert_true (g_date_time_equal (mws_clock_dummy_get_next_alarm_time (MWS_CLOCK_DUMMY (fixture->clock)),
+                                    expected_alarm));
+  g_assert_true (mws_clock_dummy_next_alarm (MWS_CLOCK_DUMMY (fixture->clock)));
+  assert_entries_changed_signals (fixture, NULL, NULL, entry_array, NULL, NULL);
+  g_assert_cmpuint (mws_schedule_entry_get_download_starts_at (entry), ==, 0);
+}
 
-      gboolean initial_allow_downloads = mws_scheduler_get_allow_downloads (fixture->scheduler);
+/* Assert that the plan computed by mws_scheduler_compute_plan() with
+ * @overrides at @now_usec has the entries from @expected_active_entries active,
+ * and next changes at @expected_next_reschedule_usec. */
+static void
+assert_plan (Fixture    *fixture,
+             GHashTable *overrides,
+             gint64      now_usec,
+             GPtrArray  *expected_active_entries,
+             gint64      expected_next_reschedule_usec)
+{
+  g_autoptr(GPtrArray) active_entries = NULL;
+  gint64 next_reschedule_usec = 0;
 
-      /* Set the time in state 1. */
-      mws_clock_dummy_set_time_zone (MWS_CLOCK_DUMMY (fixture->clock), state1_tz);
-      mws_clock_dummy_set_time (MWS_CLOCK_DUMMY (fixture->clock), state1_time);
+  mws_scheduler_compute_plan (fixture->scheduler, overrides, now_usec,
+                              &active_entries, &next_reschedule_usec);
+  assert_ptr_arrays_equal (active_entries, expected_active_entries);
+  g_assert_cmpint (next_reschedule_usec, ==, expected_next_reschedule_usec);
+}
 
-      /* Set up the connections in state 1. */
-      g_autoptr(GHashTable) state1_connections =
-          g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+/* Test that mws_scheduler_compute_plan() takes the connection overrides and
+ * time into account, and doesn’t change the scheduler’s state or emit any
+ * signals. */
+static void
+test_scheduler_compute_plan (Fixture       *fixture,
+                             gconstpointer  test_data)
+{
+  const TestData *data = test_data;
+  g_assert (data->max_active_entries == 2);
 
-      for (gsize j = 0; j < G_N_ELEMENTS (transitions[i].state1_tariffs); j++)
-        {
-          if (transitions[i].state1_tariffs[j] != NULL)
-            {
-              g_autofree gchar *id = g_strdup_printf ("connection%" G_GSIZE_FORMAT, j);
+  g_autoptr(GError) local_error = NULL;
 
-              g_autofree MwsConnectionDetails *connection = g_new0 (MwsConnectionDetails, 1);
-              connection->metered = MWS_METERED_NO;
-              connection->allow_downloads_when_metered = FALSE;
-              connection->allow_downloads = TRUE;
-              connection->tariff = transitions[i].state1_tariffs[j];
+  /* A tariff where downloads are banned from 02:00 to 04:00 every day. */
+  g_autoptr(GPtrArray) periods = g_ptr_array_new_with_free_func (g_object_unref);
 
-              g_hash_table_insert (state1_connections, g_steal_pointer (&id),
-                                   g_steal_pointer (&connection));
-            }
-        }
+  g_autoptr(GDateTime) period1_start = g_date_time_new_utc (2018, 1, 1, 0, 0, 0);
+  g_autoptr(GDateTime) period1_end = g_date_time_new_utc (2018, 1, 2, 0, 0, 0);
+  g_ptr_array_add (periods, mwt_period_new (period1_start, period1_end,
+                                            MWT_PERIOD_REPEAT_DAY, 1,
+                                            "capacity-limit", G_MAXUINT64,
+                                            NULL));
 
-      mws_connection_monitor_dummy_update_connections (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
-                                                       state1_connections, NULL);
+  g_autoptr(GDateTime) period2_start = g_date_time_new_utc (2018, 1, 1, 2, 0, 0);
+  g_autoptr(GDateTime) period2_end = g_date_time_new_utc (2018, 1, 1, 4, 0, 0);
+  g_ptr_array_add (periods, mwt_period_new (period2_start, period2_end,
+                                            MWT_PERIOD_REPEAT_DAY, 1,
+                                            "capacity-limit", G_GUINT64_CONSTANT (0),
+                                            NULL));
 
-      /* Due to the test setup, we always expect allow-downloads=true. */
-      if (!initial_allow_downloads)
-        mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
-                                               fixture->scheduler,
-                                               "notify::allow-downloads", NULL);
-      mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+  g_autoptr(MwtTariff) tariff = mwt_tariff_new ("tariff1", periods);
 
-      /* Add a single entry to the scheduler. */
-      g_autoptr(MwsScheduleEntry) entry = mws_schedule_entry_new (":owner.1");
+  /* Start at 00:30. */
+  g_autoptr(GTimeZone) tz = g_time_zone_new_utc ();
+  g_autoptr(GDateTime) start_time = g_date_time_new_utc (2018, 2, 3, 0, 30, 0);
+  mws_clock_dummy_set_time_zone (MWS_CLOCK_DUMMY (fixture->clock), tz);
+  mws_clock_dummy_set_time (MWS_CLOCK_DUMMY (fixture->clock), start_time);
 
-      g_autoptr(GPtrArray) entry_array = g_ptr_array_new_with_free_func (NULL);
-      g_ptr_array_add (entry_array, entry);
+  MwsConnectionDetails connection =
+    {
+      .metered = MWS_METERED_NO,
+      .allow_downloads_when_metered = FALSE,
+      .allow_downloads = TRUE,
+      .tariff = NULL,
+    };
+  g_autoptr(GHashTable) connections = g_hash_table_new (g_str_hash, g_str_equal);
+  g_hash_table_insert (connections, "connection0", &connection);
 
-      mws_scheduler_update_entries (fixture->scheduler, entry_array, NULL, &local_error);
-      g_assert_no_error (local_error);
-      assert_entries_changed_signals (fixture, entry_array, NULL,
-                                      (transitions[i].state1_expected_active ? entry_array : NULL),
-                                      NULL, NULL);
+  gboolean initial_allow_downloads = mws_scheduler_get_allow_downloads (fixture->scheduler);
+  mws_connection_monitor_dummy_update_connections (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
+                                                   connections, NULL);
+  if (!initial_allow_downloads)
+    mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
+                                           fixture->scheduler,
+                                           "notify::allow-downloads", NULL);
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
 
-      /* Change to the next time. */
-      mws_clock_dummy_set_time_zone (MWS_CLOCK_DUMMY (fixture->clock), state2_tz);
-      mws_clock_dummy_set_time (MWS_CLOCK_DUMMY (fixture->clock), state2_time);
+  /* Add two entries, which should both become active. */
+  g_autoptr(MwsScheduleEntry) entry1 = mws_schedule_entry_new (":owner.1");
+  g_autoptr(MwsScheduleEntry) entry2 = mws_schedule_entry_new (":owner.1");
 
-      /* Change to the next connection state. */
-      for (gsize j = 0; j < G_N_ELEMENTS (transitions[i].state2_tariffs); j++)
-        {
-          if (transitions[i].state2_tariffs[j] != NULL)
-            {
-              g_autofree gchar *id = g_strdup_printf ("connection%" G_GSIZE_FORMAT, j);
+  g_autoptr(GPtrArray) added_array = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (added_array, entry1);
+  g_ptr_array_add (added_array, entry2);
 
-              g_autofree MwsConnectionDetails *connection = g_new0 (MwsConnectionDetails, 1);
-              connection->metered = MWS_METERED_NO;
-              connection->allow_downloads_when_metered = FALSE;
-              connection->allow_downloads = TRUE;
-              connection->tariff = transitions[i].state2_tariffs[j];
+  mws_scheduler_update_entries (fixture->scheduler, added_array, NULL, &local_error);
+  g_assert_no_error (local_error);
+  assert_entries_changed_signals (fixture, added_array, NULL, added_array, NULL, NULL);
 
-              mws_connection_monitor_dummy_update_connection (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
-                                                              id, connection);
-            }
-        }
+  /* With no overrides, the plan should match the current state. */
+  assert_plan (fixture, NULL, 0, added_array, G_MAXINT64);
 
-      if (transitions[i].state1_expected_active == transitions[i].state2_expected_active)
-        mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
-      else if (transitions[i].state1_expected_active)
-        assert_entries_changed_signals (fixture, NULL, NULL, NULL, entry_array, NULL);
-      else
-        assert_entries_changed_signals (fixture, NULL, NULL, entry_array, NULL, NULL);
+  /* If the connection were metered, nothing would be active. */
+  MwsConnectionDetails connection_metered = connection;
+  connection_metered.metered = MWS_METERED_YES;
+  g_autoptr(GHashTable) overrides = g_hash_table_new (g_str_hash, g_str_equal);
+  g_hash_table_insert (overrides, "connection0", &connection_metered);
 
-      /* Change back to the previous time. This might not be very realistic,
-       * but the scheduler should deal with it. */
-      mws_clock_dummy_set_time_zone (MWS_CLOCK_DUMMY (fixture->clock), state1_tz);
-      mws_clock_dummy_set_time (MWS_CLOCK_DUMMY (fixture->clock), state1_time);
+  assert_plan (fixture, overrides, 0, NULL, G_MAXINT64);
 
-      /* Change back to the previous connection state. The entry’s scheduled
-       * state should always be the same as before. */
-      for (gsize j = 0; j < G_N_ELEMENTS (transitions[i].state1_tariffs); j++)
-        {
-          if (transitions[i].state1_tariffs[j] != NULL)
-            {
-              g_autofree gchar *id = g_strdup_printf ("connection%" G_GSIZE_FORMAT, j);
+  /* Same if another connection appeared with an unknown metered status. */
+  MwsConnectionDetails connection_unknown =
+    {
+      .metered = MWS_METERED_UNKNOWN,
+      .allow_downloads_when_metered = FALSE,
+      .allow_downloads = TRUE,
+      .tariff = NULL,
+    };
+  g_hash_table_remove_all (overrides);
+  g_hash_table_insert (overrides, "connection1", &connection_unknown);
 
-              g_autofree MwsConnectionDetails *connection = g_new0 (MwsConnectionDetails, 1);
-              connection->metered = MWS_METERED_NO;
-              connection->allow_downloads_when_metered = FALSE;
-              connection->allow_downloads = TRUE;
-              connection->tariff = transitions[i].state1_tariffs[j];
+  assert_plan (fixture, overrides, 0, NULL, G_MAXINT64);
 
-              mws_connection_monitor_dummy_update_connection (MWS_CONNECTION_MONITOR_DUMMY (fixture->connection_monitor),
-                                                              id, connection);
-            }
-        }
+  /* With the tariff, both entries would be active until 02:00; at 03:00,
+   * neither would be, until 04:00. */
+  MwsConnectionDetails connection_tariff = connection;
+  connection_tariff.tariff = tariff;
+  g_hash_table_remove_all (overrides);
+  g_hash_table_insert (overrides, "connection0", &connection_tariff);
 
-      if (transitions[i].state1_expected_active == transitions[i].state2_expected_active)
-        mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
-      else if (transitions[i].state2_expected_active)
-        assert_entries_changed_signals (fixture, NULL, NULL, NULL, entry_array, NULL);
-      else
-        assert_entries_changed_signals (fixture, NULL, NULL, entry_array, NULL, NULL);
+  g_autoptr(GDateTime) two = g_date_time_new_utc (2018, 2, 3, 2, 0, 0);
+  g_autoptr(GDateTime) three = g_date_time_new_utc (2018, 2, 3, 3, 0, 0);
+  g_autoptr(GDateTime) four = g_date_time_new_utc (2018, 2, 3, 4, 0, 0);
 
-      /* Clean up. */
-      teardown (fixture, test_data);
-      setup (fixture, test_data);
+  assert_plan (fixture, overrides, 0, added_array,
+               g_date_time_to_unix (two) * G_USEC_PER_SEC);
+  assert_plan (fixture, overrides, g_date_time_to_unix (three) * G_USEC_PER_SEC,
+               NULL, g_date_time_to_unix (four) * G_USEC_PER_SEC);
+
+  /* None of that should have changed the scheduler’s state. */
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry1));
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry2));
+  g_assert_true (mws_scheduler_get_allow_downloads (fixture->scheduler));
+  g_assert_null (mws_clock_dummy_get_next_alarm_time (MWS_CLOCK_DUMMY (fixture->clock)));
+}
+
+/* Test that when #MwsScheduler:reschedule-delay is set, a burst of changes to
+ * the set of entries results in a single reschedule after the delay, and that
+ * mws_scheduler_reschedule() still works synchronously. */
+static void
+test_scheduler_scheduling_coalesced (Fixture       *fixture,
+                                     gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  g_autoptr(MwsScheduleEntry) entry1 = schedule_entry_new_with_priority (":owner.1", 5);
+  g_autoptr(MwsScheduleEntry) entry2 = schedule_entry_new_with_priority (":owner.1", 10);
+  g_autoptr(MwsScheduleEntry) entry3 = schedule_entry_new_with_priority (":owner.1", 15);
+  MwsScheduleEntry *entries[] = { entry1, entry2, entry3 };
+
+  /* Add the entries one at a time. No entries should become active until the
+   * coalesced reschedule happens. */
+  for (gsize i = 0; i < G_N_ELEMENTS (entries); i++)
+    {
+      g_autoptr(GPtrArray) added = g_ptr_array_new_with_free_func (NULL);
+      g_ptr_array_add (added, entries[i]);
+
+      mws_scheduler_update_entries (fixture->scheduler, added, NULL, &local_error);
+      g_assert_no_error (local_error);
+      assert_entries_changed_signals (fixture, added, NULL, NULL, NULL, NULL);
+      g_assert_false (mws_scheduler_is_entry_active (fixture->scheduler, entries[i]));
     }
+
+  /* Wait for the reschedule. Only the most important entry should be made
+   * active, and in a single signal emission. */
+  while (mws_signal_logger_get_n_emissions (fixture->scheduler_signals) == 0)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_autoptr(GPtrArray) expected_active = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (expected_active, entry3);
+
+  g_autoptr(GPtrArray) changed_active_added = NULL;
+  g_autoptr(GPtrArray) changed_active_removed = NULL;
+  mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
+                                         fixture->scheduler, "active-entries-changed",
+                                         &changed_active_added, &changed_active_removed);
+  assert_ptr_arrays_equal (changed_active_added, expected_active);
+  assert_ptr_arrays_equal (changed_active_removed, NULL);
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry3));
+
+  /* Changing a priority should also be coalesced, until a synchronous
+   * reschedule is forced. */
+  mws_schedule_entry_set_priority (entry1, 20);
+  g_assert_true (mws_scheduler_is_entry_active (fixture->scheduler, entry3));
+  mws_signal_logger_assert_no_emissions (fixture->scheduler_signals);
+
+  mws_scheduler_reschedule (fixture->scheduler);
+
+  g_autoptr(GPtrArray) expected_active2 = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (expected_active2, entry1);
+
+  g_autoptr(GPtrArray) changed_active_added2 = NULL;
+  g_autoptr(GPtrArray) changed_active_removed2 = NULL;
+  mws_signal_logger_assert_emission_pop (fixture->scheduler_signals,
+                                         fixture->scheduler, "active-entries-changed",
+                                         &changed_active_added2, &changed_active_removed2);
+  assert_ptr_arrays_equal (changed_active_added2, expected_active2);
+  assert_ptr_arrays_equal (changed_active_removed2, expected_active);
 }
 
 int
@@ -1292,6 +2896,55 @@ main (int    argc,
     {
       .max_active_entries = 2,
     };
+  const TestData small_entry_data =
+    {
+      .max_active_entries = 2,
+      .small_entry_threshold = 1000,
+    };
+  const TestData coalesced_data =
+    {
+      .max_active_entries = 1,
+      .reschedule_delay_ms = 10,
+    };
+  const TestData min_run_time_data =
+    {
+      .max_active_entries = 1,
+      .min_run_time_secs = 60,
+    };
+  const TestData priority_margin_data =
+    {
+      .max_active_entries = 1,
+      .preemption_priority_margin = 10,
+    };
+  const TestData non_resumable_data =
+    {
+      .max_active_entries = 1,
+      .non_resumable_protect_percent = 90,
+      .non_resumable_protect_size = 1000,
+    };
+  const TestData fair_share_peers_data =
+    {
+      .max_active_entries = 2,
+      .fair_share = TRUE,
+      .fair_share_quantum_secs = 60,
+    };
+  const TestData fair_share_weights_data =
+    {
+      .max_active_entries = 3,
+      .fair_share = TRUE,
+      .peer_weights = "[Peer Weights]\n/some/heavy/owner=2\n",
+    };
+  const TestData quota_data =
+    {
+      .max_active_entries = 1,
+      .max_entries_per_owner = 2,
+    };
+  const TestData fair_share_turns_data =
+    {
+      .max_active_entries = 1,
+      .fair_share = TRUE,
+      .fair_share_quantum_secs = 60,
+    };
 
   g_test_add_func ("/scheduler/construction", test_scheduler_construction);
   g_test_add ("/scheduler/entries", Fixture, &standard_data, setup,
@@ -1299,6 +2952,10 @@ main (int    argc,
   g_test_add ("/scheduler/entries/remove-for-owner", Fixture,
               &standard_data, setup,
               test_scheduler_entries_remove_for_owner, teardown);
+  g_test_add ("/scheduler/entries/reuse", Fixture, &standard_data, setup,
+              test_scheduler_entries_reuse, teardown);
+  g_test_add ("/scheduler/entries/quota", Fixture, &quota_data, setup,
+              test_scheduler_entries_quota, teardown);
   g_test_add ("/scheduler/properties", Fixture, &standard_data, setup,
               test_scheduler_properties, teardown);
   g_test_add ("/scheduler/scheduling/entry-priorities", Fixture,
@@ -1307,9 +2964,39 @@ main (int    argc,
   g_test_add ("/scheduler/scheduling/peer-priorities", Fixture,
               &standard_data, setup,
               test_scheduler_scheduling_peer_priorities, teardown);
+  g_test_add ("/scheduler/scheduling/expected-size", Fixture,
+              &standard_data, setup,
+              test_scheduler_scheduling_expected_size, teardown);
+  g_test_add ("/scheduler/scheduling/small-entry", Fixture,
+              &small_entry_data, setup,
+              test_scheduler_scheduling_small_entry, teardown);
   g_test_add ("/scheduler/scheduling/max-active-entries", Fixture,
               &max_active_entries_data, setup,
               test_scheduler_scheduling_max_active_entries, teardown);
+  g_test_add ("/scheduler/scheduling/priority-changed", Fixture,
+              &standard_data, setup,
+              test_scheduler_scheduling_priority_changed, teardown);
+  g_test_add ("/scheduler/preemption/min-run-time", Fixture,
+              &min_run_time_data, setup,
+              test_scheduler_preemption_min_run_time, teardown);
+  g_test_add ("/scheduler/preemption/priority-margin", Fixture,
+              &priority_margin_data, setup,
+              test_scheduler_preemption_priority_margin, teardown);
+  g_test_add ("/scheduler/preemption/non-resumable", Fixture,
+              &non_resumable_data, setup,
+              test_scheduler_preemption_non_resumable, teardown);
+  g_test_add ("/scheduler/fair-share/peers", Fixture,
+              &fair_share_peers_data, setup,
+              test_scheduler_fair_share_peers, teardown);
+  g_test_add ("/scheduler/fair-share/weights", Fixture,
+              &fair_share_weights_data, setup,
+              test_scheduler_fair_share_weights, teardown);
+  g_test_add ("/scheduler/fair-share/turns", Fixture,
+              &fair_share_turns_data, setup,
+              test_scheduler_fair_share_turns, teardown);
+  g_test_add ("/scheduler/scheduling/frozen", Fixture,
+              &standard_data, setup,
+              test_scheduler_scheduling_frozen, teardown);
   g_test_add ("/scheduler/scheduling/peer-vanished", Fixture,
               &standard_data, setup,
               test_scheduler_scheduling_peer_vanished, teardown);
@@ -1319,6 +3006,33 @@ main (int    argc,
   g_test_add ("/scheduler/scheduling/tariff", Fixture,
               &standard_data, setup,
               test_scheduler_scheduling_tariff, teardown);
+  g_test_add ("/scheduler/scheduling/tariff-alarm", Fixture,
+              &standard_data, setup,
+              test_scheduler_scheduling_tariff_alarm, teardown);
+  g_test_add ("/scheduler/scheduling/tariff-alarm/multiple", Fixture,
+              &standard_data, setup,
+              test_scheduler_scheduling_tariff_alarm_multiple, teardown);
+  g_test_add ("/scheduler/scheduling/capacity-limit", Fixture,
+              &standard_data, setup,
+              test_scheduler_scheduling_capacity_limit, teardown);
+  g_test_add ("/scheduler/scheduling/bind-to-connection", Fixture,
+              &max_active_entries_data, setup,
+              test_scheduler_scheduling_bind_to_connection, teardown);
+  g_test_add ("/scheduler/scheduling/max-rate", Fixture,
+              &max_active_entries_data, setup,
+              test_scheduler_scheduling_max_rate, teardown);
+  g_test_add ("/scheduler/scheduling/deadline", Fixture,
+              &max_active_entries_data, setup,
+              test_scheduler_scheduling_deadline, teardown);
+  g_test_add ("/scheduler/scheduling/download-starts-at", Fixture,
+              &max_active_entries_data, setup,
+              test_scheduler_scheduling_download_starts_at, teardown);
+  g_test_add ("/scheduler/scheduling/coalesced", Fixture,
+              &coalesced_data, setup,
+              test_scheduler_scheduling_coalesced, teardown);
+  g_test_add ("/scheduler/compute-plan", Fixture,
+              &max_active_entries_data, setup,
+              test_scheduler_compute_plan, teardown);
 
   return g_test_run ();
 }
@@ -0,0 +1,257 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+
+#include "config.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <libmogwai-schedule/usage-ledger.h>
+#include <locale.h>
+
+
+/* Fixture which creates a temporary directory to put a ledger file in. It is
+ * deleted, along with the ledger file, on teardown. */
+typedef struct
+{
+  gchar *tmp_dir;  /* (owned) */
+  gchar *path;  /* (owned) */
+} Fixture;
+
+static void
+setup (Fixture       *fixture,
+       gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  fixture->tmp_dir = g_dir_make_tmp ("mogwai-usage-ledger-XXXXXX", &local_error);
+  g_assert_no_error (local_error);
+  fixture->path = g_build_filename (fixture->tmp_dir, "usage-ledger", NULL);
+}
+
+static void
+teardown (Fixture       *fixture,
+          gconstpointer  test_data)
+{
+  g_unlink (fixture->path);
+  g_rmdir (fixture->tmp_dir);
+
+  g_clear_pointer (&fixture->path, g_free);
+  g_clear_pointer (&fixture->tmp_dir, g_free);
+}
+
+/* Load a new #MwsUsageLedger from @fixture->path, asserting that it loads
+ * without errors. */
+static MwsUsageLedger *
+load_ledger (Fixture *fixture)
+{
+  g_autoptr(MwsUsageLedger) ledger = mws_usage_ledger_new (fixture->path);
+  g_autoptr(GError) local_error = NULL;
+
+  mws_usage_ledger_load (ledger, &local_error);
+  g_assert_no_error (local_error);
+
+  return g_steal_pointer (&ledger);
+}
+
+/* Test that a ledger can be loaded from a file which doesn’t exist, and is
+ * empty. */
+static void
+test_usage_ledger_missing (Fixture       *fixture,
+                           gconstpointer  test_data)
+{
+  g_autoptr(MwsUsageLedger) ledger = load_ledger (fixture);
+  g_autoptr(GError) local_error = NULL;
+
+  g_assert_cmpstr (mws_usage_ledger_get_path (ledger), ==, fixture->path);
+  g_assert_cmpuint (mws_usage_ledger_get_n_records (ledger), ==, 0);
+  g_assert_cmpuint (mws_usage_ledger_lookup (ledger, "connection0", 0, 100), ==, 0);
+
+  /* Flushing an empty ledger shouldn’t create the file. */
+  mws_usage_ledger_flush (ledger, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_false (g_file_test (fixture->path, G_FILE_TEST_EXISTS));
+}
+
+/* Test that records survive being flushed and reloaded, and that later records
+ * for the same recurrence supersede earlier ones. */
+static void
+test_usage_ledger_round_trip (Fixture       *fixture,
+                              gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  g_autoptr(MwsUsageLedger) ledger = load_ledger (fixture);
+  mws_usage_ledger_record (ledger, "connection0", 0, 100, 5);
+  mws_usage_ledger_record (ledger, "connection0", 100, 200, 10);
+  mws_usage_ledger_record (ledger, "connection1", 0, 100, 15);
+  g_assert_cmpuint (mws_usage_ledger_get_n_records (ledger), ==, 3);
+
+  mws_usage_ledger_flush (ledger, &local_error);
+  g_assert_no_error (local_error);
+
+  mws_usage_ledger_record (ledger, "connection0", 0, 100, 20);
+  g_clear_object (&ledger);  /* flushes */
+
+  g_autoptr(MwsUsageLedger) reloaded = load_ledger (fixture);
+  g_assert_cmpuint (mws_usage_ledger_get_n_records (reloaded), ==, 3);
+  g_assert_cmpuint (mws_usage_ledger_lookup (reloaded, "connection0", 0, 100), ==, 20);
+  g_assert_cmpuint (mws_usage_ledger_lookup (reloaded, "connection0", 100, 200), ==, 10);
+  g_assert_cmpuint (mws_usage_ledger_lookup (reloaded, "connection1", 0, 100), ==, 15);
+  g_assert_cmpuint (mws_usage_ledger_lookup (reloaded, "connection1", 100, 200), ==, 0);
+}
+
+/* Test that records for recurrences which have ended are expired. */
+static void
+test_usage_ledger_expire (Fixture       *fixture,
+                          gconstpointer  test_data)
+{
+  g_autoptr(MwsUsageLedger) ledger = load_ledger (fixture);
+
+  mws_usage_ledger_record (ledger, "connection0", 0, 100, 5);
+  mws_usage_ledger_record (ledger, "connection0", 100, 200, 10);
+
+  mws_usage_ledger_expire (ledger, 100);
+  g_assert_cmpuint (mws_usage_ledger_get_n_records (ledger), ==, 1);
+  g_assert_cmpuint (mws_usage_ledger_lookup (ledger, "connection0", 0, 100), ==, 0);
+  g_assert_cmpuint (mws_usage_ledger_lookup (ledger, "connection0", 100, 200), ==, 10);
+
+  g_clear_object (&ledger);
+
+  g_autoptr(MwsUsageLedger) reloaded = load_ledger (fixture);
+  g_assert_cmpuint (mws_usage_ledger_get_n_records (reloaded), ==, 1);
+}
+
+/* Test that the ledger file is compacted once it contains many superseded
+ * records, so that it doesn’t grow without bound. */
+static void
+test_usage_ledger_compaction (Fixture       *fixture,
+                              gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(MwsUsageLedger) ledger = load_ledger (fixture);
+  goffset max_size = 0;
+
+  for (guint64 i = 1; i <= 1000; i++)
+    {
+      GStatBuf stat_buf;
+
+      mws_usage_ledger_record (ledger, "connection0", 0, 100, i);
+      mws_usage_ledger_flush (ledger, &local_error);
+      g_assert_no_error (local_error);
+
+      g_assert_cmpint (g_stat (fixture->path, &stat_buf), ==, 0);
+      max_size = MAX (max_size, stat_buf.st_size);
+    }
+
+  /* Each record is about 40 bytes, so the file must have been compacted. */
+  g_assert_cmpint (max_size, <, 100 * 40);
+
+  g_clear_object (&ledger);
+
+  g_autoptr(MwsUsageLedger) reloaded = load_ledger (fixture);
+  g_assert_cmpuint (mws_usage_ledger_get_n_records (reloaded), ==, 1);
+  g_assert_cmpuint (mws_usage_ledger_lookup (reloaded, "connection0", 0, 100), ==, 1000);
+}
+
+/* Test that a ledger file which has been truncated part-way through a record
+ * can be loaded, and is repaired on the next flush. */
+static void
+test_usage_ledger_truncated (Fixture       *fixture,
+                             gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autofree gchar *contents = NULL;
+  gsize contents_len;
+
+  g_autoptr(MwsUsageLedger) ledger = load_ledger (fixture);
+  mws_usage_ledger_record (ledger, "connection0", 0, 100, 5);
+  mws_usage_ledger_flush (ledger, &local_error);
+  g_assert_no_error (local_error);
+  mws_usage_ledger_record (ledger, "connection1", 0, 100, 10);
+  g_clear_object (&ledger);
+
+  g_file_get_contents (fixture->path, &contents, &contents_len, &local_error);
+  g_assert_no_error (local_error);
+  g_file_set_contents (fixture->path, contents, contents_len - 3, &local_error);
+  g_assert_no_error (local_error);
+
+  g_autoptr(MwsUsageLedger) reloaded = load_ledger (fixture);
+  g_assert_cmpuint (mws_usage_ledger_get_n_records (reloaded), ==, 1);
+  g_assert_cmpuint (mws_usage_ledger_lookup (reloaded, "connection0", 0, 100), ==, 5);
+
+  /* Adding a record after the damage should still be loadable. */
+  mws_usage_ledger_record (reloaded, "connection2", 0, 100, 15);
+  g_clear_object (&reloaded);
+
+  g_autoptr(MwsUsageLedger) repaired = load_ledger (fixture);
+  g_assert_cmpuint (mws_usage_ledger_get_n_records (repaired), ==, 2);
+  g_assert_cmpuint (mws_usage_ledger_lookup (repaired, "connection2", 0, 100), ==, 15);
+}
+
+/* Test that a file in an unrecognised format results in an error, and is
+ * replaced on the next flush. */
+static void
+test_usage_ledger_invalid (Fixture       *fixture,
+                           gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  g_file_set_contents (fixture->path, "not a ledger", -1, &local_error);
+  g_assert_no_error (local_error);
+
+  g_autoptr(MwsUsageLedger) ledger = mws_usage_ledger_new (fixture->path);
+  g_assert_false (mws_usage_ledger_load (ledger, &local_error));
+  g_assert_error (local_error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+  g_clear_error (&local_error);
+  g_assert_cmpuint (mws_usage_ledger_get_n_records (ledger), ==, 0);
+
+  mws_usage_ledger_record (ledger, "connection0", 0, 100, 5);
+  g_clear_object (&ledger);
+
+  g_autoptr(MwsUsageLedger) reloaded = load_ledger (fixture);
+  g_assert_cmpuint (mws_usage_ledger_lookup (reloaded, "connection0", 0, 100), ==, 5);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  setlocale (LC_ALL, "");
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add ("/usage-ledger/missing", Fixture, NULL, setup,
+              test_usage_ledger_missing, teardown);
+  g_test_add ("/usage-ledger/round-trip", Fixture, NULL, setup,
+              test_usage_ledger_round_trip, teardown);
+  g_test_add ("/usage-ledger/expire", Fixture, NULL, setup,
+              test_usage_ledger_expire, teardown);
+  g_test_add ("/usage-ledger/compaction", Fixture, NULL, setup,
+              test_usage_ledger_compaction, teardown);
+  g_test_add ("/usage-ledger/truncated", Fixture, NULL, setup,
+              test_usage_ledger_truncated, teardown);
+  g_test_add ("/usage-ledger/invalid", Fixture, NULL, setup,
+              test_usage_ledger_invalid, teardown);
+
+  return g_test_run ();
+}
@@ -0,0 +1,77 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2026 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+
+#include "config.h"
+
+#include <glib.h>
+#include <libmogwai-schedule/wake-timer-private.h>
+#include <locale.h>
+#include <string.h>
+
+
+/* Test that calendar specifications are escaped in wake timer unit names the
+ * same way `systemd-escape` does, so that `%I` in the template unit gives the
+ * original specification back. In particular, `-` must be escaped, since `%I`
+ * turns it into `/`. */
+static void
+test_wake_timer_unit_escaping (void)
+{
+  const struct
+    {
+      const gchar *calendar_spec;
+      const gchar *expected_unit;
+    }
+  vectors[] =
+    {
+      { "2026-10-14 12:00:00 UTC",
+        "mogwai-scheduled-wake@2026\\x2d10\\x2d14\\x2012:00:00\\x20UTC.timer" },
+      { "daily", "mogwai-scheduled-wake@daily.timer" },
+      { "*-*-* 00:00:00",
+        "mogwai-scheduled-wake@\\x2a\\x2d\\x2a\\x2d\\x2a\\x2000:00:00.timer" },
+    };
+
+  for (gsize i = 0; i < G_N_ELEMENTS (vectors); i++)
+    {
+      g_autofree gchar *unit = NULL;
+
+      g_test_message ("%" G_GSIZE_FORMAT ": %s", i, vectors[i].calendar_spec);
+
+      unit = mws_wake_timer_unit_for_calendar_spec (vectors[i].calendar_spec);
+      g_assert_cmpstr (unit, ==, vectors[i].expected_unit);
+      g_assert_true (g_str_has_prefix (unit, "mogwai-scheduled-wake@"));
+      g_assert_null (strchr (unit + strlen ("mogwai-scheduled-wake@"), '-'));
+    }
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  setlocale (LC_ALL, "");
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/wake-timer/unit-escaping",
+                   test_wake_timer_unit_escaping);
+
+  return g_test_run ();
+}
@@ -0,0 +1,160 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+
+#include "config.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <libmogwai-schedule/worker-pool.h>
+#include <locale.h>
+
+
+/* State shared between the worker threads running count_thread_cb(). */
+typedef struct
+{
+  gint n_running;  /* (atomic) */
+  gint max_running;  /* (atomic) */
+} Counters;
+
+/* State for the callbacks, which must only be accessed in the main thread. */
+typedef struct
+{
+  GThread *main_thread;  /* (unowned) */
+  guint n_completed;
+} CallbackData;
+
+static void
+count_thread_cb (GTask        *task,
+                 gpointer      source_object,
+                 gpointer      task_data,
+                 GCancellable *cancellable)
+{
+  Counters *counters = task_data;
+  gint n_running = g_atomic_int_add (&counters->n_running, 1) + 1;
+  gint max_running;
+
+  do
+    max_running = g_atomic_int_get (&counters->max_running);
+  while (n_running > max_running &&
+         !g_atomic_int_compare_and_exchange (&counters->max_running,
+                                             max_running, n_running));
+
+  /* Give the other tasks a chance to run at the same time. */
+  g_usleep (10 * 1000);
+
+  g_atomic_int_add (&counters->n_running, -1);
+  g_task_return_pointer (task, g_thread_self (), NULL);
+}
+
+static void
+count_cb (GObject      *obj,
+          GAsyncResult *result,
+          gpointer      user_data)
+{
+  CallbackData *data = user_data;
+  g_autoptr(GError) local_error = NULL;
+
+  /* The result should be returned in the main thread, having been calculated
+   * in another thread. */
+  g_assert_true (g_thread_self () == data->main_thread);
+
+  GThread *worker_thread = g_task_propagate_pointer (G_TASK (result), &local_error);
+  g_assert_no_error (local_error);
+  g_assert_true (worker_thread != data->main_thread);
+
+  data->n_completed++;
+}
+
+/* Test that tasks run in worker threads, that no more than
+ * %MWS_WORKER_POOL_MAX_THREADS of them run at once, and that their results are
+ * returned in the main context. */
+static void
+test_worker_pool_bounded (void)
+{
+  const guint n_tasks = MWS_WORKER_POOL_MAX_THREADS * 3;
+  Counters counters = { 0, 0 };
+  CallbackData data = { g_thread_self (), 0 };
+
+  for (guint i = 0; i < n_tasks; i++)
+    {
+      g_autoptr(GTask) task = g_task_new (NULL, NULL, count_cb, &data);
+      g_task_set_task_data (task, &counters, NULL);
+      mws_worker_pool_run_task (task, count_thread_cb);
+    }
+
+  while (data.n_completed < n_tasks)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpint (g_atomic_int_get (&counters.n_running), ==, 0);
+  g_assert_cmpint (g_atomic_int_get (&counters.max_running), >, 0);
+  g_assert_cmpint (g_atomic_int_get (&counters.max_running), <=, MWS_WORKER_POOL_MAX_THREADS);
+}
+
+static void
+error_thread_cb (GTask        *task,
+                 gpointer      source_object,
+                 gpointer      task_data,
+                 GCancellable *cancellable)
+{
+  g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           "Invalid data");
+}
+
+static void
+async_result_cb (GObject      *obj,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  GAsyncResult **result_out = user_data;
+  *result_out = g_object_ref (result);
+}
+
+/* Test that errors from tasks are propagated back to the main context. */
+static void
+test_worker_pool_error (void)
+{
+  g_autoptr(GAsyncResult) result = NULL;
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GTask) task = g_task_new (NULL, NULL, async_result_cb, &result);
+
+  mws_worker_pool_run_task (task, error_thread_cb);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_null (g_task_propagate_pointer (G_TASK (result), &local_error));
+  g_assert_error (local_error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  setlocale (LC_ALL, "");
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/worker-pool/bounded", test_worker_pool_bounded);
+  g_test_add_func ("/worker-pool/error", test_worker_pool_error);
+
+  return g_test_run ();
+}
@@ -0,0 +1,88 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Static tracepoints for the scheduling hot path, as USDT probes under the
+ * `mogwai` provider, which can be attached to with tools like `bpftrace` or
+ * SystemTap. See `docs/debugging.md`.
+ *
+ * Each probe has a semaphore, which the tracer increments when it attaches.
+ * Probe arguments which are not already to hand should only be computed if
+ * MWS_TRACE_ENABLED() is true for the probe, so that they cost nothing when no
+ * tracer is attached. The probes themselves are a single `nop` each.
+ *
+ * If `sys/sdt.h` is not available at build time, all of this compiles to
+ * nothing. */
+
+/* Values for the `verdict` argument of the `entry_verdict` probe. */
+typedef enum
+{
+  MWS_TRACE_ENTRY_SELECTED = 0,
+  MWS_TRACE_ENTRY_DEFERRED,
+  MWS_TRACE_ENTRY_NOT_SAFE,
+} MwsTraceEntryVerdict;
+
+#if HAVE_SYS_SDT_H
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define MWS_TRACE_SEMAPHORE(name) mogwai_##name##_semaphore
+
+/* The list of probes. Each needs a semaphore defining in trace.c. */
+#define MWS_TRACE_FOREACH_PROBE(X) \
+  X (reschedule_start) \
+  X (reschedule_end) \
+  X (entry_verdict) \
+  X (tariff_lookup) \
+  X (dbus_method_start) \
+  X (dbus_method_end)
+
+#define MWS_TRACE_DECLARE_SEMAPHORE(name) \
+  extern unsigned short MWS_TRACE_SEMAPHORE (name) G_GNUC_INTERNAL;
+MWS_TRACE_FOREACH_PROBE (MWS_TRACE_DECLARE_SEMAPHORE)
+#undef MWS_TRACE_DECLARE_SEMAPHORE
+
+#define MWS_TRACE_ENABLED(name) G_UNLIKELY (MWS_TRACE_SEMAPHORE (name) > 0)
+#define MWS_TRACE0(name) STAP_PROBE (mogwai, name)
+#define MWS_TRACE1(name, a) STAP_PROBE1 (mogwai, name, a)
+#define MWS_TRACE2(name, a, b) STAP_PROBE2 (mogwai, name, a, b)
+#define MWS_TRACE3(name, a, b, c) STAP_PROBE3 (mogwai, name, a, b, c)
+#define MWS_TRACE4(name, a, b, c, d) STAP_PROBE4 (mogwai, name, a, b, c, d)
+
+#else  /* if !HAVE_SYS_SDT_H */
+
+#define MWS_TRACE_ENABLED(name) FALSE
+#define MWS_TRACE0(name) G_STMT_START { } G_STMT_END
+#define MWS_TRACE1(name, a) G_STMT_START { } G_STMT_END
+#define MWS_TRACE2(name, a, b) G_STMT_START { } G_STMT_END
+#define MWS_TRACE3(name, a, b, c) G_STMT_START { } G_STMT_END
+#define MWS_TRACE4(name, a, b, c, d) G_STMT_START { } G_STMT_END
+
+#endif  /* !HAVE_SYS_SDT_H */
+
+G_END_DECLS
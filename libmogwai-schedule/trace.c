@@ -0,0 +1,39 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <libmogwai-schedule/trace-private.h>
+
+
+#if HAVE_SYS_SDT_H
+
+/* Semaphores for the probes declared in trace-private.h. These have to be in
+ * the `.probes` section so that tracers can find and increment them when they
+ * attach to the corresponding probe. */
+#define MWS_TRACE_DEFINE_SEMAPHORE(name) \
+  unsigned short MWS_TRACE_SEMAPHORE (name) __attribute__ ((section (".probes"))) = 0;
+MWS_TRACE_FOREACH_PROBE (MWS_TRACE_DEFINE_SEMAPHORE)
+#undef MWS_TRACE_DEFINE_SEMAPHORE
+
+#endif  /* HAVE_SYS_SDT_H */
@@ -0,0 +1,811 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <glib-object.h>
+#include <glib/gi18n-lib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <libmogwai-schedule/usage-ledger.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/* Every ledger file starts with this (including its nul terminator), so that
+ * the format can be changed in future. */
+#define LEDGER_MAGIC "MWSUL01"
+
+/* How long to batch records in memory before writing and syncing them. This
+ * bounds how much accounting is lost if the daemon is killed. */
+#define FLUSH_INTERVAL_SECONDS 30
+
+/* The file is rewritten to contain only the live records once it contains
+ * more than this many times as many records as are live, and at least
+ * %COMPACTION_MIN_RECORDS of them. */
+#define COMPACTION_RATIO 4
+#define COMPACTION_MIN_RECORDS 64
+
+/* The number of bytes used by a record, apart from its connection ID: a
+ * #guint16 length for the connection ID, then two #gint64 recurrence times and
+ * a #guint64 byte count, all little endian. */
+#define RECORD_FIXED_SIZE (sizeof (guint16) + 2 * sizeof (gint64) + sizeof (guint64))
+
+/* Number of bytes used in a recurrence of a tariff period on a connection. The
+ * record is its own key in #MwsUsageLedger.records. */
+typedef struct
+{
+  gchar *connection_id;  /* (owned) (not nullable) */
+  gint64 recurrence_start_usec;
+  gint64 recurrence_end_usec;
+  guint64 n_bytes;
+  gboolean dirty;  /* if it’s in #MwsUsageLedger.dirty_records */
+} UsageRecord;
+
+static void
+usage_record_free (UsageRecord *record)
+{
+  g_free (record->connection_id);
+  g_free (record);
+}
+
+static guint
+usage_record_hash (gconstpointer key)
+{
+  const UsageRecord *record = key;
+
+  return (g_str_hash (record->connection_id) ^
+          g_int64_hash (&record->recurrence_start_usec) ^
+          g_int64_hash (&record->recurrence_end_usec));
+}
+
+static gboolean
+usage_record_equal (gconstpointer a,
+                    gconstpointer b)
+{
+  const UsageRecord *record_a = a, *record_b = b;
+
+  return (record_a->recurrence_start_usec == record_b->recurrence_start_usec &&
+          record_a->recurrence_end_usec == record_b->recurrence_end_usec &&
+          g_str_equal (record_a->connection_id, record_b->connection_id));
+}
+
+static void mws_usage_ledger_dispose      (GObject      *object);
+static void mws_usage_ledger_finalize     (GObject      *object);
+static void mws_usage_ledger_get_property (GObject      *object,
+                                           guint         property_id,
+                                           GValue       *value,
+                                           GParamSpec   *pspec);
+static void mws_usage_ledger_set_property (GObject      *object,
+                                           guint         property_id,
+                                           const GValue *value,
+                                           GParamSpec   *pspec);
+
+/**
+ * MwsUsageLedger:
+ *
+ * A persistent record of how many bytes have been downloaded over each network
+ * connection in the current recurrence of each of its tariff periods, so that
+ * capacity limits are enforced correctly across restarts of the daemon.
+ *
+ * Records are identified by a connection ID, and the start and end times of
+ * the recurrence they apply to. Each record stores the total number of bytes
+ * used in that recurrence, so replaying the ledger only needs the most recent
+ * record for each recurrence.
+ *
+ * The ledger is stored as an append-only binary file at #MwsUsageLedger:path.
+ * Calls to mws_usage_ledger_record() only update the ledger in memory; the
+ * changed records are appended to the file and synced to disk in a batch at
+ * most %FLUSH_INTERVAL_SECONDS later, or when mws_usage_ledger_flush() is
+ * called. Once the file contains many more records than are still live (see
+ * mws_usage_ledger_expire()), it is compacted by atomically replacing it with
+ * one containing only the live records. This keeps it small, so loading it
+ * with mws_usage_ledger_load() is cheap.
+ *
+ * If the file is truncated (for example, due to a crash part-way through a
+ * write), the complete records before the damage are loaded, and the file is
+ * rewritten on the next flush.
+ *
+ * Since: 0.3.0
+ */
+struct _MwsUsageLedger
+{
+  GObject parent;
+
+  gchar *path;  /* (owned) (not nullable) */
+
+  GHashTable *records;  /* (owned) (element-type UsageRecord UsageRecord) */
+  GPtrArray *dirty_records;  /* (owned) (element-type UsageRecord) (unowned elements) */
+
+  /* Number of records in the file, including stale ones. */
+  guint n_file_records;
+  gboolean needs_compaction;
+
+  guint flush_source_id;  /* 0 if no flush is scheduled */
+};
+
+typedef enum
+{
+  PROP_PATH = 1,
+} MwsUsageLedgerProperty;
+
+G_DEFINE_TYPE (MwsUsageLedger, mws_usage_ledger, G_TYPE_OBJECT)
+
+static void
+mws_usage_ledger_class_init (MwsUsageLedgerClass *klass)
+{
+  GObjectClass *object_class = (GObjectClass *) klass;
+  GParamSpec *props[PROP_PATH + 1] = { NULL, };
+
+  object_class->dispose = mws_usage_ledger_dispose;
+  object_class->finalize = mws_usage_ledger_finalize;
+  object_class->get_property = mws_usage_ledger_get_property;
+  object_class->set_property = mws_usage_ledger_set_property;
+
+  /**
+   * MwsUsageLedger:path:
+   *
+   * Path to the file to store the ledger in. Its parent directory will be
+   * created when the ledger is first written, if needed.
+   *
+   * Since: 0.3.0
+   */
+  props[PROP_PATH] =
+      g_param_spec_string ("path", "Path",
+                           "Path to the file to store the ledger in.",
+                           NULL,
+                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (object_class, G_N_ELEMENTS (props), props);
+}
+
+static void
+mws_usage_ledger_init (MwsUsageLedger *self)
+{
+  self->records = g_hash_table_new_full (usage_record_hash, usage_record_equal,
+                                         NULL, (GDestroyNotify) usage_record_free);
+  self->dirty_records = g_ptr_array_new_with_free_func (NULL);
+}
+
+static void
+mws_usage_ledger_dispose (GObject *object)
+{
+  MwsUsageLedger *self = MWS_USAGE_LEDGER (object);
+  g_autoptr(GError) local_error = NULL;
+
+  g_clear_handle_id (&self->flush_source_id, g_source_remove);
+
+  if (self->records != NULL &&
+      !mws_usage_ledger_flush (self, &local_error))
+    g_warning ("%s", local_error->message);
+
+  /* Chain up to the parent class */
+  G_OBJECT_CLASS (mws_usage_ledger_parent_class)->dispose (object);
+}
+
+static void
+mws_usage_ledger_finalize (GObject *object)
+{
+  MwsUsageLedger *self = MWS_USAGE_LEDGER (object);
+
+  g_clear_pointer (&self->dirty_records, g_ptr_array_unref);
+  g_clear_pointer (&self->records, g_hash_table_unref);
+  g_clear_pointer (&self->path, g_free);
+
+  /* Chain up to the parent class */
+  G_OBJECT_CLASS (mws_usage_ledger_parent_class)->finalize (object);
+}
+
+static void
+mws_usage_ledger_get_property (GObject    *object,
+                               guint       property_id,
+                               GValue     *value,
+                               GParamSpec *pspec)
+{
+  MwsUsageLedger *self = MWS_USAGE_LEDGER (object);
+
+  switch ((MwsUsageLedgerProperty) property_id)
+    {
+    case PROP_PATH:
+      g_value_set_string (value, self->path);
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+static void
+mws_usage_ledger_set_property (GObject      *object,
+                               guint         property_id,
+                               const GValue *value,
+                               GParamSpec   *pspec)
+{
+  MwsUsageLedger *self = MWS_USAGE_LEDGER (object);
+
+  switch ((MwsUsageLedgerProperty) property_id)
+    {
+    case PROP_PATH:
+      /* Construct only. */
+      g_assert (self->path == NULL);
+      self->path = g_value_dup_string (value);
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+/**
+ * mws_usage_ledger_new:
+ * @path: path to the file to store the ledger in
+ *
+ * Create a #MwsUsageLedger which stores its records in @path. The ledger is
+ * initially empty: call mws_usage_ledger_load() to load the existing records
+ * from @path.
+ *
+ * Returns: (transfer full): a new #MwsUsageLedger
+ * Since: 0.3.0
+ */
+MwsUsageLedger *
+mws_usage_ledger_new (const gchar *path)
+{
+  g_return_val_if_fail (path != NULL, NULL);
+
+  return g_object_new (MWS_TYPE_USAGE_LEDGER,
+                       "path", path,
+                       NULL);
+}
+
+/**
+ * mws_usage_ledger_get_path:
+ * @self: a #MwsUsageLedger
+ *
+ * Get the value of #MwsUsageLedger:path.
+ *
+ * Returns: path to the ledger file
+ * Since: 0.3.0
+ */
+const gchar *
+mws_usage_ledger_get_path (MwsUsageLedger *self)
+{
+  g_return_val_if_fail (MWS_IS_USAGE_LEDGER (self), NULL);
+
+  return self->path;
+}
+
+static void
+append_record (GByteArray        *buffer,
+               const UsageRecord *record)
+{
+  gsize connection_id_len = strlen (record->connection_id);
+  guint16 connection_id_len_le = GUINT16_TO_LE ((guint16) connection_id_len);
+  gint64 recurrence_start_usec_le = GINT64_TO_LE (record->recurrence_start_usec);
+  gint64 recurrence_end_usec_le = GINT64_TO_LE (record->recurrence_end_usec);
+  guint64 n_bytes_le = GUINT64_TO_LE (record->n_bytes);
+
+  g_assert (connection_id_len <= G_MAXUINT16);
+
+  g_byte_array_append (buffer, (const guint8 *) &connection_id_len_le,
+                       sizeof (connection_id_len_le));
+  g_byte_array_append (buffer, (const guint8 *) record->connection_id,
+                       connection_id_len);
+  g_byte_array_append (buffer, (const guint8 *) &recurrence_start_usec_le,
+                       sizeof (recurrence_start_usec_le));
+  g_byte_array_append (buffer, (const guint8 *) &recurrence_end_usec_le,
+                       sizeof (recurrence_end_usec_le));
+  g_byte_array_append (buffer, (const guint8 *) &n_bytes_le,
+                       sizeof (n_bytes_le));
+}
+
+/* Parse the record at @*offset in @data, advancing @*offset past it. Returns
+ * %NULL if the data is truncated or invalid. */
+static UsageRecord *
+parse_record (const guint8 *data,
+              gsize         data_len,
+              gsize        *offset)
+{
+  guint16 connection_id_len_le;
+  gint64 recurrence_start_usec_le, recurrence_end_usec_le;
+  guint64 n_bytes_le;
+  gsize pos = *offset;
+
+  if (data_len - pos < RECORD_FIXED_SIZE)
+    return NULL;
+
+  memcpy (&connection_id_len_le, data + pos, sizeof (connection_id_len_le));
+  pos += sizeof (connection_id_len_le);
+
+  gsize connection_id_len = GUINT16_FROM_LE (connection_id_len_le);
+
+  if (connection_id_len == 0 ||
+      data_len - pos < connection_id_len + RECORD_FIXED_SIZE - sizeof (guint16))
+    return NULL;
+
+  const gchar *connection_id = (const gchar *) data + pos;
+  pos += connection_id_len;
+
+  if (!g_utf8_validate (connection_id, connection_id_len, NULL))
+    return NULL;
+
+  memcpy (&recurrence_start_usec_le, data + pos, sizeof (recurrence_start_usec_le));
+  pos += sizeof (recurrence_start_usec_le);
+  memcpy (&recurrence_end_usec_le, data + pos, sizeof (recurrence_end_usec_le));
+  pos += sizeof (recurrence_end_usec_le);
+  memcpy (&n_bytes_le, data + pos, sizeof (n_bytes_le));
+  pos += sizeof (n_bytes_le);
+
+  UsageRecord *record = g_new0 (UsageRecord, 1);
+  record->connection_id = g_strndup (connection_id, connection_id_len);
+  record->recurrence_start_usec = GINT64_FROM_LE (recurrence_start_usec_le);
+  record->recurrence_end_usec = GINT64_FROM_LE (recurrence_end_usec_le);
+  record->n_bytes = GUINT64_FROM_LE (n_bytes_le);
+
+  *offset = pos;
+
+  return record;
+}
+
+/**
+ * mws_usage_ledger_load:
+ * @self: a #MwsUsageLedger
+ * @error: return location for a #GError, or %NULL
+ *
+ * Load the records from the ledger file into memory. This must be called
+ * before any records are added using mws_usage_ledger_record(). If the file
+ * doesn’t exist, the ledger is left empty and %TRUE is returned.
+ *
+ * If the file can’t be read, or has an unrecognised format, an error is
+ * returned and the ledger is left empty. The file will be replaced when the
+ * ledger is next flushed. If the file is truncated, the complete records in
+ * it are loaded and %TRUE is returned.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 0.3.0
+ */
+gboolean
+mws_usage_ledger_load (MwsUsageLedger  *self,
+                       GError         **error)
+{
+  g_return_val_if_fail (MWS_IS_USAGE_LEDGER (self), FALSE);
+  g_return_val_if_fail (g_hash_table_size (self->records) == 0, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  g_autofree gchar *contents = NULL;
+  gsize contents_len = 0;
+  g_autoptr(GError) local_error = NULL;
+
+  if (!g_file_get_contents (self->path, &contents, &contents_len, &local_error))
+    {
+      if (g_error_matches (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        {
+          g_debug ("%s: No usage ledger at ‘%s’", G_STRFUNC, self->path);
+          return TRUE;
+        }
+
+      self->needs_compaction = TRUE;
+      g_propagate_prefixed_error (error, g_steal_pointer (&local_error),
+                                  _("Error loading usage ledger ‘%s’: "),
+                                  self->path);
+      return FALSE;
+    }
+
+  if (contents_len < sizeof (LEDGER_MAGIC) ||
+      memcmp (contents, LEDGER_MAGIC, sizeof (LEDGER_MAGIC)) != 0)
+    {
+      self->needs_compaction = TRUE;
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   _("Error loading usage ledger ‘%s’: Unrecognised format"),
+                   self->path);
+      return FALSE;
+    }
+
+  const guint8 *data = (const guint8 *) contents;
+  gsize offset = sizeof (LEDGER_MAGIC);
+
+  while (offset < contents_len)
+    {
+      UsageRecord *record = parse_record (data, contents_len, &offset);
+
+      if (record == NULL)
+        {
+          g_debug ("%s: Usage ledger ‘%s’ is damaged after %u records; "
+                   "it will be rewritten", G_STRFUNC, self->path,
+                   self->n_file_records);
+          self->needs_compaction = TRUE;
+          break;
+        }
+
+      /* Later records supersede earlier ones. */
+      g_hash_table_replace (self->records, record, record);
+      self->n_file_records++;
+    }
+
+  g_debug ("%s: Loaded %u records (%u live) from usage ledger ‘%s’",
+           G_STRFUNC, self->n_file_records, g_hash_table_size (self->records),
+           self->path);
+
+  return TRUE;
+}
+
+/* Write all of @data to @fd, retrying on short writes. On error, errno is
+ * set and %FALSE is returned. */
+static gboolean
+write_all (int           fd,
+           const guint8 *data,
+           gsize         data_len)
+{
+  while (data_len > 0)
+    {
+      ssize_t n_written = write (fd, data, data_len);
+
+      if (n_written < 0 && errno == EINTR)
+        continue;
+      else if (n_written < 0)
+        return FALSE;
+
+      data += n_written;
+      data_len -= n_written;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+set_error_from_errno (GError      **error,
+                      int           errsv,
+                      const gchar  *path)
+{
+  g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+               _("Error writing usage ledger ‘%s’: %s"),
+               path, g_strerror (errsv));
+  return FALSE;
+}
+
+/* Atomically replace the ledger file with one containing only the live
+ * records. */
+static gboolean
+compact (MwsUsageLedger  *self,
+         GError         **error)
+{
+  g_autoptr(GByteArray) buffer = g_byte_array_new ();
+  g_autofree gchar *tmp_path = g_strconcat (self->path, ".tmp", NULL);
+  GHashTableIter iter;
+  gpointer key;
+  int fd, errsv;
+
+  g_byte_array_append (buffer, (const guint8 *) LEDGER_MAGIC, sizeof (LEDGER_MAGIC));
+
+  g_hash_table_iter_init (&iter, self->records);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    append_record (buffer, key);
+
+  fd = g_open (tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0)
+    return set_error_from_errno (error, errno, tmp_path);
+
+  if (!write_all (fd, buffer->data, buffer->len) ||
+      fsync (fd) < 0)
+    {
+      errsv = errno;
+      close (fd);
+      g_unlink (tmp_path);
+      return set_error_from_errno (error, errsv, tmp_path);
+    }
+
+  if (close (fd) < 0 ||
+      g_rename (tmp_path, self->path) < 0)
+    {
+      errsv = errno;
+      g_unlink (tmp_path);
+      return set_error_from_errno (error, errsv, self->path);
+    }
+
+  g_debug ("%s: Compacted usage ledger ‘%s’ from %u to %u records",
+           G_STRFUNC, self->path, self->n_file_records,
+           g_hash_table_size (self->records));
+
+  self->n_file_records = g_hash_table_size (self->records);
+  self->needs_compaction = FALSE;
+
+  return TRUE;
+}
+
+/* Append the dirty records to the ledger file, writing its header first if
+ * it’s new. */
+static gboolean
+append_dirty_records (MwsUsageLedger  *self,
+                      GError         **error)
+{
+  g_autoptr(GByteArray) buffer = g_byte_array_new ();
+  struct stat stat_buf;
+  int fd, errsv;
+
+  fd = g_open (self->path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0)
+    return set_error_from_errno (error, errno, self->path);
+
+  if (fstat (fd, &stat_buf) < 0)
+    {
+      errsv = errno;
+      close (fd);
+      return set_error_from_errno (error, errsv, self->path);
+    }
+
+  if (stat_buf.st_size == 0)
+    g_byte_array_append (buffer, (const guint8 *) LEDGER_MAGIC, sizeof (LEDGER_MAGIC));
+
+  for (guint i = 0; i < self->dirty_records->len; i++)
+    append_record (buffer, g_ptr_array_index (self->dirty_records, i));
+
+  if (!write_all (fd, buffer->data, buffer->len) ||
+      fsync (fd) < 0)
+    {
+      errsv = errno;
+      close (fd);
+
+      /* The file may now end in a partial record, so make sure the next flush
+       * doesn’t append after it. */
+      self->needs_compaction = TRUE;
+
+      return set_error_from_errno (error, errsv, self->path);
+    }
+
+  if (close (fd) < 0)
+    return set_error_from_errno (error, errno, self->path);
+
+  self->n_file_records += self->dirty_records->len;
+
+  return TRUE;
+}
+
+/**
+ * mws_usage_ledger_flush:
+ * @self: a #MwsUsageLedger
+ * @error: return location for a #GError, or %NULL
+ *
+ * Write any records which have changed since the last flush to the ledger
+ * file, and sync it to disk. The file is compacted if needed. This is done
+ * automatically a short time after records change, and when @self is
+ * disposed, but should be called explicitly before the process exits.
+ *
+ * If this fails, the changed records are kept in memory, and will be written
+ * on the next flush.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 0.3.0
+ */
+gboolean
+mws_usage_ledger_flush (MwsUsageLedger  *self,
+                        GError         **error)
+{
+  g_return_val_if_fail (MWS_IS_USAGE_LEDGER (self), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  g_clear_handle_id (&self->flush_source_id, g_source_remove);
+
+  if (self->dirty_records->len == 0 && !self->needs_compaction)
+    return TRUE;
+
+  g_autofree gchar *dirname = g_path_get_dirname (self->path);
+  if (g_mkdir_with_parents (dirname, 0755) < 0)
+    return set_error_from_errno (error, errno, self->path);
+
+  guint n_live_records = g_hash_table_size (self->records);
+  guint n_file_records = self->n_file_records + self->dirty_records->len;
+  gboolean success;
+
+  if (self->needs_compaction ||
+      (n_file_records >= COMPACTION_MIN_RECORDS &&
+       n_file_records / COMPACTION_RATIO > n_live_records))
+    success = compact (self, error);
+  else
+    success = append_dirty_records (self, error);
+
+  if (!success)
+    return FALSE;
+
+  for (guint i = 0; i < self->dirty_records->len; i++)
+    {
+      UsageRecord *record = g_ptr_array_index (self->dirty_records, i);
+      record->dirty = FALSE;
+    }
+
+  g_ptr_array_set_size (self->dirty_records, 0);
+
+  return TRUE;
+}
+
+static gboolean
+flush_cb (gpointer user_data)
+{
+  MwsUsageLedger *self = MWS_USAGE_LEDGER (user_data);
+  g_autoptr(GError) local_error = NULL;
+
+  self->flush_source_id = 0;
+
+  if (!mws_usage_ledger_flush (self, &local_error))
+    g_warning ("%s", local_error->message);
+
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * mws_usage_ledger_lookup:
+ * @self: a #MwsUsageLedger
+ * @connection_id: ID of the connection to look up
+ * @recurrence_start_usec: start of the tariff period recurrence to look up, in
+ *    microseconds since the Unix epoch
+ * @recurrence_end_usec: end of the tariff period recurrence to look up, in
+ *    microseconds since the Unix epoch
+ *
+ * Get the number of bytes recorded in the ledger as having been used over
+ * @connection_id in the given recurrence of a tariff period.
+ *
+ * Returns: number of bytes used, or 0 if there is no record
+ * Since: 0.3.0
+ */
+guint64
+mws_usage_ledger_lookup (MwsUsageLedger *self,
+                         const gchar    *connection_id,
+                         gint64          recurrence_start_usec,
+                         gint64          recurrence_end_usec)
+{
+  g_return_val_if_fail (MWS_IS_USAGE_LEDGER (self), 0);
+  g_return_val_if_fail (connection_id != NULL, 0);
+
+  const UsageRecord key =
+    {
+      .connection_id = (gchar *) connection_id,
+      .recurrence_start_usec = recurrence_start_usec,
+      .recurrence_end_usec = recurrence_end_usec,
+    };
+
+  const UsageRecord *record = g_hash_table_lookup (self->records, &key);
+
+  return (record != NULL) ? record->n_bytes : 0;
+}
+
+/**
+ * mws_usage_ledger_record:
+ * @self: a #MwsUsageLedger
+ * @connection_id: ID of the connection the bytes were used over
+ * @recurrence_start_usec: start of the tariff period recurrence the bytes were
+ *    used in, in microseconds since the Unix epoch
+ * @recurrence_end_usec: end of the tariff period recurrence the bytes were used
+ *    in, in microseconds since the Unix epoch
+ * @n_bytes: total number of bytes used in the recurrence so far
+ *
+ * Record that @n_bytes have been used over @connection_id in the given
+ * recurrence of a tariff period, replacing any previous record for it. This
+ * only updates the ledger in memory, so is cheap to call often; it will be
+ * written to disk on the next flush, which will happen automatically.
+ *
+ * Since: 0.3.0
+ */
+void
+mws_usage_ledger_record (MwsUsageLedger *self,
+                         const gchar    *connection_id,
+                         gint64          recurrence_start_usec,
+                         gint64          recurrence_end_usec,
+                         guint64         n_bytes)
+{
+  g_return_if_fail (MWS_IS_USAGE_LEDGER (self));
+  g_return_if_fail (connection_id != NULL && *connection_id != '\0');
+  g_return_if_fail (recurrence_start_usec < recurrence_end_usec);
+
+  if (strlen (connection_id) > G_MAXUINT16)
+    {
+      g_debug ("%s: Not recording usage for connection with overlong ID",
+               G_STRFUNC);
+      return;
+    }
+
+  const UsageRecord key =
+    {
+      .connection_id = (gchar *) connection_id,
+      .recurrence_start_usec = recurrence_start_usec,
+      .recurrence_end_usec = recurrence_end_usec,
+    };
+
+  UsageRecord *record = g_hash_table_lookup (self->records, &key);
+
+  if (record == NULL)
+    {
+      record = g_new0 (UsageRecord, 1);
+      record->connection_id = g_strdup (connection_id);
+      record->recurrence_start_usec = recurrence_start_usec;
+      record->recurrence_end_usec = recurrence_end_usec;
+      g_hash_table_add (self->records, record);
+    }
+  else if (record->n_bytes == n_bytes)
+    {
+      return;
+    }
+
+  record->n_bytes = n_bytes;
+
+  if (!record->dirty)
+    {
+      record->dirty = TRUE;
+      g_ptr_array_add (self->dirty_records, record);
+    }
+
+  if (self->flush_source_id == 0)
+    self->flush_source_id = g_timeout_add_seconds (FLUSH_INTERVAL_SECONDS,
+                                                   flush_cb, self);
+}
+
+/**
+ * mws_usage_ledger_expire:
+ * @self: a #MwsUsageLedger
+ * @now_usec: the current time, in microseconds since the Unix epoch
+ *
+ * Remove the records for tariff period recurrences which ended at or before
+ * @now_usec, since they no longer affect capacity limits. They will be removed
+ * from the ledger file the next time it is compacted.
+ *
+ * Since: 0.3.0
+ */
+void
+mws_usage_ledger_expire (MwsUsageLedger *self,
+                         gint64          now_usec)
+{
+  g_return_if_fail (MWS_IS_USAGE_LEDGER (self));
+
+  GHashTableIter iter;
+  gpointer key;
+
+  g_hash_table_iter_init (&iter, self->records);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      UsageRecord *record = key;
+
+      if (record->recurrence_end_usec > now_usec)
+        continue;
+
+      if (record->dirty)
+        g_ptr_array_remove_fast (self->dirty_records, record);
+
+      g_hash_table_iter_remove (&iter);
+    }
+}
+
+/**
+ * mws_usage_ledger_get_n_records:
+ * @self: a #MwsUsageLedger
+ *
+ * Get the number of live records in the ledger.
+ *
+ * Returns: number of records
+ * Since: 0.3.0
+ */
+guint
+mws_usage_ledger_get_n_records (MwsUsageLedger *self)
+{
+  g_return_val_if_fail (MWS_IS_USAGE_LEDGER (self), 0);
+
+  return g_hash_table_size (self->records);
+}
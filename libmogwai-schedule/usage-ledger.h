@@ -0,0 +1,57 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+
+#pragma once
+
+#include <glib.h>
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define MWS_TYPE_USAGE_LEDGER mws_usage_ledger_get_type ()
+G_DECLARE_FINAL_TYPE (MwsUsageLedger, mws_usage_ledger, MWS, USAGE_LEDGER, GObject)
+
+MwsUsageLedger *mws_usage_ledger_new           (const gchar     *path);
+
+const gchar    *mws_usage_ledger_get_path      (MwsUsageLedger  *self);
+
+gboolean        mws_usage_ledger_load          (MwsUsageLedger  *self,
+                                                GError         **error);
+gboolean        mws_usage_ledger_flush         (MwsUsageLedger  *self,
+                                                GError         **error);
+
+guint64         mws_usage_ledger_lookup        (MwsUsageLedger  *self,
+                                                const gchar     *connection_id,
+                                                gint64           recurrence_start_usec,
+                                                gint64           recurrence_end_usec);
+void            mws_usage_ledger_record        (MwsUsageLedger  *self,
+                                                const gchar     *connection_id,
+                                                gint64           recurrence_start_usec,
+                                                gint64           recurrence_end_usec,
+                                                guint64          n_bytes);
+void            mws_usage_ledger_expire        (MwsUsageLedger  *self,
+                                                gint64           now_usec);
+
+guint           mws_usage_ledger_get_n_records (MwsUsageLedger  *self);
+
+G_END_DECLS
@@ -0,0 +1,455 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <glib/gi18n-lib.h>
+#include <gio/gio.h>
+#include <libmogwai-schedule/wake-timer.h>
+#include <libmogwai-schedule/wake-timer-private.h>
+
+
+/* The wake timer is an instance of the static systemd timer template unit
+ * %MWS_WAKE_TIMER_TEMPLATE_UNIT, which starts %MWS_WAKE_TIMER_TARGET_UNIT at
+ * the wall clock time given by its (escaped) instance name. This lets the
+ * daemon exit while it has no work to do until then, rather than staying
+ * resident just to wait for a #MwsClock alarm.
+ *
+ * A template is used, rather than a transient unit, because systemd only tells
+ * polkit which unit is being managed (and how) for StartUnit() and StopUnit()
+ * calls. That lets the polkit rules allow the daemon to start and stop
+ * instances of this template, and nothing else. */
+
+#define WAKE_TIMER_PREFIX "mogwai-scheduled-wake@"
+#define WAKE_TIMER_SUFFIX ".timer"
+
+/* Whether @error is the given D-Bus error from systemd. */
+static gboolean
+is_systemd_error (const GError *error,
+                  const gchar  *error_name)
+{
+  g_autofree gchar *remote_error = NULL;
+
+  if (error == NULL || !g_dbus_error_is_remote_error (error))
+    return FALSE;
+
+  remote_error = g_dbus_error_get_remote_error (error);
+  return (g_strcmp0 (remote_error, error_name) == 0);
+}
+
+/* Get the name of the wake timer instance which elapses at @calendar_spec.
+ * The instance name is escaped as `systemd-escape` would: `%I` in the template
+ * unescapes `\xNN`, but also turns `-` back into `/`, so everything apart from
+ * alphanumerics, `:` and `_` (including `-`) must be escaped as `\xNN`. */
+gchar *
+mws_wake_timer_unit_for_calendar_spec (const gchar *calendar_spec)
+{
+  g_autoptr(GString) unit = g_string_new (WAKE_TIMER_PREFIX);
+
+  for (const gchar *c = calendar_spec; *c != '\0'; c++)
+    {
+      if (g_ascii_isalnum (*c) || *c == ':' || *c == '_')
+        g_string_append_c (unit, *c);
+      else
+        g_string_append_printf (unit, "\\x%02x", (guint) (guchar) *c);
+    }
+
+  g_string_append (unit, WAKE_TIMER_SUFFIX);
+
+  return g_string_free (g_steal_pointer (&unit), FALSE);
+}
+
+typedef struct
+{
+  GDBusConnection *connection;  /* (owned) */
+  gchar *keep_unit;  /* (owned) (nullable) */
+  guint n_pending;
+  GError *error;  /* (owned) (nullable) */
+} StopData;
+
+static void
+stop_data_free (StopData *data)
+{
+  g_clear_object (&data->connection);
+  g_free (data->keep_unit);
+  g_clear_error (&data->error);
+  g_free (data);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (StopData, stop_data_free)
+
+static void stop_instances_list_cb (GObject      *obj,
+                                    GAsyncResult *result,
+                                    gpointer      user_data);
+static void stop_instances_stop_cb (GObject      *obj,
+                                    GAsyncResult *result,
+                                    gpointer      user_data);
+
+/* Stop all the loaded instances of the wake timer, apart from @keep_unit (if
+ * it’s non-%NULL). There may be more than one if the daemon was killed while
+ * arming one. */
+static void
+stop_instances_async (GDBusConnection     *connection,
+                      const gchar         *keep_unit,
+                      GCancellable        *cancellable,
+                      GAsyncReadyCallback  callback,
+                      gpointer             user_data)
+{
+  g_autoptr(GTask) task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (task, stop_instances_async);
+
+  g_autoptr(StopData) data = g_new0 (StopData, 1);
+  data->connection = g_object_ref (connection);
+  data->keep_unit = g_strdup (keep_unit);
+  g_task_set_task_data (task, g_steal_pointer (&data), (GDestroyNotify) stop_data_free);
+
+  const gchar *states[] = { NULL };
+  const gchar *patterns[] = { WAKE_TIMER_PREFIX "*" WAKE_TIMER_SUFFIX, NULL };
+
+  g_dbus_connection_call (connection,
+                          "org.freedesktop.systemd1",
+                          "/org/freedesktop/systemd1",
+                          "org.freedesktop.systemd1.Manager",
+                          "ListUnitsByPatterns",
+                          g_variant_new ("(^as^as)", states, patterns),
+                          G_VARIANT_TYPE ("(a(ssssssouso))"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1  /* default timeout */,
+                          cancellable,
+                          stop_instances_list_cb,
+                          g_steal_pointer (&task));
+}
+
+static void
+stop_instances_list_cb (GObject      *obj,
+                        GAsyncResult *result,
+                        gpointer      user_data)
+{
+  GDBusConnection *connection = G_DBUS_CONNECTION (obj);
+  g_autoptr(GTask) task = G_TASK (user_data);
+  StopData *data = g_task_get_task_data (task);
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  reply = g_dbus_connection_call_finish (connection, result, &local_error);
+
+  if (reply == NULL)
+    {
+      g_task_return_error (task, g_steal_pointer (&local_error));
+      return;
+    }
+
+  g_autoptr(GVariantIter) units_iter = NULL;
+  const gchar *unit_name, *active_state;
+
+  g_variant_get (reply, "(a(ssssssouso))", &units_iter);
+
+  while (g_variant_iter_next (units_iter, "(&s&s&s&s&s&s&ou&s&o)",
+                              &unit_name, NULL, NULL, &active_state,
+                              NULL, NULL, NULL, NULL, NULL, NULL))
+    {
+      if (g_strcmp0 (unit_name, data->keep_unit) == 0 ||
+          g_str_equal (active_state, "inactive"))
+        continue;
+
+      g_debug ("%s: Stopping ‘%s’", G_STRFUNC, unit_name);
+
+      data->n_pending++;
+      g_dbus_connection_call (connection,
+                              "org.freedesktop.systemd1",
+                              "/org/freedesktop/systemd1",
+                              "org.freedesktop.systemd1.Manager",
+                              "StopUnit",
+                              g_variant_new ("(ss)", unit_name, "replace"),
+                              G_VARIANT_TYPE ("(o)"),
+                              G_DBUS_CALL_FLAGS_NONE,
+                              -1  /* default timeout */,
+                              g_task_get_cancellable (task),
+                              stop_instances_stop_cb,
+                              g_object_ref (task));
+    }
+
+  if (data->n_pending == 0)
+    g_task_return_boolean (task, TRUE);
+}
+
+static void
+stop_instances_stop_cb (GObject      *obj,
+                        GAsyncResult *result,
+                        gpointer      user_data)
+{
+  GDBusConnection *connection = G_DBUS_CONNECTION (obj);
+  g_autoptr(GTask) task = G_TASK (user_data);
+  StopData *data = g_task_get_task_data (task);
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  reply = g_dbus_connection_call_finish (connection, result, &local_error);
+
+  /* The timer might have elapsed and been unloaded in the meantime. */
+  if (local_error != NULL &&
+      !is_systemd_error (local_error, "org.freedesktop.systemd1.NoSuchUnit") &&
+      data->error == NULL)
+    data->error = g_steal_pointer (&local_error);
+
+  data->n_pending--;
+
+  if (data->n_pending > 0)
+    return;
+
+  if (data->error != NULL)
+    g_task_return_error (task, g_steal_pointer (&data->error));
+  else
+    g_task_return_boolean (task, TRUE);
+}
+
+static gboolean
+stop_instances_finish (GAsyncResult  *result,
+                       GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+  g_return_val_if_fail (g_async_result_is_tagged (result, stop_instances_async), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+typedef struct
+{
+  GDBusConnection *connection;  /* (owned) */
+  gchar *unit;  /* (owned) */
+} ArmData;
+
+static void
+arm_data_free (ArmData *data)
+{
+  g_clear_object (&data->connection);
+  g_free (data->unit);
+  g_free (data);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ArmData, arm_data_free)
+
+static void arm_stop_cb  (GObject      *obj,
+                          GAsyncResult *result,
+                          gpointer      user_data);
+static void arm_start_cb (GObject      *obj,
+                          GAsyncResult *result,
+                          gpointer      user_data);
+
+/**
+ * mws_wake_timer_arm_async:
+ * @connection: system bus connection
+ * @wake_time: time to start %MWS_WAKE_TIMER_TARGET_UNIT at
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: callback to invoke once the timer is armed
+ * @user_data: data to pass to @callback
+ *
+ * Arm the wake timer, so that systemd starts %MWS_WAKE_TIMER_TARGET_UNIT at
+ * @wake_time (rounded up to the next second), even if the daemon has exited by
+ * then. Any previously armed wake timer is replaced.
+ *
+ * The timer is a calendar timer, so it follows the wall clock: if the system
+ * is suspended at @wake_time, the unit is started once it resumes.
+ *
+ * Since: 0.3.0
+ */
+void
+mws_wake_timer_arm_async (GDBusConnection     *connection,
+                          GDateTime           *wake_time,
+                          GCancellable        *cancellable,
+                          GAsyncReadyCallback  callback,
+                          gpointer             user_data)
+{
+  g_return_if_fail (G_IS_DBUS_CONNECTION (connection));
+  g_return_if_fail (wake_time != NULL);
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+  g_autoptr(GTask) task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (task, mws_wake_timer_arm_async);
+
+  /* Calendar specifications only have a resolution of one second. Waking
+   * early would be pointless, so round up. */
+  g_autoptr(GDateTime) wake_time_utc = g_date_time_to_utc (wake_time);
+  gint microsecond = g_date_time_get_microsecond (wake_time_utc);
+  g_autoptr(GDateTime) wake_time_rounded = NULL;
+  wake_time_rounded = g_date_time_add (wake_time_utc,
+                                       (microsecond > 0) ? G_USEC_PER_SEC - microsecond : 0);
+
+  g_autofree gchar *calendar_spec = g_date_time_format (wake_time_rounded,
+                                                        "%Y-%m-%d %H:%M:%S UTC");
+  g_autoptr(ArmData) data = g_new0 (ArmData, 1);
+  data->connection = g_object_ref (connection);
+  data->unit = mws_wake_timer_unit_for_calendar_spec (calendar_spec);
+  const gchar *unit = data->unit;
+  g_task_set_task_data (task, g_steal_pointer (&data), (GDestroyNotify) arm_data_free);
+
+  /* Stop any other armed instance first, so only one wake time is pending. */
+  stop_instances_async (connection, unit, cancellable,
+                        arm_stop_cb, g_steal_pointer (&task));
+}
+
+static void
+arm_stop_cb (GObject      *obj,
+             GAsyncResult *result,
+             gpointer      user_data)
+{
+  g_autoptr(GTask) task = G_TASK (user_data);
+  ArmData *data = g_task_get_task_data (task);
+  g_autoptr(GError) local_error = NULL;
+
+  /* An old instance which can’t be stopped will elapse harmlessly, since it
+   * only starts the daemon. If the new one can’t be started either, that will
+   * give a more meaningful error. */
+  if (!stop_instances_finish (result, &local_error))
+    g_debug ("%s: Error stopping old wake timers: %s",
+             G_STRFUNC, local_error->message);
+
+  g_debug ("%s: Arming ‘%s’", G_STRFUNC, data->unit);
+
+  g_dbus_connection_call (data->connection,
+                          "org.freedesktop.systemd1",
+                          "/org/freedesktop/systemd1",
+                          "org.freedesktop.systemd1.Manager",
+                          "StartUnit",
+                          g_variant_new ("(ss)", data->unit, "replace"),
+                          G_VARIANT_TYPE ("(o)"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1  /* default timeout */,
+                          g_task_get_cancellable (task),
+                          arm_start_cb,
+                          g_object_ref (task));
+}
+
+static void
+arm_start_cb (GObject      *obj,
+              GAsyncResult *result,
+              gpointer      user_data)
+{
+  GDBusConnection *connection = G_DBUS_CONNECTION (obj);
+  g_autoptr(GTask) task = G_TASK (user_data);
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  reply = g_dbus_connection_call_finish (connection, result, &local_error);
+
+  if (local_error != NULL)
+    {
+      g_prefix_error (&local_error, _("Error arming wake timer: "));
+      g_task_return_error (task, g_steal_pointer (&local_error));
+      return;
+    }
+
+  g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * mws_wake_timer_arm_finish:
+ * @result: asynchronous operation result
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish arming the wake timer. See mws_wake_timer_arm_async().
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 0.3.0
+ */
+gboolean
+mws_wake_timer_arm_finish (GAsyncResult  *result,
+                           GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+  g_return_val_if_fail (g_async_result_is_tagged (result, mws_wake_timer_arm_async), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+static void disarm_cb (GObject      *obj,
+                       GAsyncResult *result,
+                       gpointer      user_data);
+
+/**
+ * mws_wake_timer_disarm_async:
+ * @connection: system bus connection
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: callback to invoke once the timer is disarmed
+ * @user_data: data to pass to @callback
+ *
+ * Disarm the wake timer, if it’s armed. It is not an error if it isn’t.
+ *
+ * Since: 0.3.0
+ */
+void
+mws_wake_timer_disarm_async (GDBusConnection     *connection,
+                             GCancellable        *cancellable,
+                             GAsyncReadyCallback  callback,
+                             gpointer             user_data)
+{
+  g_return_if_fail (G_IS_DBUS_CONNECTION (connection));
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+  g_autoptr(GTask) task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (task, mws_wake_timer_disarm_async);
+
+  stop_instances_async (connection, NULL, cancellable, disarm_cb,
+                        g_steal_pointer (&task));
+}
+
+static void
+disarm_cb (GObject      *obj,
+           GAsyncResult *result,
+           gpointer      user_data)
+{
+  g_autoptr(GTask) task = G_TASK (user_data);
+  g_autoptr(GError) local_error = NULL;
+
+  if (!stop_instances_finish (result, &local_error))
+    {
+      g_prefix_error (&local_error, _("Error disarming wake timer: "));
+      g_task_return_error (task, g_steal_pointer (&local_error));
+    }
+  else
+    {
+      g_task_return_boolean (task, TRUE);
+    }
+}
+
+/**
+ * mws_wake_timer_disarm_finish:
+ * @result: asynchronous operation result
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish disarming the wake timer. See mws_wake_timer_disarm_async().
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 0.3.0
+ */
+gboolean
+mws_wake_timer_disarm_finish (GAsyncResult  *result,
+                              GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+  g_return_val_if_fail (g_async_result_is_tagged (result, mws_wake_timer_disarm_async), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
@@ -0,0 +1,66 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/**
+ * MWS_WAKE_TIMER_TEMPLATE_UNIT:
+ *
+ * Name of the systemd timer template unit, instances of which are started by
+ * mws_wake_timer_arm_async(). The instance name is the time the timer elapses
+ * at, as a calendar specification.
+ *
+ * Since: 0.3.0
+ */
+#define MWS_WAKE_TIMER_TEMPLATE_UNIT "mogwai-scheduled-wake@.timer"
+
+/**
+ * MWS_WAKE_TIMER_TARGET_UNIT:
+ *
+ * Name of the systemd unit which is started when the wake timer elapses. This
+ * is set in %MWS_WAKE_TIMER_TEMPLATE_UNIT, rather than by the daemon.
+ *
+ * Since: 0.3.0
+ */
+#define MWS_WAKE_TIMER_TARGET_UNIT "mogwai-scheduled.service"
+
+void     mws_wake_timer_arm_async     (GDBusConnection      *connection,
+                                       GDateTime            *wake_time,
+                                       GCancellable         *cancellable,
+                                       GAsyncReadyCallback   callback,
+                                       gpointer              user_data);
+gboolean mws_wake_timer_arm_finish    (GAsyncResult         *result,
+                                       GError              **error);
+
+void     mws_wake_timer_disarm_async  (GDBusConnection      *connection,
+                                       GCancellable         *cancellable,
+                                       GAsyncReadyCallback   callback,
+                                       gpointer              user_data);
+gboolean mws_wake_timer_disarm_finish (GAsyncResult         *result,
+                                       GError              **error);
+
+G_END_DECLS
@@ -0,0 +1,108 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <libmogwai-schedule/worker-pool.h>
+
+
+/* A task queued by mws_worker_pool_run_task(). */
+typedef struct
+{
+  GTask *task;  /* (owned) */
+  GTaskThreadFunc task_func;
+} WorkerJob;
+
+static void
+worker_thread_cb (gpointer data,
+                  gpointer user_data)
+{
+  WorkerJob *job = data;
+
+  job->task_func (job->task,
+                  g_task_get_source_object (job->task),
+                  g_task_get_task_data (job->task),
+                  g_task_get_cancellable (job->task));
+
+  g_object_unref (job->task);
+  g_free (job);
+}
+
+static GThreadPool *
+get_worker_pool (void)
+{
+  static gsize pool_once = 0;
+  static GThreadPool *pool = NULL;
+
+  if (g_once_init_enter (&pool_once))
+    {
+      g_autoptr(GError) local_error = NULL;
+
+      /* Non-exclusive pools can’t fail to be created. */
+      pool = g_thread_pool_new (worker_thread_cb, NULL,
+                                MWS_WORKER_POOL_MAX_THREADS, FALSE,
+                                &local_error);
+      g_assert_no_error (local_error);
+
+      g_once_init_leave (&pool_once, 1);
+    }
+
+  return pool;
+}
+
+/**
+ * mws_worker_pool_run_task:
+ * @task: a #GTask
+ * @task_func: function to run in a worker thread
+ *
+ * Run @task_func in one of a bounded pool of worker threads, as
+ * g_task_run_in_thread() does with GIO’s shared pool. This is for blocking
+ * work, such as reading from `/proc` or parsing large tariffs, which would
+ * otherwise hold up the main context and delay unrelated D-Bus method calls.
+ *
+ * @task_func must return a result using one of the `g_task_return_*()`
+ * functions, and must not touch any state which is owned by the main context
+ * without locking. The result is returned to @task’s callback in the
+ * #GMainContext which was the thread-default when @task was created. At most
+ * %MWS_WORKER_POOL_MAX_THREADS tasks run at once; the pool is separate from
+ * GIO’s, so these tasks never delay GIO’s own asynchronous operations.
+ *
+ * A reference to @task is held until @task_func returns.
+ *
+ * Since: 0.3.0
+ */
+void
+mws_worker_pool_run_task (GTask           *task,
+                          GTaskThreadFunc  task_func)
+{
+  g_return_if_fail (G_IS_TASK (task));
+  g_return_if_fail (task_func != NULL);
+
+  WorkerJob *job = g_new0 (WorkerJob, 1);
+  job->task = g_object_ref (task);
+  job->task_func = task_func;
+
+  /* Non-exclusive pools can’t fail to push. */
+  g_thread_pool_push (get_worker_pool (), job, NULL);
+}
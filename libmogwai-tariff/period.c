@@ -83,8 +83,33 @@ struct _MwtPeriod
   guint repeat_period;
 
   guint64 capacity_limit;
+
+  /* Cached values for calculating recurrences of periods which repeat with a
+   * fixed step (%MWT_PERIOD_REPEAT_HOUR, %MWT_PERIOD_REPEAT_DAY and
+   * %MWT_PERIOD_REPEAT_WEEK), without allocating #GDateTimes. All times are in
+   * microseconds; the local times are wall-clock times in the respective
+   * #GTimeZones of @start and @end, relative to the Unix epoch. @step is the
+   * repeat step in microseconds, or zero if this fast path can’t be used. */
+  gint64 start_usec;
+  gint64 end_usec;
+  gint64 start_local_usec;
+  gint64 end_local_usec;
+  gboolean start_is_dst;
+  gboolean end_is_dst;
+  gint64 step;
+  gboolean step_is_wall_clock;
 };
 
+/* An upper bound on the difference between any two #GDateTimes, in
+ * microseconds. Anything larger than this cannot be represented, and products
+ * of anything smaller than this with small factors cannot overflow a #gint64. */
+#define MAX_DATE_TIME_SPAN (G_GINT64_CONSTANT (10000) * 366 * G_TIME_SPAN_DAY)
+
+/* The range of times representable by #GDateTime, in microseconds since the
+ * Unix epoch: 0001-01-01T00:00:00Z to 9999-12-31T23:59:59.999999Z. */
+#define MIN_DATE_TIME_USEC (G_GINT64_CONSTANT (-62135596800) * G_USEC_PER_SEC)
+#define MAX_DATE_TIME_USEC (G_GINT64_CONSTANT (253402300800) * G_USEC_PER_SEC - 1)
+
 typedef enum
 {
   PROP_START = 1,
@@ -204,6 +229,13 @@ mwt_period_init (MwtPeriod *self)
   /* Nothing to do here. */
 }
 
+static gint64
+date_time_to_usec (GDateTime *date_time)
+{
+  return (g_date_time_to_unix (date_time) * G_USEC_PER_SEC +
+          g_date_time_get_microsecond (date_time));
+}
+
 static void
 mwt_period_constructed (GObject *object)
 {
@@ -214,6 +246,47 @@ mwt_period_constructed (GObject *object)
   /* Validate properties. */
   g_assert (mwt_period_validate (self->start, self->end, self->repeat_type,
                                  self->repeat_period, NULL));
+
+  /* Precalculate the values for the recurrence fast path. */
+  self->start_usec = date_time_to_usec (self->start);
+  self->end_usec = date_time_to_usec (self->end);
+  self->start_local_usec = self->start_usec + g_date_time_get_utc_offset (self->start);
+  self->end_local_usec = self->end_usec + g_date_time_get_utc_offset (self->end);
+  self->start_is_dst = g_date_time_is_daylight_savings (self->start);
+  self->end_is_dst = g_date_time_is_daylight_savings (self->end);
+
+  GTimeSpan unit;
+
+  switch (self->repeat_type)
+    {
+    case MWT_PERIOD_REPEAT_HOUR:
+      /* g_date_time_add_hours() adds a fixed number of microseconds. */
+      unit = G_TIME_SPAN_HOUR;
+      self->step_is_wall_clock = FALSE;
+      break;
+    case MWT_PERIOD_REPEAT_DAY:
+      /* g_date_time_add_days() and g_date_time_add_weeks() add to the
+       * wall-clock time, then correct it for the time zone. */
+      unit = G_TIME_SPAN_DAY;
+      self->step_is_wall_clock = TRUE;
+      break;
+    case MWT_PERIOD_REPEAT_WEEK:
+      unit = G_TIME_SPAN_DAY * 7;
+      self->step_is_wall_clock = TRUE;
+      break;
+    case MWT_PERIOD_REPEAT_NONE:
+    case MWT_PERIOD_REPEAT_MONTH:
+    case MWT_PERIOD_REPEAT_YEAR:
+    default:
+      /* Months and years are not of fixed length, even in wall-clock time. */
+      unit = 0;
+      break;
+    }
+
+  if (unit != 0 && self->repeat_period <= MAX_DATE_TIME_SPAN / unit)
+    self->step = unit * self->repeat_period;
+  else
+    self->step = 0;
 }
 
 static void
@@ -623,13 +696,222 @@ get_nth_recurrence_skip_empty (MwtPeriod  *self,
     }
   while (was_empty);
 
-  g_debug ("%s: returning %s, n_skipped_periods: %" G_GUINT64_FORMAT " → %" G_GUINT64_FORMAT,
-           G_STRFUNC, retval ? "yes" : "no", *inout_n_skipped_periods, n_skipped_periods);
-
   *inout_n_skipped_periods = n_skipped_periods;
   return retval;
 }
 
+/* Floor division, rounding towards negative infinity. @b must be positive. */
+static gint64
+div_floor (gint64 a,
+           gint64 b)
+{
+  return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+/* Convert @local_usec, a wall-clock time in @tz relative to the Unix epoch, to
+ * microseconds since the Unix epoch. This resolves ambiguous and non-existent
+ * local times the same way as g_date_time_add_days(), preferring intervals
+ * whose DST type matches @is_dst. */
+static gint64
+local_usec_to_usec (GTimeZone *tz,
+                    gboolean   is_dst,
+                    gint64     local_usec)
+{
+  gint64 local_secs = div_floor (local_usec, G_USEC_PER_SEC);
+  gint64 remainder_usec = local_usec - local_secs * G_USEC_PER_SEC;
+  gint interval = g_time_zone_adjust_time (tz,
+                                           is_dst ? G_TIME_TYPE_DAYLIGHT : G_TIME_TYPE_STANDARD,
+                                           &local_secs);
+
+  return ((local_secs - g_time_zone_get_offset (tz, interval)) * G_USEC_PER_SEC +
+          remainder_usec);
+}
+
+/* Calculate the start and end time of the @n-th recurrence of @self, in
+ * microseconds since the Unix epoch, without allocating. This is equivalent
+ * to get_nth_recurrence(), but only works for periods with a fixed
+ * #MwtPeriod.step. Unlike get_nth_recurrence(), @n may be zero.
+ *
+ * If the recurrence can’t be represented, %FALSE is returned. If it is empty,
+ * @out_start and @out_end will be equal. */
+static gboolean
+get_nth_recurrence_usec (MwtPeriod *self,
+                         guint64    n,
+                         gint64    *out_start,
+                         gint64    *out_end)
+{
+  g_assert (self->step != 0);
+
+  /* Match the limits of get_nth_recurrence(). */
+  if (n > G_MAXINT / self->repeat_period ||
+      n > MAX_DATE_TIME_SPAN / self->step)
+    return FALSE;
+
+  gint64 offset = self->step * (gint64) n;
+
+  if (!self->step_is_wall_clock)
+    {
+      *out_start = self->start_usec + offset;
+      *out_end = self->end_usec + offset;
+    }
+  else
+    {
+      *out_start = local_usec_to_usec (g_date_time_get_timezone (self->start),
+                                       self->start_is_dst,
+                                       self->start_local_usec + offset);
+      *out_end = local_usec_to_usec (g_date_time_get_timezone (self->end),
+                                     self->end_is_dst,
+                                     self->end_local_usec + offset);
+    }
+
+  return (*out_start >= MIN_DATE_TIME_USEC && *out_end <= MAX_DATE_TIME_USEC);
+}
+
+/* Estimate which recurrence of @self was the last to have a start (or end, if
+ * @use_end is %TRUE) at or before @when_usec. The estimate could be off by one
+ * or two either way, due to time zone changes in #MwtPeriod.step_is_wall_clock
+ * mode. */
+static guint64
+estimate_nth_recurrence (MwtPeriod *self,
+                         gint64     when_usec,
+                         gboolean   use_end)
+{
+  gint64 base_usec = use_end ? self->end_usec : self->start_usec;
+  gint64 base_local_usec = use_end ? self->end_local_usec : self->start_local_usec;
+  gint64 diff;
+
+  if (self->step_is_wall_clock)
+    {
+      GTimeZone *tz = g_date_time_get_timezone (use_end ? self->end : self->start);
+      gint interval = g_time_zone_find_interval (tz, G_TIME_TYPE_UNIVERSAL,
+                                                 div_floor (when_usec, G_USEC_PER_SEC));
+      gint64 when_local_usec = when_usec;
+
+      if (interval >= 0)
+        when_local_usec += g_time_zone_get_offset (tz, interval) * G_USEC_PER_SEC;
+
+      diff = when_local_usec - base_local_usec;
+    }
+  else
+    {
+      diff = when_usec - base_usec;
+    }
+
+  return (diff > 0) ? (guint64) (diff / self->step) : 0;
+}
+
+/* Fast path for get_nearest_recurrences(), for periods with a fixed
+ * #MwtPeriod.step. Rather than stepping through recurrences one at a time, the
+ * index of the recurrence nearest @when_usec is calculated directly. This does
+ * not allocate.
+ *
+ * @when_usec must not be before #MwtPeriod:start. Recurrences are ordered, so
+ * the recurrence containing @when_usec (if any) is the first one which ends
+ * after it, as long as that also starts at or before it. The next recurrence
+ * is the first non-empty one which starts after @when_usec.
+ *
+ * @out_has_contains and @out_has_next are set to whether a containing and a
+ * next recurrence were found; the other out arguments are only set if so. */
+static void
+get_nearest_recurrences_fixed (MwtPeriod *self,
+                               gint64     when_usec,
+                               gboolean  *out_has_contains,
+                               gint64    *out_contains_start,
+                               gint64    *out_contains_end,
+                               gboolean  *out_has_next,
+                               gint64    *out_next_start,
+                               gint64    *out_next_end)
+{
+  gint64 start_usec, end_usec;
+
+  g_assert (when_usec >= self->start_usec);
+
+  *out_has_contains = FALSE;
+  *out_has_next = FALSE;
+
+  /* Find the last recurrence which starts at or before @when_usec. Recurrence
+   * 0 always does. Unrepresentable recurrences are treated as being infinitely
+   * far in the future. */
+  guint64 last_started = estimate_nth_recurrence (self, when_usec, FALSE);
+
+  while (last_started > 0 &&
+         (!get_nth_recurrence_usec (self, last_started, &start_usec, &end_usec) ||
+          start_usec > when_usec))
+    last_started--;
+  while (last_started < G_MAXUINT64 &&
+         get_nth_recurrence_usec (self, last_started + 1, &start_usec, &end_usec) &&
+         start_usec <= when_usec)
+    last_started++;
+
+  /* Find the first recurrence which ends after @when_usec. */
+  guint64 first_unended = estimate_nth_recurrence (self, when_usec, TRUE);
+
+  while (first_unended > 0 &&
+         (!get_nth_recurrence_usec (self, first_unended - 1, &start_usec, &end_usec) ||
+          end_usec > when_usec))
+    first_unended--;
+  while (first_unended <= last_started &&
+         get_nth_recurrence_usec (self, first_unended, &start_usec, &end_usec) &&
+         end_usec <= when_usec)
+    first_unended++;
+
+  if (first_unended <= last_started &&
+      get_nth_recurrence_usec (self, first_unended, &start_usec, &end_usec))
+    {
+      *out_has_contains = TRUE;
+      *out_contains_start = start_usec;
+      *out_contains_end = end_usec;
+    }
+
+  /* Find the next non-empty recurrence. Empty recurrences (due to DST
+   * transitions) are rare, and never adjacent. */
+  for (guint64 n = last_started + 1; n > last_started; n++)
+    {
+      if (!get_nth_recurrence_usec (self, n, &start_usec, &end_usec))
+        break;
+      if (start_usec == end_usec)
+        continue;
+
+      *out_has_next = TRUE;
+      *out_next_start = start_usec;
+      *out_next_end = end_usec;
+      break;
+    }
+}
+
+/* Wrap a time from get_nth_recurrence_usec() in a #GDateTime in the same time
+ * zone as @base, which is at @base_usec. Returns %NULL if it’s out of range. */
+static GDateTime *
+date_time_new_from_usec (GDateTime *base,
+                         gint64     base_usec,
+                         gint64     usec)
+{
+  return g_date_time_add (base, usec - base_usec);
+}
+
+/* Wrap the start and end of a recurrence from get_nearest_recurrences_fixed()
+ * in #GDateTimes. Both or neither are returned. */
+static void
+recurrence_to_date_times (MwtPeriod  *self,
+                          gboolean    has_recurrence,
+                          gint64      start_usec,
+                          gint64      end_usec,
+                          GDateTime **out_start,
+                          GDateTime **out_end)
+{
+  if (!has_recurrence)
+    return;
+
+  g_autoptr(GDateTime) start = date_time_new_from_usec (self->start, self->start_usec, start_usec);
+  g_autoptr(GDateTime) end = date_time_new_from_usec (self->end, self->end_usec, end_usec);
+
+  if (start != NULL && end != NULL)
+    {
+      *out_start = g_steal_pointer (&start);
+      *out_end = g_steal_pointer (&end);
+    }
+}
+
 /**
  * get_nearest_recurrences:
  * @self: a #MwtPeriod
@@ -716,6 +998,23 @@ get_nearest_recurrences (MwtPeriod  *self,
       self->repeat_period == 0)
     goto done;
 
+  /* Can we calculate the recurrences directly? */
+  if (self->step != 0)
+    {
+      gboolean has_contains, has_next;
+      gint64 contains_start_usec = 0, contains_end_usec = 0;
+      gint64 next_start_usec = 0, next_end_usec = 0;
+
+      get_nearest_recurrences_fixed (self, date_time_to_usec (when),
+                                     &has_contains, &contains_start_usec, &contains_end_usec,
+                                     &has_next, &next_start_usec, &next_end_usec);
+      recurrence_to_date_times (self, has_contains, contains_start_usec, contains_end_usec,
+                                &retval_contains_start, &retval_contains_end);
+      recurrence_to_date_times (self, has_next, next_start_usec, next_end_usec,
+                                &retval_next_start, &retval_next_end);
+      goto done;
+    }
+
   /* Firstly, work out a lower bound on the number of periods which could have
    * elapsed between @self->start and @when. We can use this to jump ahead to
    * roughly when the most appropriate recurrence could happen to contain @when,
@@ -754,9 +1053,6 @@ get_nearest_recurrences (MwtPeriod  *self,
   g_assert (max_period_span != 0 && self->repeat_period != 0);
   guint64 min_n_periods = ((diff / max_period_span) / self->repeat_period);
 
-  g_debug ("%s: diff: %" G_GINT64_FORMAT ", min_n_periods: %" G_GUINT64_FORMAT,
-           G_STRFUNC, diff, min_n_periods);
-
   start = g_date_time_ref (self->start);
   end = g_date_time_ref (self->end);
 
@@ -940,3 +1236,188 @@ mwt_period_get_next_recurrence (MwtPeriod  *self,
 
   return retval;
 }
+
+/* Get the recurrences of @self nearest to @when_usec, in microseconds since the
+ * Unix epoch. This is equivalent to get_nearest_recurrences(), but does not
+ * allocate unless the period repeats monthly or yearly. */
+static void
+get_nearest_recurrences_usec (MwtPeriod *self,
+                              gint64     when_usec,
+                              gboolean  *out_has_contains,
+                              gint64    *out_contains_start,
+                              gint64    *out_contains_end,
+                              gboolean  *out_has_next,
+                              gint64    *out_next_start,
+                              gint64    *out_next_end)
+{
+  *out_has_contains = FALSE;
+  *out_has_next = FALSE;
+
+  if (when_usec < self->start_usec)
+    {
+      *out_has_next = TRUE;
+      *out_next_start = self->start_usec;
+      *out_next_end = self->end_usec;
+    }
+  else if (self->repeat_type == MWT_PERIOD_REPEAT_NONE)
+    {
+      if (when_usec < self->end_usec)
+        {
+          *out_has_contains = TRUE;
+          *out_contains_start = self->start_usec;
+          *out_contains_end = self->end_usec;
+        }
+    }
+  else if (self->step != 0)
+    {
+      get_nearest_recurrences_fixed (self, when_usec,
+                                     out_has_contains, out_contains_start, out_contains_end,
+                                     out_has_next, out_next_start, out_next_end);
+    }
+  else
+    {
+      /* Slow path. */
+      g_autoptr(GDateTime) when = date_time_new_from_usec (self->start, self->start_usec,
+                                                           when_usec);
+      g_autoptr(GDateTime) contains_start = NULL, contains_end = NULL;
+      g_autoptr(GDateTime) next_start = NULL, next_end = NULL;
+
+      if (when == NULL)
+        return;
+
+      get_nearest_recurrences (self, when, &contains_start, &contains_end,
+                               &next_start, &next_end);
+
+      if (contains_start != NULL)
+        {
+          *out_has_contains = TRUE;
+          *out_contains_start = date_time_to_usec (contains_start);
+          *out_contains_end = date_time_to_usec (contains_end);
+        }
+      if (next_start != NULL)
+        {
+          *out_has_next = TRUE;
+          *out_next_start = date_time_to_usec (next_start);
+          *out_next_end = date_time_to_usec (next_end);
+        }
+    }
+}
+
+/**
+ * mwt_period_get_start_usec:
+ * @self: a #MwtPeriod
+ *
+ * Get the value of #MwtPeriod:start, in microseconds since the Unix epoch.
+ *
+ * Returns: start date/time, in microseconds since the Unix epoch
+ * Since: 0.3.0
+ */
+gint64
+mwt_period_get_start_usec (MwtPeriod *self)
+{
+  g_return_val_if_fail (MWT_IS_PERIOD (self), 0);
+
+  return self->start_usec;
+}
+
+/**
+ * mwt_period_get_end_usec:
+ * @self: a #MwtPeriod
+ *
+ * Get the value of #MwtPeriod:end, in microseconds since the Unix epoch.
+ *
+ * Returns: end date/time, in microseconds since the Unix epoch
+ * Since: 0.3.0
+ */
+gint64
+mwt_period_get_end_usec (MwtPeriod *self)
+{
+  g_return_val_if_fail (MWT_IS_PERIOD (self), 0);
+
+  return self->end_usec;
+}
+
+/**
+ * mwt_period_contains_time_usec:
+ * @self: a #MwtPeriod
+ * @when_usec: the time to check, in microseconds since the Unix epoch
+ * @out_start_usec: (optional) (out): return location for the start time of the
+ *    recurrence which contains @when_usec
+ * @out_end_usec: (optional) (out): return location for the end time of the
+ *    recurrence which contains @when_usec
+ *
+ * Version of mwt_period_contains_time() which takes and returns times as
+ * microseconds since the Unix epoch. Unless the period repeats monthly or
+ * yearly, this does not allocate memory.
+ *
+ * If @when_usec does not fall within a recurrence of the #MwtPeriod,
+ * @out_start_usec and @out_end_usec will not be set.
+ *
+ * Returns: %TRUE if @when_usec lies in the period, %FALSE otherwise
+ * Since: 0.3.0
+ */
+gboolean
+mwt_period_contains_time_usec (MwtPeriod *self,
+                               gint64     when_usec,
+                               gint64    *out_start_usec,
+                               gint64    *out_end_usec)
+{
+  g_return_val_if_fail (MWT_IS_PERIOD (self), FALSE);
+
+  gboolean has_contains, has_next;
+  gint64 contains_start = 0, contains_end = 0, next_start = 0, next_end = 0;
+
+  get_nearest_recurrences_usec (self, when_usec,
+                                &has_contains, &contains_start, &contains_end,
+                                &has_next, &next_start, &next_end);
+
+  if (has_contains && out_start_usec != NULL)
+    *out_start_usec = contains_start;
+  if (has_contains && out_end_usec != NULL)
+    *out_end_usec = contains_end;
+
+  return has_contains;
+}
+
+/**
+ * mwt_period_get_next_recurrence_usec:
+ * @self: a #MwtPeriod
+ * @after_usec: time to get the next recurrence after, in microseconds since the
+ *    Unix epoch
+ * @out_next_start_usec: (optional) (out): return location for the start time of
+ *    the next recurrence after @after_usec
+ * @out_next_end_usec: (optional) (out): return location for the end time of the
+ *    next recurrence after @after_usec
+ *
+ * Version of mwt_period_get_next_recurrence() which takes and returns times as
+ * microseconds since the Unix epoch. Unless the period repeats monthly or
+ * yearly, this does not allocate memory.
+ *
+ * If there is no next recurrence, @out_next_start_usec and @out_next_end_usec
+ * will not be set.
+ *
+ * Returns: %TRUE if a next recurrence was found, %FALSE otherwise
+ * Since: 0.3.0
+ */
+gboolean
+mwt_period_get_next_recurrence_usec (MwtPeriod *self,
+                                     gint64     after_usec,
+                                     gint64    *out_next_start_usec,
+                                     gint64    *out_next_end_usec)
+{
+  g_return_val_if_fail (MWT_IS_PERIOD (self), FALSE);
+
+  gboolean has_contains, has_next;
+  gint64 contains_start = 0, contains_end = 0, next_start = 0, next_end = 0;
+
+  get_nearest_recurrences_usec (self, after_usec,
+                                &has_contains, &contains_start, &contains_end,
+                                &has_next, &next_start, &next_end);
+
+  if (has_next && out_next_start_usec != NULL)
+    *out_next_start_usec = next_start;
+  if (has_next && out_next_end_usec != NULL)
+    *out_next_end_usec = next_end;
+
+  return has_next;
+}
@@ -100,4 +100,16 @@ guint               mwt_period_get_repeat_period  (MwtPeriod *self);
 
 guint64             mwt_period_get_capacity_limit (MwtPeriod *self);
 
+gint64   mwt_period_get_start_usec           (MwtPeriod *self);
+gint64   mwt_period_get_end_usec             (MwtPeriod *self);
+
+gboolean mwt_period_contains_time_usec       (MwtPeriod *self,
+                                              gint64     when_usec,
+                                              gint64    *out_start_usec,
+                                              gint64    *out_end_usec);
+gboolean mwt_period_get_next_recurrence_usec (MwtPeriod *self,
+                                              gint64     after_usec,
+                                              gint64    *out_next_start_usec,
+                                              gint64    *out_next_end_usec);
+
 G_END_DECLS
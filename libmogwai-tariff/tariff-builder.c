@@ -28,7 +28,10 @@
 #include <gio/gio.h>
 #include <libmogwai-tariff/period.h>
 #include <libmogwai-tariff/tariff-builder.h>
+#include <libmogwai-tariff/tariff-format-private.h>
+#include <libmogwai-tariff/tariff-private.h>
 #include <libmogwai-tariff/tariff.h>
+#include <libmogwai-tariff/time-zone-cache-private.h>
 
 
 static void mwt_tariff_builder_dispose (GObject *object);
@@ -49,6 +52,17 @@ static void mwt_tariff_builder_dispose (GObject *object);
  * A #MwtTariffBuilder may be used multiple times, or an in-progress tariff may
  * be destroyed by using mwt_tariff_builder_reset().
  *
+ * For tariffs with a large number of periods, they can be added using
+ * mwt_tariff_builder_add_period_fields() instead of
+ * mwt_tariff_builder_add_period(), which avoids creating a #MwtPeriod for
+ * each of them. The periods are sorted and validated once, when the tariff is
+ * built.
+ *
+ * By default, tariffs are serialised in version 2 of the file format, which
+ * all versions of #MwtTariffLoader since 0.1.0 can load. Version 3 is more
+ * compact and faster to load, and can be selected using
+ * mwt_tariff_builder_set_format_version().
+ *
  * Since: 0.1.0
  */
 struct _MwtTariffBuilder
@@ -56,12 +70,55 @@ struct _MwtTariffBuilder
   GObject parent;
 
   gchar *name;  /* (owned) */
-  GPtrArray *periods;  /* (element-type MwtPeriod) (owned) */
+  GArray *periods;  /* (element-type PeriodFields) (owned) */
+  gboolean periods_sorted;
+
+  /* Table of the time zone identifiers used by @periods, in order of first
+   * use, with no duplicates. @time_zone_indices maps each identifier to its
+   * index in @time_zones + 1. */
+  GPtrArray *time_zones;  /* (element-type utf8) (owned) */
+  GHashTable *time_zone_indices;  /* (element-type utf8 guint) (owned) */
+
+  guint16 format_version;
 
   MwtTariff *final_tariff;  /* (nullable) (owned) */
   GVariant *final_variant;  /* (nullable) (owned) */
 };
 
+/* A period which has been added to the builder, in the form it’s serialised
+ * in. Periods added with mwt_tariff_builder_add_period() keep a reference to
+ * their #MwtPeriod; periods added with mwt_tariff_builder_add_period_fields()
+ * only have one created if mwt_tariff_builder_get_tariff() is called.
+ *
+ * @start_usec and @end_usec are used for sorting, and are %G_MAXINT64 if
+ * @start_unix or @end_unix are out of range. */
+typedef struct
+{
+  guint64 start_unix;
+  guint64 end_unix;
+  gint64 start_usec;
+  gint64 end_usec;
+  guint16 start_timezone_index;
+  guint16 end_timezone_index;
+  MwtPeriodRepeatType repeat_type;
+  guint repeat_period;
+  guint64 capacity_limit;
+  MwtPeriod *period;  /* (nullable) (owned) */
+} PeriodFields;
+
+static void
+period_fields_clear (PeriodFields *fields)
+{
+  g_clear_object (&fields->period);
+}
+
+/* Default version of the file format to write. */
+#define DEFAULT_FORMAT_VERSION 2
+
+/* The last UNIX timestamp which can be represented by a #GDateTime,
+ * 9999-12-31T23:59:59Z. */
+#define MAX_UNIX G_GINT64_CONSTANT (253402300799)
+
 G_DEFINE_TYPE (MwtTariffBuilder, mwt_tariff_builder, G_TYPE_OBJECT)
 
 static void
@@ -75,7 +132,11 @@ mwt_tariff_builder_class_init (MwtTariffBuilderClass *klass)
 static void
 mwt_tariff_builder_init (MwtTariffBuilder *self)
 {
-  self->periods = g_ptr_array_new_with_free_func (g_object_unref);
+  self->periods = g_array_new (FALSE, FALSE, sizeof (PeriodFields));
+  g_array_set_clear_func (self->periods, (GDestroyNotify) period_fields_clear);
+  self->time_zones = g_ptr_array_new_with_free_func (g_free);
+  self->time_zone_indices = g_hash_table_new (g_str_hash, g_str_equal);
+  self->format_version = DEFAULT_FORMAT_VERSION;
 }
 
 static void
@@ -84,7 +145,9 @@ mwt_tariff_builder_dispose (GObject *object)
   MwtTariffBuilder *self = MWT_TARIFF_BUILDER (object);
 
   g_clear_pointer (&self->name, g_free);
-  g_clear_pointer (&self->periods, g_ptr_array_unref);
+  g_clear_pointer (&self->periods, g_array_unref);
+  g_clear_pointer (&self->time_zone_indices, g_hash_table_unref);
+  g_clear_pointer (&self->time_zones, g_ptr_array_unref);
   g_clear_object (&self->final_tariff);
   g_clear_pointer (&self->final_variant, g_variant_unref);
 
@@ -121,11 +184,45 @@ mwt_tariff_builder_reset (MwtTariffBuilder *self)
   g_return_if_fail (MWT_IS_TARIFF_BUILDER (self));
 
   g_clear_pointer (&self->name, g_free);
-  g_ptr_array_set_size (self->periods, 0);
+  g_array_set_size (self->periods, 0);
+  self->periods_sorted = FALSE;
+  g_hash_table_remove_all (self->time_zone_indices);
+  g_ptr_array_set_size (self->time_zones, 0);
+  self->format_version = DEFAULT_FORMAT_VERSION;
   g_clear_object (&self->final_tariff);
   g_clear_pointer (&self->final_variant, g_variant_unref);
 }
 
+/**
+ * mwt_tariff_builder_set_format_version:
+ * @self: a #MwtTariffBuilder
+ * @format_version: version of the file format to use; 2 or 3
+ *
+ * Set the version of the file format which the tariff will be serialised in
+ * by mwt_tariff_builder_get_tariff_as_variant() and
+ * mwt_tariff_builder_get_tariff_as_bytes(). The default is version 2.
+ *
+ * Version 3 stores each time zone identifier once, and the periods as an
+ * array of fixed-width records, followed by a sorted index of the start and
+ * end times of the non-recurring periods. It can only be loaded by
+ * #MwtTariffLoader since version 0.3.0.
+ *
+ * Since: 0.3.0
+ */
+void
+mwt_tariff_builder_set_format_version (MwtTariffBuilder *self,
+                                       guint16           format_version)
+{
+  g_return_if_fail (MWT_IS_TARIFF_BUILDER (self));
+  g_return_if_fail (format_version == 2 || format_version == 3);
+
+  if (self->format_version == format_version)
+    return;
+
+  self->format_version = format_version;
+  g_clear_pointer (&self->final_variant, g_variant_unref);
+}
+
 /**
  * mwt_tariff_builder_set_name:
  * @self: a #MwtTariffBuilder
@@ -147,6 +244,51 @@ mwt_tariff_builder_set_name (MwtTariffBuilder *self,
   self->name = g_strdup (name);
 }
 
+/* Look up @identifier in the builder’s time zone table, adding it if it’s not
+ * already there, and return its index. */
+static guint16
+time_zone_table_add (MwtTariffBuilder *self,
+                     const gchar      *identifier)
+{
+  guint index_plus_one = GPOINTER_TO_UINT (g_hash_table_lookup (self->time_zone_indices,
+                                                                identifier));
+
+  if (index_plus_one != 0)
+    return index_plus_one - 1;
+
+  /* The table is indexed by a guint16. In practice there are only a few
+   * hundred time zones in the world. */
+  g_assert (self->time_zones->len < G_MAXUINT16);
+
+  gchar *identifier_copy = g_strdup (identifier);
+  g_ptr_array_add (self->time_zones, identifier_copy);
+  g_hash_table_insert (self->time_zone_indices, identifier_copy,
+                       GUINT_TO_POINTER (self->time_zones->len));
+
+  return self->time_zones->len - 1;
+}
+
+/* Convert @unix_timestamp to microseconds, or return %G_MAXINT64 if it’s out of
+ * range. */
+static gint64
+unix_to_usec (guint64 unix_timestamp)
+{
+  if (unix_timestamp > MAX_UNIX)
+    return G_MAXINT64;
+
+  return (gint64) unix_timestamp * G_USEC_PER_SEC;
+}
+
+static void
+add_period_fields (MwtTariffBuilder *self,
+                   PeriodFields     *fields)
+{
+  g_array_append_val (self->periods, *fields);
+  self->periods_sorted = FALSE;
+  g_clear_object (&self->final_tariff);
+  g_clear_pointer (&self->final_variant, g_variant_unref);
+}
+
 /**
  * mwt_tariff_builder_add_period:
  * @self: a #MwtTariffBuilder
@@ -168,7 +310,87 @@ mwt_tariff_builder_add_period (MwtTariffBuilder *self,
   g_return_if_fail (MWT_IS_TARIFF_BUILDER (self));
   g_return_if_fail (MWT_IS_PERIOD (period));
 
-  g_ptr_array_add (self->periods, g_object_ref (period));
+  GDateTime *start = mwt_period_get_start (period);
+  GDateTime *end = mwt_period_get_end (period);
+  PeriodFields fields =
+    {
+      .start_unix = g_date_time_to_unix (start),
+      .end_unix = g_date_time_to_unix (end),
+      .start_usec = mwt_period_get_start_usec (period),
+      .end_usec = mwt_period_get_end_usec (period),
+      .start_timezone_index =
+          time_zone_table_add (self, g_time_zone_get_identifier (g_date_time_get_timezone (start))),
+      .end_timezone_index =
+          time_zone_table_add (self, g_time_zone_get_identifier (g_date_time_get_timezone (end))),
+      .repeat_type = mwt_period_get_repeat_type (period),
+      .repeat_period = mwt_period_get_repeat_period (period),
+      .capacity_limit = mwt_period_get_capacity_limit (period),
+      .period = g_object_ref (period),
+    };
+
+  add_period_fields (self, &fields);
+}
+
+/**
+ * mwt_tariff_builder_add_period_fields:
+ * @self: a #MwtTariffBuilder
+ * @start_unix: start of the period, as a UNIX timestamp
+ * @start_timezone: identifier of the time zone for @start_unix, as accepted by
+ *    g_time_zone_new()
+ * @end_unix: end of the period, as a UNIX timestamp
+ * @end_timezone: identifier of the time zone for @end_unix, as accepted by
+ *    g_time_zone_new()
+ * @repeat_type: repeat type (see #MwtPeriod:repeat-type)
+ * @repeat_period: repeat period (see #MwtPeriod:repeat-period)
+ * @capacity_limit: capacity limit (see #MwtPeriod:capacity-limit)
+ *
+ * Add a period to the tariff under construction, given its fields. This is
+ * equivalent to creating a #MwtPeriod from them and calling
+ * mwt_tariff_builder_add_period(), but is a lot cheaper for tariffs with a
+ * large number of periods, as no #MwtPeriod is created unless
+ * mwt_tariff_builder_get_tariff() is called.
+ *
+ * The fields are not validated until the tariff is built. If they are invalid,
+ * mwt_tariff_builder_get_tariff() (and the other getters) will return %NULL.
+ *
+ * If none of the periods in the tariff recur, they are validated without
+ * creating any #MwtPeriods or #MwtTariff when calling
+ * mwt_tariff_builder_get_tariff_as_variant() or
+ * mwt_tariff_builder_get_tariff_as_bytes(), and are serialised directly.
+ * Otherwise, checking overlaps between recurrences requires a #MwtTariff to be
+ * built.
+ *
+ * Since: 0.3.0
+ */
+void
+mwt_tariff_builder_add_period_fields (MwtTariffBuilder    *self,
+                                      guint64              start_unix,
+                                      const gchar         *start_timezone,
+                                      guint64              end_unix,
+                                      const gchar         *end_timezone,
+                                      MwtPeriodRepeatType  repeat_type,
+                                      guint                repeat_period,
+                                      guint64              capacity_limit)
+{
+  g_return_if_fail (MWT_IS_TARIFF_BUILDER (self));
+  g_return_if_fail (start_timezone != NULL);
+  g_return_if_fail (end_timezone != NULL);
+
+  PeriodFields fields =
+    {
+      .start_unix = start_unix,
+      .end_unix = end_unix,
+      .start_usec = unix_to_usec (start_unix),
+      .end_usec = unix_to_usec (end_unix),
+      .start_timezone_index = time_zone_table_add (self, start_timezone),
+      .end_timezone_index = time_zone_table_add (self, end_timezone),
+      .repeat_type = repeat_type,
+      .repeat_period = repeat_period,
+      .capacity_limit = capacity_limit,
+      .period = NULL,
+    };
+
+  add_period_fields (self, &fields);
 }
 
 /* Order by decreasing span, then by increasing start date/time. */
@@ -176,21 +398,79 @@ static gint
 periods_sort_cb (gconstpointer a,
                  gconstpointer b)
 {
-  MwtPeriod *p1 = *((MwtPeriod **) a);
-  MwtPeriod *p2 = *((MwtPeriod **) b);
+  const PeriodFields *p1 = a;
+  const PeriodFields *p2 = b;
+
+  /* Invalid periods may have spans which overflow; they will fail validation
+   * whatever order they’re in. */
+  gint64 p1_span = p1->end_usec - p1->start_usec;
+  gint64 p2_span = p2->end_usec - p2->start_usec;
+
+  if (p1_span != p2_span)
+    return (p1_span > p2_span) ? -1 : 1;
+  if (p1->start_usec != p2->start_usec)
+    return (p1->start_usec < p2->start_usec) ? -1 : 1;
+  return 0;
+}
+
+/* Ensure the periods are in the order required by mwt_tariff_validate(). */
+static void
+sort_periods (MwtTariffBuilder *self)
+{
+  if (self->periods_sorted)
+    return;
+
+  g_array_sort (self->periods, periods_sort_cb);
+  self->periods_sorted = TRUE;
+}
 
-  GDateTime *p1_start = mwt_period_get_start (p1);
-  GDateTime *p1_end = mwt_period_get_end (p2);
-  GDateTime *p2_start = mwt_period_get_start (p1);
-  GDateTime *p2_end = mwt_period_get_end (p2);
+/* Construct a #GDateTime from the given @unix_timestamp (always in UTC) in the
+ * time zone with the given @identifier. This will return %NULL if the time
+ * zone can’t be loaded or an invalid time results. */
+static GDateTime *
+date_time_new_from_unix (guint64      unix_timestamp,
+                         const gchar *identifier)
+{
+  if (unix_timestamp > MAX_UNIX)
+    return NULL;
 
-  GTimeSpan p1_span = g_date_time_difference (p1_end, p1_start);
-  GTimeSpan p2_span = g_date_time_difference (p2_end, p2_start);
+  g_autoptr(GTimeZone) tz = mwt_time_zone_cache_lookup (identifier);
+  if (tz == NULL)
+    return NULL;
 
-  if (p1_span == p2_span)
-    return g_date_time_compare (p1_start, p2_start);
+  g_autoptr(GDateTime) utc = g_date_time_new_from_unix_utc (unix_timestamp);
+  if (utc == NULL)
+    return NULL;
 
-  return (p1_span > p2_span) ? -1 : 1;
+  return g_date_time_to_timezone (utc, tz);
+}
+
+/* Create the #MwtPeriod for @fields if it doesn’t exist yet. Returns %FALSE if
+ * the fields are invalid. */
+static gboolean
+ensure_period (MwtTariffBuilder  *self,
+               PeriodFields      *fields,
+               GError           **error)
+{
+  if (fields->period != NULL)
+    return TRUE;
+
+  g_autoptr(GDateTime) start =
+      date_time_new_from_unix (fields->start_unix,
+                               g_ptr_array_index (self->time_zones, fields->start_timezone_index));
+  g_autoptr(GDateTime) end =
+      date_time_new_from_unix (fields->end_unix,
+                               g_ptr_array_index (self->time_zones, fields->end_timezone_index));
+
+  /* Note: @start and @end might be %NULL. mwt_period_validate() handles that. */
+  if (!mwt_period_validate (start, end, fields->repeat_type, fields->repeat_period, error))
+    return FALSE;
+
+  fields->period = mwt_period_new (start, end, fields->repeat_type, fields->repeat_period,
+                                   "capacity-limit", fields->capacity_limit,
+                                   NULL);
+
+  return TRUE;
 }
 
 /**
@@ -219,63 +499,241 @@ mwt_tariff_builder_get_tariff (MwtTariffBuilder *self)
   if (self->final_tariff == NULL)
     {
       /* Ensure the periods are in order. */
-      g_ptr_array_sort (self->periods, periods_sort_cb);
+      sort_periods (self);
+
+      g_autoptr(GPtrArray) periods = g_ptr_array_new_full (self->periods->len, g_object_unref);
+
+      for (gsize i = 0; i < self->periods->len; i++)
+        {
+          PeriodFields *fields = &g_array_index (self->periods, PeriodFields, i);
 
-      if (!mwt_tariff_validate (self->name, self->periods, &local_error))
+          if (!ensure_period (self, fields, &local_error))
+            {
+              g_debug ("Invalid period %" G_GSIZE_FORMAT ": %s", i, local_error->message);
+              return NULL;
+            }
+
+          g_ptr_array_add (periods, g_object_ref (fields->period));
+        }
+
+      if (!mwt_tariff_validate (self->name, periods, &local_error))
         {
           g_debug ("Invalid tariff: %s", local_error->message);
           return NULL;
         }
-      self->final_tariff = mwt_tariff_new (self->name, self->periods);
+      self->final_tariff = mwt_tariff_new (self->name, periods);
     }
 
   return g_object_ref (self->final_tariff);
 }
 
-/* Returns a new floating variant. */
+/* Validate the tariff under construction, without creating a #MwtTariff if
+ * possible. This is equivalent to checking whether
+ * mwt_tariff_builder_get_tariff() returns %NULL, but if none of the periods
+ * recur, the fields are checked directly: overlaps between recurrences can
+ * only be checked on #MwtPeriods.
+ *
+ * Like mwt_tariff_builder_get_tariff(), failures are not reported as errors,
+ * just as debug messages. */
+static gboolean
+validate (MwtTariffBuilder *self)
+{
+  if (self->final_tariff != NULL)
+    return TRUE;
+
+  sort_periods (self);
+
+  if (!mwt_tariff_validate_name (self->name) || self->periods->len == 0)
+    {
+      g_debug ("Invalid tariff: no name or periods");
+      return FALSE;
+    }
+
+  for (gsize i = 0; i < self->periods->len; i++)
+    {
+      const PeriodFields *fields = &g_array_index (self->periods, PeriodFields, i);
+
+      if (fields->repeat_type != MWT_PERIOD_REPEAT_NONE)
+        {
+          g_autoptr(MwtTariff) tariff = mwt_tariff_builder_get_tariff (self);
+          return (tariff != NULL);
+        }
+    }
+
+  for (gsize i = 0; i < self->time_zones->len; i++)
+    {
+      g_autoptr(GTimeZone) tz = mwt_time_zone_cache_lookup (g_ptr_array_index (self->time_zones, i));
+
+      if (tz == NULL)
+        {
+          g_debug ("Invalid time zone ‘%s’",
+                   (const gchar *) g_ptr_array_index (self->time_zones, i));
+          return FALSE;
+        }
+    }
+
+  g_autofree gint64 *starts = g_new (gint64, self->periods->len);
+  g_autofree gint64 *ends = g_new (gint64, self->periods->len);
+
+  for (gsize i = 0; i < self->periods->len; i++)
+    {
+      const PeriodFields *fields = &g_array_index (self->periods, PeriodFields, i);
+
+      /* Equivalent to mwt_period_validate(), given the repeat type is none. */
+      if (fields->start_unix > MAX_UNIX ||
+          fields->end_unix > MAX_UNIX ||
+          fields->start_unix >= fields->end_unix ||
+          fields->repeat_period != 0)
+        {
+          g_debug ("Invalid period %" G_GSIZE_FORMAT, i);
+          return FALSE;
+        }
+
+      starts[i] = fields->start_usec;
+      ends[i] = fields->end_usec;
+    }
+
+  if (!mwt_tariff_spans_are_nonoverlapping (starts, ends, self->periods->len))
+    {
+      g_debug ("Invalid tariff: periods overlap");
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Build the inner variant for version 2 of the file format. Returns a new
+ * floating variant. */
 static GVariant *
-mwt_tariff_builder_build_tariff_variant (const gchar *name,
-                                         MwtTariff   *tariff)
+build_tariff_variant_v2 (MwtTariffBuilder *self)
 {
-  const guint16 format_version = 2;
-  const gchar *format_magic = "Mogwai tariff";
   g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("(sa(ttssqut))"));
 
-  g_variant_builder_add (&builder, "s", name);
+  g_variant_builder_add (&builder, "s", self->name);
 
-  /* Periods. mwt_tariff_get_periods() guarantees it’s in order. */
-  GPtrArray *periods = mwt_tariff_get_periods (tariff);
+  /* Periods. validate() guarantees they’re in order. */
   g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(ttssqut)"));
 
-  for (gsize i = 0; i < periods->len; i++)
+  for (gsize i = 0; i < self->periods->len; i++)
     {
-      MwtPeriod *period = g_ptr_array_index (periods, i);
-      GDateTime *start = mwt_period_get_start (period);
-      GTimeZone *start_tz = g_date_time_get_timezone (start);
-      GDateTime *end = mwt_period_get_end (period);
-      GTimeZone *end_tz = g_date_time_get_timezone (end);
-      guint64 start_unix = g_date_time_to_unix (start);
-      guint64 end_unix = g_date_time_to_unix (end);
+      const PeriodFields *fields = &g_array_index (self->periods, PeriodFields, i);
 
       g_variant_builder_open (&builder, G_VARIANT_TYPE ("(ttssqut)"));
-      g_variant_builder_add (&builder, "t", start_unix);
-      g_variant_builder_add (&builder, "t", end_unix);
-      g_variant_builder_add (&builder, "s", g_time_zone_get_identifier (start_tz));
-      g_variant_builder_add (&builder, "s", g_time_zone_get_identifier (end_tz));
-      g_variant_builder_add (&builder, "q", (guint16) mwt_period_get_repeat_type (period));
-      g_variant_builder_add (&builder, "u", (guint32) mwt_period_get_repeat_period (period));
-      g_variant_builder_add (&builder, "t", mwt_period_get_capacity_limit (period));
+      g_variant_builder_add (&builder, "t", fields->start_unix);
+      g_variant_builder_add (&builder, "t", fields->end_unix);
+      g_variant_builder_add (&builder, "s", g_ptr_array_index (self->time_zones, fields->start_timezone_index));
+      g_variant_builder_add (&builder, "s", g_ptr_array_index (self->time_zones, fields->end_timezone_index));
+      g_variant_builder_add (&builder, "q", (guint16) fields->repeat_type);
+      g_variant_builder_add (&builder, "u", (guint32) fields->repeat_period);
+      g_variant_builder_add (&builder, "t", fields->capacity_limit);
       g_variant_builder_close (&builder);
     }
 
   g_variant_builder_close (&builder);
 
+  return g_variant_builder_end (&builder);
+}
+
+static gint
+uint64_compare (gconstpointer a,
+                gconstpointer b)
+{
+  guint64 a_value = *((const guint64 *) a);
+  guint64 b_value = *((const guint64 *) b);
+
+  if (a_value == b_value)
+    return 0;
+  return (a_value < b_value) ? -1 : 1;
+}
+
+/* Build the inner variant for version 3 of the file format. See
+ * #MwtTariffPeriodRecordV3. Returns a new floating variant. */
+static GVariant *
+build_tariff_variant_v3 (MwtTariffBuilder *self)
+{
+  /* Periods. validate() guarantees they’re in order. The records must be
+   * zero-initialised so that the padding in them is zeroed, as required for
+   * the variant to be in normal form. */
+  g_autofree MwtTariffPeriodRecordV3 *records = g_new0 (MwtTariffPeriodRecordV3, self->periods->len);
+  g_autoptr(GArray) transitions = g_array_sized_new (FALSE, FALSE, sizeof (guint64),
+                                                     self->periods->len * 2);
+
+  for (gsize i = 0; i < self->periods->len; i++)
+    {
+      const PeriodFields *fields = &g_array_index (self->periods, PeriodFields, i);
+      MwtTariffPeriodRecordV3 *record = &records[i];
+
+      record->start_unix = fields->start_unix;
+      record->end_unix = fields->end_unix;
+      record->start_timezone_index = fields->start_timezone_index;
+      record->end_timezone_index = fields->end_timezone_index;
+      record->repeat_type = (guint16) fields->repeat_type;
+      record->repeat_period = (guint32) fields->repeat_period;
+      record->capacity_limit = fields->capacity_limit;
+
+      if (fields->repeat_type == MWT_PERIOD_REPEAT_NONE)
+        {
+          g_array_append_val (transitions, record->start_unix);
+          g_array_append_val (transitions, record->end_unix);
+        }
+    }
+
+  /* Sort and deduplicate the transition index. */
+  g_array_sort (transitions, uint64_compare);
+
+  gsize n_transitions = 0;
+  for (gsize i = 0; i < transitions->len; i++)
+    {
+      guint64 transition = g_array_index (transitions, guint64, i);
+
+      if (n_transitions == 0 ||
+          g_array_index (transitions, guint64, n_transitions - 1) != transition)
+        g_array_index (transitions, guint64, n_transitions++) = transition;
+    }
+
+  g_array_set_size (transitions, n_transitions);
+
+  GVariant *children[] =
+    {
+      g_variant_new_string (self->name),
+      g_variant_new_strv ((const gchar * const *) self->time_zones->pdata,
+                          self->time_zones->len),
+      g_variant_new_fixed_array (G_VARIANT_TYPE ("(ttqqqut)"),
+                                 records, self->periods->len,
+                                 sizeof (MwtTariffPeriodRecordV3)),
+      g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64,
+                                 transitions->data, transitions->len,
+                                 sizeof (guint64)),
+    };
+
+  return g_variant_new_tuple (children, G_N_ELEMENTS (children));
+}
+
+/* Returns a new floating variant. */
+static GVariant *
+mwt_tariff_builder_build_tariff_variant (MwtTariffBuilder *self)
+{
+  const gchar *format_magic = "Mogwai tariff";
+  GVariant *inner_variant;
+
+  switch (self->format_version)
+    {
+    case 2:
+      inner_variant = build_tariff_variant_v2 (self);
+      break;
+    case 3:
+      inner_variant = build_tariff_variant_v3 (self);
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+
   /* Add the file format version, which also acts as a byte order mark (so
    * explicitly don’t convert it to a known endianness). The magic bytes allow
    * content type detection. */
   return g_variant_new ("(sqv)",
-                        format_magic, format_version,
-                        g_variant_builder_end (&builder));
+                        format_magic, self->format_version,
+                        inner_variant);
 }
 
 /**
@@ -301,11 +759,10 @@ mwt_tariff_builder_get_tariff_as_variant (MwtTariffBuilder *self)
 
   if (self->final_variant == NULL)
     {
-      g_autoptr(MwtTariff) tariff = mwt_tariff_builder_get_tariff (self);
-      if (tariff == NULL)
+      if (!validate (self))
         return NULL;
 
-      g_autoptr(GVariant) variant = mwt_tariff_builder_build_tariff_variant (self->name, tariff);
+      g_autoptr(GVariant) variant = mwt_tariff_builder_build_tariff_variant (self);
       self->final_variant = g_variant_ref_sink (g_steal_pointer (&variant));
     }
 
@@ -40,6 +40,16 @@ void              mwt_tariff_builder_set_name              (MwtTariffBuilder *se
                                                             const gchar      *name);
 void              mwt_tariff_builder_add_period            (MwtTariffBuilder *self,
                                                             MwtPeriod        *period);
+void              mwt_tariff_builder_add_period_fields     (MwtTariffBuilder    *self,
+                                                            guint64              start_unix,
+                                                            const gchar         *start_timezone,
+                                                            guint64              end_unix,
+                                                            const gchar         *end_timezone,
+                                                            MwtPeriodRepeatType  repeat_type,
+                                                            guint                repeat_period,
+                                                            guint64              capacity_limit);
+void              mwt_tariff_builder_set_format_version    (MwtTariffBuilder *self,
+                                                            guint16           format_version);
 
 MwtTariff        *mwt_tariff_builder_get_tariff            (MwtTariffBuilder *self);
 GVariant         *mwt_tariff_builder_get_tariff_as_variant (MwtTariffBuilder *self);
@@ -0,0 +1,75 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <stddef.h>
+
+G_BEGIN_DECLS
+
+/**
+ * MwtTariffPeriodRecordV3:
+ * @start_unix: start of the period, as a UNIX timestamp in UTC
+ * @end_unix: end of the period, as a UNIX timestamp in UTC
+ * @start_timezone_index: index of the time zone identifier for @start_unix in
+ *    the tariff’s time zone table
+ * @end_timezone_index: index of the time zone identifier for @end_unix in the
+ *    tariff’s time zone table
+ * @repeat_type: a #MwtPeriodRepeatType
+ * @repeat_period: the repeat period, in units of @repeat_type
+ * @capacity_limit: the capacity limit for the period, in bytes
+ *
+ * In-memory layout of a single `(ttqqqut)` period record in version 3 of the
+ * tariff file format. The full version 3 format is:
+ * |[
+ * (sqv) → ("Mogwai tariff", 3, (sasa(ttqqqut)at))
+ * ]|
+ * where the inner variant contains the tariff name, the table of time zone
+ * identifiers (with no duplicates), the period records (in the order given by
+ * mwt_tariff_get_periods()) and a strictly increasing index of the start and
+ * end times of all the non-recurring periods.
+ *
+ * As all the members of a record are fixed-width, the array of records can be
+ * accessed directly with g_variant_get_fixed_array(). The layout of this
+ * struct must match the #GVariant serialisation of `(ttqqqut)`, including the
+ * 2 bytes of padding after @repeat_type, which must be zero.
+ *
+ * Since: 0.3.0
+ */
+typedef struct
+{
+  guint64 start_unix;
+  guint64 end_unix;
+  guint16 start_timezone_index;
+  guint16 end_timezone_index;
+  guint16 repeat_type;
+  /* 2 bytes of padding */
+  guint32 repeat_period;
+  guint64 capacity_limit;
+} MwtTariffPeriodRecordV3;
+
+G_STATIC_ASSERT (sizeof (MwtTariffPeriodRecordV3) == 40);
+G_STATIC_ASSERT (offsetof (MwtTariffPeriodRecordV3, repeat_period) == 24);
+G_STATIC_ASSERT (offsetof (MwtTariffPeriodRecordV3, capacity_limit) == 32);
+
+G_END_DECLS
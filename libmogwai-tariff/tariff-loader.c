@@ -27,8 +27,10 @@
 #include <glib-object.h>
 #include <gio/gio.h>
 #include <libmogwai-tariff/period.h>
+#include <libmogwai-tariff/tariff-format-private.h>
 #include <libmogwai-tariff/tariff-loader.h>
 #include <libmogwai-tariff/tariff.h>
+#include <libmogwai-tariff/time-zone-cache-private.h>
 #include <malloc.h>
 #include <stdlib.h>
 
@@ -41,9 +43,11 @@ static void mwt_tariff_loader_dispose (GObject *object);
  * A helper object for loading an #MwtTariff from its serialised form as a
  * #GBytes. See #MwtTariffBuilder for the inverse operation.
  *
- * When using a #MwtTariffLoader, the tariff must be loaded from a #GBytes or
- * a #GVariant using mwt_tariff_loader_load_from_bytes() or
- * mwt_tariff_loader_load_from_variant(). If that succeeds, the #MwtTariff
+ * When using a #MwtTariffLoader, the tariff must be loaded from a file, a
+ * #GMappedFile, a #GBytes or a #GVariant using
+ * mwt_tariff_loader_load_from_file(), mwt_tariff_loader_load_from_mapped_file(),
+ * mwt_tariff_loader_load_from_bytes() or mwt_tariff_loader_load_from_variant().
+ * If that succeeds, the #MwtTariff
  * object may be retrieved using mwt_tariff_loader_get_tariff(). This will be
  * %NULL if loading failed. Details of the failure will come from the #GError
  * set by the loading function.
@@ -175,46 +179,295 @@ mwt_tariff_loader_load_from_bytes (MwtTariffLoader  *self,
   return mwt_tariff_loader_load_from_variant (self, variant, error);
 }
 
-/* Construct a #GDateTime from the given @unix_timestamp (always in UTC) and
- * @timezone_identifier (for example, ‘Europe/London’; note that this is *not*
- * a timezone abbreviation like ‘AST’). This will return %NULL if an invalid
- * time results. */
+/**
+ * mwt_tariff_loader_load_from_mapped_file:
+ * @self: a #MwtTariffLoader
+ * @mapped_file: the mapped file to load
+ * @error: return location for a #GError, or %NULL
+ *
+ * Version of mwt_tariff_loader_load_from_bytes() which loads from a
+ * #GMappedFile. Memory mappings are page aligned, so the data is loaded directly
+ * from the mapping without being copied. The mapping is only needed while
+ * loading: the loaded tariff does not keep a reference to @mapped_file.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 0.3.0
+ */
+gboolean
+mwt_tariff_loader_load_from_mapped_file (MwtTariffLoader  *self,
+                                         GMappedFile      *mapped_file,
+                                         GError          **error)
+{
+  g_return_val_if_fail (MWT_IS_TARIFF_LOADER (self), FALSE);
+  g_return_val_if_fail (mapped_file != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  g_autoptr(GBytes) bytes = g_mapped_file_get_bytes (mapped_file);
+
+  /* mmap() always returns page-aligned memory, so this won’t copy. */
+  g_assert (((guintptr) g_bytes_get_data (bytes, NULL)) % 8 == 0);
+
+  return mwt_tariff_loader_load_from_bytes (self, bytes, error);
+}
+
+/**
+ * mwt_tariff_loader_load_from_file:
+ * @self: a #MwtTariffLoader
+ * @path: (type filename): path of the file to load
+ * @error: return location for a #GError, or %NULL
+ *
+ * Version of mwt_tariff_loader_load_from_bytes() which loads from the file at
+ * @path. The file is mapped into memory with #GMappedFile and loaded using
+ * mwt_tariff_loader_load_from_mapped_file(), so it is not copied or read into
+ * a buffer first.
+ *
+ * If the file cannot be mapped, a #GFileError will be returned.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 0.3.0
+ */
+gboolean
+mwt_tariff_loader_load_from_file (MwtTariffLoader  *self,
+                                  const gchar      *path,
+                                  GError          **error)
+{
+  g_return_val_if_fail (MWT_IS_TARIFF_LOADER (self), FALSE);
+  g_return_val_if_fail (path != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  /* Clear any existing result. */
+  g_clear_object (&self->final_tariff);
+
+  g_autoptr(GMappedFile) mapped_file = g_mapped_file_new (path, FALSE  /* read-only */, error);
+  if (mapped_file == NULL)
+    return FALSE;
+
+  return mwt_tariff_loader_load_from_mapped_file (self, mapped_file, error);
+}
+
+/* Construct a #GDateTime from the given @unix_timestamp (always in UTC) in
+ * the given @tz. This will return %NULL if @tz is %NULL or an invalid time
+ * results. */
 static GDateTime *
-date_time_new_from_unix (guint64      unix_timestamp,
-                         const gchar *timezone_identifier)
+date_time_new_from_unix (guint64    unix_timestamp,
+                         GTimeZone *tz)
 {
+  if (tz == NULL || unix_timestamp > G_MAXINT64)
+    return NULL;
+
   g_autoptr(GDateTime) utc = g_date_time_new_from_unix_utc (unix_timestamp);
   if (utc == NULL)
     return NULL;
 
-  g_autoptr(GTimeZone) tz = NULL;
-  if (*timezone_identifier == '\0')
-    tz = g_time_zone_new_local ();
-  else
-#if GLIB_CHECK_VERSION(2, 68, 0)
-    tz = g_time_zone_new_identifier (timezone_identifier);
-#else
-    tz = g_time_zone_new (timezone_identifier);
-#endif
-
-#if GLIB_CHECK_VERSION(2, 68, 0)
-  if (tz == NULL)
-    return NULL;
-#endif
+  return g_date_time_to_timezone (utc, tz);
+}
+
+/* Create a new #MwtPeriod from its serialised fields, or return %NULL and set
+ * @error if they’re invalid. @i is the index of the period in the file, for
+ * error messages. @start_tz and @end_tz may be %NULL if they couldn’t be
+ * loaded. */
+static MwtPeriod *
+period_new_from_fields (gsize       i,
+                        guint64     start_unix,
+                        GTimeZone  *start_tz,
+                        guint64     end_unix,
+                        GTimeZone  *end_tz,
+                        guint16     repeat_type_uint16,
+                        guint32     repeat_period,
+                        guint64     capacity_limit,
+                        GError    **error)
+{
+  /* Note: @start and @end might be %NULL. mwt_period_validate() handles that. */
+  g_autoptr(GDateTime) start = date_time_new_from_unix (start_unix, start_tz);
+  g_autoptr(GDateTime) end = date_time_new_from_unix (end_unix, end_tz);
+  MwtPeriodRepeatType repeat_type = (MwtPeriodRepeatType) repeat_type_uint16;
 
-  g_debug ("%s: Created timezone ‘%s’ for ‘%s’, with offset %d at interval 0",
-           G_STRFUNC, g_time_zone_get_identifier (tz), timezone_identifier,
-           g_time_zone_get_offset (tz, 0));
+  g_autoptr(GError) local_error = NULL;
+  if (!mwt_period_validate (start, end, repeat_type, repeat_period, &local_error))
+    {
+      g_propagate_prefixed_error (error, g_steal_pointer (&local_error),
+                                  _("Error parsing period %" G_GSIZE_FORMAT ": "),
+                                  i);
+      return NULL;
+    }
 
-#if !GLIB_CHECK_VERSION(2, 68, 0)
-  /* Creating a timezone can’t actually fail, but if we fail to load the
-   * timezone information, the #GTimeZone will just represent UTC. Catch that. */
-  g_assert (tz != NULL);
-  if (!g_str_equal (g_time_zone_get_identifier (tz), timezone_identifier))
-    return NULL;
-#endif
+  return mwt_period_new (start, end, repeat_type, repeat_period,
+                         "capacity-limit", capacity_limit,
+                         NULL);
+}
 
-  return g_date_time_to_timezone (utc, tz);
+static void
+time_zone_unref_nullable (gpointer tz)
+{
+  if (tz != NULL)
+    g_time_zone_unref (tz);
+}
+
+static gint
+uint64_compare (gconstpointer a,
+                gconstpointer b)
+{
+  guint64 a_value = *((const guint64 *) a);
+  guint64 b_value = *((const guint64 *) b);
+
+  if (a_value == b_value)
+    return 0;
+  return (a_value < b_value) ? -1 : 1;
+}
+
+/* Load the periods from an inner variant of type `(sasa(ttqqqut)at)`, which is
+ * version 3 of the file format. See #MwtTariffPeriodRecordV3. The records are
+ * accessed in place, and each time zone in the table is only loaded once. */
+static gboolean
+load_periods_v3 (GVariant   *inner_variant,
+                 GPtrArray  *periods,
+                 GError    **error)
+{
+  g_autoptr(GVariant) time_zones_variant = g_variant_get_child_value (inner_variant, 1);
+  g_autoptr(GVariant) records_variant = g_variant_get_child_value (inner_variant, 2);
+  g_autoptr(GVariant) transitions_variant = g_variant_get_child_value (inner_variant, 3);
+
+  gsize n_time_zones;
+  g_autofree const gchar **time_zone_identifiers = g_variant_get_strv (time_zones_variant, &n_time_zones);
+  g_autoptr(GPtrArray) time_zones = g_ptr_array_new_with_free_func (time_zone_unref_nullable);
+  g_ptr_array_set_size (time_zones, n_time_zones);
+
+  gsize n_records;
+  const MwtTariffPeriodRecordV3 *records = g_variant_get_fixed_array (records_variant, &n_records,
+                                                                      sizeof (MwtTariffPeriodRecordV3));
+
+  gsize n_transitions;
+  const guint64 *transitions = g_variant_get_fixed_array (transitions_variant, &n_transitions,
+                                                          sizeof (guint64));
+
+  for (gsize i = 1; i < n_transitions; i++)
+    {
+      if (transitions[i - 1] >= transitions[i])
+        {
+          g_set_error_literal (error, MWT_TARIFF_ERROR, MWT_TARIFF_ERROR_INVALID,
+                               _("Transition index is not strictly increasing."));
+          return FALSE;
+        }
+    }
+
+  for (gsize i = 0; i < n_records; i++)
+    {
+      const MwtTariffPeriodRecordV3 *record = &records[i];
+      const guint16 timezone_indices[] =
+        {
+          record->start_timezone_index,
+          record->end_timezone_index,
+        };
+
+      for (gsize j = 0; j < G_N_ELEMENTS (timezone_indices); j++)
+        {
+          guint16 timezone_index = timezone_indices[j];
+
+          if (timezone_index >= n_time_zones)
+            {
+              g_set_error (error, MWT_TARIFF_ERROR, MWT_TARIFF_ERROR_INVALID,
+                           _("Error parsing period %" G_GSIZE_FORMAT ": "
+                             "Invalid time zone index %u."),
+                           i + 1, (guint) timezone_index);
+              return FALSE;
+            }
+
+          /* Invalid time zones are left as %NULL and reported by
+           * mwt_period_validate(). */
+          if (time_zones->pdata[timezone_index] == NULL)
+            time_zones->pdata[timezone_index] =
+                mwt_time_zone_cache_lookup (time_zone_identifiers[timezone_index]);
+        }
+
+      /* Non-recurring periods must be in the transition index. */
+      if (record->repeat_type == MWT_PERIOD_REPEAT_NONE &&
+          (bsearch (&record->start_unix, transitions, n_transitions,
+                    sizeof (*transitions), uint64_compare) == NULL ||
+           bsearch (&record->end_unix, transitions, n_transitions,
+                    sizeof (*transitions), uint64_compare) == NULL))
+        {
+          g_set_error (error, MWT_TARIFF_ERROR, MWT_TARIFF_ERROR_INVALID,
+                       _("Error parsing period %" G_GSIZE_FORMAT ": "
+                         "Period is missing from the transition index."),
+                       i + 1);
+          return FALSE;
+        }
+
+      g_autoptr(MwtPeriod) period = NULL;
+      period = period_new_from_fields (i + 1,
+                                       record->start_unix,
+                                       time_zones->pdata[record->start_timezone_index],
+                                       record->end_unix,
+                                       time_zones->pdata[record->end_timezone_index],
+                                       record->repeat_type,
+                                       record->repeat_period,
+                                       record->capacity_limit,
+                                       error);
+      if (period == NULL)
+        return FALSE;
+
+      g_ptr_array_add (periods, g_steal_pointer (&period));
+    }
+
+  return TRUE;
+}
+
+/* Load the periods from an inner variant of type `(sa(ttqut))` or
+ * `(sa(ttssqut))`, which are versions 1 and 2 of the file format. */
+static gboolean
+load_periods_v1_v2 (GVariant   *inner_variant,
+                    guint16     format_version,
+                    GPtrArray  *periods,
+                    GError    **error)
+{
+  guint64 start_unix, end_unix, capacity_limit;
+  const gchar *start_timezone, *end_timezone;
+  guint16 repeat_type_uint16;
+  guint32 repeat_period;
+
+  g_autoptr(GVariantIter) iter = NULL;
+  g_variant_get_child (inner_variant, 1, "a*", &iter);
+
+  gsize i = 0;
+
+  while (i++,
+         (format_version == 2) ?
+             g_variant_iter_loop (iter, "(tt&s&squt)",
+                                  &start_unix,
+                                  &end_unix,
+                                  &start_timezone,
+                                  &end_timezone,
+                                  &repeat_type_uint16,
+                                  &repeat_period,
+                                  &capacity_limit) :
+             g_variant_iter_loop (iter, "(ttqut)",
+                                  &start_unix,
+                                  &end_unix,
+                                  &repeat_type_uint16,
+                                  &repeat_period,
+                                  &capacity_limit))
+    {
+      /* Version 1 only supported UTC timezones. */
+      if (format_version == 1)
+        {
+          start_timezone = "Z";
+          end_timezone = "Z";
+        }
+
+      g_autoptr(GTimeZone) start_tz = mwt_time_zone_cache_lookup (start_timezone);
+      g_autoptr(GTimeZone) end_tz = mwt_time_zone_cache_lookup (end_timezone);
+
+      g_autoptr(MwtPeriod) period = NULL;
+      period = period_new_from_fields (i, start_unix, start_tz, end_unix, end_tz,
+                                       repeat_type_uint16, repeat_period,
+                                       capacity_limit, error);
+      if (period == NULL)
+        return FALSE;
+
+      g_ptr_array_add (periods, g_steal_pointer (&period));
+    }
+
+  return TRUE;
 }
 
 /**
@@ -274,7 +527,8 @@ mwt_tariff_loader_load_from_variant (MwtTariffLoader  *self,
     }
 
   /* Is the version number byteswapped? It should be 0x0001. */
-  if (format_version == 0x0100 || format_version == 0x0200)
+  if (format_version == 0x0100 || format_version == 0x0200 ||
+      format_version == 0x0300)
     {
       /* FIXME: Mess around with refs because g_variant_byteswap() had a bug
        * with how it handled floating refs.
@@ -285,7 +539,8 @@ mwt_tariff_loader_load_from_variant (MwtTariffLoader  *self,
       inner_variant = g_steal_pointer (&inner_variant_swapped);
       format_version = GUINT16_SWAP_LE_BE (format_version);
     }
-  else if (format_version != 0x0001 && format_version != 0x0002)
+  else if (format_version != 0x0001 && format_version != 0x0002 &&
+           format_version != 0x0003)
     {
       g_set_error (error, MWT_TARIFF_ERROR, MWT_TARIFF_ERROR_INVALID,
                    _("Unknown file format version %x02."),
@@ -293,11 +548,13 @@ mwt_tariff_loader_load_from_variant (MwtTariffLoader  *self,
       return FALSE;
     }
 
-  /* Load version 1 of the file format. */
+  /* Check the type of the inner variant for each version of the format. */
   if ((format_version == 1 &&
        !g_variant_is_of_type (inner_variant, G_VARIANT_TYPE ("(sa(ttqut))"))) ||
       (format_version == 2 &&
-       !g_variant_is_of_type (inner_variant, G_VARIANT_TYPE ("(sa(ttssqut))"))))
+       !g_variant_is_of_type (inner_variant, G_VARIANT_TYPE ("(sa(ttssqut))"))) ||
+      (format_version == 3 &&
+       !g_variant_is_of_type (inner_variant, G_VARIANT_TYPE ("(sasa(ttqqqut)at)"))))
     {
       g_set_error (error, MWT_TARIFF_ERROR, MWT_TARIFF_ERROR_INVALID,
                    _("Input data does not have correct type."));
@@ -305,60 +562,18 @@ mwt_tariff_loader_load_from_variant (MwtTariffLoader  *self,
     }
 
   const gchar *name;
-  g_autoptr(GVariantIter) iter = NULL;
-  g_variant_get (inner_variant, "(&sa*)", &name, &iter);
-
-  guint64 start_unix, end_unix, capacity_limit;
-  const gchar *start_timezone, *end_timezone;
-  guint16 repeat_type_uint16;
-  guint32 repeat_period;
-
   g_autoptr(GPtrArray) periods = g_ptr_array_new_with_free_func (g_object_unref);
-  gsize i = 0;
-
-  while (i++,
-         (format_version == 2) ?
-             g_variant_iter_loop (iter, "(tt&s&squt)",
-                                  &start_unix,
-                                  &end_unix,
-                                  &start_timezone,
-                                  &end_timezone,
-                                  &repeat_type_uint16,
-                                  &repeat_period,
-                                  &capacity_limit) :
-             g_variant_iter_loop (iter, "(ttqut)",
-                                  &start_unix,
-                                  &end_unix,
-                                  &repeat_type_uint16,
-                                  &repeat_period,
-                                  &capacity_limit))
-    {
-      /* Version 1 only supported UTC timezones. */
-      if (format_version == 1)
-        {
-          start_timezone = "Z";
-          end_timezone = "Z";
-        }
 
-      /* Note: @start and @end might be %NULL. mwt_period_validate() handles that. */
-      g_autoptr(GDateTime) start = date_time_new_from_unix (start_unix, start_timezone);
-      g_autoptr(GDateTime) end = date_time_new_from_unix (end_unix, end_timezone);
-      MwtPeriodRepeatType repeat_type = (MwtPeriodRepeatType) repeat_type_uint16;
+  g_variant_get_child (inner_variant, 0, "&s", &name);
 
-      g_autoptr(GError) local_error = NULL;
-      if (!mwt_period_validate (start, end, repeat_type, repeat_period, &local_error))
-        {
-          g_propagate_prefixed_error (error, g_steal_pointer (&local_error),
-                                      _("Error parsing period %" G_GSIZE_FORMAT ": "),
-                                      i);
-          return FALSE;
-        }
-
-      g_autoptr(MwtPeriod) period = NULL;
-      period = mwt_period_new (start, end, repeat_type, repeat_period,
-                               "capacity-limit", capacity_limit,
-                               NULL);
-      g_ptr_array_add (periods, g_steal_pointer (&period));
+  if (format_version == 3)
+    {
+      if (!load_periods_v3 (inner_variant, periods, error))
+        return FALSE;
+    }
+  else if (!load_periods_v1_v2 (inner_variant, format_version, periods, error))
+    {
+      return FALSE;
     }
 
   g_autoptr(GError) local_error = NULL;
@@ -39,6 +39,12 @@ gboolean         mwt_tariff_loader_load_from_bytes       (MwtTariffLoader  *self
 gboolean         mwt_tariff_loader_load_from_variant     (MwtTariffLoader  *self,
                                                           GVariant         *variant,
                                                           GError          **error);
+gboolean         mwt_tariff_loader_load_from_mapped_file (MwtTariffLoader  *self,
+                                                          GMappedFile      *mapped_file,
+                                                          GError          **error);
+gboolean         mwt_tariff_loader_load_from_file        (MwtTariffLoader  *self,
+                                                          const gchar      *path,
+                                                          GError          **error);
 
 MwtTariff       *mwt_tariff_loader_get_tariff            (MwtTariffLoader  *self);
 
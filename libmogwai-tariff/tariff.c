@@ -27,6 +27,7 @@
 #include <glib-object.h>
 #include <gio/gio.h>
 #include <libmogwai-tariff/period.h>
+#include <libmogwai-tariff/tariff-private.h>
 #include <libmogwai-tariff/tariff.h>
 #include <string.h>
 
@@ -35,6 +36,7 @@ G_DEFINE_QUARK (MwtTariffError, mwt_tariff_error)
 
 static void mwt_tariff_constructed  (GObject      *object);
 static void mwt_tariff_dispose      (GObject      *object);
+static void mwt_tariff_finalize     (GObject      *object);
 static void mwt_tariff_get_property (GObject      *object,
                                      guint         property_id,
                                      GValue       *value,
@@ -100,8 +102,78 @@ struct _MwtTariff
 
   gchar *name;  /* (owned) */
   GPtrArray *periods;  /*  (element-type MwtPeriod) (owned) */
+
+  /* Compiled form of the periods, built in constructed(), which can be queried
+   * without allocating. Non-recurring periods are stored as their spans, in
+   * microseconds since the Unix epoch, ordered by increasing start time and
+   * then decreasing end time. As the periods are guaranteed to be either
+   * disjoint or nested, the spans form a forest: each span’s parent is the
+   * shortest span which contains it (or %G_MAXSIZE), and is always earlier in
+   * the arrays. This can be searched in O(log N + depth).
+   *
+   * Recurring periods have unbounded sets of spans so cannot be indexed the
+   * same way; they are kept in @recurring_periods and checked individually. */
+  gsize n_spans;
+  gint64 *span_starts;  /* (array length=n_spans) (owned) */
+  gint64 *span_ends;  /* (array length=n_spans) (owned) */
+  gsize *span_parents;  /* (array length=n_spans) (owned) */
+  MwtPeriod **span_periods;  /* (array length=n_spans) (owned) (element-type unowned) */
+
+  /* Every start and end time of the non-recurring periods, in strictly
+   * increasing order, with a #GDateTime (in the period’s time zone) for each. */
+  gsize n_boundaries;
+  gint64 *boundaries;  /* (array length=n_boundaries) (owned) */
+  GDateTime **boundary_date_times;  /* (array length=n_boundaries) (owned) (element-type unowned) */
+
+  GPtrArray *recurring_periods;  /* (element-type MwtPeriod) (owned) */
+
+  /* Optional materialised timeline of the transitions between
+   * @timeline_start and @timeline_covered_until, for tariffs with recurring
+   * periods, which would otherwise have to be expanded on every query. It is
+   * enabled by setting a non-zero @timeline_horizon, and is a cache: it never
+   * changes the results of queries, so it doesn’t affect the immutability of
+   * the tariff. See mwt_tariff_set_timeline_horizon().
+   *
+   * The first entry is at @timeline_start, and each later one is a
+   * transition, as returned by get_next_transition_usec(); all the
+   * transitions up to and including @timeline_covered_until are present. Each
+   * entry’s period applies until the next entry. @timeline_covered_until is
+   * %G_MAXINT64 if there are no transitions after the last entry. */
+  GMutex timeline_lock;
+  GTimeSpan timeline_horizon;  /* (locked-by timeline_lock) */
+  GArray *timeline;  /* (element-type TimelineEntry) (owned) (nullable) (locked-by timeline_lock) */
+  gint64 timeline_covered_until;  /* (locked-by timeline_lock) */
 };
 
+/* Temporary representations used while building the compiled form. */
+typedef struct
+{
+  gint64 start;
+  gint64 end;
+  MwtPeriod *period;  /* (unowned) */
+} Span;
+
+typedef struct
+{
+  gint64 when;
+  GDateTime *date_time;  /* (unowned) */
+} Boundary;
+
+typedef struct
+{
+  gint64 when;
+  MwtPeriod *period;  /* (unowned) (nullable) */
+  /* As returned by get_next_transition_usec(), to convert @when to a
+   * #GDateTime; %NULL for the first entry. */
+  GDateTime *boundary_date_time;  /* (unowned) (nullable) */
+  gint64 boundary_usec;
+} TimelineEntry;
+
+/* Maximum number of entries in the materialised timeline, to bound its memory
+ * use for tariffs with lots of short recurring periods. If the horizon would
+ * need more, the timeline covers less time, and is extended more often. */
+#define MAX_TIMELINE_ENTRIES 100000
+
 typedef enum
 {
   PROP_NAME = 1,
@@ -118,6 +190,7 @@ mwt_tariff_class_init (MwtTariffClass *klass)
 
   object_class->constructed = mwt_tariff_constructed;
   object_class->dispose = mwt_tariff_dispose;
+  object_class->finalize = mwt_tariff_finalize;
   object_class->get_property = mwt_tariff_get_property;
   object_class->set_property = mwt_tariff_set_property;
 
@@ -165,7 +238,153 @@ mwt_tariff_class_init (MwtTariffClass *klass)
 static void
 mwt_tariff_init (MwtTariff *self)
 {
-  /* Nothing to do here. */
+  g_mutex_init (&self->timeline_lock);
+}
+
+static gint64
+date_time_to_usec (GDateTime *date_time)
+{
+  return (g_date_time_to_unix (date_time) * G_USEC_PER_SEC +
+          g_date_time_get_microsecond (date_time));
+}
+
+static gint
+span_compare (const Span *a,
+              const Span *b)
+{
+  if (a->start != b->start)
+    return (a->start < b->start) ? -1 : 1;
+  if (a->end != b->end)
+    return (a->end > b->end) ? -1 : 1;
+  return 0;
+}
+
+static gint
+boundary_compare (const Boundary *a,
+                  const Boundary *b)
+{
+  if (a->when != b->when)
+    return (a->when < b->when) ? -1 : 1;
+  return 0;
+}
+
+/* Work out the parent of each span in @spans, which must be sorted using
+ * span_compare(), and store it in @out_parents (an array of the same length as
+ * @spans). The parent of a span is the shortest span which contains it, or
+ * %G_MAXSIZE if no other span contains it.
+ *
+ * Since the spans are sorted by start time, the parent is either the previous
+ * span, or one of that span’s ancestors: the first ancestor which ends after the
+ * span starts. If that ancestor ends before the span does, the two spans
+ * partially overlap, and %FALSE is returned. %FALSE is also returned if two
+ * spans are equal. Otherwise, all the spans are disjoint or nested, and %TRUE
+ * is returned.
+ *
+ * This is amortised O(N), as each span is skipped over at most once when
+ * walking up the ancestors of later spans. */
+static gboolean
+build_span_forest (GArray *spans,
+                   gsize  *out_parents)
+{
+  for (gsize i = 0; i < spans->len; i++)
+    {
+      const Span *span = &g_array_index (spans, Span, i);
+      gsize parent = (i > 0) ? i - 1 : G_MAXSIZE;
+
+      /* p_1: ▀▀▀
+       * p_2: ▀▀▀
+       */
+      if (parent != G_MAXSIZE &&
+          span_compare (span, &g_array_index (spans, Span, parent)) == 0)
+        return FALSE;
+
+      while (parent != G_MAXSIZE &&
+             g_array_index (spans, Span, parent).end <= span->start)
+        parent = out_parents[parent];
+
+      /* p_1: ▀▀▀
+       * p_2:  ▀▀▀
+       */
+      if (parent != G_MAXSIZE &&
+          g_array_index (spans, Span, parent).end < span->end)
+        return FALSE;
+
+      out_parents[i] = parent;
+    }
+
+  return TRUE;
+}
+
+static void
+compile (MwtTariff *self)
+{
+  g_autoptr(GArray) spans = g_array_sized_new (FALSE, FALSE, sizeof (Span),
+                                               self->periods->len);
+  g_autoptr(GArray) boundaries = g_array_sized_new (FALSE, FALSE, sizeof (Boundary),
+                                                    self->periods->len * 2);
+  self->recurring_periods = g_ptr_array_new_with_free_func (NULL);
+
+  for (gsize i = 0; i < self->periods->len; i++)
+    {
+      MwtPeriod *period = g_ptr_array_index (self->periods, i);
+
+      if (mwt_period_get_repeat_type (period) != MWT_PERIOD_REPEAT_NONE)
+        {
+          g_ptr_array_add (self->recurring_periods, period);
+          continue;
+        }
+
+      Span span = { mwt_period_get_start_usec (period),
+                    mwt_period_get_end_usec (period),
+                    period };
+      Boundary start_boundary = { span.start, mwt_period_get_start (period) };
+      Boundary end_boundary = { span.end, mwt_period_get_end (period) };
+
+      g_array_append_val (spans, span);
+      g_array_append_val (boundaries, start_boundary);
+      g_array_append_val (boundaries, end_boundary);
+    }
+
+  g_array_sort (spans, (GCompareFunc) span_compare);
+  g_array_sort (boundaries, (GCompareFunc) boundary_compare);
+
+  self->n_spans = spans->len;
+  self->span_starts = g_new (gint64, spans->len);
+  self->span_ends = g_new (gint64, spans->len);
+  self->span_parents = g_new (gsize, spans->len);
+  self->span_periods = g_new (MwtPeriod *, spans->len);
+
+  for (gsize i = 0; i < spans->len; i++)
+    {
+      const Span *span = &g_array_index (spans, Span, i);
+
+      self->span_starts[i] = span->start;
+      self->span_ends[i] = span->end;
+      self->span_periods[i] = span->period;
+    }
+
+  /* Periods are validated to be disjoint or nested, so this can’t fail. */
+  gboolean forest_built = build_span_forest (spans, self->span_parents);
+  g_assert (forest_built);
+
+  /* Remove duplicate boundaries, where one period starts or ends as another
+   * starts or ends. */
+  self->n_boundaries = 0;
+  self->boundaries = g_new (gint64, boundaries->len);
+  self->boundary_date_times = g_new (GDateTime *, boundaries->len);
+
+  for (gsize i = 0; i < boundaries->len; i++)
+    {
+      const Boundary *boundary = &g_array_index (boundaries, Boundary, i);
+
+      if (self->n_boundaries > 0 &&
+          self->boundaries[self->n_boundaries - 1] == boundary->when)
+        continue;
+
+      self->boundaries[self->n_boundaries] = boundary->when;
+      self->boundary_date_times[self->n_boundaries] = boundary->date_time;
+      self->n_boundaries++;
+    }
 }
 
 static void
@@ -177,6 +396,8 @@ mwt_tariff_constructed (GObject *object)
 
   /* Validate the properties. */
   g_assert (mwt_tariff_validate (self->name, self->periods, NULL));
+
+  compile (self);
 }
 
 static void
@@ -186,11 +407,30 @@ mwt_tariff_dispose (GObject *object)
 
   g_clear_pointer (&self->name, g_free);
   g_clear_pointer (&self->periods, g_ptr_array_unref);
+  g_clear_pointer (&self->span_starts, g_free);
+  g_clear_pointer (&self->span_ends, g_free);
+  g_clear_pointer (&self->span_parents, g_free);
+  g_clear_pointer (&self->span_periods, g_free);
+  g_clear_pointer (&self->boundaries, g_free);
+  g_clear_pointer (&self->boundary_date_times, g_free);
+  g_clear_pointer (&self->recurring_periods, g_ptr_array_unref);
+  g_clear_pointer (&self->timeline, g_array_unref);
 
   /* Chain up to the parent class */
   G_OBJECT_CLASS (mwt_tariff_parent_class)->dispose (object);
 }
 
+static void
+mwt_tariff_finalize (GObject *object)
+{
+  MwtTariff *self = MWT_TARIFF (object);
+
+  g_mutex_clear (&self->timeline_lock);
+
+  /* Chain up to the parent class */
+  G_OBJECT_CLASS (mwt_tariff_parent_class)->finalize (object);
+}
+
 static void
 mwt_tariff_get_property (GObject    *object,
                          guint       property_id,
@@ -237,56 +477,130 @@ mwt_tariff_set_property (GObject      *object,
     }
 }
 
+/* Maximum number of recurrences to expand, across all the recurring periods in
+ * a tariff, when checking whether its periods overlap. This bounds the cost of
+ * validating tariffs which have a long horizon (see
+ * mwt_tariff_are_periods_nonoverlapping()) and frequently recurring periods. */
+#define MAX_EXPANDED_RECURRENCES 10000
+
+/* Add a #Span to @spans for each recurrence of @period which starts before
+ * @horizon_end_usec, up to a maximum of @max_recurrences. The first occurrence
+ * of @period is always added. Recurrences of a single period may overlap (for
+ * example, if a monthly recurrence spans time zones with different offsets),
+ * which is not a conflict, so overlapping recurrences are merged. */
+static void
+add_period_spans (GArray    *spans,
+                  MwtPeriod *period,
+                  gint64     horizon_end_usec,
+                  gsize      max_recurrences)
+{
+  Span span = { mwt_period_get_start_usec (period),
+                mwt_period_get_end_usec (period),
+                period };
+  gint64 next_start, next_end;
+
+  for (gsize i = 1;
+       i < max_recurrences &&
+       mwt_period_get_next_recurrence_usec (period, span.start, &next_start, &next_end) &&
+       next_start < horizon_end_usec;
+       i++)
+    {
+      if (next_start < span.end)
+        {
+          span.end = MAX (span.end, next_end);
+        }
+      else
+        {
+          g_array_append_val (spans, span);
+          span.start = next_start;
+          span.end = next_end;
+        }
+    }
+
+  g_array_append_val (spans, span);
+}
+
 /* ∀ p_1, p_2 ∈ self->periods.
  *   ¬ (p_1.start < p_2.start ∧
  *      p_1.end > p_2.start ∧
  *      p_1.end < p_2.end) ∧
  *   ¬ (p_1.start = p_2.start ∧
  *      p_1.end = p_2.end)
+ *
+ * This is checked by sorting the spans of the periods (including their
+ * recurrences) and sweeping over them to build the same forest of nested spans
+ * which is used to index the non-recurring periods for lookups (see
+ * build_span_forest()). This is O(N log N) in the number of spans.
+ *
+ * Recurring periods have an unbounded number of spans, so they are expanded up
+ * to a horizon: one cycle of the longest-recurring period after the end of the
+ * latest period, subject to %MAX_EXPANDED_RECURRENCES. Conflicts which first
+ * occur beyond the horizon are not detected.
  */
 static gboolean
 mwt_tariff_are_periods_nonoverlapping (GPtrArray *periods)
 {
-  /* FIXME: This is O(N^2) at the moment. We assume there are not many periods. */
-  /* FIXME: This needs to expand recurrences, since we could have two periods
-   * whose spans are identical, but whose start times differ by the repeat period
-   * of one of them. */
+  gint64 latest_end_usec = G_MININT64;
+  gint64 longest_cycle_usec = 0;
+  gsize n_recurring_periods = 0;
+
   for (gsize i = 0; i < periods->len; i++)
     {
-      MwtPeriod *p_1 = g_ptr_array_index (periods, i);
-      GDateTime *p_1_start = mwt_period_get_start (p_1);
-      GDateTime *p_1_end = mwt_period_get_end (p_1);
+      MwtPeriod *period = g_ptr_array_index (periods, i);
+      gint64 start_usec = mwt_period_get_start_usec (period);
+      gint64 next_start_usec;
 
-      for (gsize j = 0; j < periods->len; j++)
-        {
-          MwtPeriod *p_2 = g_ptr_array_index (periods, j);
-          GDateTime *p_2_start = mwt_period_get_start (p_2);
-          GDateTime *p_2_end = mwt_period_get_end (p_2);
-
-          if (i == j)
-            continue;
-
-          /* p_1: ▀▀▀
-           * p_2:  ▀▀▀
-           * or (when i and j have swapped)
-           * p_1:  ▀▀▀
-           * p_2: ▀▀▀
-           */
-          if (g_date_time_compare (p_1_start, p_2_start) < 0 &&
-              g_date_time_compare (p_1_end, p_2_start) > 0 &&
-              g_date_time_compare (p_1_end, p_2_end) < 0)
-            return FALSE;
-
-          /* p_1: ▀▀▀
-           * p_2: ▀▀▀
-           */
-          if (g_date_time_compare (p_1_start, p_2_start) == 0 &&
-              g_date_time_compare (p_1_end, p_2_end) == 0)
-            return FALSE;
-        }
+      latest_end_usec = MAX (latest_end_usec, mwt_period_get_end_usec (period));
+
+      if (mwt_period_get_repeat_type (period) == MWT_PERIOD_REPEAT_NONE)
+        continue;
+
+      n_recurring_periods++;
+      if (mwt_period_get_next_recurrence_usec (period, start_usec, &next_start_usec, NULL))
+        longest_cycle_usec = MAX (longest_cycle_usec, next_start_usec - start_usec);
     }
 
-  return TRUE;
+  gint64 horizon_end_usec = latest_end_usec + longest_cycle_usec;
+  gsize max_recurrences = (n_recurring_periods > 0) ?
+                          MAX (1, MAX_EXPANDED_RECURRENCES / n_recurring_periods) : 1;
+
+  g_autoptr(GArray) spans = g_array_sized_new (FALSE, FALSE, sizeof (Span),
+                                               periods->len);
+
+  for (gsize i = 0; i < periods->len; i++)
+    add_period_spans (spans, g_ptr_array_index (periods, i),
+                      horizon_end_usec, max_recurrences);
+
+  g_array_sort (spans, (GCompareFunc) span_compare);
+
+  g_autofree gsize *parents = g_new (gsize, spans->len);
+
+  return build_span_forest (spans, parents);
+}
+
+/* Check whether the @n_spans spans given by @starts and @ends (in microseconds
+ * since the Unix epoch) are all disjoint or nested, and none of them are equal.
+ * This is a version of mwt_tariff_are_periods_nonoverlapping() for
+ * non-recurring periods which haven’t been instantiated as #MwtPeriods; see
+ * mwt_tariff_builder_add_period_fields(). */
+gboolean
+mwt_tariff_spans_are_nonoverlapping (const gint64 *starts,
+                                     const gint64 *ends,
+                                     gsize         n_spans)
+{
+  g_autoptr(GArray) spans = g_array_sized_new (FALSE, FALSE, sizeof (Span), n_spans);
+
+  for (gsize i = 0; i < n_spans; i++)
+    {
+      Span span = { starts[i], ends[i], NULL };
+      g_array_append_val (spans, span);
+    }
+
+  g_array_sort (spans, (GCompareFunc) span_compare);
+
+  g_autofree gsize *parents = g_new (gsize, spans->len);
+
+  return build_span_forest (spans, parents);
 }
 
 /* Periods must be ordered by decreasing time span, and then by increasing start
@@ -298,16 +612,14 @@ mwt_tariff_are_periods_ordered (GPtrArray *periods)
     {
       MwtPeriod *p1 = g_ptr_array_index (periods, i - 1);
       MwtPeriod *p2 = g_ptr_array_index (periods, i);
-      GDateTime *p1_start = mwt_period_get_start (p1);
-      GDateTime *p1_end = mwt_period_get_end (p1);
-      GDateTime *p2_start = mwt_period_get_start (p2);
-      GDateTime *p2_end = mwt_period_get_end (p2);
+      gint64 p1_start = mwt_period_get_start_usec (p1);
+      gint64 p2_start = mwt_period_get_start_usec (p2);
 
-      GTimeSpan p1_span = g_date_time_difference (p1_end, p1_start);
-      GTimeSpan p2_span = g_date_time_difference (p2_end, p2_start);
+      GTimeSpan p1_span = mwt_period_get_end_usec (p1) - p1_start;
+      GTimeSpan p2_span = mwt_period_get_end_usec (p2) - p2_start;
 
       if (p1_span < p2_span ||
-          (p1_span == p2_span && g_date_time_compare (p1_start, p2_start) >= 0))
+          (p1_span == p2_span && p1_start >= p2_start))
         return FALSE;
     }
 
@@ -416,6 +728,326 @@ mwt_tariff_get_periods (MwtTariff *self)
   return self->periods;
 }
 
+/* Find the shortest period with a recurrence containing @when_usec (if
+ * @before is %FALSE), or containing the instant immediately before @when_usec
+ * (if @before is %TRUE). As times are in microseconds, that instant is
+ * (@when_usec - 1).
+ *
+ * This doesn’t allocate, unless the tariff contains monthly or yearly
+ * recurring periods. */
+static MwtPeriod *
+lookup_period_usec (MwtTariff *self,
+                    gint64     when_usec,
+                    gboolean   before)
+{
+  MwtPeriod *shortest_period = NULL;
+  GTimeSpan shortest_period_duration = G_MAXINT64;
+
+  if (before)
+    when_usec--;
+
+  /* Binary search for the last span which starts at or before @when_usec. */
+  gsize lower = 0, upper = self->n_spans;
+
+  while (lower < upper)
+    {
+      gsize mid = lower + (upper - lower) / 2;
+
+      if (self->span_starts[mid] <= when_usec)
+        lower = mid + 1;
+      else
+        upper = mid;
+    }
+
+  /* That span is the shortest one which could contain @when_usec. If it
+   * doesn’t, one of its ancestors might. Any other span which contains
+   * @when_usec must contain the first span too, so must be one of its
+   * ancestors. */
+  for (gsize i = (lower > 0) ? lower - 1 : G_MAXSIZE; i != G_MAXSIZE;
+       i = self->span_parents[i])
+    {
+      if (self->span_ends[i] > when_usec)
+        {
+          shortest_period = self->span_periods[i];
+          shortest_period_duration = self->span_ends[i] - self->span_starts[i];
+          break;
+        }
+    }
+
+  for (gsize i = 0; i < self->recurring_periods->len; i++)
+    {
+      MwtPeriod *period = g_ptr_array_index (self->recurring_periods, i);
+
+      if (!mwt_period_contains_time_usec (period, when_usec, NULL, NULL))
+        continue;
+
+      /* Pick the shortest period. There should be no ties here, since
+       * overlapping periods are disallowed. */
+      GTimeSpan duration = (mwt_period_get_end_usec (period) -
+                            mwt_period_get_start_usec (period));
+
+      g_assert (shortest_period == NULL || duration != shortest_period_duration);
+
+      if (shortest_period == NULL || duration < shortest_period_duration)
+        {
+          shortest_period = period;
+          shortest_period_duration = duration;
+        }
+    }
+
+  return shortest_period;
+}
+
+static gboolean get_next_transition_usec (MwtTariff   *self,
+                                          gint64       after_usec,
+                                          gint64      *out_next_transition_usec,
+                                          GDateTime  **out_boundary_date_time,
+                                          gint64      *out_boundary_usec);
+
+/* Append the transitions after the last entry in @self->timeline until
+ * @until_usec (or the first one after it), or until the timeline is full.
+ * @self->timeline_lock must be held. */
+static void
+timeline_extend (MwtTariff *self,
+                 gint64     until_usec)
+{
+  while (self->timeline_covered_until < until_usec &&
+         self->timeline->len < MAX_TIMELINE_ENTRIES)
+    {
+      const TimelineEntry *last =
+          &g_array_index (self->timeline, TimelineEntry, self->timeline->len - 1);
+      TimelineEntry entry;
+
+      if (!get_next_transition_usec (self, last->when, &entry.when,
+                                     &entry.boundary_date_time,
+                                     &entry.boundary_usec))
+        {
+          self->timeline_covered_until = G_MAXINT64;
+          return;
+        }
+
+      entry.period = lookup_period_usec (self, entry.when, FALSE);
+      g_array_append_val (self->timeline, entry);
+      self->timeline_covered_until = entry.when;
+    }
+}
+
+/* Ensure the timeline, if enabled, covers @when_usec and the horizon after
+ * it. The timeline slides forwards as queries move forwards in time: entries
+ * which are entirely before @when_usec are dropped, and more are added at the
+ * end once the remaining horizon drops below half. Queries before the start of
+ * the timeline are not covered, so that looking up the odd time in the past
+ * doesn’t cause it to be rebuilt.
+ *
+ * @self->timeline_lock must be held. Returns %TRUE if the timeline covers
+ * @when_usec afterwards, i.e. the first entry is at or before @when_usec, and
+ * @self->timeline_covered_until is after it. */
+static gboolean
+timeline_ensure (MwtTariff *self,
+                 gint64     when_usec)
+{
+  if (self->timeline_horizon == 0)
+    return FALSE;
+
+  gint64 until_usec = (when_usec <= G_MAXINT64 - self->timeline_horizon) ?
+                      when_usec + self->timeline_horizon : G_MAXINT64;
+
+  if (self->timeline == NULL || when_usec >= self->timeline_covered_until)
+    {
+      /* Nothing usable: start again at @when_usec. */
+      TimelineEntry first = { when_usec, lookup_period_usec (self, when_usec, FALSE), NULL, 0 };
+
+      if (self->timeline == NULL)
+        self->timeline = g_array_new (FALSE, FALSE, sizeof (TimelineEntry));
+      g_array_set_size (self->timeline, 0);
+      g_array_append_val (self->timeline, first);
+      self->timeline_covered_until = when_usec;
+
+      timeline_extend (self, until_usec);
+    }
+  else if (g_array_index (self->timeline, TimelineEntry, 0).when > when_usec)
+    {
+      return FALSE;
+    }
+  else if (self->timeline_covered_until - when_usec < self->timeline_horizon / 2)
+    {
+      /* Drop the entries before the one which covers @when_usec. If the
+       * timeline is full, wait until that would free up at least half of it,
+       * so the cost of moving the remaining entries is amortised. */
+      gsize i = 1;
+      while (i < self->timeline->len &&
+             g_array_index (self->timeline, TimelineEntry, i).when <= when_usec)
+        i++;
+
+      if (self->timeline->len < MAX_TIMELINE_ENTRIES ||
+          i - 1 >= self->timeline->len / 2)
+        {
+          g_array_remove_range (self->timeline, 0, i - 1);
+          timeline_extend (self, until_usec);
+        }
+    }
+
+  return (when_usec < self->timeline_covered_until);
+}
+
+/* Find the index of the first entry in the timeline after @when_usec, which
+ * must be covered by it. As the first entry is at or before @when_usec, this
+ * is always greater than zero. @self->timeline_lock must be held. */
+static gsize
+timeline_search (MwtTariff *self,
+                 gint64     when_usec)
+{
+  gsize lower = 1, upper = self->timeline->len;
+
+  while (lower < upper)
+    {
+      gsize mid = lower + (upper - lower) / 2;
+
+      if (g_array_index (self->timeline, TimelineEntry, mid).when <= when_usec)
+        lower = mid + 1;
+      else
+        upper = mid;
+    }
+
+  return lower;
+}
+
+/* Look up the period at @when_usec in the timeline, if it’s enabled and covers
+ * @when_usec. Returns %TRUE and sets @out_period if so; returns %FALSE
+ * otherwise, and the caller must fall back to lookup_period_usec(). */
+static gboolean
+timeline_lookup_period (MwtTariff  *self,
+                        gint64      when_usec,
+                        MwtPeriod **out_period)
+{
+  /* Avoid locking for tariffs which can never have a timeline. */
+  if (self->recurring_periods->len == 0)
+    return FALSE;
+
+  g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&self->timeline_lock);
+
+  if (!timeline_ensure (self, when_usec))
+    return FALSE;
+
+  gsize i = timeline_search (self, when_usec);
+  *out_period = g_array_index (self->timeline, TimelineEntry, i - 1).period;
+
+  return TRUE;
+}
+
+/* Find the next transition after @after_usec in the timeline, if it’s enabled
+ * and covers @after_usec. Returns %TRUE and sets the out arguments if so (with
+ * @out_has_next set to %FALSE if there are no more transitions); returns
+ * %FALSE otherwise, and the caller must fall back to
+ * get_next_transition_usec(). The out arguments are as for
+ * get_next_transition_usec() and lookup_period_usec(). */
+static gboolean
+timeline_get_next_transition (MwtTariff   *self,
+                              gint64       after_usec,
+                              gboolean    *out_has_next,
+                              gint64      *out_next_transition_usec,
+                              GDateTime  **out_boundary_date_time,
+                              gint64      *out_boundary_usec,
+                              MwtPeriod  **out_from_period,
+                              MwtPeriod  **out_to_period)
+{
+  if (self->recurring_periods->len == 0)
+    return FALSE;
+
+  g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&self->timeline_lock);
+
+  if (!timeline_ensure (self, after_usec))
+    return FALSE;
+
+  gsize i = timeline_search (self, after_usec);
+
+  /* This is only possible if there are no more transitions, as otherwise the
+   * timeline would have been extended to include the next one. */
+  if (i == self->timeline->len)
+    {
+      g_assert (self->timeline_covered_until == G_MAXINT64);
+      *out_has_next = FALSE;
+      return TRUE;
+    }
+
+  const TimelineEntry *from = &g_array_index (self->timeline, TimelineEntry, i - 1);
+  const TimelineEntry *to = &g_array_index (self->timeline, TimelineEntry, i);
+
+  *out_has_next = TRUE;
+  *out_next_transition_usec = to->when;
+  *out_boundary_date_time = to->boundary_date_time;
+  *out_boundary_usec = to->boundary_usec;
+  *out_from_period = from->period;
+  *out_to_period = to->period;
+
+  return TRUE;
+}
+
+/**
+ * mwt_tariff_set_timeline_horizon:
+ * @self: a #MwtTariff
+ * @horizon: how far ahead of each query to materialise transitions, in
+ *    microseconds, or zero to disable the timeline
+ *
+ * Set the horizon of the materialised timeline for this tariff. If @horizon is
+ * non-zero, and the tariff contains recurring periods, the transitions
+ * between periods are calculated in advance for the @horizon after the time
+ * passed to each query, and are stored in a sorted array. Subsequent calls to
+ * mwt_tariff_lookup_period(), mwt_tariff_get_next_transition() and their
+ * variants for times within the timeline are then binary searches over that
+ * array, rather than expanding every recurring period.
+ *
+ * The timeline is extended lazily as queries move forward in time, so this is
+ * suited to long-lived tariffs which are queried for the current time
+ * repeatedly, such as in a scheduler. A horizon of a week is typical.
+ * Extending the timeline occasionally allocates.
+ *
+ * The timeline doesn’t change the results of any queries. Tariffs with no
+ * recurring periods are already compiled to a form which can be queried in
+ * logarithmic time, so the timeline is never built for them.
+ *
+ * Since: 0.3.0
+ */
+void
+mwt_tariff_set_timeline_horizon (MwtTariff *self,
+                                 GTimeSpan  horizon)
+{
+  g_return_if_fail (MWT_IS_TARIFF (self));
+  g_return_if_fail (horizon >= 0);
+
+  g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&self->timeline_lock);
+
+  if (self->recurring_periods->len == 0)
+    horizon = 0;
+
+  if (horizon == self->timeline_horizon)
+    return;
+
+  self->timeline_horizon = horizon;
+  g_clear_pointer (&self->timeline, g_array_unref);
+}
+
+/**
+ * mwt_tariff_get_timeline_horizon:
+ * @self: a #MwtTariff
+ *
+ * Get the horizon of the materialised timeline for this tariff, as set by
+ * mwt_tariff_set_timeline_horizon(). This is zero if the timeline is disabled,
+ * which is always the case if the tariff contains no recurring periods.
+ *
+ * Returns: timeline horizon, in microseconds
+ * Since: 0.3.0
+ */
+GTimeSpan
+mwt_tariff_get_timeline_horizon (MwtTariff *self)
+{
+  g_return_val_if_fail (MWT_IS_TARIFF (self), 0);
+
+  g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&self->timeline_lock);
+
+  return self->timeline_horizon;
+}
+
 /**
  * mwt_tariff_lookup_period:
  * @self: a #MwtTariff
@@ -426,7 +1058,9 @@ mwt_tariff_get_periods (MwtTariff *self)
  * returned. It is up to the caller to treat this appropriately (for example, by
  * disallowing all downloads).
  *
- * This will expand the recurrences of each period in order to find matches.
+ * Non-recurring periods are looked up in a compiled form of the tariff, built
+ * when it is constructed, in logarithmic time. The recurrences of each
+ * recurring period are expanded individually in order to find matches.
  *
  * Returns: (transfer none) (nullable): period covering @when, or %NULL if no
  *    periods are relevant
@@ -439,42 +1073,35 @@ mwt_tariff_lookup_period (MwtTariff *self,
   g_return_val_if_fail (MWT_IS_TARIFF (self), NULL);
   g_return_val_if_fail (when != NULL, NULL);
 
-  /* Find the set of periods which overlap @when, including taking recurrences
-   * into account. */
-  /* FIXME: We don’t expect there to be many periods in a tariff. If there are,
-   * this algorithm could be improved to use an interval tree or similar to
-   * improve performance. */
-  g_autoptr(GPtrArray) matches = g_ptr_array_new_with_free_func (NULL);
-
-  for (gsize i = 0; i < self->periods->len; i++)
-    {
-      MwtPeriod *period = g_ptr_array_index (self->periods, i);
-
-      if (mwt_period_contains_time (period, when, NULL, NULL))
-        g_ptr_array_add (matches, period);
-    }
+  return mwt_tariff_lookup_period_usec (self, date_time_to_usec (when));
+}
 
-  /* Pick the shortest period. There should be no ties here, since overlapping
-   * periods are disallowed. */
-  MwtPeriod *shortest_period = NULL;
-  GTimeSpan shortest_period_duration = G_MAXINT64;
-  for (gsize i = 0; i < matches->len; i++)
-    {
-      MwtPeriod *period = g_ptr_array_index (matches, i);
-      GDateTime *start = mwt_period_get_start (period);
-      GDateTime *end = mwt_period_get_end (period);
-      GTimeSpan duration = g_date_time_difference (end, start);
+/**
+ * mwt_tariff_lookup_period_usec:
+ * @self: a #MwtTariff
+ * @when_usec: the time to look up, in microseconds since the Unix epoch
+ *
+ * Version of mwt_tariff_lookup_period() which takes the time as microseconds
+ * since the Unix epoch. This is suitable for use in hot paths: it doesn’t
+ * allocate memory, unless the tariff contains periods which repeat monthly or
+ * yearly.
+ *
+ * Returns: (transfer none) (nullable): period covering @when_usec, or %NULL if
+ *    no periods are relevant
+ * Since: 0.3.0
+ */
+MwtPeriod *
+mwt_tariff_lookup_period_usec (MwtTariff *self,
+                               gint64     when_usec)
+{
+  g_return_val_if_fail (MWT_IS_TARIFF (self), NULL);
 
-      g_assert (shortest_period == NULL || duration != shortest_period_duration);
+  MwtPeriod *period = NULL;
 
-      if (shortest_period == NULL || duration < shortest_period_duration)
-        {
-          shortest_period = period;
-          shortest_period_duration = duration;
-        }
-    }
+  if (timeline_lookup_period (self, when_usec, &period))
+    return period;
 
-  return shortest_period;
+  return lookup_period_usec (self, when_usec, FALSE);
 }
 
 static void
@@ -497,70 +1124,93 @@ update_earliest (GDateTime **earliest,
     }
 }
 
-typedef struct
-{
-  GDateTime *when;  /* (owned) */
-  enum
-    {
-      TRANSITION_FROM,
-      TRANSITION_TO,
-    } type;
-  gsize period_index;
-  MwtPeriod *period;  /* (unowned) */
-} TransitionData;
-
-static void
-transition_data_clear (TransitionData *data)
+/* Get the first transition after @after_usec, which is the earliest start or
+ * end of a period (or one of its recurrences) after it. For non-recurring
+ * periods, that can be found from the compiled spans; each recurring period has
+ * to be queried.
+ *
+ * @out_boundary_date_time and @out_boundary_usec return the start or end time
+ * of the period the transition was calculated from (not necessarily of the
+ * same recurrence), so that the transition can be converted to a #GDateTime in
+ * the same time zone.
+ *
+ * This doesn’t allocate, unless the tariff contains monthly or yearly
+ * recurring periods. */
+static gboolean
+get_next_transition_usec (MwtTariff   *self,
+                          gint64       after_usec,
+                          gint64      *out_next_transition_usec,
+                          GDateTime  **out_boundary_date_time,
+                          gint64      *out_boundary_usec)
 {
-  g_clear_pointer (&data->when, g_date_time_unref);
-}
+  gint64 next_transition_usec = G_MAXINT64;
+  GDateTime *boundary_date_time = NULL;
+  gint64 boundary_usec = 0;
+  gsize lower = 0, upper = self->n_boundaries;
 
-static gint
-transition_data_sort (const TransitionData *a,
-                      const TransitionData *b)
-{
-  gint when_comparison = g_date_time_compare (a->when, b->when);
+  while (lower < upper)
+    {
+      gsize mid = lower + (upper - lower) / 2;
 
-  if (when_comparison != 0)
-    return when_comparison;
+      if (self->boundaries[mid] <= after_usec)
+        lower = mid + 1;
+      else
+        upper = mid;
+    }
 
-  /* Order %TRANSITION_FROM before %TRANSITION_TO. */
-  if (a->type == TRANSITION_FROM && b->type == TRANSITION_TO)
-    return -1;
-  else if (a->type == TRANSITION_TO && b->type == TRANSITION_FROM)
-    return 1;
+  if (lower < self->n_boundaries)
+    {
+      next_transition_usec = self->boundaries[lower];
+      boundary_date_time = self->boundary_date_times[lower];
+      boundary_usec = self->boundaries[lower];
+    }
 
-  /* If the transition types are equal, order by length/start time. That’s
-   * equivalent to ordering by the reverse index of @period in self->periods,
-   * due to the sort order we guarantee on the latter. */
-  if (a->period_index > b->period_index)
-    return -1;
-  else if (a->period_index < b->period_index)
-    return 1;
+  for (gsize i = 0; i < self->recurring_periods->len; i++)
+    {
+      MwtPeriod *period = g_ptr_array_index (self->recurring_periods, i);
+      gint64 period_transition_usec;
+      GDateTime *period_boundary_date_time;
+      gint64 period_boundary_usec;
+
+      /* If the period contains @after_usec, its next transition is the end of
+       * that recurrence; otherwise it’s the start of its next recurrence, if
+       * any. */
+      if (mwt_period_contains_time_usec (period, after_usec, NULL, &period_transition_usec))
+        {
+          period_boundary_date_time = mwt_period_get_end (period);
+          period_boundary_usec = mwt_period_get_end_usec (period);
+        }
+      else if (mwt_period_get_next_recurrence_usec (period, after_usec, &period_transition_usec, NULL))
+        {
+          period_boundary_date_time = mwt_period_get_start (period);
+          period_boundary_usec = mwt_period_get_start_usec (period);
+        }
+      else
+        {
+          continue;
+        }
 
-  g_assert_not_reached ();
-}
+      g_assert (period_transition_usec > after_usec);
 
-/* Get the next transition from @transitions after @data_index whose date/time
- * is greater than that of @data. If no such transition exists, return %NULL. */
-static const TransitionData *
-get_next_transition (GArray               *transitions,
-                     gsize                 data_index,
-                     const TransitionData *data)
-{
-  if (data_index == G_MAXSIZE)
-    return NULL;
+      if (period_transition_usec < next_transition_usec)
+        {
+          next_transition_usec = period_transition_usec;
+          boundary_date_time = period_boundary_date_time;
+          boundary_usec = period_boundary_usec;
+        }
+    }
 
-  for (gsize next_data_index = data_index + 1; next_data_index < transitions->len; next_data_index++)
-    {
-      const TransitionData *next_data =
-          &g_array_index (transitions, TransitionData, next_data_index);
+  if (boundary_date_time == NULL)
+    return FALSE;
 
-      if (!g_date_time_equal (next_data->when, data->when))
-        return next_data;
-    }
+  if (out_next_transition_usec != NULL)
+    *out_next_transition_usec = next_transition_usec;
+  if (out_boundary_date_time != NULL)
+    *out_boundary_date_time = boundary_date_time;
+  if (out_boundary_usec != NULL)
+    *out_boundary_usec = boundary_usec;
 
-  return NULL;
+  return TRUE;
 }
 
 /**
@@ -632,115 +1282,37 @@ mwt_tariff_get_next_transition (MwtTariff  *self,
       return g_steal_pointer (&first_transition);
     }
 
-  /* Otherwise, get the next transition for each of the periods in the tariff.
-   * For each period, if the period contains @after, then we know its next
-   * transition will be FROM that period to another. Otherwise, if the period
-   * has another recurrence after @after, we know its next transition will be
-   * TO that period from another. Build this up into an array of
-   * #TransitionData. */
+  /* Otherwise, find the next transition in the compiled tariff, and convert it
+   * to a #GDateTime in the time zone of the period boundary it came from. */
   g_autoptr(GDateTime) next_transition = NULL;
   MwtPeriod *next_from_period = NULL;
   MwtPeriod *next_to_period = NULL;
-
-  g_autoptr(GArray) transitions = g_array_sized_new (FALSE, FALSE,
-                                                     sizeof (TransitionData),
-                                                     self->periods->len);
-  g_array_set_clear_func (transitions, (GDestroyNotify) transition_data_clear);
-
-  for (gsize i = 0; i < self->periods->len; i++)
+  gint64 next_transition_usec = 0;
+  GDateTime *boundary_date_time = NULL;
+  gint64 boundary_usec = 0;
+  gint64 after_usec = date_time_to_usec (after);
+  gboolean has_next;
+
+  if (!timeline_get_next_transition (self, after_usec, &has_next,
+                                     &next_transition_usec,
+                                     &boundary_date_time, &boundary_usec,
+                                     &next_from_period, &next_to_period))
     {
-      MwtPeriod *period = g_ptr_array_index (self->periods, i);
+      has_next = get_next_transition_usec (self, after_usec,
+                                           &next_transition_usec,
+                                           &boundary_date_time, &boundary_usec);
 
-      g_array_set_size (transitions, transitions->len + 1);
-      TransitionData *data = &g_array_index (transitions, TransitionData,
-                                             transitions->len - 1);
-
-      if (mwt_period_contains_time (period, after, NULL, &data->when))
-        {
-          g_assert (g_date_time_compare (data->when, after) > 0);
-          data->type = TRANSITION_FROM;
-          data->period_index = i;
-          data->period = period;
-        }
-      else if (mwt_period_get_next_recurrence (period, after, &data->when, NULL))
-        {
-          g_assert (g_date_time_compare (data->when, after) > 0);
-          data->type = TRANSITION_TO;
-          data->period_index = i;
-          data->period = period;
-        }
-      else
+      if (has_next)
         {
-          /* This period has no more transitions; erase the prospective entry
-           * from @transitions. */
-          g_array_set_size (transitions, transitions->len - 1);
+          next_from_period = lookup_period_usec (self, next_transition_usec, TRUE);
+          next_to_period = lookup_period_usec (self, next_transition_usec, FALSE);
         }
     }
 
-  /* Is @transitions empty? */
-  if (transitions->len == 0)
-    goto done;
-
-  /* Sort the transitions. */
-  g_array_sort (transitions, (GCompareFunc) transition_data_sort);
-
-  /* All the transitions in @transitions are guaranteed to be equal to or later
-   * than @after. So far, the @next_transition_data only contains *one* of the
-   * periods which the transition enters/leaves. Now we need to work out what
-   * the other period is. It may be %NULL. */
-  const TransitionData *next_transition_data =
-      &g_array_index (transitions, TransitionData, 0);
-  g_assert (g_date_time_compare (after, next_transition_data->when) < 0);
-
-  switch (next_transition_data->type)
-    {
-    case TRANSITION_FROM:
-        {
-          /* In this case, @next_transition_data concerns a transition FROM one
-           * period to another. The #TransitionData.when field is the end
-           * date/time of a recurrence of the period given in
-           * #TransitionData.period. Find the following transition. If it’s also
-           * a FROM transition, we have one period nested within another, and
-           * the transition we care about (@next_transition_data) is FROM the
-           * inner to the outer. If it’s a TO transition instead, there could be
-           * several different valid arrangements of periods, and the easiest
-           * way to find the period the transition is going to is by calling
-           * mwt_tariff_lookup_period() for the end of the current one. */
-          const TransitionData *following_transition_data =
-              get_next_transition (transitions, 0, next_transition_data);
-          next_transition = g_date_time_ref (next_transition_data->when);
-          next_from_period = next_transition_data->period;
-          if (following_transition_data != NULL &&
-              following_transition_data->type == TRANSITION_FROM)
-            next_to_period = following_transition_data->period;
-          else
-            next_to_period = mwt_tariff_lookup_period (self, next_transition);
-        }
-      break;
-    case TRANSITION_TO:
-        {
-          next_transition = g_date_time_ref (next_transition_data->when);
-          next_to_period = next_transition_data->period;
-
-          /* In this case, we could have two transitions, FROM and TO, with
-           * @after sitting between them. There could be a period which spans
-           * from before FROM to after TO. To detect this, we’d have to walk
-           * backwards through the list of transitions (potentially needing
-           * to generate new ones), bracketing them, until we found an
-           * unmatched TO transition. It seems easier to do this hack. I am
-           * not happy with this hack, but it does mean saving a lot of code
-           * and testing. The only algorithmically nice fix for this is to
-           * rewrite everything to use an interval tree.
-           * FIXME: Should we put lower bounds on the permitted lengths of periods? */
-          g_autoptr(GDateTime) before_next_transition = g_date_time_add_seconds (next_transition, -1.0);
-          next_from_period = mwt_tariff_lookup_period (self, before_next_transition);
-        }
-      break;
-    default:
-      g_assert_not_reached ();
-    }
+  if (has_next)
+    next_transition = g_date_time_add (boundary_date_time,
+                                       next_transition_usec - boundary_usec);
 
-done:
   g_assert (next_transition != NULL || next_from_period == NULL);
   g_assert (next_transition != NULL || next_to_period == NULL);
   g_assert (next_transition == NULL ||
@@ -758,6 +1330,72 @@ done:
   return g_steal_pointer (&next_transition);
 }
 
+/**
+ * mwt_tariff_get_next_transition_usec:
+ * @self: a #MwtTariff
+ * @after_usec: time to get the next transition after, in microseconds since
+ *    the Unix epoch
+ * @out_next_transition_usec: (out) (optional): return location for the time of
+ *    the next transition, in microseconds since the Unix epoch
+ * @out_from_period: (out) (optional) (nullable) (transfer none): return
+ *    location for the period being transitioned out of
+ * @out_to_period: (out) (optional) (nullable) (transfer none): return location
+ *    for the period being transitioned in to
+ *
+ * Version of mwt_tariff_get_next_transition() which takes and returns times
+ * as microseconds since the Unix epoch. This is suitable for use in hot paths:
+ * it doesn’t allocate memory, unless the tariff contains periods which repeat
+ * monthly or yearly.
+ *
+ * If there are no more transitions after @after_usec, %FALSE is returned,
+ * @out_next_transition_usec is not set, and @out_from_period and
+ * @out_to_period are set to %NULL.
+ *
+ * Returns: %TRUE if there is a next transition, %FALSE otherwise
+ * Since: 0.3.0
+ */
+gboolean
+mwt_tariff_get_next_transition_usec (MwtTariff  *self,
+                                     gint64      after_usec,
+                                     gint64     *out_next_transition_usec,
+                                     MwtPeriod **out_from_period,
+                                     MwtPeriod **out_to_period)
+{
+  g_return_val_if_fail (MWT_IS_TARIFF (self), FALSE);
+
+  gint64 next_transition_usec = 0;
+  MwtPeriod *next_from_period = NULL;
+  MwtPeriod *next_to_period = NULL;
+  GDateTime *boundary_date_time = NULL;
+  gint64 boundary_usec = 0;
+  gboolean retval;
+
+  if (!timeline_get_next_transition (self, after_usec, &retval,
+                                     &next_transition_usec,
+                                     &boundary_date_time, &boundary_usec,
+                                     &next_from_period, &next_to_period))
+    {
+      retval = get_next_transition_usec (self, after_usec, &next_transition_usec,
+                                         NULL, NULL);
+
+      if (retval && (out_from_period != NULL || out_to_period != NULL))
+        {
+          next_from_period = lookup_period_usec (self, next_transition_usec, TRUE);
+          next_to_period = lookup_period_usec (self, next_transition_usec, FALSE);
+        }
+    }
+
+  if (retval && out_next_transition_usec != NULL)
+    *out_next_transition_usec = next_transition_usec;
+
+  if (out_from_period != NULL)
+    *out_from_period = next_from_period;
+  if (out_to_period != NULL)
+    *out_to_period = next_to_period;
+
+  return retval;
+}
+
 /**
  * mwt_tariff_validate_name:
  * @name: (nullable): string to validate
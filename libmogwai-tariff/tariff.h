@@ -65,6 +65,18 @@ GDateTime   *mwt_tariff_get_next_transition (MwtTariff  *self,
                                              MwtPeriod **out_from_period,
                                              MwtPeriod **out_to_period);
 
+MwtPeriod   *mwt_tariff_lookup_period_usec       (MwtTariff  *self,
+                                                  gint64      when_usec);
+gboolean     mwt_tariff_get_next_transition_usec (MwtTariff  *self,
+                                                  gint64      after_usec,
+                                                  gint64     *out_next_transition_usec,
+                                                  MwtPeriod **out_from_period,
+                                                  MwtPeriod **out_to_period);
+
+void         mwt_tariff_set_timeline_horizon (MwtTariff  *self,
+                                              GTimeSpan   horizon);
+GTimeSpan    mwt_tariff_get_timeline_horizon (MwtTariff  *self);
+
 gboolean     mwt_tariff_validate_name    (const gchar  *name);
 
 G_END_DECLS
@@ -866,6 +866,125 @@ test_period_contains_time_overflow (void)
   g_assert_null (out_end2);
 }
 
+/* Test that recurrences of periods with a base time over a year in the past,
+ * which are calculated directly rather than by stepping through them, match
+ * those calculated by repeatedly adding to the base time. Use a time zone with
+ * DST so that some recurrences are empty. */
+static void
+test_period_contains_time_distant (void)
+{
+  g_autoptr(GTimeZone) tz = time_zone_new ("Europe/London");
+  const struct
+    {
+      MwtPeriodRepeatType repeat_type;
+      guint repeat_period;
+      gint start_hour;
+      gint start_minute;
+      gint end_hour;
+      gint end_minute;
+    }
+  periods[] =
+    {
+      { MWT_PERIOD_REPEAT_HOUR, 1, 1, 0, 1, 20 },
+      { MWT_PERIOD_REPEAT_HOUR, 5, 1, 0, 3, 0 },
+      { MWT_PERIOD_REPEAT_DAY, 1, 1, 0, 2, 0 },
+      { MWT_PERIOD_REPEAT_DAY, 1, 1, 15, 1, 45 },
+      { MWT_PERIOD_REPEAT_DAY, 3, 0, 30, 4, 0 },
+      { MWT_PERIOD_REPEAT_WEEK, 1, 1, 0, 2, 0 },
+    };
+
+  for (gsize i = 0; i < G_N_ELEMENTS (periods); i++)
+    {
+      g_autoptr(GDateTime) start =
+          g_date_time_new (tz, 2017, 1, 2, periods[i].start_hour, periods[i].start_minute, 0.0);
+      g_autoptr(GDateTime) end =
+          g_date_time_new (tz, 2017, 1, 2, periods[i].end_hour, periods[i].end_minute, 0.0);
+      g_autoptr(MwtPeriod) period =
+          mwt_period_new (start, end, periods[i].repeat_type, periods[i].repeat_period,
+                          NULL);
+
+      /* Check every 50 minutes across the spring DST transition in 2018. */
+      for (gint j = 0; j < 24 * 60 * 6 / 50; j++)
+        {
+          g_autoptr(GDateTime) when_base = g_date_time_new (tz, 2018, 3, 22, 0, 0, 0.0);
+          g_autoptr(GDateTime) when = g_date_time_add_minutes (when_base, j * 50);
+
+          /* Calculate the expected recurrences the slow way. */
+          g_autoptr(GDateTime) expected_contains_start = NULL;
+          g_autoptr(GDateTime) expected_contains_end = NULL;
+          g_autoptr(GDateTime) expected_next_start = NULL;
+          g_autoptr(GDateTime) expected_next_end = NULL;
+
+          for (gint n = 0; expected_next_start == NULL; n++)
+            {
+              gint addand = n * periods[i].repeat_period;
+              g_autoptr(GDateTime) n_start = NULL;
+              g_autoptr(GDateTime) n_end = NULL;
+
+              switch (periods[i].repeat_type)
+                {
+                case MWT_PERIOD_REPEAT_HOUR:
+                  n_start = g_date_time_add_hours (start, addand);
+                  n_end = g_date_time_add_hours (end, addand);
+                  break;
+                case MWT_PERIOD_REPEAT_DAY:
+                  n_start = g_date_time_add_days (start, addand);
+                  n_end = g_date_time_add_days (end, addand);
+                  break;
+                case MWT_PERIOD_REPEAT_WEEK:
+                  n_start = g_date_time_add_weeks (start, addand);
+                  n_end = g_date_time_add_weeks (end, addand);
+                  break;
+                case MWT_PERIOD_REPEAT_NONE:
+                case MWT_PERIOD_REPEAT_MONTH:
+                case MWT_PERIOD_REPEAT_YEAR:
+                default:
+                  g_assert_not_reached ();
+                }
+
+              if (g_date_time_equal (n_start, n_end))
+                continue;
+
+              if (g_date_time_compare (n_start, when) > 0)
+                {
+                  expected_next_start = g_steal_pointer (&n_start);
+                  expected_next_end = g_steal_pointer (&n_end);
+                }
+              else if (g_date_time_compare (when, n_end) < 0)
+                {
+                  g_clear_pointer (&expected_contains_start, g_date_time_unref);
+                  g_clear_pointer (&expected_contains_end, g_date_time_unref);
+                  expected_contains_start = g_steal_pointer (&n_start);
+                  expected_contains_end = g_steal_pointer (&n_end);
+                }
+            }
+
+          g_autoptr(GDateTime) contains_start = NULL;
+          g_autoptr(GDateTime) contains_end = NULL;
+          g_autoptr(GDateTime) next_start = NULL;
+          g_autoptr(GDateTime) next_end = NULL;
+
+          g_autofree gchar *when_str = g_date_time_format (when, "%FT%T%:::z");
+          g_test_message ("Period %" G_GSIZE_FORMAT ", when %s", i, when_str);
+
+          gboolean contains = mwt_period_contains_time (period, when,
+                                                        &contains_start, &contains_end);
+          g_assert_true (contains == (expected_contains_start != NULL));
+
+          if (contains)
+            {
+              g_assert_true (g_date_time_equal (contains_start, expected_contains_start));
+              g_assert_true (g_date_time_equal (contains_end, expected_contains_end));
+            }
+
+          g_assert_true (mwt_period_get_next_recurrence (period, when,
+                                                         &next_start, &next_end));
+          g_assert_true (g_date_time_equal (next_start, expected_next_start));
+          g_assert_true (g_date_time_equal (next_end, expected_next_end));
+        }
+    }
+}
+
 /* Test that calling mwt_period_next_recurrence() with a %NULL #GDateTime gives
  * the base time for the #MwtPeriod, regardless of whether the period has any
  * recurrences. */
@@ -908,6 +1027,7 @@ main (int    argc,
   g_test_add_func ("/period/properties/defaults", test_period_properties_defaults);
   g_test_add_func ("/period/contains-time", test_period_contains_time);
   g_test_add_func ("/period/contains-time/overflow", test_period_contains_time_overflow);
+  g_test_add_func ("/period/contains-time/distant", test_period_contains_time_distant);
   g_test_add_func ("/period/next-recurrence/first", test_period_next_recurrence_first);
 
   return g_test_run ();
@@ -25,6 +25,7 @@
 #include <glib.h>
 #include <gio/gio.h>
 #include <libmogwai-tariff/tariff-builder.h>
+#include <libmogwai-tariff/tariff-loader.h>
 #include <locale.h>
 
 #include "common.h"
@@ -149,6 +150,135 @@ test_tariff_builder_empty (void)
   g_assert_null (mwt_tariff_builder_get_tariff_as_bytes (builder));
 }
 
+/* Test building a tariff with a lot of periods using
+ * mwt_tariff_builder_add_period_fields(), and check it serialises identically
+ * to one built using mwt_tariff_builder_add_period(), and loads correctly. The
+ * periods are added in reverse order to check they’re sorted. */
+static void
+test_tariff_builder_fields (gconstpointer test_data)
+{
+  guint16 format_version = GPOINTER_TO_UINT (test_data);
+  const guint n_hours = 24 * 7;
+  g_autoptr(GDateTime) outer_start = g_date_time_new_utc (2018, 1, 1, 0, 0, 0);
+  guint64 outer_start_unix = g_date_time_to_unix (outer_start);
+
+  g_autoptr(MwtTariffBuilder) fields_builder = mwt_tariff_builder_new ();
+  g_autoptr(MwtTariffBuilder) period_builder = mwt_tariff_builder_new ();
+
+  mwt_tariff_builder_set_name (fields_builder, "test-tariff");
+  mwt_tariff_builder_set_name (period_builder, "test-tariff");
+  mwt_tariff_builder_set_format_version (fields_builder, format_version);
+  mwt_tariff_builder_set_format_version (period_builder, format_version);
+
+  for (guint i = n_hours; i > 0; i--)
+    {
+      guint64 start_unix = outer_start_unix + (i - 1) * 60 * 60;
+      guint64 end_unix = start_unix + 60 * 60;
+
+      mwt_tariff_builder_add_period_fields (fields_builder,
+                                            start_unix, "UTC", end_unix, "UTC",
+                                            MWT_PERIOD_REPEAT_NONE, 0, i);
+
+      g_autoptr(GDateTime) start = g_date_time_add_hours (outer_start, i - 1);
+      g_autoptr(GDateTime) end = g_date_time_add_hours (outer_start, i);
+      g_autoptr(MwtPeriod) period = mwt_period_new (start, end,
+                                                    MWT_PERIOD_REPEAT_NONE, 0,
+                                                    "capacity-limit", (guint64) i,
+                                                    NULL);
+      mwt_tariff_builder_add_period (period_builder, period);
+    }
+
+  /* And one period containing all the others. */
+  g_autoptr(GDateTime) outer_end = g_date_time_add_hours (outer_start, n_hours);
+  mwt_tariff_builder_add_period_fields (fields_builder,
+                                        outer_start_unix, "UTC",
+                                        outer_start_unix + n_hours * 60 * 60, "UTC",
+                                        MWT_PERIOD_REPEAT_NONE, 0, G_MAXUINT64);
+  g_autoptr(MwtPeriod) outer_period = mwt_period_new (outer_start, outer_end,
+                                                      MWT_PERIOD_REPEAT_NONE, 0,
+                                                      "capacity-limit", G_MAXUINT64,
+                                                      NULL);
+  mwt_tariff_builder_add_period (period_builder, outer_period);
+
+  g_autoptr(GBytes) fields_bytes = mwt_tariff_builder_get_tariff_as_bytes (fields_builder);
+  g_autoptr(GBytes) period_bytes = mwt_tariff_builder_get_tariff_as_bytes (period_builder);
+  g_assert_nonnull (fields_bytes);
+  g_assert_nonnull (period_bytes);
+  g_assert_true (g_bytes_equal (fields_bytes, period_bytes));
+
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(MwtTariffLoader) loader = mwt_tariff_loader_new ();
+  g_assert_true (mwt_tariff_loader_load_from_bytes (loader, fields_bytes, &local_error));
+  g_assert_no_error (local_error);
+
+  MwtTariff *loaded_tariff = mwt_tariff_loader_get_tariff (loader);
+  GPtrArray *loaded_periods = mwt_tariff_get_periods (loaded_tariff);
+  g_assert_cmpuint (loaded_periods->len, ==, n_hours + 1);
+  assert_periods_equal (g_ptr_array_index (loaded_periods, 0), outer_period);
+
+  /* The tariff can also be retrieved as an object. */
+  g_autoptr(MwtTariff) tariff = mwt_tariff_builder_get_tariff (fields_builder);
+  g_assert_nonnull (tariff);
+  g_assert_cmpuint (mwt_tariff_get_periods (tariff)->len, ==, n_hours + 1);
+}
+
+/* Test that invalid periods added with mwt_tariff_builder_add_period_fields()
+ * are rejected when building the tariff. */
+static void
+test_tariff_builder_fields_invalid (void)
+{
+  const struct
+    {
+      guint64 start_unix;
+      const gchar *start_timezone;
+      guint64 end_unix;
+      MwtPeriodRepeatType repeat_type;
+      guint repeat_period;
+    }
+  vectors[] =
+    {
+      /* Ends before it starts. */
+      { 1514772000, "UTC", 1514768400, MWT_PERIOD_REPEAT_NONE, 0 },
+      /* Empty. */
+      { 1514768400, "UTC", 1514768400, MWT_PERIOD_REPEAT_NONE, 0 },
+      /* Out of range. */
+      { 1514768400, "UTC", G_MAXUINT64, MWT_PERIOD_REPEAT_NONE, 0 },
+      /* Inconsistent repeat properties. */
+      { 1514768400, "UTC", 1514772000, MWT_PERIOD_REPEAT_NONE, 1 },
+      { 1514768400, "UTC", 1514772000, MWT_PERIOD_REPEAT_DAY, 0 },
+      /* Partially overlaps the other period. */
+      { 1514766600, "UTC", 1514770200, MWT_PERIOD_REPEAT_NONE, 0 },
+      { 1514766600, "UTC", 1514770200, MWT_PERIOD_REPEAT_DAY, 1 },
+      /* Equal to the other period. */
+      { 1514764800, "UTC", 1514768400, MWT_PERIOD_REPEAT_NONE, 0 },
+    };
+
+  for (gsize i = 0; i < G_N_ELEMENTS (vectors); i++)
+    {
+      g_autoptr(MwtTariffBuilder) builder = mwt_tariff_builder_new ();
+
+      g_test_message ("Vector %" G_GSIZE_FORMAT, i);
+
+      mwt_tariff_builder_set_name (builder, "test-tariff");
+
+      /* 2018-01-01T00:00:00Z to 2018-01-01T01:00:00Z. */
+      mwt_tariff_builder_add_period_fields (builder,
+                                            1514764800, "UTC", 1514768400, "UTC",
+                                            MWT_PERIOD_REPEAT_NONE, 0, G_MAXUINT64);
+      mwt_tariff_builder_add_period_fields (builder,
+                                            vectors[i].start_unix,
+                                            vectors[i].start_timezone,
+                                            vectors[i].end_unix,
+                                            vectors[i].start_timezone,
+                                            vectors[i].repeat_type,
+                                            vectors[i].repeat_period,
+                                            G_MAXUINT64);
+
+      g_assert_null (mwt_tariff_builder_get_tariff_as_bytes (builder));
+      g_assert_null (mwt_tariff_builder_get_tariff (builder));
+    }
+}
+
 int
 main (int    argc,
       char **argv)
@@ -160,6 +290,11 @@ main (int    argc,
   g_test_add_func ("/tariff-builder/reset/partial", test_tariff_builder_reset_partial);
   g_test_add_func ("/tariff-builder/simple", test_tariff_builder_simple);
   g_test_add_func ("/tariff-builder/empty", test_tariff_builder_empty);
+  g_test_add_data_func ("/tariff-builder/fields/v2",
+                        GUINT_TO_POINTER (2), test_tariff_builder_fields);
+  g_test_add_data_func ("/tariff-builder/fields/v3",
+                        GUINT_TO_POINTER (3), test_tariff_builder_fields);
+  g_test_add_func ("/tariff-builder/fields/invalid", test_tariff_builder_fields_invalid);
 
   return g_test_run ();
 }
@@ -23,6 +23,7 @@
 #include "config.h"
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <gio/gio.h>
 #include <libmogwai-tariff/tariff-loader.h>
 #include <locale.h>
@@ -124,6 +125,14 @@ test_tariff_loader_errors_variant (void)
       "('Mogwai tariff', @q 0, <@(sa(ttssqut)) ('a', [(0, 1, 'UTC', 'UTC', 0, 0, 0)])>)",
       /* Invalid magic */
       "('not magic', @q 2, <@(sa(ttssqut)) ('a', [(0, 1, 'UTC', 'UTC', 0, 0, 0)])>)",
+      /* Version 3 with the wrong inner type */
+      "('Mogwai tariff', @q 3, <@(sa(ttssqut)) ('a', [(0, 1, 'UTC', 'UTC', 0, 0, 0)])>)",
+      /* Version 3 with an out of range time zone index */
+      "('Mogwai tariff', @q 3, <@(sasa(ttqqqut)at) ('a', ['UTC'], [(0, 1, 0, 1, 0, 0, 0)], [0, 1])>)",
+      /* Version 3 with an unsorted transition index */
+      "('Mogwai tariff', @q 3, <@(sasa(ttqqqut)at) ('a', ['UTC'], [(0, 1, 0, 0, 0, 0, 0)], [1, 0])>)",
+      /* Version 3 with a period missing from the transition index */
+      "('Mogwai tariff', @q 3, <@(sasa(ttqqqut)at) ('a', ['UTC'], [(0, 1, 0, 0, 0, 0, 0)], [0])>)",
       /* Invalid outer type */
       "('hello there', @q 1)",
       "'boo'",
@@ -204,6 +213,51 @@ test_tariff_loader_simple_bytes (void)
   g_assert_cmpuint (mwt_period_get_capacity_limit (period2), ==, G_MAXUINT64);
 }
 
+/* Test loading a simple tariff from a file works, and that errors from
+ * mapping the file are reported.
+ * Note: These bytes are in version 1 format. */
+static void
+test_tariff_loader_simple_file (void)
+{
+  const guint8 *data =
+    (const guint8 *) "\x4d\x6f\x67\x77\x61\x69\x20\x74\x61\x72\x69\x66\x66\x00"
+                     "\x01\x00\x74\x65\x73\x74\x2d\x74\x61\x72\x69\x66\x66\x00"
+                     "\x00\x00\x00\x00\x00\x7a\x49\x5a\x00\x00\x00\x00\x80\x58"
+                     "\x72\x5a\x00\x00\x00\x00\x04\x00\x00\x00\x01\x00\x00\x00"
+                     "\x00\x94\x35\x77\x00\x00\x00\x00\x80\x11\x50\x5a\x00\x00"
+                     "\x00\x00\x80\xb4\x52\x5a\x00\x00\x00\x00\x03\x00\x00\x00"
+                     "\x01\x00\x00\x00\xff\xff\xff\xff\xff\xff\xff\xff\x0c\x00"
+                     "\x28\x73\x61\x28\x74\x74\x71\x75\x74\x29\x29\x0e";
+  const gsize len = 110;
+
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *tmp_dir = g_dir_make_tmp ("mogwai-tariff-loader-XXXXXX", &error);
+  g_assert_no_error (error);
+  g_autofree gchar *path = g_build_filename (tmp_dir, "tariff", NULL);
+
+  g_file_set_contents (path, (const gchar *) data, len, &error);
+  g_assert_no_error (error);
+
+  g_autoptr(MwtTariffLoader) loader = mwt_tariff_loader_new ();
+  gboolean retval = mwt_tariff_loader_load_from_file (loader, path, &error);
+  g_assert_no_error (error);
+  g_assert_true (retval);
+
+  MwtTariff *tariff = mwt_tariff_loader_get_tariff (loader);
+  g_assert_true (MWT_IS_TARIFF (tariff));
+  g_assert_cmpstr (mwt_tariff_get_name (tariff), ==, "test-tariff");
+  g_assert_cmpuint (mwt_tariff_get_periods (tariff)->len, ==, 2);
+
+  g_assert_cmpint (g_unlink (path), ==, 0);
+  g_assert_cmpint (g_rmdir (tmp_dir), ==, 0);
+
+  /* Now the file doesn’t exist. */
+  retval = mwt_tariff_loader_load_from_file (loader, path, &error);
+  g_assert_error (error, G_FILE_ERROR, G_FILE_ERROR_NOENT);
+  g_assert_false (retval);
+  g_assert_null (mwt_tariff_loader_get_tariff (loader));
+}
+
 /* Test loading a simple tariff from a serialised #GVariant works. It’s not a
  * very exciting tariff. */
 static void
@@ -244,6 +298,51 @@ test_tariff_loader_simple_variant (void)
   g_assert_cmpuint (mwt_period_get_capacity_limit (period1), ==, 0);
 }
 
+/* Test that time zones are shared between periods and between loads of
+ * tariffs, rather than being loaded from disk each time. */
+static void
+test_tariff_loader_time_zones_shared (void)
+{
+  const gchar *tariff_str =
+      "('Mogwai tariff', @q 2, <@(sa(ttssqut)) ('test-tariff', ["
+      "(1514764800, 1517443200, 'Europe/London', 'Europe/London', 4, 1, 0),"
+      "(1515196800, 1515369600, 'Europe/London', 'America/Atka', 3, 1, 0)"
+      "])>)";
+
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GVariant) variant = g_variant_parse (NULL, tariff_str, NULL, NULL,
+                                                 &local_error);
+  g_assert_no_error (local_error);
+
+  g_autoptr(MwtTariffLoader) loader1 = mwt_tariff_loader_new ();
+  g_autoptr(MwtTariffLoader) loader2 = mwt_tariff_loader_new ();
+
+  gboolean retval = mwt_tariff_loader_load_from_variant (loader1, variant, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_true (retval);
+
+  retval = mwt_tariff_loader_load_from_variant (loader2, variant, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_true (retval);
+
+  GPtrArray *periods1 = mwt_tariff_get_periods (mwt_tariff_loader_get_tariff (loader1));
+  GPtrArray *periods2 = mwt_tariff_get_periods (mwt_tariff_loader_get_tariff (loader2));
+  g_assert_cmpuint (periods1->len, ==, 2);
+  g_assert_cmpuint (periods2->len, ==, 2);
+
+  GTimeZone *london_tz = g_date_time_get_timezone (mwt_period_get_start (periods1->pdata[0]));
+  g_assert_cmpstr (g_time_zone_get_identifier (london_tz), ==, "Europe/London");
+
+  g_assert_true (g_date_time_get_timezone (mwt_period_get_end (periods1->pdata[0])) == london_tz);
+  g_assert_true (g_date_time_get_timezone (mwt_period_get_start (periods1->pdata[1])) == london_tz);
+  g_assert_true (g_date_time_get_timezone (mwt_period_get_start (periods2->pdata[0])) == london_tz);
+  g_assert_true (g_date_time_get_timezone (mwt_period_get_start (periods2->pdata[1])) == london_tz);
+
+  GTimeZone *atka_tz = g_date_time_get_timezone (mwt_period_get_end (periods1->pdata[1]));
+  g_assert_cmpstr (g_time_zone_get_identifier (atka_tz), ==, "America/Atka");
+  g_assert_true (g_date_time_get_timezone (mwt_period_get_end (periods2->pdata[1])) == atka_tz);
+}
+
 /* Test that loading a tariff with no periods fails gracefully.
  * Note: These bytes are in version 1 format. */
 static void
@@ -304,6 +403,9 @@ main (int    argc,
   g_test_add_func ("/tariff-loader/errors/variant", test_tariff_loader_errors_variant);
   g_test_add_func ("/tariff-loader/simple/bytes", test_tariff_loader_simple_bytes);
   g_test_add_func ("/tariff-loader/simple/variant", test_tariff_loader_simple_variant);
+  g_test_add_func ("/tariff-loader/simple/file", test_tariff_loader_simple_file);
+  g_test_add_func ("/tariff-loader/time-zones/shared",
+                   test_tariff_loader_time_zones_shared);
   g_test_add_func ("/tariff-loader/empty", test_tariff_loader_empty);
   g_test_add_func ("/tariff-loader/empty/byteswapped",
                    test_tariff_loader_empty_byteswapped);
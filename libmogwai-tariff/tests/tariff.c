@@ -44,6 +44,13 @@ time_zone_new (const gchar *tz_str)
 #endif
 }
 
+static gint64
+date_time_to_usec (GDateTime *date_time)
+{
+  return (g_date_time_to_unix (date_time) * G_USEC_PER_SEC +
+          g_date_time_get_microsecond (date_time));
+}
+
 /* Test the GObject properties on a tariff. */
 static void
 test_tariff_properties (void)
@@ -75,6 +82,88 @@ test_tariff_properties (void)
   g_assert_cmpuint (actual_periods2->len, ==, 1);
 }
 
+/* Test mwt_tariff_validate() accepts periods which are disjoint or nested, and
+ * rejects periods which partially overlap or are equal, including when only
+ * their recurrences do so. */
+static void
+test_tariff_validate_overlap (void)
+{
+  const struct
+    {
+      /* Two periods, each given as hours relative to 2018-01-01T00:00:00Z.
+       * They must be in the order required by mwt_tariff_validate(). */
+      struct
+        {
+          gint start_hours;
+          gint end_hours;
+          MwtPeriodRepeatType repeat_type;
+          guint repeat_period;
+        }
+      periods[2];
+      gboolean expected_valid;
+    }
+  vectors[] =
+    {
+      /* Disjoint. */
+      { { { 0, 2, MWT_PERIOD_REPEAT_NONE, 0 }, { 3, 4, MWT_PERIOD_REPEAT_NONE, 0 } }, TRUE },
+      /* Adjacent. */
+      { { { 0, 2, MWT_PERIOD_REPEAT_NONE, 0 }, { 2, 3, MWT_PERIOD_REPEAT_NONE, 0 } }, TRUE },
+      /* Nested. */
+      { { { 0, 48, MWT_PERIOD_REPEAT_NONE, 0 }, { 0, 1, MWT_PERIOD_REPEAT_NONE, 0 } }, TRUE },
+      { { { 0, 48, MWT_PERIOD_REPEAT_NONE, 0 }, { 47, 48, MWT_PERIOD_REPEAT_NONE, 0 } }, TRUE },
+      /* Partially overlapping. */
+      { { { 0, 3, MWT_PERIOD_REPEAT_NONE, 0 }, { 2, 4, MWT_PERIOD_REPEAT_NONE, 0 } }, FALSE },
+      /* Nested, and all the recurrences are nested too. */
+      { { { 0, 48, MWT_PERIOD_REPEAT_NONE, 0 }, { 1, 2, MWT_PERIOD_REPEAT_DAY, 1 } }, TRUE },
+      { { { 0, 24, MWT_PERIOD_REPEAT_DAY, 1 }, { 22, 23, MWT_PERIOD_REPEAT_DAY, 1 } }, TRUE },
+      /* Nested, but a later recurrence partially overlaps the end. */
+      { { { 0, 48, MWT_PERIOD_REPEAT_NONE, 0 }, { 22, 26, MWT_PERIOD_REPEAT_DAY, 1 } }, FALSE },
+      /* Nested, but a later recurrence partially overlaps a recurrence of the
+       * other period. */
+      { { { 0, 24, MWT_PERIOD_REPEAT_DAY, 2 }, { 10, 14, MWT_PERIOD_REPEAT_HOUR, 36 } }, FALSE },
+      /* Equal spans, but at different times. */
+      { { { 0, 1, MWT_PERIOD_REPEAT_NONE, 0 }, { 24, 25, MWT_PERIOD_REPEAT_NONE, 0 } }, TRUE },
+      /* Equal spans at different times, but one recurs onto the other. */
+      { { { 0, 1, MWT_PERIOD_REPEAT_DAY, 1 }, { 24, 25, MWT_PERIOD_REPEAT_NONE, 0 } }, FALSE },
+      { { { 0, 1, MWT_PERIOD_REPEAT_DAY, 2 }, { 24, 25, MWT_PERIOD_REPEAT_DAY, 2 } }, TRUE },
+      { { { 0, 1, MWT_PERIOD_REPEAT_DAY, 2 }, { 48, 49, MWT_PERIOD_REPEAT_DAY, 2 } }, FALSE },
+    };
+
+  g_autoptr(GDateTime) base = g_date_time_new_utc (2018, 1, 1, 0, 0, 0);
+
+  for (gsize i = 0; i < G_N_ELEMENTS (vectors); i++)
+    {
+      g_autoptr(GPtrArray) periods = g_ptr_array_new_with_free_func (g_object_unref);
+      g_autoptr(GError) local_error = NULL;
+
+      g_test_message ("Vector %" G_GSIZE_FORMAT, i);
+
+      for (gsize j = 0; j < G_N_ELEMENTS (vectors[i].periods); j++)
+        {
+          g_autoptr(GDateTime) start = g_date_time_add_hours (base, vectors[i].periods[j].start_hours);
+          g_autoptr(GDateTime) end = g_date_time_add_hours (base, vectors[i].periods[j].end_hours);
+
+          g_ptr_array_add (periods, mwt_period_new (start, end,
+                                                    vectors[i].periods[j].repeat_type,
+                                                    vectors[i].periods[j].repeat_period,
+                                                    NULL));
+        }
+
+      gboolean valid = mwt_tariff_validate ("name", periods, &local_error);
+
+      if (vectors[i].expected_valid)
+        {
+          g_assert_no_error (local_error);
+          g_assert_true (valid);
+        }
+      else
+        {
+          g_assert_error (local_error, MWT_TARIFF_ERROR, MWT_TARIFF_ERROR_INVALID);
+          g_assert_false (valid);
+        }
+    }
+}
+
 /* Test mwt_tariff_lookup_period() with various dates/times for a generic
  * tariff. */
 static void
@@ -137,6 +226,8 @@ test_tariff_lookup (void)
           g_date_time_new_utc (vectors[i].year, vectors[i].month, vectors[i].day,
                                vectors[i].hour, vectors[i].minute, vectors[i].seconds);
       MwtPeriod *lookup_period = mwt_tariff_lookup_period (tariff, lookup_date);
+      g_assert_true (mwt_tariff_lookup_period_usec (tariff, date_time_to_usec (lookup_date)) ==
+                     lookup_period);
       if (vectors[i].expected_period == NULL)
         {
           g_assert_null (lookup_period);
@@ -149,6 +240,67 @@ test_tariff_lookup (void)
     }
 }
 
+/* Test mwt_tariff_lookup_period() and mwt_tariff_get_next_transition() on a
+ * tariff with a lot of non-recurring periods, as would be used for hourly
+ * pricing. This exercises the index built over the periods. */
+static void
+test_tariff_lookup_many_periods (void)
+{
+  g_autoptr(GPtrArray) periods = g_ptr_array_new_with_free_func (g_object_unref);
+  const guint n_hours = 24 * 28;
+
+  /* One period covering four weeks, with a one-hour period nested inside it
+   * for every other hour. */
+  g_autoptr(GDateTime) outer_start = g_date_time_new_utc (2018, 2, 1, 0, 0, 0);
+  g_autoptr(GDateTime) outer_end = g_date_time_add_hours (outer_start, n_hours);
+  g_ptr_array_add (periods, mwt_period_new (outer_start, outer_end,
+                                            MWT_PERIOD_REPEAT_NONE, 0,
+                                            NULL));
+
+  for (guint i = 0; i < n_hours; i += 2)
+    {
+      g_autoptr(GDateTime) start = g_date_time_add_hours (outer_start, i);
+      g_autoptr(GDateTime) end = g_date_time_add_hours (outer_start, i + 1);
+      g_ptr_array_add (periods, mwt_period_new (start, end,
+                                                MWT_PERIOD_REPEAT_NONE, 0,
+                                                "capacity-limit", (guint64) i,
+                                                NULL));
+    }
+
+  g_autoptr(MwtTariff) tariff = mwt_tariff_new ("name", periods);
+  MwtPeriod *outer_period = g_ptr_array_index (periods, 0);
+
+  for (guint i = 0; i < n_hours; i++)
+    {
+      /* Which period is expected to cover the hour starting at @i? */
+      MwtPeriod *hour_period = (i % 2 == 0) ? g_ptr_array_index (periods, i / 2 + 1) : outer_period;
+      MwtPeriod *next_hour_period =
+          (i + 1 == n_hours) ? NULL :
+          ((i + 1) % 2 == 0) ? g_ptr_array_index (periods, (i + 1) / 2 + 1) : outer_period;
+
+      g_test_message ("Hour %u", i);
+
+      g_autoptr(GDateTime) hour_start = g_date_time_add_hours (outer_start, i);
+      g_autoptr(GDateTime) hour_middle = g_date_time_add_minutes (hour_start, 30);
+      g_autoptr(GDateTime) hour_end = g_date_time_add_hours (hour_start, 1);
+
+      g_assert_true (mwt_tariff_lookup_period (tariff, hour_start) == hour_period);
+      g_assert_true (mwt_tariff_lookup_period (tariff, hour_middle) == hour_period);
+
+      g_autoptr(GDateTime) next = NULL;
+      MwtPeriod *from_period = NULL, *to_period = NULL;
+      next = mwt_tariff_get_next_transition (tariff, hour_middle,
+                                             &from_period, &to_period);
+
+      g_assert_nonnull (next);
+      g_assert_true (g_date_time_equal (next, hour_end));
+      g_assert_true (from_period == hour_period);
+      g_assert_true (to_period == next_hour_period);
+    }
+
+  g_assert_null (mwt_tariff_lookup_period (tariff, outer_end));
+}
+
 /* Test getting the next transition using mwt_tariff_get_next_transition(), and
  * check that it’s calculated correctly, and returns the correct to/from periods
  * for a variety of tariffs and date/times. */
@@ -548,6 +700,19 @@ test_tariff_next_transition (void)
           g_assert_null (to_period);
         }
 
+      /* Check the compiled tariff gives the same result. */
+      gint64 next_usec = 0;
+      MwtPeriod *from_period_usec = NULL, *to_period_usec = NULL;
+      gboolean has_next_usec =
+          mwt_tariff_get_next_transition_usec (vectors[i].tariff, date_time_to_usec (after),
+                                               &next_usec, &from_period_usec, &to_period_usec);
+
+      g_assert_true (has_next_usec == (expected_next != NULL));
+      if (has_next_usec)
+        g_assert_cmpint (next_usec, ==, date_time_to_usec (expected_next));
+      g_assert_true (from_period_usec == from_period);
+      g_assert_true (to_period_usec == to_period);
+
       /* Test calling with (@after == NULL). */
       if (vectors[i].expected_next_is_first)
         {
@@ -578,17 +743,137 @@ test_tariff_next_transition (void)
   g_assert_true (to_period == period3a);
 }
 
+/* Check that lookups and next transitions from @tariff, which has a timeline
+ * enabled, match those from @reference, which doesn’t, at @when_usec. */
+static void
+assert_timeline_matches (MwtTariff *tariff,
+                         MwtTariff *reference,
+                         gint64     when_usec)
+{
+  gint64 next_usec = 0, expected_next_usec = 0;
+  MwtPeriod *from_period = NULL, *to_period = NULL;
+  MwtPeriod *expected_from_period = NULL, *expected_to_period = NULL;
+  gboolean has_next, expected_has_next;
+
+  /* The two tariffs are built from the same #MwtPeriod instances, so periods
+   * can be compared by pointer. */
+  g_assert_true (mwt_tariff_lookup_period_usec (tariff, when_usec) ==
+                 mwt_tariff_lookup_period_usec (reference, when_usec));
+
+  has_next = mwt_tariff_get_next_transition_usec (tariff, when_usec, &next_usec,
+                                                  &from_period, &to_period);
+  expected_has_next = mwt_tariff_get_next_transition_usec (reference, when_usec,
+                                                           &expected_next_usec,
+                                                           &expected_from_period,
+                                                           &expected_to_period);
+  g_assert_cmpint (has_next, ==, expected_has_next);
+  if (has_next)
+    g_assert_cmpint (next_usec, ==, expected_next_usec);
+  g_assert_true (from_period == expected_from_period);
+  g_assert_true (to_period == expected_to_period);
+
+  /* And the #GDateTime version, which has to convert time zones. */
+  g_autoptr(GDateTime) when = g_date_time_new_from_unix_utc (when_usec / G_USEC_PER_SEC);
+  g_autoptr(GDateTime) next = NULL, expected_next = NULL;
+  next = mwt_tariff_get_next_transition (tariff, when, NULL, NULL);
+  expected_next = mwt_tariff_get_next_transition (reference, when, NULL, NULL);
+
+  g_assert_true ((next == NULL) == (expected_next == NULL));
+  if (next != NULL)
+    {
+      g_assert_true (g_date_time_equal (next, expected_next));
+      g_assert_cmpstr (g_date_time_get_timezone_abbreviation (next), ==,
+                       g_date_time_get_timezone_abbreviation (expected_next));
+    }
+}
+
+/* Test that the materialised timeline from mwt_tariff_set_timeline_horizon()
+ * gives the same results as calculating everything from scratch, as it slides
+ * forwards, and when queries jump backwards, or past its end. */
+static void
+test_tariff_timeline (void)
+{
+  g_autoptr(GPtrArray) periods = g_ptr_array_new_with_free_func (g_object_unref);
+  g_autoptr(GTimeZone) tz = time_zone_new ("Europe/London");
+
+  /* A year-long period, with a daily period nested inside it, and a weekly
+   * period which doesn’t overlap the daily one. The year-long period is in a
+   * different time zone, to check that transitions keep their time zone. */
+  g_autoptr(GDateTime) year_start = g_date_time_new (tz, 2018, 1, 1, 0, 0, 0);
+  g_autoptr(GDateTime) year_end = g_date_time_new (tz, 2019, 1, 1, 0, 0, 0);
+  g_autoptr(GDateTime) day_start = g_date_time_new_utc (2018, 1, 1, 0, 0, 0);
+  g_autoptr(GDateTime) day_end = g_date_time_new_utc (2018, 1, 1, 6, 0, 0);
+  g_autoptr(GDateTime) week_start = g_date_time_new_utc (2018, 1, 1, 8, 0, 0);
+  g_autoptr(GDateTime) week_end = g_date_time_new_utc (2018, 1, 1, 10, 0, 0);
+
+  g_ptr_array_add (periods, mwt_period_new (year_start, year_end,
+                                            MWT_PERIOD_REPEAT_NONE, 0, NULL));
+  g_ptr_array_add (periods, mwt_period_new (day_start, day_end,
+                                            MWT_PERIOD_REPEAT_DAY, 1, NULL));
+  g_ptr_array_add (periods, mwt_period_new (week_start, week_end,
+                                            MWT_PERIOD_REPEAT_WEEK, 1, NULL));
+
+  g_autoptr(MwtTariff) reference = mwt_tariff_new ("name", periods);
+  g_autoptr(MwtTariff) tariff = mwt_tariff_new ("name", periods);
+
+  g_assert_cmpint (mwt_tariff_get_timeline_horizon (tariff), ==, 0);
+  mwt_tariff_set_timeline_horizon (tariff, 2 * G_TIME_SPAN_DAY);
+  g_assert_cmpint (mwt_tariff_get_timeline_horizon (tariff), ==, 2 * G_TIME_SPAN_DAY);
+
+  /* Move forwards through a few weeks, so the timeline slides several times,
+   * checking the transitions themselves too. */
+  gint64 start_usec = date_time_to_usec (year_start);
+  gint64 when_usec;
+
+  for (when_usec = start_usec;
+       when_usec < start_usec + 21 * G_TIME_SPAN_DAY;
+       when_usec += 37 * G_TIME_SPAN_MINUTE)
+    {
+      assert_timeline_matches (tariff, reference, when_usec);
+      assert_timeline_matches (tariff, reference, when_usec + 2 * G_TIME_SPAN_HOUR);
+    }
+
+  /* Jump backwards, and forwards past the end of the timeline. */
+  assert_timeline_matches (tariff, reference, start_usec + G_TIME_SPAN_HOUR);
+  assert_timeline_matches (tariff, reference, start_usec + 100 * G_TIME_SPAN_DAY);
+  assert_timeline_matches (tariff, reference, start_usec + 100 * G_TIME_SPAN_DAY + 1);
+
+  /* Around and after the end of the tariff, where there are no more
+   * transitions. */
+  gint64 end_usec = date_time_to_usec (year_end);
+  assert_timeline_matches (tariff, reference, end_usec - 3 * G_TIME_SPAN_DAY);
+  assert_timeline_matches (tariff, reference, end_usec - 1);
+  assert_timeline_matches (tariff, reference, end_usec);
+  assert_timeline_matches (tariff, reference, end_usec + G_TIME_SPAN_DAY);
+
+  /* Disabling the timeline should work too. */
+  mwt_tariff_set_timeline_horizon (tariff, 0);
+  assert_timeline_matches (tariff, reference, start_usec + G_TIME_SPAN_HOUR);
+
+  /* The timeline is never enabled for tariffs without recurring periods. */
+  g_autoptr(GPtrArray) periods2 = g_ptr_array_new_with_free_func (NULL);
+  g_ptr_array_add (periods2, g_ptr_array_index (periods, 0));
+  g_autoptr(MwtTariff) tariff2 = mwt_tariff_new ("name", periods2);
+  mwt_tariff_set_timeline_horizon (tariff2, G_TIME_SPAN_DAY);
+  g_assert_cmpint (mwt_tariff_get_timeline_horizon (tariff2), ==, 0);
+}
+
 /* Test that serialising a tariff with #MwtTariffBuilder, then loading it with
- * #MwtTariffLoader, gives an identical tariff to the original one. Particularly,
- * we care that the timezones have not changed. */
+ * #MwtTariffLoader, gives an identical tariff to the original one, in the file
+ * format version given by @test_data (or the default version if that’s zero),
+ * and in both byte orders. Particularly, we care that the timezones have not
+ * changed. */
 static void
-test_tariff_serialisation_roundtrip (void)
+test_tariff_serialisation_roundtrip (gconstpointer test_data)
 {
+  guint16 format_version = GPOINTER_TO_UINT (test_data);
   g_autoptr(MwtTariffBuilder) builder = NULL;
 
   /* Build the tariff. */
   builder = mwt_tariff_builder_new ();
   mwt_tariff_builder_set_name (builder, "test-tariff");
+  if (format_version != 0)
+    mwt_tariff_builder_set_format_version (builder, format_version);
 
   /* Period 1. */
   g_autoptr(GTimeZone) start1_tz = time_zone_new ("Europe/London");
@@ -612,6 +897,16 @@ test_tariff_serialisation_roundtrip (void)
                             NULL);
   mwt_tariff_builder_add_period (builder, period2);
 
+  /* Period 3. This is non-recurring, and shares a timezone with period 1. */
+  g_autoptr(GDateTime) start3 = g_date_time_new (start1_tz, 2018, 1, 2, 0, 0, 0);
+  g_autoptr(GDateTime) end3 = g_date_time_new (start1_tz, 2018, 1, 3, 0, 0, 0);
+
+  g_autoptr(MwtPeriod) period3 = NULL;
+  period3 = mwt_period_new (start3, end3, MWT_PERIOD_REPEAT_NONE, 0,
+                            "capacity-limit", G_GUINT64_CONSTANT (0),
+                            NULL);
+  mwt_tariff_builder_add_period (builder, period3);
+
   /* Finish building the tariff and get it in variant form. */
   g_autoptr(MwtTariff) built_tariff = NULL;
   built_tariff = mwt_tariff_builder_get_tariff (builder);
@@ -619,30 +914,42 @@ test_tariff_serialisation_roundtrip (void)
   g_autoptr(GVariant) variant = NULL;
   variant = mwt_tariff_builder_get_tariff_as_variant (builder);
 
-  /* Load it again. */
-  g_autoptr(MwtTariffLoader) loader = mwt_tariff_loader_new ();
-  g_autoptr(GError) local_error = NULL;
+  guint16 variant_format_version;
+  g_variant_get (variant, "(&sqv)", NULL, &variant_format_version, NULL);
+  g_assert_cmpuint (variant_format_version, ==,
+                    (format_version != 0) ? format_version : 2);
+
+  g_autoptr(GVariant) variant_swapped = g_variant_byteswap (variant);
+  GVariant *variants[] = { variant, variant_swapped };
 
-  gboolean retval = mwt_tariff_loader_load_from_variant (loader, variant, &local_error);
-  g_assert_no_error (local_error);
-  g_assert_true (retval);
+  for (gsize j = 0; j < G_N_ELEMENTS (variants); j++)
+    {
+      /* Load it again. */
+      g_autoptr(MwtTariffLoader) loader = mwt_tariff_loader_new ();
+      g_autoptr(GError) local_error = NULL;
 
-  MwtTariff *loaded_tariff = mwt_tariff_loader_get_tariff (loader);
+      gboolean retval = mwt_tariff_loader_load_from_variant (loader, variants[j],
+                                                             &local_error);
+      g_assert_no_error (local_error);
+      g_assert_true (retval);
 
-  /* Check properties. */
-  g_assert_cmpstr (mwt_tariff_get_name (loaded_tariff), ==,
-                   mwt_tariff_get_name (built_tariff));
+      MwtTariff *loaded_tariff = mwt_tariff_loader_get_tariff (loader);
 
-  GPtrArray *built_periods = mwt_tariff_get_periods (built_tariff);
-  GPtrArray *loaded_periods = mwt_tariff_get_periods (loaded_tariff);
-  g_assert_cmpuint (loaded_periods->len, ==, built_periods->len);
+      /* Check properties. */
+      g_assert_cmpstr (mwt_tariff_get_name (loaded_tariff), ==,
+                       mwt_tariff_get_name (built_tariff));
 
-  for (gsize i = 0; i < loaded_periods->len; i++)
-    {
-      MwtPeriod *built_period = g_ptr_array_index (built_periods, i);
-      MwtPeriod *loaded_period = g_ptr_array_index (loaded_periods, i);
+      GPtrArray *built_periods = mwt_tariff_get_periods (built_tariff);
+      GPtrArray *loaded_periods = mwt_tariff_get_periods (loaded_tariff);
+      g_assert_cmpuint (loaded_periods->len, ==, built_periods->len);
 
-      assert_periods_equal (loaded_period, built_period);
+      for (gsize i = 0; i < loaded_periods->len; i++)
+        {
+          MwtPeriod *built_period = g_ptr_array_index (built_periods, i);
+          MwtPeriod *loaded_period = g_ptr_array_index (loaded_periods, i);
+
+          assert_periods_equal (loaded_period, built_period);
+        }
     }
 }
 
@@ -654,9 +961,17 @@ main (int    argc,
   g_test_init (&argc, &argv, NULL);
 
   g_test_add_func ("/tariff/properties", test_tariff_properties);
+  g_test_add_func ("/tariff/validate/overlap", test_tariff_validate_overlap);
   g_test_add_func ("/tariff/lookup", test_tariff_lookup);
+  g_test_add_func ("/tariff/lookup/many-periods", test_tariff_lookup_many_periods);
   g_test_add_func ("/tariff/next-transition", test_tariff_next_transition);
-  g_test_add_func ("/tariff/serialisation/roundtrip", test_tariff_serialisation_roundtrip);
+  g_test_add_func ("/tariff/timeline", test_tariff_timeline);
+  g_test_add_data_func ("/tariff/serialisation/roundtrip",
+                        GUINT_TO_POINTER (0), test_tariff_serialisation_roundtrip);
+  g_test_add_data_func ("/tariff/serialisation/roundtrip/v2",
+                        GUINT_TO_POINTER (2), test_tariff_serialisation_roundtrip);
+  g_test_add_data_func ("/tariff/serialisation/roundtrip/v3",
+                        GUINT_TO_POINTER (3), test_tariff_serialisation_roundtrip);
 
   return g_test_run ();
 }
@@ -0,0 +1,244 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+
+#include "config.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <libmogwai-tariff/time-zone-cache-private.h>
+#include <string.h>
+#include <sys/stat.h>
+
+
+/* A process-wide table of interned #GTimeZones, keyed by identifier. Loading
+ * a #GTimeZone parses its tzfile from disk, and tariffs tend to use the same
+ * few time zones over and over again, so this keeps a strong reference to
+ * each time zone which has been loaded successfully.
+ *
+ * The table is invalidated per entry when the tzfile for that entry changes
+ * (for example, when the tzdata package is updated), which is detected by
+ * comparing a stat() of the file against the one taken when the entry was
+ * loaded. That is much cheaper than reparsing the file. Identifiers which
+ * don’t correspond to a tzfile (such as ‘UTC’ or POSIX TZ strings) are
+ * stamped as missing, and are reloaded if a file with that name appears.
+ *
+ * The local time zone (identifier ‘’) is not interned, since GLib already
+ * caches it and tracks changes to `TZ`. */
+
+typedef struct
+{
+  gboolean exists;
+  dev_t dev;
+  ino_t ino;
+  goffset size;
+  gint64 mtime;
+} FileStamp;
+
+typedef struct
+{
+  GTimeZone *tz;  /* (owned) */
+  FileStamp stamp;
+} CacheEntry;
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+  g_time_zone_unref (entry->tz);
+  g_free (entry);
+}
+
+G_LOCK_DEFINE_STATIC (time_zone_cache);
+static GHashTable *time_zone_cache = NULL;  /* (owned) (element-type utf8 CacheEntry) (locked-by time_zone_cache) */
+
+/* Get the path of the tzfile which GLib will load for @identifier, following
+ * the same rules as g_time_zone_new_identifier(). */
+static gchar *
+get_tzfile_path (const gchar *identifier)
+{
+  const gchar *tzdir;
+
+  if (g_path_is_absolute (identifier))
+    return g_strdup (identifier);
+
+  tzdir = g_getenv ("TZDIR");
+  if (tzdir == NULL)
+    tzdir = "/usr/share/zoneinfo";
+
+  return g_build_filename (tzdir, identifier, NULL);
+}
+
+static void
+file_stamp_init (FileStamp   *stamp,
+                 const gchar *identifier)
+{
+  g_autofree gchar *path = get_tzfile_path (identifier);
+  GStatBuf buf;
+
+  memset (stamp, 0, sizeof (*stamp));
+
+  if (g_stat (path, &buf) != 0)
+    return;
+
+  stamp->exists = TRUE;
+  stamp->dev = buf.st_dev;
+  stamp->ino = buf.st_ino;
+  stamp->size = buf.st_size;
+  stamp->mtime = buf.st_mtime;
+}
+
+static gboolean
+file_stamp_equal (const FileStamp *a,
+                  const FileStamp *b)
+{
+  if (a->exists != b->exists)
+    return FALSE;
+  if (!a->exists)
+    return TRUE;
+
+  return (a->dev == b->dev &&
+          a->ino == b->ino &&
+          a->size == b->size &&
+          a->mtime == b->mtime);
+}
+
+/* Construct a #GTimeZone for @timezone_identifier (for example,
+ * ‘Europe/London’; note that this is *not* a timezone abbreviation like
+ * ‘AST’). This will return %NULL if the timezone information can’t be
+ * loaded. */
+static GTimeZone *
+time_zone_new_from_identifier (const gchar *timezone_identifier)
+{
+  g_autoptr(GTimeZone) tz = NULL;
+  if (*timezone_identifier == '\0')
+    tz = g_time_zone_new_local ();
+  else
+#if GLIB_CHECK_VERSION(2, 68, 0)
+    tz = g_time_zone_new_identifier (timezone_identifier);
+#else
+    tz = g_time_zone_new (timezone_identifier);
+#endif
+
+#if GLIB_CHECK_VERSION(2, 68, 0)
+  if (tz == NULL)
+    return NULL;
+#endif
+
+  g_debug ("%s: Created timezone ‘%s’ for ‘%s’, with offset %d at interval 0",
+           G_STRFUNC, g_time_zone_get_identifier (tz), timezone_identifier,
+           g_time_zone_get_offset (tz, 0));
+
+#if !GLIB_CHECK_VERSION(2, 68, 0)
+  /* Creating a timezone can’t actually fail, but if we fail to load the
+   * timezone information, the #GTimeZone will just represent UTC. Catch that. */
+  g_assert (tz != NULL);
+  if (!g_str_equal (g_time_zone_get_identifier (tz), timezone_identifier))
+    return NULL;
+#endif
+
+  return g_steal_pointer (&tz);
+}
+
+/**
+ * mwt_time_zone_cache_lookup:
+ * @identifier: a time zone identifier, such as ‘Europe/London’, or ‘’ for
+ *    the local time zone
+ *
+ * Get the #GTimeZone for @identifier, loading it if it’s not already in the
+ * process-wide cache, or if its tzfile has changed since it was loaded.
+ *
+ * This is thread-safe.
+ *
+ * Returns: (transfer full) (nullable): the time zone, or %NULL if it could
+ *    not be loaded
+ * Since: 0.3.0
+ */
+GTimeZone *
+mwt_time_zone_cache_lookup (const gchar *identifier)
+{
+  g_return_val_if_fail (identifier != NULL, NULL);
+
+  if (*identifier == '\0')
+    return time_zone_new_from_identifier (identifier);
+
+  /* Stat the file outside the lock. */
+  FileStamp stamp;
+  file_stamp_init (&stamp, identifier);
+
+  G_LOCK (time_zone_cache);
+
+  if (time_zone_cache == NULL)
+    time_zone_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                             g_free,
+                                             (GDestroyNotify) cache_entry_free);
+
+  CacheEntry *entry = g_hash_table_lookup (time_zone_cache, identifier);
+
+  if (entry != NULL && file_stamp_equal (&entry->stamp, &stamp))
+    {
+      GTimeZone *tz = g_time_zone_ref (entry->tz);
+      G_UNLOCK (time_zone_cache);
+      return tz;
+    }
+
+  G_UNLOCK (time_zone_cache);
+
+  /* Load the time zone outside the lock, as it hits the disk. If another
+   * thread loads the same time zone in the meantime, the last one wins. */
+  g_autoptr(GTimeZone) tz = time_zone_new_from_identifier (identifier);
+  if (tz == NULL)
+    {
+      G_LOCK (time_zone_cache);
+      g_hash_table_remove (time_zone_cache, identifier);
+      G_UNLOCK (time_zone_cache);
+      return NULL;
+    }
+
+  entry = g_new0 (CacheEntry, 1);
+  entry->tz = g_time_zone_ref (tz);
+  entry->stamp = stamp;
+
+  G_LOCK (time_zone_cache);
+  g_hash_table_replace (time_zone_cache, g_strdup (identifier), entry);
+  G_UNLOCK (time_zone_cache);
+
+  return g_steal_pointer (&tz);
+}
+
+/**
+ * mwt_time_zone_cache_clear:
+ *
+ * Drop all the time zones from the process-wide cache, so that they are
+ * reloaded from disk on next use. This is not normally necessary, since
+ * changes to tzfiles are detected automatically.
+ *
+ * This is thread-safe.
+ *
+ * Since: 0.3.0
+ */
+void
+mwt_time_zone_cache_clear (void)
+{
+  G_LOCK (time_zone_cache);
+  g_clear_pointer (&time_zone_cache, g_hash_table_unref);
+  G_UNLOCK (time_zone_cache);
+}
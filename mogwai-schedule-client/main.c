@@ -20,9 +20,14 @@
  *  - Philip Withnall <withnall@endlessm.com>
  */
 
+#define _GNU_SOURCE
+
 #include "config.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <gio/gio.h>
+#include <gio/gfiledescriptorbased.h>
 #include <glib.h>
 #include <glib/gi18n.h>
 #include <glib-object.h>
@@ -33,6 +38,7 @@
 #include <locale.h>
 #include <signal.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 
@@ -95,94 +101,318 @@ signal_sigterm_cb (gpointer user_data)
   return handle_signal (signal_data, SIGTERM);
 }
 
-/* Download handling. */
+/* Download handling.
+ *
+ * If the download is resumable, the scheduler may pause it at any point by
+ * setting #MwscScheduleEntry:download-now to %FALSE. The in-progress transfer
+ * is cancelled (using @transfer_cancellable), the partially downloaded data is
+ * kept, and when the download is allowed to continue, it’s resumed from the end
+ * of the output file using an HTTP `Range` request.
+ *
+ * The scheduler may also ask for the download to be throttled, using
+ * #MwscScheduleEntry:max-rate. This is enforced with a token bucket: before
+ * each chunk is read, the bucket is refilled at the maximum rate for the time
+ * since it was last refilled, and if it’s less than half full, reading is
+ * paused (using @throttle_source) until it would be full. */
 typedef struct
 {
-  MwscScheduler *scheduler;  /* (owned) */
-  GVariant *parameters;  /* (owned) */
   gchar *uri;  /* (owned) */
   GFile *destination_file;  /* (owned) */
-  SoupSession *session;  /* (owned) */
+  gboolean resumable;
+  SoupSession *session;  /* (owned); may be shared with other downloads */
 #ifdef USE_LIBSOUP_2_4
   SoupRequest *request;  /* (owned) (nullable) */
+#else
+  SoupMessage *message;  /* (owned) (nullable) */
 #endif
   MwscScheduleEntry *entry;  /* (owned) (nullable) */
   gulong entry_notify_download_now_id;
+  gulong entry_notify_max_rate_id;
+  gulong entry_notify_download_starts_at_id;
+  GFileOutputStream *output_stream;  /* (owned) (nullable) */
   GInputStream *request_stream;  /* (owned) (nullable) */
-  gsize bytes_spliced;
+  goffset request_offset;
+  gsize bytes_written;
+
+  /* Buffer for copying from @request_stream to @output_stream, and how far
+   * through the output file the copy has got. Writeback of the file is
+   * started periodically, up to @writeback_offset. */
+  guint8 *buffer;  /* (owned) (nullable) */
+  goffset write_offset;
+  goffset writeback_offset;
+
+  /* How far through the output file the download was when its progress was
+   * last reported to the scheduler; see report_progress(). */
+  goffset reported_offset;
+
+  /* Cancelled to pause the transfer, and also whenever the task’s cancellable
+   * is cancelled. */
+  GCancellable *transfer_cancellable;  /* (owned) */
+  GCancellable *cancellable;  /* (owned) (nullable) */
+  gulong cancellable_cancelled_id;
+
+  /* Whether a transfer is in progress, and whether it is being paused. */
+  gboolean transferring;
+  gboolean pausing;
+
+  /* Reference to the task, held while waiting for permission to download. */
+  GTask *waiting_task;  /* (owned) (nullable) */
+
+  /* Token bucket for throttling to @max_rate bytes per second (or not at all if
+   * it’s zero). @bucket_refill_usec is the monotonic time the bucket was last
+   * refilled, or zero if it should be refilled completely. @throttle_source
+   * holds a reference to the task while reading is paused. */
+  guint64 max_rate;
+  guint64 bucket_tokens;
+  gint64 bucket_refill_usec;
+  GSource *throttle_source;  /* (owned) (nullable) */
 } DownloadData;
 
 static void
 download_data_free (DownloadData *data)
 {
+  g_assert (data->waiting_task == NULL);
+  g_assert (data->throttle_source == NULL);
+
+  if (data->cancellable_cancelled_id != 0)
+    g_cancellable_disconnect (data->cancellable, data->cancellable_cancelled_id);
+  g_clear_object (&data->cancellable);
+  g_clear_object (&data->transfer_cancellable);
+  g_clear_pointer (&data->buffer, g_free);
   g_clear_object (&data->request_stream);
-  g_assert (data->entry_notify_download_now_id == 0);
+  g_clear_object (&data->output_stream);
+  if (data->entry_notify_download_now_id != 0)
+    g_signal_handler_disconnect (data->entry, data->entry_notify_download_now_id);
+  if (data->entry_notify_max_rate_id != 0)
+    g_signal_handler_disconnect (data->entry, data->entry_notify_max_rate_id);
+  if (data->entry_notify_download_starts_at_id != 0)
+    g_signal_handler_disconnect (data->entry, data->entry_notify_download_starts_at_id);
   g_clear_object (&data->entry);
 #ifdef USE_LIBSOUP_2_4
   g_clear_object (&data->request);
+#else
+  g_clear_object (&data->message);
 #endif
   g_clear_object (&data->session);
   g_clear_object (&data->destination_file);
   g_clear_pointer (&data->uri, g_free);
-  g_clear_pointer (&data->parameters, g_variant_unref);
-  g_clear_object (&data->scheduler);
   g_free (data);
 }
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (DownloadData, download_data_free);
 
-static void scheduler_cb (GObject      *obj,
-                          GAsyncResult *result,
-                          gpointer      user_data);
-static void schedule_cb (GObject      *obj,
-                         GAsyncResult *result,
-                         gpointer      user_data);
 static void entry_notify_download_now_cb (GObject    *obj,
                                           GParamSpec *pspec,
                                           gpointer    user_data);
+static void entry_notify_max_rate_cb     (GObject    *obj,
+                                          GParamSpec *pspec,
+                                          gpointer    user_data);
+static void entry_notify_download_starts_at_cb (GObject    *obj,
+                                                GParamSpec *pspec,
+                                                gpointer    user_data);
 static void start_download (GTask *task);
+static void open_cb (GObject      *obj,
+                     GAsyncResult *result,
+                     gpointer      user_data);
+static void send_request (GTask *task);
 static void request_send_cb (GObject      *obj,
                              GAsyncResult *result,
                              gpointer      user_data);
-static void replace_cb (GObject      *obj,
-                        GAsyncResult *result,
-                        gpointer      user_data);
-static void splice_cb (GObject      *obj,
-                       GAsyncResult *result,
-                       gpointer      user_data);
+static void copy_next_chunk (GTask *task);
+static void read_cb (GObject      *obj,
+                     GAsyncResult *result,
+                     gpointer      user_data);
+static void write_cb (GObject      *obj,
+                      GAsyncResult *result,
+                      gpointer      user_data);
+static void finish_download (GTask *task);
+static void close_cb (GObject      *obj,
+                      GAsyncResult *result,
+                      gpointer      user_data);
 static void remove_cb (GObject      *obj,
                        GAsyncResult *result,
                        gpointer      user_data);
 
 static void
-download_uri_async (const gchar         *uri,
-                    GFile               *destination_file,
-                    guint32              priority,
-                    gboolean             resumable,
-                    GDBusConnection     *connection,
-                    GCancellable        *cancellable,
-                    GAsyncReadyCallback  callback,
-                    gpointer             user_data)
+cancellable_cancelled_cb (GCancellable *cancellable,
+                          gpointer      user_data)
+{
+  GCancellable *transfer_cancellable = G_CANCELLABLE (user_data);
+
+  g_cancellable_cancel (transfer_cancellable);
+}
+
+/* Download @uri to @destination_file once @entry is allowed to download. The
+ * result of the task is the number of bytes downloaded. */
+static void
+download_entry_async (MwscScheduleEntry   *entry,
+                      SoupSession         *session,
+                      const gchar         *uri,
+                      GFile               *destination_file,
+                      gboolean             resumable,
+                      GCancellable        *cancellable,
+                      GAsyncReadyCallback  callback,
+                      gpointer             user_data)
 {
   g_autoptr(GTask) task = g_task_new (NULL, cancellable, callback, user_data);
-  g_task_set_source_tag (task, download_uri_async);
+  g_task_set_source_tag (task, download_entry_async);
 
-  g_autoptr(DownloadData) data = g_new0 (DownloadData, 1);
+  DownloadData *data = g_new0 (DownloadData, 1);
   data->uri = g_strdup (uri);
   data->destination_file = g_object_ref (destination_file);
-  data->session = soup_session_new ();
+  data->resumable = resumable;
+  data->session = g_object_ref (session);
+  data->entry = g_object_ref (entry);
+  data->transfer_cancellable = g_cancellable_new ();
 
-  /* Sort out the arguments for the schedule entry. */
-  g_auto(GVariantDict) dict = G_VARIANT_DICT_INIT (NULL);
-  g_variant_dict_insert (&dict, "Priority", "u", priority);
-  g_variant_dict_insert (&dict, "Resumable", "b", resumable);
-  data->parameters = g_variant_ref_sink (g_variant_dict_end (&dict));
+  if (cancellable != NULL)
+    {
+      data->cancellable = g_object_ref (cancellable);
+      data->cancellable_cancelled_id =
+          g_cancellable_connect (cancellable, G_CALLBACK (cancellable_cancelled_cb),
+                                 data->transfer_cancellable, NULL);
+    }
+
+  g_task_set_task_data (task, data, (GDestroyNotify) download_data_free);
+
+  /* Watch for the scheduler allowing, pausing or throttling the download for
+   * as long as the task exists. The handlers are disconnected in
+   * download_data_free(), so they don’t need to hold a reference to the
+   * task. */
+  data->entry_notify_download_now_id =
+      g_signal_connect (data->entry, "notify::download-now",
+                        (GCallback) entry_notify_download_now_cb, task);
+  data->entry_notify_max_rate_id =
+      g_signal_connect (data->entry, "notify::max-rate",
+                        (GCallback) entry_notify_max_rate_cb, task);
+  data->entry_notify_download_starts_at_id =
+      g_signal_connect (data->entry, "notify::download-starts-at",
+                        (GCallback) entry_notify_download_starts_at_cb, task);
+  data->max_rate = mwsc_schedule_entry_get_max_rate (data->entry);
+
+  /* FIXME: We should probably check for cancellation while waiting here.
+   * Similarly, check for #MwscScheduleEntry::invalidated. */
+  gboolean download_now = mwsc_schedule_entry_get_download_now (data->entry);
+
+  if (!download_now)
+    {
+      g_message ("Waiting for permission to download ‘%s’", data->uri);
+      data->waiting_task = g_steal_pointer (&task);
+      entry_notify_download_starts_at_cb (G_OBJECT (data->entry), NULL,
+                                          data->waiting_task);
+    }
+  else
+    {
+      g_message ("Immediately granted permission to download ‘%s’", data->uri);
+      start_download (task);
+    }
+}
 
-  g_task_set_task_data (task, g_steal_pointer (&data), (GDestroyNotify) download_data_free);
+static gssize
+download_entry_finish (GAsyncResult  *result,
+                       GError       **error)
+{
+  g_assert (g_task_is_valid (result, NULL));
+  g_assert (g_async_result_is_tagged (result, download_entry_async));
+
+  return g_task_propagate_int (G_TASK (result), error);
+}
+
+/* One URI to download, and where to save it. */
+typedef struct
+{
+  gchar *uri;  /* (owned) */
+  GFile *destination_file;  /* (owned) */
+} DownloadItem;
+
+static DownloadItem *
+download_item_new (const gchar *uri,
+                   GFile       *destination_file)
+{
+  DownloadItem *item = g_new0 (DownloadItem, 1);
+  item->uri = g_strdup (uri);
+  item->destination_file = g_object_ref (destination_file);
+  return item;
+}
+
+static void
+download_item_free (DownloadItem *item)
+{
+  g_clear_object (&item->destination_file);
+  g_clear_pointer (&item->uri, g_free);
+  g_free (item);
+}
+
+/* State for downloading several #DownloadItems in parallel. All the downloads
+ * share one #MwscScheduler, are scheduled with one D-Bus call, and share one
+ * #SoupSession so that connections to the same server can be reused. */
+typedef struct
+{
+  GPtrArray *items;  /* (owned) (element-type DownloadItem) */
+  guint32 priority;
+  gboolean resumable;
+  MwscScheduler *scheduler;  /* (owned) (nullable) */
+  SoupSession *session;  /* (owned) */
+  gsize n_remaining;
+  gsize n_failed;
+  GError *first_error;  /* (owned) (nullable) */
+} DownloadItemsData;
+
+static void
+download_items_data_free (DownloadItemsData *data)
+{
+  g_clear_error (&data->first_error);
+  g_clear_object (&data->session);
+  g_clear_object (&data->scheduler);
+  g_clear_pointer (&data->items, g_ptr_array_unref);
+  g_free (data);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (DownloadItemsData, download_items_data_free);
+
+static void scheduler_cb (GObject      *obj,
+                          GAsyncResult *result,
+                          gpointer      user_data);
+static void schedule_entries_cb (GObject      *obj,
+                                 GAsyncResult *result,
+                                 gpointer      user_data);
+static void download_entry_cb (GObject      *obj,
+                               GAsyncResult *result,
+                               gpointer      user_data);
+
+/* Schedule and download all the #DownloadItems in @items. As many of them are
+ * downloaded in parallel as the scheduler allows. */
+static void
+download_items_async (GPtrArray           *items,
+                      guint32              priority,
+                      gboolean             resumable,
+                      GDBusConnection     *connection,
+                      GCancellable        *cancellable,
+                      GAsyncReadyCallback  callback,
+                      gpointer             user_data)
+{
+  g_assert (items->len > 0);
+
+  g_autoptr(GTask) task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (task, download_items_async);
+
+  g_autoptr(DownloadItemsData) data = g_new0 (DownloadItemsData, 1);
+  data->items = g_ptr_array_ref (items);
+  data->priority = priority;
+  data->resumable = resumable;
+
+  /* The scheduler limits how many downloads are active at once, so don’t let
+   * the session’s default connection limits throttle them further. */
+  data->session = soup_session_new_with_options ("max-conns", MAX (10, items->len),
+                                                 "max-conns-per-host", MAX (2, items->len),
+                                                 NULL);
+
+  g_task_set_task_data (task, g_steal_pointer (&data),
+                        (GDestroyNotify) download_items_data_free);
 
   g_message ("Connecting to download scheduler");
 
-  /* Create a scheduler and entry for the download. */
+  /* Create a scheduler and entries for the downloads. */
   mwsc_scheduler_new_full_async (connection,
                                  "com.endlessm.MogwaiSchedule1",
                                  "/com/endlessm/DownloadManager1",
@@ -192,11 +422,11 @@ download_uri_async (const gchar         *uri,
 }
 
 static gboolean
-download_uri_finish (GAsyncResult  *result,
-                     GError       **error)
+download_items_finish (GAsyncResult  *result,
+                       GError       **error)
 {
   g_assert (g_task_is_valid (result, NULL));
-  g_assert (g_async_result_is_tagged (result, download_uri_async));
+  g_assert (g_async_result_is_tagged (result, download_items_async));
 
   return g_task_propagate_boolean (G_TASK (result), error);
 }
@@ -207,11 +437,11 @@ scheduler_cb (GObject      *obj,
               gpointer      user_data)
 {
   g_autoptr(GTask) task = G_TASK (user_data);
-  DownloadData *data = g_task_get_task_data (task);
+  DownloadItemsData *data = g_task_get_task_data (task);
   GCancellable *cancellable = g_task_get_cancellable (task);
   g_autoptr(GError) error = NULL;
 
-  /* Grab the scheduler and create a schedule entry. */
+  /* Grab the scheduler and create the schedule entries. */
   data->scheduler = mwsc_scheduler_new_full_finish (result, &error);
 
   if (error != NULL)
@@ -220,27 +450,226 @@ scheduler_cb (GObject      *obj,
       return;
     }
 
-  g_message ("Creating schedule entry");
+  if (data->items->len == 1)
+    g_message ("Creating schedule entry");
+  else
+    g_message ("Creating %u schedule entries", data->items->len);
 
-  mwsc_scheduler_schedule_async (data->scheduler,
-                                 data->parameters,
-                                 cancellable,
-                                 schedule_cb,
-                                 g_steal_pointer (&task));
+  /* All the entries have the same parameters. */
+  g_auto(GVariantDict) dict = G_VARIANT_DICT_INIT (NULL);
+  g_variant_dict_insert (&dict, "Priority", "u", data->priority);
+  g_variant_dict_insert (&dict, "Resumable", "b", data->resumable);
+  g_autoptr(GVariant) parameters = g_variant_ref_sink (g_variant_dict_end (&dict));
+
+  g_autoptr(GPtrArray) parameters_array = g_ptr_array_new_with_free_func (NULL);
+  for (gsize i = 0; i < data->items->len; i++)
+    g_ptr_array_add (parameters_array, parameters);
+
+  mwsc_scheduler_schedule_entries_async (data->scheduler,
+                                         parameters_array,
+                                         cancellable,
+                                         schedule_entries_cb,
+                                         g_steal_pointer (&task));
 }
 
 static void
-schedule_cb (GObject      *obj,
-             GAsyncResult *result,
-             gpointer      user_data)
+schedule_entries_cb (GObject      *obj,
+                     GAsyncResult *result,
+                     gpointer      user_data)
 {
   MwscScheduler *scheduler = MWSC_SCHEDULER (obj);
   g_autoptr(GTask) task = G_TASK (user_data);
+  DownloadItemsData *data = g_task_get_task_data (task);
+  GCancellable *cancellable = g_task_get_cancellable (task);
+  g_autoptr(GError) error = NULL;
+
+  /* Grab the schedule entries. */
+  g_autoptr(GPtrArray) entries = NULL;
+  entries = mwsc_scheduler_schedule_entries_finish (scheduler, result, &error);
+
+  if (error != NULL)
+    {
+      g_task_return_error (task, g_steal_pointer (&error));
+      return;
+    }
+
+  g_assert (entries->len == data->items->len);
+
+  /* Start all the downloads. Each one waits until its entry is active. */
+  data->n_remaining = entries->len;
+
+  for (gsize i = 0; i < entries->len; i++)
+    {
+      MwscScheduleEntry *entry = g_ptr_array_index (entries, i);
+      const DownloadItem *item = g_ptr_array_index (data->items, i);
+
+      download_entry_async (entry, data->session, item->uri, item->destination_file,
+                            data->resumable, cancellable,
+                            download_entry_cb, g_object_ref (task));
+    }
+}
+
+static void
+download_entry_cb (GObject      *obj,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+  g_autoptr(GTask) task = G_TASK (user_data);
+  DownloadItemsData *data = g_task_get_task_data (task);
+  g_autoptr(GError) error = NULL;
+
+  if (download_entry_finish (result, &error) < 0)
+    {
+      data->n_failed++;
+
+      if (data->first_error == NULL)
+        data->first_error = g_steal_pointer (&error);
+      else
+        g_debug ("Additional download error: %s", error->message);
+    }
+
+  g_assert (data->n_remaining > 0);
+  data->n_remaining--;
+
+  if (data->n_remaining > 0)
+    return;
+
+  /* All the downloads have finished. Report the first error, if any. */
+  if (data->first_error != NULL && data->items->len > 1)
+    g_prefix_error (&data->first_error,
+                    _("%" G_GSIZE_FORMAT " of %u downloads failed; first error: "),
+                    data->n_failed, data->items->len);
+
+  if (data->first_error != NULL)
+    g_task_return_error (task, g_steal_pointer (&data->first_error));
+  else
+    g_task_return_boolean (task, TRUE);
+}
+
+static void
+entry_notify_download_now_cb (GObject    *obj,
+                              GParamSpec *pspec,
+                              gpointer    user_data)
+{
+  MwscScheduleEntry *entry = MWSC_SCHEDULE_ENTRY (obj);
+  GTask *task = G_TASK (user_data);
+  DownloadData *data = g_task_get_task_data (task);
+
+  if (mwsc_schedule_entry_get_download_now (entry) && data->waiting_task != NULL)
+    {
+      g_autoptr(GTask) waiting_task = g_steal_pointer (&data->waiting_task);
+      start_download (waiting_task);
+    }
+  else if (!mwsc_schedule_entry_get_download_now (entry) &&
+           data->transferring && data->resumable && !data->pausing)
+    {
+      /* Cancel the transfer, keeping the partially downloaded file. */
+      g_message ("Pausing download of ‘%s’", data->uri);
+      data->pausing = TRUE;
+      g_cancellable_cancel (data->transfer_cancellable);
+    }
+}
+
+/* Report the scheduler’s prediction of when a waiting download will start. */
+static void
+entry_notify_download_starts_at_cb (GObject    *obj,
+                                    GParamSpec *pspec,
+                                    gpointer    user_data)
+{
+  MwscScheduleEntry *entry = MWSC_SCHEDULE_ENTRY (obj);
+  GTask *task = G_TASK (user_data);
+  DownloadData *data = g_task_get_task_data (task);
+  guint64 download_starts_at = mwsc_schedule_entry_get_download_starts_at (entry);
+
+  if (data->waiting_task == NULL || download_starts_at == 0 ||
+      download_starts_at > (guint64) G_MAXINT64)
+    return;
+
+  g_autoptr(GDateTime) starts_at = g_date_time_new_from_unix_local ((gint64) download_starts_at);
+  if (starts_at == NULL)
+    return;
+
+  g_autofree gchar *starts_at_str = g_date_time_format (starts_at, "%c");
+  g_message ("Download of ‘%s’ is expected to start at %s",
+             data->uri, starts_at_str);
+}
+
+static void
+entry_notify_max_rate_cb (GObject    *obj,
+                          GParamSpec *pspec,
+                          gpointer    user_data)
+{
+  MwscScheduleEntry *entry = MWSC_SCHEDULE_ENTRY (obj);
+  GTask *task = G_TASK (user_data);
+  DownloadData *data = g_task_get_task_data (task);
+  guint64 max_rate = mwsc_schedule_entry_get_max_rate (entry);
+
+  if (max_rate == data->max_rate)
+    return;
+
+  if (max_rate > 0)
+    g_message ("Limiting download of ‘%s’ to %" G_GUINT64_FORMAT " bytes/s",
+               data->uri, max_rate);
+  else
+    g_message ("No longer limiting download of ‘%s’", data->uri);
+
+  data->max_rate = max_rate;
+
+  /* If reading is paused to throttle the download, work out again how long
+   * for, using the new rate. */
+  if (data->throttle_source != NULL)
+    {
+      g_autoptr(GTask) throttled_task = g_object_ref (task);
+      g_source_destroy (data->throttle_source);
+      g_clear_pointer (&data->throttle_source, g_source_unref);
+      copy_next_chunk (throttled_task);
+    }
+}
+
+static void
+start_download (GTask *task)
+{
+  DownloadData *data = g_task_get_task_data (task);
+  GCancellable *cancellable = g_task_get_cancellable (task);
+
+  data->transferring = TRUE;
+
+  /* The output file is opened once, and kept open if the download is paused.
+   * Resumable downloads are appended to any existing file, so that an
+   * interrupted download can be continued by running the client again. */
+  if (data->output_stream != NULL)
+    send_request (task);
+  else if (data->resumable)
+    g_file_append_to_async (data->destination_file,
+                            G_FILE_CREATE_NONE,
+                            G_PRIORITY_DEFAULT,
+                            cancellable,
+                            open_cb,
+                            g_object_ref (task));
+  else
+    g_file_replace_async (data->destination_file, NULL,
+                          FALSE,  /* no backup */
+                          G_FILE_CREATE_NONE,
+                          G_PRIORITY_DEFAULT,
+                          cancellable,
+                          open_cb,
+                          g_object_ref (task));
+}
+
+static void
+open_cb (GObject      *obj,
+         GAsyncResult *result,
+         gpointer      user_data)
+{
+  GFile *destination_file = G_FILE (obj);
+  g_autoptr(GTask) task = G_TASK (user_data);
   DownloadData *data = g_task_get_task_data (task);
   g_autoptr(GError) error = NULL;
 
-  /* Grab the schedule entry. */
-  data->entry = mwsc_scheduler_schedule_finish (scheduler, result, &error);
+  if (data->resumable)
+    data->output_stream = g_file_append_to_finish (destination_file, result, &error);
+  else
+    data->output_stream = g_file_replace_finish (destination_file, result, &error);
 
   if (error != NULL)
     {
@@ -248,150 +677,513 @@ schedule_cb (GObject      *obj,
       return;
     }
 
-  /* FIXME: We should probably check for cancellation while waiting here.
-   * Similarly, check for #MwscScheduleEntry::invalidated. */
-  gboolean download_now = mwsc_schedule_entry_get_download_now (data->entry);
+  send_request (task);
+}
 
-  if (!download_now)
+static void
+send_request (GTask *task)
+{
+  DownloadData *data = g_task_get_task_data (task);
+  g_autoptr(GError) error = NULL;
+#ifndef USE_LIBSOUP_2_4
+  SoupMessageHeaders *request_headers;
+#endif
+
+  /* Work out how much has already been downloaded. */
+  data->request_offset = 0;
+
+  if (data->resumable)
     {
-      g_message ("Waiting for permission to download");
-      data->entry_notify_download_now_id =
-          g_signal_connect (data->entry, "notify::download-now",
-                            (GCallback) entry_notify_download_now_cb,
-                            g_steal_pointer (&task));
+      g_autoptr(GFileInfo) info = NULL;
+      info = g_file_output_stream_query_info (data->output_stream,
+                                              G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                                              NULL, &error);
+      if (info == NULL)
+        {
+          g_task_return_error (task, g_steal_pointer (&error));
+          return;
+        }
+
+      data->request_offset = g_file_info_get_size (info);
     }
+
+  /* Start the download. */
+  if (data->request_offset > 0)
+    g_message ("Resuming download of ‘%s’ from byte %" G_GOFFSET_FORMAT,
+               data->uri, data->request_offset);
   else
+    g_message ("Starting download of ‘%s’", data->uri);
+
+  g_clear_object (&data->request_stream);
+
+#ifdef USE_LIBSOUP_2_4
+  g_clear_object (&data->request);
+  data->request = soup_session_request (data->session, data->uri, &error);
+
+  if (error != NULL)
+    {
+      g_task_return_error (task, g_steal_pointer (&error));
+      return;
+    }
+
+  if (data->request_offset > 0 && SOUP_IS_REQUEST_HTTP (data->request))
+    {
+      SoupMessage *msg = soup_request_http_get_message (SOUP_REQUEST_HTTP (data->request));
+      soup_message_headers_set_range (msg->request_headers, data->request_offset, -1);
+      g_object_unref (msg);
+    }
+
+  soup_request_send_async (data->request, data->transfer_cancellable,
+                           request_send_cb, g_object_ref (task));
+#else
+  g_clear_object (&data->message);
+  data->message = soup_message_new (SOUP_METHOD_GET, data->uri);
+
+  if (data->request_offset > 0)
+    {
+      request_headers = soup_message_get_request_headers (data->message);
+      soup_message_headers_set_range (request_headers, data->request_offset, -1);
+    }
+
+  soup_session_send_async (data->session,
+                           data->message,
+                           G_PRIORITY_DEFAULT,
+                           data->transfer_cancellable,
+                           request_send_cb,
+                           g_object_ref (task));
+#endif
+}
+
+/* Size of the buffer used to copy downloaded data to disk. This is a lot larger
+ * than the default used by g_output_stream_splice_async(), to reduce the
+ * number of main loop iterations and system calls per byte on large downloads. */
+#define COPY_BUFFER_SIZE (256 * 1024)
+
+/* How much data to write before starting writeback of it to disk. This is
+ * done without waiting for the writeback to complete, so that the amount of
+ * dirty data in the page cache, and hence the eventual stall on close(), is
+ * bounded without a blocking fsync() after every write. */
+#define WRITEBACK_INTERVAL (32 * 1024 * 1024)
+
+/* How much data to write between reports of the progress of a non-resumable
+ * download to the scheduler; see report_progress(). */
+#define PROGRESS_REPORT_INTERVAL (8 * 1024 * 1024)
+
+/* Get the length of the response body for the current request, or -1 if it is
+ * not known. */
+static goffset
+get_content_length (DownloadData *data)
+{
+#ifdef USE_LIBSOUP_2_4
+  return soup_request_get_content_length (data->request);
+#else
+  SoupMessageHeaders *response_headers = soup_message_get_response_headers (data->message);
+
+  if (soup_message_headers_get_encoding (response_headers) != SOUP_ENCODING_CONTENT_LENGTH)
+    return -1;
+
+  return soup_message_headers_get_content_length (response_headers);
+#endif
+}
+
+#if defined(HAVE_FALLOCATE) || defined(HAVE_SYNC_FILE_RANGE)
+/* Get the file descriptor of the output file, or -1 if it is not a local
+ * file. */
+static int
+get_output_fd (DownloadData *data)
+{
+  if (!G_IS_FILE_DESCRIPTOR_BASED (data->output_stream))
+    return -1;
+
+  return g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (data->output_stream));
+}
+#endif
+
+/* Reserve disk space for the rest of the download, if its length is known, so
+ * the file is less fragmented on disk. The apparent size of the file is not
+ * changed, so resuming from the end of the file still works. Failure is not
+ * fatal, as not all file systems support it. */
+static void
+preallocate_output (DownloadData *data,
+                    goffset       content_length)
+{
+#ifdef HAVE_FALLOCATE
+  int fd = get_output_fd (data);
+
+  if (fd < 0 || content_length <= 0)
+    return;
+
+  if (fallocate (fd, FALLOC_FL_KEEP_SIZE, data->request_offset, content_length) < 0)
+    {
+      int errsv = errno;
+      g_debug ("Error preallocating %" G_GOFFSET_FORMAT " bytes for ‘%s’: %s",
+               content_length, data->uri, g_strerror (errsv));
+    }
+#endif
+}
+
+/* Start writeback of the data written since the last call, if there’s at least
+ * %WRITEBACK_INTERVAL of it or if @force is %TRUE. This doesn’t wait for the
+ * writeback to complete. */
+static void
+start_writeback (DownloadData *data,
+                 gboolean      force)
+{
+#ifdef HAVE_SYNC_FILE_RANGE
+  goffset pending = data->write_offset - data->writeback_offset;
+  int fd = get_output_fd (data);
+
+  if (fd < 0 || pending <= 0 || (!force && pending < WRITEBACK_INTERVAL))
+    return;
+
+  if (sync_file_range (fd, data->writeback_offset, pending, SYNC_FILE_RANGE_WRITE) < 0)
+    {
+      int errsv = errno;
+      g_debug ("Error starting writeback for ‘%s’: %s", data->uri, g_strerror (errsv));
+    }
+
+  data->writeback_offset = data->write_offset;
+#endif
+}
+
+static void
+send_progress_cb (GObject      *obj,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+  MwscScheduleEntry *entry = MWSC_SCHEDULE_ENTRY (obj);
+  g_autoptr(GError) error = NULL;
+
+  /* Not fatal: the scheduler just might pause the download. */
+  if (!mwsc_schedule_entry_send_properties_finish (entry, result, &error))
+    g_debug ("Error reporting progress of schedule entry ‘%s’: %s",
+             mwsc_schedule_entry_get_id (entry), error->message);
+}
+
+/* Report how much of a non-resumable download has been written, every
+ * %PROGRESS_REPORT_INTERVAL bytes, so the scheduler can avoid pausing it when
+ * it’s nearly complete (pausing it would throw away everything downloaded so
+ * far). Resumable downloads lose nothing when paused, so aren’t reported. */
+static void
+report_progress (DownloadData *data)
+{
+  if (data->resumable ||
+      data->write_offset - data->reported_offset < PROGRESS_REPORT_INTERVAL)
+    return;
+
+  mwsc_schedule_entry_set_downloaded_size (data->entry, (guint64) data->write_offset);
+  mwsc_schedule_entry_send_properties_async (data->entry, NULL,
+                                             send_progress_cb, NULL);
+  data->reported_offset = data->write_offset;
+}
+
+/* Handle @error from the transfer. If it was cancelled to pause the download,
+ * wait for permission to resume; otherwise return it from @task. */
+static void
+transfer_failed (GTask  *task,
+                 GError *error)
+{
+  DownloadData *data = g_task_get_task_data (task);
+  GCancellable *cancellable = g_task_get_cancellable (task);
+  g_autoptr(GError) owned_error = error;
+
+  data->transferring = FALSE;
+
+  if (!data->pausing ||
+      !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED) ||
+      g_cancellable_is_cancelled (cancellable))
     {
-      g_message ("Immediately granted permission to download");
+      g_task_return_error (task, g_steal_pointer (&owned_error));
+      return;
+    }
+
+  data->pausing = FALSE;
+  g_cancellable_reset (data->transfer_cancellable);
+  g_clear_object (&data->request_stream);
+
+  /* The scheduler may have allowed the download again in the meantime. */
+  if (mwsc_schedule_entry_get_download_now (data->entry))
+    {
+      g_message ("Download of ‘%s’ paused; resuming immediately", data->uri);
       start_download (task);
     }
+  else
+    {
+      g_message ("Download of ‘%s’ paused; waiting for permission to resume",
+                 data->uri);
+      data->waiting_task = g_object_ref (task);
+    }
+}
+
+static void
+request_send_cb (GObject      *obj,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+#ifdef USE_LIBSOUP_2_4
+  SoupRequest *request = SOUP_REQUEST (obj);
+#else
+  SoupSession *session = SOUP_SESSION (obj);
+#endif
+  g_autoptr(GTask) task = G_TASK (user_data);
+  DownloadData *data = g_task_get_task_data (task);
+  GCancellable *cancellable = g_task_get_cancellable (task);
+  g_autoptr(GError) error = NULL;
+  guint status_code;
+
+#ifdef USE_LIBSOUP_2_4
+  data->request_stream = soup_request_send_finish (request, result, &error);
+#else
+  data->request_stream = soup_session_send_finish (session, result, &error);
+#endif
+
+  if (error != NULL)
+    {
+      transfer_failed (task, g_steal_pointer (&error));
+      return;
+    }
+
+  /* If resuming, check whether the server honoured the Range request. */
+#ifdef USE_LIBSOUP_2_4
+  if (SOUP_IS_REQUEST_HTTP (data->request))
+    {
+      SoupMessage *msg = soup_request_http_get_message (SOUP_REQUEST_HTTP (data->request));
+      status_code = msg->status_code;
+      g_object_unref (msg);
+    }
+  else
+    {
+      status_code = SOUP_STATUS_OK;
+    }
+#else
+  status_code = soup_message_get_status (data->message);
+#endif
+
+  if (data->request_offset > 0 &&
+      status_code == SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE)
+    {
+      /* The whole file has already been downloaded. */
+      g_message ("Download of ‘%s’ already complete", data->uri);
+      finish_download (task);
+      return;
+    }
+  else if (data->request_offset > 0 &&
+           status_code == SOUP_STATUS_OK)
+    {
+      g_message ("Server does not support resuming ‘%s’; restarting download",
+                 data->uri);
+
+      if (!g_seekable_truncate (G_SEEKABLE (data->output_stream), 0,
+                                cancellable, &error))
+        {
+          g_task_return_error (task, g_steal_pointer (&error));
+          return;
+        }
+
+      data->request_offset = 0;
+    }
+  else if (data->request_offset > 0 &&
+           status_code != SOUP_STATUS_PARTIAL_CONTENT)
+    {
+      /* Don’t overwrite the partial download with an error page. */
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                               _("Error resuming download of ‘%s’: HTTP status %u"),
+                               data->uri, status_code);
+      return;
+    }
+
+  /* Copy to the output file, which is kept open in case the download is
+   * paused. */
+  data->write_offset = data->request_offset;
+  data->writeback_offset = data->request_offset;
+  data->reported_offset = data->request_offset;
+  data->bucket_refill_usec = 0;
+  preallocate_output (data, get_content_length (data));
+
+  if (data->buffer == NULL)
+    data->buffer = g_malloc (COPY_BUFFER_SIZE);
+
+  copy_next_chunk (task);
+}
+
+/* Refill the token bucket for the time since it was last refilled. If it’s at
+ * least half full, set @chunk_size to the number of bytes which can be read now
+ * and return zero; otherwise, return how long to wait (in microseconds) until
+ * it would be full. The bucket holds at most one second’s worth of data, and
+ * at most %COPY_BUFFER_SIZE bytes. */
+static gint64
+throttle_refill (DownloadData *data,
+                 gsize        *chunk_size)
+{
+  guint64 capacity = MIN (data->max_rate, COPY_BUFFER_SIZE);
+  gint64 now_usec = g_get_monotonic_time ();
+
+  g_assert (data->max_rate > 0);
+
+  if (data->bucket_refill_usec == 0)
+    {
+      data->bucket_tokens = capacity;
+    }
+  else
+    {
+      gint64 elapsed_usec = CLAMP (now_usec - data->bucket_refill_usec, 0, G_USEC_PER_SEC);
+      guint64 refill;
+
+      if (data->max_rate > G_MAXUINT64 / G_USEC_PER_SEC)
+        refill = capacity;
+      else
+        refill = (guint64) elapsed_usec * data->max_rate / G_USEC_PER_SEC;
+
+      data->bucket_tokens = MIN (data->bucket_tokens + MIN (refill, capacity), capacity);
+    }
+
+  data->bucket_refill_usec = now_usec;
+
+  if (data->bucket_tokens < (capacity + 1) / 2)
+    return MAX ((gint64) ((capacity - data->bucket_tokens) * G_USEC_PER_SEC / data->max_rate), 1);
+
+  *chunk_size = data->bucket_tokens;
+  return 0;
+}
+
+static gboolean
+throttle_cb (gpointer user_data)
+{
+  GTask *task = G_TASK (user_data);
+  DownloadData *data = g_task_get_task_data (task);
+  g_autoptr(GError) error = NULL;
+
+  g_clear_pointer (&data->throttle_source, g_source_unref);
+
+  /* The transfer may have been cancelled while it was throttled. */
+  if (g_cancellable_set_error_if_cancelled (data->transfer_cancellable, &error))
+    transfer_failed (task, g_steal_pointer (&error));
+  else
+    copy_next_chunk (task);
+
+  return G_SOURCE_REMOVE;
 }
 
 static void
-entry_notify_download_now_cb (GObject    *obj,
-                              GParamSpec *pspec,
-                              gpointer    user_data)
+copy_next_chunk (GTask *task)
 {
-  MwscScheduleEntry *entry = MWSC_SCHEDULE_ENTRY (obj);
-  GTask *task = G_TASK (user_data);
   DownloadData *data = g_task_get_task_data (task);
+  gsize chunk_size = COPY_BUFFER_SIZE;
 
-  if (mwsc_schedule_entry_get_download_now (entry))
+  if (data->max_rate > 0)
     {
-      start_download (task);
-      g_signal_handler_disconnect (data->entry, data->entry_notify_download_now_id);
-      data->entry_notify_download_now_id = 0;
-      g_object_unref (task);
+      gint64 delay_usec = throttle_refill (data, &chunk_size);
+
+      if (delay_usec > 0)
+        {
+          /* Wait until the bucket is full, or until the transfer is
+           * cancelled. */
+          g_autoptr(GSource) cancellable_source = NULL;
+          cancellable_source = g_cancellable_source_new (data->transfer_cancellable);
+
+          g_assert (data->throttle_source == NULL);
+          data->throttle_source = g_timeout_source_new ((guint) ((delay_usec + 999) / 1000));
+          g_source_add_child_source (data->throttle_source, cancellable_source);
+          g_source_set_callback (data->throttle_source, throttle_cb,
+                                 g_object_ref (task), g_object_unref);
+          g_source_attach (data->throttle_source, g_main_context_get_thread_default ());
+          return;
+        }
     }
+
+  g_input_stream_read_async (data->request_stream,
+                             data->buffer, chunk_size,
+                             G_PRIORITY_DEFAULT,
+                             data->transfer_cancellable,
+                             read_cb,
+                             g_object_ref (task));
 }
 
 static void
-start_download (GTask *task)
+read_cb (GObject      *obj,
+         GAsyncResult *result,
+         gpointer      user_data)
 {
+  GInputStream *request_stream = G_INPUT_STREAM (obj);
+  g_autoptr(GTask) task = G_TASK (user_data);
   DownloadData *data = g_task_get_task_data (task);
-  GCancellable *cancellable = g_task_get_cancellable (task);
-#ifdef USE_LIBSOUP_2_4
   g_autoptr(GError) error = NULL;
-#else
-  g_autoptr(SoupMessage) msg = NULL;
-#endif
-
-  /* Start the download. */
-  g_message ("Starting download of ‘%s’", data->uri);
 
-#ifdef USE_LIBSOUP_2_4
-  data->request = soup_session_request (data->session, data->uri, &error);
+  gssize bytes_read = g_input_stream_read_finish (request_stream, result, &error);
 
   if (error != NULL)
     {
-      g_task_return_error (task, g_steal_pointer (&error));
+      transfer_failed (task, g_steal_pointer (&error));
       return;
     }
 
-  soup_request_send_async (data->request, cancellable, request_send_cb, g_object_ref (task));
-#else
-  msg = soup_message_new (SOUP_METHOD_GET, data->uri);
+  if (bytes_read == 0)
+    {
+      finish_download (task);
+      return;
+    }
 
-  soup_session_send_async (data->session,
-                           msg,
-                           G_PRIORITY_DEFAULT,
-                           cancellable,
-                           request_send_cb,
-                           g_object_ref (task));
-#endif
+  if (data->max_rate > 0)
+    data->bucket_tokens -= MIN ((guint64) bytes_read, data->bucket_tokens);
+
+  g_output_stream_write_all_async (G_OUTPUT_STREAM (data->output_stream),
+                                   data->buffer, (gsize) bytes_read,
+                                   G_PRIORITY_DEFAULT,
+                                   data->transfer_cancellable,
+                                   write_cb,
+                                   g_steal_pointer (&task));
 }
 
 static void
-request_send_cb (GObject      *obj,
-                 GAsyncResult *result,
-                 gpointer      user_data)
+write_cb (GObject      *obj,
+          GAsyncResult *result,
+          gpointer      user_data)
 {
-#ifdef USE_LIBSOUP_2_4
-  SoupRequest *request = SOUP_REQUEST (obj);
-#else
-  SoupSession *session = SOUP_SESSION (obj);
-#endif
+  GOutputStream *output_stream = G_OUTPUT_STREAM (obj);
   g_autoptr(GTask) task = G_TASK (user_data);
   DownloadData *data = g_task_get_task_data (task);
-  GCancellable *cancellable = g_task_get_cancellable (task);
   g_autoptr(GError) error = NULL;
+  gsize bytes_written = 0;
 
-#ifdef USE_LIBSOUP_2_4
-  data->request_stream = soup_request_send_finish (request, result, &error);
-#else
-  data->request_stream = soup_session_send_finish (session, result, &error);
-#endif
+  g_output_stream_write_all_finish (output_stream, result, &bytes_written, &error);
+
+  /* Count partial writes, even on error. */
+  data->bytes_written += bytes_written;
+  data->write_offset += bytes_written;
 
   if (error != NULL)
     {
-      g_task_return_error (task, g_steal_pointer (&error));
+      transfer_failed (task, g_steal_pointer (&error));
       return;
     }
 
-  /* Open the local output file and splice to it. */
-  g_file_replace_async (data->destination_file, NULL,
-                        FALSE,  /* no backup */
-                        G_FILE_CREATE_NONE,
-                        G_PRIORITY_DEFAULT,
-                        cancellable,
-                        replace_cb,
-                        g_steal_pointer (&task));
+  start_writeback (data, FALSE);
+  report_progress (data);
+  copy_next_chunk (task);
 }
 
 static void
-replace_cb (GObject      *obj,
-            GAsyncResult *result,
-            gpointer      user_data)
+finish_download (GTask *task)
 {
-  GFile *destination_file = G_FILE (obj);
-  g_autoptr(GTask) task = G_TASK (user_data);
   DownloadData *data = g_task_get_task_data (task);
   GCancellable *cancellable = g_task_get_cancellable (task);
-  g_autoptr(GError) error = NULL;
-
-  g_autoptr(GFileOutputStream) output_stream = NULL;
-  output_stream = g_file_replace_finish (destination_file, result, &error);
-
-  if (error != NULL)
-    {
-      g_task_return_error (task, g_steal_pointer (&error));
-      return;
-    }
 
-  g_output_stream_splice_async (G_OUTPUT_STREAM (output_stream),
-                                data->request_stream,
-                                G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
-                                G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
-                                G_PRIORITY_DEFAULT,
-                                cancellable,
-                                splice_cb,
-                                g_steal_pointer (&task));
+  data->transferring = FALSE;
+  g_clear_object (&data->request_stream);
+  g_clear_pointer (&data->buffer, g_free);
+  start_writeback (data, TRUE);
+
+  g_output_stream_close_async (G_OUTPUT_STREAM (data->output_stream),
+                               G_PRIORITY_DEFAULT,
+                               cancellable,
+                               close_cb,
+                               g_object_ref (task));
 }
 
 static void
-splice_cb (GObject      *obj,
-           GAsyncResult *result,
-           gpointer      user_data)
+close_cb (GObject      *obj,
+          GAsyncResult *result,
+          gpointer      user_data)
 {
   GOutputStream *output_stream = G_OUTPUT_STREAM (obj);
   g_autoptr(GTask) task = G_TASK (user_data);
@@ -399,18 +1191,13 @@ splice_cb (GObject      *obj,
   GCancellable *cancellable = g_task_get_cancellable (task);
   g_autoptr(GError) error = NULL;
 
-  gssize bytes_spliced = g_output_stream_splice_finish (output_stream, result, &error);
-
-  if (error != NULL)
+  if (!g_output_stream_close_finish (output_stream, result, &error))
     {
       g_task_return_error (task, g_steal_pointer (&error));
       return;
     }
 
-  g_assert (bytes_spliced >= 0);
-  data->bytes_spliced = (gsize) bytes_spliced;
-
-  g_message ("Download complete; removing schedule entry");
+  g_message ("Download of ‘%s’ complete; removing schedule entry", data->uri);
 
   /* Now notify the scheduler that the download is complete.
    * Really, we should do this on all the error paths above, but we rely on
@@ -439,7 +1226,7 @@ remove_cb (GObject      *obj,
     }
 
   /* Success. */
-  g_task_return_int (task, data->bytes_spliced);
+  g_task_return_int (task, (gssize) data->bytes_written);
 }
 
 static void
@@ -478,6 +1265,59 @@ log_writer_cb (GLogLevelFlags   log_level,
     return g_log_writer_default (log_level, fields, n_fields, user_data);
 }
 
+/* Parse a download manifest from @manifest_filename. Each non-empty line which
+ * doesn’t start with `#` gives a URI and an output filename, separated by
+ * whitespace. The output filename may contain spaces. */
+static GPtrArray *
+load_manifest (const gchar  *manifest_filename,
+               GError      **error)
+{
+  g_autofree gchar *contents = NULL;
+
+  if (!g_file_get_contents (manifest_filename, &contents, NULL, error))
+    return NULL;
+
+  g_autoptr(GPtrArray) items = g_ptr_array_new_with_free_func ((GDestroyNotify) download_item_free);
+  g_auto(GStrv) lines = g_strsplit (contents, "\n", -1);
+
+  for (gsize i = 0; lines[i] != NULL; i++)
+    {
+      gchar *line = g_strstrip (lines[i]);
+
+      if (*line == '\0' || *line == '#')
+        continue;
+
+      gsize uri_len = strcspn (line, " \t");
+      gchar *output_filename = line + uri_len;
+
+      if (*output_filename != '\0')
+        {
+          *output_filename = '\0';
+          output_filename = g_strchug (output_filename + 1);
+        }
+
+      if (*output_filename == '\0')
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       _("Line %" G_GSIZE_FORMAT " of manifest ‘%s’ must contain a URI and OUTPUT-FILENAME"),
+                       i + 1, manifest_filename);
+          return NULL;
+        }
+
+      g_autoptr(GFile) destination_file = g_file_new_for_commandline_arg (output_filename);
+      g_ptr_array_add (items, download_item_new (line, destination_file));
+    }
+
+  if (items->len == 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   _("Manifest ‘%s’ contains no downloads"), manifest_filename);
+      return NULL;
+    }
+
+  return g_steal_pointer (&items);
+}
+
 /* Command handlers. */
 typedef struct
 {
@@ -498,6 +1338,7 @@ handle_download (RunContext  *run_context,
   gboolean quiet = FALSE;
   gint priority = 0;
   gboolean resumable = FALSE;
+  g_autofree gchar *manifest_filename = NULL;
   g_auto (GStrv) args = NULL;
 
   const GOptionEntry entries[] =
@@ -513,6 +1354,9 @@ handle_download (RunContext  *run_context,
       { "resumable", 'r', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &resumable,
         N_("Enable resume support for this download (default: non-resumable)"),
         NULL },
+      { "batch", 'b', G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME, &manifest_filename,
+        N_("Download all the URIs listed in MANIFEST, one ‘URI OUTPUT-FILENAME’ pair per line"),
+        N_("MANIFEST") },
       { G_OPTION_REMAINING, 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING_ARRAY,
         &args, NULL, NULL },
       { NULL, },
@@ -533,7 +1377,17 @@ handle_download (RunContext  *run_context,
       return EXIT_INVALID_OPTIONS;
     }
 
-  if (args == NULL || args[0] == NULL || args[1] == NULL)
+  if (manifest_filename != NULL && args != NULL && args[0] != NULL)
+    {
+      g_autofree gchar *message = NULL;
+      message = g_strdup_printf (_("Option parsing failed: %s"),
+                                 _("A URI and OUTPUT-FILENAME cannot be given with --batch"));
+      g_printerr ("%s: %s\n", run_context->argv0, message);
+
+      return EXIT_INVALID_OPTIONS;
+    }
+  if (manifest_filename == NULL &&
+      (args == NULL || args[0] == NULL || args[1] == NULL))
     {
       g_autofree gchar *message = NULL;
       message = g_strdup_printf (_("Option parsing failed: %s"),
@@ -542,7 +1396,7 @@ handle_download (RunContext  *run_context,
 
       return EXIT_INVALID_OPTIONS;
     }
-  if (args[2] != NULL)
+  if (manifest_filename == NULL && args[2] != NULL)
     {
       g_autofree gchar *message = NULL;
       message = g_strdup_printf (_("Option parsing failed: %s"),
@@ -563,9 +1417,31 @@ handle_download (RunContext  *run_context,
       return EXIT_INVALID_OPTIONS;
     }
 
-  const gchar *uri = args[0];
-  const gchar *output_filename = args[1];
-  g_autoptr(GFile) destination_file = g_file_new_for_commandline_arg (output_filename);
+  g_autoptr(GPtrArray) items = NULL;
+
+  if (manifest_filename != NULL)
+    {
+      items = load_manifest (manifest_filename, &error);
+
+      if (items == NULL)
+        {
+          g_autofree gchar *message = NULL;
+          message = g_strdup_printf (_("Option parsing failed: %s"),
+                                     error->message);
+          g_printerr ("%s: %s\n", run_context->argv0, message);
+
+          return EXIT_INVALID_OPTIONS;
+        }
+    }
+  else
+    {
+      const gchar *uri = args[0];
+      const gchar *output_filename = args[1];
+      g_autoptr(GFile) destination_file = g_file_new_for_commandline_arg (output_filename);
+
+      items = g_ptr_array_new_with_free_func ((GDestroyNotify) download_item_free);
+      g_ptr_array_add (items, download_item_new (uri, destination_file));
+    }
 
   /* Log handling. */
   g_log_set_writer_func (log_writer_cb, &quiet, NULL);
@@ -607,12 +1483,12 @@ handle_download (RunContext  *run_context,
       return EXIT_BUS_UNAVAILABLE;
     }
 
-  /* Create a #GTask for the scheduling and download, and start downloading. */
+  /* Create a #GTask for the scheduling and downloads, and start downloading. */
   g_autoptr(GAsyncResult) download_result = NULL;
-  download_uri_async (uri, destination_file, priority, resumable, connection,
-                      run_context->cancellable, async_result_cb, &download_result);
+  download_items_async (items, priority, resumable, connection,
+                        run_context->cancellable, async_result_cb, &download_result);
 
-  /* Run the main loop until we are signalled or the download finishes. */
+  /* Run the main loop until we are signalled or the downloads finish. */
   while (!g_cancellable_is_cancelled (run_context->cancellable) &&
          download_result == NULL)
     g_main_context_iteration (NULL, TRUE);
@@ -620,7 +1496,7 @@ handle_download (RunContext  *run_context,
   if (download_result != NULL)
     {
       /* Handle errors from the command. */
-      download_uri_finish (download_result, &error);
+      download_items_finish (download_result, &error);
 
       if (error != NULL)
         {
@@ -870,6 +1746,231 @@ notify_cb (GObject    *obj,
   g_print ("%s\n", message);
 }
 
+/* Format a duration in microseconds for printing. */
+static gchar *
+format_usec (guint64 usec)
+{
+  if (usec < G_TIME_SPAN_MILLISECOND)
+    return g_strdup_printf ("%" G_GUINT64_FORMAT "µs", usec);
+  else if (usec < G_TIME_SPAN_SECOND)
+    return g_strdup_printf ("%.1fms", (gdouble) usec / G_TIME_SPAN_MILLISECOND);
+  else
+    return g_strdup_printf ("%.1fs", (gdouble) usec / G_TIME_SPAN_SECOND);
+}
+
+/* Print a histogram from the Metrics interface, in the format given by
+ * mws_latency_histogram_to_variant(): a summary line, then one line for each
+ * non-empty bucket. */
+static void
+print_histogram (const gchar *name,
+                 GVariant    *histogram)
+{
+  g_auto(GVariantDict) dict = G_VARIANT_DICT_INIT (histogram);
+  guint64 count = 0, total_usec = 0, max_usec = 0;
+
+  g_variant_dict_lookup (&dict, "Count", "t", &count);
+  g_variant_dict_lookup (&dict, "TotalMicroseconds", "t", &total_usec);
+  g_variant_dict_lookup (&dict, "MaxMicroseconds", "t", &max_usec);
+
+  if (count == 0)
+    {
+      g_print (_("%s: no samples\n"), name);
+      return;
+    }
+
+  g_autofree gchar *mean_str = format_usec (total_usec / count);
+  g_autofree gchar *max_str = format_usec (max_usec);
+  g_print ("%s: %" G_GUINT64_FORMAT " samples, mean %s, max %s\n",
+           name, count, mean_str, max_str);
+
+  g_autoptr(GVariant) buckets_variant = NULL;
+  buckets_variant = g_variant_dict_lookup_value (&dict, "Buckets",
+                                                 G_VARIANT_TYPE ("at"));
+  if (buckets_variant == NULL)
+    return;
+
+  /* Bucket 0 is for durations under 1µs, bucket i is for durations under
+   * 2^i µs, and the last bucket also includes all longer durations. */
+  gsize n_buckets;
+  const guint64 *buckets = g_variant_get_fixed_array (buckets_variant, &n_buckets,
+                                                      sizeof (guint64));
+
+  for (gsize i = 0; i < n_buckets && i < 64; i++)
+    {
+      if (buckets[i] == 0)
+        continue;
+
+      if (i == 0 || i + 1 < n_buckets)
+        {
+          g_autofree gchar *bound_str = format_usec (G_GUINT64_CONSTANT (1) << i);
+          g_print ("  < %s: %" G_GUINT64_FORMAT "\n", bound_str, buckets[i]);
+        }
+      else
+        {
+          g_autofree gchar *bound_str = format_usec (G_GUINT64_CONSTANT (1) << (i - 1));
+          g_print ("  ≥ %s: %" G_GUINT64_FORMAT "\n", bound_str, buckets[i]);
+        }
+    }
+}
+
+static gint
+compare_strings (gconstpointer a,
+                 gconstpointer b)
+{
+  return g_strcmp0 (*(const gchar * const *) a, *(const gchar * const *) b);
+}
+
+/* Print the metrics from the Metrics interface, in a stable order. Unknown
+ * types of value (from a newer daemon) are printed in GVariant text format. */
+static void
+print_metrics (GVariant *metrics)
+{
+  g_auto(GVariantDict) dict = G_VARIANT_DICT_INIT (metrics);
+  g_autoptr(GPtrArray) keys = g_ptr_array_new_with_free_func (g_free);
+  GVariantIter iter;
+  gchar *key;
+
+  g_variant_iter_init (&iter, metrics);
+  while (g_variant_iter_next (&iter, "{sv}", &key, NULL))
+    g_ptr_array_add (keys, key);
+
+  g_ptr_array_sort (keys, compare_strings);
+
+  for (gsize i = 0; i < keys->len; i++)
+    {
+      const gchar *name = keys->pdata[i];
+      g_autoptr(GVariant) value = g_variant_dict_lookup_value (&dict, name, NULL);
+
+      if (g_variant_is_of_type (value, G_VARIANT_TYPE_VARDICT))
+        {
+          print_histogram (name, value);
+        }
+      else if (g_variant_is_of_type (value, G_VARIANT_TYPE_UINT64))
+        {
+          g_print ("%s: %" G_GUINT64_FORMAT "\n", name, g_variant_get_uint64 (value));
+        }
+      else
+        {
+          g_autofree gchar *value_str = g_variant_print (value, FALSE);
+          g_print ("%s: %s\n", name, value_str);
+        }
+    }
+}
+
+static int
+handle_stats (RunContext  *run_context,
+              int         *argc,
+              char       **argv[])
+{
+  g_autoptr(GError) error = NULL;
+
+  /* Command line parsing. */
+  g_autofree gchar *bus_address = NULL;
+
+  const GOptionEntry entries[] =
+    {
+      { "bus-address", 'a', G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING, &bus_address,
+        N_("Address of the D-Bus daemon to connect to (default: system bus)"),
+        N_("ADDRESS") },
+      { NULL, },
+    };
+
+  g_autoptr(GOptionContext) context = g_option_context_new (NULL);
+  g_option_context_set_summary (context, _("Print download scheduler performance metrics"));
+  g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
+
+  if (!g_option_context_parse (context, argc, argv, &error))
+    {
+      g_autofree gchar *message = NULL;
+      message = g_strdup_printf (_("Option parsing failed: %s"),
+                                 error->message);
+      g_printerr ("%s: %s\n", run_context->argv0, message);
+
+      return EXIT_INVALID_OPTIONS;
+    }
+
+  if (*argc > 1)
+    {
+      g_autofree gchar *message = NULL;
+      message = g_strdup_printf (_("Option parsing failed: %s"),
+                                 _("Too many arguments provided"));
+      g_printerr ("%s: %s\n", run_context->argv0, message);
+
+      return EXIT_INVALID_OPTIONS;
+    }
+
+  /* Connect to D-Bus. If no address was specified on the command line, use the
+   * system bus. */
+  if (bus_address == NULL)
+    {
+      bus_address = g_dbus_address_get_for_bus_sync (G_BUS_TYPE_SYSTEM,
+                                                     run_context->cancellable,
+                                                     &error);
+    }
+
+  if (error != NULL)
+    {
+      g_autofree gchar *message = NULL;
+      message = g_strdup_printf (_("D-Bus system bus unavailable: %s"),
+                                 error->message);
+      g_printerr ("%s: %s\n", run_context->argv0, message);
+
+      return EXIT_BUS_UNAVAILABLE;
+    }
+
+  g_autoptr(GDBusConnection) connection = NULL;
+  connection = g_dbus_connection_new_for_address_sync (bus_address,
+                                                       G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                                       G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                                       NULL  /* observer */,
+                                                       run_context->cancellable,
+                                                       &error);
+
+  if (error != NULL)
+    {
+      g_autofree gchar *message = NULL;
+      message = g_strdup_printf (_("D-Bus bus ‘%s’ unavailable: %s"),
+                                 bus_address, error->message);
+      g_printerr ("%s: %s\n", run_context->argv0, message);
+
+      return EXIT_BUS_UNAVAILABLE;
+    }
+
+  g_autoptr(MwscScheduler) scheduler = NULL;
+  scheduler = mwsc_scheduler_new_full (connection,
+                                       "com.endlessm.MogwaiSchedule1",
+                                       "/com/endlessm/DownloadManager1",
+                                       run_context->cancellable,
+                                       &error);
+
+  if (error != NULL)
+    {
+      g_autofree gchar *message = NULL;
+      message = g_strdup_printf (_("Scheduler could not be created: %s"),
+                                 error->message);
+      g_printerr ("%s: %s\n", run_context->argv0, message);
+
+      return EXIT_BUS_UNAVAILABLE;
+    }
+
+  g_autoptr(GVariant) metrics = NULL;
+  metrics = mwsc_scheduler_get_metrics (scheduler, run_context->cancellable, &error);
+
+  if (error != NULL)
+    {
+      g_autofree gchar *message = NULL;
+      message = g_strdup_printf (_("Metrics could not be retrieved: %s"),
+                                 error->message);
+      g_printerr ("%s: %s\n", run_context->argv0, message);
+
+      return EXIT_FAILED;
+    }
+
+  print_metrics (metrics);
+
+  return EXIT_OK;
+}
+
 int
 main (int   argc,
       char *argv[])
@@ -938,6 +2039,12 @@ main (int   argc,
       argc--;
       exit_status = handle_monitor (&run_context, &argc, &argv);
     }
+  else if (g_str_equal (command, "stats"))
+    {
+      argv++;
+      argc--;
+      exit_status = handle_stats (&run_context, &argc, &argv);
+    }
   else
     {
       /* Assume the user is using the old-style
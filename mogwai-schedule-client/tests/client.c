@@ -195,6 +195,7 @@ test_client_error_handling (Fixture       *fixture,
       { "mogwai-schedule-client", "download", "-p", "-1", "http://example.com/", "out", NULL, },
       { "mogwai-schedule-client", "download", "-p", "", "http://example.com/", "out", NULL, },
       { "mogwai-schedule-client", "monitor", "too", "many", "arguments", NULL, },
+      { "mogwai-schedule-client", "stats", "too", "many", NULL, },
     };
 
   for (gsize i = 0; i < G_N_ELEMENTS (vectors); i++)
@@ -383,6 +384,56 @@ test_client_monitor_simple (Fixture       *fixture,
   assert_client_success (process, fixture->tmpdir, quiet, 2);
 }
 
+/* Test that something is successfully outputted for `stats --help`. */
+static void
+test_client_stats_help (Fixture       *fixture,
+                        gconstpointer  test_data)
+{
+  g_autoptr(GError) error = NULL;
+
+  g_autoptr(GSubprocess) process = NULL;
+  process = g_subprocess_launcher_spawn (fixture->launcher, &error,
+                                         "mogwai-schedule-client", "stats", "--help",
+                                         NULL);
+  g_assert_no_error (error);
+
+  g_autofree gchar *stdout_text = NULL;
+  g_autofree gchar *stderr_text = NULL;
+
+  g_subprocess_communicate_utf8 (process, NULL, NULL, &stdout_text, &stderr_text, &error);
+  g_assert_no_error (error);
+
+  g_assert_cmpint (g_subprocess_get_exit_status (process), ==, 0);
+  g_assert_cmpstr (stdout_text, !=, "");
+  g_assert_cmpstr (stderr_text, ==, "");
+}
+
+/* Test that a failed connection to D-Bus is correctly reported. */
+static void
+test_client_stats_invalid_bus (Fixture       *fixture,
+                               gconstpointer  test_data)
+{
+  g_autoptr(GError) error = NULL;
+
+  g_autoptr(GSubprocess) process = NULL;
+  process = g_subprocess_launcher_spawn (fixture->launcher, &error,
+                                         "mogwai-schedule-client",
+                                         "stats",
+                                         "-a", "not a bus",
+                                         NULL);
+  g_assert_no_error (error);
+
+  g_autofree gchar *stdout_text = NULL;
+  g_autofree gchar *stderr_text = NULL;
+
+  g_subprocess_communicate_utf8 (process, NULL, NULL, &stdout_text, &stderr_text, &error);
+  g_assert_no_error (error);
+
+  g_assert_cmpint (g_subprocess_get_exit_status (process), ==, 2  /* couldn’t connect to bus */);
+  g_assert_cmpstr (stdout_text, ==, "");
+  g_assert_cmpstr (stderr_text, !=, "");
+}
+
 int
 main (int    argc,
       char **argv)
@@ -411,6 +462,10 @@ main (int    argc,
               setup, test_client_monitor_simple, teardown);
   g_test_add ("/client/monitor/simple/quiet", Fixture, GINT_TO_POINTER (TRUE)  /* quiet */,
               setup, test_client_monitor_simple, teardown);
+  g_test_add ("/client/stats/help", Fixture, NULL, setup,
+              test_client_stats_help, teardown);
+  g_test_add ("/client/stats/invalid-bus", Fixture, NULL,
+              setup, test_client_stats_invalid_bus, teardown);
 
   return g_test_run ();
 }
@@ -0,0 +1,687 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <glib-unix.h>
+#include <gio/gio.h>
+#include <libmogwai-schedule/clock-system.h>
+#include <libmogwai-schedule/peer-manager-dbus.h>
+#include <libmogwai-schedule/schedule-service.h>
+#include <libmogwai-schedule/scheduler.h>
+#include <libmogwai-schedule/service.h>
+#include <libmogwai-schedule/tests/connection-monitor-dummy.h>
+#include <libmogwai-schedule-client/schedule-entry.h>
+#include <libmogwai-schedule-client/scheduler.h>
+#include <locale.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/* End-to-end load test for the scheduler daemon. This starts a private
+ * dbus-daemon, and runs a copy of the daemon’s D-Bus service on it in a
+ * subprocess (by re-executing itself with --daemon). The subprocess uses the
+ * real #MwsPeerManagerDBus and #MwsClockSystem, but a
+ * #MwsConnectionMonitorDummy with a single unmetered connection, so it doesn’t
+ * depend on NetworkManager. It then runs --clients simulated clients, each in
+ * its own thread with its own bus connection, using libmogwai-schedule-client.
+ * Each client schedules --entries entries one at a time, then changes the
+ * priority of each of them, then removes them all.
+ *
+ * The results are printed to stdout as tab-separated values, with a header
+ * line, like the scheduler benchmark: the median and 99th percentile client
+ * latencies for each operation in microseconds, the rate of signals emitted by
+ * the daemon (from its Metrics interface), and the daemon’s resident set size
+ * (current and peak) in KiB and CPU usage over the run.
+ *
+ * If --max-p99-latency or --max-rss are given, the test fails if the 99th
+ * percentile Schedule() latency or the daemon’s peak resident set size exceed
+ * them, so it can be used to catch scaling regressions. */
+
+#define DAEMON_NAME "com.endlessm.MogwaiSchedule1"
+#define DAEMON_OBJECT_PATH "/com/endlessm/DownloadManager1"
+
+typedef struct
+{
+  GMainLoop *loop;  /* (unowned) */
+  guint handler_id;
+} SignalData;
+
+static gboolean
+quit_cb (gpointer user_data)
+{
+  SignalData *signal_data = user_data;
+
+  g_main_loop_quit (signal_data->loop);
+
+  /* The source is removed by returning, so don’t remove it again later. */
+  signal_data->handler_id = 0;
+  return G_SOURCE_REMOVE;
+}
+
+static void
+name_lost_cb (GDBusConnection *connection,
+              const gchar     *name,
+              gpointer         user_data)
+{
+  GMainLoop *loop = user_data;
+
+  g_printerr ("%s: Lost D-Bus name ‘%s’\n", g_get_prgname (), name);
+  g_main_loop_quit (loop);
+}
+
+/* Run the daemon side of the test, until SIGTERM or SIGINT is received. */
+static int
+run_daemon (const gchar *address,
+            guint        max_entries)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  g_autoptr(GDBusConnection) connection = NULL;
+  connection = g_dbus_connection_new_for_address_sync (address,
+                                                       G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION |
+                                                       G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+                                                       NULL, NULL, &local_error);
+  if (connection == NULL)
+    {
+      g_printerr ("%s: Error connecting to bus: %s\n",
+                  g_get_prgname (), local_error->message);
+      return EXIT_FAILURE;
+    }
+
+  g_autoptr(MwsConnectionMonitor) connection_monitor = NULL;
+  connection_monitor = MWS_CONNECTION_MONITOR (mws_connection_monitor_dummy_new ());
+
+  MwsConnectionDetails details =
+    {
+      .metered = MWS_METERED_NO,
+      .allow_downloads_when_metered = FALSE,
+      .allow_downloads = TRUE,
+      .tariff = NULL,
+    };
+  g_autoptr(GHashTable) connections = g_hash_table_new (g_str_hash, g_str_equal);
+  g_hash_table_insert (connections, (gpointer) "connection0", &details);
+  mws_connection_monitor_dummy_update_connections (MWS_CONNECTION_MONITOR_DUMMY (connection_monitor),
+                                                   connections, NULL);
+
+  g_autoptr(MwsPeerManager) peer_manager = NULL;
+  peer_manager = MWS_PEER_MANAGER (mws_peer_manager_dbus_new (connection, NULL));
+  g_autoptr(MwsClock) clock = MWS_CLOCK (mws_clock_system_new ());
+
+  g_autoptr(MwsScheduler) scheduler = NULL;
+  scheduler = g_object_new (MWS_TYPE_SCHEDULER,
+                            "connection-monitor", connection_monitor,
+                            "peer-manager", peer_manager,
+                            "clock", clock,
+                            "reschedule-delay", MWS_SERVICE_RESCHEDULE_DELAY_MS,
+                            "max-entries", max_entries,
+                            NULL);
+
+  g_autoptr(MwsScheduleService) service = NULL;
+  service = mws_schedule_service_new (connection, DAEMON_OBJECT_PATH, scheduler);
+
+  if (!mws_schedule_service_register (service, &local_error))
+    {
+      g_printerr ("%s: Error registering service: %s\n",
+                  g_get_prgname (), local_error->message);
+      return EXIT_FAILURE;
+    }
+
+  g_autoptr(GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+  SignalData sigterm_data = { loop, 0 };
+  sigterm_data.handler_id = g_unix_signal_add (SIGTERM, quit_cb, &sigterm_data);
+  SignalData sigint_data = { loop, 0 };
+  sigint_data.handler_id = g_unix_signal_add (SIGINT, quit_cb, &sigint_data);
+
+  /* Own the name last, so clients don’t start until everything is ready. */
+  guint name_id = g_bus_own_name_on_connection (connection, DAEMON_NAME,
+                                                G_BUS_NAME_OWNER_FLAGS_DO_NOT_QUEUE,
+                                                NULL, name_lost_cb,
+                                                loop, NULL);
+
+  g_main_loop_run (loop);
+
+  g_bus_unown_name (name_id);
+  g_clear_handle_id (&sigint_data.handler_id, g_source_remove);
+  g_clear_handle_id (&sigterm_data.handler_id, g_source_remove);
+  mws_schedule_service_unregister (service);
+
+  return EXIT_SUCCESS;
+}
+
+/* State for one simulated client, running in its own thread. The latencies are
+ * in microseconds. */
+typedef struct
+{
+  const gchar *address;  /* (unowned) */
+  guint n_entries;
+  GArray *schedule_latencies;  /* (owned) (element-type gint64) */
+  GArray *update_latencies;  /* (owned) (element-type gint64) */
+  GArray *remove_latencies;  /* (owned) (element-type gint64) */
+  GError *error;  /* (owned) (nullable) */
+} Client;
+
+static void
+client_init (Client      *client,
+             const gchar *address,
+             guint        n_entries)
+{
+  client->address = address;
+  client->n_entries = n_entries;
+  client->schedule_latencies = g_array_sized_new (FALSE, FALSE, sizeof (gint64), n_entries);
+  client->update_latencies = g_array_sized_new (FALSE, FALSE, sizeof (gint64), n_entries);
+  client->remove_latencies = g_array_sized_new (FALSE, FALSE, sizeof (gint64), n_entries);
+  client->error = NULL;
+}
+
+static void
+client_clear (Client *client)
+{
+  g_clear_pointer (&client->schedule_latencies, g_array_unref);
+  g_clear_pointer (&client->update_latencies, g_array_unref);
+  g_clear_pointer (&client->remove_latencies, g_array_unref);
+  g_clear_error (&client->error);
+}
+
+/* Handle any signals which have arrived, as a real client would between
+ * calls. */
+static void
+drain_context (GMainContext *context)
+{
+  while (g_main_context_iteration (context, FALSE));
+}
+
+static void
+record_latency (GArray *latencies,
+                gint64  start_usec)
+{
+  gint64 latency = g_get_monotonic_time () - start_usec;
+  g_array_append_val (latencies, latency);
+}
+
+static gboolean
+client_run (Client        *client,
+            GMainContext  *context,
+            GError       **error)
+{
+  g_autoptr(GDBusConnection) connection = NULL;
+  connection = g_dbus_connection_new_for_address_sync (client->address,
+                                                       G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION |
+                                                       G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+                                                       NULL, NULL, error);
+  if (connection == NULL)
+    return FALSE;
+
+  g_autoptr(MwscScheduler) scheduler = NULL;
+  scheduler = mwsc_scheduler_new_full (connection, DAEMON_NAME, DAEMON_OBJECT_PATH,
+                                       NULL, error);
+  if (scheduler == NULL)
+    return FALSE;
+
+  g_autoptr(GPtrArray) entries = g_ptr_array_new_full (client->n_entries, g_object_unref);
+
+  /* Schedule the entries one at a time, as most clients do. */
+  for (guint i = 0; i < client->n_entries; i++)
+    {
+      g_auto(GVariantDict) dict = G_VARIANT_DICT_INIT (NULL);
+      g_variant_dict_insert (&dict, "priority", "u", (guint32) i);
+
+      gint64 start_usec = g_get_monotonic_time ();
+      MwscScheduleEntry *entry = mwsc_scheduler_schedule (scheduler,
+                                                          g_variant_dict_end (&dict),
+                                                          NULL, error);
+      if (entry == NULL)
+        return FALSE;
+      record_latency (client->schedule_latencies, start_usec);
+
+      g_ptr_array_add (entries, entry);
+      drain_context (context);
+    }
+
+  /* Reverse their priorities, so the active entry changes each time. */
+  for (guint i = 0; i < entries->len; i++)
+    {
+      MwscScheduleEntry *entry = g_ptr_array_index (entries, i);
+      mwsc_schedule_entry_set_priority (entry, client->n_entries - i);
+
+      gint64 start_usec = g_get_monotonic_time ();
+      if (!mwsc_schedule_entry_send_properties (entry, NULL, error))
+        return FALSE;
+      record_latency (client->update_latencies, start_usec);
+
+      drain_context (context);
+    }
+
+  /* Remove them all. */
+  for (guint i = 0; i < entries->len; i++)
+    {
+      MwscScheduleEntry *entry = g_ptr_array_index (entries, i);
+
+      gint64 start_usec = g_get_monotonic_time ();
+      if (!mwsc_schedule_entry_remove (entry, NULL, error))
+        return FALSE;
+      record_latency (client->remove_latencies, start_usec);
+
+      drain_context (context);
+    }
+
+  return g_dbus_connection_close_sync (connection, NULL, error);
+}
+
+static gpointer
+client_thread_cb (gpointer user_data)
+{
+  Client *client = user_data;
+  g_autoptr(GMainContext) context = g_main_context_new ();
+
+  /* Signals for the client’s proxies are delivered in this context. */
+  g_main_context_push_thread_default (context);
+  client_run (client, context, &client->error);
+  g_main_context_pop_thread_default (context);
+
+  return NULL;
+}
+
+static gint
+compare_gint64 (gconstpointer a,
+                gconstpointer b)
+{
+  gint64 a_val = *((const gint64 *) a);
+  gint64 b_val = *((const gint64 *) b);
+
+  return (a_val > b_val) - (a_val < b_val);
+}
+
+/* Get the @percent percentile from @samples, which must be sorted. */
+static gint64
+percentile (GArray *samples,
+            guint   percent)
+{
+  if (samples->len == 0)
+    return 0;
+
+  return g_array_index (samples, gint64, ((samples->len - 1) * percent + 50) / 100);
+}
+
+/* CPU time (in clock ticks) and resident set sizes (in KiB) of a process. */
+typedef struct
+{
+  guint64 cpu_ticks;
+  guint64 rss_kib;
+  guint64 peak_rss_kib;
+} ProcessStats;
+
+static guint64
+parse_status_kib (const gchar *status,
+                  const gchar *key)
+{
+  const gchar *line = strstr (status, key);
+
+  if (line == NULL)
+    return 0;
+
+  return g_ascii_strtoull (line + strlen (key), NULL, 10);
+}
+
+static gboolean
+get_process_stats (const gchar   *pid,
+                   ProcessStats  *out_stats,
+                   GError       **error)
+{
+  g_autofree gchar *stat_path = g_build_filename ("/proc", pid, "stat", NULL);
+  g_autofree gchar *stat = NULL;
+  g_autofree gchar *status_path = g_build_filename ("/proc", pid, "status", NULL);
+  g_autofree gchar *status = NULL;
+
+  if (!g_file_get_contents (stat_path, &stat, NULL, error) ||
+      !g_file_get_contents (status_path, &status, NULL, error))
+    return FALSE;
+
+  /* The command name is in parentheses and may contain spaces, so skip past
+   * it. The first field after it is the state (field 3); utime and stime are
+   * fields 14 and 15. */
+  const gchar *comm_end = strrchr (stat, ')');
+  g_auto(GStrv) fields = NULL;
+
+  if (comm_end != NULL && comm_end[1] == ' ')
+    fields = g_strsplit (comm_end + 2, " ", -1);
+
+  if (fields == NULL || g_strv_length (fields) < 13)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Invalid contents of ‘%s’", stat_path);
+      return FALSE;
+    }
+
+  out_stats->cpu_ticks = (g_ascii_strtoull (fields[11], NULL, 10) +
+                          g_ascii_strtoull (fields[12], NULL, 10));
+  out_stats->rss_kib = parse_status_kib (status, "VmRSS:");
+  out_stats->peak_rss_kib = parse_status_kib (status, "VmHWM:");
+
+  return TRUE;
+}
+
+static void
+async_result_cb (GObject      *obj,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  GAsyncResult **result_out = user_data;
+  *result_out = g_object_ref (result);
+}
+
+/* Get the daemon’s SignalsEmitted counter from its Metrics interface. */
+static gboolean
+get_signals_emitted (GDBusConnection  *connection,
+                     guint64          *out_signals_emitted,
+                     GError          **error)
+{
+  g_autoptr(GVariant) reply = NULL;
+  reply = g_dbus_connection_call_sync (connection, DAEMON_NAME, DAEMON_OBJECT_PATH,
+                                       "com.endlessm.DownloadManager1.Metrics",
+                                       "GetMetrics", NULL, G_VARIANT_TYPE ("(a{sv})"),
+                                       G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                       -1, NULL, error);
+  if (reply == NULL)
+    return FALSE;
+
+  g_autoptr(GVariant) metrics = g_variant_get_child_value (reply, 0);
+
+  if (!g_variant_lookup (metrics, "SignalsEmitted", "t", out_signals_emitted))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "No SignalsEmitted in metrics");
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+name_appeared_cb (GDBusConnection *connection,
+                  const gchar     *name,
+                  const gchar     *name_owner,
+                  gpointer         user_data)
+{
+  gboolean *appeared = user_data;
+  *appeared = TRUE;
+}
+
+static void
+print_header (void)
+{
+  g_print ("clients\tentries\t"
+           "schedule_p50_us\tschedule_p99_us\t"
+           "update_p50_us\tupdate_p99_us\t"
+           "remove_p50_us\tremove_p99_us\t"
+           "signals_per_s\tdaemon_rss_kib\tdaemon_peak_rss_kib\t"
+           "daemon_cpu_percent\n");
+}
+
+/* Run the clients against the daemon (already started as @daemon on the bus at
+ * @address) and print the results. Returns %FALSE if the test fails. */
+static gboolean
+run_clients (GSubprocess      *daemon,
+             GDBusConnection  *connection,
+             const gchar      *address,
+             guint             n_clients,
+             guint             n_entries,
+             guint             max_p99_latency_ms,
+             guint             max_rss_kib,
+             GError          **error)
+{
+  const gchar *daemon_pid = g_subprocess_get_identifier (daemon);
+  ProcessStats stats_before, stats_after;
+  guint64 signals_before, signals_after;
+
+  if (!get_process_stats (daemon_pid, &stats_before, error) ||
+      !get_signals_emitted (connection, &signals_before, error))
+    return FALSE;
+
+  g_autofree Client *clients = g_new0 (Client, n_clients);
+  g_autofree GThread **threads = g_new0 (GThread *, n_clients);
+  gint64 start_usec = g_get_monotonic_time ();
+
+  for (guint i = 0; i < n_clients; i++)
+    {
+      g_autofree gchar *thread_name = g_strdup_printf ("client%u", i);
+
+      client_init (&clients[i], address, n_entries);
+      threads[i] = g_thread_new (thread_name, client_thread_cb, &clients[i]);
+    }
+
+  for (guint i = 0; i < n_clients; i++)
+    g_thread_join (threads[i]);
+
+  gint64 elapsed_usec = MAX (g_get_monotonic_time () - start_usec, 1);
+
+  if (!get_process_stats (daemon_pid, &stats_after, error) ||
+      !get_signals_emitted (connection, &signals_after, error))
+    return FALSE;
+
+  /* Merge the clients’ results. */
+  g_autoptr(GArray) schedule_latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+  g_autoptr(GArray) update_latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+  g_autoptr(GArray) remove_latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+  gboolean success = TRUE;
+
+  for (guint i = 0; i < n_clients; i++)
+    {
+      if (clients[i].error != NULL && success)
+        {
+          g_propagate_prefixed_error (error, g_steal_pointer (&clients[i].error),
+                                      "Error in client %u: ", i);
+          success = FALSE;
+        }
+
+      g_array_append_vals (schedule_latencies, clients[i].schedule_latencies->data,
+                           clients[i].schedule_latencies->len);
+      g_array_append_vals (update_latencies, clients[i].update_latencies->data,
+                           clients[i].update_latencies->len);
+      g_array_append_vals (remove_latencies, clients[i].remove_latencies->data,
+                           clients[i].remove_latencies->len);
+      client_clear (&clients[i]);
+    }
+
+  if (!success)
+    return FALSE;
+
+  g_array_sort (schedule_latencies, compare_gint64);
+  g_array_sort (update_latencies, compare_gint64);
+  g_array_sort (remove_latencies, compare_gint64);
+
+  gdouble elapsed_secs = elapsed_usec / (gdouble) G_USEC_PER_SEC;
+  gdouble signals_per_sec = (signals_after - signals_before) / elapsed_secs;
+  gdouble cpu_percent = 100.0 * (stats_after.cpu_ticks - stats_before.cpu_ticks) /
+                        sysconf (_SC_CLK_TCK) / elapsed_secs;
+  gint64 schedule_p99_usec = percentile (schedule_latencies, 99);
+
+  print_header ();
+  g_print ("%u\t%u\t"
+           "%" G_GINT64_FORMAT "\t%" G_GINT64_FORMAT "\t"
+           "%" G_GINT64_FORMAT "\t%" G_GINT64_FORMAT "\t"
+           "%" G_GINT64_FORMAT "\t%" G_GINT64_FORMAT "\t"
+           "%.1f\t%" G_GUINT64_FORMAT "\t%" G_GUINT64_FORMAT "\t%.1f\n",
+           n_clients, n_entries,
+           percentile (schedule_latencies, 50), schedule_p99_usec,
+           percentile (update_latencies, 50), percentile (update_latencies, 99),
+           percentile (remove_latencies, 50), percentile (remove_latencies, 99),
+           signals_per_sec, stats_after.rss_kib, stats_after.peak_rss_kib,
+           cpu_percent);
+
+  if (max_p99_latency_ms > 0 &&
+      schedule_p99_usec > (gint64) max_p99_latency_ms * 1000)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "99th percentile Schedule() latency of %" G_GINT64_FORMAT
+                   "µs exceeds the limit of %ums",
+                   schedule_p99_usec, max_p99_latency_ms);
+      return FALSE;
+    }
+
+  if (max_rss_kib > 0 && stats_after.peak_rss_kib > max_rss_kib)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Daemon peak RSS of %" G_GUINT64_FORMAT "KiB exceeds the "
+                   "limit of %uKiB",
+                   stats_after.peak_rss_kib, max_rss_kib);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Start the bus and the daemon, run the clients, and shut everything down
+ * again. */
+static gboolean
+run_load_test (guint     n_clients,
+               guint     n_entries,
+               guint     max_p99_latency_ms,
+               guint     max_rss_kib,
+               GError  **error)
+{
+  g_autoptr(GTestDBus) bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+  g_test_dbus_up (bus);
+  const gchar *address = g_test_dbus_get_bus_address (bus);
+
+  g_autofree gchar *clients_str = g_strdup_printf ("%u", n_clients);
+  g_autofree gchar *entries_str = g_strdup_printf ("%u", n_entries);
+
+  g_autoptr(GSubprocess) daemon = NULL;
+  daemon = g_subprocess_new (G_SUBPROCESS_FLAGS_NONE, error,
+                             "/proc/self/exe", "--daemon",
+                             "--address", address,
+                             "--clients", clients_str,
+                             "--entries", entries_str,
+                             NULL);
+  if (daemon == NULL)
+    {
+      g_test_dbus_down (bus);
+      return FALSE;
+    }
+
+  g_autoptr(GAsyncResult) wait_result = NULL;
+  g_subprocess_wait_async (daemon, NULL, async_result_cb, &wait_result);
+
+  gboolean success = FALSE;
+  g_autoptr(GDBusConnection) connection = NULL;
+  connection = g_dbus_connection_new_for_address_sync (address,
+                                                       G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION |
+                                                       G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+                                                       NULL, NULL, error);
+
+  if (connection != NULL)
+    {
+      /* Wait for the daemon to be ready. */
+      gboolean appeared = FALSE;
+      guint watch_id = g_bus_watch_name_on_connection (connection, DAEMON_NAME,
+                                                       G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                       name_appeared_cb, NULL,
+                                                       &appeared, NULL);
+
+      while (!appeared && wait_result == NULL)
+        g_main_context_iteration (NULL, TRUE);
+
+      g_bus_unwatch_name (watch_id);
+
+      if (wait_result != NULL)
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                     "Daemon exited before it was ready");
+      else
+        success = run_clients (daemon, connection, address, n_clients, n_entries,
+                               max_p99_latency_ms, max_rss_kib, error);
+
+      g_dbus_connection_close_sync (connection, NULL, NULL);
+    }
+
+  /* Shut down the daemon. */
+  if (wait_result == NULL)
+    g_subprocess_send_signal (daemon, SIGTERM);
+
+  while (wait_result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_test_dbus_down (bus);
+
+  return success;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  gboolean daemon_mode = FALSE;
+  g_autofree gchar *address = NULL;
+  gint n_clients = 8;
+  gint n_entries = 100;
+  gint max_p99_latency_ms = 0;
+  gint max_rss_kib = 0;
+  g_autoptr(GError) local_error = NULL;
+
+  setlocale (LC_ALL, "");
+
+  const GOptionEntry entries[] =
+    {
+      { "clients", 'c', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &n_clients,
+        "Number of simulated clients", "N" },
+      { "entries", 'n', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &n_entries,
+        "Number of entries each client schedules", "N" },
+      { "max-p99-latency", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &max_p99_latency_ms,
+        "Fail if the 99th percentile Schedule() latency exceeds this", "MS" },
+      { "max-rss", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &max_rss_kib,
+        "Fail if the daemon’s peak resident set size exceeds this", "KIB" },
+      { "daemon", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE, &daemon_mode,
+        "Run the daemon side of the test (internal)", NULL },
+      { "address", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_STRING, &address,
+        "Address of the bus to run the daemon on (internal)", "ADDRESS" },
+      { NULL, },
+    };
+
+  g_autoptr(GOptionContext) context = g_option_context_new ("— load test the scheduler daemon");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &local_error) ||
+      n_clients < 1 || n_entries < 1 ||
+      max_p99_latency_ms < 0 || max_rss_kib < 0 ||
+      (daemon_mode && address == NULL))
+    {
+      g_printerr ("%s: %s\n", g_get_prgname (),
+                  (local_error != NULL) ? local_error->message : "Invalid arguments");
+      return EXIT_FAILURE;
+    }
+
+  /* Leave room for all the clients’ entries. */
+  if (daemon_mode)
+    return run_daemon (address, (guint) n_clients * (guint) n_entries);
+
+  if (!run_load_test (n_clients, n_entries, max_p99_latency_ms, max_rss_kib,
+                      &local_error))
+    {
+      g_printerr ("%s: %s\n", g_get_prgname (), local_error->message);
+      return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
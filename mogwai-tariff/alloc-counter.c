@@ -0,0 +1,119 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *  - Philip Withnall <withnall@endlessm.com>
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <stdlib.h>
+
+#include "mogwai-tariff/alloc-counter.h"
+
+
+/* Counting of heap allocations, for `mogwai-tariff bench`.
+ *
+ * GLib no longer allows its allocator to be replaced, so this works by
+ * overriding malloc(), calloc() and realloc() for the whole process, and
+ * forwarding them to the C library’s implementations. That’s only possible
+ * with glibc, which exports those implementations under other names.
+ * Elsewhere, allocations aren’t counted.
+ *
+ * The overrides only check a flag when not counting, so they don’t noticeably
+ * slow down the rest of the utility. */
+
+#ifdef HAVE_LIBC_MALLOC
+
+extern void *__libc_malloc  (size_t size);
+extern void *__libc_calloc  (size_t n_members,
+                             size_t size);
+extern void *__libc_realloc (void   *ptr,
+                             size_t  size);
+
+static gint counting = 0;
+static gsize n_allocations = 0;
+
+static inline void
+count_allocation (void)
+{
+  if (g_atomic_int_get (&counting))
+    g_atomic_pointer_add (&n_allocations, 1);
+}
+
+void *
+malloc (size_t size)
+{
+  count_allocation ();
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t n_members,
+        size_t size)
+{
+  count_allocation ();
+  return __libc_calloc (n_members, size);
+}
+
+void *
+realloc (void   *ptr,
+         size_t  size)
+{
+  count_allocation ();
+  return __libc_realloc (ptr, size);
+}
+
+#endif  /* HAVE_LIBC_MALLOC */
+
+/* Whether allocations can be counted on this platform. If not,
+ * mwt_alloc_counter_stop() always returns zero. */
+gboolean
+mwt_alloc_counter_is_supported (void)
+{
+#ifdef HAVE_LIBC_MALLOC
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+/* Reset the count of allocations, and start counting them. */
+void
+mwt_alloc_counter_start (void)
+{
+#ifdef HAVE_LIBC_MALLOC
+  n_allocations = 0;
+  g_atomic_int_set (&counting, 1);
+#endif
+}
+
+/* Stop counting allocations, and return how many there were since
+ * mwt_alloc_counter_start() was called. Allocations using any of malloc(),
+ * calloc() or realloc(), from any thread, are counted. */
+gsize
+mwt_alloc_counter_stop (void)
+{
+#ifdef HAVE_LIBC_MALLOC
+  g_atomic_int_set (&counting, 0);
+  return (gsize) g_atomic_pointer_get (&n_allocations);
+#else
+  return 0;
+#endif
+}
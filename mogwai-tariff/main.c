@@ -25,16 +25,20 @@
 #include <gio/gio.h>
 #include <glib.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 #include <glib-object.h>
 #include <glib-unix.h>
 #include <libmogwai-tariff/tariff-builder.h>
 #include <libmogwai-tariff/tariff-loader.h>
+#include <errno.h>
 #include <locale.h>
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "mogwai-tariff/alloc-counter.h"
+
 
 /* FIXME: Add tests for this client. */
 
@@ -242,23 +246,10 @@ load_tariff_from_file (const gchar  *tariff_path,
 {
   g_autofree gchar *tariff_path_utf8 = g_filename_display_name (tariff_path);
 
-  /* Load the file. */
-  g_autoptr(GMappedFile) mmap = NULL;
-
-  mmap = g_mapped_file_new (tariff_path, FALSE  /* read-only */, error);
-  if (mmap == NULL)
-    {
-      g_prefix_error (error, _("Error loading tariff file ‘%s’: "),
-                      tariff_path_utf8);
-      return NULL;
-    }
-
-  g_autoptr(GBytes) bytes = g_mapped_file_get_bytes (mmap);
-
   /* Load the tariff. */
   g_autoptr(MwtTariffLoader) loader = mwt_tariff_loader_new ();
 
-  if (!mwt_tariff_loader_load_from_bytes (loader, bytes, error))
+  if (!mwt_tariff_loader_load_from_file (loader, tariff_path, error))
     {
       g_prefix_error (error, _("Error loading tariff file ‘%s’: "),
                       tariff_path_utf8);
@@ -345,16 +336,194 @@ capacity_limit_from_string (const gchar  *str,
                                      capacity_limit_out, error);
 }
 
+/* A cache of the result of the last lookup in `mogwai-tariff lookup --batch`.
+ * The period which applies can only change at a transition, so the result
+ * applies to all times from @valid_from_usec (inclusive) up to the next
+ * transition at @valid_until_usec (exclusive). If the input times are sorted,
+ * most lookups will hit the cursor, which makes them O(1) amortised. */
+typedef struct
+{
+  gint64 valid_from_usec;
+  gint64 valid_until_usec;
+  gchar *result;  /* (owned) (nullable) */
+} LookupCursor;
+
+static void
+lookup_cursor_clear (LookupCursor *cursor)
+{
+  g_clear_pointer (&cursor->result, g_free);
+}
+
+G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC (LookupCursor, lookup_cursor_clear)
+
+/* Format the result of looking up @lookup_time in @tariff as a line for
+ * `mogwai-tariff lookup --batch` (without the leading LOOKUP-TIME or trailing
+ * newline): the start and end of the recurrence of the period which covers
+ * @lookup_time, and its capacity limit; or `-` for each of them if no period
+ * matches. */
+static gchar *
+format_batch_result (GDateTime *lookup_time,
+                     MwtPeriod *period)
+{
+  g_autoptr(GDateTime) start = NULL;
+  g_autoptr(GDateTime) end = NULL;
+
+  if (period == NULL ||
+      !mwt_period_contains_time (period, lookup_time, &start, &end))
+    return g_strdup ("-\t-\t-");
+
+  g_autofree gchar *start_str = g_date_time_format (start, "%Y-%m-%dT%H:%M:%S%:::z");
+  g_autofree gchar *end_str = g_date_time_format (end, "%Y-%m-%dT%H:%M:%S%:::z");
+  guint64 capacity_limit = mwt_period_get_capacity_limit (period);
+
+  if (capacity_limit == G_MAXUINT64)
+    return g_strdup_printf ("%s\t%s\tunlimited", start_str, end_str);
+  else
+    return g_strdup_printf ("%s\t%s\t%" G_GUINT64_FORMAT,
+                            start_str, end_str, capacity_limit);
+}
+
+/* Minimum amount of output to buffer in `mogwai-tariff lookup --batch` before
+ * writing it to stdout. */
+#define BATCH_OUTPUT_BUFFER_SIZE (64 * 1024)
+
+/* Write all of @output to stdout, and empty it. */
+static gboolean
+flush_batch_output (GString  *output,
+                    GError  **error)
+{
+  if (fwrite (output->str, 1, output->len, stdout) != output->len)
+    {
+      int errsv = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   _("Error writing to stdout: %s"), g_strerror (errsv));
+      return FALSE;
+    }
+
+  g_string_truncate (output, 0);
+
+  return TRUE;
+}
+
+/* Handle a command like
+ *   mogwai-tariff lookup --batch tariff.file < times.txt
+ * by loading the tariff once, and then looking up each of the newline-separated
+ * times from stdin in it. One result line is printed for each non-empty input
+ * line, containing the input time, and the start, end and capacity limit of the
+ * period which applies at that time; separated by tabs.
+ */
+static gboolean
+handle_lookup_batch (const gchar  *tariff_path,
+                     GError      **error)
+{
+  g_autoptr(MwtTariff) tariff = load_tariff_from_file (tariff_path, error);
+  if (tariff == NULL)
+    return FALSE;
+
+  g_auto(LookupCursor) cursor = { G_MAXINT64, G_MININT64, NULL };
+  g_autoptr(GString) output = g_string_sized_new (BATCH_OUTPUT_BUFFER_SIZE);
+  g_autofree gchar *line = NULL;
+  gsize line_size = 0;
+  guint line_number = 0;
+
+  while (getline (&line, &line_size, stdin) >= 0)
+    {
+      line_number++;
+
+      const gchar *lookup_time_str = g_strstrip (line);
+      if (*lookup_time_str == '\0')
+        continue;
+
+      g_autoptr(GDateTime) lookup_time = g_date_time_new_from_iso8601 (lookup_time_str, NULL);
+      if (lookup_time == NULL)
+        {
+          /* Output the results for the preceding lines before failing. */
+          flush_batch_output (output, NULL);
+
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       _("Invalid ISO 8601 date/time ‘%s’ on line %u."),
+                       lookup_time_str, line_number);
+          return FALSE;
+        }
+
+      gint64 lookup_time_usec = g_date_time_to_unix (lookup_time) * G_USEC_PER_SEC +
+                                g_date_time_get_microsecond (lookup_time);
+
+      if (lookup_time_usec < cursor.valid_from_usec ||
+          lookup_time_usec >= cursor.valid_until_usec)
+        {
+          MwtPeriod *period = mwt_tariff_lookup_period_usec (tariff, lookup_time_usec);
+          gint64 next_transition_usec;
+
+          if (!mwt_tariff_get_next_transition_usec (tariff, lookup_time_usec,
+                                                    &next_transition_usec,
+                                                    NULL, NULL))
+            next_transition_usec = G_MAXINT64;
+
+          g_free (cursor.result);
+          cursor.result = format_batch_result (lookup_time, period);
+          cursor.valid_from_usec = lookup_time_usec;
+          cursor.valid_until_usec = next_transition_usec;
+        }
+
+      g_string_append (output, lookup_time_str);
+      g_string_append_c (output, '\t');
+      g_string_append (output, cursor.result);
+      g_string_append_c (output, '\n');
+
+      if (output->len >= BATCH_OUTPUT_BUFFER_SIZE &&
+          !flush_batch_output (output, error))
+        return FALSE;
+    }
+
+  if (ferror (stdin))
+    {
+      int errsv = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   _("Error reading from stdin: %s"), g_strerror (errsv));
+      return FALSE;
+    }
+
+  if (!flush_batch_output (output, error))
+    return FALSE;
+
+  if (fflush (stdout) != 0)
+    {
+      int errsv = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   _("Error writing to stdout: %s"), g_strerror (errsv));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
 /* Handle a command like
  *   mogwai-tariff lookup tariff.file 2018-10-02T10:15:00Z
  * by looking up which period applies at that time, and dumping its properties.
+ * If @batch is %TRUE, the times are read from stdin instead; see
+ * handle_lookup_batch().
  */
 static gboolean
 handle_lookup (const gchar * const  *args,
+               gboolean              batch,
                gboolean              use_colour,
                GError              **error)
 {
   /* Parse arguments. */
+  if (batch)
+    {
+      if (args == NULL || g_strv_length ((gchar **) args) != 1)
+        {
+          g_set_error_literal (error, MWT_CLIENT_ERROR,
+                               MWT_CLIENT_ERROR_INVALID_OPTIONS,
+                               _("A TARIFF is required, and LOOKUP-TIMEs must be passed on stdin."));
+          return FALSE;
+        }
+
+      return handle_lookup_batch (args[0], error);
+    }
+
   if (args == NULL || g_strv_length ((gchar **) args) != 2)
     {
       g_set_error_literal (error, MWT_CLIENT_ERROR,
@@ -426,21 +595,141 @@ handle_dump (const gchar * const  *args,
   return TRUE;
 }
 
+/* Add the periods listed in the CSV file at @csv_path (or stdin, if it’s `-`)
+ * to @builder. Each line of the file gives one period, as
+ *   start,end,repeat-type,repeat-period,capacity-limit
+ * in the same formats as the arguments to `mogwai-tariff build`. Empty lines,
+ * and lines starting with `#`, are ignored.
+ *
+ * The periods are added using mwt_tariff_builder_add_period_fields(), so no
+ * #MwtPeriod is created for each one, which makes building tariffs with a lot
+ * of periods a lot faster. */
+static gboolean
+add_periods_from_csv (MwtTariffBuilder  *builder,
+                      const gchar       *csv_path,
+                      GError           **error)
+{
+  gboolean use_stdin = g_str_equal (csv_path, "-");
+  g_autofree gchar *csv_path_utf8 = use_stdin ? g_strdup ("stdin") : g_filename_display_name (csv_path);
+  FILE *file = use_stdin ? stdin : g_fopen (csv_path, "r");
+
+  if (file == NULL)
+    {
+      int errsv = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   _("Error opening CSV file ‘%s’: %s"),
+                   csv_path_utf8, g_strerror (errsv));
+      return FALSE;
+    }
+
+  g_autofree gchar *line = NULL;
+  gsize line_size = 0;
+  guint line_number = 0;
+  gboolean success = TRUE;
+  g_autoptr(GError) local_error = NULL;
+
+  while (getline (&line, &line_size, file) >= 0)
+    {
+      line_number++;
+
+      const gchar *stripped_line = g_strstrip (line);
+      if (*stripped_line == '\0' || *stripped_line == '#')
+        continue;
+
+      g_auto(GStrv) fields = g_strsplit (stripped_line, ",", 0);
+      if (g_strv_length (fields) != 5)
+        {
+          g_set_error_literal (&local_error, MWT_CLIENT_ERROR,
+                               MWT_CLIENT_ERROR_INVALID_OPTIONS,
+                               _("Expected 5 comma-separated fields."));
+          success = FALSE;
+          break;
+        }
+
+      for (gsize i = 0; fields[i] != NULL; i++)
+        g_strstrip (fields[i]);
+
+      g_autoptr(GDateTime) start = NULL;
+      g_autoptr(GDateTime) end = NULL;
+      MwtPeriodRepeatType repeat_type = MWT_PERIOD_REPEAT_NONE;
+      guint64 repeat_period64 = 0;
+      guint64 capacity_limit = 0;
+
+      if ((start = date_time_from_string (fields[0], &local_error)) == NULL)
+        g_prefix_error (&local_error, _("Invalid START: "));
+      else if ((end = date_time_from_string (fields[1], &local_error)) == NULL)
+        g_prefix_error (&local_error, _("Invalid END: "));
+      else if (!repeat_type_from_string (fields[2], &repeat_type, &local_error))
+        g_prefix_error (&local_error, _("Invalid REPEAT-TYPE: "));
+      else if (!g_ascii_string_to_unsigned (fields[3], 10, 0, G_MAXUINT,
+                                            &repeat_period64, &local_error))
+        g_prefix_error (&local_error, _("Invalid REPEAT-PERIOD: "));
+      else if (!capacity_limit_from_string (fields[4], &capacity_limit, &local_error))
+        g_prefix_error (&local_error, _("Invalid CAPACITY-LIMIT: "));
+
+      if (local_error != NULL)
+        {
+          success = FALSE;
+          break;
+        }
+
+      /* Timestamps before the Unix epoch can’t be stored in a tariff file;
+       * pass them through as out of range, so the builder rejects them. */
+      gint64 start_unix = g_date_time_to_unix (start);
+      gint64 end_unix = g_date_time_to_unix (end);
+
+      mwt_tariff_builder_add_period_fields (builder,
+                                            (start_unix >= 0) ? (guint64) start_unix : G_MAXUINT64,
+                                            g_time_zone_get_identifier (g_date_time_get_timezone (start)),
+                                            (end_unix >= 0) ? (guint64) end_unix : G_MAXUINT64,
+                                            g_time_zone_get_identifier (g_date_time_get_timezone (end)),
+                                            repeat_type, (guint) repeat_period64,
+                                            capacity_limit);
+    }
+
+  if (success && ferror (file))
+    {
+      int errsv = errno;
+      g_set_error (&local_error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "%s", g_strerror (errsv));
+      success = FALSE;
+    }
+
+  if (!use_stdin)
+    fclose (file);
+
+  if (!success)
+    {
+      g_propagate_prefixed_error (error, g_steal_pointer (&local_error),
+                                  _("Error reading line %u of CSV file ‘%s’: "),
+                                  line_number, csv_path_utf8);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
 /* Handle a command like
  *   mogwai-tariff build tariff.file name \
  *     [start end repeat-type repeat-period capacity-limit] \
  *     …
- * by building and saving the given tariff.
+ * by building and saving the given tariff. If @from_csv_path is non-%NULL,
+ * more periods are read from that CSV file; see add_periods_from_csv(). If
+ * @base64 is %TRUE, the tariff is saved base64-encoded, in the form expected
+ * by the `connection.tariff-bin` NetworkManager user setting.
  */
 static gboolean
 handle_build (const gchar * const  *args,
+              const gchar          *from_csv_path,
+              gboolean              base64,
               gboolean              use_colour,
               GError              **error)
 {
   /* Parse arguments. */
   const guint n_args_per_period = 5;
+  const guint min_n_periods = (from_csv_path != NULL) ? 0 : 1;
   guint n_args = (args != NULL) ? g_strv_length ((gchar **) args) : 0;
-  if (args == NULL || n_args < 2 + n_args_per_period ||
+  if (args == NULL || n_args < 2 + n_args_per_period * min_n_periods ||
       ((n_args - 2) % n_args_per_period) != 0)
     {
       g_set_error_literal (error, MWT_CLIENT_ERROR,
@@ -517,6 +806,10 @@ handle_build (const gchar * const  *args,
       mwt_tariff_builder_add_period (builder, period);
     }
 
+  if (from_csv_path != NULL &&
+      !add_periods_from_csv (builder, from_csv_path, error))
+    return FALSE;
+
   /* Save the tariff. */
   g_autoptr(GBytes) bytes = mwt_tariff_builder_get_tariff_as_bytes (builder);
   if (bytes == NULL)
@@ -528,6 +821,15 @@ handle_build (const gchar * const  *args,
       return FALSE;
     }
 
+  if (base64)
+    {
+      gsize data_len;
+      const guchar *data = g_bytes_get_data (bytes, &data_len);
+      gchar *encoded = g_base64_encode (data, data_len);
+      g_bytes_unref (bytes);
+      bytes = g_bytes_new_take (encoded, strlen (encoded));
+    }
+
   if (!g_file_set_contents (tariff_path, g_bytes_get_data (bytes, NULL),
                             g_bytes_get_size (bytes), error))
     {
@@ -540,6 +842,209 @@ handle_build (const gchar * const  *args,
   return TRUE;
 }
 
+/* Number of distinct random times to query in `mogwai-tariff bench`. They are
+ * reused if more queries than this are run, to bound memory use. */
+#define BENCH_MAX_TIMES (1 << 16)
+
+/* Minimum time to spend loading the tariff repeatedly in `mogwai-tariff bench`,
+ * to get a stable measurement of the load time. */
+#define BENCH_MIN_LOAD_TIME_USEC (100 * G_TIME_SPAN_MILLISECOND)
+
+/* A query to benchmark. It must return whether the query found a result, so
+ * the compiler can’t optimise it away. @when and @when_usec are the same
+ * time. */
+typedef gboolean (*BenchQueryFunc) (MwtTariff *tariff,
+                                    GDateTime *when,
+                                    gint64     when_usec);
+
+static gboolean
+bench_lookup_period (MwtTariff *tariff,
+                     GDateTime *when,
+                     gint64     when_usec)
+{
+  return (mwt_tariff_lookup_period (tariff, when) != NULL);
+}
+
+static gboolean
+bench_get_next_transition (MwtTariff *tariff,
+                           GDateTime *when,
+                           gint64     when_usec)
+{
+  g_autoptr(GDateTime) next = mwt_tariff_get_next_transition (tariff, when, NULL, NULL);
+  return (next != NULL);
+}
+
+static gboolean
+bench_lookup_period_usec (MwtTariff *tariff,
+                          GDateTime *when,
+                          gint64     when_usec)
+{
+  return (mwt_tariff_lookup_period_usec (tariff, when_usec) != NULL);
+}
+
+static gboolean
+bench_get_next_transition_usec (MwtTariff *tariff,
+                                GDateTime *when,
+                                gint64     when_usec)
+{
+  gint64 next_usec;
+  return mwt_tariff_get_next_transition_usec (tariff, when_usec, &next_usec, NULL, NULL);
+}
+
+/* Run @n_queries of @func, cycling through the @n_times times in @times and
+ * @times_usec, and print how long they took per query. Then run each of the
+ * times through @func once more, counting allocations. */
+static void
+bench_queries (const gchar    *name,
+               BenchQueryFunc  func,
+               MwtTariff      *tariff,
+               GDateTime     **times,
+               const gint64   *times_usec,
+               gsize           n_times,
+               guint64         n_queries)
+{
+  guint64 n_found = 0;
+  gint64 start_usec = g_get_monotonic_time ();
+
+  for (guint64 i = 0; i < n_queries; i++)
+    {
+      gsize j = i % n_times;
+      n_found += func (tariff, times[j], times_usec[j]) ? 1 : 0;
+    }
+
+  gint64 duration_usec = g_get_monotonic_time () - start_usec;
+
+  mwt_alloc_counter_start ();
+  for (gsize j = 0; j < n_times; j++)
+    func (tariff, times[j], times_usec[j]);
+  gsize n_allocations = mwt_alloc_counter_stop ();
+
+  g_print ("%-28s %10.1f ns/query", name,
+           (gdouble) duration_usec * 1000.0 / (gdouble) n_queries);
+  if (mwt_alloc_counter_is_supported ())
+    g_print (" %8.2f allocations/query", (gdouble) n_allocations / (gdouble) n_times);
+  g_print (" (%" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " found)\n",
+           n_found, n_queries);
+}
+
+/* Handle a command like
+ *   mogwai-tariff bench tariff.file [n-queries]
+ * by timing how long the tariff takes to load, and how long random queries on
+ * it take.
+ */
+static gboolean
+handle_bench (const gchar * const  *args,
+              gboolean              use_colour,
+              GError              **error)
+{
+  /* Parse arguments. */
+  guint n_args = (args != NULL) ? g_strv_length ((gchar **) args) : 0;
+  if (n_args < 1 || n_args > 2)
+    {
+      g_set_error_literal (error, MWT_CLIENT_ERROR,
+                           MWT_CLIENT_ERROR_INVALID_OPTIONS,
+                           _("A TARIFF is required."));
+      return FALSE;
+    }
+
+  const gchar *tariff_path = args[0];
+  guint64 n_queries = 1000000;
+
+  g_autoptr(GError) local_error = NULL;
+
+  if (n_args > 1 &&
+      !g_ascii_string_to_unsigned (args[1], 10, 1, G_MAXUINT64,
+                                   &n_queries, &local_error))
+    {
+      g_set_error (error, MWT_CLIENT_ERROR, MWT_CLIENT_ERROR_INVALID_OPTIONS,
+                   _("Invalid N-QUERIES: %s"), local_error->message);
+      return FALSE;
+    }
+
+  /* Time loading the tariff. Load it repeatedly, so the time is stable. */
+  g_autoptr(MwtTariff) tariff = NULL;
+  guint n_loads = 0;
+  gint64 start_usec = g_get_monotonic_time ();
+  gint64 load_duration_usec;
+
+  do
+    {
+      g_clear_object (&tariff);
+      tariff = load_tariff_from_file (tariff_path, error);
+      if (tariff == NULL)
+        return FALSE;
+
+      n_loads++;
+      load_duration_usec = g_get_monotonic_time () - start_usec;
+    }
+  while (load_duration_usec < BENCH_MIN_LOAD_TIME_USEC);
+
+  /* Work out the time range to query across. If any of the periods recur, go
+   * beyond the end of the last period, to cover some of the recurrences. */
+  GPtrArray *periods = mwt_tariff_get_periods (tariff);
+  gint64 range_start_usec = G_MAXINT64;
+  gint64 range_end_usec = G_MININT64;
+  gboolean any_recur = FALSE;
+
+  for (gsize i = 0; i < periods->len; i++)
+    {
+      MwtPeriod *period = g_ptr_array_index (periods, i);
+
+      range_start_usec = MIN (range_start_usec, mwt_period_get_start_usec (period));
+      range_end_usec = MAX (range_end_usec, mwt_period_get_end_usec (period));
+      any_recur = any_recur || (mwt_period_get_repeat_type (period) != MWT_PERIOD_REPEAT_NONE);
+    }
+
+  if (any_recur)
+    range_end_usec += MAX (range_end_usec - range_start_usec, 365 * G_TIME_SPAN_DAY);
+
+  /* Generate the times to query, to the nearest second. Use a fixed seed so
+   * the results can be compared between runs. */
+  g_autoptr(GRand) rand = g_rand_new_with_seed (0);
+  gsize n_times = (gsize) MIN (n_queries, BENCH_MAX_TIMES);
+  g_autofree GDateTime **times = g_new0 (GDateTime *, n_times);
+  g_autofree gint64 *times_usec = g_new0 (gint64, n_times);
+
+  for (gsize i = 0; i < n_times; i++)
+    {
+      gint64 when_secs = (gint64) g_rand_double_range (rand,
+                                                       (gdouble) (range_start_usec / G_USEC_PER_SEC),
+                                                       (gdouble) (range_end_usec / G_USEC_PER_SEC));
+      times_usec[i] = when_secs * G_USEC_PER_SEC;
+      times[i] = g_date_time_new_from_unix_utc (when_secs);
+    }
+
+  /* Print the results. */
+  g_autofree gchar *range_start_str = NULL;
+  g_autofree gchar *range_end_str = NULL;
+  g_autoptr(GDateTime) range_start = g_date_time_new_from_unix_utc (range_start_usec / G_USEC_PER_SEC);
+  g_autoptr(GDateTime) range_end = g_date_time_new_from_unix_utc (range_end_usec / G_USEC_PER_SEC);
+  range_start_str = g_date_time_format (range_start, "%Y-%m-%dT%H:%M:%S%:::z");
+  range_end_str = g_date_time_format (range_end, "%Y-%m-%dT%H:%M:%S%:::z");
+
+  g_print (_("Tariff ‘%s’: %u periods\n"), mwt_tariff_get_name (tariff), periods->len);
+  g_print (_("Load time: %.1f µs (mean of %u loads)\n"),
+           (gdouble) load_duration_usec / (gdouble) n_loads, n_loads);
+  g_print (_("Querying %" G_GUINT64_FORMAT " random times between %s and %s\n"),
+           n_queries, range_start_str, range_end_str);
+  if (!mwt_alloc_counter_is_supported ())
+    g_print (_("Allocations can’t be counted on this platform\n"));
+
+  bench_queries ("lookup_period", bench_lookup_period,
+                 tariff, times, times_usec, n_times, n_queries);
+  bench_queries ("get_next_transition", bench_get_next_transition,
+                 tariff, times, times_usec, n_times, n_queries);
+  bench_queries ("lookup_period_usec", bench_lookup_period_usec,
+                 tariff, times, times_usec, n_times, n_queries);
+  bench_queries ("get_next_transition_usec", bench_get_next_transition_usec,
+                 tariff, times, times_usec, n_times, n_queries);
+
+  for (gsize i = 0; i < n_times; i++)
+    g_date_time_unref (times[i]);
+
+  return TRUE;
+}
+
 int
 main (int   argc,
       char *argv[])
@@ -569,9 +1074,20 @@ main (int   argc,
 
   /* Handle command line parameters. */
   g_auto (GStrv) args = NULL;
+  gboolean batch = FALSE;
+  gboolean base64 = FALSE;
+  g_autofree gchar *from_csv_path = NULL;
 
   const GOptionEntry entries[] =
     {
+      { "batch", 'b', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &batch,
+        N_("Read LOOKUP-TIMEs from stdin, one per line (lookup only)"), NULL },
+      { "base64", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &base64,
+        N_("Save the TARIFF base64-encoded, for connection.tariff-bin (build only)"),
+        NULL },
+      { "from-csv", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME, &from_csv_path,
+        N_("Read PERIODs from the given CSV file, or ‘-’ for stdin (build only)"),
+        N_("FILE") },
       { G_OPTION_REMAINING, 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING_ARRAY,
         &args, NULL, NULL },
       { NULL, },
@@ -585,10 +1101,20 @@ main (int   argc,
         "  build TARIFF NAME START END REPEAT-TYPE REPEAT-PERIOD CAPACITY-LIMIT […]\n"
         "    Build a new tariff called NAME and save it to the TARIFF file.\n"
         "    Add one or more periods using the given arguments.\n"
+        "  build --from-csv FILE TARIFF NAME […]\n"
+        "    Build a new tariff, adding periods from FILE, one per line, as\n"
+        "    START,END,REPEAT-TYPE,REPEAT-PERIOD,CAPACITY-LIMIT.\n"
+        "  build --base64 TARIFF NAME […]\n"
+        "    Build a new tariff and save it base64-encoded, as used by the\n"
+        "    connection.tariff-bin NetworkManager user setting.\n"
         "  dump TARIFF\n"
         "    Dump all periods from the given TARIFF file.\n"
         "  lookup TARIFF LOOKUP-TIME\n"
-        "    Look up the period which covers LOOKUP-TIME in the given TARIFF file.\n"));
+        "    Look up the period which covers LOOKUP-TIME in the given TARIFF file.\n"
+        "  lookup --batch TARIFF\n"
+        "    Look up each LOOKUP-TIME read from stdin in the given TARIFF file.\n"
+        "  bench TARIFF [N-QUERIES]\n"
+        "    Time loading the given TARIFF file, and N-QUERIES random lookups in it.\n"));
   g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
 
   if (!g_option_context_parse (context, &argc, &argv, &error))
@@ -612,12 +1138,24 @@ main (int   argc,
     }
 
   /* Handle the different commands. */
-  if (g_str_equal (args[0], "build"))
-    handle_build ((const gchar * const *) args + 1, use_colour, &error);
+  if (batch && !g_str_equal (args[0], "lookup"))
+    g_set_error (&error, MWT_CLIENT_ERROR, MWT_CLIENT_ERROR_INVALID_OPTIONS,
+                 _("--batch is only supported by the lookup command"));
+  else if (from_csv_path != NULL && !g_str_equal (args[0], "build"))
+    g_set_error (&error, MWT_CLIENT_ERROR, MWT_CLIENT_ERROR_INVALID_OPTIONS,
+                 _("--from-csv is only supported by the build command"));
+  else if (base64 && !g_str_equal (args[0], "build"))
+    g_set_error (&error, MWT_CLIENT_ERROR, MWT_CLIENT_ERROR_INVALID_OPTIONS,
+                 _("--base64 is only supported by the build command"));
+  else if (g_str_equal (args[0], "build"))
+    handle_build ((const gchar * const *) args + 1, from_csv_path, base64,
+                  use_colour, &error);
   else if (g_str_equal (args[0], "dump"))
     handle_dump ((const gchar * const *) args + 1, use_colour, &error);
   else if (g_str_equal (args[0], "lookup"))
-    handle_lookup ((const gchar * const *) args + 1, use_colour, &error);
+    handle_lookup ((const gchar * const *) args + 1, batch, use_colour, &error);
+  else if (g_str_equal (args[0], "bench"))
+    handle_bench ((const gchar * const *) args + 1, use_colour, &error);
   else
     g_set_error (&error, MWT_CLIENT_ERROR, MWT_CLIENT_ERROR_INVALID_OPTIONS,
                  _("Unrecognised command ‘%s’"), args[1]);
@@ -20,6 +20,7 @@
 
 """Integration tests for the mogwai-tariff utility."""
 
+import base64
 import os
 import shutil
 import subprocess
@@ -67,7 +68,7 @@ class TestMogwaiTariff(unittest.TestCase):
     def tearDown(self):
         shutil.rmtree(self.tmpdir)
 
-    def runMogwaiTariff(self, *args):
+    def runMogwaiTariff(self, *args, stdin=None):
         argv = [self.__mogwai_tariff]
         argv.extend(args)
         print('Running:', argv)
@@ -77,6 +78,7 @@ class TestMogwaiTariff(unittest.TestCase):
         print('Environment:', env)
 
         info = subprocess.run(argv, timeout=self.timeout_seconds,
+                              input=stdin,
                               stdout=subprocess.PIPE,
                               stderr=subprocess.STDOUT,
                               env=env)
@@ -153,6 +155,141 @@ class TestMogwaiTariff(unittest.TestCase):
 
         os.remove('tariff1')
 
+    def test_build_from_csv(self):
+        """Test building a tariff with periods from a CSV file."""
+        with open('periods.csv', 'w') as csv:
+            csv.write('# start,end,repeat-type,repeat-period,capacity-limit\n'
+                      '2017-01-02T00:00:00Z, 2017-01-02T05:00:00Z, day, 1, '
+                      '2000000\n'
+                      '\n'
+                      '2017-01-01T00:00:00Z,2018-01-01T00:00:00Z,none,0,'
+                      'unlimited\n')
+
+        info = self.runMogwaiTariff('build', '--from-csv', 'periods.csv',
+                                    'csv', 'csv')
+        info.check_returncode()
+        self.assertTrue(os.path.exists('csv'))
+
+        info = self.runMogwaiTariff('dump', 'csv')
+        info.check_returncode()
+        out = normalise_output(info.stdout)
+        self.assertIn(
+            'Tariff ‘csv’\n'
+            '------------\n'
+            '\n'
+            'Period 2017-01-01T00:00:00+00 – 2018-01-01T00:00:00+00:\n'
+            ' • Never repeats\n'
+            ' • Capacity limit: unlimited\n'
+            'Period 2017-01-02T00:00:00+00 – 2017-01-02T05:00:00+00:\n'
+            ' • Repeats every 1 day\n'
+            ' • Capacity limit: 2.0 MB (2000000 bytes)', out)
+
+        # Periods can also be read from stdin, and combined with ones from the
+        # arguments.
+        info = self.runMogwaiTariff('build', '--from-csv', '-',
+                                    'csv', 'csv',
+                                    '2017-01-01T00:00:00Z',
+                                    '2018-01-01T00:00:00Z',
+                                    'none', '0', 'unlimited',
+                                    stdin=b'2017-01-02T00:00:00Z,'
+                                          b'2017-01-02T05:00:00Z,'
+                                          b'none,0,0\n')
+        info.check_returncode()
+
+        # Errors should give the line number.
+        info = self.runMogwaiTariff('build', '--from-csv', '-',
+                                    'csv', 'csv',
+                                    stdin=b'2017-01-01T00:00:00Z,'
+                                          b'2018-01-01T00:00:00Z,'
+                                          b'none,0,unlimited\n'
+                                          b'2017-01-02T00:00:00Z,'
+                                          b'2017-01-02T05:00:00Z,'
+                                          b'none,0\n')
+        out = normalise_output(info.stdout)
+        self.assertIn('line 2', out)
+        self.assertEqual(info.returncode, 1)  # EXIT_INVALID_OPTIONS
+
+        os.remove('csv')
+        os.remove('periods.csv')
+
+    def test_build_base64(self):
+        """Test building a base64-encoded tariff."""
+        period_args = ['2017-01-01T00:00:00Z', '2018-01-01T00:00:00Z',
+                       'none', '0', 'unlimited']
+        info = self.runMogwaiTariff('build', 'tariff-bin', 'bin', *period_args)
+        info.check_returncode()
+        info = self.runMogwaiTariff('build', '--base64', 'tariff-b64', 'bin',
+                                    *period_args)
+        info.check_returncode()
+
+        with open('tariff-bin', 'rb') as f:
+            binary = f.read()
+        with open('tariff-b64', 'rb') as f:
+            encoded = f.read()
+
+        # The output should be plain base64 of the binary tariff, with no
+        # trailing newline, so it can be used directly as the value of
+        # connection.tariff-bin.
+        self.assertEqual(base64.b64decode(encoded, validate=True), binary)
+
+        # --base64 is only valid for build.
+        info = self.runMogwaiTariff('dump', '--base64', 'tariff-bin')
+        self.assertEqual(info.returncode, 1)  # EXIT_INVALID_OPTIONS
+
+        os.remove('tariff-bin')
+        os.remove('tariff-b64')
+
+    def test_lookup_batch(self):
+        """Test looking up several times from stdin in a tariff."""
+        info = self.runMogwaiTariff('build', 'batch', 'batch',
+                                    '2017-01-01T00:00:00Z',
+                                    '2018-01-01T00:00:00Z',
+                                    'none', '0', 'unlimited',
+                                    '2017-01-02T00:00:00Z',
+                                    '2017-01-02T05:00:00Z',
+                                    'day', '1', '2000000')
+        info.check_returncode()
+        self.assertTrue(os.path.exists('batch'))
+
+        # The times are mostly sorted, so most lookups will use the cursor,
+        # but the last one goes backwards.
+        info = self.runMogwaiTariff('lookup', '--batch', 'batch',
+                                    stdin=b'2017-01-01T01:00:00Z\n'
+                                          b'2017-01-01T02:00:00Z\n'
+                                          b'\n'
+                                          b'2017-01-03T01:00:00Z\n'
+                                          b'2017-01-03T04:59:59Z\n'
+                                          b'2017-01-03T05:00:00Z\n'
+                                          b'2019-01-01T06:00:00Z\n'
+                                          b'2017-01-02T00:00:00Z\n')
+        info.check_returncode()
+        out = normalise_output(info.stdout)
+        self.assertEqual(
+            '2017-01-01T01:00:00Z\t2017-01-01T00:00:00+00\t'
+            '2018-01-01T00:00:00+00\tunlimited\n'
+            '2017-01-01T02:00:00Z\t2017-01-01T00:00:00+00\t'
+            '2018-01-01T00:00:00+00\tunlimited\n'
+            '2017-01-03T01:00:00Z\t2017-01-03T00:00:00+00\t'
+            '2017-01-03T05:00:00+00\t2000000\n'
+            '2017-01-03T04:59:59Z\t2017-01-03T00:00:00+00\t'
+            '2017-01-03T05:00:00+00\t2000000\n'
+            '2017-01-03T05:00:00Z\t2017-01-01T00:00:00+00\t'
+            '2018-01-01T00:00:00+00\tunlimited\n'
+            '2019-01-01T06:00:00Z\t-\t-\t-\n'
+            '2017-01-02T00:00:00Z\t2017-01-02T00:00:00+00\t'
+            '2017-01-02T05:00:00+00\t2000000', out)
+
+        # Invalid times should cause an error after the preceding results.
+        info = self.runMogwaiTariff('lookup', '--batch', 'batch',
+                                    stdin=b'2017-01-01T01:00:00Z\n'
+                                          b'not a time\n')
+        out = normalise_output(info.stdout)
+        self.assertIn('2017-01-01T01:00:00Z\t', out)
+        self.assertIn('on line 2', out)
+        self.assertEqual(info.returncode, 3)  # EXIT_FAILED
+
+        os.remove('batch')
+
     def test_timezones(self):
         """Test building and dumping a tariff with non-UTC timezones."""
         info = self.runMogwaiTariff('build', 'tz', 'tz',
@@ -175,6 +312,32 @@ class TestMogwaiTariff(unittest.TestCase):
 
         os.remove('tz')
 
+    def test_bench(self):
+        """Test benchmarking queries on a tariff."""
+        info = self.runMogwaiTariff('build', 'bench', 'bench',
+                                    '2017-01-01T00:00:00Z',
+                                    '2018-01-01T00:00:00Z',
+                                    'none', '0', 'unlimited',
+                                    '2017-01-02T00:00:00Z',
+                                    '2017-01-02T05:00:00Z',
+                                    'day', '1', '2000000')
+        info.check_returncode()
+        self.assertTrue(os.path.exists('bench'))
+
+        info = self.runMogwaiTariff('bench', 'bench', '1000')
+        info.check_returncode()
+        out = normalise_output(info.stdout)
+        self.assertIn('Tariff ‘bench’: 2 periods\n', out)
+        self.assertIn('Querying 1000 random times', out)
+        self.assertIn('lookup_period ', out)
+        self.assertIn('get_next_transition_usec ', out)
+
+        # Invalid numbers of queries should be rejected.
+        info = self.runMogwaiTariff('bench', 'bench', '0')
+        self.assertEqual(info.returncode, 1)  # EXIT_INVALID_OPTIONS
+
+        os.remove('bench')
+
 
 if __name__ == '__main__':
     unittest.main(testRunner=taptestrunner.TAPTestRunner())